@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Calibrate every compiled codec on this host and print the cost table,
+ * then break encode and decode down with hardware performance counters
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define SECONDS 5
+
+static const struct {
+	int sample_rate;
+	int num_channels;
+} configs[] = {
+	{ 8000, 1 },
+	{ 16000, 1 },
+	{ 48000, 1 },
+	{ 48000, 2 },
+};
+
+static void print_config(int sample_rate, int num_channels)
+{
+	struct mux_codec_cost cost;
+	int i;
+
+	for (i = 0; i < MUX_CODEC_MAX; i++) {
+		if (mux_codec_cost(i, sample_rate, num_channels,
+				   &cost) != MUX_OK)
+			continue;
+
+		printf("%-8s %6d %2d %12llu %12llu %9.1f %6d %8.1f %8d%s\n",
+		       mux_codec_to_name(i), sample_rate, num_channels,
+		       (unsigned long long)cost.encode_ns_per_sec,
+		       (unsigned long long)cost.decode_ns_per_sec,
+		       cost.encode_ns_per_sec ?
+		       1e9 / (double)cost.encode_ns_per_sec : 0.0,
+		       cost.frame_samples,
+		       cost.latency_samples * 1000.0 / sample_rate,
+		       cost.bytes_per_sec,
+		       cost.calibrated ? "" : "  (nominal)");
+	}
+}
+
+/* First configuration the codec accepts, widest first */
+static struct mux_encoder *open_encoder(enum mux_codec_type codec,
+					int *sample_rate, int *num_channels)
+{
+	struct mux_encoder *enc;
+	size_t i;
+
+	for (i = sizeof(configs) / sizeof(configs[0]); i-- > 0;) {
+		enc = mux_encoder_new(codec, configs[i].sample_rate,
+				      configs[i].num_channels, 2, NULL, 0);
+		if (enc) {
+			*sample_rate = configs[i].sample_rate;
+			*num_channels = configs[i].num_channels;
+			return enc;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Encode then decode SECONDS of PCM in 20 ms chunks, counting each
+ * stage separately; only library calls are inside the regions
+ */
+static void profile_codec(enum mux_codec_type codec)
+{
+	struct bench_perf enc_perf, dec_perf;
+	struct mux_encoder *enc;
+	struct mux_decoder *dec;
+	int16_t pcm[48000 / 50 * 2];
+	uint8_t out[65536], *stream = NULL, *p;
+	size_t len = 0, cap = 0, frames, consumed, written, pos;
+	int sample_rate, num_channels, stream_type, i;
+
+	enc = open_encoder(codec, &sample_rate, &num_channels);
+	if (!enc)
+		return;
+
+	memset(&enc_perf, 0, sizeof(enc_perf));
+	memset(&dec_perf, 0, sizeof(dec_perf));
+	frames = sample_rate / 50;
+
+	for (i = 0; i <= SECONDS * 50; i++) {
+		if (i < SECONDS * 50)
+			bench_fill_pcm(pcm, frames, num_channels, sample_rate,
+				       (uint64_t)i * frames);
+
+		bench_perf_begin(&enc_perf);
+		if (i < SECONDS * 50)
+			mux_encoder_encode(enc, pcm,
+					   frames * num_channels * sizeof(int16_t),
+					   &consumed, MUX_STREAM_AUDIO);
+		else
+			mux_encoder_finalize(enc);
+		bench_perf_end(&enc_perf);
+
+		for (;;) {
+			bench_perf_begin(&enc_perf);
+			mux_encoder_read(enc, out, sizeof(out), &written);
+			bench_perf_end(&enc_perf);
+			if (written == 0)
+				break;
+
+			if (len + written > cap) {
+				cap = cap ? cap * 2 : 1 << 20;
+				while (cap < len + written)
+					cap *= 2;
+				p = realloc(stream, cap);
+				if (!p)
+					goto out;
+				stream = p;
+			}
+			memcpy(stream + len, out, written);
+			len += written;
+		}
+	}
+
+	dec = mux_decoder_new(codec, 2, NULL, 0);
+	if (!dec)
+		goto out;
+
+	for (pos = 0; pos <= len; pos += consumed) {
+		bench_perf_begin(&dec_perf);
+		if (pos < len) {
+			size_t n = len - pos < 4096 ? len - pos : 4096;
+
+			if (mux_decoder_decode(dec, stream + pos, n,
+					       &consumed) != MUX_OK)
+				consumed = 0;
+		} else {
+			mux_decoder_finalize(dec);
+			consumed = 1;
+		}
+		do {
+			mux_decoder_read(dec, out, sizeof(out), &written,
+					 &stream_type);
+		} while (written > 0);
+		bench_perf_end(&dec_perf);
+
+		if (consumed == 0)
+			break;
+	}
+	mux_decoder_destroy(dec);
+
+	frames = (size_t)SECONDS * sample_rate;
+	bench_perf_print(mux_codec_to_name(codec), "encode", &enc_perf,
+			 frames, frames * num_channels * sizeof(int16_t));
+	bench_perf_print(mux_codec_to_name(codec), "decode", &dec_perf,
+			 frames, frames * num_channels * sizeof(int16_t));
+
+out:
+	mux_encoder_destroy(enc);
+	free(stream);
+}
+
+int main(void)
+{
+	enum mux_codec_type codec;
+	size_t i;
+
+	printf("%-8s %6s %2s %12s %12s %9s %6s %8s %8s\n",
+	       "codec", "rate", "ch", "enc ns/s", "dec ns/s", "enc x RT",
+	       "frame", "lat ms", "bytes/s");
+
+	for (i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+		mux_calibrate_all(configs[i].sample_rate,
+				  configs[i].num_channels);
+		print_config(configs[i].sample_rate, configs[i].num_channels);
+	}
+
+	printf("\nCheapest codec for 8 kHz mono, <= 40 ms, <= 2 KB/s: ");
+	if (mux_codec_select(8000, 1, 40, 2000, &codec) == MUX_OK)
+		printf("%s\n", mux_codec_to_name(codec));
+	else
+		printf("none\n");
+
+	printf("\nPer-stage counters, %d s of PCM per codec, per sample frame "
+	       "and per PCM byte\n", SECONDS);
+	if (!bench_perf_open())
+		printf("(hardware counters unavailable, CPU time only)\n");
+	bench_perf_print_header();
+	for (i = 0; i < MUX_CODEC_MAX; i++)
+		profile_codec(i);
+	bench_perf_close();
+
+	return 0;
+}
@@ -0,0 +1,210 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Lateness of high-priority calls on an overloaded host: one thread
+ * serves 20 ms ticks of more calls than it can encode in real time,
+ * the high-priority tenth last in every tick. Without the governor
+ * every call falls behind; with it the low priorities are degraded or
+ * shed until the rest keep up.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define TICK_MS      20
+#define TICKS        150          /* 3 s */
+#define UPDATE_TICKS 5            /* governor update every 100 ms */
+#define DEMAND_PCT   150          /* of one CPU */
+#define MAX_CALLS    50000
+#define POOL         256
+
+struct scenario {
+	const char *name;
+	enum mux_codec_type codec;
+	int rate;
+};
+
+static const struct scenario scenarios[] = {
+	{ "A-law", MUX_CODEC_ALAW, 8000 },
+	{ "Opus",  MUX_CODEC_OPUS, 48000 },
+};
+
+struct result {
+	uint64_t late_p50;            /* ns past the tick, high priority */
+	uint64_t late_max;
+	int shed;
+	int lowered;
+};
+
+static uint8_t out[1 << 16];
+
+static int encode(struct mux_encoder *enc, const int16_t *pcm, size_t frames)
+{
+	size_t consumed, written;
+	int ret;
+
+	ret = mux_encoder_encode(enc, pcm, frames * sizeof(*pcm), &consumed,
+				 MUX_STREAM_AUDIO);
+	while (mux_encoder_read(enc, out, sizeof(out), &written) == MUX_OK &&
+	       written > 0)
+		;
+	return ret;
+}
+
+static void sleep_until(uint64_t t)
+{
+	uint64_t now = bench_now_ns();
+	struct timespec ts;
+
+	if (now >= t)
+		return;
+	ts.tv_sec = (time_t)((t - now) / 1000000000ULL);
+	ts.tv_nsec = (long)((t - now) % 1000000000ULL);
+	nanosleep(&ts, NULL);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Calls needed for DEMAND_PCT of one CPU, timed over a pool of calls */
+static int size_calls(const struct scenario *s, const int16_t *pcm,
+		      size_t frames)
+{
+	struct mux_encoder *pool[POOL];
+	uint64_t t0, ns = 0;
+	int i, pass, n;
+
+	for (n = 0; n < POOL; n++) {
+		pool[n] = mux_encoder_new(s->codec, s->rate, 1, 1, NULL, 0);
+		if (!pool[n])
+			break;
+	}
+	if (n == POOL) {
+		t0 = bench_now_ns();
+		for (pass = 0; pass < 5; pass++)
+			for (i = 0; i < POOL; i++)
+				encode(pool[i], pcm, frames);
+		ns = (bench_now_ns() - t0) / (5 * POOL);
+	}
+	for (i = 0; i < n; i++)
+		mux_encoder_destroy(pool[i]);
+	if (n < POOL)
+		return 0;
+
+	n = (int)((uint64_t)TICK_MS * 1000000 * DEMAND_PCT / 100 /
+		  (ns ? ns : 1));
+	return n < MAX_CALLS ? n : MAX_CALLS;
+}
+
+static int run(const struct scenario *s, const int16_t *pcm, size_t frames,
+	       int calls, int governed, struct result *r)
+{
+	struct mux_governor_config cfg;
+	struct mux_governor_stats stats;
+	struct mux_governor *g = NULL;
+	struct mux_encoder **encs;
+	uint64_t *late, start, deadline, now;
+	int high = calls / 10, i, t, n_late = 0, ret = 0;
+
+	encs = calloc((size_t)calls, sizeof(*encs));
+	late = calloc((size_t)TICKS * (size_t)high, sizeof(*late));
+	if (!encs || !late) {
+		free(encs);
+		free(late);
+		return -1;
+	}
+
+	if (governed) {
+		memset(&cfg, 0, sizeof(cfg));
+		cfg.cpus = 1;
+		cfg.admit_load_pct = 100;
+		cfg.protected_priority = 2;
+		g = mux_governor_new(&cfg);
+		if (!g)
+			ret = -1;
+	}
+
+	/* High priority last, so it waits for everything else */
+	for (i = 0; i < calls && ret == 0; i++) {
+		encs[i] = mux_encoder_new(s->codec, s->rate, 1, 1, NULL, 0);
+		if (!encs[i])
+			ret = -1;
+		else if (g)
+			mux_governor_admit(g, encs[i], (uint32_t)i,
+					   i >= calls - high ? 2 : 1);
+	}
+
+	start = bench_now_ns();
+	for (t = 0; t < TICKS && ret == 0; t++) {
+		deadline = start + (uint64_t)(t + 1) * TICK_MS * 1000000;
+		for (i = 0; i < calls; i++) {
+			encode(encs[i], pcm, frames);
+			if (i >= calls - high) {
+				now = bench_now_ns();
+				late[n_late++] = now > deadline ? now - deadline : 0;
+			}
+		}
+		if (g && t % UPDATE_TICKS == 0)
+			mux_governor_update(g);
+		sleep_until(deadline);
+	}
+
+	memset(r, 0, sizeof(*r));
+	if (g && mux_governor_get_stats(g, &stats) == MUX_OK) {
+		r->shed = (int)stats.actions[MUX_GOVERN_SHED_SESSION];
+		r->lowered = (int)(stats.actions[MUX_GOVERN_COMPLEXITY_LOWERED] +
+				   stats.actions[MUX_GOVERN_DTX_ON]);
+	}
+	if (n_late) {
+		qsort(late, (size_t)n_late, sizeof(*late), cmp_u64);
+		r->late_p50 = late[n_late / 2];
+		r->late_max = late[n_late - 1];
+	}
+
+	for (i = 0; i < calls; i++)
+		mux_encoder_destroy(encs[i]);
+	mux_governor_destroy(g);
+	free(encs);
+	free(late);
+	return ret;
+}
+
+int main(void)
+{
+	static int16_t pcm[48000 / 50];
+	struct result plain, gov;
+	size_t i, frames;
+	int calls;
+
+	printf("%d ms ticks for %d s, %d%% of one CPU demanded\n\n", TICK_MS,
+	       TICKS * TICK_MS / 1000, DEMAND_PCT);
+	printf("%-6s %6s | %10s %10s | %10s %10s %6s %8s\n", "", "", "plain",
+	       "", "governed", "", "", "");
+	printf("%-6s %6s | %10s %10s | %10s %10s %6s %8s\n", "codec", "calls",
+	       "p50 ms", "max ms", "p50 ms", "max ms", "shed", "lowered");
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		const struct scenario *s = &scenarios[i];
+
+		frames = (size_t)s->rate / 50;
+		bench_fill_pcm(pcm, frames, 1, s->rate, 0);
+		calls = size_calls(s, pcm, frames);
+		if (calls < 10 || run(s, pcm, frames, calls, 0, &plain) != 0 ||
+		    run(s, pcm, frames, calls, 1, &gov) != 0) {
+			printf("%-6s (not available)\n", s->name);
+			continue;
+		}
+
+		printf("%-6s %6d | %10.2f %10.2f | %10.2f %10.2f %6d %8d\n",
+		       s->name, calls, (double)plain.late_p50 / 1e6,
+		       (double)plain.late_max / 1e6, (double)gov.late_p50 / 1e6,
+		       (double)gov.late_max / 1e6, gov.shed, gov.lowered);
+	}
+	return 0;
+}
@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Channel-group encode and decode throughput of a 32-channel stream in
+ * stereo pairs, by worker thread count, in multiples of real time
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE      48000
+#define CHANNELS  32
+#define SECONDS   5
+#define FRAMES    (RATE / 50)
+
+static int16_t pcm[FRAMES * CHANNELS];
+
+static int run(enum mux_codec_type codec, int threads, double *enc_x,
+	       double *dec_x)
+{
+	struct mux_param ep[] = {
+		{ .name = "channel_groups", .value.i = 2 },
+		{ .name = "threads", .value.i = threads },
+	};
+	struct mux_param dp[] = {
+		{ .name = "channel_groups", .value.b = 1 },
+		{ .name = "threads", .value.i = threads },
+		{ .name = "max_channels", .value.i = CHANNELS },
+	};
+	static uint8_t buf[1 << 16];
+	struct mux_encoder *enc;
+	struct mux_decoder *dec;
+	uint8_t *stream = NULL, *p;
+	size_t len = 0, cap = 0, consumed, written;
+	uint64_t t0;
+	int i, type, ret = -1;
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 1, ep, 2);
+	dec = mux_decoder_new(codec, 1, dp, 3);
+	if (!enc || !dec)
+		goto out;
+
+	t0 = bench_now_ns();
+	for (i = 0; i <= SECONDS * 50; i++) {
+		if (i < SECONDS * 50)
+			mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+					   MUX_STREAM_AUDIO);
+		else
+			mux_encoder_finalize(enc);
+		while (mux_encoder_read(enc, buf, sizeof(buf), &written) ==
+		       MUX_OK && written > 0) {
+			if (len + written > cap) {
+				cap = (len + written) * 2;
+				p = realloc(stream, cap);
+				if (!p)
+					goto out;
+				stream = p;
+			}
+			memcpy(stream + len, buf, written);
+			len += written;
+		}
+	}
+	*enc_x = SECONDS * 1e9 / (double)(bench_now_ns() - t0);
+
+	t0 = bench_now_ns();
+	for (i = 0; (size_t)i * 4096 < len; i++) {
+		written = len - (size_t)i * 4096;
+		mux_decoder_decode(dec, stream + (size_t)i * 4096,
+				   written < 4096 ? written : 4096, &consumed);
+		while (mux_decoder_read(dec, buf, sizeof(buf), &written,
+					&type) == MUX_OK && written > 0)
+			;
+	}
+	mux_decoder_finalize(dec);
+	while (mux_decoder_read(dec, buf, sizeof(buf), &written, &type) ==
+	       MUX_OK && written > 0)
+		;
+	*dec_x = SECONDS * 1e9 / (double)(bench_now_ns() - t0);
+	ret = 0;
+
+out:
+	free(stream);
+	mux_encoder_destroy(enc);
+	mux_decoder_destroy(dec);
+	return ret;
+}
+
+int main(void)
+{
+	static const enum mux_codec_type codecs[] = {
+		MUX_CODEC_PCM, MUX_CODEC_ALAW, MUX_CODEC_FLAC,
+		MUX_CODEC_OPUS, MUX_CODEC_VORBIS,
+	};
+	static const int threads[] = { 1, 2, 4, 8, 16 };
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	double enc_x, dec_x;
+	size_t i, t;
+
+	printf("%d channels in stereo pairs, %d Hz, %d s; %ld CPUs\n\n",
+	       CHANNELS, RATE, SECONDS, cpus);
+	printf("%-8s %8s %14s %14s\n", "codec", "threads", "encode x rt",
+	       "decode x rt");
+
+	bench_fill_pcm(pcm, FRAMES, CHANNELS, RATE, 0);
+	for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+			/* More threads than CPUs only measures the scheduler */
+			if (t > 0 && threads[t] > cpus)
+				break;
+			if (run(codecs[i], threads[t], &enc_x, &dec_x) != 0)
+				break;
+			printf("%-8s %8d %14.1f %14.1f\n",
+			       mux_codec_to_name(codecs[i]), threads[t],
+			       enc_x, dec_x);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Memory held by idle sessions before and after hibernation, and the
+ * cost of hibernating and waking them again
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE      16000
+#define CHANNELS  1
+#define SESSIONS  1000
+#define CHUNKS    50         /* 1 s of 20 ms chunks before parking */
+#define CHUNK     (RATE / 50)
+
+struct session {
+	struct mux_encoder *enc;
+	struct mux_decoder *dec;
+};
+
+/* Push some audio through both halves of a session, then drain */
+static int warm_up(struct session *s, uint64_t first_frame)
+{
+	int16_t pcm[CHUNK * CHANNELS];
+	uint8_t buf[16384];
+	size_t consumed, written;
+	int i, stream_type;
+
+	for (i = 0; i < CHUNKS; i++) {
+		bench_fill_pcm(pcm, CHUNK, CHANNELS, RATE,
+			       first_frame + (uint64_t)i * CHUNK);
+		if (mux_encoder_encode(s->enc, pcm, sizeof(pcm), &consumed,
+				       MUX_STREAM_AUDIO) != MUX_OK)
+			return -1;
+		while (mux_encoder_read(s->enc, buf, sizeof(buf), &written) ==
+		       MUX_OK && written > 0) {
+			if (mux_decoder_decode(s->dec, buf, written,
+					       &consumed) != MUX_OK)
+				return -1;
+		}
+		do {
+			stream_type = -1;
+			mux_decoder_read(s->dec, buf, sizeof(buf), &written,
+					 &stream_type);
+		} while (written > 0);
+	}
+
+	return 0;
+}
+
+static size_t total_memory(const struct session *s, int n)
+{
+	size_t bytes = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		bytes += mux_encoder_memory_usage(s[i].enc) +
+			 mux_decoder_memory_usage(s[i].dec);
+
+	return bytes;
+}
+
+static void destroy_sessions(struct session *s, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		mux_encoder_destroy(s[i].enc);
+		mux_decoder_destroy(s[i].dec);
+	}
+}
+
+static int bench_codec(enum mux_codec_type codec)
+{
+	struct session *s;
+	size_t before, after;
+	uint64_t t0, hib_ns, wake_ns;
+	int i, n = 0;
+
+	s = calloc(SESSIONS, sizeof(*s));
+	if (!s)
+		return -1;
+
+	for (n = 0; n < SESSIONS; n++) {
+		s[n].enc = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+		s[n].dec = mux_decoder_new(codec, 2, NULL, 0);
+		if (!s[n].enc || !s[n].dec || warm_up(&s[n], 0) != 0) {
+			n++;
+			destroy_sessions(s, n);
+			free(s);
+			return -1;
+		}
+	}
+
+	before = total_memory(s, n);
+
+	t0 = bench_now_ns();
+	for (i = 0; i < n; i++) {
+		mux_encoder_hibernate(s[i].enc);
+		mux_decoder_hibernate(s[i].dec);
+	}
+	hib_ns = bench_now_ns() - t0;
+
+	after = total_memory(s, n);
+
+	t0 = bench_now_ns();
+	for (i = 0; i < n; i++) {
+		mux_encoder_wake(s[i].enc);
+		mux_decoder_wake(s[i].dec);
+	}
+	wake_ns = bench_now_ns() - t0;
+
+	printf("%-8s %10zu %10zu %9.1f%% %10.2f %10.2f\n",
+	       mux_codec_to_name(codec), before / n, after / n,
+	       100.0 * (double)(before - after) / (double)before,
+	       (double)hib_ns / n / 1e3, (double)wake_ns / n / 1e3);
+
+	destroy_sessions(s, n);
+	free(s);
+	return 0;
+}
+
+int main(void)
+{
+	int i, benched = 0;
+
+	printf("Idle session memory, %d sessions (encoder + decoder), "
+	       "%d Hz %d ch\n\n", SESSIONS, RATE, CHANNELS);
+	printf("%-8s %10s %10s %10s %10s %10s\n", "codec", "bytes",
+	       "parked", "released", "park us", "wake us");
+
+	for (i = 0; i < MUX_CODEC_MAX; i++) {
+		if (bench_codec(i) == 0)
+			benched++;
+	}
+
+	if (!benched)
+		printf("No codecs available\n");
+
+	return 0;
+}
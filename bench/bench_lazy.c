@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Load a whole stream into a decoder and read back only the start of it,
+ * as a player does when a clip is queued and then skipped: eager
+ * decoding against lazy=1 for buffered memory and CPU spent
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE      48000
+#define CHANNELS  2
+#define SECONDS   60
+#define PASSES    5
+
+struct stream {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+static int append(struct stream *s, const uint8_t *data, size_t size)
+{
+	if (s->size + size > s->capacity) {
+		size_t cap = s->capacity ? s->capacity * 2 : 65536;
+		uint8_t *p;
+
+		while (cap < s->size + size)
+			cap *= 2;
+		p = realloc(s->data, cap);
+		if (!p)
+			return -1;
+		s->data = p;
+		s->capacity = cap;
+	}
+
+	memcpy(s->data + s->size, data, size);
+	s->size += size;
+	return 0;
+}
+
+static int encode_stream(enum mux_codec_type codec, struct stream *s)
+{
+	const size_t frames = RATE / 50;
+	struct mux_encoder *enc;
+	int16_t pcm[RATE / 50 * CHANNELS];
+	uint8_t out[65536];
+	size_t consumed, written;
+	int i;
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 1, NULL, 0);
+	if (!enc)
+		return -1;
+
+	for (i = 0; i < SECONDS * 50; i++) {
+		bench_fill_pcm(pcm, frames, CHANNELS, RATE,
+			       (uint64_t)i * frames);
+		mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				   MUX_STREAM_AUDIO);
+		while (mux_encoder_read(enc, out, sizeof(out), &written) ==
+		       MUX_OK && written > 0)
+			append(s, out, written);
+	}
+
+	mux_encoder_finalize(enc);
+	while (mux_encoder_read(enc, out, sizeof(out), &written) == MUX_OK &&
+	       written > 0)
+		append(s, out, written);
+
+	mux_encoder_destroy(enc);
+	return 0;
+}
+
+/*
+ * Feed the whole stream, then read percent of its audio; returns the
+ * peak buffered bytes and CPU ns
+ */
+static int run(enum mux_codec_type codec, const struct stream *s,
+	       int lazy, int percent, size_t *mem, uint64_t *cpu)
+{
+	const struct mux_param params[] = {
+		{ .name = "lazy", .value.b = lazy },
+	};
+	static uint8_t out[1 << 16];
+	struct mux_decoder *dec;
+	size_t want, got = 0, consumed, written;
+	uint64_t c0;
+	int stream_type;
+
+	want = (size_t)SECONDS * RATE * CHANNELS * 2 / 100 * percent;
+	dec = mux_decoder_new(codec, 1, params, 1);
+	if (!dec)
+		return -1;
+
+	c0 = bench_cpu_ns();
+	if (mux_decoder_decode(dec, s->data, s->size, &consumed) != MUX_OK ||
+	    mux_decoder_finalize(dec) != MUX_OK) {
+		mux_decoder_destroy(dec);
+		return -1;
+	}
+	*mem = mux_decoder_memory_usage(dec);
+
+	while (got < want &&
+	       mux_decoder_read(dec, out, sizeof(out), &written,
+				&stream_type) ==
+	       MUX_OK && written > 0)
+		got += written;
+	*cpu = bench_cpu_ns() - c0;
+
+	mux_decoder_destroy(dec);
+	return 0;
+}
+
+int main(void)
+{
+	static const enum mux_codec_type codecs[] = {
+		MUX_CODEC_PCM, MUX_CODEC_ALAW, MUX_CODEC_OPUS, MUX_CODEC_FLAC,
+	};
+	static const int percents[] = { 10, 100 };
+	size_t i, p, eager_mem, lazy_mem;
+	uint64_t eager_cpu, lazy_cpu, ns;
+	int pass;
+
+	printf("Whole stream queued, part of it read, %d Hz %d ch, %d s\n\n",
+	       RATE, CHANNELS, SECONDS);
+	printf("%-8s %5s %12s %12s %12s %12s\n", "codec", "read", "eager KiB",
+	       "lazy KiB", "eager cpu ms", "lazy cpu ms");
+
+	for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		struct stream s = { NULL, 0, 0 };
+
+		if (encode_stream(codecs[i], &s) != 0) {
+			free(s.data);
+			continue;
+		}
+
+		for (p = 0; p < sizeof(percents) / sizeof(percents[0]); p++) {
+			eager_cpu = lazy_cpu = 0;
+			for (pass = 0; pass < PASSES; pass++) {
+				if (run(codecs[i], &s, 0, percents[p],
+					&eager_mem, &ns) != 0)
+					break;
+				eager_cpu += ns;
+				if (run(codecs[i], &s, 1, percents[p],
+					&lazy_mem, &ns) != 0)
+					break;
+				lazy_cpu += ns;
+			}
+			if (pass != PASSES)
+				break;
+
+			printf("%-8s %4d%% %12zu %12zu %12.2f %12.2f\n",
+			       mux_codec_to_name(codecs[i]), percents[p],
+			       eager_mem / 1024, lazy_mem / 1024,
+			       (double)eager_cpu / PASSES / 1e6,
+			       (double)lazy_cpu / PASSES / 1e6);
+		}
+
+		free(s.data);
+	}
+
+	return 0;
+}
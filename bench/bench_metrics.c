@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Cost of shared-memory metrics: encode+read of 20 ms chunks without
+ * metrics, with a session attached, and with another process scraping
+ * the page in a tight loop; then the reader's own cost per scrape
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE      48000
+#define CHANNELS  1
+#define FRAMES    (RATE / 50)
+#define ITERS     200000
+#define SLOTS     64
+#define SCRAPES   200000
+
+enum mode { OFF, ATTACHED, SCRAPED };
+
+static void scrape(struct mux_metrics *m)
+{
+	struct mux_metrics *r = mux_metrics_open(mux_metrics_fd(m));
+	struct mux_metrics_counters total;
+
+	if (!r)
+		_exit(1);
+	for (;;)
+		mux_metrics_read_total(r, &total);
+}
+
+static int run(enum mux_codec_type codec, enum mode mode, double *ns_per_call)
+{
+	static int16_t pcm[FRAMES * CHANNELS];
+	static uint8_t out[16384];
+	struct mux_metrics *m = NULL;
+	struct mux_encoder *enc;
+	size_t consumed, written;
+	pid_t scraper = -1;
+	uint64_t t0;
+	int i, status, ret = 0;
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 1, NULL, 0);
+	if (!enc)
+		return -1;
+
+	if (mode != OFF) {
+		m = mux_metrics_create(NULL, SLOTS);
+		if (!m || mux_encoder_set_metrics(enc, m, "bench") != MUX_OK) {
+			mux_encoder_destroy(enc);
+			mux_metrics_close(m);
+			return -1;
+		}
+	}
+	if (mode == SCRAPED) {
+		scraper = fork();
+		if (scraper == 0)
+			scrape(m);
+	}
+
+	bench_fill_pcm(pcm, FRAMES, CHANNELS, RATE, 0);
+	t0 = bench_now_ns();
+	for (i = 0; i < ITERS; i++) {
+		if (mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				       MUX_STREAM_AUDIO) != MUX_OK ||
+		    mux_encoder_read(enc, out, sizeof(out), &written) != MUX_OK) {
+			ret = -1;
+			break;
+		}
+	}
+	*ns_per_call = (double)(bench_now_ns() - t0) / ITERS / 2;
+
+	if (scraper > 0) {
+		kill(scraper, SIGKILL);
+		waitpid(scraper, &status, 0);
+	}
+	mux_encoder_destroy(enc);
+	mux_metrics_close(m);
+	return ret;
+}
+
+/* Scrape cost with every slot in use */
+static int reader_cost(double *slot_ns, double *total_ns)
+{
+	struct mux_metrics *m, *r;
+	struct mux_encoder *enc[SLOTS];
+	struct mux_metrics_session s;
+	struct mux_metrics_counters total;
+	uint64_t t0;
+	int i, ret = -1;
+
+	memset(enc, 0, sizeof(enc));
+	m = mux_metrics_create(NULL, SLOTS);
+	r = m ? mux_metrics_open(mux_metrics_fd(m)) : NULL;
+	if (!r)
+		goto out;
+	for (i = 0; i < SLOTS; i++) {
+		enc[i] = mux_encoder_new(MUX_CODEC_PCM, RATE, CHANNELS, 1,
+					 NULL, 0);
+		if (!enc[i] || mux_encoder_set_metrics(enc[i], m, "s") != MUX_OK)
+			goto out;
+	}
+
+	t0 = bench_now_ns();
+	for (i = 0; i < SCRAPES; i++)
+		mux_metrics_read(r, i % SLOTS, &s);
+	*slot_ns = (double)(bench_now_ns() - t0) / SCRAPES;
+
+	t0 = bench_now_ns();
+	for (i = 0; i < SCRAPES / SLOTS; i++)
+		mux_metrics_read_total(r, &total);
+	*total_ns = (double)(bench_now_ns() - t0) / (SCRAPES / SLOTS);
+	ret = 0;
+
+out:
+	for (i = 0; i < SLOTS; i++)
+		mux_encoder_destroy(enc[i]);
+	mux_metrics_close(r);
+	mux_metrics_close(m);
+	return ret;
+}
+
+int main(void)
+{
+	static const enum mux_codec_type codecs[] = {
+		MUX_CODEC_PCM, MUX_CODEC_ALAW, MUX_CODEC_OPUS,
+	};
+	static const char *const modes[] = { "off", "attached", "scraped" };
+	double ns, base, slot_ns, total_ns;
+	size_t i;
+	int mode, last;
+
+	printf("Encode + read of 20 ms chunks, %d Hz %d ch, %d iterations\n\n",
+	       RATE, CHANNELS, ITERS);
+	printf("%-8s %-9s %12s %10s\n", "codec", "metrics", "ns/call",
+	       "overhead");
+
+	/* A spinning scraper on the only CPU measures the scheduler */
+	last = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SCRAPED : ATTACHED;
+
+	for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		base = 0;
+		for (mode = OFF; mode <= last; mode++) {
+			if (run(codecs[i], mode, &ns) != 0)
+				break;
+			if (mode == OFF)
+				base = ns;
+			printf("%-8s %-9s %12.1f %+10.1f\n",
+			       mux_codec_to_name(codecs[i]), modes[mode], ns,
+			       ns - base);
+		}
+	}
+
+	if (reader_cost(&slot_ns, &total_ns) == 0)
+		printf("\nReader: %.1f ns per slot, %.1f ns for totals of %d slots\n",
+		       slot_ns, total_ns, SLOTS);
+	else
+		printf("\nShared-memory metrics not available\n");
+
+	return 0;
+}
@@ -0,0 +1,181 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Compare decode CPU per stream at full fidelity against the reduced
+ * monitoring output (output_rate=8000, output_channels=1)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE      48000
+#define CHANNELS  2
+#define SECONDS   10
+#define PASSES    3
+
+struct stream {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+static int append(struct stream *s, const uint8_t *data, size_t size)
+{
+	if (s->size + size > s->capacity) {
+		size_t cap = s->capacity ? s->capacity * 2 : 65536;
+		uint8_t *p;
+
+		while (cap < s->size + size)
+			cap *= 2;
+		p = realloc(s->data, cap);
+		if (!p)
+			return -1;
+		s->data = p;
+		s->capacity = cap;
+	}
+
+	memcpy(s->data + s->size, data, size);
+	s->size += size;
+	return 0;
+}
+
+static int encode_stream(enum mux_codec_type codec, struct stream *s)
+{
+	const size_t frames = RATE / 50;
+	struct mux_encoder *enc;
+	int16_t pcm[RATE / 50 * CHANNELS];
+	uint8_t out[65536];
+	size_t consumed, written;
+	int i;
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	if (!enc)
+		return -1;
+
+	for (i = 0; i < SECONDS * 50; i++) {
+		bench_fill_pcm(pcm, frames, CHANNELS, RATE,
+			       (uint64_t)i * frames);
+		mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				   MUX_STREAM_AUDIO);
+		while (mux_encoder_read(enc, out, sizeof(out), &written) ==
+		       MUX_OK && written > 0)
+			append(s, out, written);
+	}
+
+	mux_encoder_finalize(enc);
+	while (mux_encoder_read(enc, out, sizeof(out), &written) == MUX_OK &&
+	       written > 0)
+		append(s, out, written);
+
+	mux_encoder_destroy(enc);
+	return 0;
+}
+
+/*
+ * Decode the whole stream, returning CPU ns and decoded audio bytes
+ */
+static int decode_stream(enum mux_codec_type codec, const struct stream *s,
+			 const struct mux_param *params, int num_params,
+			 uint64_t *cpu_ns, size_t *audio_bytes)
+{
+	static uint8_t out[1 << 16];
+	struct mux_decoder *dec;
+	size_t pos, chunk, consumed, written;
+	int stream_type;
+	uint64_t t0;
+
+	dec = mux_decoder_new(codec, 2, params, num_params);
+	if (!dec)
+		return -1;
+
+	*audio_bytes = 0;
+	t0 = bench_cpu_ns();
+
+	for (pos = 0; pos < s->size; pos += chunk) {
+		chunk = s->size - pos < 4096 ? s->size - pos : 4096;
+		mux_decoder_decode(dec, s->data + pos, chunk, &consumed);
+		do {
+			stream_type = -1;
+			mux_decoder_read(dec, out, sizeof(out), &written,
+					 &stream_type);
+			if (stream_type == MUX_STREAM_AUDIO)
+				*audio_bytes += written;
+		} while (written > 0);
+	}
+
+	mux_decoder_finalize(dec);
+	do {
+		stream_type = -1;
+		mux_decoder_read(dec, out, sizeof(out), &written, &stream_type);
+		if (stream_type == MUX_STREAM_AUDIO)
+			*audio_bytes += written;
+	} while (written > 0);
+
+	*cpu_ns = bench_cpu_ns() - t0;
+	mux_decoder_destroy(dec);
+	return 0;
+}
+
+static void report(const char *label, uint64_t cpu_ns, size_t audio_bytes)
+{
+	double ns_per_sec = (double)cpu_ns / PASSES / SECONDS;
+
+	printf("  %-10s %10.3f ms/s %10.0f streams/core %10zu bytes\n",
+	       label, ns_per_sec / 1e6, 1e9 / ns_per_sec,
+	       audio_bytes / PASSES);
+}
+
+int main(void)
+{
+	const struct mux_param monitor[] = {
+		{ .name = "output_rate", .value.i = 8000 },
+		{ .name = "output_channels", .value.i = 1 },
+	};
+	const struct mux_param_desc *desc;
+	int i, count, pass, benched = 0;
+
+	printf("Monitoring decode, %d Hz %d ch source, %d s\n\n",
+	       RATE, CHANNELS, SECONDS);
+
+	for (i = 0; i < MUX_CODEC_MAX; i++) {
+		struct stream s = { NULL, 0, 0 };
+		uint64_t full_ns = 0, mon_ns = 0, ns;
+		size_t full_bytes = 0, mon_bytes = 0, bytes;
+
+		if (mux_get_decoder_params(i, &desc, &count) != MUX_OK ||
+		    count == 0)
+			continue;
+
+		if (encode_stream(i, &s) != 0) {
+			free(s.data);
+			continue;
+		}
+
+		for (pass = 0; pass < PASSES; pass++) {
+			if (decode_stream(i, &s, NULL, 0, &ns, &bytes) != 0)
+				break;
+			full_ns += ns;
+			full_bytes += bytes;
+
+			if (decode_stream(i, &s, monitor, 2, &ns, &bytes) != 0)
+				break;
+			mon_ns += ns;
+			mon_bytes += bytes;
+		}
+
+		if (pass == PASSES) {
+			printf("%s\n", mux_codec_to_name(i));
+			report("full", full_ns, full_bytes);
+			report("8k mono", mon_ns, mon_bytes);
+			benched++;
+		}
+
+		free(s.data);
+	}
+
+	if (!benched)
+		printf("No compiled codec supports reduced decoding\n");
+
+	return 0;
+}
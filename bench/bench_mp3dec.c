@@ -0,0 +1,302 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * In-tree MP3 decoder against libmpg123: startup cost and decode speed
+ * in multiples of real time, scalar and SIMD. The stream is LAME output
+ * when the encoder is compiled in, otherwise synthetic frames with every
+ * line in use.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE     48000
+#define SECONDS  10
+#define ROUNDS   5
+
+static uint8_t *stream;
+static size_t stream_len;
+static double stream_seconds;
+
+static int encode_lame(void)
+{
+	static int16_t pcm[RATE / 10 * 2];
+	struct mux_param p = { .name = "bitrate", .value.i = 192 };
+	static uint8_t buf[1 << 16];
+	struct mux_encoder *enc;
+	size_t consumed, written, cap = 0;
+	uint8_t *q;
+	int i;
+
+	enc = mux_encoder_new(MUX_CODEC_MP3, RATE, 2, 1, &p, 1);
+	if (!enc)
+		return -1;
+
+	for (i = 0; i <= SECONDS * 10; i++) {
+		if (i < SECONDS * 10) {
+			bench_fill_pcm(pcm, RATE / 10, 2, RATE,
+				       (uint64_t)i * (RATE / 10));
+			mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+					   MUX_STREAM_AUDIO);
+		} else {
+			mux_encoder_finalize(enc);
+		}
+		while (mux_encoder_read(enc, buf, sizeof(buf), &written) ==
+		       MUX_OK && written > 0) {
+			if (stream_len + written > cap) {
+				cap = (stream_len + written) * 2;
+				q = realloc(stream, cap);
+				if (!q)
+					break;
+				stream = q;
+			}
+			memcpy(stream + stream_len, buf, written);
+			stream_len += written;
+		}
+	}
+
+	mux_encoder_destroy(enc);
+	stream_seconds = SECONDS;
+	return stream_len ? 0 : -1;
+}
+
+static void put(uint8_t *p, size_t *pos, unsigned int v, int n)
+{
+	while (n--) {
+		if ((v >> n) & 1)
+			p[*pos >> 3] |= (uint8_t)(0x80 >> (*pos & 7));
+		(*pos)++;
+	}
+}
+
+/*
+ * 256 kbps joint stereo frames of random +-1 lines over the whole
+ * spectrum (count1 table B): full work for the filterbank
+ */
+static int synthesize(void)
+{
+	const size_t frame_bytes = 768, frames = SECONDS * RATE / 1152;
+	uint8_t main_data[768];
+	size_t f, pos, mpos, start[5];
+	int i, q, k, v;
+
+	stream = calloc(frames, frame_bytes);
+	if (!stream)
+		return -1;
+	srand(1);
+
+	for (f = 0; f < frames; f++) {
+		uint8_t *p = stream + f * frame_bytes;
+
+		memset(main_data, 0, sizeof(main_data));
+		mpos = 0;
+		/* Two granules of two channels */
+		for (i = 0; i < 4; i++) {
+			start[i] = mpos;
+			for (q = 0; q < 144; q++) {
+				v = rand() & 15;
+				put(main_data, &mpos, 15u - (unsigned int)v, 4);
+				for (k = 0; k < 4; k++)
+					if ((v >> k) & 1)
+						put(main_data, &mpos,
+						    (unsigned int)rand() & 1, 1);
+			}
+		}
+		start[4] = mpos;
+
+		pos = 0;
+		put(p, &pos, 0xfffb, 16);
+		put(p, &pos, 0xd4, 8);          /* 256 kbps, 48 kHz */
+		put(p, &pos, 0x60, 8);          /* joint stereo, M/S */
+		put(p, &pos, 0, 9 + 3 + 8);
+		for (i = 0; i < 4; i++) {
+			put(p, &pos, (unsigned int)(start[i + 1] - start[i]), 12);
+			put(p, &pos, 0, 9);
+			put(p, &pos, 190, 8);
+			put(p, &pos, 0, 4 + 1 + 22 + 2);
+			put(p, &pos, 1, 1);
+		}
+		memcpy(p + 4 + 32, main_data, (mpos + 7) / 8);
+	}
+
+	stream_len = frames * frame_bytes;
+	stream_seconds = (double)frames * 1152 / RATE;
+	return 0;
+}
+
+/* Decode the stream with the frame API; returns seconds of wall time */
+static double run_direct(int flags)
+{
+	static int16_t pcm[MUX_MP3DEC_MAX_SAMPLES * 2];
+	struct mux_mp3_frame_info info;
+	struct mux_mp3dec *d = mux_mp3dec_new(flags);
+	size_t pos = 0, consumed;
+	uint64_t t0;
+
+	if (!d)
+		return -1;
+
+	t0 = bench_now_ns();
+	while (pos < stream_len &&
+	       mux_mp3dec_decode_frame(d, stream + pos, stream_len - pos, pcm,
+				       &consumed, &info) == MUX_OK &&
+	       (consumed > 0 || info.frame_bytes))
+		pos += consumed;
+	t0 = bench_now_ns() - t0;
+
+	mux_mp3dec_destroy(d);
+	return (double)t0 / 1e9;
+}
+
+/* Decode through MUX_CODEC_MP3; builtin < 0 leaves the choice default */
+static double run_codec(int builtin, int mono)
+{
+	static uint8_t out[1 << 16];
+	struct mux_param p[2];
+	struct mux_decoder *dec;
+	size_t pos, n, consumed, written;
+	int np = 0, type;
+	uint64_t t0;
+
+	if (builtin >= 0) {
+		p[np].name = "builtin";
+		p[np++].value.b = builtin;
+	}
+	if (mono) {
+		p[np].name = "output_channels";
+		p[np++].value.i = 1;
+	}
+
+	t0 = bench_now_ns();
+	dec = mux_decoder_new(MUX_CODEC_MP3, 1, p, np);
+	if (!dec)
+		return -1;
+	for (pos = 0; pos < stream_len; pos += n) {
+		n = stream_len - pos < 4096 ? stream_len - pos : 4096;
+		if (mux_decoder_decode(dec, stream + pos, n, &consumed) != MUX_OK)
+			break;
+		while (mux_decoder_read(dec, out, sizeof(out), &written,
+					&type) == MUX_OK && written > 0)
+			;
+	}
+	mux_decoder_finalize(dec);
+	while (mux_decoder_read(dec, out, sizeof(out), &written, &type) ==
+	       MUX_OK && written > 0)
+		;
+	mux_decoder_destroy(dec);
+	return (double)(bench_now_ns() - t0) / 1e9;
+}
+
+/* Best of ROUNDS, as multiples of real time */
+static double best_direct(int flags)
+{
+	double t, best = 0;
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		t = run_direct(flags);
+		if (t > 0 && (best == 0 || t < best))
+			best = t;
+	}
+	return best > 0 ? stream_seconds / best : 0;
+}
+
+static double best_codec(int builtin, int mono)
+{
+	double t, best = 0;
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		t = run_codec(builtin, mono);
+		if (t > 0 && (best == 0 || t < best))
+			best = t;
+	}
+	return best > 0 ? stream_seconds / best : 0;
+}
+
+/* Whether the codec offers the choice between the two backends */
+static int both_backends(void)
+{
+	const struct mux_param_desc *desc;
+	int i, count;
+
+	if (mux_get_decoder_params(MUX_CODEC_MP3, &desc, &count) != MUX_OK)
+		return 0;
+	for (i = 0; i < count; i++)
+		if (strcmp(desc[i].name, "builtin") == 0)
+			return 1;
+	return 0;
+}
+
+/* Decoder creation: the first in the process builds the tables */
+static void startup(void)
+{
+	struct mux_param p = { .name = "builtin", .value.b = 0 };
+	struct mux_decoder *dec;
+	struct mux_mp3dec *d;
+	uint64_t t0, cold;
+	int i;
+
+	t0 = bench_now_ns();
+	d = mux_mp3dec_new(0);
+	cold = bench_now_ns() - t0;
+	mux_mp3dec_destroy(d);
+
+	t0 = bench_now_ns();
+	for (i = 0; i < 1000; i++)
+		mux_mp3dec_destroy(mux_mp3dec_new(0));
+	printf("%-24s %10.1f us cold %8.2f us warm\n", "in-tree new",
+	       (double)cold / 1e3, (double)(bench_now_ns() - t0) / 1e6);
+
+	t0 = bench_now_ns();
+	dec = mux_decoder_new(MUX_CODEC_MP3, 1, &p, 1);
+	cold = bench_now_ns() - t0;
+	if (!dec)
+		return;
+	mux_decoder_destroy(dec);
+	t0 = bench_now_ns();
+	for (i = 0; i < 1000; i++)
+		mux_decoder_destroy(mux_decoder_new(MUX_CODEC_MP3, 1, &p, 1));
+	printf("%-24s %10.1f us cold %8.2f us warm\n",
+	       both_backends() ? "codec mpg123" : "codec",
+	       (double)cold / 1e3, (double)(bench_now_ns() - t0) / 1e6);
+}
+
+int main(void)
+{
+	double x;
+
+	if (encode_lame() == 0) {
+		printf("LAME stream, 192 kbps stereo, %d Hz, %.1f s\n\n", RATE,
+		       stream_seconds);
+	} else if (synthesize() == 0) {
+		printf("Synthetic stream, 256 kbps joint stereo, %d Hz, %.1f s\n\n",
+		       RATE, stream_seconds);
+	} else {
+		return 1;
+	}
+
+	startup();
+	printf("\n%-24s %10s\n", "decoder", "x realtime");
+
+	printf("%-24s %10.1f\n", "in-tree scalar", best_direct(MUX_MP3DEC_SCALAR));
+	if (mux_mp3dec_simd())
+		printf("%-24s %10.1f\n", "in-tree SIMD", best_direct(0));
+	printf("%-24s %10.1f\n", "in-tree mono", best_direct(MUX_MP3DEC_MONO));
+
+	/* Through the codec, with whichever backends are compiled in */
+	if (both_backends()) {
+		printf("%-24s %10.1f\n", "codec in-tree", best_codec(1, 0));
+		printf("%-24s %10.1f\n", "codec mpg123", best_codec(0, 0));
+		printf("%-24s %10.1f\n", "codec in-tree mono", best_codec(1, 1));
+		printf("%-24s %10.1f\n", "codec mpg123 mono", best_codec(0, 1));
+	} else {
+		x = best_codec(-1, 0);
+		if (x > 0)
+			printf("%-24s %10.1f\n", "codec", x);
+	}
+
+	free(stream);
+	return 0;
+}
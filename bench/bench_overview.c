@@ -0,0 +1,253 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Compare waveform overview generation through a full decode plus a
+ * scalar min/max/RMS pass against mux_overview, at native and (where
+ * the codec supports it) reduced output rate
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE      48000
+#define CHANNELS  2
+#define SECONDS   60
+#define PASSES    3
+#define BUCKET    480  /* 10 ms */
+
+struct stream {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+static int append(struct stream *s, const uint8_t *data, size_t size)
+{
+	if (s->size + size > s->capacity) {
+		size_t cap = s->capacity ? s->capacity * 2 : 65536;
+		uint8_t *p;
+
+		while (cap < s->size + size)
+			cap *= 2;
+		p = realloc(s->data, cap);
+		if (!p)
+			return -1;
+		s->data = p;
+		s->capacity = cap;
+	}
+
+	memcpy(s->data + s->size, data, size);
+	s->size += size;
+	return 0;
+}
+
+static int encode_stream(enum mux_codec_type codec, struct stream *s)
+{
+	const size_t frames = RATE / 50;
+	struct mux_encoder *enc;
+	int16_t pcm[RATE / 50 * CHANNELS];
+	uint8_t out[65536];
+	size_t consumed, written;
+	int i;
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	if (!enc)
+		return -1;
+
+	for (i = 0; i < SECONDS * 50; i++) {
+		bench_fill_pcm(pcm, frames, CHANNELS, RATE,
+			       (uint64_t)i * frames);
+		mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				   MUX_STREAM_AUDIO);
+		while (mux_encoder_read(enc, out, sizeof(out), &written) ==
+		       MUX_OK && written > 0)
+			append(s, out, written);
+	}
+
+	mux_encoder_finalize(enc);
+	while (mux_encoder_read(enc, out, sizeof(out), &written) == MUX_OK &&
+	       written > 0)
+		append(s, out, written);
+
+	mux_encoder_destroy(enc);
+	return 0;
+}
+
+/* What an application does without the overview API */
+struct naive {
+	int16_t min[CHANNELS], max[CHANNELS];
+	double sumsq[CHANNELS];
+	size_t count, buckets;
+	uint16_t rms;
+};
+
+static void naive_scan(struct naive *n, const int16_t *pcm, size_t frames)
+{
+	size_t i;
+	int c;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < CHANNELS; c++) {
+			int16_t v = pcm[i * CHANNELS + c];
+
+			if (v < n->min[c])
+				n->min[c] = v;
+			if (v > n->max[c])
+				n->max[c] = v;
+			n->sumsq[c] += (double)v * v;
+		}
+		if (++n->count == BUCKET) {
+			for (c = 0; c < CHANNELS; c++) {
+				n->rms = (uint16_t)sqrt(n->sumsq[c] / BUCKET);
+				n->min[c] = INT16_MAX;
+				n->max[c] = INT16_MIN;
+				n->sumsq[c] = 0;
+			}
+			n->count = 0;
+			n->buckets++;
+		}
+	}
+}
+
+static int run_naive(enum mux_codec_type codec, const struct stream *s,
+		     uint64_t *ns, size_t *buckets)
+{
+	static int16_t out[1 << 15];
+	struct mux_decoder *dec;
+	struct naive n;
+	size_t pos, chunk, consumed, written;
+	uint64_t t0;
+	int stream_type, c;
+
+	dec = mux_decoder_new(codec, 2, NULL, 0);
+	if (!dec)
+		return -1;
+
+	memset(&n, 0, sizeof(n));
+	for (c = 0; c < CHANNELS; c++) {
+		n.min[c] = INT16_MAX;
+		n.max[c] = INT16_MIN;
+	}
+
+	t0 = bench_now_ns();
+	for (pos = 0; pos <= s->size; pos += chunk) {
+		chunk = s->size - pos < 4096 ? s->size - pos : 4096;
+		if (chunk)
+			mux_decoder_decode(dec, s->data + pos, chunk, &consumed);
+		else
+			mux_decoder_finalize(dec);
+		do {
+			stream_type = -1;
+			mux_decoder_read(dec, out, sizeof(out), &written,
+					 &stream_type);
+			if (stream_type == MUX_STREAM_AUDIO)
+				naive_scan(&n, out, written / (2 * CHANNELS));
+		} while (written > 0);
+		if (!chunk)
+			break;
+	}
+	*ns = bench_now_ns() - t0;
+	*buckets = n.buckets;
+
+	mux_decoder_destroy(dec);
+	return 0;
+}
+
+static int run_overview(enum mux_codec_type codec, const struct stream *s,
+			const struct mux_param *params, int num_params,
+			uint64_t *ns, size_t *buckets)
+{
+	static struct mux_peak peaks[4096];
+	struct mux_overview *ov;
+	size_t pos, chunk, consumed, n;
+	uint64_t t0;
+
+	ov = mux_overview_new(codec, 2, CHANNELS, BUCKET, params, num_params);
+	if (!ov)
+		return -1;
+
+	*buckets = 0;
+	t0 = bench_now_ns();
+	for (pos = 0; pos < s->size; pos += consumed) {
+		chunk = s->size - pos < 4096 ? s->size - pos : 4096;
+		if (mux_overview_feed(ov, s->data + pos, chunk,
+				      &consumed) != MUX_OK)
+			break;
+		while (mux_overview_read(ov, peaks, 4096 / CHANNELS, &n) ==
+		       MUX_OK && n > 0)
+			*buckets += n;
+	}
+	mux_overview_finalize(ov);
+	while (mux_overview_read(ov, peaks, 4096 / CHANNELS, &n) == MUX_OK &&
+	       n > 0)
+		*buckets += n;
+	*ns = bench_now_ns() - t0;
+
+	mux_overview_destroy(ov);
+	return 0;
+}
+
+static void report(const char *label, uint64_t ns, size_t buckets)
+{
+	double sec = (double)ns / PASSES / 1e9;
+
+	printf("  %-16s %8.2f ms %10.0fx realtime %8zu buckets\n",
+	       label, sec * 1e3, SECONDS / sec, buckets);
+}
+
+int main(void)
+{
+	const struct mux_param reduced[] = {
+		{ .name = "output_rate", .value.i = 8000 },
+	};
+	int i, pass, benched = 0;
+
+	printf("Waveform overview, %d Hz %d ch source, %d s, %d frame buckets\n\n",
+	       RATE, CHANNELS, SECONDS, BUCKET);
+
+	for (i = 0; i < MUX_CODEC_MAX; i++) {
+		struct stream s = { NULL, 0, 0 };
+		uint64_t naive_ns = 0, ov_ns = 0, red_ns = 0, ns;
+		size_t naive_b = 0, ov_b = 0, red_b = 0;
+		int have_reduced = 1;
+
+		if (encode_stream(i, &s) != 0) {
+			free(s.data);
+			continue;
+		}
+
+		for (pass = 0; pass < PASSES; pass++) {
+			if (run_naive(i, &s, &ns, &naive_b) != 0)
+				break;
+			naive_ns += ns;
+			if (run_overview(i, &s, NULL, 0, &ns, &ov_b) != 0)
+				break;
+			ov_ns += ns;
+			if (have_reduced &&
+			    run_overview(i, &s, reduced, 1, &ns, &red_b) == 0)
+				red_ns += ns;
+			else
+				have_reduced = 0;
+		}
+
+		if (pass == PASSES) {
+			printf("%s (%zu byte stream)\n", mux_codec_to_name(i),
+			       s.size);
+			report("decode + scan", naive_ns, naive_b);
+			report("overview", ov_ns, ov_b);
+			if (have_reduced && i != MUX_CODEC_PCM &&
+			    i != MUX_CODEC_ALAW && i != MUX_CODEC_MULAW)
+				report("overview 8 kHz", red_ns, red_b);
+			benched++;
+		}
+
+		free(s.data);
+	}
+
+	if (!benched)
+		printf("No codecs available\n");
+
+	return 0;
+}
@@ -0,0 +1,248 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Random-access lookup + decode latency: one file per clip versus a
+ * single memory-mapped clip pack
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE      8000
+#define CHANNELS  1
+#define NUM_CLIPS 2000
+#define LOOKUPS   20000
+#define FRAMES    (RATE / 2)    /* 500 ms clips */
+#define CLIP_MAX  (FRAMES * CHANNELS * 4 + 4096)
+#define DIR_PATH  "bench_pack_clips"
+#define PACK_PATH "bench_pack.muxpack"
+
+static uint8_t clip_buf[CLIP_MAX];
+static uint8_t out_buf[FRAMES * CHANNELS * 2 + 4096];
+
+static size_t encode_clip(enum mux_codec_type codec, int index)
+{
+	struct mux_encoder *enc;
+	int16_t pcm[FRAMES * CHANNELS];
+	size_t total = 0, consumed, written;
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 1, NULL, 0);
+	if (!enc)
+		return 0;
+
+	bench_fill_pcm(pcm, FRAMES, CHANNELS, RATE, (uint64_t)index * FRAMES);
+	if (mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+			       MUX_STREAM_AUDIO) == MUX_OK &&
+	    mux_encoder_finalize(enc) == MUX_OK) {
+		while (total < sizeof(clip_buf) &&
+		       mux_encoder_read(enc, clip_buf + total,
+					sizeof(clip_buf) - total, &written) ==
+		       MUX_OK && written > 0)
+			total += written;
+	}
+
+	mux_encoder_destroy(enc);
+	return total;
+}
+
+static size_t decode(struct mux_decoder *dec, const uint8_t *data, size_t len)
+{
+	size_t total = 0, consumed, written;
+	int stream_type;
+
+	if (mux_decoder_decode(dec, data, len, &consumed) != MUX_OK ||
+	    mux_decoder_finalize(dec) != MUX_OK)
+		return 0;
+
+	do {
+		stream_type = -1;
+		mux_decoder_read(dec, out_buf, sizeof(out_buf), &written,
+				 &stream_type);
+		total += written;
+	} while (written > 0);
+
+	return total;
+}
+
+static void clip_path(char *path, size_t size, int index)
+{
+	snprintf(path, size, DIR_PATH "/%08d.mux", index);
+}
+
+static int build(enum mux_codec_type codec)
+{
+	struct mux_pack_writer *w;
+	struct mux_clip clip;
+	char path[64];
+	FILE *f;
+	int i;
+
+	mkdir(DIR_PATH, 0755);
+	w = mux_pack_writer_new(PACK_PATH);
+	if (!w)
+		return -1;
+
+	memset(&clip, 0, sizeof(clip));
+	clip.codec_type = codec;
+	clip.num_streams = 1;
+	clip.sample_rate = RATE;
+	clip.num_channels = CHANNELS;
+	clip.duration = FRAMES;
+	clip.data = clip_buf;
+
+	for (i = 0; i < NUM_CLIPS; i++) {
+		clip.id = (uint64_t)i;
+		clip.size = encode_clip(codec, i);
+		if (clip.size == 0 || mux_pack_writer_add(w, &clip) != MUX_OK)
+			goto fail;
+
+		clip_path(path, sizeof(path), i);
+		f = fopen(path, "wb");
+		if (!f)
+			goto fail;
+		if (fwrite(clip_buf, 1, clip.size, f) != clip.size) {
+			fclose(f);
+			goto fail;
+		}
+		fclose(f);
+	}
+
+	if (mux_pack_writer_finish(w) != MUX_OK)
+		goto fail;
+	mux_pack_writer_destroy(w);
+	return 0;
+
+fail:
+	mux_pack_writer_destroy(w);
+	return -1;
+}
+
+static void cleanup(void)
+{
+	char path[64];
+	int i;
+
+	for (i = 0; i < NUM_CLIPS; i++) {
+		clip_path(path, sizeof(path), i);
+		remove(path);
+	}
+	remove(DIR_PATH);
+	remove(PACK_PATH);
+}
+
+/* Open the clip's file, read it whole and decode it */
+static size_t per_file(enum mux_codec_type codec, int index)
+{
+	struct mux_decoder *dec;
+	char path[64];
+	size_t len, total;
+	FILE *f;
+
+	clip_path(path, sizeof(path), index);
+	f = fopen(path, "rb");
+	if (!f)
+		return 0;
+	len = fread(clip_buf, 1, sizeof(clip_buf), f);
+	fclose(f);
+
+	dec = mux_decoder_new(codec, 1, NULL, 0);
+	if (!dec)
+		return 0;
+	total = decode(dec, clip_buf, len);
+	mux_decoder_destroy(dec);
+	return total;
+}
+
+/* Look the clip up in the pack and decode it in place */
+static size_t from_pack(const struct mux_pack *pack, int index)
+{
+	struct mux_decoder *dec;
+	struct mux_clip clip;
+	size_t total;
+
+	if (mux_pack_find(pack, (uint64_t)index, &clip) != MUX_OK)
+		return 0;
+
+	dec = mux_pack_decoder_new(&clip, NULL, 0);
+	if (!dec)
+		return 0;
+	total = decode(dec, clip.data, clip.size);
+	mux_decoder_destroy(dec);
+	return total;
+}
+
+static int bench_codec(enum mux_codec_type codec, const int *order)
+{
+	struct mux_pack *pack;
+	uint64_t t0, file_ns, pack_ns, open_ns;
+	size_t file_bytes = 0, pack_bytes = 0;
+	int i;
+
+	if (build(codec) != 0) {
+		cleanup();
+		return -1;
+	}
+
+	t0 = bench_now_ns();
+	for (i = 0; i < LOOKUPS; i++)
+		file_bytes += per_file(codec, order[i]);
+	file_ns = bench_now_ns() - t0;
+
+	t0 = bench_now_ns();
+	pack = mux_pack_open(PACK_PATH);
+	open_ns = bench_now_ns() - t0;
+	if (!pack) {
+		cleanup();
+		return -1;
+	}
+
+	t0 = bench_now_ns();
+	for (i = 0; i < LOOKUPS; i++)
+		pack_bytes += from_pack(pack, order[i]);
+	pack_ns = bench_now_ns() - t0;
+
+	mux_pack_close(pack);
+	cleanup();
+
+	if (file_bytes != pack_bytes)
+		printf("%-8s output mismatch (%zu vs %zu bytes)\n",
+		       mux_codec_to_name(codec), file_bytes, pack_bytes);
+
+	printf("%-8s %12.2f %12.2f %9.2fx %10.1f\n", mux_codec_to_name(codec),
+	       (double)file_ns / LOOKUPS / 1e3,
+	       (double)pack_ns / LOOKUPS / 1e3,
+	       (double)file_ns / (double)pack_ns, (double)open_ns / 1e3);
+	return 0;
+}
+
+int main(void)
+{
+	int *order;
+	int i, benched = 0;
+
+	order = malloc(LOOKUPS * sizeof(*order));
+	if (!order)
+		return 1;
+
+	srand(1);
+	for (i = 0; i < LOOKUPS; i++)
+		order[i] = rand() % NUM_CLIPS;
+
+	printf("Clip lookup + decode, %d clips of %d ms, %d random lookups\n\n",
+	       NUM_CLIPS, FRAMES * 1000 / RATE, LOOKUPS);
+	printf("%-8s %12s %12s %10s %10s\n", "codec", "file us/clip",
+	       "pack us/clip", "speedup", "open us");
+
+	for (i = 0; i < MUX_CODEC_MAX; i++) {
+		if (bench_codec(i, order) == 0)
+			benched++;
+	}
+
+	if (!benched)
+		printf("No codecs available\n");
+
+	free(order);
+	return 0;
+}
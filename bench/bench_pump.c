@@ -0,0 +1,188 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Encode PCM between two pipes, fed and drained by child processes:
+ * the blocking read/encode/read/write loop of tools/mux.c against
+ * mux_encoder_pump() driven by poll() on non-blocking fds
+ */
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE        48000
+#define CHANNELS    2
+#define TOTAL_BYTES ((size_t)64 << 20)
+#define CHUNK       3840          /* 20 ms */
+
+enum mode { LOOP, PUMP };
+
+static void produce(int fd)
+{
+	static int16_t pcm[CHUNK / 2];
+	size_t sent, off;
+	ssize_t w;
+
+	bench_fill_pcm(pcm, CHUNK / 4, CHANNELS, RATE, 0);
+	for (sent = 0; sent < TOTAL_BYTES; sent += CHUNK) {
+		for (off = 0; off < CHUNK; off += (size_t)w) {
+			w = write(fd, (uint8_t *)pcm + off, CHUNK - off);
+			if (w <= 0)
+				_exit(1);
+		}
+	}
+	_exit(0);
+}
+
+static void discard(int fd)
+{
+	static uint8_t buf[1 << 16];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	_exit(0);
+}
+
+/* The loop every integrator writes, as in tools/mux.c */
+static int run_loop(struct mux_encoder *enc, int in_fd, int out_fd)
+{
+	static uint8_t in[8192], out[16384];
+	size_t have = 0, whole, consumed, written;
+	ssize_t r;
+
+	for (;;) {
+		r = read(in_fd, in + have, sizeof(in) - have);
+		if (r <= 0)
+			break;
+		have += (size_t)r;
+		whole = have - have % (CHANNELS * 2);
+		if (mux_encoder_encode(enc, in, whole, &consumed,
+				       MUX_STREAM_AUDIO) != MUX_OK)
+			return -1;
+		memmove(in, in + whole, have - whole);
+		have -= whole;
+
+		while (mux_encoder_read(enc, out, sizeof(out), &written) ==
+		       MUX_OK && written > 0) {
+			if (write(out_fd, out, written) != (ssize_t)written)
+				return -1;
+		}
+	}
+
+	if (mux_encoder_finalize(enc) != MUX_OK)
+		return -1;
+	while (mux_encoder_read(enc, out, sizeof(out), &written) == MUX_OK &&
+	       written > 0) {
+		if (write(out_fd, out, written) != (ssize_t)written)
+			return -1;
+	}
+	return 0;
+}
+
+static int run_pump(struct mux_encoder *enc, int in_fd, int out_fd)
+{
+	struct pollfd fds[2];
+	int ret, wait;
+
+	fcntl(in_fd, F_SETFL, fcntl(in_fd, F_GETFL) | O_NONBLOCK);
+	fcntl(out_fd, F_SETFL, fcntl(out_fd, F_GETFL) | O_NONBLOCK);
+
+	for (;;) {
+		ret = mux_encoder_pump(enc, in_fd, -1, out_fd, &wait);
+		if (ret == MUX_ERROR_EOF)
+			return 0;
+		if (ret != MUX_OK)
+			return -1;
+
+		fds[0].fd = wait & MUX_PUMP_IN ? in_fd : -1;
+		fds[0].events = POLLIN;
+		fds[1].fd = wait & MUX_PUMP_OUT ? out_fd : -1;
+		fds[1].events = POLLOUT;
+		if (poll(fds, 2, -1) < 0)
+			return -1;
+	}
+}
+
+static int run(enum mux_codec_type codec, enum mode mode, uint64_t *wall,
+	       uint64_t *cpu)
+{
+	struct mux_encoder *enc;
+	int in_p[2], out_p[2], status, ret;
+	pid_t producer, consumer;
+	uint64_t t0, c0;
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 1, NULL, 0);
+	if (!enc)
+		return -1;
+	if (pipe(in_p) != 0 || pipe(out_p) != 0) {
+		mux_encoder_destroy(enc);
+		return -1;
+	}
+
+	producer = fork();
+	if (producer == 0) {
+		close(in_p[0]);
+		close(out_p[0]);
+		close(out_p[1]);
+		produce(in_p[1]);
+	}
+	consumer = fork();
+	if (consumer == 0) {
+		close(in_p[0]);
+		close(in_p[1]);
+		close(out_p[1]);
+		discard(out_p[0]);
+	}
+	close(in_p[1]);
+	close(out_p[0]);
+
+	t0 = bench_now_ns();
+	c0 = bench_cpu_ns();
+	if (mode == LOOP)
+		ret = run_loop(enc, in_p[0], out_p[1]);
+	else
+		ret = run_pump(enc, in_p[0], out_p[1]);
+	*cpu = bench_cpu_ns() - c0;
+	close(out_p[1]);
+	close(in_p[0]);
+
+	waitpid(producer, &status, 0);
+	waitpid(consumer, &status, 0);
+	*wall = bench_now_ns() - t0;
+
+	mux_encoder_destroy(enc);
+	return ret;
+}
+
+int main(void)
+{
+	static const enum mux_codec_type codecs[] = {
+		MUX_CODEC_PCM, MUX_CODEC_ALAW, MUX_CODEC_OPUS,
+	};
+	static const char *const modes[] = { "loop", "pump" };
+	uint64_t wall, cpu;
+	double mb = (double)TOTAL_BYTES / (1 << 20);
+	size_t i;
+	int m;
+
+	printf("Pipe -> encoder -> pipe, %.0f MiB of %d Hz %d ch PCM\n\n", mb,
+	       RATE, CHANNELS);
+	printf("%-8s %-6s %10s %14s\n", "codec", "mode", "MiB/s", "cpu ns/KiB");
+
+	for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		for (m = LOOP; m <= PUMP; m++) {
+			if (run(codecs[i], m, &wall, &cpu) != 0)
+				continue;
+			printf("%-8s %-6s %10.1f %14.1f\n",
+			       mux_codec_to_name(codecs[i]), modes[m],
+			       mb / ((double)wall / 1e9),
+			       (double)cpu / (mb * 1024));
+		}
+	}
+
+	return 0;
+}
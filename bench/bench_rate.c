@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Queueing delay on a constrained link with and without encoder rate
+ * control. Output of each 20 ms tick goes into a link queue drained at
+ * the link rate; the delay is what a byte waits in it. Calls carry
+ * side channel bursts (e.g. a slide or transcript dump) next to their
+ * audio; codecs with a live bitrate are also run above the link rate.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define SECONDS    30
+#define WINDOW_MS  200
+
+struct scenario {
+	const char *name;
+	enum mux_codec_type codec;
+	int rate;
+	int channels;
+	int bitrate;          /* kbps param, 0 = codec default */
+	int link_bps;
+	int side_bytes;       /* burst every 5 s */
+};
+
+static const struct scenario scenarios[] = {
+	{ "A-law + side",   MUX_CODEC_ALAW, 8000,  1,  0, 72000,  6000 },
+	{ "Opus 64k VBR",   MUX_CODEC_OPUS, 48000, 2, 64, 32000,     0 },
+	{ "Opus + side",    MUX_CODEC_OPUS, 48000, 2, 24, 32000,  6000 },
+	{ "AAC 96k",        MUX_CODEC_AAC,  48000, 2, 96, 64000,     0 },
+	{ "AMR 12.2 + side", MUX_CODEC_AMR, 8000,  1,  0,  9600,  1500 },
+};
+
+struct result {
+	double max_ms;
+	double mean_ms;
+	double kbps;
+	uint64_t encode_ns;
+};
+
+static int run(const struct scenario *s, int limit, struct result *res)
+{
+	struct mux_param p = { .name = "bitrate", .value.i = s->bitrate };
+	struct mux_encoder *enc;
+	static uint8_t side[65536], out[1 << 16];
+	int16_t *pcm;
+	size_t frames = (size_t)s->rate / 50, consumed, written;
+	double queue = 0, drain = (double)s->link_bps / 8 / 50, delay, sum = 0;
+	uint64_t total = 0, t0;
+	int tick, ticks = SECONDS * 50;
+
+	enc = mux_encoder_new(s->codec, s->rate, s->channels, 2,
+			      s->bitrate ? &p : NULL, s->bitrate ? 1 : 0);
+	if (!enc)
+		return -1;
+	if (limit && mux_encoder_set_rate_limit(enc, s->link_bps,
+						WINDOW_MS) != MUX_OK) {
+		mux_encoder_destroy(enc);
+		return -1;
+	}
+
+	pcm = malloc(frames * (size_t)s->channels * sizeof(*pcm));
+	if (!pcm) {
+		mux_encoder_destroy(enc);
+		return -1;
+	}
+	memset(side, 'x', sizeof(side));
+	memset(res, 0, sizeof(*res));
+
+	for (tick = 0; tick < ticks; tick++) {
+		bench_fill_pcm(pcm, frames, s->channels, s->rate,
+			       (uint64_t)tick * frames);
+		t0 = bench_now_ns();
+		mux_encoder_encode(enc, pcm, frames * (size_t)s->channels *
+				   sizeof(*pcm), &consumed, MUX_STREAM_AUDIO);
+		if (s->side_bytes && tick % 250 == 100)
+			mux_encoder_encode(enc, side, (size_t)s->side_bytes,
+					   &consumed, MUX_STREAM_SIDE_CHANNEL);
+		res->encode_ns += bench_now_ns() - t0;
+
+		while (mux_encoder_read(enc, out, sizeof(out), &written) ==
+		       MUX_OK && written > 0) {
+			queue += (double)written;
+			total += written;
+		}
+
+		/* The newest byte waits for everything queued ahead of it */
+		delay = queue / drain * 20;
+		sum += delay;
+		if (delay > res->max_ms)
+			res->max_ms = delay;
+		queue = queue > drain ? queue - drain : 0;
+	}
+
+	res->mean_ms = sum / ticks;
+	res->kbps = (double)total * 8 / SECONDS / 1000;
+	res->encode_ns /= (uint64_t)ticks;
+	free(pcm);
+	mux_encoder_destroy(enc);
+	return 0;
+}
+
+int main(void)
+{
+	struct result off, on;
+	size_t i;
+
+	printf("%d s per run, %d ms bucket, side bursts every 5 s\n\n", SECONDS,
+	       WINDOW_MS);
+	printf("%-16s %6s | %8s %8s %7s %8s | %8s %8s %7s %8s\n", "", "link",
+	       "max ms", "mean ms", "kbps", "ns/tick", "max ms", "mean ms",
+	       "kbps", "ns/tick");
+	printf("%-16s %6s | %-35s | %s\n", "call", "kbps", "  no rate control",
+	       "  rate control");
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		const struct scenario *s = &scenarios[i];
+
+		if (run(s, 0, &off) != 0 || run(s, 1, &on) != 0) {
+			printf("%-16s (not available)\n", s->name);
+			continue;
+		}
+		printf("%-16s %6.1f | %8.1f %8.1f %7.1f %8llu | %8.1f %8.1f %7.1f %8llu\n",
+		       s->name, s->link_bps / 1000.0,
+		       off.max_ms, off.mean_ms, off.kbps,
+		       (unsigned long long)off.encode_ns,
+		       on.max_ms, on.mean_ms, on.kbps,
+		       (unsigned long long)on.encode_ns);
+	}
+	return 0;
+}
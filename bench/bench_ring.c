@@ -0,0 +1,263 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Compare PCM transport between processes over a pipe against the
+ * shared-memory ring: raw throughput, throughput into an encoder, and
+ * one-way latency of paced 20 ms chunks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#ifdef __linux__
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RATE       48000
+#define CHANNELS   2
+#define CHUNK      (RATE / 50 * CHANNELS * 2)  /* 20 ms, 3840 bytes */
+#define BULK_BYTES ((size_t)1 << 30)
+#define LAT_CHUNKS 2000
+#define RING_SIZE  (1 << 20)
+
+enum transport { PIPE, RING };
+
+struct link {
+	int fds[2];
+	struct mux_ring *ring;
+};
+
+/*
+ * Producer: bulk mode writes as fast as possible, paced mode stamps
+ * each chunk with the send time and sleeps 1 ms between chunks.
+ */
+static void produce(enum transport t, struct link *l, size_t total, int paced)
+{
+	static uint8_t chunk[CHUNK];
+	struct mux_ring *ring = NULL;
+	struct timespec gap = { 0, 1000000 };
+	size_t sent, off, n;
+	uint64_t stamp;
+	ssize_t w;
+
+	if (t == RING)
+		ring = mux_ring_open(mux_ring_fd(l->ring));
+	else
+		close(l->fds[0]);
+
+	bench_fill_pcm((int16_t *)chunk, CHUNK / 4, CHANNELS, RATE, 0);
+
+	for (sent = 0; sent < total; sent += CHUNK) {
+		if (paced) {
+			nanosleep(&gap, NULL);
+			stamp = bench_now_ns();
+			memcpy(chunk, &stamp, sizeof(stamp));
+		}
+
+		for (off = 0; off < CHUNK; off += n) {
+			if (t == RING) {
+				if (mux_ring_write(ring, chunk + off, CHUNK - off,
+						   &n, -1) != MUX_OK)
+					_exit(1);
+			} else {
+				w = write(l->fds[1], chunk + off, CHUNK - off);
+				if (w <= 0)
+					_exit(1);
+				n = (size_t)w;
+			}
+		}
+	}
+
+	if (t == RING) {
+		mux_ring_shutdown(ring);
+		mux_ring_close(ring);
+	} else {
+		close(l->fds[1]);
+	}
+	_exit(0);
+}
+
+static int open_link(enum transport t, struct link *l)
+{
+	if (t == RING) {
+		l->ring = mux_ring_create(RING_SIZE);
+		return l->ring ? 0 : -1;
+	}
+	return pipe(l->fds);
+}
+
+/*
+ * Consumer side. encode != 0 feeds an A-law encoder; latency != NULL
+ * collects per-chunk one-way latency.
+ */
+static int consume(enum transport t, struct link *l, int encode,
+		   uint64_t *latency, size_t *total)
+{
+	static uint8_t buf[CHUNK * 16], out[1 << 16];
+	struct mux_encoder *enc = NULL;
+	size_t n, consumed, written, have = 0, chunks = 0;
+	uint64_t stamp;
+	ssize_t r;
+	int ret;
+
+	if (encode) {
+		enc = mux_encoder_new(MUX_CODEC_ALAW, RATE, CHANNELS, 1, NULL, 0);
+		if (!enc)
+			return -1;
+	}
+
+	*total = 0;
+	for (;;) {
+		if (t == RING && enc) {
+			ret = mux_encoder_encode_ring(enc, l->ring, -1, &n);
+		} else if (t == RING && !latency) {
+			/* Zero copy: look at the data in place */
+			const void *ptr;
+
+			ret = mux_ring_read_acquire(l->ring, &ptr, &n, -1);
+			if (ret == MUX_OK)
+				ret = mux_ring_read_release(l->ring, n);
+		} else if (t == RING) {
+			ret = mux_ring_read(l->ring, buf + have,
+					    sizeof(buf) - have, &n, -1);
+		} else {
+			r = read(l->fds[0], buf + have, sizeof(buf) - have);
+			ret = r > 0 ? MUX_OK : MUX_ERROR_EOF;
+			n = r > 0 ? (size_t)r : 0;
+			if (ret == MUX_OK && enc) {
+				/* Keep a split frame for the next read */
+				size_t whole = (have + n) - (have + n) % 4;
+
+				ret = mux_encoder_encode(enc, buf, whole, &consumed,
+							 MUX_STREAM_AUDIO);
+				have = have + n - whole;
+				memmove(buf, buf + whole, have);
+			}
+		}
+		if (ret != MUX_OK)
+			break;
+
+		*total += n;
+		if (enc) {
+			while (mux_encoder_read(enc, out, sizeof(out), &written) ==
+			       MUX_OK && written > 0)
+				;
+			continue;
+		}
+
+		if (!latency)
+			continue;
+
+		/* Whole chunks carry a send stamp at the front */
+		have += n;
+		while (have >= CHUNK) {
+			memcpy(&stamp, buf, sizeof(stamp));
+			if (chunks < LAT_CHUNKS)
+				latency[chunks++] = bench_now_ns() - stamp;
+			memmove(buf, buf + CHUNK, have - CHUNK);
+			have -= CHUNK;
+		}
+	}
+
+	mux_encoder_destroy(enc);
+	return 0;
+}
+
+static int run(enum transport t, size_t bytes, int encode, uint64_t *latency,
+	       uint64_t *ns, size_t *total)
+{
+	struct link l;
+	uint64_t t0;
+	pid_t pid;
+	int status;
+
+	memset(&l, 0, sizeof(l));
+	if (open_link(t, &l) != 0)
+		return -1;
+
+	t0 = bench_now_ns();
+	pid = fork();
+	if (pid == 0)
+		produce(t, &l, bytes, latency != NULL);
+	if (pid < 0)
+		return -1;
+
+	if (t == PIPE)
+		close(l.fds[1]);
+
+	consume(t, &l, encode, latency, total);
+	*ns = bench_now_ns() - t0;
+
+	waitpid(pid, &status, 0);
+	if (t == RING)
+		mux_ring_close(l.ring);
+	else
+		close(l.fds[0]);
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(void)
+{
+	static const char *names[] = { "pipe", "ring" };
+	static uint64_t latency[LAT_CHUNKS];
+	uint64_t ns;
+	size_t total;
+	int t, encode;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("PCM transport between processes, %d byte chunks\n\n", CHUNK);
+
+	for (encode = 0; encode <= 1; encode++) {
+		printf("%s\n", encode ? "Into A-law encoder" : "Raw throughput");
+		for (t = PIPE; t <= RING; t++) {
+			if (run(t, BULK_BYTES / (encode ? 4 : 1), encode, NULL,
+				&ns, &total) != 0) {
+				printf("  %-6s unavailable\n", names[t]);
+				continue;
+			}
+			printf("  %-6s %10.1f MB/s %10.0fx realtime\n", names[t],
+			       total / (ns / 1e9) / 1e6,
+			       total / (double)(RATE * CHANNELS * 2) / (ns / 1e9));
+		}
+		printf("\n");
+	}
+
+	printf("One-way latency, %d paced chunks\n", LAT_CHUNKS);
+	for (t = PIPE; t <= RING; t++) {
+		memset(latency, 0, sizeof(latency));
+		if (run(t, (size_t)LAT_CHUNKS * CHUNK, 0, latency, &ns,
+			&total) != 0) {
+			printf("  %-6s unavailable\n", names[t]);
+			continue;
+		}
+		qsort(latency, LAT_CHUNKS, sizeof(latency[0]), cmp_u64);
+		printf("  %-6s p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+		       names[t], latency[LAT_CHUNKS / 2] / 1e3,
+		       latency[LAT_CHUNKS * 99 / 100] / 1e3,
+		       latency[LAT_CHUNKS - 1] / 1e3);
+	}
+
+	return 0;
+}
+
+#else
+
+int main(void)
+{
+	printf("Shared memory ring is Linux only\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Compare full decoding against side-channel-only extraction
+ * (side_only=1) on the same muxed stream
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE      48000
+#define CHANNELS  2
+#define SECONDS   30
+#define PASSES    5
+
+struct stream {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+static int append(struct stream *s, const uint8_t *data, size_t size)
+{
+	if (s->size + size > s->capacity) {
+		size_t cap = s->capacity ? s->capacity * 2 : 65536;
+		uint8_t *p;
+
+		while (cap < s->size + size)
+			cap *= 2;
+		p = realloc(s->data, cap);
+		if (!p)
+			return -1;
+		s->data = p;
+		s->capacity = cap;
+	}
+
+	memcpy(s->data + s->size, data, size);
+	s->size += size;
+	return 0;
+}
+
+/*
+ * 20 ms audio frames with a short metadata message every 100 ms
+ */
+static int encode_stream(enum mux_codec_type codec, struct stream *s)
+{
+	const size_t frames = RATE / 50;
+	struct mux_encoder *enc;
+	int16_t pcm[RATE / 50 * CHANNELS];
+	uint8_t out[65536];
+	char meta[64];
+	size_t consumed, written;
+	int i;
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	if (!enc)
+		return -1;
+
+	for (i = 0; i < SECONDS * 50; i++) {
+		bench_fill_pcm(pcm, frames, CHANNELS, RATE,
+			       (uint64_t)i * frames);
+		mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				   MUX_STREAM_AUDIO);
+		if (i % 5 == 0) {
+			snprintf(meta, sizeof(meta), "{\"t\":%d}", i * 20);
+			mux_encoder_encode(enc, meta, strlen(meta), &consumed,
+					   MUX_STREAM_SIDE_CHANNEL);
+		}
+		while (mux_encoder_read(enc, out, sizeof(out), &written) ==
+		       MUX_OK && written > 0)
+			append(s, out, written);
+	}
+
+	mux_encoder_finalize(enc);
+	while (mux_encoder_read(enc, out, sizeof(out), &written) == MUX_OK &&
+	       written > 0)
+		append(s, out, written);
+
+	mux_encoder_destroy(enc);
+	return 0;
+}
+
+static void drain(struct mux_decoder *dec, size_t *side_bytes)
+{
+	static uint8_t out[1 << 16];
+	size_t written;
+	int stream_type;
+
+	do {
+		stream_type = -1;
+		mux_decoder_read(dec, out, sizeof(out), &written, &stream_type);
+		if (stream_type == MUX_STREAM_SIDE_CHANNEL)
+			*side_bytes += written;
+	} while (written > 0);
+}
+
+/*
+ * Run the whole stream through a decoder, returning wall ns and the
+ * side channel bytes recovered
+ */
+static int decode_stream(enum mux_codec_type codec, const struct stream *s,
+			 const struct mux_param *params, int num_params,
+			 uint64_t *ns, size_t *side_bytes)
+{
+	struct mux_decoder *dec;
+	size_t pos, chunk, consumed;
+	uint64_t t0;
+
+	dec = mux_decoder_new(codec, 2, params, num_params);
+	if (!dec)
+		return -1;
+
+	*side_bytes = 0;
+	t0 = bench_now_ns();
+
+	for (pos = 0; pos < s->size; pos += chunk) {
+		chunk = s->size - pos < 4096 ? s->size - pos : 4096;
+		mux_decoder_decode(dec, s->data + pos, chunk, &consumed);
+		drain(dec, side_bytes);
+	}
+
+	mux_decoder_finalize(dec);
+	drain(dec, side_bytes);
+
+	*ns = bench_now_ns() - t0;
+	mux_decoder_destroy(dec);
+	return 0;
+}
+
+static void report(const char *label, uint64_t ns, size_t stream_size,
+		   size_t side_bytes)
+{
+	double sec = (double)ns / PASSES / 1e9;
+
+	printf("  %-10s %10.1f MB/s %10.0fx realtime %8zu side bytes\n",
+	       label, stream_size / sec / 1e6, SECONDS / sec, side_bytes);
+}
+
+int main(void)
+{
+	const struct mux_param side_only[] = {
+		{ .name = "side_only", .value.b = 1 },
+	};
+	int i, pass, benched = 0;
+
+	printf("Side channel extraction, %d Hz %d ch source, %d s\n\n",
+	       RATE, CHANNELS, SECONDS);
+
+	for (i = 0; i < MUX_CODEC_MAX; i++) {
+		struct stream s = { NULL, 0, 0 };
+		uint64_t full_ns = 0, side_ns = 0, ns;
+		size_t full_bytes = 0, side_bytes = 0;
+
+		if (encode_stream(i, &s) != 0) {
+			free(s.data);
+			continue;
+		}
+
+		for (pass = 0; pass < PASSES; pass++) {
+			if (decode_stream(i, &s, NULL, 0, &ns, &full_bytes) != 0)
+				break;
+			full_ns += ns;
+
+			if (decode_stream(i, &s, side_only, 1, &ns,
+					  &side_bytes) != 0)
+				break;
+			side_ns += ns;
+		}
+
+		if (pass == PASSES) {
+			printf("%s (%zu byte stream)\n", mux_codec_to_name(i),
+			       s.size);
+			report("full", full_ns, s.size, full_bytes);
+			report("side only", side_ns, s.size, side_bytes);
+			benched++;
+		}
+
+		free(s.data);
+	}
+
+	if (!benched)
+		printf("No codecs available\n");
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Measure snapshot size, snapshot time and restore time of a live
+ * encoder and decoder for every codec that supports snapshots
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define WARMUP_MS   200
+#define ITERATIONS  200
+
+static uint8_t blob[1 << 20];
+
+static int warm_up(enum mux_codec_type codec, int sample_rate,
+		   int num_channels, struct mux_encoder **enc_out,
+		   struct mux_decoder **dec_out)
+{
+	size_t frames = sample_rate / 100;
+	struct mux_encoder *enc;
+	struct mux_decoder *dec;
+	uint8_t out[65536];
+	int16_t *pcm;
+	size_t consumed, written;
+	int i;
+
+	enc = mux_encoder_new(codec, sample_rate, num_channels, 2, NULL, 0);
+	dec = mux_decoder_new(codec, 2, NULL, 0);
+	pcm = malloc(frames * num_channels * sizeof(int16_t));
+	if (!enc || !dec || !pcm)
+		goto fail;
+
+	/* Odd-sized chunks leave samples pending inside the encoder */
+	for (i = 0; i < WARMUP_MS / 10; i++) {
+		bench_fill_pcm(pcm, frames - 7, num_channels, sample_rate,
+			       (uint64_t)i * frames);
+		mux_encoder_encode(enc, pcm,
+				   (frames - 7) * num_channels * sizeof(int16_t),
+				   &consumed, MUX_STREAM_AUDIO);
+		while (mux_encoder_read(enc, out, sizeof(out), &written) ==
+		       MUX_OK && written > 0)
+			mux_decoder_decode(dec, out, written, &consumed);
+	}
+
+	free(pcm);
+	*enc_out = enc;
+	*dec_out = dec;
+	return 0;
+
+fail:
+	free(pcm);
+	mux_decoder_destroy(dec);
+	mux_encoder_destroy(enc);
+	return -1;
+}
+
+static void bench_codec(enum mux_codec_type codec, int sample_rate,
+			int num_channels)
+{
+	struct mux_encoder *enc, *enc2;
+	struct mux_decoder *dec, *dec2;
+	size_t enc_size, dec_size;
+	uint64_t t0, snap_ns = 0, restore_ns = 0, dsnap_ns = 0, drestore_ns = 0;
+	int i, ret;
+
+	if (warm_up(codec, sample_rate, num_channels, &enc, &dec) != 0)
+		return;
+
+	ret = mux_encoder_snapshot(enc, blob, sizeof(blob), &enc_size);
+	if (ret != MUX_OK) {
+		printf("%-8s %6d %2d  %s\n", mux_codec_to_name(codec),
+		       sample_rate, num_channels, mux_error_string(ret));
+		goto out;
+	}
+
+	enc2 = mux_encoder_new(codec, sample_rate, num_channels, 2, NULL, 0);
+	dec2 = mux_decoder_new(codec, 2, NULL, 0);
+
+	for (i = 0; i < ITERATIONS; i++) {
+		t0 = bench_now_ns();
+		mux_encoder_snapshot(enc, blob, sizeof(blob), &enc_size);
+		snap_ns += bench_now_ns() - t0;
+
+		t0 = bench_now_ns();
+		mux_encoder_restore(enc2, blob, enc_size);
+		restore_ns += bench_now_ns() - t0;
+
+		t0 = bench_now_ns();
+		mux_decoder_snapshot(dec, blob, sizeof(blob), &dec_size);
+		dsnap_ns += bench_now_ns() - t0;
+
+		t0 = bench_now_ns();
+		mux_decoder_restore(dec2, blob, dec_size);
+		drestore_ns += bench_now_ns() - t0;
+	}
+
+	printf("%-8s %6d %2d %9zu %9.2f %9.2f %9zu %9.2f %9.2f\n",
+	       mux_codec_to_name(codec), sample_rate, num_channels,
+	       enc_size, snap_ns / 1e3 / ITERATIONS,
+	       restore_ns / 1e3 / ITERATIONS,
+	       dec_size, dsnap_ns / 1e3 / ITERATIONS,
+	       drestore_ns / 1e3 / ITERATIONS);
+
+	mux_decoder_destroy(dec2);
+	mux_encoder_destroy(enc2);
+out:
+	mux_decoder_destroy(dec);
+	mux_encoder_destroy(enc);
+}
+
+int main(void)
+{
+	int i;
+
+	printf("%-8s %6s %2s %9s %9s %9s %9s %9s %9s\n",
+	       "codec", "rate", "ch", "enc B", "snap us", "rest us",
+	       "dec B", "snap us", "rest us");
+
+	for (i = 0; i < MUX_CODEC_MAX; i++) {
+		bench_codec(i, 48000, 2);
+		bench_codec(i, 8000, 1);
+	}
+
+	return 0;
+}
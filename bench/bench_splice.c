@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * CPU per call for hold music played into many calls: every call
+ * encoding the music through its own encoder in 20 ms ticks, against
+ * splicing one clip that was encoded once. Calls are live on both
+ * sides, with a little audio before the music and after it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define CALLS    200
+#define SECONDS  10
+
+struct scenario {
+	const char *name;
+	enum mux_codec_type codec;
+	int rate;
+	int channels;
+};
+
+static const struct scenario scenarios[] = {
+	{ "A-law",  MUX_CODEC_ALAW,   8000,  1 },
+	{ "AMR-NB", MUX_CODEC_AMR,    8000,  1 },
+	{ "AMR-WB", MUX_CODEC_AMR_WB, 16000, 1 },
+	{ "Opus",   MUX_CODEC_OPUS,   48000, 1 },
+	{ "Vorbis", MUX_CODEC_VORBIS, 44100, 2 },
+};
+
+static uint8_t out[1 << 16];
+
+static size_t drain(struct mux_encoder *enc)
+{
+	size_t written, total = 0;
+
+	while (mux_encoder_read(enc, out, sizeof(out), &written) == MUX_OK &&
+	       written > 0)
+		total += written;
+	return total;
+}
+
+static int encode(struct mux_encoder *enc, const int16_t *pcm, size_t frames,
+		  int channels)
+{
+	size_t consumed;
+
+	return mux_encoder_encode(enc, pcm, frames * (size_t)channels *
+				  sizeof(*pcm), &consumed, MUX_STREAM_AUDIO);
+}
+
+/* The music once, as a whole stream */
+static uint8_t *make_clip(const struct scenario *s, const int16_t *music,
+			  size_t frames, struct mux_clip *clip)
+{
+	struct mux_encoder *enc;
+	size_t cap = 1 << 20, len = 0, written;
+	uint8_t *data;
+
+	enc = mux_encoder_new(s->codec, s->rate, s->channels, 2, NULL, 0);
+	data = malloc(cap);
+	if (!enc || !data || encode(enc, music, frames, s->channels) != MUX_OK ||
+	    mux_encoder_finalize(enc) != MUX_OK) {
+		mux_encoder_destroy(enc);
+		free(data);
+		return NULL;
+	}
+	while (len < cap && mux_encoder_read(enc, data + len, cap - len,
+					     &written) == MUX_OK && written > 0)
+		len += written;
+	mux_encoder_destroy(enc);
+
+	memset(clip, 0, sizeof(*clip));
+	clip->codec_type = s->codec;
+	clip->num_streams = 2;
+	clip->sample_rate = s->rate;
+	clip->num_channels = s->channels;
+	clip->duration = frames;
+	clip->data = data;
+	clip->size = len;
+	return data;
+}
+
+/* CPU ns for all calls; splice or re-encode the music */
+static int run(const struct scenario *s, const int16_t *music, size_t frames,
+	       const struct mux_clip *clip, uint64_t *cpu_ns, uint64_t *bytes)
+{
+	struct mux_encoder *enc;
+	size_t tick = (size_t)s->rate / 50, pos;
+	uint64_t t0;
+	int call, ret = 0;
+
+	*cpu_ns = 0;
+	*bytes = 0;
+	for (call = 0; call < CALLS && ret == 0; call++) {
+		enc = mux_encoder_new(s->codec, s->rate, s->channels, 2, NULL, 0);
+		if (!enc)
+			return -1;
+
+		t0 = bench_cpu_ns();
+		/* A greeting, the music, then the agent picks up */
+		ret = encode(enc, music, tick * 3 / 2, s->channels);
+		if (clip) {
+			if (ret == MUX_OK)
+				ret = mux_encoder_splice(enc, clip);
+		} else {
+			for (pos = 0; pos + tick <= frames && ret == MUX_OK;
+			     pos += tick) {
+				ret = encode(enc, music + pos * (size_t)s->channels,
+					     tick, s->channels);
+				*bytes += drain(enc);
+			}
+		}
+		if (ret == MUX_OK)
+			ret = encode(enc, music, tick * 3 / 2, s->channels);
+		if (ret == MUX_OK)
+			ret = mux_encoder_finalize(enc);
+		*bytes += drain(enc);
+		*cpu_ns += bench_cpu_ns() - t0;
+		mux_encoder_destroy(enc);
+	}
+	return ret;
+}
+
+int main(void)
+{
+	struct mux_clip clip;
+	uint64_t enc_ns, splice_ns, enc_bytes, splice_bytes;
+	size_t i, frames;
+	int16_t *music;
+	uint8_t *data;
+
+	printf("%d calls, %d s of hold music each\n\n", CALLS, SECONDS);
+	printf("%-8s | %14s %10s | %14s %10s | %8s\n", "", "re-encode",
+	       "", "splice", "", "");
+	printf("%-8s | %14s %10s | %14s %10s | %8s\n", "codec",
+	       "us/call-sec", "KiB/call", "us/call-sec", "KiB/call",
+	       "speedup");
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		const struct scenario *s = &scenarios[i];
+
+		frames = (size_t)s->rate * SECONDS;
+		music = malloc(frames * (size_t)s->channels * sizeof(*music));
+		if (!music)
+			return 1;
+		bench_fill_pcm(music, frames, s->channels, s->rate, 0);
+
+		data = make_clip(s, music, frames, &clip);
+		if (!data || run(s, music, frames, NULL, &enc_ns,
+				 &enc_bytes) != 0 ||
+		    run(s, music, frames, &clip, &splice_ns,
+			&splice_bytes) != 0) {
+			printf("%-8s (not available)\n", s->name);
+			free(data);
+			free(music);
+			continue;
+		}
+
+		printf("%-8s | %14.2f %10.1f | %14.2f %10.1f | %7.0fx\n",
+		       s->name,
+		       (double)enc_ns / 1000 / CALLS / SECONDS,
+		       (double)enc_bytes / 1024 / CALLS,
+		       (double)splice_ns / 1000 / CALLS / SECONDS,
+		       (double)splice_bytes / 1024 / CALLS,
+		       splice_ns ? (double)enc_ns / (double)splice_ns : 0);
+		free(data);
+		free(music);
+	}
+	return 0;
+}
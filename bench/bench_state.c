@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Side channel bytes and CPU for slowly changing state: 40 settings
+ * that never change, now-playing that changes every 10 s and 8 levels
+ * that change every 20 ms tick. Resending the whole state as a blob,
+ * every tick or once a second (so late joiners wait up to a second),
+ * against keyed state with a snapshot every second. CPU is encode plus
+ * decode of the A-law call it rides on; the blob is not even parsed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE      8000
+#define TICK      (RATE / 50)
+#define SECONDS   60
+#define TICKS     (SECONDS * 50)
+#define SETTINGS  40
+#define LEVELS    8
+
+enum mode {
+	AUDIO_ONLY,
+	BLOB_TICK,
+	BLOB_SECOND,
+	KEYED,
+	MODES
+};
+
+static const char *const names[MODES] = {
+	"audio only", "blob every tick", "blob every second", "keyed state"
+};
+
+static int16_t pcm[TICK];
+static uint8_t out[1 << 16];
+
+struct state {
+	char settings[SETTINGS][48];
+	char title[64];
+	char levels[LEVELS][16];
+};
+
+static void advance(struct state *s, int t)
+{
+	int i;
+
+	if (t == 0)
+		for (i = 0; i < SETTINGS; i++)
+			snprintf(s->settings[i], sizeof(s->settings[i]),
+				 "setting %d value, fixed for the call", i);
+	snprintf(s->title, sizeof(s->title), "Now playing: track %d", t / 500);
+	for (i = 0; i < LEVELS; i++)
+		snprintf(s->levels[i], sizeof(s->levels[i]), "%d",
+			 -((t * 7 + i * 13) % 60));
+}
+
+static size_t blob(const struct state *s, char *buf, size_t cap)
+{
+	size_t n = 0;
+	int i;
+
+	for (i = 0; i < SETTINGS; i++)
+		n += (size_t)snprintf(buf + n, cap - n, "setting%d=%s\n", i,
+				      s->settings[i]);
+	n += (size_t)snprintf(buf + n, cap - n, "title=%s\n", s->title);
+	for (i = 0; i < LEVELS; i++)
+		n += (size_t)snprintf(buf + n, cap - n, "level%d=%s\n", i,
+				      s->levels[i]);
+	return n;
+}
+
+static char setting_keys[SETTINGS][16], level_keys[LEVELS][16];
+
+/* Everything, every tick: only what changed goes out */
+static int set_keys(struct mux_encoder *enc, const struct state *s)
+{
+	int i, ret = MUX_OK;
+
+	for (i = 0; i < SETTINGS && ret == MUX_OK; i++)
+		ret = mux_encoder_state_set(enc, setting_keys[i],
+					    s->settings[i],
+					    strlen(s->settings[i]));
+	if (ret == MUX_OK)
+		ret = mux_encoder_state_set(enc, "title", s->title,
+					    strlen(s->title));
+	for (i = 0; i < LEVELS && ret == MUX_OK; i++)
+		ret = mux_encoder_state_set(enc, level_keys[i], s->levels[i],
+					    strlen(s->levels[i]));
+	return ret;
+}
+
+static int run(enum mode mode, uint64_t *cpu_ns, uint64_t *side_bytes)
+{
+	struct mux_encoder *enc;
+	struct mux_decoder *dec;
+	struct mux_state_stats stats;
+	struct mux_state_event ev;
+	struct state s;
+	char buf[4096];
+	size_t consumed, written, n, pos;
+	uint64_t t0;
+	int t, type, ret;
+
+	enc = mux_encoder_new(MUX_CODEC_ALAW, RATE, 1, 2, NULL, 0);
+	dec = mux_decoder_new(MUX_CODEC_ALAW, 2, NULL, 0);
+	if (!enc || !dec) {
+		mux_encoder_destroy(enc);
+		mux_decoder_destroy(dec);
+		return -1;
+	}
+
+	*side_bytes = 0;
+	t0 = bench_cpu_ns();
+	ret = MUX_OK;
+	if (mode == KEYED) {
+		ret = mux_encoder_set_state(enc, 1000);
+		if (ret == MUX_OK)
+			ret = mux_decoder_set_state(dec, 1);
+	}
+
+	for (t = 0; t < TICKS && ret == MUX_OK; t++) {
+		advance(&s, t);
+		if (mode == KEYED) {
+			ret = set_keys(enc, &s);
+		} else if (mode == BLOB_TICK ||
+			   (mode == BLOB_SECOND && t % 50 == 0)) {
+			n = blob(&s, buf, sizeof(buf));
+			ret = mux_encoder_encode(enc, buf, n, &consumed,
+						 MUX_STREAM_SIDE_CHANNEL);
+			*side_bytes += n;
+		}
+		if (ret == MUX_OK)
+			ret = mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+						 MUX_STREAM_AUDIO);
+
+		while (ret == MUX_OK &&
+		       mux_encoder_read(enc, out, sizeof(out), &written) ==
+		       MUX_OK && written > 0) {
+			for (pos = 0; pos < written && ret == MUX_OK;
+			     pos += consumed)
+				ret = mux_decoder_decode(dec, out + pos,
+							 written - pos,
+							 &consumed);
+		}
+		while (ret == MUX_OK &&
+		       mux_decoder_read(dec, buf, sizeof(buf), &written,
+					&type) == MUX_OK && written > 0)
+			;
+		while (mode == KEYED &&
+		       mux_decoder_state_next_event(dec, &ev) == MUX_OK)
+			;
+	}
+	*cpu_ns = bench_cpu_ns() - t0;
+
+	if (mode == KEYED && mux_encoder_get_state_stats(enc, &stats) == MUX_OK)
+		*side_bytes = stats.bytes;
+
+	mux_encoder_destroy(enc);
+	mux_decoder_destroy(dec);
+	return ret == MUX_OK ? 0 : -1;
+}
+
+int main(void)
+{
+	uint64_t cpu_ns, bytes;
+	int i, m;
+
+	for (i = 0; i < SETTINGS; i++)
+		snprintf(setting_keys[i], sizeof(setting_keys[i]), "setting%d",
+			 i);
+	for (i = 0; i < LEVELS; i++)
+		snprintf(level_keys[i], sizeof(level_keys[i]), "level%d", i);
+
+	bench_fill_pcm(pcm, TICK, 1, RATE, 0);
+
+	printf("%d s of an A-law call, 20 ms ticks\n\n", SECONDS);
+	printf("%-18s | %12s | %16s\n", "side channel", "side B/s",
+	       "CPU us/stream-s");
+
+	for (m = 0; m < MODES; m++) {
+		if (run((enum mode)m, &cpu_ns, &bytes) != 0) {
+			printf("%-18s (failed)\n", names[m]);
+			continue;
+		}
+		printf("%-18s | %12.0f | %16.2f\n", names[m],
+		       (double)bytes / SECONDS, (double)cpu_ns / 1000 / SECONDS);
+	}
+	return 0;
+}
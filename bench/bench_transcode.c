@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Cost of changing a stream's framing: packets copied by the
+ * transcoder versus decoded and encoded again (passthrough=0), per
+ * second of audio
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE      48000
+#define CHANNELS  2
+#define SECONDS   10
+#define FRAMES    (RATE / 50)
+#define ITERS     20
+
+static uint8_t *make_input(enum mux_codec_type codec, size_t *len)
+{
+	static int16_t pcm[FRAMES * CHANNELS];
+	struct mux_encoder *enc;
+	size_t consumed, written, cap = 1 << 20;
+	uint8_t *buf;
+	int i;
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	buf = malloc(cap);
+	if (!enc || !buf) {
+		mux_encoder_destroy(enc);
+		free(buf);
+		return NULL;
+	}
+
+	*len = 0;
+	for (i = 0; i < SECONDS * 50; i++) {
+		bench_fill_pcm(pcm, FRAMES, CHANNELS, RATE, (size_t)i * FRAMES);
+		mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				   MUX_STREAM_AUDIO);
+		for (;;) {
+			if (cap - *len < 65536) {
+				uint8_t *p = realloc(buf, cap * 2);
+
+				if (!p)
+					goto fail;
+				buf = p;
+				cap *= 2;
+			}
+			if (mux_encoder_read(enc, buf + *len, cap - *len,
+					     &written) != MUX_OK || !written)
+				break;
+			*len += written;
+		}
+	}
+	mux_encoder_destroy(enc);
+	return buf;
+
+fail:
+	mux_encoder_destroy(enc);
+	free(buf);
+	return NULL;
+}
+
+static int run(enum mux_codec_type codec, const uint8_t *in, size_t len,
+	       int passthrough, double *ns_per_sec)
+{
+	static uint8_t out[65536];
+	struct mux_param p = { .name = "passthrough" };
+	struct mux_transcoder *tc;
+	size_t pos, n, consumed, written;
+	uint64_t t0;
+	int i;
+
+	p.value.b = passthrough;
+	t0 = bench_cpu_ns();
+	for (i = 0; i < ITERS; i++) {
+		tc = mux_transcoder_new(codec, 2, codec, 1, RATE, CHANNELS,
+					&p, 1);
+		if (!tc)
+			return -1;
+		for (pos = 0; pos < len; pos += n) {
+			n = len - pos < 4096 ? len - pos : 4096;
+			if (mux_transcoder_feed(tc, in + pos, n, &consumed) !=
+			    MUX_OK) {
+				mux_transcoder_destroy(tc);
+				return -1;
+			}
+			while (mux_transcoder_read(tc, out, sizeof(out),
+						   &written) == MUX_OK && written)
+				;
+		}
+		mux_transcoder_finalize(tc);
+		while (mux_transcoder_read(tc, out, sizeof(out), &written) ==
+		       MUX_OK && written)
+			;
+		mux_transcoder_destroy(tc);
+	}
+	*ns_per_sec = (double)(bench_cpu_ns() - t0) / ITERS / SECONDS;
+	return 0;
+}
+
+int main(void)
+{
+	static const enum mux_codec_type codecs[] = {
+		MUX_CODEC_PCM, MUX_CODEC_ALAW, MUX_CODEC_FLAC,
+		MUX_CODEC_OPUS, MUX_CODEC_VORBIS, MUX_CODEC_MP3,
+	};
+	double copy_ns, full_ns;
+	uint8_t *in;
+	size_t i, len;
+
+	printf("Two streams to one, %d s of %d Hz %d ch, CPU time per second of audio\n\n",
+	       SECONDS, RATE, CHANNELS);
+	printf("%-8s %12s %14s %10s\n", "codec", "copy us", "transcode us",
+	       "speedup");
+
+	for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		in = make_input(codecs[i], &len);
+		if (!in)
+			continue;
+		if (run(codecs[i], in, len, 1, &copy_ns) == 0 &&
+		    run(codecs[i], in, len, 0, &full_ns) == 0)
+			printf("%-8s %12.1f %14.1f %9.1fx\n",
+			       mux_codec_to_name(codecs[i]), copy_ns / 1000,
+			       full_ns / 1000, full_ns / copy_ns);
+		free(in);
+	}
+
+	return 0;
+}
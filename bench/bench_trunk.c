@@ -0,0 +1,262 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Many G.711 calls between two gateways, 20 ms per packet: a socket
+ * pair per call carrying its own stream against one trunk carrying
+ * them all. Reports packets per second and CPU per packet for the
+ * whole path, encode to decoded PCM, in one thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "mux.h"
+#include "bench_utils.h"
+
+#define RATE     8000
+#define TICK     160             /* 20 ms */
+#define TICKS    250
+#define CALLS    1000
+#define WIRE     65536
+
+enum mode { CODEC_ONLY, PER_CONNECTION, TRUNK };
+
+struct call {
+	struct mux_encoder *enc;
+	struct mux_decoder *dec;
+	int fd[2];
+	int slot;
+};
+
+static struct call *calls;
+static int num_calls;
+static int16_t pcm[TICK];
+static uint8_t wire[WIRE];
+static uint8_t out[WIRE];
+
+struct result {
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	uint64_t syscalls;
+	uint64_t wire_bytes;
+};
+
+static int drain_decoder(struct mux_decoder *dec)
+{
+	size_t written;
+	int type;
+
+	while (mux_decoder_read(dec, out, sizeof(out), &written, &type) ==
+	       MUX_OK && written > 0)
+		;
+	return 0;
+}
+
+/* Encode, carry and decode one packet of a call on its own */
+static int run_call(struct call *c, enum mode mode, struct result *res)
+{
+	size_t consumed, written, got;
+	ssize_t n;
+
+	if (mux_encoder_encode(c->enc, pcm, sizeof(pcm), &consumed,
+			       MUX_STREAM_AUDIO) != MUX_OK ||
+	    mux_encoder_read(c->enc, wire, sizeof(wire), &written) != MUX_OK)
+		return -1;
+
+	got = written;
+	if (mode == PER_CONNECTION) {
+		if (write(c->fd[0], wire, written) != (ssize_t)written)
+			return -1;
+		n = read(c->fd[1], wire, sizeof(wire));
+		if (n <= 0)
+			return -1;
+		got = (size_t)n;
+		res->syscalls += 2;
+		res->wire_bytes += got;
+	}
+
+	if (mux_decoder_decode(c->dec, wire, got, &consumed) != MUX_OK)
+		return -1;
+	return drain_decoder(c->dec);
+}
+
+/* All calls' packets of one tick through the trunk */
+static int run_trunk_tick(struct mux_trunk_writer *w,
+			  struct mux_trunk_reader *r, int fd[2],
+			  struct result *res)
+{
+	struct mux_trunk_session s;
+	size_t consumed, written;
+	ssize_t n;
+	int i, type;
+
+	for (i = 0; i < num_calls; i++)
+		if (mux_encoder_encode(calls[i].enc, pcm, sizeof(pcm), &consumed,
+				       MUX_STREAM_AUDIO) != MUX_OK)
+			return -1;
+	if (mux_trunk_writer_collect(w) != MUX_OK)
+		return -1;
+
+	while (mux_trunk_writer_read(w, wire, sizeof(wire), &written) ==
+	       MUX_OK && written > 0) {
+		if (write(fd[0], wire, written) != (ssize_t)written)
+			return -1;
+		res->syscalls++;
+		res->wire_bytes += written;
+		while (written > 0) {
+			n = read(fd[1], out, written);
+			if (n <= 0)
+				return -1;
+			res->syscalls++;
+			written -= (size_t)n;
+			if (mux_trunk_reader_feed(r, out, (size_t)n,
+						  &consumed) != MUX_OK)
+				return -1;
+			while (mux_trunk_reader_read(r, &s, out, sizeof(out),
+						     &consumed, &type) ==
+			       MUX_OK && type >= 0)
+				;
+		}
+	}
+	return 0;
+}
+
+static int setup(enum mode mode)
+{
+	int i;
+
+	for (i = 0; i < num_calls; i++) {
+		calls[i].enc = mux_encoder_new(MUX_CODEC_ALAW, RATE, 1, 1,
+					       NULL, 0);
+		calls[i].dec = mode == TRUNK ? NULL :
+			       mux_decoder_new(MUX_CODEC_ALAW, 1, NULL, 0);
+		if (!calls[i].enc || (mode != TRUNK && !calls[i].dec))
+			return -1;
+		if (mode == PER_CONNECTION &&
+		    socketpair(AF_UNIX, SOCK_STREAM, 0, calls[i].fd) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void teardown(enum mode mode)
+{
+	int i;
+
+	for (i = 0; i < num_calls; i++) {
+		mux_encoder_destroy(calls[i].enc);
+		mux_decoder_destroy(calls[i].dec);
+		if (mode == PER_CONNECTION) {
+			close(calls[i].fd[0]);
+			close(calls[i].fd[1]);
+		}
+	}
+	memset(calls, 0, (size_t)num_calls * sizeof(*calls));
+}
+
+static int run(enum mode mode, struct result *res)
+{
+	struct mux_trunk_writer *w = NULL;
+	struct mux_trunk_reader *r = NULL;
+	uint64_t t0, c0;
+	int fd[2] = { -1, -1 };
+	int i, tick, ret = -1;
+
+	memset(res, 0, sizeof(*res));
+	if (setup(mode) != 0)
+		goto out;
+
+	if (mode == TRUNK) {
+		w = mux_trunk_writer_new();
+		r = mux_trunk_reader_new(NULL, 0);
+		if (!w || !r || socketpair(AF_UNIX, SOCK_STREAM, 0, fd) != 0)
+			goto out;
+		for (i = 0; i < num_calls; i++)
+			if (mux_trunk_writer_add(w, (uint32_t)i, calls[i].enc,
+						 &calls[i].slot) != MUX_OK)
+				goto out;
+	}
+
+	t0 = bench_now_ns();
+	c0 = bench_cpu_ns();
+	for (tick = 0; tick < TICKS; tick++) {
+		if (mode == TRUNK) {
+			if (run_trunk_tick(w, r, fd, res) != 0)
+				goto out;
+			continue;
+		}
+		for (i = 0; i < num_calls; i++)
+			if (run_call(&calls[i], mode, res) != 0)
+				goto out;
+	}
+	res->cpu_ns = bench_cpu_ns() - c0;
+	res->wall_ns = bench_now_ns() - t0;
+	ret = 0;
+
+out:
+	mux_trunk_writer_destroy(w);
+	mux_trunk_reader_destroy(r);
+	if (fd[0] >= 0) {
+		close(fd[0]);
+		close(fd[1]);
+	}
+	teardown(mode);
+	return ret;
+}
+
+/* Two fds per call for the per-connection model */
+static int max_calls(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+		return 100;
+	if (rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		getrlimit(RLIMIT_NOFILE, &rl);
+	}
+	if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > 2 * CALLS + 64)
+		return CALLS;
+	return ((int)rl.rlim_cur - 64) / 2;
+}
+
+int main(void)
+{
+	static const char *names[] = {
+		"codec only", "per-connection", "trunk"
+	};
+	struct result res;
+	uint64_t packets;
+	int mode;
+
+	num_calls = max_calls();
+	if (num_calls <= 0)
+		return 1;
+	calls = calloc((size_t)num_calls, sizeof(*calls));
+	if (!calls)
+		return 1;
+	bench_fill_pcm(pcm, TICK, 1, RATE, 0);
+	packets = (uint64_t)num_calls * TICKS;
+
+	printf("%d A-law calls, %d packets of 20 ms each\n\n", num_calls,
+	       TICKS);
+	printf("%-16s %12s %12s %12s %12s\n", "model", "packets/s",
+	       "CPU ns/pkt", "syscall/tick", "wire B/pkt");
+
+	for (mode = CODEC_ONLY; mode <= TRUNK; mode++) {
+		if (run(mode, &res) != 0) {
+			printf("%-16s failed\n", names[mode]);
+			continue;
+		}
+		printf("%-16s %12.0f %12.0f %12.1f %12.1f\n", names[mode],
+		       (double)packets * 1e9 / (double)res.wall_ns,
+		       (double)res.cpu_ns / (double)packets,
+		       (double)res.syscalls / TICKS,
+		       (double)res.wire_bytes / (double)packets);
+	}
+
+	free(calls);
+	return 0;
+}
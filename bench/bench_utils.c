@@ -0,0 +1,213 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "bench_utils.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t bench_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void bench_fill_pcm(int16_t *pcm, size_t frames, int num_channels,
+		    int sample_rate, uint64_t offset)
+{
+	uint32_t seed = (uint32_t)offset * 2654435761u + 1;
+	size_t i;
+	int c;
+
+	for (i = 0; i < frames; i++) {
+		double t = (double)(offset + i) / sample_rate;
+		double v = 0.4 * sin(2.0 * M_PI * 440.0 * t);
+
+		seed = seed * 1103515245u + 12345u;
+		v += 0.05 * ((double)(seed >> 16) / 32768.0 - 1.0);
+
+		for (c = 0; c < num_channels; c++)
+			pcm[i * num_channels + c] = (int16_t)(v * 32767.0);
+	}
+}
+
+#ifdef __linux__
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} counter_events[BENCH_COUNTER_MAX] = {
+	[BENCH_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[BENCH_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[BENCH_L1D_MISSES] = {
+		PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_L1D |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+	},
+	[BENCH_LLC_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[BENCH_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static int counter_fd[BENCH_COUNTER_MAX] = { -1, -1, -1, -1, -1 };
+static unsigned int counter_valid;
+
+unsigned int bench_perf_open(void)
+{
+	struct perf_event_attr attr;
+	int i, fd;
+
+	if (counter_valid)
+		return counter_valid;
+
+	for (i = 0; i < BENCH_COUNTER_MAX; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counter_events[i].type;
+		attr.config = counter_events[i].config;
+		/* User space only: allowed at perf_event_paranoid <= 2 */
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		/* Scale for multiplexing when the PMU runs out of counters */
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+				   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+				  PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		counter_fd[i] = fd;
+		counter_valid |= 1u << i;
+	}
+
+	return counter_valid;
+}
+
+void bench_perf_close(void)
+{
+	int i;
+
+	for (i = 0; i < BENCH_COUNTER_MAX; i++) {
+		if (counter_fd[i] >= 0)
+			close(counter_fd[i]);
+		counter_fd[i] = -1;
+	}
+	counter_valid = 0;
+}
+
+static uint64_t read_counter(int fd)
+{
+	uint64_t v[3];
+
+	if (read(fd, v, sizeof(v)) != (ssize_t)sizeof(v) || v[2] == 0)
+		return 0;
+	if (v[2] == v[1])
+		return v[0];
+	return (uint64_t)((double)v[0] * v[1] / v[2]);
+}
+#else
+unsigned int bench_perf_open(void)
+{
+	return 0;
+}
+
+void bench_perf_close(void)
+{
+}
+
+static uint64_t read_counter(int fd)
+{
+	(void)fd;
+	return 0;
+}
+
+static const int counter_fd[BENCH_COUNTER_MAX];
+static const unsigned int counter_valid;
+#endif
+
+void bench_perf_begin(struct bench_perf *p)
+{
+	int i;
+
+	p->valid = counter_valid;
+	for (i = 0; i < BENCH_COUNTER_MAX; i++)
+		if (counter_valid & (1u << i))
+			p->count[i] -= read_counter(counter_fd[i]);
+	p->cpu_ns -= bench_cpu_ns();
+	p->wall_ns -= bench_now_ns();
+}
+
+void bench_perf_end(struct bench_perf *p)
+{
+	int i;
+
+	p->wall_ns += bench_now_ns();
+	p->cpu_ns += bench_cpu_ns();
+	for (i = 0; i < BENCH_COUNTER_MAX; i++)
+		if (p->valid & (1u << i))
+			p->count[i] += read_counter(counter_fd[i]);
+}
+
+void bench_perf_print_header(void)
+{
+	printf("%-8s %-8s %8s %8s %7s %8s %5s %8s %8s %8s\n",
+	       "codec", "stage", "ns/smp", "cyc/smp", "cyc/B", "ins/smp",
+	       "IPC", "L1m/KB", "LLCm/KB", "brm/KB");
+}
+
+static void print_ratio(unsigned int valid, int counter, uint64_t value,
+			double div, int width, int prec)
+{
+	if (valid & (1u << counter))
+		printf(" %*.*f", width, prec, value / div);
+	else
+		printf(" %*s", width, "-");
+}
+
+void bench_perf_print(const char *name, const char *stage,
+		      const struct bench_perf *p, uint64_t samples,
+		      uint64_t bytes)
+{
+	double smp = samples ? (double)samples : 1.0;
+	double b = bytes ? (double)bytes : 1.0;
+	unsigned int ipc_valid = (p->valid >> BENCH_CYCLES & 1) &&
+				 (p->valid >> BENCH_INSTRUCTIONS & 1) &&
+				 p->count[BENCH_CYCLES] ?
+				 1u << BENCH_CYCLES : 0;
+
+	printf("%-8s %-8s %8.1f", name, stage, p->cpu_ns / smp);
+	print_ratio(p->valid, BENCH_CYCLES, p->count[BENCH_CYCLES], smp, 8, 1);
+	print_ratio(p->valid, BENCH_CYCLES, p->count[BENCH_CYCLES], b, 7, 2);
+	print_ratio(p->valid, BENCH_INSTRUCTIONS, p->count[BENCH_INSTRUCTIONS],
+		    smp, 8, 1);
+	print_ratio(ipc_valid, BENCH_CYCLES, p->count[BENCH_INSTRUCTIONS],
+		    ipc_valid ? (double)p->count[BENCH_CYCLES] : 1.0, 5, 2);
+	print_ratio(p->valid, BENCH_L1D_MISSES, p->count[BENCH_L1D_MISSES],
+		    b / 1024.0, 8, 2);
+	print_ratio(p->valid, BENCH_LLC_MISSES, p->count[BENCH_LLC_MISSES],
+		    b / 1024.0, 8, 2);
+	print_ratio(p->valid, BENCH_BRANCH_MISSES,
+		    p->count[BENCH_BRANCH_MISSES], b / 1024.0, 8, 2);
+	printf("\n");
+}
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Shared helpers for the benchmark programs
+ */
+#ifndef BENCH_UTILS_H
+#define BENCH_UTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Monotonic wall clock in nanoseconds */
+uint64_t bench_now_ns(void);
+
+/* CPU time consumed by the calling thread in nanoseconds */
+uint64_t bench_cpu_ns(void);
+
+/* Fill interleaved 16-bit PCM with a deterministic tone plus noise */
+void bench_fill_pcm(int16_t *pcm, size_t frames, int num_channels,
+		    int sample_rate, uint64_t offset);
+
+/*
+ * Hardware performance counters (Linux perf_event_open) around a
+ * measured region of the calling thread. Counters that can't be opened
+ * (no PMU, containers, perf_event_paranoid) are left out of valid and
+ * the region still measures wall and CPU time.
+ */
+enum bench_counter {
+	BENCH_CYCLES,
+	BENCH_INSTRUCTIONS,
+	BENCH_L1D_MISSES,
+	BENCH_LLC_MISSES,
+	BENCH_BRANCH_MISSES,
+	BENCH_COUNTER_MAX
+};
+
+struct bench_perf {
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	uint64_t count[BENCH_COUNTER_MAX];
+	unsigned int valid;  /* bit per enum bench_counter */
+};
+
+/*
+ * Open the counters once per process; returns the valid mask. They
+ * count only the thread that opened them, so begin/end regions must
+ * run on that thread.
+ */
+unsigned int bench_perf_open(void);
+void bench_perf_close(void);
+
+/* Region deltas accumulate into p, so a stage can span several calls */
+void bench_perf_begin(struct bench_perf *p);
+void bench_perf_end(struct bench_perf *p);
+
+/* Column header and one row, normalized per sample frame and per byte */
+void bench_perf_print_header(void);
+void bench_perf_print(const char *name, const char *stage,
+		      const struct bench_perf *p, uint64_t samples,
+		      uint64_t bytes);
+
+#endif /* BENCH_UTILS_H */
@@ -55,6 +55,9 @@ enum mux_param_type {
 #define MUX_ERROR_DECODE   -7  /* Decoding error */
 #define MUX_ERROR_FORMAT   -8  /* Format/container error */
 #define MUX_ERROR_INIT     -9  /* Initialization error */
+#define MUX_ERROR_UNSUPPORTED -10 /* Operation not supported by codec */
+#define MUX_ERROR_LIMIT    -11 /* Stream exceeds a configured resource limit */
+#define MUX_ERROR_NOTFOUND -12 /* No such entry */
 
 /*
  * Error information structure
@@ -163,6 +166,56 @@ struct mux_sample_rate_list {
 int mux_get_supported_sample_rates(enum mux_codec_type codec_type,
 				    struct mux_sample_rate_list *list);
 
+/*
+ * Codec cost model
+ *
+ * Estimates are per configuration (codec, sample rate, channels).
+ * Until a configuration has been calibrated on the current host the
+ * figures come from a built-in nominal table and calibrated is 0.
+ */
+struct mux_codec_cost {
+	uint64_t encode_ns_per_sec;  /* CPU ns to encode one second of audio */
+	uint64_t decode_ns_per_sec;  /* CPU ns to decode one second of audio */
+	int frame_samples;           /* samples per channel in a codec frame */
+	int latency_samples;         /* algorithmic latency in samples */
+	int bytes_per_sec;           /* typical muxed output bytes per second */
+	int calibrated;              /* non-zero if measured on this host */
+};
+
+/*
+ * Run short built-in micro-encodes and micro-decodes for one
+ * configuration and cache the measured cost. Uses default codec
+ * parameters. Not thread-safe; intended to run at startup.
+ */
+int mux_calibrate(enum mux_codec_type codec_type,
+		  int sample_rate,
+		  int num_channels);
+
+/*
+ * Calibrate every compiled codec that supports the given configuration.
+ * Returns the number of codecs calibrated.
+ */
+int mux_calibrate_all(int sample_rate, int num_channels);
+
+/*
+ * Query the estimated cost of a configuration
+ */
+int mux_codec_cost(enum mux_codec_type codec_type,
+		   int sample_rate,
+		   int num_channels,
+		   struct mux_codec_cost *cost);
+
+/*
+ * Pick the cheapest compiled codec (encode + decode CPU) whose latency
+ * and output rate fit the given limits. A limit of 0 means unlimited.
+ * Returns MUX_ERROR_NOCODEC if nothing fits.
+ */
+int mux_codec_select(int sample_rate,
+		     int num_channels,
+		     int max_latency_ms,
+		     int max_bytes_per_sec,
+		     enum mux_codec_type *codec);
+
 /*
  * Encoder - static allocation
  */
@@ -188,6 +241,16 @@ struct mux_encoder *mux_encoder_new(enum mux_codec_type codec_type,
 
 void mux_encoder_destroy(struct mux_encoder *enc);
 
+/*
+ * Encoder parameters accepted for every codec:
+ *   channel_groups (int) - 1 or 2: encode the channels as mono or
+ *   stereo groups, each with its own codec instance, interleaved as
+ *   tagged LEB128 frames behind a group map. This is a different
+ *   stream format; decoders need channel_groups too. 0 = off.
+ *   threads (int) - worker threads for the groups, 0 = one per CPU.
+ *   Each session starts its own, so the default is 1 (no workers).
+ */
+
 /*
  * Decoder - static allocation
  */
@@ -209,6 +272,34 @@ struct mux_decoder *mux_decoder_new(enum mux_codec_type codec_type,
 
 void mux_decoder_destroy(struct mux_decoder *dec);
 
+/*
+ * Decoder parameters accepted for every codec:
+ *   side_only (bool) - only demultiplex and return side channel data.
+ *   Audio payloads are skipped unparsed and no codec state is created,
+ *   so this works even for codecs that aren't compiled in. Requires
+ *   num_streams == 2. Snapshots are not supported in this mode.
+ *   lazy (bool) - mux_decoder_decode() only queues the compressed input;
+ *   mux_decoder_read() decodes frames/pages from the queue until the
+ *   request can be filled. Buffered data stays compressed and audio
+ *   that is never read is never decoded. mux_decoder_finalize() takes
+ *   effect once the queue has been read. A snapshot decodes the queue.
+ *   channel_groups (bool) - decode a stream written with the encoder's
+ *   channel_groups; max_channels applies to the total.
+ *   threads (int) - as for the encoder, default 1.
+ *
+ * Resource limits for untrusted input (int). Violations are rejected
+ * as soon as they are visible, with MUX_ERROR_LIMIT:
+ *   max_frame_size     - largest frame or packet payload (16 MiB)
+ *   max_buffered_input - undecoded input held by the decoder (64 MiB,
+ *                        raised to fit at least one maximal frame)
+ *   max_channels       - channels a stream header may declare (255)
+ *   max_sample_rate    - sample rate a stream header may declare (384000)
+ *   max_decode_input   - input bytes taken per mux_decoder_decode() call
+ *                        (0 = unlimited)
+ * When input is capped, *input_consumed is less than input_size and the
+ * remainder must be passed again.
+ */
+
 /*
  * Encoding: audio/side_channel → multiplexed bytes
  */
@@ -251,6 +342,698 @@ int mux_decoder_read(struct mux_decoder *dec,
  */
 int mux_decoder_finalize(struct mux_decoder *dec);
 
+/*
+ * Session snapshot/restore
+ *
+ * Serialize the complete codec and mux state of a live encoder or
+ * decoder into a flat blob, so the session can continue elsewhere
+ * without a glitch or a new stream header. Blobs are only portable
+ * between identical builds on the same architecture.
+ *
+ * If blob is NULL, *blob_written is set to the required size. If
+ * blob_size is too small, MUX_ERROR_INVAL is returned and
+ * *blob_written holds the required size.
+ *
+ * restore expects an encoder/decoder initialized with the same
+ * configuration; the *_new_from_snapshot variants create one. Decoder
+ * blobs carry the params the decoder was created with (lazy, limits,
+ * output reduction, channel groups), so a decoder made from one is set
+ * up like the original.
+ * Codecs whose library state can't be serialized return
+ * MUX_ERROR_UNSUPPORTED, as does an Opus blob from another libopus
+ * version (or, without dladdr(), one loaded at another address). A
+ * restore that fails leaves the encoder/decoder as it was.
+ */
+int mux_encoder_snapshot(struct mux_encoder *enc,
+			 void *blob,
+			 size_t blob_size,
+			 size_t *blob_written);
+
+int mux_encoder_restore(struct mux_encoder *enc,
+			const void *blob,
+			size_t blob_size);
+
+struct mux_encoder *mux_encoder_new_from_snapshot(const void *blob,
+						  size_t blob_size);
+
+int mux_decoder_snapshot(struct mux_decoder *dec,
+			 void *blob,
+			 size_t blob_size,
+			 size_t *blob_written);
+
+int mux_decoder_restore(struct mux_decoder *dec,
+			const void *blob,
+			size_t blob_size);
+
+struct mux_decoder *mux_decoder_new_from_snapshot(const void *blob,
+						  size_t blob_size);
+
+/*
+ * Idle session memory release
+ *
+ * trim gives back buffer capacity beyond pending data and codec scratch
+ * that is reallocated on demand. hibernate also parks codec state the
+ * library can rebuild (e.g. Ogg stream buffers) in a compact form;
+ * wake restores it. Any encode/decode/read/finalize/snapshot call on a
+ * hibernated session wakes it first, so calling wake is only needed to
+ * take the cost ahead of time. Pending output survives both.
+ *
+ * memory_usage reports the bytes held by the session, including the
+ * encoder/decoder struct. Library-internal allocations are counted
+ * where the codec can size them.
+ */
+int mux_encoder_trim(struct mux_encoder *enc);
+int mux_encoder_hibernate(struct mux_encoder *enc);
+int mux_encoder_wake(struct mux_encoder *enc);
+size_t mux_encoder_memory_usage(const struct mux_encoder *enc);
+
+int mux_decoder_trim(struct mux_decoder *dec);
+int mux_decoder_hibernate(struct mux_decoder *dec);
+int mux_decoder_wake(struct mux_decoder *dec);
+size_t mux_decoder_memory_usage(const struct mux_decoder *dec);
+
+/*
+ * Shared-memory PCM ring (Linux)
+ *
+ * A single-producer/single-consumer byte ring in a memfd, for moving
+ * PCM between processes without pipe copies. The creating process
+ * hands mux_ring_fd() to the other side (fork inheritance or
+ * SCM_RIGHTS), which attaches with mux_ring_open(). Blocking waits use
+ * futexes and cost no syscall while the other side is awake.
+ *
+ * timeout_ms < 0 waits forever, 0 never waits. On timeout the call
+ * returns MUX_OK with nothing available. Readers get MUX_ERROR_EOF
+ * once the producer called mux_ring_shutdown() and the ring is empty.
+ * On other platforms create/open return NULL and the rest return
+ * MUX_ERROR_UNSUPPORTED.
+ */
+struct mux_ring;
+
+struct mux_ring *mux_ring_create(size_t capacity);
+struct mux_ring *mux_ring_open(int fd);
+void mux_ring_close(struct mux_ring *ring);
+int mux_ring_fd(const struct mux_ring *ring);
+size_t mux_ring_capacity(const struct mux_ring *ring);
+
+/* Producer: zero-copy (acquire + commit) or copying */
+int mux_ring_write_acquire(struct mux_ring *ring, void **ptr,
+			   size_t *avail, int timeout_ms);
+int mux_ring_write_commit(struct mux_ring *ring, size_t size);
+int mux_ring_write(struct mux_ring *ring, const void *data, size_t size,
+		   size_t *written, int timeout_ms);
+void mux_ring_shutdown(struct mux_ring *ring);
+
+/* Consumer: zero-copy (acquire + release) or copying */
+int mux_ring_read_acquire(struct mux_ring *ring, const void **ptr,
+			  size_t *avail, int timeout_ms);
+int mux_ring_read_release(struct mux_ring *ring, size_t size);
+int mux_ring_read(struct mux_ring *ring, void *data, size_t size,
+		  size_t *bytes_read, int timeout_ms);
+
+/*
+ * Encode the whole PCM frames currently in the ring, reading them in
+ * place from shared memory. Waits up to timeout_ms for at least one
+ * whole frame; once the producer has closed the ring, a trailing
+ * partial frame is dropped and MUX_ERROR_EOF returned.
+ */
+int mux_encoder_encode_ring(struct mux_encoder *enc, struct mux_ring *ring,
+			    int timeout_ms, size_t *input_consumed);
+
+/*
+ * Move decoded audio into the ring. Side channel data is left for
+ * mux_decoder_read().
+ */
+int mux_decoder_read_ring(struct mux_decoder *dec, struct mux_ring *ring,
+			  int timeout_ms, size_t *output_written);
+
+/*
+ * Non-blocking fd pumps (POSIX)
+ *
+ * Do as much work as the fds allow without blocking, for poll/epoll
+ * loops. The encoder reads PCM from in_fd and side channel data from
+ * side_fd (-1 for none) and writes the stream to out_fd. The decoder
+ * reads the stream from in_fd, writes audio to out_fd and side channel
+ * data to side_fd (-1 discards it). side_fd is a byte stream both ways:
+ * each read is sent as it comes, so write boundaries on a pipe or
+ * socket are not kept. Frame side data that needs them, e.g. with a
+ * length prefix, or use keyed state.
+ *
+ * Returns MUX_OK with *wait set to the MUX_PUMP_* fds that would block
+ * (readable for inputs, writable for outputs); call again when one of
+ * them is ready. End of input (on both inputs for the encoder)
+ * finalizes the session, and MUX_ERROR_EOF is returned once all of
+ * its output has been written. Reads stop while a blocked output has
+ * about 1 MiB queued. Elsewhere these return MUX_ERROR_UNSUPPORTED.
+ */
+#define MUX_PUMP_IN   0x1
+#define MUX_PUMP_SIDE 0x2
+#define MUX_PUMP_OUT  0x4
+
+int mux_encoder_pump(struct mux_encoder *enc, int in_fd, int side_fd,
+		     int out_fd, int *wait);
+int mux_decoder_pump(struct mux_decoder *dec, int in_fd, int out_fd,
+		     int side_fd, int *wait);
+
+/*
+ * Shared-memory metrics (Linux)
+ *
+ * Counters for every attached session in a page other processes map
+ * read-only, so monitoring scrapes them without an API call, syscall
+ * or lock on the audio path. path NULL creates a memfd (hand out
+ * mux_metrics_fd(), or read /proc/<pid>/fd/<n>); otherwise the file
+ * at path, e.g. under /dev/shm, is created, replacing an older metrics
+ * page but nothing else (create fails if another file is there).
+ * Readers attach with mux_metrics_open() on a descriptor of either.
+ *
+ * Each encode, decode and read call of an attached session counts
+ * once: bytes_in is input consumed, bytes_out output read, buffered
+ * the output waiting to be read after the call, busy_ns the time
+ * spent inside the library. latency[0] counts calls under 1024 ns and
+ * each next bucket is twice as wide; the last one is open-ended.
+ * Sessions detach on destroy; the metrics must outlive them. Totals
+ * include detached sessions. Elsewhere create/open return NULL and
+ * attaching returns MUX_ERROR_UNSUPPORTED.
+ */
+#define MUX_METRICS_BUCKETS      16
+#define MUX_METRICS_NAME_MAX     32
+#define MUX_METRICS_MAX_SESSIONS 65536
+
+struct mux_metrics_counters {
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t buffered;
+	uint64_t busy_ns;
+	uint64_t latency[MUX_METRICS_BUCKETS];
+};
+
+struct mux_metrics_session {
+	char name[MUX_METRICS_NAME_MAX];
+	enum mux_codec_type codec_type;
+	int decoder;                  /* 0 for an encoder */
+	struct mux_metrics_counters counters;
+};
+
+struct mux_metrics;
+
+struct mux_metrics *mux_metrics_create(const char *path, int max_sessions);
+struct mux_metrics *mux_metrics_open(int fd);
+void mux_metrics_close(struct mux_metrics *m);
+int mux_metrics_fd(const struct mux_metrics *m);
+int mux_metrics_slots(const struct mux_metrics *m);
+
+/* Attach to a slot of m, or detach with m NULL; MUX_ERROR_LIMIT if full */
+int mux_encoder_set_metrics(struct mux_encoder *enc, struct mux_metrics *m,
+			    const char *name);
+int mux_decoder_set_metrics(struct mux_decoder *dec, struct mux_metrics *m,
+			    const char *name);
+
+/* MUX_ERROR_NOTFOUND for a free slot */
+int mux_metrics_read(const struct mux_metrics *m, int slot,
+		     struct mux_metrics_session *out);
+int mux_metrics_read_total(const struct mux_metrics *m,
+			   struct mux_metrics_counters *out);
+
+/*
+ * Transcoding
+ *
+ * Converts a stream of src_codec into one of dst_codec, configured by
+ * the encoder params. sample_rate and num_channels describe the source;
+ * nothing is resampled or remixed. If the codecs are the same and the
+ * source already is what the params ask for, packets are copied into
+ * the target framing instead of being decoded and encoded again: Ogg
+ * pages verbatim, LEB128 and raw frames rewrapped, side channel data
+ * dropped when dst_streams is 1. Only params that are given count;
+ * e.g. a bitrate is compared against the bitrate the stream declares
+ * (Vorbis, MP3) or measures over its first second (Opus, AAC), while
+ * params a stream can't be checked against (quality, vbr, profile,
+ * dtx) always transcode. FLAC passes through at 16 bits, whatever the
+ * compression. The bool param "passthrough" = 0 forces transcoding.
+ * A decoder and encoder are only set up once it comes to transcoding.
+ *
+ * Input is held until the source header has been seen, up to 1 MiB.
+ * Returns NULL if the streams would need a codec that isn't compiled
+ * in; when that only shows up in the data, feed and finalize return
+ * MUX_ERROR_NOCODEC.
+ */
+struct mux_transcoder;
+
+struct mux_transcoder *mux_transcoder_new(enum mux_codec_type src_codec,
+					  int src_streams,
+					  enum mux_codec_type dst_codec,
+					  int dst_streams,
+					  int sample_rate,
+					  int num_channels,
+					  const struct mux_param *params,
+					  int num_params);
+void mux_transcoder_destroy(struct mux_transcoder *tc);
+
+int mux_transcoder_feed(struct mux_transcoder *tc, const void *input,
+			size_t input_size, size_t *input_consumed);
+int mux_transcoder_finalize(struct mux_transcoder *tc);
+int mux_transcoder_read(struct mux_transcoder *tc, void *output,
+			size_t output_size, size_t *output_written);
+
+/* 1 when copying packets, 0 when transcoding, -1 still undecided */
+int mux_transcoder_passthrough(const struct mux_transcoder *tc);
+
+/*
+ * In-tree MP3 decoder
+ *
+ * MPEG-1, 2 and 2.5 Layer III without libmpg123; MUX_CODEC_MP3 decoders
+ * use it only when built with CODEC_MP3_BUILTIN (experimental, not yet
+ * checked against reference streams).
+ * Each call skips junk and ID3v2 tags up to the next frame and decodes
+ * it into pcm, interleaved, MUX_MP3DEC_MAX_SAMPLES frames at most.
+ * *consumed is what the caller can drop; info->frame_bytes is 0 when a
+ * whole frame isn't there yet, and info->samples is 0 for a frame that
+ * couldn't be decoded (e.g. its bit reservoir came before the start of
+ * the stream). Once a frame has been decoded, headers of another MPEG
+ * version or sample rate are taken for junk until mux_mp3dec_reset().
+ */
+#define MUX_MP3DEC_MAX_SAMPLES 1152
+
+#define MUX_MP3DEC_SCALAR 1     /* no SIMD kernels */
+#define MUX_MP3DEC_MONO   2     /* mix stereo down before synthesis */
+
+struct mux_mp3_frame_info {
+	int frame_bytes;
+	int sample_rate;
+	int channels;           /* of the output */
+	int samples;            /* per channel */
+	int bitrate;            /* kbps */
+};
+
+struct mux_mp3dec;
+
+struct mux_mp3dec *mux_mp3dec_new(int flags);
+void mux_mp3dec_destroy(struct mux_mp3dec *d);
+void mux_mp3dec_reset(struct mux_mp3dec *d);
+
+int mux_mp3dec_decode_frame(struct mux_mp3dec *d, const void *data,
+			    size_t size, int16_t *pcm, size_t *consumed,
+			    struct mux_mp3_frame_info *info);
+
+/* 1 if the SIMD kernels are compiled in */
+int mux_mp3dec_simd(void);
+
+/*
+ * Trunks
+ *
+ * Many sessions interleaved over one byte stream, e.g. all calls
+ * between two gateways on a single connection. Each session is an
+ * encoder the caller keeps and feeds; the writer frames whatever the
+ * encoders have produced under a compact slot number with a per-session
+ * sequence byte, and announces sessions with their id, codec and
+ * format. mux_trunk_writer_collect() gathers every session in one pass,
+ * so one read and one write() carry a whole tick of all calls. Call
+ * mux_encoder_finalize() before mux_trunk_writer_remove() to send a
+ * session's last output; slots are reused afterwards.
+ *
+ * The reader runs a decoder per session, created with the params given
+ * to mux_trunk_reader_new(). mux_trunk_reader_read() drains sessions in
+ * the order they got data and fills *session with the one the output
+ * belongs to. A session that has closed and been drained is reported
+ * once with *stream_type MUX_TRUNK_END and 0 bytes. A session's decoder
+ * errors (or MUX_ERROR_NOCODEC) are returned by read with *session
+ * set and only drop that session's data; damage to the trunk itself
+ * (bad frames, unknown slots, sequence gaps) makes feed fail with
+ * MUX_ERROR_FORMAT. Feed takes all input unless a decoder limits the
+ * work per call; read and feed the rest again then.
+ */
+#define MUX_TRUNK_END 2
+
+struct mux_trunk_session {
+	uint32_t id;
+	enum mux_codec_type codec_type;
+	int num_streams;
+	int sample_rate;
+	int num_channels;
+};
+
+struct mux_trunk_writer;
+
+struct mux_trunk_writer *mux_trunk_writer_new(void);
+void mux_trunk_writer_destroy(struct mux_trunk_writer *w);
+
+int mux_trunk_writer_add(struct mux_trunk_writer *w, uint32_t id,
+			 struct mux_encoder *enc, int *slot);
+int mux_trunk_writer_remove(struct mux_trunk_writer *w, int slot);
+int mux_trunk_writer_collect(struct mux_trunk_writer *w);
+int mux_trunk_writer_read(struct mux_trunk_writer *w, void *output,
+			  size_t output_size, size_t *output_written);
+
+struct mux_trunk_reader;
+
+struct mux_trunk_reader *mux_trunk_reader_new(const struct mux_param *params,
+					      int num_params);
+void mux_trunk_reader_destroy(struct mux_trunk_reader *r);
+
+int mux_trunk_reader_feed(struct mux_trunk_reader *r, const void *input,
+			  size_t input_size, size_t *input_consumed);
+/* End of the trunk: closes every open session; MUX_ERROR_FORMAT if cut */
+int mux_trunk_reader_finalize(struct mux_trunk_reader *r);
+int mux_trunk_reader_read(struct mux_trunk_reader *r,
+			  struct mux_trunk_session *session,
+			  void *output, size_t output_size,
+			  size_t *output_written, int *stream_type);
+
+/*
+ * Encoder rate control
+ *
+ * Holds an encoder's output, framing and side channel data included,
+ * to rate_bps with a token bucket of window_ms worth of credit. Credit
+ * accrues with the audio encoded, so the limit holds in stream time.
+ * Opus, AAC and AMR have their bitrate lowered live as the bucket
+ * drains below half full and raised again, never above their own or
+ * the link's; side channel data is deferred until there is spare
+ * credit and released in slices, or all at once on finalize. Up to
+ * 2 MiB of side data is queued; past that *input_consumed comes back
+ * short, and MUX_ERROR_LIMIT once nothing fits, until the link catches
+ * up. Other codecs keep their rate, so only side data is paced for them.
+ * rate_bps 0 turns rate control off, flushing deferred side data.
+ */
+struct mux_rate_stats {
+	uint64_t bytes;         /* emitted since the limit was set */
+	int64_t level;          /* credit in bytes, negative after a burst */
+	int bitrate;            /* codec target in bps, 0 if fixed */
+	size_t side_queued;     /* side channel bytes held back */
+};
+
+int mux_encoder_set_rate_limit(struct mux_encoder *enc, int rate_bps,
+			       int window_ms);
+/* MUX_ERROR_NOTFOUND without a limit */
+int mux_encoder_get_rate_stats(const struct mux_encoder *enc,
+			       struct mux_rate_stats *stats);
+
+/*
+ * Load governor
+ *
+ * Admission control and overload shedding for encoders sharing a
+ * host. The governor measures the time each attached session spends
+ * in mux_encoder_encode() against the audio it encodes (its realtime
+ * factor) and their sum against the CPUs (the load), once per
+ * mux_governor_update(); call that every 100 ms to 1 s from any
+ * thread. A session is refused when the load plus its estimate from
+ * mux_codec_cost() would pass admit_load_pct.
+ *
+ * Above max_load_pct the policies run in the configured order until
+ * the estimated load is back at target_load_pct, each one over the
+ * sessions from the lowest priority up: lowering codec complexity
+ * (Opus), turning on DTX for sessions that were silent since the last
+ * update (Opus, AMR, AMR-WB), and shedding. A shed session's encode
+ * fails with MUX_ERROR_LIMIT; read and finalize still work. Sessions
+ * at or above protected_priority, if non-zero, are never touched.
+ * Below target_load_pct, changes are undone one per update, from the
+ * highest priority down. Changes reach a codec at its session's next
+ * encode call, on the thread that makes it. Every decision is counted
+ * in the stats and queued as an event.
+ *
+ * A zeroed config, or NULL, takes the defaults below. Sessions detach
+ * on mux_governor_remove() or destroy; the governor must outlive them.
+ */
+#define MUX_GOVERN_POLICY_MAX 3
+
+enum mux_govern_policy {
+	MUX_GOVERN_END = 0,
+	MUX_GOVERN_COMPLEXITY,
+	MUX_GOVERN_DTX,
+	MUX_GOVERN_SHED
+};
+
+struct mux_governor_config {
+	int cpus;                 /* default: online CPUs */
+	int max_load_pct;         /* default 85 */
+	int target_load_pct;      /* default 70 */
+	int admit_load_pct;       /* default max_load_pct */
+	int protected_priority;   /* default 0, none */
+	int silence_level;        /* peak sample, default 64 (-54 dBFS) */
+	int low_complexity;       /* default 2 */
+	enum mux_govern_policy policies[MUX_GOVERN_POLICY_MAX];
+				  /* default complexity, DTX, shed */
+};
+
+enum mux_govern_action {
+	MUX_GOVERN_REFUSED,
+	MUX_GOVERN_COMPLEXITY_LOWERED,
+	MUX_GOVERN_COMPLEXITY_RESTORED,
+	MUX_GOVERN_DTX_ON,
+	MUX_GOVERN_DTX_OFF,
+	MUX_GOVERN_SHED_SESSION
+};
+
+struct mux_governor_event {
+	enum mux_govern_action action;
+	uint32_t id;
+	int priority;
+	int load_pct;             /* when decided */
+};
+
+struct mux_governor_stats {
+	int sessions;             /* attached and not shed */
+	int load_pct;             /* of all CPUs, over the last update */
+	int overloaded;           /* last update was above max_load_pct */
+	uint64_t admitted;
+	uint64_t actions[MUX_GOVERN_SHED_SESSION + 1];
+};
+
+struct mux_governor_session {
+	uint32_t id;
+	int priority;
+	int rtf_pct;              /* time in encode per audio time */
+	int complexity;           /* -1 without a complexity control */
+	int dtx;
+	int silent;
+	int shed;
+};
+
+struct mux_governor;
+
+struct mux_governor *mux_governor_new(const struct mux_governor_config *cfg);
+void mux_governor_destroy(struct mux_governor *g);
+
+/* MUX_ERROR_LIMIT if over capacity, MUX_ERROR_INVAL if already attached */
+int mux_governor_admit(struct mux_governor *g, struct mux_encoder *enc,
+		       uint32_t id, int priority);
+int mux_governor_remove(struct mux_governor *g, struct mux_encoder *enc);
+
+/* Returns the number of decisions taken */
+int mux_governor_update(struct mux_governor *g);
+
+int mux_governor_get_stats(struct mux_governor *g,
+			   struct mux_governor_stats *stats);
+/* MUX_ERROR_NOTFOUND unless enc is attached */
+int mux_governor_get_session(struct mux_governor *g,
+			     const struct mux_encoder *enc,
+			     struct mux_governor_session *session);
+/* Oldest undelivered decision; MUX_ERROR_NOTFOUND when there is none */
+int mux_governor_next_event(struct mux_governor *g,
+			    struct mux_governor_event *event);
+
+/*
+ * Keyed side channel state
+ *
+ * A map of string keys to binary values carried on the side channel,
+ * for slowly changing state such as now-playing, levels or settings.
+ * The encoder sends the keys changed since its previous record once
+ * per audio encode call, and a full snapshot first, every snapshot_ms
+ * of audio (0 = never) and on mux_encoder_state_sync(), e.g. at a
+ * segment boundary, so listeners joining mid-stream catch up. Setting
+ * a key to its current value sends nothing. Changes made after the
+ * last audio go out on finalize. A record holds at most 1 MiB: a set
+ * that would grow the map past that fails with MUX_ERROR_LIMIT, and a
+ * delta that would not fit, e.g. with many deletes, goes out as a
+ * snapshot instead.
+ *
+ * Records carry a marker, sequence number and checksum, so they may be
+ * split across side channel packets (e.g. by rate control) and found
+ * by a decoder that starts at any frame or page. A decoder applies
+ * nothing before its first snapshot and waits for the next one if a
+ * record goes missing. Works over LEB128 and Ogg side streams alike.
+ *
+ * While enabled, the side channel carries only state records: the
+ * decoder takes them out of mux_decoder_read() instead of returning
+ * them, keeps the map and queues an event for every key set or
+ * deleted. Event and get pointers stay valid until the next read,
+ * next_event or state call on the decoder.
+ */
+#define MUX_STATE_KEY_MAX   255     /* bytes, without the NUL */
+#define MUX_STATE_VALUE_MAX 65535
+
+enum mux_state_change {
+	MUX_STATE_SET,
+	MUX_STATE_DELETED
+};
+
+struct mux_state_event {
+	enum mux_state_change change;
+	const char *key;
+	const void *value;        /* NULL when deleted */
+	size_t size;
+};
+
+struct mux_state_stats {
+	int keys;
+	int synced;               /* decoder: has a snapshot and no gap since */
+	uint64_t records;         /* sent, or applied */
+	uint64_t snapshots;
+	uint64_t bytes;           /* record bytes sent, body bytes applied */
+	uint64_t dropped;         /* decoder: records skipped out of sync */
+	uint64_t events_lost;     /* decoder: over 1 MiB of events queued */
+};
+
+/* Needs two streams; snapshot_ms < 0 turns state off */
+int mux_encoder_set_state(struct mux_encoder *enc, int snapshot_ms);
+int mux_encoder_state_set(struct mux_encoder *enc, const char *key,
+			  const void *value, size_t size);
+/* MUX_ERROR_NOTFOUND if key isn't set */
+int mux_encoder_state_delete(struct mux_encoder *enc, const char *key);
+/* Send a snapshot now */
+int mux_encoder_state_sync(struct mux_encoder *enc);
+int mux_encoder_get_state_stats(const struct mux_encoder *enc,
+				struct mux_state_stats *stats);
+
+int mux_decoder_set_state(struct mux_decoder *dec, int on);
+/* MUX_ERROR_NOTFOUND if key isn't set, or not synced yet */
+int mux_decoder_state_get(struct mux_decoder *dec, const char *key,
+			  const void **value, size_t *size);
+/* Oldest undelivered change; MUX_ERROR_NOTFOUND when there is none */
+int mux_decoder_state_next_event(struct mux_decoder *dec,
+				 struct mux_state_event *event);
+int mux_decoder_get_state_stats(const struct mux_decoder *dec,
+				struct mux_state_stats *stats);
+
+/*
+ * Waveform overview
+ *
+ * Per-bucket min/max/RMS of each channel, computed straight from an
+ * encoded stream without producing PCM output. frames_per_bucket is
+ * counted at the stream's native rate. PCM and G.711 are reduced from
+ * the frame payloads; num_channels gives their layout and is ignored
+ * for codecs whose streams declare it. Other decoder parameters are
+ * passed on, so e.g. output_rate makes Opus synthesize at a lower
+ * rate for a cheaper, slightly smoothed overview.
+ */
+#define MUX_OVERVIEW_MAX_CHANNELS 8
+
+struct mux_peak {
+	int16_t min;
+	int16_t max;
+	uint16_t rms;
+};
+
+struct mux_overview;
+
+struct mux_overview *mux_overview_new(enum mux_codec_type codec_type,
+				      int num_streams,
+				      int num_channels,
+				      int frames_per_bucket,
+				      const struct mux_param *params,
+				      int num_params);
+void mux_overview_destroy(struct mux_overview *ov);
+
+int mux_overview_feed(struct mux_overview *ov,
+		      const void *input,
+		      size_t input_size,
+		      size_t *input_consumed);
+
+/* End of stream: emits the last, partial bucket */
+int mux_overview_finalize(struct mux_overview *ov);
+
+/*
+ * Read completed buckets. Each bucket is mux_overview_channels()
+ * consecutive entries, one per channel.
+ */
+int mux_overview_read(struct mux_overview *ov,
+		      struct mux_peak *peaks,
+		      size_t max_buckets,
+		      size_t *buckets);
+
+/* Channels per bucket, 0 until the stream has declared them */
+int mux_overview_channels(const struct mux_overview *ov);
+
+/*
+ * Clip packs
+ *
+ * One file holding many short encoded clips: a sorted index (id ->
+ * offset, length, codec, duration), stream headers stored once for all
+ * clips that carry identical ones (Opus/Vorbis Ogg header pages, FLAC
+ * metadata of passthrough streams) and 64-byte aligned payloads.
+ *
+ * mux_pack_open() maps the file read-only. Lookups are a binary search
+ * of the index and return pointers into the mapping, valid until
+ * mux_pack_close(). A clip's stream is header followed by data;
+ * mux_pack_decoder_new() returns a decoder that has already consumed
+ * the header, so only data needs to be fed. For clips from a pack, the
+ * first decoder opened without params for a shared header is kept as
+ * a snapshot and later ones are restored from it instead of parsing
+ * the header again (codecs with snapshot support only).
+ *
+ * The writer takes each clip as a whole stream in data (header is
+ * ignored) and splits off the shared header itself. duration is in
+ * sample frames and, like sample_rate and num_channels, is stored as
+ * given. The file is only valid once mux_pack_writer_finish() returns
+ * MUX_OK; duplicate ids make it fail with MUX_ERROR_INVAL.
+ */
+struct mux_clip {
+	uint64_t id;
+	enum mux_codec_type codec_type;
+	int num_streams;
+	int sample_rate;
+	int num_channels;
+	uint64_t duration;
+	const uint8_t *header;
+	size_t header_size;
+	const uint8_t *data;
+	size_t size;
+	const struct mux_pack *pack;   /* set by lookups, ignored by the writer */
+};
+
+struct mux_pack_writer;
+
+struct mux_pack_writer *mux_pack_writer_new(const char *path);
+int mux_pack_writer_add(struct mux_pack_writer *w,
+			const struct mux_clip *clip);
+int mux_pack_writer_finish(struct mux_pack_writer *w);
+void mux_pack_writer_destroy(struct mux_pack_writer *w);
+
+struct mux_pack;
+
+struct mux_pack *mux_pack_open(const char *path);
+/* Use a pack already in memory; data must outlive the pack */
+struct mux_pack *mux_pack_open_memory(const void *data, size_t size);
+void mux_pack_close(struct mux_pack *pack);
+
+size_t mux_pack_count(const struct mux_pack *pack);
+/* index runs over clips in id order; unknown ids give MUX_ERROR_NOTFOUND */
+int mux_pack_get(const struct mux_pack *pack, size_t index,
+		 struct mux_clip *clip);
+int mux_pack_find(const struct mux_pack *pack, uint64_t id,
+		  struct mux_clip *clip);
+
+struct mux_decoder *mux_pack_decoder_new(const struct mux_clip *clip,
+					 const struct mux_param *params,
+					 int num_params);
+
+/*
+ * Splicing clips into live encoders
+ *
+ * Appends a pre-encoded clip, e.g. hold music or a prompt from a clip
+ * pack, to an encoder's output without decoding or re-encoding it.
+ * The clip must have the encoder's codec, sample rate and channel
+ * count; its num_streams may differ. A partially buffered frame of
+ * live audio is finished with silence first. Ogg packets are
+ * renumbered and their granule positions continue the live stream;
+ * Vorbis clips must also come from the same encoder settings, or
+ * MUX_ERROR_FORMAT is returned. The whole clip is checked first, so a
+ * mismatched, corrupt or cut clip adds nothing to the output. Live
+ * encoding continues afterwards.
+ * PCM, G.711, AMR, AMR-WB, Opus and Vorbis support splicing; other
+ * codecs return MUX_ERROR_UNSUPPORTED.
+ */
+int mux_encoder_splice(struct mux_encoder *enc, const struct mux_clip *clip);
+
 /*
  * Error reporting
  */
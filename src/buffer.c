@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "mux.h"
 #include "mux_internal.h"
+#include "mux_trace.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -46,6 +47,8 @@ static int mux_buffer_ensure_capacity(struct mux_buffer *buf, size_t needed)
 	if (new_capacity < needed)
 		new_capacity = needed;
 
+	MUX_PROBE3(buffer_grow, buf, buf->capacity, new_capacity);
+
 	new_data = realloc(buf->data, new_capacity);
 	if (!new_data)
 		return MUX_ERROR_NOMEM;
@@ -76,6 +79,18 @@ int mux_buffer_write(struct mux_buffer *buf, const void *data, size_t size)
 	return MUX_OK;
 }
 
+/*
+ * Room for size more bytes at the end, for writing in place; the caller
+ * adds what it wrote to buf->size
+ */
+void *mux_buffer_reserve(struct mux_buffer *buf, size_t size)
+{
+	if (!buf || mux_buffer_ensure_capacity(buf, buf->size + size) != MUX_OK)
+		return NULL;
+
+	return buf->data + buf->size;
+}
+
 int mux_buffer_read(struct mux_buffer *buf, void *data, size_t size,
 		    size_t *bytes_read)
 {
@@ -124,3 +139,48 @@ void mux_buffer_clear(struct mux_buffer *buf)
 	buf->size = 0;
 	buf->read_pos = 0;
 }
+
+/*
+ * Move unread data to the front so appends don't keep growing the buffer
+ */
+void mux_buffer_compact(struct mux_buffer *buf)
+{
+	if (!buf || buf->read_pos == 0)
+		return;
+
+	memmove(buf->data, buf->data + buf->read_pos,
+		buf->size - buf->read_pos);
+	buf->size -= buf->read_pos;
+	buf->read_pos = 0;
+}
+
+/*
+ * Give back capacity beyond the unread data. An empty buffer is freed
+ * entirely and regrows on the next write.
+ */
+void mux_buffer_shrink(struct mux_buffer *buf)
+{
+	uint8_t *new_data;
+
+	if (!buf)
+		return;
+
+	mux_buffer_compact(buf);
+
+	if (buf->size == 0) {
+		free(buf->data);
+		buf->data = NULL;
+		buf->capacity = 0;
+		return;
+	}
+
+	if (buf->size == buf->capacity)
+		return;
+
+	/* On failure the larger block is simply kept */
+	new_data = realloc(buf->data, buf->size);
+	if (new_data) {
+		buf->data = new_data;
+		buf->capacity = buf->size;
+	}
+}
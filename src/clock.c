@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux_internal.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/*
+ * Monotonic clock in nanoseconds
+ */
+uint64_t mux_clock_ns(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000ULL +
+	       (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000ULL /
+	       (uint64_t)freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/*
+ * CPU time consumed by the calling thread in nanoseconds.
+ * Falls back to the monotonic clock where per-thread CPU time
+ * is not available.
+ */
+uint64_t mux_cpu_clock_ns(void)
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID) && !defined(__EMSCRIPTEN__)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+		return (uint64_t)ts.tv_sec * 1000000000ULL +
+		       (uint64_t)ts.tv_nsec;
+#endif
+	return mux_clock_ns();
+}
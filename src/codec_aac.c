@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "mux.h"
 #include "mux_internal.h"
+#include "mux_trace.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -40,6 +41,9 @@ struct aac_decoder_data {
 	/* Decoder configuration */
 	int sample_rate;
 	int num_channels;
+
+	/* Optional monitoring decimation (downmix is done by FDK) */
+	struct mux_pcm_reducer reduce;
 };
 
 /*
@@ -300,8 +304,10 @@ static int mux_aac_encoder_encode(struct mux_encoder *enc,
 		in_args.numInSamples = samples_per_frame;
 
 		/* Encode */
+		MUX_PROBE_LIB_ENTRY(MUX_CODEC_AAC, "aacEncEncode");
 		AACENC_ERROR err = aacEncEncode(data->enc, &in_buf, &out_buf,
 						&in_args, &out_args);
+		MUX_PROBE_LIB_RETURN(MUX_CODEC_AAC, "aacEncEncode", err);
 		if (err != AACENC_OK) {
 			mux_encoder_set_error(enc, MUX_ERROR_ENCODE,
 					      "AAC encoding failed",
@@ -411,6 +417,25 @@ static int mux_aac_encoder_finalize(struct mux_encoder *enc)
 	return MUX_OK;
 }
 
+/*
+ * AAC live bitrate change; fdk-aac applies it from the next frame
+ */
+static int mux_aac_encoder_set_bitrate(struct mux_encoder *enc, int bps,
+				       int *applied)
+{
+	struct aac_encoder_data *data = enc->codec_data;
+
+	if (bps > 0) {
+		if (aacEncoder_SetParam(data->enc, AACENC_BITRATE,
+					(UINT)bps) != AACENC_OK)
+			return MUX_ERROR_INVAL;
+		data->bitrate = bps;
+	}
+
+	*applied = data->bitrate;
+	return MUX_OK;
+}
+
 /*
  * AAC decoder initialization
  */
@@ -419,9 +444,7 @@ static int mux_aac_decoder_init(struct mux_decoder *dec,
 				 int num_params)
 {
 	struct aac_decoder_data *data;
-
-	(void)params;
-	(void)num_params;
+	int ret;
 
 	data = calloc(1, sizeof(*data));
 	if (!data) {
@@ -431,6 +454,15 @@ static int mux_aac_decoder_init(struct mux_decoder *dec,
 		return MUX_ERROR_NOMEM;
 	}
 
+	ret = mux_pcm_reducer_setup(&data->reduce, params, num_params);
+	if (ret != MUX_OK) {
+		mux_decoder_set_error(dec, ret,
+				      "Invalid output_rate/output_channels",
+				      NULL, 0, NULL);
+		free(data);
+		return ret;
+	}
+
 	/* Initialize input buffer for LEB128 demuxing */
 	if (mux_buffer_init(&data->input_buf, 8192) != MUX_OK) {
 		mux_decoder_set_error(dec, MUX_ERROR_NOMEM,
@@ -451,6 +483,11 @@ static int mux_aac_decoder_init(struct mux_decoder *dec,
 		return MUX_ERROR_INIT;
 	}
 
+	/* Let FDK's own matrix downmix produce mono */
+	if (data->reduce.req_channels > 0)
+		aacDecoder_SetParam(data->dec, AAC_PCM_MAX_OUTPUT_CHANNELS,
+				    data->reduce.req_channels);
+
 	dec->codec_data = data;
 	return MUX_OK;
 }
@@ -499,21 +536,21 @@ static int mux_aac_decoder_decode(struct mux_decoder *dec,
 		return MUX_ERROR_INVAL;
 
 	/* Add input to buffer */
-	ret = mux_buffer_write(&data->input_buf, input, input_size);
+	ret = mux_decoder_buffer_input(dec, &data->input_buf, input, input_size,
+				       &consumed);
 	if (ret != MUX_OK)
 		return ret;
 
-	consumed = input_size;
-
 	/* Try to read frames from input buffer */
 	while (1) {
-		ret = mux_leb128_read_frame(&data->input_buf,
-					    frame_buf, sizeof(frame_buf),
-					    &frame_size, &stream_type, dec->num_streams);
+		ret = mux_decoder_read_frame(dec, &data->input_buf,
+					     frame_buf, sizeof(frame_buf),
+					     &frame_size, &stream_type);
 		if (ret != MUX_OK) {
-			mux_decoder_set_error(dec, MUX_ERROR_FORMAT,
-					      "Failed to read LEB128 frame",
-					      NULL, 0, NULL);
+			if (ret != MUX_ERROR_LIMIT)
+				mux_decoder_set_error(dec, MUX_ERROR_FORMAT,
+						      "Failed to read LEB128 frame",
+						      NULL, 0, NULL);
 			return ret;
 		}
 
@@ -548,9 +585,12 @@ static int mux_aac_decoder_decode(struct mux_decoder *dec,
 
 		/* Decode frame */
 		int16_t pcm_buf[8192];  /* Large enough for any AAC frame */
+		MUX_PROBE_LIB_ENTRY(MUX_CODEC_AAC, "aacDecoder_DecodeFrame");
 		err = aacDecoder_DecodeFrame(data->dec, pcm_buf,
 					     sizeof(pcm_buf) / sizeof(int16_t),
 					     0);
+		MUX_PROBE_LIB_RETURN(MUX_CODEC_AAC, "aacDecoder_DecodeFrame",
+				     err);
 		if (err != AAC_DEC_OK) {
 			/* Some errors are recoverable */
 			if (err != AAC_DEC_NOT_ENOUGH_BITS)
@@ -563,12 +603,24 @@ static int mux_aac_decoder_decode(struct mux_decoder *dec,
 		/* Get stream info */
 		CStreamInfo *info = aacDecoder_GetStreamInfo(data->dec);
 		if (info && info->numChannels > 0) {
+			if (info->sampleRate != data->sample_rate ||
+			    info->numChannels != data->num_channels) {
+				ret = mux_decoder_check_format(dec,
+							       info->sampleRate,
+							       info->numChannels);
+				if (ret != MUX_OK)
+					return ret;
+				mux_pcm_reducer_start(&data->reduce,
+						      info->sampleRate,
+						      info->numChannels);
+			}
+
 			data->sample_rate = info->sampleRate;
 			data->num_channels = info->numChannels;
 
 			/* Write decoded PCM to output */
-			size_t pcm_bytes = info->frameSize * info->numChannels * sizeof(int16_t);
-			ret = mux_buffer_write(&dec->audio_output, pcm_buf, pcm_bytes);
+			ret = mux_pcm_reducer_write_s16(&data->reduce, dec,
+							pcm_buf, info->frameSize);
 			if (ret != MUX_OK)
 				return ret;
 		}
@@ -648,10 +700,12 @@ const struct mux_codec_ops mux_codec_aac_ops = {
 	.decoder_read = mux_aac_decoder_read,
 	.decoder_finalize = mux_aac_decoder_finalize,
 
+	.encoder_set_bitrate = mux_aac_encoder_set_bitrate,
+
 	.encoder_params = aac_encoder_params,
 	.encoder_param_count = sizeof(aac_encoder_params) / sizeof(aac_encoder_params[0]),
-	.decoder_params = NULL,
-	.decoder_param_count = 0,
+	.decoder_params = mux_reduce_decoder_params,
+	.decoder_param_count = MUX_REDUCE_PARAM_COUNT,
 
 	.supported_sample_rates = aac_sample_rates,
 	.sample_rate_count = sizeof(aac_sample_rates) / sizeof(aac_sample_rates[0]),
@@ -63,7 +63,7 @@ static uint8_t alaw_encode_sample(int16_t pcm)
 /*
  * A-law decoding: 8-bit A-law -> 16-bit linear PCM
  */
-static int16_t alaw_decode_sample(uint8_t alaw)
+int16_t mux_alaw_decode_sample(uint8_t alaw)
 {
 	int sign;
 	int exponent;
@@ -211,6 +211,32 @@ static int alaw_encoder_finalize(struct mux_encoder *enc)
 	return MUX_OK;
 }
 
+/*
+ * A-law encoder splice
+ * Every whole sample frame is a frame boundary, so cached payloads go
+ * straight out
+ */
+static int alaw_encoder_splice_check(struct mux_encoder *enc,
+				     const uint8_t *packet, size_t size)
+{
+	(void)packet;
+	if (size % (size_t)enc->num_channels != 0)
+		return MUX_ERROR_FORMAT;
+	return MUX_OK;
+}
+
+static int alaw_encoder_splice(struct mux_encoder *enc, const uint8_t *packet,
+			       size_t size)
+{
+	int ret = alaw_encoder_splice_check(enc, packet, size);
+
+	if (ret != MUX_OK)
+		return ret;
+
+	return mux_leb128_write_frame(&enc->output, packet, size,
+				      MUX_STREAM_AUDIO, enc->num_streams);
+}
+
 /*
  * A-law decoder initialization
  */
@@ -281,18 +307,17 @@ static int alaw_decoder_decode(struct mux_decoder *dec,
 	if (!frame_buf)
 		return MUX_ERROR_NOMEM;
 
-	ret = mux_buffer_write(&data->input_buf, input, input_size);
+	ret = mux_decoder_buffer_input(dec, &data->input_buf, input, input_size,
+				       &consumed);
 	if (ret != MUX_OK) {
 		free(frame_buf);
 		return ret;
 	}
 
-	consumed = input_size;
-
 	while (1) {
-		ret = mux_leb128_read_frame(&data->input_buf,
-					    frame_buf, frame_buf_capacity,
-					    &frame_size, &stream_type, dec->num_streams);
+		ret = mux_decoder_read_frame(dec, &data->input_buf,
+					     frame_buf, frame_buf_capacity,
+					     &frame_size, &stream_type);
 			if (ret == MUX_ERROR_INVAL && frame_size > frame_buf_capacity) {
 			uint8_t *new_buf = realloc(frame_buf, frame_size);
 			if (!new_buf) {
@@ -302,9 +327,9 @@ static int alaw_decoder_decode(struct mux_decoder *dec,
 			frame_buf = new_buf;
 			frame_buf_capacity = frame_size;
 
-			ret = mux_leb128_read_frame(&data->input_buf,
-						    frame_buf, frame_buf_capacity,
-						    &frame_size, &stream_type, dec->num_streams);
+			ret = mux_decoder_read_frame(dec, &data->input_buf,
+						     frame_buf, frame_buf_capacity,
+						     &frame_size, &stream_type);
 		}
 
 		if (ret != MUX_OK) {
@@ -326,7 +351,7 @@ static int alaw_decoder_decode(struct mux_decoder *dec,
 			}
 
 			for (i = 0; i < frame_size; i++) {
-				pcm_out[i] = alaw_decode_sample(frame_buf[i]);
+				pcm_out[i] = mux_alaw_decode_sample(frame_buf[i]);
 			}
 
 			ret = mux_buffer_write(&dec->audio_output,
@@ -396,6 +421,70 @@ static int alaw_decoder_finalize(struct mux_decoder *dec)
 	return MUX_OK;
 }
 
+/*
+ * A-law snapshot/restore
+ * The encoder is stateless; the decoder only holds unparsed input
+ */
+static int alaw_encoder_snapshot(struct mux_encoder *enc,
+				 struct mux_buffer *blob)
+{
+	(void)enc;
+	(void)blob;
+	return MUX_OK;
+}
+
+static int alaw_encoder_restore(struct mux_encoder *enc,
+				struct mux_snap_reader *r)
+{
+	(void)enc;
+	(void)r;
+	return MUX_OK;
+}
+
+static int alaw_decoder_snapshot(struct mux_decoder *dec,
+				 struct mux_buffer *blob)
+{
+	struct alaw_codec_data *data = dec->codec_data;
+
+	return mux_snap_put_buffer(blob, &data->input_buf);
+}
+
+static int alaw_decoder_restore(struct mux_decoder *dec,
+				struct mux_snap_reader *r)
+{
+	struct alaw_codec_data *data = dec->codec_data;
+	const uint8_t *input;
+	size_t size;
+	int ret;
+
+	ret = mux_snap_stage_buffer(r, &data->input_buf, &input, &size);
+	if (ret == MUX_OK)
+		ret = mux_snap_end(r);
+	if (ret == MUX_OK)
+		mux_snap_commit_buffer(&data->input_buf, input, size);
+
+	return ret;
+}
+
+/*
+ * A-law memory release: only the demux input buffer is reclaimable
+ */
+static int alaw_decoder_trim(struct mux_decoder *dec, int hibernate)
+{
+	struct alaw_codec_data *data = dec->codec_data;
+
+	(void)hibernate;
+	mux_buffer_shrink(&data->input_buf);
+	return MUX_OK;
+}
+
+static size_t alaw_decoder_memory(const struct mux_decoder *dec)
+{
+	const struct alaw_codec_data *data = dec->codec_data;
+
+	return sizeof(*data) + data->input_buf.capacity;
+}
+
 /*
  * A-law supports telephony standard rates, but can handle any rate
  */
@@ -417,6 +506,17 @@ const struct mux_codec_ops mux_codec_alaw_ops = {
 	.decoder_read = alaw_decoder_read,
 	.decoder_finalize = alaw_decoder_finalize,
 
+	.encoder_snapshot = alaw_encoder_snapshot,
+	.encoder_restore = alaw_encoder_restore,
+	.decoder_snapshot = alaw_decoder_snapshot,
+	.decoder_restore = alaw_decoder_restore,
+
+	.decoder_trim = alaw_decoder_trim,
+	.decoder_memory = alaw_decoder_memory,
+
+	.encoder_splice = alaw_encoder_splice,
+	.encoder_splice_check = alaw_encoder_splice_check,
+
 	.encoder_params = NULL,
 	.encoder_param_count = 0,
 	.decoder_params = NULL,
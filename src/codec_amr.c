@@ -12,6 +12,7 @@
  */
 #include "mux.h"
 #include "mux_internal.h"
+#include "mux_trace.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -234,6 +235,7 @@ static int amr_encoder_encode(struct mux_encoder *enc,
 
 		/* Encode complete frame */
 		if (data->input_samples == AMR_FRAME_SAMPLES) {
+			MUX_PROBE_LIB_ENTRY(MUX_CODEC_AMR, "Encoder_Interface_Encode");
 			frame_size = Encoder_Interface_Encode(
 				data->encoder,
 				data->mode,
@@ -241,6 +243,8 @@ static int amr_encoder_encode(struct mux_encoder *enc,
 				frame_buf,
 				0  /* force_speech */
 			);
+			MUX_PROBE_LIB_RETURN(MUX_CODEC_AMR, "Encoder_Interface_Encode",
+					     frame_size);
 
 			if (frame_size < 0) {
 				mux_encoder_set_error(enc, MUX_ERROR_ENCODE,
@@ -310,6 +314,7 @@ static int amr_encoder_finalize(struct mux_encoder *enc)
 		memset(&data->input_buf[data->input_samples], 0,
 		       (AMR_FRAME_SAMPLES - data->input_samples) * sizeof(int16_t));
 
+		MUX_PROBE_LIB_ENTRY(MUX_CODEC_AMR, "Encoder_Interface_Encode");
 		frame_size = Encoder_Interface_Encode(
 			data->encoder,
 			data->mode,
@@ -317,6 +322,8 @@ static int amr_encoder_finalize(struct mux_encoder *enc)
 			frame_buf,
 			0
 		);
+		MUX_PROBE_LIB_RETURN(MUX_CODEC_AMR, "Encoder_Interface_Encode",
+				     frame_size);
 
 		if (frame_size > 0) {
 			ret = mux_leb128_write_frame(&enc->output, frame_buf, frame_size,
@@ -331,6 +338,53 @@ static int amr_encoder_finalize(struct mux_encoder *enc)
 	return MUX_OK;
 }
 
+/*
+ * AMR live bitrate change: the highest mode at or below bps
+ */
+static const int amr_mode_bps[] = {
+	4750, 5150, 5900, 6700, 7400, 7950, 10200, 12200
+};
+
+static int amr_encoder_set_bitrate(struct mux_encoder *enc, int bps,
+				   int *applied)
+{
+	struct amr_encoder_data *data = enc->codec_data;
+	int mode;
+
+	if (bps > 0) {
+		for (mode = AMR_MODE_1220; mode > AMR_MODE_475; mode--)
+			if (amr_mode_bps[mode] <= bps)
+				break;
+		data->mode = mode;
+	}
+
+	*applied = amr_mode_bps[data->mode];
+	return MUX_OK;
+}
+
+/*
+ * AMR DTX switch. The library takes DTX only at init, so the encoder
+ * is recreated; this is meant for silent calls, where the reset of
+ * its state goes unheard.
+ */
+static int amr_encoder_set_dtx(struct mux_encoder *enc, int on)
+{
+	struct amr_encoder_data *data = enc->codec_data;
+	void *encoder;
+
+	on = on ? 1 : 0;
+	if (on == data->dtx)
+		return MUX_OK;
+
+	encoder = Encoder_Interface_init(on);
+	if (!encoder)
+		return MUX_ERROR_NOMEM;
+	Encoder_Interface_exit(data->encoder);
+	data->encoder = encoder;
+	data->dtx = on;
+	return MUX_OK;
+}
+
 /*
  * AMR decoder initialization
  */
@@ -444,14 +498,13 @@ static int amr_decoder_decode(struct mux_decoder *dec,
 	if (!frame_buf)
 		return MUX_ERROR_NOMEM;
 
-	ret = mux_buffer_write(&data->input_buf, input, input_size);
+	ret = mux_decoder_buffer_input(dec, &data->input_buf, input, input_size,
+				       input_consumed);
 	if (ret != MUX_OK) {
 		free(frame_buf);
 		return ret;
 	}
 
-	*input_consumed = input_size;
-
 	/* Passthrough mode: parse AMR frames directly */
 	if (dec->num_streams == 1) {
 		while (data->input_buf.size - data->input_buf.read_pos > 0) {
@@ -471,7 +524,10 @@ static int amr_decoder_decode(struct mux_decoder *dec,
 				break;
 
 			/* Decode AMR frame */
+			MUX_PROBE_LIB_ENTRY(MUX_CODEC_AMR, "Decoder_Interface_Decode");
 			Decoder_Interface_Decode(data->decoder, buf_ptr, pcm_out, 0);
+			MUX_PROBE_LIB_RETURN(MUX_CODEC_AMR, "Decoder_Interface_Decode",
+					     0);
 
 			ret = mux_buffer_write(&dec->audio_output,
 					       pcm_out, sizeof(pcm_out));
@@ -496,9 +552,9 @@ static int amr_decoder_decode(struct mux_decoder *dec,
 
 	/* Mux mode: use LEB128 framing */
 	while (1) {
-		ret = mux_leb128_read_frame(&data->input_buf,
-					    frame_buf, frame_buf_capacity,
-					    &frame_size, &stream_type, dec->num_streams);
+		ret = mux_decoder_read_frame(dec, &data->input_buf,
+					     frame_buf, frame_buf_capacity,
+					     &frame_size, &stream_type);
 			if (ret == MUX_ERROR_INVAL && frame_size > frame_buf_capacity) {
 			uint8_t *new_buf = realloc(frame_buf, frame_size);
 			if (!new_buf) {
@@ -508,9 +564,9 @@ static int amr_decoder_decode(struct mux_decoder *dec,
 			frame_buf = new_buf;
 			frame_buf_capacity = frame_size;
 
-			ret = mux_leb128_read_frame(&data->input_buf,
-						    frame_buf, frame_buf_capacity,
-						    &frame_size, &stream_type, dec->num_streams);
+			ret = mux_decoder_read_frame(dec, &data->input_buf,
+						     frame_buf, frame_buf_capacity,
+						     &frame_size, &stream_type);
 		}
 
 		if (ret != MUX_OK) {
@@ -525,7 +581,10 @@ static int amr_decoder_decode(struct mux_decoder *dec,
 
 		if (stream_type == MUX_STREAM_AUDIO) {
 			/* Decode AMR frame */
+			MUX_PROBE_LIB_ENTRY(MUX_CODEC_AMR, "Decoder_Interface_Decode");
 			Decoder_Interface_Decode(data->decoder, frame_buf, pcm_out, 0);
+			MUX_PROBE_LIB_RETURN(MUX_CODEC_AMR, "Decoder_Interface_Decode",
+					     0);
 
 			ret = mux_buffer_write(&dec->audio_output,
 					       pcm_out, sizeof(pcm_out));
@@ -592,6 +651,56 @@ static int amr_decoder_finalize(struct mux_decoder *dec)
 	return MUX_OK;
 }
 
+/*
+ * AMR encoder splice
+ * A partial frame is finished with silence first. Clips from raw
+ * streams come as runs of frames, which are split on their mode byte.
+ */
+static int amr_encoder_splice_check(struct mux_encoder *enc,
+				    const uint8_t *packet, size_t size)
+{
+	size_t pos = 0;
+	int frame_size;
+
+	(void)enc;
+	while (pos < size) {
+		frame_size = amr_get_frame_size(packet[pos]);
+		if (frame_size <= 0 || (size_t)frame_size > size - pos)
+			return MUX_ERROR_FORMAT;
+		pos += (size_t)frame_size;
+	}
+	return MUX_OK;
+}
+
+static int amr_encoder_splice(struct mux_encoder *enc, const uint8_t *packet,
+			      size_t size)
+{
+	struct amr_encoder_data *data = enc->codec_data;
+	size_t pos = 0;
+	int frame_size, ret;
+
+	if (data->input_samples > 0) {
+		ret = amr_encoder_finalize(enc);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	while (pos < size) {
+		frame_size = amr_get_frame_size(packet[pos]);
+		if (frame_size <= 0 || (size_t)frame_size > size - pos)
+			return MUX_ERROR_FORMAT;
+
+		ret = mux_leb128_write_frame(&enc->output, packet + pos,
+					     (size_t)frame_size,
+					     MUX_STREAM_AUDIO, enc->num_streams);
+		if (ret != MUX_OK)
+			return ret;
+		pos += (size_t)frame_size;
+	}
+
+	return MUX_OK;
+}
+
 /*
  * AMR-NB only supports 8kHz
  */
@@ -613,6 +722,11 @@ const struct mux_codec_ops mux_codec_amr_ops = {
 	.decoder_read = amr_decoder_read,
 	.decoder_finalize = amr_decoder_finalize,
 
+	.encoder_set_bitrate = amr_encoder_set_bitrate,
+	.encoder_splice = amr_encoder_splice,
+	.encoder_splice_check = amr_encoder_splice_check,
+	.encoder_set_dtx = amr_encoder_set_dtx,
+
 	.encoder_params = amr_encoder_params,
 	.encoder_param_count = sizeof(amr_encoder_params) / sizeof(amr_encoder_params[0]),
 	.decoder_params = NULL,
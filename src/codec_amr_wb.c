@@ -16,6 +16,7 @@
  */
 #include "mux.h"
 #include "mux_internal.h"
+#include "mux_trace.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -268,6 +269,7 @@ static int amr_wb_encoder_encode(struct mux_encoder *enc,
 
 		/* Encode complete frame */
 		if (data->input_samples == AMR_WB_FRAME_SAMPLES) {
+			MUX_PROBE_LIB_ENTRY(MUX_CODEC_AMR_WB, "E_IF_encode");
 			frame_size = E_IF_encode(
 				data->encoder,
 				data->mode,
@@ -275,6 +277,8 @@ static int amr_wb_encoder_encode(struct mux_encoder *enc,
 				frame_buf,
 				data->dtx
 			);
+			MUX_PROBE_LIB_RETURN(MUX_CODEC_AMR_WB, "E_IF_encode",
+					     frame_size);
 
 			if (frame_size < 0) {
 				mux_encoder_set_error(enc, MUX_ERROR_ENCODE,
@@ -352,6 +356,7 @@ static int amr_wb_encoder_finalize(struct mux_encoder *enc)
 		memset(&data->input_buf[data->input_samples], 0,
 		       (AMR_WB_FRAME_SAMPLES - data->input_samples) * sizeof(int16_t));
 
+		MUX_PROBE_LIB_ENTRY(MUX_CODEC_AMR_WB, "E_IF_encode");
 		frame_size = E_IF_encode(
 			data->encoder,
 			data->mode,
@@ -359,6 +364,8 @@ static int amr_wb_encoder_finalize(struct mux_encoder *enc)
 			frame_buf,
 			data->dtx
 		);
+		MUX_PROBE_LIB_RETURN(MUX_CODEC_AMR_WB, "E_IF_encode",
+				     frame_size);
 
 		if (frame_size > 0) {
 			ret = mux_leb128_write_frame(&enc->output, frame_buf, frame_size,
@@ -377,6 +384,43 @@ static int amr_wb_encoder_finalize(struct mux_encoder *enc)
 #endif
 }
 
+#ifdef HAVE_AMR_WB_ENCODE
+/*
+ * AMR-WB live bitrate change: the highest mode at or below bps
+ */
+static const int amr_wb_mode_bps[] = {
+	6600, 8850, 12650, 14250, 15850, 18250, 19850, 23050, 23850
+};
+
+static int amr_wb_encoder_set_bitrate(struct mux_encoder *enc, int bps,
+				      int *applied)
+{
+	struct amr_wb_encoder_data *data = enc->codec_data;
+	int mode;
+
+	if (bps > 0) {
+		for (mode = AMR_WB_MODE_2385; mode > AMR_WB_MODE_660; mode--)
+			if (amr_wb_mode_bps[mode] <= bps)
+				break;
+		data->mode = mode;
+	}
+
+	*applied = amr_wb_mode_bps[data->mode];
+	return MUX_OK;
+}
+
+/*
+ * AMR-WB DTX switch: the encoder takes the flag with every frame
+ */
+static int amr_wb_encoder_set_dtx(struct mux_encoder *enc, int on)
+{
+	struct amr_wb_encoder_data *data = enc->codec_data;
+
+	data->dtx = on ? 1 : 0;
+	return MUX_OK;
+}
+#endif
+
 /*
  * AMR-WB decoder initialization
  */
@@ -491,14 +535,13 @@ static int amr_wb_decoder_decode(struct mux_decoder *dec,
 	if (!frame_buf)
 		return MUX_ERROR_NOMEM;
 
-	ret = mux_buffer_write(&data->input_buf, input, input_size);
+	ret = mux_decoder_buffer_input(dec, &data->input_buf, input, input_size,
+				       input_consumed);
 	if (ret != MUX_OK) {
 		free(frame_buf);
 		return ret;
 	}
 
-	*input_consumed = input_size;
-
 	/* Passthrough mode: parse AMR-WB frames directly */
 	if (dec->num_streams == 1) {
 		while (data->input_buf.size - data->input_buf.read_pos > 0) {
@@ -518,7 +561,10 @@ static int amr_wb_decoder_decode(struct mux_decoder *dec,
 				break;
 
 			/* Decode AMR-WB frame */
+			MUX_PROBE_LIB_ENTRY(MUX_CODEC_AMR_WB, "D_IF_decode");
 			D_IF_decode(data->decoder, buf_ptr, pcm_out, 0);
+			MUX_PROBE_LIB_RETURN(MUX_CODEC_AMR_WB, "D_IF_decode",
+					     0);
 
 			ret = mux_buffer_write(&dec->audio_output,
 					       pcm_out, sizeof(pcm_out));
@@ -543,9 +589,9 @@ static int amr_wb_decoder_decode(struct mux_decoder *dec,
 
 	/* Mux mode: use LEB128 framing */
 	while (1) {
-		ret = mux_leb128_read_frame(&data->input_buf,
-					    frame_buf, frame_buf_capacity,
-					    &frame_size, &stream_type, dec->num_streams);
+		ret = mux_decoder_read_frame(dec, &data->input_buf,
+					     frame_buf, frame_buf_capacity,
+					     &frame_size, &stream_type);
 			if (ret == MUX_ERROR_INVAL && frame_size > frame_buf_capacity) {
 			uint8_t *new_buf = realloc(frame_buf, frame_size);
 			if (!new_buf) {
@@ -555,9 +601,9 @@ static int amr_wb_decoder_decode(struct mux_decoder *dec,
 			frame_buf = new_buf;
 			frame_buf_capacity = frame_size;
 
-			ret = mux_leb128_read_frame(&data->input_buf,
-						    frame_buf, frame_buf_capacity,
-						    &frame_size, &stream_type, dec->num_streams);
+			ret = mux_decoder_read_frame(dec, &data->input_buf,
+						     frame_buf, frame_buf_capacity,
+						     &frame_size, &stream_type);
 		}
 
 		if (ret != MUX_OK) {
@@ -572,7 +618,10 @@ static int amr_wb_decoder_decode(struct mux_decoder *dec,
 
 		if (stream_type == MUX_STREAM_AUDIO) {
 			/* Decode AMR-WB frame */
+			MUX_PROBE_LIB_ENTRY(MUX_CODEC_AMR_WB, "D_IF_decode");
 			D_IF_decode(data->decoder, frame_buf, pcm_out, 0);
+			MUX_PROBE_LIB_RETURN(MUX_CODEC_AMR_WB, "D_IF_decode",
+					     0);
 
 			ret = mux_buffer_write(&dec->audio_output,
 					       pcm_out, sizeof(pcm_out));
@@ -639,6 +688,58 @@ static int amr_wb_decoder_finalize(struct mux_decoder *dec)
 	return MUX_OK;
 }
 
+#ifdef HAVE_AMR_WB_ENCODE
+/*
+ * AMR-WB encoder splice
+ * A partial frame is finished with silence first. Clips from raw
+ * streams come as runs of frames, which are split on their mode byte.
+ */
+static int amr_wb_encoder_splice_check(struct mux_encoder *enc,
+				       const uint8_t *packet, size_t size)
+{
+	size_t pos = 0;
+	int frame_size;
+
+	(void)enc;
+	while (pos < size) {
+		frame_size = amr_wb_get_frame_size(packet[pos]);
+		if (frame_size <= 0 || (size_t)frame_size > size - pos)
+			return MUX_ERROR_FORMAT;
+		pos += (size_t)frame_size;
+	}
+	return MUX_OK;
+}
+
+static int amr_wb_encoder_splice(struct mux_encoder *enc,
+				 const uint8_t *packet, size_t size)
+{
+	struct amr_wb_encoder_data *data = enc->codec_data;
+	size_t pos = 0;
+	int frame_size, ret;
+
+	if (data->input_samples > 0) {
+		ret = amr_wb_encoder_finalize(enc);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	while (pos < size) {
+		frame_size = amr_wb_get_frame_size(packet[pos]);
+		if (frame_size <= 0 || (size_t)frame_size > size - pos)
+			return MUX_ERROR_FORMAT;
+
+		ret = mux_leb128_write_frame(&enc->output, packet + pos,
+					     (size_t)frame_size,
+					     MUX_STREAM_AUDIO, enc->num_streams);
+		if (ret != MUX_OK)
+			return ret;
+		pos += (size_t)frame_size;
+	}
+
+	return MUX_OK;
+}
+#endif
+
 /*
  * AMR-WB only supports 16kHz
  */
@@ -660,6 +761,13 @@ const struct mux_codec_ops mux_codec_amr_wb_ops = {
 	.decoder_read = amr_wb_decoder_read,
 	.decoder_finalize = amr_wb_decoder_finalize,
 
+#ifdef HAVE_AMR_WB_ENCODE
+	.encoder_set_bitrate = amr_wb_encoder_set_bitrate,
+	.encoder_splice = amr_wb_encoder_splice,
+	.encoder_splice_check = amr_wb_encoder_splice_check,
+	.encoder_set_dtx = amr_wb_encoder_set_dtx,
+#endif
+
 	.encoder_params = amr_wb_encoder_params,
 	.encoder_param_count = sizeof(amr_wb_encoder_params) / sizeof(amr_wb_encoder_params[0]),
 	.decoder_params = NULL,
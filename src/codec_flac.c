@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "mux.h"
 #include "mux_internal.h"
+#include "mux_trace.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -36,8 +37,12 @@ struct flac_decoder_data {
 	/* Input buffer for FLAC decoder */
 	struct mux_buffer flac_input_buf;
 
-	/* Buffer for decoded audio output */
-	struct mux_buffer *audio_output_buf;
+	/* Owning decoder: decoded audio goes to it from the callbacks */
+	struct mux_decoder *mux_dec;
+	int limit_error;
+
+	/* Optional monitoring downmix/decimation */
+	struct mux_pcm_reducer reduce;
 
 	/* Sample rate info */
 	int sample_rate;
@@ -241,36 +246,28 @@ static int mux_flac_encoder_encode(struct mux_encoder *enc,
 	const int16_t *pcm = input;
 	size_t num_samples = input_size / sizeof(int16_t) / data->num_channels;
 
-	/* Convert interleaved int16 to FLAC__int32 planar */
-	FLAC__int32 *buffer[8];  /* Max 8 channels */
-	int ch;
-
-	for (ch = 0; ch < data->num_channels; ch++) {
-		buffer[ch] = malloc(num_samples * sizeof(FLAC__int32));
-		if (!buffer[ch]) {
-			for (int i = 0; i < ch; i++)
-				free(buffer[i]);
-			mux_encoder_set_error(enc, MUX_ERROR_NOMEM,
-					      "Failed to allocate FLAC buffer",
-					      NULL, 0, NULL);
-			return MUX_ERROR_NOMEM;
-		}
-	}
+	/* Widen to FLAC__int32, keeping the interleaving */
+	size_t total = num_samples * data->num_channels;
+	FLAC__int32 *buffer = malloc(total * sizeof(*buffer));
 
-	for (size_t i = 0; i < num_samples; i++) {
-		for (ch = 0; ch < data->num_channels; ch++) {
-			buffer[ch][i] = pcm[i * data->num_channels + ch];
-		}
+	if (!buffer) {
+		mux_encoder_set_error(enc, MUX_ERROR_NOMEM,
+				      "Failed to allocate FLAC buffer",
+				      NULL, 0, NULL);
+		return MUX_ERROR_NOMEM;
 	}
 
+	for (size_t i = 0; i < total; i++)
+		buffer[i] = pcm[i];
+
 	/* Encode samples */
-	FLAC__bool ok = FLAC__stream_encoder_process(data->enc,
-						     (const FLAC__int32 *const *)buffer,
-						     num_samples);
+	MUX_PROBE_LIB_ENTRY(MUX_CODEC_FLAC, "FLAC__stream_encoder_process_interleaved");
+	FLAC__bool ok = FLAC__stream_encoder_process_interleaved(data->enc, buffer,
+								 num_samples);
+	MUX_PROBE_LIB_RETURN(MUX_CODEC_FLAC, "FLAC__stream_encoder_process_interleaved",
+			     ok);
 
-	/* Free buffers */
-	for (ch = 0; ch < data->num_channels; ch++)
-		free(buffer[ch]);
+	free(buffer);
 
 	if (!ok) {
 		FLAC__StreamEncoderState state = FLAC__stream_encoder_get_state(data->enc);
@@ -394,29 +391,29 @@ static FLAC__StreamDecoderWriteStatus flac_decoder_write_callback(
 	void *client_data)
 {
 	struct flac_decoder_data *data = client_data;
-	int ch;
-	unsigned i;
-	int16_t *pcm_buf;
-	size_t pcm_size;
+	struct mux_pcm_reducer *r = &data->reduce;
 
 	(void)decoder;
 
-	/* Convert planar FLAC__int32 to interleaved int16 */
-	pcm_size = frame->header.blocksize * data->num_channels * sizeof(int16_t);
-	pcm_buf = malloc(pcm_size);
-	if (!pcm_buf)
-		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
-
-	for (i = 0; i < frame->header.blocksize; i++) {
-		for (ch = 0; ch < data->num_channels; ch++) {
-			pcm_buf[i * data->num_channels + ch] = (int16_t)buffer[ch][i];
+	/* Frames carry their own format; follow it if STREAMINFO was missed */
+	if (r->in_rate != (int)frame->header.sample_rate ||
+	    r->in_channels != (int)frame->header.channels) {
+		if (mux_decoder_check_format(data->mux_dec,
+					     frame->header.sample_rate,
+					     frame->header.channels) != MUX_OK) {
+			data->limit_error = 1;
+			return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 		}
+		mux_pcm_reducer_start(r, frame->header.sample_rate,
+				      frame->header.channels);
 	}
 
-	/* Write to audio output buffer */
-	mux_buffer_write(data->audio_output_buf, pcm_buf, pcm_size);
+	/* Planar FLAC__int32 straight to interleaved int16, downmixed and
+	 * decimated if requested */
+	if (mux_pcm_reducer_write_s32(r, data->mux_dec, buffer,
+				      frame->header.blocksize) != MUX_OK)
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 
-	free(pcm_buf);
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
@@ -461,9 +458,7 @@ static int mux_flac_decoder_init(struct mux_decoder *dec,
 {
 	struct flac_decoder_data *data;
 	FLAC__StreamDecoderInitStatus init_status;
-
-	(void)params;
-	(void)num_params;
+	int ret;
 
 	data = calloc(1, sizeof(*data));
 	if (!data) {
@@ -473,7 +468,16 @@ static int mux_flac_decoder_init(struct mux_decoder *dec,
 		return MUX_ERROR_NOMEM;
 	}
 
-	data->audio_output_buf = &dec->audio_output;
+	ret = mux_pcm_reducer_setup(&data->reduce, params, num_params);
+	if (ret != MUX_OK) {
+		mux_decoder_set_error(dec, ret,
+				      "Invalid output_rate/output_channels",
+				      NULL, 0, NULL);
+		free(data);
+		return ret;
+	}
+
+	data->mux_dec = dec;
 
 	/* Initialize input buffer for LEB128 demuxing */
 	if (mux_buffer_init(&data->leb128_input_buf, 4096) != MUX_OK) {
@@ -559,6 +563,18 @@ static void mux_flac_decoder_deinit(struct mux_decoder *dec)
 	dec->codec_data = NULL;
 }
 
+static FLAC__bool process_single(struct flac_decoder_data *data)
+{
+	FLAC__bool ok;
+
+	MUX_PROBE_LIB_ENTRY(MUX_CODEC_FLAC, "FLAC__stream_decoder_process_single");
+	ok = FLAC__stream_decoder_process_single(data->dec);
+	MUX_PROBE_LIB_RETURN(MUX_CODEC_FLAC,
+			     "FLAC__stream_decoder_process_single", ok);
+
+	return ok;
+}
+
 /*
  * FLAC decoder decode
  * Reads LEB128 frames and decodes FLAC audio
@@ -583,21 +599,21 @@ static int mux_flac_decoder_decode(struct mux_decoder *dec,
 		return MUX_ERROR_INVAL;
 
 	/* Add input to LEB128 buffer */
-	ret = mux_buffer_write(&data->leb128_input_buf, input, input_size);
+	ret = mux_decoder_buffer_input(dec, &data->leb128_input_buf, input, input_size,
+				       &consumed);
 	if (ret != MUX_OK)
 		return ret;
 
-	consumed = input_size;
-
 	/* Try to read frames from LEB128 input buffer */
 	while (1) {
-		ret = mux_leb128_read_frame(&data->leb128_input_buf,
-					    frame_buf, sizeof(frame_buf),
-					    &frame_size, &stream_type, dec->num_streams);
+		ret = mux_decoder_read_frame(dec, &data->leb128_input_buf,
+					     frame_buf, sizeof(frame_buf),
+					     &frame_size, &stream_type);
 		if (ret != MUX_OK) {
-			mux_decoder_set_error(dec, MUX_ERROR_FORMAT,
-					      "Failed to read LEB128 frame",
-					      NULL, 0, NULL);
+			if (ret != MUX_ERROR_LIMIT)
+				mux_decoder_set_error(dec, MUX_ERROR_FORMAT,
+						      "Failed to read LEB128 frame",
+						      NULL, 0, NULL);
 			return ret;
 		}
 
@@ -632,11 +648,14 @@ static int mux_flac_decoder_decode(struct mux_decoder *dec,
 		while (mux_buffer_available(&data->flac_input_buf) > 0 &&
 		       (FLAC__stream_decoder_get_state(data->dec) == FLAC__STREAM_DECODER_SEARCH_FOR_FRAME_SYNC ||
 			FLAC__stream_decoder_get_state(data->dec) == FLAC__STREAM_DECODER_READ_FRAME)) {
-			if (!FLAC__stream_decoder_process_single(data->dec))
+			if (!process_single(data))
 				break;
 		}
 	}
 
+	if (data->limit_error)
+		return MUX_ERROR_LIMIT;
+
 	*input_consumed = consumed;
 	return MUX_OK;
 }
@@ -701,7 +720,7 @@ static int mux_flac_decoder_finalize(struct mux_decoder *dec)
 
 	/* Process any remaining frames */
 	while (FLAC__stream_decoder_get_state(data->dec) != FLAC__STREAM_DECODER_END_OF_STREAM) {
-		if (!FLAC__stream_decoder_process_single(data->dec))
+		if (!process_single(data))
 			break;
 	}
 
@@ -726,8 +745,8 @@ const struct mux_codec_ops mux_codec_flac_ops = {
 
 	.encoder_params = flac_encoder_params,
 	.encoder_param_count = sizeof(flac_encoder_params) / sizeof(flac_encoder_params[0]),
-	.decoder_params = NULL,
-	.decoder_param_count = 0,
+	.decoder_params = mux_reduce_decoder_params,
+	.decoder_param_count = MUX_REDUCE_PARAM_COUNT,
 
 	.supported_sample_rates = flac_sample_rates,
 	.sample_rate_count = 2,
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "mux.h"
 #include "mux_internal.h"
+#include "mux_trace.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -80,9 +81,51 @@ static int mp3_ensure_buffer(struct mp3_encoder_data *data, size_t num_samples)
 struct mp3_decoder_data {
 #ifdef HAVE_MP3_USE_MPG123
 	mpg123_handle *mh;  /* mpg123 decoder handle */
+	struct mux_buffer head;  /* fed before the first format, for replay */
+	int probing;             /* down-sampling waits for the stream rate */
+#endif
+#if defined(HAVE_MP3_USE_MPG123) || defined(HAVE_MP3_BUILTIN)
+	struct mux_pcm_reducer reduce;  /* Monitoring downmix/decimation */
+#endif
+#ifdef HAVE_MP3_BUILTIN
+	struct mux_mp3dec *builtin;   /* In-tree decoder, NULL with mpg123 */
+	struct mux_buffer stream;     /* MP3 bytes from LEB128 payloads */
+	int16_t pcm[MUX_MP3DEC_MAX_SAMPLES * 2];
 #endif
 	struct mux_buffer input_buf;  /* Buffer for muxed input */
 };
+
+/* Largest LEB128 payload; a single one may hold many frames */
+#define MP3_MAX_PAYLOAD 65536
+
+/* Give up picking a down-sampling factor after this much input */
+#define MP3_PROBE_MAX   (1 << 20)
+#endif
+
+#if defined(HAVE_MP3_USE_MPG123) && defined(HAVE_MP3_BUILTIN)
+/*
+ * MP3 decoder parameters, with both backends compiled in
+ */
+static const struct mux_param_desc mp3_decoder_params[] = {
+	{
+		.name = "output_rate",
+		.description = "Maximum output sample rate (0 = native)",
+		.type = MUX_PARAM_TYPE_INT,
+		.range.i = { .min = 0, .max = 384000, .def = 0 }
+	},
+	{
+		.name = "output_channels",
+		.description = "Output channels (0 = native, 1 = mono downmix)",
+		.type = MUX_PARAM_TYPE_INT,
+		.range.i = { .min = 0, .max = 1, .def = 0 }
+	},
+	{
+		.name = "builtin",
+		.description = "Decode with the in-tree decoder instead of mpg123",
+		.type = MUX_PARAM_TYPE_BOOL,
+		.range.b = { .def = 0 }
+	}
+};
 #endif
 
 #ifdef HAVE_MP3_ENCODE
@@ -111,7 +154,8 @@ static const struct mux_param_desc mp3_encoder_params[] = {
 };
 #endif
 
-#ifdef HAVE_MP3_ENCODE
+#if defined(HAVE_MP3_ENCODE) || \
+	(defined(HAVE_MP3_USE_MPG123) && defined(HAVE_MP3_BUILTIN))
 /*
  * Helper to find parameter value by name
  */
@@ -127,7 +171,7 @@ static const struct mux_param *find_param(const struct mux_param *params,
 	}
 	return NULL;
 }
-#endif /* HAVE_MP3_ENCODE */
+#endif
 
 #ifdef HAVE_MP3_ENCODE
 /*
@@ -267,6 +311,7 @@ static int mp3_encoder_encode(struct mux_encoder *enc,
 		return MUX_ERROR_NOMEM;
 	}
 
+	MUX_PROBE_LIB_ENTRY(MUX_CODEC_MP3, "lame_encode_buffer");
 	if (enc->num_channels == 1) {
 		mp3_bytes = lame_encode_buffer(data->gfp,
 					       pcm, NULL,
@@ -280,6 +325,7 @@ static int mp3_encoder_encode(struct mux_encoder *enc,
 							   data->mp3_buffer,
 							   data->mp3_buffer_size);
 	}
+	MUX_PROBE_LIB_RETURN(MUX_CODEC_MP3, "lame_encode_buffer", mp3_bytes);
 
 	if (mp3_bytes < 0) {
 		const char *err_msg = lame_encode_error_string(mp3_bytes);
@@ -352,9 +398,11 @@ static int mp3_encoder_finalize(struct mux_encoder *enc)
 				      NULL, 0, NULL);
 		return MUX_ERROR_NOMEM;
 	}
+	MUX_PROBE_LIB_ENTRY(MUX_CODEC_MP3, "lame_encode_flush");
 	mp3_bytes = lame_encode_flush(data->gfp,
 				      data->mp3_buffer,
 				      data->mp3_buffer_size);
+	MUX_PROBE_LIB_RETURN(MUX_CODEC_MP3, "lame_encode_flush", mp3_bytes);
 
 	if (mp3_bytes < 0) {
 		const char *err_msg = lame_encode_error_string(mp3_bytes);
@@ -378,6 +426,24 @@ static int mp3_encoder_finalize(struct mux_encoder *enc)
 #endif /* HAVE_MP3_ENCODE */
 
 #ifdef HAVE_MP3_DECODE
+/*
+ * Release everything init may have set up
+ */
+static void mp3_decoder_free(struct mp3_decoder_data *data)
+{
+#ifdef HAVE_MP3_USE_MPG123
+	if (data->mh)
+		mpg123_delete(data->mh);
+	mux_buffer_deinit(&data->head);
+#endif
+#ifdef HAVE_MP3_BUILTIN
+	mux_mp3dec_destroy(data->builtin);
+	mux_buffer_deinit(&data->stream);
+#endif
+	mux_buffer_deinit(&data->input_buf);
+	free(data);
+}
+
 /*
  * MP3 decoder initialization
  */
@@ -386,16 +452,29 @@ static int mp3_decoder_init(struct mux_decoder *dec,
 			    int num_params)
 {
 	struct mp3_decoder_data *data;
+	int use_builtin = 0;
 	int err;
 
 	(void)params;
 	(void)num_params;
 	(void)err;
 
+#if defined(HAVE_MP3_USE_MPG123) && defined(HAVE_MP3_BUILTIN)
+	{
+		const struct mux_param *p = find_param(params, num_params,
+						       "builtin");
+
+		use_builtin = p && p->value.b;
+	}
+#elif defined(HAVE_MP3_BUILTIN)
+	use_builtin = 1;
+#endif
+	(void)use_builtin;
+
 #ifdef HAVE_MP3_USE_MPG123
 	/* Initialize mpg123 library (once per process) */
 	static int mpg123_inited = 0;
-	if (!mpg123_inited) {
+	if (!use_builtin && !mpg123_inited) {
 		if (mpg123_init() != MPG123_OK) {
 			mux_decoder_set_error(dec, MUX_ERROR_INIT,
 					      "Failed to initialize mpg123 library",
@@ -414,25 +493,71 @@ static int mp3_decoder_init(struct mux_decoder *dec,
 		return MUX_ERROR_NOMEM;
 	}
 
-#ifdef HAVE_MP3_USE_MPG123
-	/* Create mpg123 decoder handle */
-	data->mh = mpg123_new(NULL, &err);
-	if (!data->mh) {
-		mux_decoder_set_error(dec, MUX_ERROR_INIT,
-				      "Failed to create mpg123 handle",
-				      "mpg123", err, mpg123_plain_strerror(err));
+#if defined(HAVE_MP3_USE_MPG123) || defined(HAVE_MP3_BUILTIN)
+	err = mux_pcm_reducer_setup(&data->reduce, params, num_params);
+	if (err != MUX_OK) {
+		mux_decoder_set_error(dec, err,
+				      "Invalid output_rate/output_channels",
+				      NULL, 0, NULL);
 		free(data);
-		return MUX_ERROR_INIT;
+		return err;
 	}
+#endif
 
-	/* Open in feed mode (streaming) */
-	if (mpg123_open_feed(data->mh) != MPG123_OK) {
-		mux_decoder_set_error(dec, MUX_ERROR_INIT,
-				      "Failed to open mpg123 feed mode",
-				      "mpg123", 0, mpg123_error_string(data->mh));
-		mpg123_delete(data->mh);
-		free(data);
-		return MUX_ERROR_INIT;
+#ifdef HAVE_MP3_BUILTIN
+	/* Mono output is mixed before synthesis, which then runs once */
+	if (use_builtin) {
+		data->builtin = mux_mp3dec_new(data->reduce.req_channels == 1 ?
+					       MUX_MP3DEC_MONO : 0);
+		if (!data->builtin ||
+		    mux_buffer_init(&data->stream, 0) != MUX_OK) {
+			mux_decoder_set_error(dec, MUX_ERROR_NOMEM,
+					      "Failed to allocate MP3 decoder",
+					      NULL, 0, NULL);
+			mp3_decoder_free(data);
+			return MUX_ERROR_NOMEM;
+		}
+	}
+#endif
+
+#ifdef HAVE_MP3_USE_MPG123
+	if (!use_builtin) {
+		/* Create mpg123 decoder handle */
+		data->mh = mpg123_new(NULL, &err);
+		if (!data->mh) {
+			mux_decoder_set_error(dec, MUX_ERROR_INIT,
+					      "Failed to create mpg123 handle",
+					      "mpg123", err, mpg123_plain_strerror(err));
+			mp3_decoder_free(data);
+			return MUX_ERROR_INIT;
+		}
+
+		/* Reduced monitoring output: let mpg123 mix to mono and skip
+		 * the upper subbands instead of synthesizing full-band stereo */
+		if (data->reduce.req_channels == 1)
+			mpg123_param(data->mh, MPG123_ADD_FLAGS, MPG123_MONO_MIX, 0);
+
+		/* The down-sampling factor depends on the stream rate,
+		 * which the first frame tells; see mp3_pick_down_sample() */
+		if (data->reduce.req_rate > 0) {
+			if (mux_buffer_init(&data->head, 4096) != MUX_OK) {
+				mux_decoder_set_error(dec, MUX_ERROR_NOMEM,
+						      "Failed to allocate input buffer",
+						      NULL, 0, NULL);
+				mp3_decoder_free(data);
+				return MUX_ERROR_NOMEM;
+			}
+			data->probing = 1;
+		}
+
+		/* Open in feed mode (streaming) */
+		if (mpg123_open_feed(data->mh) != MPG123_OK) {
+			mux_decoder_set_error(dec, MUX_ERROR_INIT,
+					      "Failed to open mpg123 feed mode",
+					      "mpg123", 0, mpg123_error_string(data->mh));
+			mp3_decoder_free(data);
+			return MUX_ERROR_INIT;
+		}
 	}
 #endif
 
@@ -441,10 +566,7 @@ static int mp3_decoder_init(struct mux_decoder *dec,
 		mux_decoder_set_error(dec, MUX_ERROR_NOMEM,
 				      "Failed to allocate input buffer",
 				      NULL, 0, NULL);
-#ifdef HAVE_MP3_USE_MPG123
-		mpg123_delete(data->mh);
-#endif
-		free(data);
+		mp3_decoder_free(data);
 		return MUX_ERROR_NOMEM;
 	}
 
@@ -457,24 +579,251 @@ static int mp3_decoder_init(struct mux_decoder *dec,
  */
 static void mp3_decoder_deinit(struct mux_decoder *dec)
 {
-	struct mp3_decoder_data *data;
-
 	if (!dec || !dec->codec_data)
 		return;
 
-	data = dec->codec_data;
+	mp3_decoder_free(dec->codec_data);
+	dec->codec_data = NULL;
+}
+
 #ifdef HAVE_MP3_USE_MPG123
-	if (data->mh)
-		mpg123_delete(data->mh);
+/*
+ * First format of a stream decoded at reduced rate: halve or quarter
+ * the synthesis as far as it stays at or above output_rate. mpg123 only
+ * applies MPG123_DOWN_SAMPLE when a stream is opened, so the feed is
+ * reopened and what was fed so far replayed. Returns 1 if it was.
+ */
+static int mp3_pick_down_sample(struct mux_decoder *dec,
+				struct mp3_decoder_data *data, long rate)
+{
+	long down = 0;
+	int ret;
+
+	data->probing = 0;
+	while (down < 2 && (rate >> (down + 1)) >= data->reduce.req_rate)
+		down++;
+
+	if (down > 0 &&
+	    mpg123_param(data->mh, MPG123_DOWN_SAMPLE, down, 0) == MPG123_OK) {
+		ret = mpg123_open_feed(data->mh);
+		if (ret == MPG123_OK)
+			ret = mpg123_feed(data->mh, data->head.data,
+					  data->head.size);
+		if (ret != MPG123_OK) {
+			mux_decoder_set_error(dec, MUX_ERROR_DECODE,
+					      "Failed to reopen mpg123 feed",
+					      "mpg123", ret,
+					      mpg123_error_string(data->mh));
+			return MUX_ERROR_DECODE;
+		}
+		mux_buffer_deinit(&data->head);
+		return 1;
+	}
+
+	mux_buffer_deinit(&data->head);
+	return 0;
+}
+
+/*
+ * Read out everything mpg123 can decode from what it has been fed
+ */
+static int mp3_drain_mpg123(struct mux_decoder *dec,
+			    struct mp3_decoder_data *data)
+{
+	int ret;
+
+	while (1) {
+		int16_t pcm_buf[8192];
+		size_t pcm_bytes;
+
+		MUX_PROBE_LIB_ENTRY(MUX_CODEC_MP3, "mpg123_read");
+		ret = mpg123_read(data->mh, (unsigned char *)pcm_buf,
+				  sizeof(pcm_buf), &pcm_bytes);
+		MUX_PROBE_LIB_RETURN(MUX_CODEC_MP3, "mpg123_read", ret);
+
+		/* Write decoded data if we got any */
+		if (pcm_bytes > 0) {
+			struct mux_pcm_reducer *r = &data->reduce;
+			int write_ret;
+
+			if (r->in_channels == 0) {
+				long rate;
+				int channels, encoding;
+				mpg123_getformat(data->mh, &rate, &channels, &encoding);
+				write_ret = mux_decoder_check_format(dec, (int)rate,
+								     channels);
+				if (write_ret != MUX_OK)
+					return write_ret;
+				mux_pcm_reducer_start(r, (int)rate, channels);
+			}
+
+			write_ret = mux_pcm_reducer_write_s16(r, dec, pcm_buf,
+							      pcm_bytes / sizeof(int16_t) /
+							      r->in_channels);
+			if (write_ret != MUX_OK)
+				return write_ret;
+		}
+
+		/* Check return code */
+		if (ret == MPG123_OK) {
+			/* Got data, continue reading */
+			continue;
+		} else if (ret == MPG123_DONE || ret == MPG123_NEED_MORE) {
+			/* End of stream, or need more input */
+			return MUX_OK;
+		} else if (ret == MPG123_NEW_FORMAT) {
+			/* Format changed - restart the reducer on it */
+			long rate;
+			int channels, encoding;
+			mpg123_getformat(data->mh, &rate, &channels, &encoding);
+			if (data->probing) {
+				ret = mp3_pick_down_sample(dec, data, rate);
+				if (ret < 0)
+					return ret;
+				if (ret > 0)
+					continue;
+			}
+			ret = mux_decoder_check_format(dec, (int)rate, channels);
+			if (ret != MUX_OK)
+				return ret;
+			mux_pcm_reducer_start(&data->reduce, (int)rate, channels);
+			continue;
+		} else {
+			/* Error */
+			mux_decoder_set_error(dec, MUX_ERROR_DECODE,
+					      "mpg123_read failed",
+					      "mpg123", ret, mpg123_error_string(data->mh));
+			return MUX_ERROR_DECODE;
+		}
+	}
+}
 #endif
-	mux_buffer_deinit(&data->input_buf);
-	free(data);
-	dec->codec_data = NULL;
+
+#ifdef HAVE_MP3_BUILTIN
+/*
+ * Decode the whole frames in buf with the in-tree decoder. While the
+ * output needs no reduction, frames are decoded straight into
+ * audio_output.
+ */
+static int mp3_builtin_run(struct mux_decoder *dec,
+			   struct mp3_decoder_data *data,
+			   struct mux_buffer *buf)
+{
+	struct mux_pcm_reducer *r = &data->reduce;
+	struct mux_mp3_frame_info info;
+	size_t consumed, skipped, n;
+	int16_t *pcm;
+	int ret;
+
+	while (1) {
+		pcm = data->pcm;
+		if (!dec->pcm_sink && r->in_channels && !r->active) {
+			pcm = mux_buffer_reserve(&dec->audio_output,
+						 sizeof(data->pcm));
+			if (!pcm)
+				return MUX_ERROR_NOMEM;
+		}
+
+		ret = mux_mp3dec_decode_frame(data->builtin,
+					      buf->data + buf->read_pos,
+					      buf->size - buf->read_pos, pcm,
+					      &consumed, &info);
+		if (ret != MUX_OK)
+			return ret;
+		mux_buffer_read(buf, NULL, consumed, &skipped);
+
+		if (!info.frame_bytes) {
+			/* Junk or a tag skipped, or a partial frame */
+			if (consumed == 0)
+				return MUX_OK;
+			continue;
+		}
+		if (!info.samples)
+			continue;
+
+		if (info.sample_rate != r->in_rate ||
+		    info.channels != r->in_channels) {
+			ret = mux_decoder_check_format(dec, info.sample_rate,
+						       info.channels);
+			if (ret != MUX_OK)
+				return ret;
+			mux_pcm_reducer_start(r, info.sample_rate, info.channels);
+		}
+
+		n = (size_t)info.samples * (size_t)info.channels;
+		if (pcm != data->pcm) {
+			if (!r->active) {
+				dec->audio_output.size += n * sizeof(int16_t);
+				continue;
+			}
+			/* The format changed under a direct decode */
+			memcpy(data->pcm, pcm, n * sizeof(int16_t));
+		}
+
+		ret = mux_pcm_reducer_write_s16(r, dec, data->pcm,
+						(size_t)info.samples);
+		if (ret != MUX_OK)
+			return ret;
+	}
+}
+
+/*
+ * Raw streams are decoded where they sit in the input buffer; LEB128
+ * payloads are read straight into the end of the MP3 byte stream
+ */
+static int mp3_builtin_decode(struct mux_decoder *dec,
+			      struct mp3_decoder_data *data)
+{
+	size_t size;
+	uint8_t *p;
+	int stream_type;
+	int ret;
+
+	if (dec->num_streams == 1) {
+		ret = mp3_builtin_run(dec, data, &data->input_buf);
+		mux_buffer_compact(&data->input_buf);
+		return ret;
+	}
+
+	while (1) {
+		mux_buffer_compact(&data->stream);
+		p = mux_buffer_reserve(&data->stream, MP3_MAX_PAYLOAD);
+		if (!p)
+			return MUX_ERROR_NOMEM;
+
+		ret = mux_decoder_read_frame(dec, &data->input_buf, p,
+					     MP3_MAX_PAYLOAD, &size,
+					     &stream_type);
+		if (ret != MUX_OK) {
+			if (ret != MUX_ERROR_LIMIT)
+				mux_decoder_set_error(dec, MUX_ERROR_FORMAT,
+						      "Failed to read LEB128 frame",
+						      NULL, 0, NULL);
+			return ret;
+		}
+
+		if (stream_type < 0)
+			return MUX_OK;
+
+		if (stream_type == MUX_STREAM_SIDE_CHANNEL) {
+			ret = mux_buffer_write(&dec->side_output, p, size);
+			if (ret != MUX_OK)
+				return ret;
+			continue;
+		}
+
+		data->stream.size += size;
+		ret = mp3_builtin_run(dec, data, &data->stream);
+		if (ret != MUX_OK)
+			return ret;
+	}
 }
+#endif /* HAVE_MP3_BUILTIN */
 
 /*
  * MP3 decoder decode
- * Reads LEB128 frames and decompresses MP3 audio using mpg123
+ * Reads LEB128 frames and decompresses MP3 audio using mpg123 or the
+ * in-tree decoder
  */
 static int mp3_decoder_decode(struct mux_decoder *dec,
 			      const void *input,
@@ -487,7 +836,7 @@ static int mp3_decoder_decode(struct mux_decoder *dec,
 	 * comfortable for ~700ms of mp3 audio and avoids dynamic allocation
 	 * here. mux_leb128_read_frame returns MUX_ERROR_INVAL if any single
 	 * payload exceeds this. */
-	uint8_t frame_buf[65536];
+	uint8_t frame_buf[MP3_MAX_PAYLOAD];
 	size_t frame_size;
 	int stream_type;
 	int ret;
@@ -501,21 +850,30 @@ static int mp3_decoder_decode(struct mux_decoder *dec,
 		return MUX_ERROR_INVAL;
 
 	/* Add input to buffer */
-	ret = mux_buffer_write(&data->input_buf, input, input_size);
+	ret = mux_decoder_buffer_input(dec, &data->input_buf, input, input_size,
+				       &consumed);
 	if (ret != MUX_OK)
 		return ret;
 
-	consumed = input_size;
+#ifdef HAVE_MP3_BUILTIN
+	if (data->builtin) {
+		ret = mp3_builtin_decode(dec, data);
+		if (ret == MUX_OK)
+			*input_consumed = consumed;
+		return ret;
+	}
+#endif
 
 	/* Try to read frames from input buffer */
 	while (1) {
-		ret = mux_leb128_read_frame(&data->input_buf,
-					    frame_buf, sizeof(frame_buf),
-					    &frame_size, &stream_type, dec->num_streams);
+		ret = mux_decoder_read_frame(dec, &data->input_buf,
+					     frame_buf, sizeof(frame_buf),
+					     &frame_size, &stream_type);
 		if (ret != MUX_OK) {
-			mux_decoder_set_error(dec, MUX_ERROR_FORMAT,
-					      "Failed to read LEB128 frame",
-					      NULL, 0, NULL);
+			if (ret != MUX_ERROR_LIMIT)
+				mux_decoder_set_error(dec, MUX_ERROR_FORMAT,
+						      "Failed to read LEB128 frame",
+						      NULL, 0, NULL);
 			return ret;
 		}
 
@@ -534,8 +892,23 @@ static int mp3_decoder_decode(struct mux_decoder *dec,
 		}
 
 #ifdef HAVE_MP3_USE_MPG123
+		/* Keep what comes before the first format for a replay */
+		if (data->probing) {
+			if (data->head.size + frame_size > MP3_PROBE_MAX) {
+				data->probing = 0;
+				mux_buffer_deinit(&data->head);
+			} else {
+				ret = mux_buffer_write(&data->head, frame_buf,
+						       frame_size);
+				if (ret != MUX_OK)
+					return ret;
+			}
+		}
+
 		/* Feed MP3 data to mpg123 */
+		MUX_PROBE_LIB_ENTRY(MUX_CODEC_MP3, "mpg123_feed");
 		ret = mpg123_feed(data->mh, frame_buf, frame_size);
+		MUX_PROBE_LIB_RETURN(MUX_CODEC_MP3, "mpg123_feed", ret);
 		if (ret != MPG123_OK && ret != MPG123_NEED_MORE) {
 			mux_decoder_set_error(dec, MUX_ERROR_DECODE,
 					      "mpg123_feed failed",
@@ -544,44 +917,9 @@ static int mp3_decoder_decode(struct mux_decoder *dec,
 		}
 
 		/* Read all available decoded data after this feed */
-		while (1) {
-			unsigned char pcm_buf[16384];
-			size_t pcm_bytes;
-
-			ret = mpg123_read(data->mh, pcm_buf, sizeof(pcm_buf), &pcm_bytes);
-
-			/* Write decoded data if we got any */
-			if (pcm_bytes > 0) {
-				int write_ret = mux_buffer_write(&dec->audio_output,
-							       pcm_buf, pcm_bytes);
-				if (write_ret != MUX_OK)
-					return write_ret;
-			}
-
-			/* Check return code */
-			if (ret == MPG123_OK) {
-				/* Got data, continue reading */
-				continue;
-			} else if (ret == MPG123_DONE) {
-				/* End of stream */
-				break;
-			} else if (ret == MPG123_NEED_MORE) {
-				/* Need more input - break inner loop to feed more */
-				break;
-			} else if (ret == MPG123_NEW_FORMAT) {
-				/* Format changed - get new format and continue */
-				long rate;
-				int channels, encoding;
-				mpg123_getformat(data->mh, &rate, &channels, &encoding);
-				continue;
-			} else {
-				/* Error */
-				mux_decoder_set_error(dec, MUX_ERROR_DECODE,
-						      "mpg123_read failed",
-						      "mpg123", ret, mpg123_error_string(data->mh));
-				return MUX_ERROR_DECODE;
-			}
-		}
+		ret = mp3_drain_mpg123(dec, data);
+		if (ret != MUX_OK)
+			return ret;
 #else
 		/* Passthrough mode (no mpg123): emit raw MP3 frame bytes on the
 		 * audio stream. The caller is expected to feed them into a
@@ -647,6 +985,13 @@ static int mp3_decoder_finalize(struct mux_decoder *dec)
 	if (!dec)
 		return MUX_ERROR_INVAL;
 
+#ifdef HAVE_MP3_BUILTIN
+	/* Every whole frame has been decoded already */
+	if (dec->codec_data &&
+	    ((struct mp3_decoder_data *)dec->codec_data)->builtin)
+		return MUX_OK;
+#endif
+
 #ifdef HAVE_MP3_USE_MPG123
 	struct mp3_decoder_data *data = dec->codec_data;
 	int ret;
@@ -663,47 +1008,10 @@ static int mp3_decoder_finalize(struct mux_decoder *dec)
 	}
 
 	/* Read out remaining decoded data */
-	while (1) {
-		unsigned char pcm_buf[16384];
-		size_t pcm_bytes;
-
-		ret = mpg123_read(data->mh, pcm_buf, sizeof(pcm_buf), &pcm_bytes);
-
-		/* Write decoded data if we got any */
-		if (pcm_bytes > 0) {
-			int write_ret = mux_buffer_write(&dec->audio_output,
-						       pcm_buf, pcm_bytes);
-			if (write_ret != MUX_OK)
-				return write_ret;
-		}
-
-		/* Check return code */
-		if (ret == MPG123_OK) {
-			/* Got data, continue reading */
-			continue;
-		} else if (ret == MPG123_DONE) {
-			/* End of stream reached */
-			break;
-		} else if (ret == MPG123_NEED_MORE) {
-			/* No more data */
-			break;
-		} else if (ret == MPG123_NEW_FORMAT) {
-			/* Format changed - get new format and continue */
-			long rate;
-			int channels, encoding;
-			mpg123_getformat(data->mh, &rate, &channels, &encoding);
-			continue;
-		} else {
-			/* Error */
-			mux_decoder_set_error(dec, MUX_ERROR_DECODE,
-					      "mpg123_read failed during finalize",
-					      "mpg123", ret, mpg123_error_string(data->mh));
-			return MUX_ERROR_DECODE;
-		}
-	}
-#endif
-
+	return mp3_drain_mpg123(dec, data);
+#else
 	return MUX_OK;
+#endif
 }
 #endif /* HAVE_MP3_DECODE */
 
@@ -750,8 +1058,16 @@ const struct mux_codec_ops mux_codec_mp3_ops = {
 	.decoder_finalize = NULL,
 #endif
 
+#if defined(HAVE_MP3_USE_MPG123) && defined(HAVE_MP3_BUILTIN)
+	.decoder_params = mp3_decoder_params,
+	.decoder_param_count = sizeof(mp3_decoder_params) / sizeof(mp3_decoder_params[0]),
+#elif defined(HAVE_MP3_USE_MPG123) || defined(HAVE_MP3_BUILTIN)
+	.decoder_params = mux_reduce_decoder_params,
+	.decoder_param_count = MUX_REDUCE_PARAM_COUNT,
+#else
 	.decoder_params = NULL,
 	.decoder_param_count = 0,
+#endif
 
 	.supported_sample_rates = mp3_sample_rates,
 	.sample_rate_count = sizeof(mp3_sample_rates) / sizeof(mp3_sample_rates[0]),
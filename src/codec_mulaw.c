@@ -61,7 +61,7 @@ static uint8_t mulaw_encode_sample(int16_t pcm)
 /*
  * Mu-law decoding: 8-bit mu-law -> 16-bit linear PCM
  */
-static int16_t mulaw_decode_sample(uint8_t mulaw)
+int16_t mux_mulaw_decode_sample(uint8_t mulaw)
 {
 	int sign;
 	int exponent;
@@ -206,6 +206,32 @@ static int mulaw_encoder_finalize(struct mux_encoder *enc)
 	return MUX_OK;
 }
 
+/*
+ * Mu-law encoder splice
+ * Every whole sample frame is a frame boundary, so cached payloads go
+ * straight out
+ */
+static int mulaw_encoder_splice_check(struct mux_encoder *enc,
+				      const uint8_t *packet, size_t size)
+{
+	(void)packet;
+	if (size % (size_t)enc->num_channels != 0)
+		return MUX_ERROR_FORMAT;
+	return MUX_OK;
+}
+
+static int mulaw_encoder_splice(struct mux_encoder *enc, const uint8_t *packet,
+				size_t size)
+{
+	int ret = mulaw_encoder_splice_check(enc, packet, size);
+
+	if (ret != MUX_OK)
+		return ret;
+
+	return mux_leb128_write_frame(&enc->output, packet, size,
+				      MUX_STREAM_AUDIO, enc->num_streams);
+}
+
 /*
  * Mu-law decoder initialization
  */
@@ -276,18 +302,17 @@ static int mulaw_decoder_decode(struct mux_decoder *dec,
 	if (!frame_buf)
 		return MUX_ERROR_NOMEM;
 
-	ret = mux_buffer_write(&data->input_buf, input, input_size);
+	ret = mux_decoder_buffer_input(dec, &data->input_buf, input, input_size,
+				       &consumed);
 	if (ret != MUX_OK) {
 		free(frame_buf);
 		return ret;
 	}
 
-	consumed = input_size;
-
 	while (1) {
-		ret = mux_leb128_read_frame(&data->input_buf,
-					    frame_buf, frame_buf_capacity,
-					    &frame_size, &stream_type, dec->num_streams);
+		ret = mux_decoder_read_frame(dec, &data->input_buf,
+					     frame_buf, frame_buf_capacity,
+					     &frame_size, &stream_type);
 			if (ret == MUX_ERROR_INVAL && frame_size > frame_buf_capacity) {
 			uint8_t *new_buf = realloc(frame_buf, frame_size);
 			if (!new_buf) {
@@ -297,9 +322,9 @@ static int mulaw_decoder_decode(struct mux_decoder *dec,
 			frame_buf = new_buf;
 			frame_buf_capacity = frame_size;
 
-			ret = mux_leb128_read_frame(&data->input_buf,
-						    frame_buf, frame_buf_capacity,
-						    &frame_size, &stream_type, dec->num_streams);
+			ret = mux_decoder_read_frame(dec, &data->input_buf,
+						     frame_buf, frame_buf_capacity,
+						     &frame_size, &stream_type);
 		}
 
 		if (ret != MUX_OK) {
@@ -321,7 +346,7 @@ static int mulaw_decoder_decode(struct mux_decoder *dec,
 			}
 
 			for (i = 0; i < frame_size; i++) {
-				pcm_out[i] = mulaw_decode_sample(frame_buf[i]);
+				pcm_out[i] = mux_mulaw_decode_sample(frame_buf[i]);
 			}
 
 			ret = mux_buffer_write(&dec->audio_output,
@@ -391,6 +416,70 @@ static int mulaw_decoder_finalize(struct mux_decoder *dec)
 	return MUX_OK;
 }
 
+/*
+ * mu-law snapshot/restore
+ * The encoder is stateless; the decoder only holds unparsed input
+ */
+static int mulaw_encoder_snapshot(struct mux_encoder *enc,
+				  struct mux_buffer *blob)
+{
+	(void)enc;
+	(void)blob;
+	return MUX_OK;
+}
+
+static int mulaw_encoder_restore(struct mux_encoder *enc,
+				 struct mux_snap_reader *r)
+{
+	(void)enc;
+	(void)r;
+	return MUX_OK;
+}
+
+static int mulaw_decoder_snapshot(struct mux_decoder *dec,
+				  struct mux_buffer *blob)
+{
+	struct mulaw_codec_data *data = dec->codec_data;
+
+	return mux_snap_put_buffer(blob, &data->input_buf);
+}
+
+static int mulaw_decoder_restore(struct mux_decoder *dec,
+				 struct mux_snap_reader *r)
+{
+	struct mulaw_codec_data *data = dec->codec_data;
+	const uint8_t *input;
+	size_t size;
+	int ret;
+
+	ret = mux_snap_stage_buffer(r, &data->input_buf, &input, &size);
+	if (ret == MUX_OK)
+		ret = mux_snap_end(r);
+	if (ret == MUX_OK)
+		mux_snap_commit_buffer(&data->input_buf, input, size);
+
+	return ret;
+}
+
+/*
+ * Mu-law memory release: only the demux input buffer is reclaimable
+ */
+static int mulaw_decoder_trim(struct mux_decoder *dec, int hibernate)
+{
+	struct mulaw_codec_data *data = dec->codec_data;
+
+	(void)hibernate;
+	mux_buffer_shrink(&data->input_buf);
+	return MUX_OK;
+}
+
+static size_t mulaw_decoder_memory(const struct mux_decoder *dec)
+{
+	const struct mulaw_codec_data *data = dec->codec_data;
+
+	return sizeof(*data) + data->input_buf.capacity;
+}
+
 /*
  * Mu-law supports telephony standard rates, but can handle any rate
  */
@@ -412,6 +501,17 @@ const struct mux_codec_ops mux_codec_mulaw_ops = {
 	.decoder_read = mulaw_decoder_read,
 	.decoder_finalize = mulaw_decoder_finalize,
 
+	.encoder_snapshot = mulaw_encoder_snapshot,
+	.encoder_restore = mulaw_encoder_restore,
+	.decoder_snapshot = mulaw_decoder_snapshot,
+	.decoder_restore = mulaw_decoder_restore,
+
+	.decoder_trim = mulaw_decoder_trim,
+	.decoder_memory = mulaw_decoder_memory,
+
+	.encoder_splice = mulaw_encoder_splice,
+	.encoder_splice_check = mulaw_encoder_splice_check,
+
 	.encoder_params = NULL,
 	.encoder_param_count = 0,
 	.decoder_params = NULL,
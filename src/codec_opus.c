@@ -1,11 +1,20 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define _GNU_SOURCE
+#define MUX_HAVE_DLADDR 1
+#endif
+
 #include "mux.h"
 #include "mux_internal.h"
+#include "mux_trace.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <opus.h>
 #include <ogg/ogg.h>
+#ifdef MUX_HAVE_DLADDR
+#include <dlfcn.h>
+#endif
 
 /*
  * Opus encoder state
@@ -40,6 +49,9 @@ struct opus_encoder_data {
 	int16_t *pending;
 	size_t pending_samples;       /* samples currently buffered */
 	size_t pending_capacity;      /* allocated samples */
+
+	/* Ogg stream contents while hibernated */
+	struct mux_buffer parked;
 };
 
 /*
@@ -61,9 +73,15 @@ struct opus_decoder_data {
 	/* Track decoder initialization */
 	int decoder_inited;
 
-	/* Sample rate info */
+	/* Decode rate and channels */
 	int sample_rate;
 	int num_channels;
+
+	/* Optional monitoring downmix/decimation */
+	struct mux_pcm_reducer reduce;
+
+	/* Ogg sync/stream contents while hibernated */
+	struct mux_buffer parked;
 };
 
 /*
@@ -128,6 +146,8 @@ static int write_ogg_page(struct mux_buffer *output, ogg_page *og)
 	if (ret != MUX_OK)
 		return ret;
 
+	MUX_PROBE3(ogg_page_out, ogg_page_serialno(og),
+		   og->header_len + og->body_len, ogg_page_granulepos(og));
 	return MUX_OK;
 }
 
@@ -360,6 +380,7 @@ static void mux_opus_encoder_deinit(struct mux_encoder *enc)
 		opus_encoder_destroy(data->enc);
 
 	free(data->pending);
+	mux_buffer_deinit(&data->parked);
 	free(data);
 	enc->codec_data = NULL;
 }
@@ -424,8 +445,11 @@ static int mux_opus_encoder_encode(struct mux_encoder *enc,
 
 		ogg_stream_packetin(&data->os_side, &op);
 
-		/* Write out any completed pages */
-		ret = pageout_ogg_stream(&enc->output, &data->os_side);
+		/* Write out any completed pages, or every packet under a rate limit */
+		if (enc->rate)
+			ret = flush_ogg_stream(&enc->output, &data->os_side);
+		else
+			ret = pageout_ogg_stream(&enc->output, &data->os_side);
 		if (ret != MUX_OK)
 			return ret;
 
@@ -464,11 +488,13 @@ static int mux_opus_encoder_encode(struct mux_encoder *enc,
 		unsigned char opus_packet[4000];
 		int opus_len;
 
+		MUX_PROBE_LIB_ENTRY(MUX_CODEC_OPUS, "opus_encode");
 		opus_len = opus_encode(data->enc,
 				       data->pending + (samples_consumed * data->num_channels),
 				       data->frame_size,
 				       opus_packet,
 				       sizeof(opus_packet));
+		MUX_PROBE_LIB_RETURN(MUX_CODEC_OPUS, "opus_encode", opus_len);
 
 		if (opus_len < 0) {
 			mux_encoder_set_error(enc, MUX_ERROR_ENCODE,
@@ -491,8 +517,17 @@ static int mux_opus_encoder_encode(struct mux_encoder *enc,
 
 			ogg_stream_packetin(&data->os_audio, &op);
 
-			/* Write out any completed pages */
-			ret = pageout_ogg_stream(&enc->output, &data->os_audio);
+			/*
+			 * Write out any completed pages. Under a rate limit
+			 * every packet gets its own, so the link sees audio as
+			 * it is encoded rather than in pages of seconds.
+			 */
+			if (enc->rate)
+				ret = flush_ogg_stream(&enc->output,
+						       &data->os_audio);
+			else
+				ret = pageout_ogg_stream(&enc->output,
+							 &data->os_audio);
 			if (ret != MUX_OK)
 				return ret;
 		}
@@ -543,24 +578,10 @@ static int mux_opus_encoder_read(struct mux_encoder *enc,
 }
 
 /*
- * Opus encoder finalize
- * Flushes OGG streams
+ * Zero-pad the pending samples to a full frame and queue its packet
  */
-static int mux_opus_encoder_finalize(struct mux_encoder *enc)
+static int encode_pending_padded(struct opus_encoder_data *data)
 {
-	struct opus_encoder_data *data;
-	int ret;
-
-	if (!enc)
-		return MUX_ERROR_INVAL;
-
-	data = enc->codec_data;
-	if (!data)
-		return MUX_ERROR_INVAL;
-
-	/* Encode any pending tail samples by zero-padding to a full frame so we
-	 * don't lose the last < frame_size samples. The decoder's pre_skip /
-	 * stream end already trim trailing silence. */
 	if (data->pending_samples > 0) {
 		int16_t *frame = calloc(data->frame_size,
 		                        data->num_channels * sizeof(int16_t));
@@ -569,8 +590,10 @@ static int mux_opus_encoder_finalize(struct mux_encoder *enc)
 		       data->pending_samples * data->num_channels * sizeof(int16_t));
 
 		unsigned char opus_packet[4000];
+		MUX_PROBE_LIB_ENTRY(MUX_CODEC_OPUS, "opus_encode");
 		int opus_len = opus_encode(data->enc, frame, data->frame_size,
 		                           opus_packet, sizeof(opus_packet));
+		MUX_PROBE_LIB_RETURN(MUX_CODEC_OPUS, "opus_encode", opus_len);
 		free(frame);
 		if (opus_len > 0) {
 			ogg_packet ap;
@@ -585,6 +608,32 @@ static int mux_opus_encoder_finalize(struct mux_encoder *enc)
 		data->pending_samples = 0;
 	}
 
+	return MUX_OK;
+}
+
+/*
+ * Opus encoder finalize
+ * Flushes OGG streams
+ */
+static int mux_opus_encoder_finalize(struct mux_encoder *enc)
+{
+	struct opus_encoder_data *data;
+	int ret;
+
+	if (!enc)
+		return MUX_ERROR_INVAL;
+
+	data = enc->codec_data;
+	if (!data)
+		return MUX_ERROR_INVAL;
+
+	/* Encode any pending tail samples by zero-padding to a full frame so we
+	 * don't lose the last < frame_size samples. The decoder's pre_skip /
+	 * stream end already trim trailing silence. */
+	ret = encode_pending_padded(data);
+	if (ret != MUX_OK)
+		return ret;
+
 	/* Mark audio stream as ended */
 	ogg_packet op;
 	memset(&op, 0, sizeof(op));
@@ -622,9 +671,6 @@ static int mux_opus_decoder_init(struct mux_decoder *dec,
 	struct opus_decoder_data *data;
 	int ret;
 
-	(void)params;
-	(void)num_params;
-
 	data = calloc(1, sizeof(*data));
 	if (!data) {
 		mux_decoder_set_error(dec, MUX_ERROR_NOMEM,
@@ -633,6 +679,15 @@ static int mux_opus_decoder_init(struct mux_decoder *dec,
 		return MUX_ERROR_NOMEM;
 	}
 
+	ret = mux_pcm_reducer_setup(&data->reduce, params, num_params);
+	if (ret != MUX_OK) {
+		mux_decoder_set_error(dec, ret,
+				      "Invalid output_rate/output_channels",
+				      NULL, 0, NULL);
+		free(data);
+		return ret;
+	}
+
 	/* Initialize OGG sync state */
 	ret = ogg_sync_init(&data->oy);
 	if (ret != 0) {
@@ -669,6 +724,7 @@ static void mux_opus_decoder_deinit(struct mux_decoder *dec)
 
 	ogg_sync_clear(&data->oy);
 
+	mux_buffer_deinit(&data->parked);
 	free(data);
 	dec->codec_data = NULL;
 }
@@ -692,6 +748,35 @@ static int parse_opus_header(const unsigned char *packet, int bytes,
 	return 0;
 }
 
+/*
+ * Pick the decoder rate and channel count. libopus synthesizes
+ * directly at 8-48 kHz, mono or stereo, so a reduced monitoring
+ * output is mostly free; only rates libopus can't produce go through
+ * the generic decimator.
+ */
+static void opus_decode_format(struct opus_decoder_data *data)
+{
+	int rate = data->sample_rate;
+	size_t i;
+
+	if (data->reduce.req_rate > 0) {
+		rate = 48000;
+		for (i = 0; i < sizeof(opus_sample_rates) / sizeof(opus_sample_rates[0]); i++) {
+			if (opus_sample_rates[i] >= data->reduce.req_rate) {
+				rate = opus_sample_rates[i];
+				break;
+			}
+		}
+	}
+
+	if (data->reduce.req_channels > 0 &&
+	    data->reduce.req_channels < data->num_channels)
+		data->num_channels = data->reduce.req_channels;
+
+	data->sample_rate = rate;
+	mux_pcm_reducer_start(&data->reduce, rate, data->num_channels);
+}
+
 /*
  * Opus decoder decode
  * Reads OGG pages and decodes Opus audio
@@ -705,6 +790,7 @@ static int mux_opus_decoder_decode(struct mux_decoder *dec,
 	char *buffer;
 	ogg_page og;
 	ogg_packet op;
+	size_t room;
 	int ret;
 
 	if (!dec || !input || !input_consumed)
@@ -714,6 +800,11 @@ static int mux_opus_decoder_decode(struct mux_decoder *dec,
 	if (!data)
 		return MUX_ERROR_INVAL;
 
+	/* Take no more than the buffered-input limit leaves room for */
+	room = mux_decoder_input_room(dec, data->oy.fill - data->oy.returned);
+	if (input_size > room)
+		input_size = room;
+
 	/* Submit input data to OGG sync */
 	buffer = ogg_sync_buffer(&data->oy, input_size);
 	if (!buffer) {
@@ -765,6 +856,10 @@ static int mux_opus_decoder_decode(struct mux_decoder *dec,
 								      NULL, 0, NULL);
 						return MUX_ERROR_FORMAT;
 					}
+					ret = mux_decoder_check_format(dec, data->sample_rate,
+								       data->num_channels);
+					if (ret != MUX_OK)
+						return ret;
 					continue;
 				}
 
@@ -776,6 +871,8 @@ static int mux_opus_decoder_decode(struct mux_decoder *dec,
 				/* Now initialize decoder */
 				if (data->sample_rate > 0 && data->num_channels > 0) {
 					int opus_error;
+
+					opus_decode_format(data);
 					data->dec = opus_decoder_create(data->sample_rate,
 									data->num_channels,
 									&opus_error);
@@ -795,8 +892,12 @@ static int mux_opus_decoder_decode(struct mux_decoder *dec,
 				int16_t pcm_buf[5760 * 2];  /* Max Opus frame size * stereo */
 				int samples;
 
+				MUX_PROBE_LIB_ENTRY(MUX_CODEC_OPUS, "opus_decode");
 				samples = opus_decode(data->dec, op.packet, op.bytes,
-						      pcm_buf, 5760, 0);
+						      pcm_buf,
+						      5760 * 2 / data->num_channels, 0);
+				MUX_PROBE_LIB_RETURN(MUX_CODEC_OPUS, "opus_decode",
+						     samples);
 
 				if (samples < 0) {
 					mux_decoder_set_error(dec, MUX_ERROR_DECODE,
@@ -807,9 +908,8 @@ static int mux_opus_decoder_decode(struct mux_decoder *dec,
 				}
 
 				if (samples > 0) {
-					size_t pcm_size = samples * data->num_channels * sizeof(int16_t);
-					ret = mux_buffer_write(&dec->audio_output,
-							       pcm_buf, pcm_size);
+					ret = mux_pcm_reducer_write_s16(&data->reduce, dec,
+								       pcm_buf, samples);
 					if (ret != MUX_OK)
 						return ret;
 				}
@@ -832,6 +932,20 @@ static int mux_opus_decoder_decode(struct mux_decoder *dec,
 		}
 	}
 
+	/* Whatever is left in the streams is an incomplete packet */
+	if (data->have_audio_stream) {
+		ret = mux_decoder_check_frame(dec, data->os_audio.body_fill -
+					      data->os_audio.body_returned);
+		if (ret != MUX_OK)
+			return ret;
+	}
+	if (data->have_side_stream) {
+		ret = mux_decoder_check_frame(dec, data->os_side.body_fill -
+					      data->os_side.body_returned);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
 	*input_consumed = input_size;
 	return MUX_OK;
 }
@@ -889,6 +1003,892 @@ static int mux_opus_decoder_finalize(struct mux_decoder *dec)
 	return MUX_OK;
 }
 
+/*
+ * Snapshot helpers
+ *
+ * libopus states are flat blobs except for pointers into the library's
+ * own constant tables (CELT mode, SILK codebooks), at offsets libopus
+ * doesn't publish. The image is saved with an address inside libopus
+ * and the offsets of the words that point into it; restore moves those
+ * words by as far as the library has moved, so a session continues in
+ * another process or on another host with the same libopus build.
+ * Without dladdr() pointers can't be told from data, and the library
+ * has to be at the same address.
+ */
+struct opus_image {
+	const uint8_t *data;
+	size_t size;
+	uint64_t anchor;
+	const uint8_t *offsets;         /* uint32_t each, unaligned */
+	size_t num_offsets;
+};
+
+/* A constant inside libopus; a function address may be a PLT stub */
+static uint64_t opus_anchor(void)
+{
+	return (uint64_t)(uintptr_t)opus_get_version_string();
+}
+
+/* Load address of libopus, NULL where it can't be found */
+static const void *opus_base(void)
+{
+#ifdef MUX_HAVE_DLADDR
+	Dl_info info;
+
+	if (dladdr((const void *)(uintptr_t)opus_anchor(), &info))
+		return info.dli_fbase;
+#endif
+	return NULL;
+}
+
+/* Whether an image word is an address inside libopus */
+static int opus_pointer(const void *base, uintptr_t value)
+{
+#ifdef MUX_HAVE_DLADDR
+	Dl_info info;
+
+	/* Rules out small integers without asking the dynamic linker */
+	if (!base || value < (uintptr_t)base)
+		return 0;
+	return dladdr((const void *)value, &info) && info.dli_fbase == base;
+#else
+	(void)base;
+	(void)value;
+	return 0;
+#endif
+}
+
+static int put_opus_image(struct mux_buffer *blob, const void *state,
+			  size_t size)
+{
+	const char *version = opus_get_version_string();
+	const void *base = opus_base();
+	const uint8_t *p = state;
+	uintptr_t value;
+	uint32_t count = 0, off;
+	size_t i;
+	int ret;
+
+	for (i = 0; i + sizeof(value) <= size; i += sizeof(value)) {
+		memcpy(&value, p + i, sizeof(value));
+		count += opus_pointer(base, value);
+	}
+
+	ret = mux_snap_put_bytes(blob, version, strlen(version));
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u64(blob, opus_anchor());
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u32(blob, count);
+	for (i = 0; ret == MUX_OK && i + sizeof(value) <= size;
+	     i += sizeof(value)) {
+		memcpy(&value, p + i, sizeof(value));
+		off = (uint32_t)i;
+		if (opus_pointer(base, value))
+			ret = mux_snap_put(blob, &off, sizeof(off));
+	}
+	if (ret == MUX_OK)
+		ret = mux_snap_put_bytes(blob, state, size);
+
+	return ret;
+}
+
+static int get_opus_image(struct mux_snap_reader *r, struct opus_image *img,
+			  size_t state_size)
+{
+	const char *version = opus_get_version_string();
+	const uint8_t *saved;
+	uint32_t count, off, prev = 0;
+	size_t saved_size, i;
+	int ret;
+
+	ret = mux_snap_get_bytes(r, &saved, &saved_size);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u64(r, &img->anchor);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u32(r, &count);
+	if (ret != MUX_OK)
+		return ret;
+
+	if (count > state_size / sizeof(uintptr_t) ||
+	    r->size - r->pos < (size_t)count * sizeof(off))
+		return MUX_ERROR_FORMAT;
+	img->offsets = r->data + r->pos;
+	img->num_offsets = count;
+	r->pos += (size_t)count * sizeof(off);
+
+	ret = mux_snap_get_bytes(r, &img->data, &img->size);
+	if (ret != MUX_OK)
+		return ret;
+	if (img->size != state_size)
+		return MUX_ERROR_FORMAT;
+
+	/* Aligned words inside the image, in order */
+	for (i = 0; i < count; i++) {
+		memcpy(&off, img->offsets + i * sizeof(off), sizeof(off));
+		if (off % sizeof(uintptr_t) != 0 ||
+		    (size_t)off + sizeof(uintptr_t) > state_size ||
+		    (i > 0 && off <= prev))
+			return MUX_ERROR_FORMAT;
+		prev = off;
+	}
+
+	/* Table layout and pointer slots are only known for the same build */
+	if (saved_size != strlen(version) ||
+	    memcmp(saved, version, saved_size) != 0)
+		return MUX_ERROR_UNSUPPORTED;
+#ifndef MUX_HAVE_DLADDR
+	if (img->anchor != opus_anchor())
+		return MUX_ERROR_UNSUPPORTED;
+#endif
+	return MUX_OK;
+}
+
+/* Copy the image into a live state, moving its libopus pointers */
+static void load_opus_image(void *state, const struct opus_image *img)
+{
+	uintptr_t delta = (uintptr_t)(opus_anchor() - img->anchor);
+	uint8_t *p = state;
+	uintptr_t value;
+	uint32_t off;
+	size_t i;
+
+	memcpy(state, img->data, img->size);
+	for (i = 0; i < img->num_offsets; i++) {
+		memcpy(&off, img->offsets + i * sizeof(off), sizeof(off));
+		memcpy(&value, p + off, sizeof(value));
+		value += delta;
+		memcpy(p + off, &value, sizeof(value));
+	}
+}
+
+/*
+ * Save the pending (not yet paged out) contents of an OGG stream
+ */
+static int snap_ogg_stream(struct mux_buffer *blob, const ogg_stream_state *os)
+{
+	long lacing = os->lacing_fill - os->lacing_returned;
+	int ret;
+
+	ret = mux_snap_put_u64(blob, (uint64_t)os->serialno);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u64(blob, (uint64_t)os->pageno);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u64(blob, (uint64_t)os->packetno);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u64(blob, (uint64_t)os->granulepos);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u32(blob, (uint32_t)os->b_o_s);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u32(blob, (uint32_t)os->e_o_s);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u64(blob, (uint64_t)(os->lacing_packet -
+							os->lacing_returned));
+	if (ret == MUX_OK)
+		ret = mux_snap_put_bytes(blob, os->body_data + os->body_returned,
+					 os->body_fill - os->body_returned);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_bytes(blob, os->lacing_vals + os->lacing_returned,
+					 lacing * sizeof(*os->lacing_vals));
+	if (ret == MUX_OK)
+		ret = mux_snap_put_bytes(blob, os->granule_vals + os->lacing_returned,
+					 lacing * sizeof(*os->granule_vals));
+
+	return ret;
+}
+
+/* An OGG stream as saved by snap_ogg_stream(), checked but not applied */
+struct ogg_snap {
+	uint64_t serialno, pageno, packetno, granulepos, lacing_packet;
+	uint32_t b_o_s, e_o_s;
+	const uint8_t *body, *lacing_vals, *granule_vals;
+	size_t body_size, lacing_size, granule_size;
+};
+
+static int get_ogg_stream(struct mux_snap_reader *r, struct ogg_snap *snap)
+{
+	int ret;
+
+	ret = mux_snap_get_u64(r, &snap->serialno);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u64(r, &snap->pageno);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u64(r, &snap->packetno);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u64(r, &snap->granulepos);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u32(r, &snap->b_o_s);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u32(r, &snap->e_o_s);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u64(r, &snap->lacing_packet);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_bytes(r, &snap->body, &snap->body_size);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_bytes(r, &snap->lacing_vals, &snap->lacing_size);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_bytes(r, &snap->granule_vals, &snap->granule_size);
+	if (ret != MUX_OK)
+		return ret;
+
+	if (snap->lacing_size % sizeof(int) != 0 ||
+	    snap->granule_size != snap->lacing_size / sizeof(int) *
+				  sizeof(ogg_int64_t) ||
+	    snap->lacing_packet > snap->lacing_size / sizeof(int))
+		return MUX_ERROR_FORMAT;
+
+	return MUX_OK;
+}
+
+/*
+ * Build a fresh OGG stream from a checked snapshot. libogg grows its
+ * buffers with realloc(), so the storage is allocated the same way.
+ */
+static int build_ogg_stream(ogg_stream_state *os, const struct ogg_snap *snap)
+{
+	long lacing = (long)(snap->lacing_size / sizeof(*os->lacing_vals));
+
+	if (ogg_stream_init(os, (int)snap->serialno) != 0)
+		return MUX_ERROR_INIT;
+
+	if ((long)snap->body_size > os->body_storage) {
+		unsigned char *p = realloc(os->body_data, snap->body_size);
+
+		if (!p)
+			goto nomem;
+		os->body_data = p;
+		os->body_storage = (long)snap->body_size;
+	}
+
+	if (lacing > os->lacing_storage) {
+		int *vals = realloc(os->lacing_vals, snap->lacing_size);
+		ogg_int64_t *granules;
+
+		if (!vals)
+			goto nomem;
+		os->lacing_vals = vals;
+
+		granules = realloc(os->granule_vals, snap->granule_size);
+		if (!granules)
+			goto nomem;
+		os->granule_vals = granules;
+		os->lacing_storage = lacing;
+	}
+
+	if (snap->body_size > 0)
+		memcpy(os->body_data, snap->body, snap->body_size);
+	if (lacing > 0) {
+		memcpy(os->lacing_vals, snap->lacing_vals, snap->lacing_size);
+		memcpy(os->granule_vals, snap->granule_vals, snap->granule_size);
+	}
+
+	os->body_fill = (long)snap->body_size;
+	os->lacing_fill = lacing;
+	os->lacing_packet = (long)snap->lacing_packet;
+	os->pageno = (long)snap->pageno;
+	os->packetno = (ogg_int64_t)snap->packetno;
+	os->granulepos = (ogg_int64_t)snap->granulepos;
+	os->b_o_s = (int)snap->b_o_s;
+	os->e_o_s = (int)snap->e_o_s;
+
+	return MUX_OK;
+
+nomem:
+	ogg_stream_clear(os);
+	return MUX_ERROR_NOMEM;
+}
+
+/*
+ * Rebuild a cleared OGG stream from parked snapshot data
+ */
+static int restore_ogg_stream(struct mux_snap_reader *r, ogg_stream_state *os)
+{
+	struct ogg_snap snap;
+	int ret;
+
+	ret = get_ogg_stream(r, &snap);
+	if (ret != MUX_OK)
+		return ret;
+
+	return build_ogg_stream(os, &snap);
+}
+
+/*
+ * Opus encoder snapshot
+ */
+static int mux_opus_encoder_snapshot(struct mux_encoder *enc,
+				     struct mux_buffer *blob)
+{
+	struct opus_encoder_data *data = enc->codec_data;
+	int ret;
+
+	ret = put_opus_image(blob, data->enc,
+			     opus_encoder_get_size(data->num_channels));
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u64(blob, (uint64_t)data->packet_count);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u64(blob, (uint64_t)data->granule_pos);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u32(blob, data->headers_written);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u32(blob, data->have_side_stream);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_bytes(blob, data->pending,
+					 data->pending_samples *
+					 data->num_channels * sizeof(int16_t));
+	if (ret == MUX_OK)
+		ret = snap_ogg_stream(blob, &data->os_audio);
+	if (ret == MUX_OK && data->have_side_stream)
+		ret = snap_ogg_stream(blob, &data->os_side);
+
+	return ret;
+}
+
+/*
+ * Opus encoder restore. Everything is checked and built aside before
+ * the encoder is touched, so a bad snapshot leaves it as it was.
+ */
+static int mux_opus_encoder_restore(struct mux_encoder *enc,
+				    struct mux_snap_reader *r)
+{
+	struct opus_encoder_data *data = enc->codec_data;
+	size_t frame_bytes = data->num_channels * sizeof(int16_t);
+	size_t state_size = opus_encoder_get_size(data->num_channels);
+	struct ogg_snap audio, side;
+	ogg_stream_state os_audio, os_side;
+	uint64_t packet_count, granule_pos;
+	uint32_t headers_written, have_side_stream;
+	struct opus_image image;
+	const uint8_t *pending;
+	size_t pending_size;
+	int ret;
+
+	ret = get_opus_image(r, &image, state_size);
+	if (ret == MUX_ERROR_UNSUPPORTED)
+		mux_encoder_set_error(enc, ret,
+				      "Opus snapshot was taken with another libopus build",
+				      NULL, 0, NULL);
+	if (ret != MUX_OK)
+		return ret;
+
+	ret = mux_snap_get_u64(r, &packet_count);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u64(r, &granule_pos);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u32(r, &headers_written);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u32(r, &have_side_stream);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_bytes(r, &pending, &pending_size);
+	if (ret == MUX_OK)
+		ret = get_ogg_stream(r, &audio);
+	if (ret == MUX_OK && have_side_stream)
+		ret = get_ogg_stream(r, &side);
+	if (ret == MUX_OK)
+		ret = mux_snap_end(r);
+	if (ret != MUX_OK)
+		return ret;
+
+	if (pending_size % frame_bytes != 0)
+		return MUX_ERROR_FORMAT;
+
+	/* A larger pending buffer is harmless if the rest fails */
+	if (pending_size / frame_bytes > data->pending_capacity) {
+		int16_t *p = realloc(data->pending, pending_size);
+
+		if (!p)
+			return MUX_ERROR_NOMEM;
+		data->pending = p;
+		data->pending_capacity = pending_size / frame_bytes;
+	}
+
+	ret = build_ogg_stream(&os_audio, &audio);
+	if (ret == MUX_OK && have_side_stream) {
+		ret = build_ogg_stream(&os_side, &side);
+		if (ret != MUX_OK)
+			ogg_stream_clear(&os_audio);
+	}
+	if (ret != MUX_OK)
+		return ret;
+
+	/* Commit */
+	load_opus_image(data->enc, &image);
+	if (pending_size > 0)
+		memcpy(data->pending, pending, pending_size);
+	data->pending_samples = pending_size / frame_bytes;
+
+	data->packet_count = (int64_t)packet_count;
+	data->granule_pos = (int64_t)granule_pos;
+	data->headers_written = (int)headers_written;
+
+	ogg_stream_clear(&data->os_audio);
+	data->os_audio = os_audio;
+	if (data->have_side_stream)
+		ogg_stream_clear(&data->os_side);
+	if (have_side_stream)
+		data->os_side = os_side;
+	data->have_side_stream = have_side_stream != 0;
+
+	return MUX_OK;
+}
+
+/*
+ * Opus decoder snapshot
+ */
+static int mux_opus_decoder_snapshot(struct mux_decoder *dec,
+				     struct mux_buffer *blob)
+{
+	struct opus_decoder_data *data = dec->codec_data;
+	int ret;
+
+	ret = mux_snap_put_u32(blob, data->have_audio_stream);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u32(blob, data->have_side_stream);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u32(blob, data->decoder_inited);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u32(blob, data->sample_rate);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u32(blob, data->num_channels);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_bytes(blob, &data->reduce, sizeof(data->reduce));
+	if (ret == MUX_OK && data->decoder_inited)
+		ret = put_opus_image(blob, data->dec,
+				     opus_decoder_get_size(data->num_channels));
+
+	/* Bytes the sync layer holds but hasn't turned into pages yet */
+	if (ret == MUX_OK)
+		ret = mux_snap_put_bytes(blob, data->oy.data + data->oy.returned,
+					 data->oy.fill - data->oy.returned);
+	if (ret == MUX_OK && data->have_audio_stream)
+		ret = snap_ogg_stream(blob, &data->os_audio);
+	if (ret == MUX_OK && data->have_side_stream)
+		ret = snap_ogg_stream(blob, &data->os_side);
+
+	return ret;
+}
+
+/*
+ * Opus decoder restore, checked and built aside like the encoder's
+ */
+static int mux_opus_decoder_restore(struct mux_decoder *dec,
+				    struct mux_snap_reader *r)
+{
+	struct opus_decoder_data *data = dec->codec_data;
+	uint32_t have_audio_stream, have_side_stream, decoder_inited;
+	uint32_t sample_rate, num_channels;
+	struct opus_image image;
+	const uint8_t *sync_data, *reduce;
+	size_t sync_size, reduce_size;
+	struct ogg_snap audio, side;
+	ogg_stream_state os_audio, os_side;
+	ogg_sync_state oy;
+	OpusDecoder *od = NULL;
+	char *buffer;
+	int ret;
+
+	ret = mux_snap_get_u32(r, &have_audio_stream);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u32(r, &have_side_stream);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u32(r, &decoder_inited);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u32(r, &sample_rate);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_u32(r, &num_channels);
+	if (ret == MUX_OK)
+		ret = mux_snap_get_bytes(r, &reduce, &reduce_size);
+	if (ret != MUX_OK)
+		return ret;
+
+	if (reduce_size != sizeof(data->reduce) ||
+	    (decoder_inited && num_channels != 1 && num_channels != 2))
+		return MUX_ERROR_FORMAT;
+
+	if (decoder_inited) {
+		ret = get_opus_image(r, &image,
+				     opus_decoder_get_size((int)num_channels));
+		if (ret == MUX_ERROR_UNSUPPORTED)
+			mux_decoder_set_error(dec, ret,
+					      "Opus snapshot was taken with another libopus build",
+					      NULL, 0, NULL);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	ret = mux_snap_get_bytes(r, &sync_data, &sync_size);
+	if (ret == MUX_OK && have_audio_stream)
+		ret = get_ogg_stream(r, &audio);
+	if (ret == MUX_OK && have_side_stream)
+		ret = get_ogg_stream(r, &side);
+	if (ret == MUX_OK)
+		ret = mux_snap_end(r);
+	if (ret != MUX_OK)
+		return ret;
+
+	if (decoder_inited) {
+		int opus_error;
+
+		od = opus_decoder_create((opus_int32)sample_rate,
+					 (int)num_channels, &opus_error);
+		if (!od || opus_error != OPUS_OK) {
+			mux_decoder_set_error(dec, MUX_ERROR_INIT,
+					      "opus_decoder_create failed",
+					      "libopus", opus_error,
+					      opus_strerror(opus_error));
+			return MUX_ERROR_INIT;
+		}
+		load_opus_image(od, &image);
+	}
+
+	ogg_sync_init(&oy);
+	if (sync_size > 0) {
+		buffer = ogg_sync_buffer(&oy, (long)sync_size);
+		if (!buffer) {
+			ret = MUX_ERROR_NOMEM;
+			goto fail_sync;
+		}
+		memcpy(buffer, sync_data, sync_size);
+		ogg_sync_wrote(&oy, (long)sync_size);
+	}
+
+	if (have_audio_stream) {
+		ret = build_ogg_stream(&os_audio, &audio);
+		if (ret != MUX_OK)
+			goto fail_sync;
+	}
+	if (have_side_stream) {
+		ret = build_ogg_stream(&os_side, &side);
+		if (ret != MUX_OK)
+			goto fail_audio;
+	}
+
+	/* Commit */
+	memcpy(&data->reduce, reduce, reduce_size);
+	if (data->decoder_inited)
+		opus_decoder_destroy(data->dec);
+	data->dec = od;
+	data->decoder_inited = od != NULL;
+	data->sample_rate = (int)sample_rate;
+	data->num_channels = (int)num_channels;
+
+	ogg_sync_clear(&data->oy);
+	data->oy = oy;
+
+	if (data->have_audio_stream)
+		ogg_stream_clear(&data->os_audio);
+	if (have_audio_stream)
+		data->os_audio = os_audio;
+	data->have_audio_stream = have_audio_stream != 0;
+
+	if (data->have_side_stream)
+		ogg_stream_clear(&data->os_side);
+	if (have_side_stream)
+		data->os_side = os_side;
+	data->have_side_stream = have_side_stream != 0;
+
+	return MUX_OK;
+
+fail_audio:
+	if (have_audio_stream)
+		ogg_stream_clear(&os_audio);
+fail_sync:
+	ogg_sync_clear(&oy);
+	if (od)
+		opus_decoder_destroy(od);
+	return ret;
+}
+
+static size_t ogg_stream_memory(const ogg_stream_state *os)
+{
+	return (size_t)os->body_storage +
+	       (size_t)os->lacing_storage *
+	       (sizeof(*os->lacing_vals) + sizeof(*os->granule_vals));
+}
+
+/*
+ * Opus encoder memory release. Each Ogg stream keeps ~28 KiB of body
+ * and lacing storage however little is pending, so hibernation parks
+ * the pending part with the snapshot helpers and frees the rest.
+ */
+static int mux_opus_encoder_trim(struct mux_encoder *enc, int hibernate)
+{
+	struct opus_encoder_data *data = enc->codec_data;
+	size_t frame_bytes = data->num_channels * sizeof(int16_t);
+	int ret;
+
+	/* The carry-over is less than a frame; give back the rest */
+	if (data->pending_samples == 0) {
+		free(data->pending);
+		data->pending = NULL;
+		data->pending_capacity = 0;
+	} else if (data->pending_samples < data->pending_capacity) {
+		int16_t *p = realloc(data->pending,
+				     data->pending_samples * frame_bytes);
+
+		if (p) {
+			data->pending = p;
+			data->pending_capacity = data->pending_samples;
+		}
+	}
+
+	if (!hibernate)
+		return MUX_OK;
+
+	mux_buffer_clear(&data->parked);
+	ret = snap_ogg_stream(&data->parked, &data->os_audio);
+	if (ret == MUX_OK && data->have_side_stream)
+		ret = snap_ogg_stream(&data->parked, &data->os_side);
+	if (ret != MUX_OK) {
+		mux_buffer_deinit(&data->parked);
+		return ret;
+	}
+	mux_buffer_shrink(&data->parked);
+
+	ogg_stream_clear(&data->os_audio);
+	if (data->have_side_stream)
+		ogg_stream_clear(&data->os_side);
+
+	return MUX_OK;
+}
+
+static int mux_opus_encoder_wake(struct mux_encoder *enc)
+{
+	struct opus_encoder_data *data = enc->codec_data;
+	struct mux_snap_reader r = { data->parked.data, data->parked.size, 0 };
+	int ret;
+
+	ret = restore_ogg_stream(&r, &data->os_audio);
+	if (ret != MUX_OK)
+		return ret;
+
+	if (data->have_side_stream) {
+		ret = restore_ogg_stream(&r, &data->os_side);
+		if (ret != MUX_OK) {
+			ogg_stream_clear(&data->os_audio);
+			return ret;
+		}
+	}
+
+	mux_buffer_deinit(&data->parked);
+	return MUX_OK;
+}
+
+static size_t mux_opus_encoder_memory(const struct mux_encoder *enc)
+{
+	const struct opus_encoder_data *data = enc->codec_data;
+	size_t bytes;
+
+	bytes = sizeof(*data) + data->parked.capacity +
+		data->pending_capacity * data->num_channels * sizeof(int16_t) +
+		ogg_stream_memory(&data->os_audio);
+	if (data->enc)
+		bytes += (size_t)opus_encoder_get_size(data->num_channels);
+	if (data->have_side_stream)
+		bytes += ogg_stream_memory(&data->os_side);
+
+	return bytes;
+}
+
+/*
+ * Opus decoder memory release: the sync buffer and stream storage are
+ * parked the same way as for a snapshot; the libopus state stays.
+ */
+static int mux_opus_decoder_trim(struct mux_decoder *dec, int hibernate)
+{
+	struct opus_decoder_data *data = dec->codec_data;
+	int ret;
+
+	if (!hibernate)
+		return MUX_OK;
+
+	mux_buffer_clear(&data->parked);
+	ret = mux_snap_put_bytes(&data->parked, data->oy.data + data->oy.returned,
+				 data->oy.fill - data->oy.returned);
+	if (ret == MUX_OK && data->have_audio_stream)
+		ret = snap_ogg_stream(&data->parked, &data->os_audio);
+	if (ret == MUX_OK && data->have_side_stream)
+		ret = snap_ogg_stream(&data->parked, &data->os_side);
+	if (ret != MUX_OK) {
+		mux_buffer_deinit(&data->parked);
+		return ret;
+	}
+	mux_buffer_shrink(&data->parked);
+
+	ogg_sync_clear(&data->oy);
+	if (data->have_audio_stream)
+		ogg_stream_clear(&data->os_audio);
+	if (data->have_side_stream)
+		ogg_stream_clear(&data->os_side);
+
+	return MUX_OK;
+}
+
+static int mux_opus_decoder_wake(struct mux_decoder *dec)
+{
+	struct opus_decoder_data *data = dec->codec_data;
+	struct mux_snap_reader r = { data->parked.data, data->parked.size, 0 };
+	const uint8_t *sync_data;
+	size_t sync_size;
+	char *buffer;
+	int ret;
+
+	ret = mux_snap_get_bytes(&r, &sync_data, &sync_size);
+	if (ret != MUX_OK)
+		return ret;
+
+	ogg_sync_init(&data->oy);
+	if (sync_size > 0) {
+		buffer = ogg_sync_buffer(&data->oy, (long)sync_size);
+		if (!buffer) {
+			ret = MUX_ERROR_NOMEM;
+			goto fail;
+		}
+		memcpy(buffer, sync_data, sync_size);
+		ogg_sync_wrote(&data->oy, (long)sync_size);
+	}
+
+	if (data->have_audio_stream) {
+		ret = restore_ogg_stream(&r, &data->os_audio);
+		if (ret != MUX_OK)
+			goto fail;
+	}
+
+	if (data->have_side_stream) {
+		ret = restore_ogg_stream(&r, &data->os_side);
+		if (ret != MUX_OK) {
+			if (data->have_audio_stream)
+				ogg_stream_clear(&data->os_audio);
+			goto fail;
+		}
+	}
+
+	mux_buffer_deinit(&data->parked);
+	return MUX_OK;
+
+fail:
+	ogg_sync_clear(&data->oy);
+	return ret;
+}
+
+static size_t mux_opus_decoder_memory(const struct mux_decoder *dec)
+{
+	const struct opus_decoder_data *data = dec->codec_data;
+	size_t bytes;
+
+	bytes = sizeof(*data) + data->parked.capacity +
+		(size_t)data->oy.storage;
+	if (data->decoder_inited)
+		bytes += (size_t)opus_decoder_get_size(data->num_channels);
+	if (data->have_audio_stream)
+		bytes += ogg_stream_memory(&data->os_audio);
+	if (data->have_side_stream)
+		bytes += ogg_stream_memory(&data->os_side);
+
+	return bytes;
+}
+
+/*
+ * Opus live bitrate change
+ */
+static int mux_opus_encoder_set_bitrate(struct mux_encoder *enc, int bps,
+					int *applied)
+{
+	struct opus_encoder_data *data = enc->codec_data;
+	opus_int32 bitrate = 0;
+
+	if (bps > 0 && opus_encoder_ctl(data->enc,
+					OPUS_SET_BITRATE(bps)) != OPUS_OK)
+		return MUX_ERROR_INVAL;
+
+	opus_encoder_ctl(data->enc, OPUS_GET_BITRATE(&bitrate));
+	*applied = bitrate;
+	return MUX_OK;
+}
+
+/*
+ * Opus load shedding: complexity maps straight onto OPUS_SET_COMPLEXITY
+ */
+static int mux_opus_encoder_set_complexity(struct mux_encoder *enc, int level,
+					   int *applied)
+{
+	struct opus_encoder_data *data = enc->codec_data;
+	opus_int32 complexity = 0;
+
+	if (level >= 0 && opus_encoder_ctl(data->enc,
+					   OPUS_SET_COMPLEXITY(level)) != OPUS_OK)
+		return MUX_ERROR_INVAL;
+
+	opus_encoder_ctl(data->enc, OPUS_GET_COMPLEXITY(&complexity));
+	*applied = complexity;
+	return MUX_OK;
+}
+
+static int mux_opus_encoder_set_dtx(struct mux_encoder *enc, int on)
+{
+	struct opus_encoder_data *data = enc->codec_data;
+
+	if (opus_encoder_ctl(data->enc, OPUS_SET_DTX(on ? 1 : 0)) != OPUS_OK)
+		return MUX_ERROR_INVAL;
+	return MUX_OK;
+}
+
+/*
+ * Opus splice: a cached packet goes on the audio stream as if just
+ * encoded, with the next packet number and its duration added to the
+ * granule position. Opus packets carry their own mode and size, so
+ * any clip of the same rate and channel count fits.
+ */
+static int is_opus_header(const uint8_t *packet, size_t size)
+{
+	return size >= 8 && (memcmp(packet, "OpusHead", 8) == 0 ||
+			     memcmp(packet, "OpusTags", 8) == 0);
+}
+
+static int mux_opus_encoder_splice_check(struct mux_encoder *enc,
+					 const uint8_t *packet, size_t size)
+{
+	struct opus_encoder_data *data = enc->codec_data;
+
+	if (is_opus_header(packet, size) ||
+	    opus_packet_get_nb_samples(packet, (opus_int32)size,
+				       data->sample_rate) > 0)
+		return MUX_OK;
+	return MUX_ERROR_FORMAT;
+}
+
+static int mux_opus_encoder_splice(struct mux_encoder *enc,
+				   const uint8_t *packet, size_t size)
+{
+	struct opus_encoder_data *data = enc->codec_data;
+	ogg_packet op;
+	int samples, ret;
+
+	/* The clip's own OpusHead and OpusTags */
+	if (is_opus_header(packet, size))
+		return MUX_OK;
+
+	samples = opus_packet_get_nb_samples(packet, (opus_int32)size,
+					     data->sample_rate);
+	if (samples <= 0)
+		return MUX_ERROR_FORMAT;
+
+	ret = encode_pending_padded(data);
+	if (ret != MUX_OK)
+		return ret;
+
+	memset(&op, 0, sizeof(op));
+	op.packet = (unsigned char *)packet;
+	op.bytes = (long)size;
+	data->granule_pos += samples;
+	op.granulepos = data->granule_pos;
+	op.packetno = data->packet_count++;
+	ogg_stream_packetin(&data->os_audio, &op);
+
+	if (enc->rate)
+		return flush_ogg_stream(&enc->output, &data->os_audio);
+	return pageout_ogg_stream(&enc->output, &data->os_audio);
+}
+
 /*
  * Opus codec operations
  */
@@ -905,10 +1905,28 @@ const struct mux_codec_ops mux_codec_opus_ops = {
 	.decoder_read = mux_opus_decoder_read,
 	.decoder_finalize = mux_opus_decoder_finalize,
 
+	.encoder_snapshot = mux_opus_encoder_snapshot,
+	.encoder_restore = mux_opus_encoder_restore,
+	.decoder_snapshot = mux_opus_decoder_snapshot,
+	.decoder_restore = mux_opus_decoder_restore,
+
+	.encoder_trim = mux_opus_encoder_trim,
+	.encoder_wake = mux_opus_encoder_wake,
+	.encoder_memory = mux_opus_encoder_memory,
+	.decoder_trim = mux_opus_decoder_trim,
+	.decoder_wake = mux_opus_decoder_wake,
+	.decoder_memory = mux_opus_decoder_memory,
+
+	.encoder_set_bitrate = mux_opus_encoder_set_bitrate,
+	.encoder_splice = mux_opus_encoder_splice,
+	.encoder_splice_check = mux_opus_encoder_splice_check,
+	.encoder_set_complexity = mux_opus_encoder_set_complexity,
+	.encoder_set_dtx = mux_opus_encoder_set_dtx,
+
 	.encoder_params = opus_encoder_params,
 	.encoder_param_count = sizeof(opus_encoder_params) / sizeof(opus_encoder_params[0]),
-	.decoder_params = NULL,
-	.decoder_param_count = 0,
+	.decoder_params = mux_reduce_decoder_params,
+	.decoder_param_count = MUX_REDUCE_PARAM_COUNT,
 
 	.supported_sample_rates = opus_sample_rates,
 	.sample_rate_count = sizeof(opus_sample_rates) / sizeof(opus_sample_rates[0]),
@@ -107,6 +107,32 @@ static int pcm_encoder_finalize(struct mux_encoder *enc)
 	return MUX_OK;
 }
 
+/*
+ * PCM encoder splice
+ * Every whole sample frame is a frame boundary, so cached payloads go
+ * straight out
+ */
+static int pcm_encoder_splice_check(struct mux_encoder *enc,
+				    const uint8_t *packet, size_t size)
+{
+	(void)packet;
+	if (size % ((size_t)enc->num_channels * sizeof(int16_t)) != 0)
+		return MUX_ERROR_FORMAT;
+	return MUX_OK;
+}
+
+static int pcm_encoder_splice(struct mux_encoder *enc, const uint8_t *packet,
+			      size_t size)
+{
+	int ret = pcm_encoder_splice_check(enc, packet, size);
+
+	if (ret != MUX_OK)
+		return ret;
+
+	return mux_leb128_write_frame(&enc->output, packet, size,
+				      MUX_STREAM_AUDIO, enc->num_streams);
+}
+
 /*
  * PCM decoder initialization
  */
@@ -178,19 +204,18 @@ static int pcm_decoder_decode(struct mux_decoder *dec,
 		return MUX_ERROR_NOMEM;
 
 	/* Add input to buffer */
-	ret = mux_buffer_write(&data->input_buf, input, input_size);
+	ret = mux_decoder_buffer_input(dec, &data->input_buf, input, input_size,
+				       &consumed);
 	if (ret != MUX_OK) {
 		free(frame_buf);
 		return ret;
 	}
 
-	consumed = input_size;
-
 	/* Try to read frames from input buffer */
 	while (1) {
-		ret = mux_leb128_read_frame(&data->input_buf,
-					    frame_buf, frame_buf_capacity,
-					    &frame_size, &stream_type, dec->num_streams);
+		ret = mux_decoder_read_frame(dec, &data->input_buf,
+					     frame_buf, frame_buf_capacity,
+					     &frame_size, &stream_type);
 		if (ret == MUX_ERROR_INVAL && frame_size > frame_buf_capacity) {
 			/* Frame too large, reallocate buffer */
 			uint8_t *new_buf = realloc(frame_buf, frame_size);
@@ -202,9 +227,9 @@ static int pcm_decoder_decode(struct mux_decoder *dec,
 			frame_buf_capacity = frame_size;
 
 			/* Try again */
-			ret = mux_leb128_read_frame(&data->input_buf,
-						    frame_buf, frame_buf_capacity,
-						    &frame_size, &stream_type, dec->num_streams);
+			ret = mux_decoder_read_frame(dec, &data->input_buf,
+						     frame_buf, frame_buf_capacity,
+						     &frame_size, &stream_type);
 		}
 
 		if (ret != MUX_OK) {
@@ -290,6 +315,70 @@ static int pcm_decoder_finalize(struct mux_decoder *dec)
 	return MUX_OK;
 }
 
+/*
+ * PCM snapshot/restore
+ * The encoder is stateless; the decoder only holds unparsed input
+ */
+static int pcm_encoder_snapshot(struct mux_encoder *enc,
+				struct mux_buffer *blob)
+{
+	(void)enc;
+	(void)blob;
+	return MUX_OK;
+}
+
+static int pcm_encoder_restore(struct mux_encoder *enc,
+			       struct mux_snap_reader *r)
+{
+	(void)enc;
+	(void)r;
+	return MUX_OK;
+}
+
+static int pcm_decoder_snapshot(struct mux_decoder *dec,
+				struct mux_buffer *blob)
+{
+	struct pcm_codec_data *data = dec->codec_data;
+
+	return mux_snap_put_buffer(blob, &data->input_buf);
+}
+
+static int pcm_decoder_restore(struct mux_decoder *dec,
+			       struct mux_snap_reader *r)
+{
+	struct pcm_codec_data *data = dec->codec_data;
+	const uint8_t *input;
+	size_t size;
+	int ret;
+
+	ret = mux_snap_stage_buffer(r, &data->input_buf, &input, &size);
+	if (ret == MUX_OK)
+		ret = mux_snap_end(r);
+	if (ret == MUX_OK)
+		mux_snap_commit_buffer(&data->input_buf, input, size);
+
+	return ret;
+}
+
+/*
+ * PCM memory release: only the demux input buffer is reclaimable
+ */
+static int pcm_decoder_trim(struct mux_decoder *dec, int hibernate)
+{
+	struct pcm_codec_data *data = dec->codec_data;
+
+	(void)hibernate;
+	mux_buffer_shrink(&data->input_buf);
+	return MUX_OK;
+}
+
+static size_t pcm_decoder_memory(const struct mux_decoder *dec)
+{
+	const struct pcm_codec_data *data = dec->codec_data;
+
+	return sizeof(*data) + data->input_buf.capacity;
+}
+
 /*
  * PCM sample rate constraints (supports any rate)
  */
@@ -311,6 +400,17 @@ const struct mux_codec_ops mux_codec_pcm_ops = {
 	.decoder_read = pcm_decoder_read,
 	.decoder_finalize = pcm_decoder_finalize,
 
+	.encoder_snapshot = pcm_encoder_snapshot,
+	.encoder_restore = pcm_encoder_restore,
+	.decoder_snapshot = pcm_decoder_snapshot,
+	.decoder_restore = pcm_decoder_restore,
+
+	.decoder_trim = pcm_decoder_trim,
+	.decoder_memory = pcm_decoder_memory,
+
+	.encoder_splice = pcm_encoder_splice,
+	.encoder_splice_check = pcm_encoder_splice_check,
+
 	.encoder_params = NULL,
 	.encoder_param_count = 0,
 	.decoder_params = NULL,
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "mux.h"
 #include "mux_internal.h"
+#include "mux_trace.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -29,6 +30,19 @@ struct vorbis_encoder_data {
 	/* Sample rate and channels (needed for vorbis_analysis) */
 	int sample_rate;
 	int num_channels;
+
+	/*
+	 * Splicing: the audio stream as written, so that clip packets and
+	 * a restarted analysis continue its numbering and granules
+	 */
+	uint32_t ident_hash;           /* identification header */
+	uint32_t setup_hash;           /* setup header (codebooks) */
+	int drained;                   /* analysis ended ahead of a clip */
+	int restarted;                 /* next live packet follows a clip */
+	int64_t packetno;              /* next audio packet number */
+	int64_t granule_pos;           /* last granule position written */
+	int64_t granule_offset;        /* added to the analysis' own */
+	long last_blocksize;
 };
 
 /*
@@ -52,6 +66,9 @@ struct vorbis_decoder_data {
 
 	/* Track decoder initialization */
 	int decoder_inited;
+
+	/* Optional monitoring downmix/decimation */
+	struct mux_pcm_reducer reduce;
 };
 
 /*
@@ -88,6 +105,20 @@ static const struct mux_param *find_param(const struct mux_param *params,
 	return NULL;
 }
 
+/*
+ * FNV-1a over a header packet, to tell whether a clip's packets were
+ * made with the same setup
+ */
+static uint32_t header_hash(const ogg_packet *op)
+{
+	uint32_t h = 2166136261u;
+	long i;
+
+	for (i = 0; i < op->bytes; i++)
+		h = (h ^ op->packet[i]) * 16777619u;
+	return h;
+}
+
 /*
  * Helper to write OGG pages to output buffer
  */
@@ -103,6 +134,8 @@ static int write_ogg_page(struct mux_buffer *output, ogg_page *og)
 	if (ret != MUX_OK)
 		return ret;
 
+	MUX_PROBE3(ogg_page_out, ogg_page_serialno(og),
+		   og->header_len + og->body_len, ogg_page_granulepos(og));
 	return MUX_OK;
 }
 
@@ -245,6 +278,9 @@ static int vorbis_encoder_init(struct mux_encoder *enc,
 
 	vorbis_analysis_headerout(&data->vd, &data->vc,
 				  &header, &header_comm, &header_code);
+	data->ident_hash = header_hash(&header);
+	data->setup_hash = header_hash(&header_code);
+	data->packetno = 3;
 
 	ogg_stream_packetin(&data->os_audio, &header);
 	ogg_stream_packetin(&data->os_audio, &header_comm);
@@ -293,6 +329,85 @@ static void vorbis_encoder_deinit(struct mux_encoder *enc)
 	enc->codec_data = NULL;
 }
 
+/*
+ * Queue an audio packet. Positions of analysis output pass through,
+ * offset once a clip has gone before; own_granule counts the
+ * position from block sizes instead, for clip packets and the drained
+ * end of an analysis, as a decoder will see them.
+ */
+static void put_audio_packet(struct vorbis_encoder_data *data,
+			     ogg_packet *op, int own_granule)
+{
+	long bs = vorbis_packet_blocksize(&data->vi, op);
+	int64_t granule = op->granulepos;
+
+	if (own_granule || data->restarted) {
+		if (data->last_blocksize > 0 && bs > 0)
+			data->granule_pos += (data->last_blocksize + bs) / 4;
+		if (data->restarted) {
+			data->granule_offset = data->granule_pos - granule;
+			data->restarted = 0;
+		}
+	} else {
+		data->granule_pos = granule + data->granule_offset;
+	}
+
+	if (bs > 0)
+		data->last_blocksize = bs;
+	op->granulepos = data->granule_pos;
+	op->packetno = data->packetno++;
+	ogg_stream_packetin(&data->os_audio, op);
+}
+
+/*
+ * End the analysis so all audio given so far is out ahead of a clip.
+ * Its padded last block stays in the stream; the next encode starts
+ * a fresh analysis with the same setup.
+ */
+static int drain_analysis(struct mux_encoder *enc,
+			  struct vorbis_encoder_data *data)
+{
+	ogg_packet op;
+
+	if (data->drained)
+		return MUX_OK;
+
+	vorbis_analysis_wrote(&data->vd, 0);
+	while (vorbis_analysis_blockout(&data->vd, &data->vb) == 1) {
+		MUX_PROBE_LIB_ENTRY(MUX_CODEC_VORBIS, "vorbis_analysis");
+		vorbis_analysis(&data->vb, NULL);
+		MUX_PROBE_LIB_RETURN(MUX_CODEC_VORBIS, "vorbis_analysis", 0);
+		vorbis_bitrate_addblock(&data->vb);
+
+		while (vorbis_bitrate_flushpacket(&data->vd, &op)) {
+			op.e_o_s = 0;
+			put_audio_packet(data, &op, 1);
+		}
+	}
+
+	data->drained = 1;
+	return pageout_ogg_stream(&enc->output, &data->os_audio);
+}
+
+static int restart_analysis(struct mux_encoder *enc,
+			    struct vorbis_encoder_data *data)
+{
+	vorbis_block_clear(&data->vb);
+	vorbis_dsp_clear(&data->vd);
+
+	if (vorbis_analysis_init(&data->vd, &data->vi) != 0 ||
+	    vorbis_block_init(&data->vd, &data->vb) != 0) {
+		mux_encoder_set_error(enc, MUX_ERROR_INIT,
+				      "Failed to restart Vorbis analysis",
+				      "libvorbis", 0, NULL);
+		return MUX_ERROR_INIT;
+	}
+
+	data->drained = 0;
+	data->restarted = 1;
+	return MUX_OK;
+}
+
 /*
  * Vorbis encoder encode
  * For audio: compress with Vorbis and write to OGG audio stream
@@ -363,6 +478,12 @@ static int vorbis_encoder_encode(struct mux_encoder *enc,
 	}
 
 	/* Audio data: encode with Vorbis */
+	if (data->drained) {
+		ret = restart_analysis(enc, data);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
 	const int16_t *pcm = input;
 	size_t num_samples = input_size / sizeof(int16_t) / data->num_channels;
 
@@ -381,12 +502,14 @@ static int vorbis_encoder_encode(struct mux_encoder *enc,
 
 	/* Process blocks and write packets */
 	while (vorbis_analysis_blockout(&data->vd, &data->vb) == 1) {
+		MUX_PROBE_LIB_ENTRY(MUX_CODEC_VORBIS, "vorbis_analysis");
 		vorbis_analysis(&data->vb, NULL);
+		MUX_PROBE_LIB_RETURN(MUX_CODEC_VORBIS, "vorbis_analysis", 0);
 		vorbis_bitrate_addblock(&data->vb);
 
 		ogg_packet op;
 		while (vorbis_bitrate_flushpacket(&data->vd, &op)) {
-			ogg_stream_packetin(&data->os_audio, &op);
+			put_audio_packet(data, &op, 0);
 
 			/* Write out any completed pages */
 			ret = pageout_ogg_stream(&enc->output, &data->os_audio);
@@ -441,17 +564,21 @@ static int vorbis_encoder_finalize(struct mux_encoder *enc)
 	if (!data)
 		return MUX_ERROR_INVAL;
 
-	/* Signal end of audio data */
-	vorbis_analysis_wrote(&data->vd, 0);
+	/* Signal end of audio data, unless a clip already ended it */
+	if (!data->drained)
+		vorbis_analysis_wrote(&data->vd, 0);
 
 	/* Flush remaining blocks */
-	while (vorbis_analysis_blockout(&data->vd, &data->vb) == 1) {
+	while (!data->drained &&
+	       vorbis_analysis_blockout(&data->vd, &data->vb) == 1) {
+		MUX_PROBE_LIB_ENTRY(MUX_CODEC_VORBIS, "vorbis_analysis");
 		vorbis_analysis(&data->vb, NULL);
+		MUX_PROBE_LIB_RETURN(MUX_CODEC_VORBIS, "vorbis_analysis", 0);
 		vorbis_bitrate_addblock(&data->vb);
 
 		ogg_packet op;
 		while (vorbis_bitrate_flushpacket(&data->vd, &op)) {
-			ogg_stream_packetin(&data->os_audio, &op);
+			put_audio_packet(data, &op, 0);
 		}
 	}
 
@@ -480,6 +607,65 @@ static int vorbis_encoder_finalize(struct mux_encoder *enc)
 	return MUX_OK;
 }
 
+/*
+ * Vorbis encoder splice
+ * Vorbis packets only decode with the setup they were made with, so
+ * the clip's identification and setup headers must match ours. The
+ * analysis is drained before the first clip packet; the decoder
+ * overlaps the clip's first block with its padded last one.
+ */
+static int vorbis_encoder_splice_check(struct mux_encoder *enc,
+				       const uint8_t *packet, size_t size)
+{
+	struct vorbis_encoder_data *data = enc->codec_data;
+	ogg_packet op;
+	uint32_t hash;
+
+	memset(&op, 0, sizeof(op));
+	op.packet = (unsigned char *)packet;
+	op.bytes = (long)size;
+
+	/* Header packets have the low bit of the type set */
+	if (packet[0] & 1) {
+		hash = header_hash(&op);
+		if ((packet[0] == 1 && hash != data->ident_hash) ||
+		    (packet[0] == 5 && hash != data->setup_hash)) {
+			mux_encoder_set_error(enc, MUX_ERROR_FORMAT,
+					      "Clip has a different Vorbis setup",
+					      "libvorbis", 0, NULL);
+			return MUX_ERROR_FORMAT;
+		}
+		return MUX_OK;
+	}
+
+	if (vorbis_packet_blocksize(&data->vi, &op) <= 0)
+		return MUX_ERROR_FORMAT;
+	return MUX_OK;
+}
+
+static int vorbis_encoder_splice(struct mux_encoder *enc,
+				 const uint8_t *packet, size_t size)
+{
+	struct vorbis_encoder_data *data = enc->codec_data;
+	ogg_packet op;
+	int ret;
+
+	ret = vorbis_encoder_splice_check(enc, packet, size);
+	if (ret != MUX_OK || (packet[0] & 1))
+		return ret;
+
+	memset(&op, 0, sizeof(op));
+	op.packet = (unsigned char *)packet;
+	op.bytes = (long)size;
+
+	ret = drain_analysis(enc, data);
+	if (ret != MUX_OK)
+		return ret;
+
+	put_audio_packet(data, &op, 1);
+	return pageout_ogg_stream(&enc->output, &data->os_audio);
+}
+
 /*
  * Vorbis decoder initialization
  */
@@ -490,9 +676,6 @@ static int vorbis_decoder_init(struct mux_decoder *dec,
 	struct vorbis_decoder_data *data;
 	int ret;
 
-	(void)params;
-	(void)num_params;
-
 	data = calloc(1, sizeof(*data));
 	if (!data) {
 		mux_decoder_set_error(dec, MUX_ERROR_NOMEM,
@@ -501,6 +684,15 @@ static int vorbis_decoder_init(struct mux_decoder *dec,
 		return MUX_ERROR_NOMEM;
 	}
 
+	ret = mux_pcm_reducer_setup(&data->reduce, params, num_params);
+	if (ret != MUX_OK) {
+		mux_decoder_set_error(dec, ret,
+				      "Invalid output_rate/output_channels",
+				      NULL, 0, NULL);
+		free(data);
+		return ret;
+	}
+
 	/* Initialize OGG sync state */
 	ret = ogg_sync_init(&data->oy);
 	if (ret != 0) {
@@ -562,6 +754,7 @@ static int vorbis_decoder_decode(struct mux_decoder *dec,
 	char *buffer;
 	ogg_page og;
 	ogg_packet op;
+	size_t room;
 	int ret;
 
 	if (!dec || !input || !input_consumed)
@@ -571,6 +764,11 @@ static int vorbis_decoder_decode(struct mux_decoder *dec,
 	if (!data)
 		return MUX_ERROR_INVAL;
 
+	/* Take no more than the buffered-input limit leaves room for */
+	room = mux_decoder_input_room(dec, data->oy.fill - data->oy.returned);
+	if (input_size > room)
+		input_size = room;
+
 	/* Submit input data to OGG sync */
 	buffer = ogg_sync_buffer(&data->oy, input_size);
 	if (!buffer) {
@@ -617,6 +815,11 @@ static int vorbis_decoder_decode(struct mux_decoder *dec,
 					continue;
 				} else if (ret < 0) {
 					/* Not a header, initialize synthesis */
+					ret = mux_decoder_check_format(dec, data->vi.rate,
+								       data->vi.channels);
+					if (ret != MUX_OK)
+						return ret;
+
 					ret = vorbis_synthesis_init(&data->vd, &data->vi);
 					if (ret != 0) {
 						mux_decoder_set_error(dec, MUX_ERROR_INIT,
@@ -634,13 +837,20 @@ static int vorbis_decoder_decode(struct mux_decoder *dec,
 						return MUX_ERROR_INIT;
 					}
 
+					mux_pcm_reducer_start(&data->reduce,
+							      data->vi.rate,
+							      data->vi.channels);
 					data->decoder_inited = 1;
 				}
 			}
 
 			/* Decode audio packet */
 			if (data->decoder_inited) {
+				MUX_PROBE_LIB_ENTRY(MUX_CODEC_VORBIS,
+						    "vorbis_synthesis");
 				ret = vorbis_synthesis(&data->vb, &op);
+				MUX_PROBE_LIB_RETURN(MUX_CODEC_VORBIS,
+						     "vorbis_synthesis", ret);
 				if (ret == 0) {
 					vorbis_synthesis_blockin(&data->vd, &data->vb);
 
@@ -648,34 +858,10 @@ static int vorbis_decoder_decode(struct mux_decoder *dec,
 					float **pcm;
 					int samples;
 					while ((samples = vorbis_synthesis_pcmout(&data->vd, &pcm)) > 0) {
-						/* Convert planar float to interleaved int16 */
-						int channels = data->vi.channels;
-						size_t pcm_size = samples * channels * sizeof(int16_t);
-						int16_t *pcm_buf = malloc(pcm_size);
-
-						if (!pcm_buf) {
-							mux_decoder_set_error(dec, MUX_ERROR_NOMEM,
-									      "Failed to allocate PCM buffer",
-									      NULL, 0, NULL);
-							return MUX_ERROR_NOMEM;
-						}
-
-						for (int i = 0; i < samples; i++) {
-							for (int ch = 0; ch < channels; ch++) {
-								float val = pcm[ch][i] * 32768.0f;
-								if (val > 32767.0f)
-									val = 32767.0f;
-								if (val < -32768.0f)
-									val = -32768.0f;
-								pcm_buf[i * channels + ch] = (int16_t)val;
-							}
-						}
-
-						/* Write to audio output buffer */
-						ret = mux_buffer_write(&dec->audio_output,
-								       pcm_buf, pcm_size);
-						free(pcm_buf);
-
+						/* Planar float straight to interleaved int16,
+						 * downmixed/decimated if requested */
+						ret = mux_pcm_reducer_write_f32(&data->reduce, dec,
+									       pcm, samples);
 						if (ret != MUX_OK)
 							return ret;
 
@@ -701,6 +887,20 @@ static int vorbis_decoder_decode(struct mux_decoder *dec,
 		}
 	}
 
+	/* Whatever is left in the streams is an incomplete packet */
+	if (data->have_audio_stream) {
+		ret = mux_decoder_check_frame(dec, data->os_audio.body_fill -
+					      data->os_audio.body_returned);
+		if (ret != MUX_OK)
+			return ret;
+	}
+	if (data->have_side_stream) {
+		ret = mux_decoder_check_frame(dec, data->os_side.body_fill -
+					      data->os_side.body_returned);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
 	*input_consumed = input_size;
 	return MUX_OK;
 }
@@ -788,10 +988,13 @@ const struct mux_codec_ops mux_codec_vorbis_ops = {
 	.decoder_read = vorbis_decoder_read,
 	.decoder_finalize = vorbis_decoder_finalize,
 
+	.encoder_splice = vorbis_encoder_splice,
+	.encoder_splice_check = vorbis_encoder_splice_check,
+
 	.encoder_params = vorbis_encoder_params,
 	.encoder_param_count = sizeof(vorbis_encoder_params) / sizeof(vorbis_encoder_params[0]),
-	.decoder_params = NULL,
-	.decoder_param_count = 0,
+	.decoder_params = mux_reduce_decoder_params,
+	.decoder_param_count = MUX_REDUCE_PARAM_COUNT,
 
 	.supported_sample_rates = vorbis_sample_rates,
 	.sample_rate_count = 2,
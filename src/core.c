@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "mux.h"
 #include "mux_internal.h"
+#include "mux_trace.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -206,6 +207,18 @@ int mux_get_supported_sample_rates(enum mux_codec_type codec_type,
 	return MUX_OK;
 }
 
+static int int_requested(const struct mux_param *params, int num_params,
+			 const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_params; i++)
+		if (strcmp(params[i].name, name) == 0)
+			return params[i].value.i;
+
+	return 0;
+}
+
 /*
  * Encoder - static allocation
  */
@@ -232,6 +245,10 @@ int mux_encoder_init(struct mux_encoder *enc,
 	if (!ops || !ops->encoder_init)
 		return MUX_ERROR_NOCODEC;
 
+	/* Split into mono/stereo groups, each with its own codec instance */
+	if (int_requested(params, num_params, "channel_groups"))
+		ops = &mux_group_encoder_ops;
+
 	enc->codec_type = codec_type;
 	enc->ops = ops;
 	enc->sample_rate = sample_rate;
@@ -261,6 +278,11 @@ void mux_encoder_deinit(struct mux_encoder *enc)
 		enc->ops->encoder_deinit(enc);
 
 	mux_buffer_deinit(&enc->output);
+	mux_pump_free(enc->pump);
+	mux_rate_free(enc->rate);
+	mux_govern_detach(enc);
+	mux_state_writer_free(enc->state);
+	mux_encoder_set_metrics(enc, NULL, NULL);
 	memset(enc, 0, sizeof(*enc));
 }
 
@@ -300,9 +322,70 @@ void mux_encoder_destroy(struct mux_encoder *enc)
 	free(enc);
 }
 
+/*
+ * Parameter copies, for sessions that are set up again later. Values are
+ * kept as they are; no codec takes string params.
+ */
+void mux_params_free(struct mux_param *params, int num_params)
+{
+	int i;
+
+	if (!params)
+		return;
+	for (i = 0; i < num_params; i++)
+		free((char *)params[i].name);
+	free(params);
+}
+
+int mux_params_copy(struct mux_param **out, int *num_out,
+		    const struct mux_param *params, int num_params)
+{
+	struct mux_param *copy;
+	size_t len;
+	char *name;
+	int i;
+
+	*out = NULL;
+	*num_out = 0;
+	if (num_params <= 0)
+		return MUX_OK;
+
+	copy = calloc((size_t)num_params, sizeof(*copy));
+	if (!copy)
+		return MUX_ERROR_NOMEM;
+
+	for (i = 0; i < num_params; i++) {
+		len = strlen(params[i].name) + 1;
+		name = malloc(len);
+		if (!name) {
+			mux_params_free(copy, i);
+			return MUX_ERROR_NOMEM;
+		}
+		memcpy(name, params[i].name, len);
+		copy[i] = params[i];
+		copy[i].name = name;
+	}
+
+	*out = copy;
+	*num_out = num_params;
+	return MUX_OK;
+}
+
 /*
  * Decoder - static allocation
  */
+static int flag_requested(const struct mux_param *params, int num_params,
+			  const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_params; i++)
+		if (strcmp(params[i].name, name) == 0)
+			return params[i].value.b;
+
+	return 0;
+}
+
 int mux_decoder_init(struct mux_decoder *dec,
 		     enum mux_codec_type codec_type,
 		     int num_streams,
@@ -320,9 +403,23 @@ int mux_decoder_init(struct mux_decoder *dec,
 
 	memset(dec, 0, sizeof(*dec));
 
-	ops = mux_get_codec_ops(codec_type);
-	if (!ops || !ops->decoder_init)
-		return MUX_ERROR_NOCODEC;
+	if (mux_decoder_limits_setup(&dec->limits, params, num_params) != MUX_OK)
+		return MUX_ERROR_INVAL;
+
+	if (flag_requested(params, num_params, "side_only")) {
+		/* Container parsing only; the codec needn't be compiled in */
+		if (num_streams != 2)
+			return MUX_ERROR_INVAL;
+		if ((int)codec_type < 0 || codec_type >= MUX_CODEC_MAX)
+			return MUX_ERROR_NOCODEC;
+		ops = &mux_side_only_decoder_ops;
+	} else {
+		ops = mux_get_codec_ops(codec_type);
+		if (!ops || !ops->decoder_init)
+			return MUX_ERROR_NOCODEC;
+		if (flag_requested(params, num_params, "channel_groups"))
+			ops = &mux_group_decoder_ops;
+	}
 
 	dec->codec_type = codec_type;
 	dec->ops = ops;
@@ -338,6 +435,18 @@ int mux_decoder_init(struct mux_decoder *dec,
 		return ret;
 	}
 
+	/*
+	 * Demultiplexing alone is already cheap; side_only ignores lazy,
+	 * and so do channel groups, which decode in batches
+	 */
+	if (ops != &mux_side_only_decoder_ops &&
+	    ops != &mux_group_decoder_ops &&
+	    flag_requested(params, num_params, "lazy")) {
+		dec->lazy = 1;
+		dec->lazy_container = mux_demux_container(codec_type,
+							  num_streams);
+	}
+
 	ret = ops->decoder_init(dec, params, num_params);
 	if (ret != MUX_OK) {
 		mux_buffer_deinit(&dec->audio_output);
@@ -345,7 +454,13 @@ int mux_decoder_init(struct mux_decoder *dec,
 		return ret;
 	}
 
-	return MUX_OK;
+	/* Snapshots carry them, so a restored session is set up the same */
+	ret = mux_params_copy(&dec->params, &dec->num_params, params,
+			      num_params);
+	if (ret != MUX_OK)
+		mux_decoder_deinit(dec);
+
+	return ret;
 }
 
 void mux_decoder_deinit(struct mux_decoder *dec)
@@ -358,6 +473,11 @@ void mux_decoder_deinit(struct mux_decoder *dec)
 
 	mux_buffer_deinit(&dec->audio_output);
 	mux_buffer_deinit(&dec->side_output);
+	mux_buffer_deinit(&dec->lazy_input);
+	mux_pump_free(dec->pump);
+	mux_state_reader_free(dec->state);
+	mux_params_free(dec->params, dec->num_params);
+	mux_decoder_set_metrics(dec, NULL, NULL);
 	memset(dec, 0, sizeof(*dec));
 }
 
@@ -394,20 +514,87 @@ void mux_decoder_destroy(struct mux_decoder *dec)
 	free(dec);
 }
 
+/*
+ * Shared-memory metrics for a call that started at t0
+ */
+static void encoder_account(struct mux_encoder *enc, uint64_t t0, int ret,
+			    size_t bytes_in, size_t bytes_out)
+{
+	mux_metrics_account(enc->metrics, enc->metrics_slot, ret,
+			    bytes_in, bytes_out,
+			    (size_t)mux_buffer_available(&enc->output),
+			    mux_clock_ns() - t0);
+}
+
+static void decoder_account(struct mux_decoder *dec, uint64_t t0, int ret,
+			    size_t bytes_in, size_t bytes_out)
+{
+	mux_metrics_account(dec->metrics, dec->metrics_slot, ret,
+			    bytes_in, bytes_out,
+			    (size_t)mux_buffer_available(&dec->audio_output) +
+			    (size_t)mux_buffer_available(&dec->side_output),
+			    mux_clock_ns() - t0);
+}
+
 /*
  * Encoding operations
  */
+int mux_encoder_put(struct mux_encoder *enc, const void *input,
+		    size_t input_size, size_t *input_consumed, int stream_type)
+{
+	if (enc->rate)
+		return mux_rate_encode(enc, input, input_size, input_consumed,
+				       stream_type);
+	return enc->ops->encoder_encode(enc, input, input_size,
+					input_consumed, stream_type);
+}
+
 int mux_encoder_encode(struct mux_encoder *enc,
 		       const void *input,
 		       size_t input_size,
 		       size_t *input_consumed,
 		       int stream_type)
 {
+	uint64_t t0 = 0;
+	int ret;
+
 	if (!enc || !enc->ops || !enc->ops->encoder_encode)
 		return MUX_ERROR_INVAL;
 
-	return enc->ops->encoder_encode(enc, input, input_size,
-					input_consumed, stream_type);
+	if (enc->metrics || enc->govern)
+		t0 = mux_clock_ns();
+
+	if (enc->hibernated) {
+		ret = mux_encoder_wake(enc);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	if (enc->govern) {
+		ret = mux_govern_enter(enc);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	MUX_PROBE4(encode_entry, enc, enc->codec_type, input_size, stream_type);
+	if (stream_type == MUX_STREAM_SIDE_CHANNEL)
+		MUX_PROBE2(side_enqueue, enc, input_size);
+
+	ret = mux_encoder_put(enc, input, input_size, input_consumed,
+			      stream_type);
+	if (ret == MUX_OK && enc->state && stream_type == MUX_STREAM_AUDIO &&
+	    input_consumed)
+		ret = mux_state_tick(enc, *input_consumed /
+				     ((size_t)enc->num_channels * sizeof(int16_t)));
+
+	MUX_PROBE3(encode_return, enc, ret, input_consumed ? *input_consumed : 0);
+	if (enc->govern)
+		mux_govern_leave(enc, t0, input, ret == MUX_OK && input_consumed ?
+				 *input_consumed : 0, stream_type);
+	if (enc->metrics)
+		encoder_account(enc, t0, ret, ret == MUX_OK && input_consumed ?
+				*input_consumed : 0, 0);
+	return ret;
 }
 
 int mux_encoder_read(struct mux_encoder *enc,
@@ -415,18 +602,53 @@ int mux_encoder_read(struct mux_encoder *enc,
 		     size_t output_size,
 		     size_t *output_written)
 {
+	uint64_t t0 = 0;
+	int ret;
+
 	if (!enc || !enc->ops || !enc->ops->encoder_read)
 		return MUX_ERROR_INVAL;
 
-	return enc->ops->encoder_read(enc, output, output_size,
-				      output_written);
+	if (enc->metrics)
+		t0 = mux_clock_ns();
+
+	if (enc->hibernated) {
+		ret = mux_encoder_wake(enc);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	ret = enc->ops->encoder_read(enc, output, output_size,
+				     output_written);
+
+	if (enc->metrics)
+		encoder_account(enc, t0, ret, 0, ret == MUX_OK &&
+				output_written ? *output_written : 0);
+	return ret;
 }
 
 int mux_encoder_finalize(struct mux_encoder *enc)
 {
+	int ret;
+
 	if (!enc || !enc->ops)
 		return MUX_ERROR_INVAL;
 
+	if (enc->hibernated) {
+		ret = mux_encoder_wake(enc);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	/* Changes made since the last audio go out before the end */
+	if (enc->state) {
+		ret = mux_state_tick(enc, 0);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	if (enc->rate)
+		return mux_rate_finalize(enc);
+
 	/* encoder_finalize is optional - some codecs don't need it */
 	if (!enc->ops->encoder_finalize)
 		return MUX_OK;
@@ -442,11 +664,44 @@ int mux_decoder_decode(struct mux_decoder *dec,
 		       size_t input_size,
 		       size_t *input_consumed)
 {
+	uint64_t t0 = 0;
+	int ret;
+
 	if (!dec || !dec->ops || !dec->ops->decoder_decode)
 		return MUX_ERROR_INVAL;
 
-	return dec->ops->decoder_decode(dec, input, input_size,
-					input_consumed);
+	if (dec->metrics)
+		t0 = mux_clock_ns();
+
+	if (dec->hibernated) {
+		ret = mux_decoder_wake(dec);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	/* Bound the work done per call; the caller passes the rest again */
+	if (dec->limits.max_decode_input &&
+	    input_size > dec->limits.max_decode_input)
+		input_size = dec->limits.max_decode_input;
+
+	MUX_PROBE3(decode_entry, dec, dec->codec_type, input_size);
+
+	if (dec->lazy) {
+		/* Queue only; mux_decoder_read() decodes on demand */
+		if (!input || !input_consumed)
+			return MUX_ERROR_INVAL;
+		ret = mux_decoder_buffer_input(dec, &dec->lazy_input, input,
+					       input_size, input_consumed);
+	} else {
+		ret = dec->ops->decoder_decode(dec, input, input_size,
+					       input_consumed);
+	}
+
+	MUX_PROBE3(decode_return, dec, ret, input_consumed ? *input_consumed : 0);
+	if (dec->metrics)
+		decoder_account(dec, t0, ret, ret == MUX_OK && input_consumed ?
+				*input_consumed : 0, 0);
+	return ret;
 }
 
 int mux_decoder_read(struct mux_decoder *dec,
@@ -455,18 +710,66 @@ int mux_decoder_read(struct mux_decoder *dec,
 		     size_t *output_written,
 		     int *stream_type)
 {
+	uint64_t t0 = 0;
+	int ret;
+
 	if (!dec || !dec->ops || !dec->ops->decoder_read)
 		return MUX_ERROR_INVAL;
 
-	return dec->ops->decoder_read(dec, output, output_size,
-				      output_written, stream_type);
+	if (dec->metrics)
+		t0 = mux_clock_ns();
+
+	if (dec->hibernated) {
+		ret = mux_decoder_wake(dec);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	ret = mux_lazy_pull(dec, output_size);
+	if (ret == MUX_OK)
+		ret = dec->ops->decoder_read(dec, output, output_size,
+					     output_written, stream_type);
+
+	/* State records are kept, not returned */
+	while (ret == MUX_OK && dec->state && stream_type && output_written &&
+	       *stream_type == MUX_STREAM_SIDE_CHANNEL && *output_written > 0) {
+		ret = mux_state_feed(dec, output, *output_written);
+		if (ret == MUX_OK)
+			ret = mux_lazy_pull(dec, output_size);
+		if (ret == MUX_OK)
+			ret = dec->ops->decoder_read(dec, output, output_size,
+						     output_written,
+						     stream_type);
+	}
+
+	if (ret == MUX_OK && stream_type && output_written &&
+	    *stream_type == MUX_STREAM_SIDE_CHANNEL && *output_written > 0)
+		MUX_PROBE2(side_deliver, dec, *output_written);
+	if (dec->metrics)
+		decoder_account(dec, t0, ret, 0, ret == MUX_OK &&
+				output_written ? *output_written : 0);
+	return ret;
 }
 
 int mux_decoder_finalize(struct mux_decoder *dec)
 {
+	int ret;
+
 	if (!dec || !dec->ops)
 		return MUX_ERROR_INVAL;
 
+	if (dec->hibernated) {
+		ret = mux_decoder_wake(dec);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	/* Lazy decoders finalize once the queue has been read */
+	if (dec->lazy) {
+		dec->lazy_eof = 1;
+		return mux_lazy_pull(dec, 0);
+	}
+
 	/* decoder_finalize is optional - some codecs don't need it */
 	if (!dec->ops->decoder_finalize)
 		return MUX_OK;
@@ -0,0 +1,470 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * Length of the built-in calibration signal and the chunk size it is
+ * fed in. 20 ms chunks match what a live session typically submits,
+ * so per-call overhead is part of the measurement.
+ */
+#define CALIBRATION_MS     500
+#define CALIBRATION_CHUNK  20
+#define DECODE_CHUNK       4096
+
+#define COST_CACHE_SIZE    32
+
+/*
+ * Nominal per-codec figures, used until a configuration has been
+ * calibrated on this host. CPU figures are in ns per sample per
+ * channel and are only meant as a rough ordering between codecs.
+ */
+struct codec_nominal {
+	int frame_samples;     /* fixed frame size, or 0 to use frame_ms */
+	int frame_ms;
+	int delay_samples;     /* algorithmic delay on top of one frame */
+	int delay_us;
+	int bitrate;           /* nominal bits per second, or 0 */
+	int bits_per_sample;   /* x100, relative to rate * channels */
+	int encode_ns;
+	int decode_ns;
+	int max_channels;      /* 0 = no limit */
+};
+
+static const struct codec_nominal nominal_table[MUX_CODEC_MAX] = {
+	[MUX_CODEC_PCM] = {
+		.frame_samples = 1, .bits_per_sample = 1600,
+		.encode_ns = 1, .decode_ns = 1
+	},
+	[MUX_CODEC_OPUS] = {
+		.frame_ms = 20, .delay_us = 6500, .bitrate = 64000,
+		.encode_ns = 160, .decode_ns = 30, .max_channels = 2
+	},
+	[MUX_CODEC_VORBIS] = {
+		.frame_samples = 1024, .delay_samples = 1024,
+		.bits_per_sample = 145,
+		.encode_ns = 200, .decode_ns = 30
+	},
+	[MUX_CODEC_FLAC] = {
+		.frame_samples = 4096, .bits_per_sample = 900,
+		.encode_ns = 20, .decode_ns = 8, .max_channels = 8
+	},
+	[MUX_CODEC_MP3] = {
+		.frame_samples = 1152, .delay_samples = 1105,
+		.bitrate = 128000,
+		.encode_ns = 150, .decode_ns = 25, .max_channels = 2
+	},
+	[MUX_CODEC_AAC] = {
+		.frame_samples = 1024, .delay_samples = 1024,
+		.bitrate = 128000,
+		.encode_ns = 150, .decode_ns = 30, .max_channels = 2
+	},
+	[MUX_CODEC_ALAW] = {
+		.frame_samples = 1, .bits_per_sample = 800,
+		.encode_ns = 2, .decode_ns = 1
+	},
+	[MUX_CODEC_MULAW] = {
+		.frame_samples = 1, .bits_per_sample = 800,
+		.encode_ns = 2, .decode_ns = 1
+	},
+	[MUX_CODEC_AMR] = {
+		.frame_samples = 160, .delay_us = 5000, .bitrate = 12800,
+		.encode_ns = 600, .decode_ns = 150, .max_channels = 1
+	},
+	[MUX_CODEC_AMR_WB] = {
+		.frame_samples = 320, .delay_us = 5000, .bitrate = 24800,
+		.encode_ns = 800, .decode_ns = 150, .max_channels = 1
+	}
+};
+
+/*
+ * Calibration results, keyed by configuration
+ */
+struct cost_cache_entry {
+	int valid;
+	enum mux_codec_type codec_type;
+	int sample_rate;
+	int num_channels;
+	struct mux_codec_cost cost;
+};
+
+static struct cost_cache_entry cost_cache[COST_CACHE_SIZE];
+static int cost_cache_next;
+
+static int rate_supported(enum mux_codec_type codec_type, int sample_rate)
+{
+	struct mux_sample_rate_list list;
+	int i;
+
+	if (mux_get_supported_sample_rates(codec_type, &list) != MUX_OK)
+		return 0;
+
+	if (list.is_range)
+		return sample_rate >= list.rates[0] &&
+		       sample_rate <= list.rates[1];
+
+	for (i = 0; i < list.count; i++) {
+		if (list.rates[i] == sample_rate)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int check_config(enum mux_codec_type codec_type,
+			int sample_rate, int num_channels)
+{
+	if (!mux_get_codec_ops(codec_type))
+		return MUX_ERROR_NOCODEC;
+
+	if (num_channels < 1 || !rate_supported(codec_type, sample_rate))
+		return MUX_ERROR_INVAL;
+
+	if (nominal_table[codec_type].max_channels &&
+	    num_channels > nominal_table[codec_type].max_channels)
+		return MUX_ERROR_INVAL;
+
+	return MUX_OK;
+}
+
+static void nominal_cost(enum mux_codec_type codec_type,
+			 int sample_rate, int num_channels,
+			 struct mux_codec_cost *cost)
+{
+	const struct codec_nominal *n = &nominal_table[codec_type];
+	uint64_t samples = (uint64_t)sample_rate * num_channels;
+
+	memset(cost, 0, sizeof(*cost));
+
+	if (n->frame_samples)
+		cost->frame_samples = n->frame_samples;
+	else
+		cost->frame_samples = sample_rate * n->frame_ms / 1000;
+
+	cost->latency_samples = cost->frame_samples + n->delay_samples +
+		(int)((int64_t)sample_rate * n->delay_us / 1000000);
+
+	if (n->bitrate)
+		cost->bytes_per_sec = n->bitrate / 8;
+	else
+		cost->bytes_per_sec = (int)(samples * n->bits_per_sample / 800);
+
+	cost->encode_ns_per_sec = samples * n->encode_ns;
+	cost->decode_ns_per_sec = samples * n->decode_ns;
+	cost->calibrated = 0;
+}
+
+static struct cost_cache_entry *cache_find(enum mux_codec_type codec_type,
+					   int sample_rate, int num_channels)
+{
+	int i;
+
+	for (i = 0; i < COST_CACHE_SIZE; i++) {
+		struct cost_cache_entry *e = &cost_cache[i];
+
+		if (e->valid && e->codec_type == codec_type &&
+		    e->sample_rate == sample_rate &&
+		    e->num_channels == num_channels)
+			return e;
+	}
+
+	return NULL;
+}
+
+static void cache_store(enum mux_codec_type codec_type,
+			int sample_rate, int num_channels,
+			const struct mux_codec_cost *cost)
+{
+	struct cost_cache_entry *e;
+
+	e = cache_find(codec_type, sample_rate, num_channels);
+	if (!e) {
+		e = &cost_cache[cost_cache_next];
+		cost_cache_next = (cost_cache_next + 1) % COST_CACHE_SIZE;
+	}
+
+	e->valid = 1;
+	e->codec_type = codec_type;
+	e->sample_rate = sample_rate;
+	e->num_channels = num_channels;
+	e->cost = *cost;
+}
+
+/*
+ * Deterministic calibration signal: a slow sweep plus low-level
+ * noise, so that lossy codecs can't fall into a trivially cheap
+ * steady state.
+ */
+static void fill_signal(int16_t *pcm, size_t frames, int num_channels,
+			int sample_rate)
+{
+	uint32_t seed = 0x12345678;
+	size_t i;
+	int c;
+
+	for (i = 0; i < frames; i++) {
+		double t = (double)i / sample_rate;
+		double f = 200.0 + 1800.0 * t;
+		double s = 0.4 * sin(2.0 * M_PI * f * t);
+
+		for (c = 0; c < num_channels; c++) {
+			seed = seed * 1664525u + 1013904223u;
+			s += ((int32_t)(seed >> 16) - 32768) / 32768.0 * 0.05;
+			pcm[i * num_channels + c] = (int16_t)(s * 32767.0);
+		}
+	}
+}
+
+static int drain_encoder(struct mux_encoder *enc, struct mux_buffer *out)
+{
+	uint8_t chunk[DECODE_CHUNK];
+	size_t written;
+	int ret;
+
+	do {
+		ret = mux_encoder_read(enc, chunk, sizeof(chunk), &written);
+		if (ret != MUX_OK)
+			return ret;
+		if (written) {
+			ret = mux_buffer_write(out, chunk, written);
+			if (ret != MUX_OK)
+				return ret;
+		}
+	} while (written);
+
+	return MUX_OK;
+}
+
+static int drain_decoder(struct mux_decoder *dec, uint64_t *audio_bytes)
+{
+	uint8_t chunk[DECODE_CHUNK];
+	size_t written;
+	int stream_type;
+	int ret;
+
+	do {
+		stream_type = -1;
+		ret = mux_decoder_read(dec, chunk, sizeof(chunk), &written,
+				       &stream_type);
+		if (ret != MUX_OK)
+			return ret;
+		if (stream_type == MUX_STREAM_AUDIO)
+			*audio_bytes += written;
+	} while (written);
+
+	return MUX_OK;
+}
+
+static int measure_encode(enum mux_codec_type codec_type,
+			  int sample_rate, int num_channels,
+			  const int16_t *pcm, size_t frames,
+			  struct mux_buffer *encoded, uint64_t *cpu_ns)
+{
+	struct mux_encoder *enc;
+	size_t chunk = (size_t)sample_rate * CALIBRATION_CHUNK / 1000;
+	size_t pos, consumed;
+	uint64_t start;
+	int ret = MUX_OK;
+
+	enc = mux_encoder_new(codec_type, sample_rate, num_channels, 2,
+			      NULL, 0);
+	if (!enc)
+		return MUX_ERROR_NOCODEC;
+
+	start = mux_cpu_clock_ns();
+	for (pos = 0; pos < frames && ret == MUX_OK; pos += chunk) {
+		size_t n = frames - pos < chunk ? frames - pos : chunk;
+
+		ret = mux_encoder_encode(enc, pcm + pos * num_channels,
+					 n * num_channels * sizeof(int16_t),
+					 &consumed, MUX_STREAM_AUDIO);
+		if (ret == MUX_OK)
+			ret = drain_encoder(enc, encoded);
+	}
+	if (ret == MUX_OK)
+		ret = mux_encoder_finalize(enc);
+	if (ret == MUX_OK)
+		ret = drain_encoder(enc, encoded);
+	*cpu_ns = mux_cpu_clock_ns() - start;
+
+	mux_encoder_destroy(enc);
+	return ret;
+}
+
+static int measure_decode(enum mux_codec_type codec_type,
+			  const struct mux_buffer *encoded,
+			  uint64_t *cpu_ns, uint64_t *audio_bytes)
+{
+	struct mux_decoder *dec;
+	size_t pos, consumed;
+	uint64_t start;
+	int ret = MUX_OK;
+
+	dec = mux_decoder_new(codec_type, 2, NULL, 0);
+	if (!dec)
+		return MUX_ERROR_NOCODEC;
+
+	*audio_bytes = 0;
+	start = mux_cpu_clock_ns();
+	for (pos = 0; pos < encoded->size && ret == MUX_OK; pos += consumed) {
+		size_t n = encoded->size - pos;
+
+		if (n > DECODE_CHUNK)
+			n = DECODE_CHUNK;
+		ret = mux_decoder_decode(dec, encoded->data + pos, n,
+					 &consumed);
+		if (ret == MUX_OK && consumed == 0)
+			ret = MUX_ERROR_DECODE;
+		if (ret == MUX_OK)
+			ret = drain_decoder(dec, audio_bytes);
+	}
+	if (ret == MUX_OK)
+		ret = mux_decoder_finalize(dec);
+	if (ret == MUX_OK)
+		ret = drain_decoder(dec, audio_bytes);
+	*cpu_ns = mux_cpu_clock_ns() - start;
+
+	mux_decoder_destroy(dec);
+	return ret;
+}
+
+int mux_calibrate(enum mux_codec_type codec_type,
+		  int sample_rate,
+		  int num_channels)
+{
+	struct mux_codec_cost cost;
+	struct mux_buffer encoded;
+	int16_t *pcm;
+	size_t frames;
+	uint64_t enc_ns, dec_ns, audio_bytes;
+	int ret;
+
+	ret = check_config(codec_type, sample_rate, num_channels);
+	if (ret != MUX_OK)
+		return ret;
+
+	frames = (size_t)sample_rate * CALIBRATION_MS / 1000;
+	pcm = malloc(frames * num_channels * sizeof(int16_t));
+	if (!pcm)
+		return MUX_ERROR_NOMEM;
+
+	ret = mux_buffer_init(&encoded, 64 * 1024);
+	if (ret != MUX_OK) {
+		free(pcm);
+		return ret;
+	}
+
+	fill_signal(pcm, frames, num_channels, sample_rate);
+	nominal_cost(codec_type, sample_rate, num_channels, &cost);
+
+	ret = measure_encode(codec_type, sample_rate, num_channels,
+			     pcm, frames, &encoded, &enc_ns);
+	if (ret != MUX_OK)
+		goto out;
+
+	cost.encode_ns_per_sec = enc_ns * 1000 / CALIBRATION_MS;
+	cost.bytes_per_sec = (int)((uint64_t)encoded.size * 1000 /
+				   CALIBRATION_MS);
+	cost.calibrated = 1;
+
+	/*
+	 * Decoding is measured on a best-effort basis: encode-only
+	 * builds keep the nominal decode figure.
+	 */
+	if (measure_decode(codec_type, &encoded, &dec_ns,
+			   &audio_bytes) == MUX_OK && audio_bytes > 0)
+		cost.decode_ns_per_sec = dec_ns * 1000 / CALIBRATION_MS;
+
+	cache_store(codec_type, sample_rate, num_channels, &cost);
+
+out:
+	mux_buffer_deinit(&encoded);
+	free(pcm);
+	return ret;
+}
+
+int mux_calibrate_all(int sample_rate, int num_channels)
+{
+	int calibrated = 0;
+	int i;
+
+	for (i = 0; i < MUX_CODEC_MAX; i++) {
+		if (check_config(i, sample_rate, num_channels) != MUX_OK)
+			continue;
+		if (mux_calibrate(i, sample_rate, num_channels) == MUX_OK)
+			calibrated++;
+	}
+
+	return calibrated;
+}
+
+int mux_codec_cost(enum mux_codec_type codec_type,
+		   int sample_rate,
+		   int num_channels,
+		   struct mux_codec_cost *cost)
+{
+	struct cost_cache_entry *e;
+	int ret;
+
+	if (!cost)
+		return MUX_ERROR_INVAL;
+
+	ret = check_config(codec_type, sample_rate, num_channels);
+	if (ret != MUX_OK)
+		return ret;
+
+	e = cache_find(codec_type, sample_rate, num_channels);
+	if (e)
+		*cost = e->cost;
+	else
+		nominal_cost(codec_type, sample_rate, num_channels, cost);
+
+	return MUX_OK;
+}
+
+int mux_codec_select(int sample_rate,
+		     int num_channels,
+		     int max_latency_ms,
+		     int max_bytes_per_sec,
+		     enum mux_codec_type *codec)
+{
+	struct mux_codec_cost cost;
+	uint64_t best_ns = 0;
+	int found = 0;
+	int i;
+
+	if (!codec || sample_rate <= 0)
+		return MUX_ERROR_INVAL;
+
+	for (i = 0; i < MUX_CODEC_MAX; i++) {
+		uint64_t ns;
+
+		if (mux_codec_cost(i, sample_rate, num_channels,
+				   &cost) != MUX_OK)
+			continue;
+
+		if (max_latency_ms > 0 &&
+		    (int64_t)cost.latency_samples * 1000 >
+		    (int64_t)max_latency_ms * sample_rate)
+			continue;
+
+		if (max_bytes_per_sec > 0 &&
+		    cost.bytes_per_sec > max_bytes_per_sec)
+			continue;
+
+		ns = cost.encode_ns_per_sec + cost.decode_ns_per_sec;
+		if (!found || ns < best_ns) {
+			*codec = i;
+			best_ns = ns;
+			found = 1;
+		}
+	}
+
+	return found ? MUX_OK : MUX_ERROR_NOCODEC;
+}
@@ -0,0 +1,502 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Container-level demultiplexer
+ *
+ * Splits a muxed byte stream into audio and side-channel packets
+ * without touching any codec library. Packets of streams the caller
+ * didn't ask for are skipped by length alone: their payload is never
+ * copied or checksummed, and bytes still in flight are dropped as
+ * they arrive instead of being buffered.
+ */
+#define OGG_HEADER_SIZE  27
+#define OGG_FLAG_CONT    0x01
+#define OGG_FLAG_BOS     0x02
+#define OGG_FLAG_EOS     0x04
+
+/* Serial numbers used by the Ogg-based codecs */
+#define OGG_SERIAL_AUDIO 1
+#define OGG_SERIAL_SIDE  2
+
+enum mux_container mux_demux_container(enum mux_codec_type codec_type,
+				       int num_streams)
+{
+	if (codec_type == MUX_CODEC_OPUS || codec_type == MUX_CODEC_VORBIS)
+		return MUX_CONTAINER_OGG;
+	if (num_streams == 1)
+		return MUX_CONTAINER_RAW;
+	return MUX_CONTAINER_LEB128;
+}
+
+int mux_demux_init(struct mux_demux *d, enum mux_codec_type codec_type,
+		   int num_streams)
+{
+	int ret;
+
+	memset(d, 0, sizeof(*d));
+	d->container = mux_demux_container(codec_type, num_streams);
+
+	ret = mux_buffer_init(&d->input, 4096);
+	if (ret != MUX_OK)
+		return ret;
+
+	ret = mux_buffer_init(&d->partial[MUX_STREAM_AUDIO], 0);
+	if (ret == MUX_OK)
+		ret = mux_buffer_init(&d->partial[MUX_STREAM_SIDE_CHANNEL], 0);
+	if (ret != MUX_OK) {
+		mux_buffer_deinit(&d->input);
+		return ret;
+	}
+
+	return MUX_OK;
+}
+
+void mux_demux_deinit(struct mux_demux *d)
+{
+	mux_buffer_deinit(&d->input);
+	mux_buffer_deinit(&d->partial[MUX_STREAM_AUDIO]);
+	mux_buffer_deinit(&d->partial[MUX_STREAM_SIDE_CHANNEL]);
+}
+
+static int wanted(unsigned int streams, int stream_type)
+{
+	return (streams >> stream_type) & 1;
+}
+
+static int too_big(const struct mux_demux *d, size_t size)
+{
+	return d->max_packet && size > d->max_packet;
+}
+
+/*
+ * LEB128 framing: [size << 1 | stream type][payload]
+ */
+static int parse_leb128(struct mux_demux *d, const uint8_t *p, size_t len,
+			size_t *consumed)
+{
+	struct mux_demux_packet pkt;
+	size_t pos = 0;
+	int ret;
+
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.granulepos = -1;
+
+	while (pos < len) {
+		uint64_t header;
+		size_t header_len, payload;
+		int stream_type;
+
+		ret = mux_leb128_decode(p + pos, len - pos, &header,
+					&header_len);
+		if (ret != MUX_OK)
+			return MUX_ERROR_FORMAT;
+		if (header_len == 0)
+			break;
+
+		stream_type = (int)(header & 1);
+		payload = (size_t)(header >> 1);
+
+		if (!wanted(d->streams, stream_type)) {
+			/* Drop what we have, skip the rest as it arrives */
+			if (len - pos - header_len < payload) {
+				d->skip = payload - (len - pos - header_len);
+				pos = len;
+				break;
+			}
+			pos += header_len + payload;
+			continue;
+		}
+
+		if (too_big(d, payload))
+			return MUX_ERROR_LIMIT;
+
+		if (len - pos - header_len < payload)
+			break;
+
+		pkt.stream_type = stream_type;
+		pkt.data = p + pos + header_len;
+		pkt.size = payload;
+		pos += header_len + payload;
+
+		ret = d->fn(d->ctx, &pkt);
+		if (ret != MUX_OK) {
+			*consumed = pos;
+			return ret;
+		}
+	}
+
+	*consumed = pos;
+	return MUX_OK;
+}
+
+/*
+ * Ogg page CRC (polynomial 0x04c11db7, checksum field taken as zero)
+ */
+static uint32_t ogg_crc(const uint8_t *page, size_t size)
+{
+	uint32_t crc = 0;
+	size_t i;
+	int bit;
+
+	for (i = 0; i < size; i++) {
+		uint8_t byte = (i >= 22 && i < 26) ? 0 : page[i];
+
+		crc ^= (uint32_t)byte << 24;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000u) ? (crc << 1) ^ 0x04c11db7u :
+						    crc << 1;
+	}
+
+	return crc;
+}
+
+static uint32_t read_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Walk the packets of one verified page
+ */
+static int ogg_page_packets(struct mux_demux *d, const uint8_t *page,
+			    int stream_type)
+{
+	struct mux_buffer *partial = &d->partial[stream_type];
+	struct mux_demux_packet pkt;
+	uint8_t flags = page[5];
+	int nsegs = page[26];
+	const uint8_t *lacing = page + OGG_HEADER_SIZE;
+	const uint8_t *body = lacing + nsegs;
+	size_t start = 0, off = 0;
+	int first = 1, last_end = -1, seg, ret;
+	int64_t granulepos;
+
+	granulepos = (int64_t)((uint64_t)read_le32(page + 6) |
+			       ((uint64_t)read_le32(page + 10) << 32));
+
+	/* Granule position and EOS belong to the last packet ending here */
+	for (seg = 0; seg < nsegs; seg++)
+		if (lacing[seg] < 255)
+			last_end = seg;
+
+	if (!(flags & OGG_FLAG_CONT)) {
+		/* Any held partial packet lost its tail */
+		mux_buffer_clear(partial);
+		d->partial_valid[stream_type] = 0;
+		d->drop_cont[stream_type] = 0;
+	} else if (!d->partial_valid[stream_type]) {
+		/* A continuation with nothing to continue: its start was lost */
+		d->drop_cont[stream_type] = 1;
+	}
+
+	for (seg = 0; seg < nsegs; seg++) {
+		off += lacing[seg];
+		if (lacing[seg] == 255)
+			continue;
+
+		if (d->drop_cont[stream_type]) {
+			d->drop_cont[stream_type] = 0;
+			first = 0;
+			start = off;
+			continue;
+		}
+
+		memset(&pkt, 0, sizeof(pkt));
+		pkt.stream_type = stream_type;
+		pkt.bos = first && (flags & OGG_FLAG_BOS);
+		pkt.granulepos = -1;
+		if (seg == last_end) {
+			pkt.granulepos = granulepos;
+			pkt.eos = !!(flags & OGG_FLAG_EOS);
+		}
+
+		if (d->partial_valid[stream_type]) {
+			if (too_big(d, partial->size + off - start))
+				return MUX_ERROR_LIMIT;
+			ret = mux_buffer_write(partial, body + start,
+					       off - start);
+			if (ret != MUX_OK)
+				return ret;
+			pkt.data = partial->data;
+			pkt.size = partial->size;
+		} else {
+			pkt.data = body + start;
+			pkt.size = off - start;
+		}
+
+		ret = d->fn(d->ctx, &pkt);
+		mux_buffer_clear(partial);
+		d->partial_valid[stream_type] = 0;
+		if (ret != MUX_OK)
+			return ret;
+
+		first = 0;
+		start = off;
+	}
+
+	/* Trailing 255 segment: the packet continues on the next page */
+	if (nsegs > 0 && lacing[nsegs - 1] == 255 &&
+	    !d->drop_cont[stream_type]) {
+		if (too_big(d, partial->size + off - start))
+			return MUX_ERROR_LIMIT;
+		ret = mux_buffer_write(partial, body + start, off - start);
+		if (ret != MUX_OK)
+			return ret;
+		d->partial_valid[stream_type] = 1;
+	}
+
+	return MUX_OK;
+}
+
+static int parse_ogg(struct mux_demux *d, const uint8_t *p, size_t len,
+		     size_t *consumed)
+{
+	size_t pos = 0;
+	int ret;
+
+	while (len - pos >= OGG_HEADER_SIZE) {
+		const uint8_t *page = p + pos;
+		size_t header_len, body_len = 0, page_len;
+		uint32_t serial;
+		int stream_type, seg;
+
+		/* Resync on capture pattern */
+		if (memcmp(page, "OggS", 4) != 0 || page[4] != 0) {
+			const uint8_t *next = memchr(page + 1, 'O', len - pos - 1);
+
+			pos = next ? (size_t)(next - p) : len;
+			continue;
+		}
+
+		header_len = OGG_HEADER_SIZE + page[26];
+		if (len - pos < header_len)
+			break;
+
+		for (seg = 0; seg < page[26]; seg++)
+			body_len += page[OGG_HEADER_SIZE + seg];
+		page_len = header_len + body_len;
+
+		serial = read_le32(page + 14);
+		if (serial == OGG_SERIAL_AUDIO)
+			stream_type = MUX_STREAM_AUDIO;
+		else if (serial == OGG_SERIAL_SIDE)
+			stream_type = MUX_STREAM_SIDE_CHANNEL;
+		else
+			stream_type = -1;
+
+		if (stream_type < 0 || !wanted(d->streams, stream_type)) {
+			if (len - pos < page_len) {
+				d->skip = page_len - (len - pos);
+				pos = len;
+				break;
+			}
+			pos += page_len;
+			continue;
+		}
+
+		if (len - pos < page_len)
+			break;
+
+		if (ogg_crc(page, page_len) != read_le32(page + 22)) {
+			/* Not a real page; look for the next one */
+			pos++;
+			continue;
+		}
+
+		pos += page_len;
+		ret = ogg_page_packets(d, page, stream_type);
+		if (ret != MUX_OK) {
+			*consumed = pos;
+			return ret;
+		}
+	}
+
+	*consumed = pos;
+	return MUX_OK;
+}
+
+static int parse(struct mux_demux *d, const uint8_t *p, size_t len,
+		 size_t *consumed)
+{
+	struct mux_demux_packet pkt;
+
+	switch (d->container) {
+	case MUX_CONTAINER_LEB128:
+		return parse_leb128(d, p, len, consumed);
+	case MUX_CONTAINER_OGG:
+		return parse_ogg(d, p, len, consumed);
+	case MUX_CONTAINER_RAW:
+	default:
+		*consumed = len;
+		if (!wanted(d->streams, MUX_STREAM_AUDIO) || len == 0)
+			return MUX_OK;
+
+		memset(&pkt, 0, sizeof(pkt));
+		pkt.stream_type = MUX_STREAM_AUDIO;
+		pkt.data = p;
+		pkt.size = len;
+		pkt.granulepos = -1;
+		return d->fn(d->ctx, &pkt);
+	}
+}
+
+int mux_demux_feed(struct mux_demux *d, const void *data, size_t size,
+		   unsigned int streams,
+		   int (*fn)(void *ctx, const struct mux_demux_packet *pkt),
+		   void *ctx)
+{
+	const uint8_t *in = data;
+	size_t skip, consumed = 0;
+	int ret;
+
+	/* Remainder of a skipped frame or page */
+	skip = d->skip < size ? (size_t)d->skip : size;
+	d->skip -= skip;
+	in += skip;
+	size -= skip;
+
+	if (size == 0)
+		return MUX_OK;
+
+	d->streams = streams;
+	d->fn = fn;
+	d->ctx = ctx;
+
+	/* Fast path: parse straight from the caller's memory */
+	if (mux_buffer_available(&d->input) == 0) {
+		mux_buffer_clear(&d->input);
+		ret = parse(d, in, size, &consumed);
+		if (ret != MUX_OK)
+			return ret;
+
+		if (d->skip > 0 || consumed == size)
+			return MUX_OK;
+
+		return mux_buffer_write(&d->input, in + consumed,
+					size - consumed);
+	}
+
+	mux_buffer_compact(&d->input);
+	ret = mux_buffer_write(&d->input, in, size);
+	if (ret != MUX_OK)
+		return ret;
+
+	ret = parse(d, d->input.data + d->input.read_pos,
+		    mux_buffer_available(&d->input), &consumed);
+
+	if (d->skip > 0)
+		mux_buffer_clear(&d->input);
+	else
+		mux_buffer_read(&d->input, NULL, consumed, &skip);
+
+	return ret;
+}
+
+/*
+ * Side-channel-only decoder
+ *
+ * Selected by the generic "side_only" decoder parameter. Uses the
+ * demultiplexer directly and never creates codec state, so it works
+ * for any codec type, compiled in or not.
+ */
+static int side_only_packet(void *ctx, const struct mux_demux_packet *pkt)
+{
+	struct mux_decoder *dec = ctx;
+
+	/* Ogg side streams open with a "SIDE" header packet */
+	if (pkt->bos || pkt->size == 0)
+		return MUX_OK;
+
+	return mux_buffer_write(&dec->side_output, pkt->data, pkt->size);
+}
+
+static int side_only_decoder_init(struct mux_decoder *dec,
+				  const struct mux_param *params,
+				  int num_params)
+{
+	struct mux_demux *d;
+	int ret;
+
+	(void)params;
+	(void)num_params;
+
+	d = malloc(sizeof(*d));
+	if (!d)
+		return MUX_ERROR_NOMEM;
+
+	ret = mux_demux_init(d, dec->codec_type, dec->num_streams);
+	if (ret != MUX_OK) {
+		free(d);
+		return ret;
+	}
+	d->max_packet = dec->limits.max_frame_size;
+
+	dec->codec_data = d;
+	return MUX_OK;
+}
+
+static void side_only_decoder_deinit(struct mux_decoder *dec)
+{
+	if (!dec->codec_data)
+		return;
+
+	mux_demux_deinit(dec->codec_data);
+	free(dec->codec_data);
+	dec->codec_data = NULL;
+}
+
+static int side_only_decoder_decode(struct mux_decoder *dec,
+				    const void *input,
+				    size_t input_size,
+				    size_t *input_consumed)
+{
+	int ret;
+
+	if (!input || !input_consumed)
+		return MUX_ERROR_INVAL;
+
+	ret = mux_demux_feed(dec->codec_data, input, input_size,
+			     1u << MUX_STREAM_SIDE_CHANNEL,
+			     side_only_packet, dec);
+	if (ret != MUX_OK) {
+		mux_decoder_set_error(dec, ret, ret == MUX_ERROR_LIMIT ?
+				      "Packet exceeds max_frame_size" :
+				      "Failed to demultiplex input",
+				      NULL, 0, NULL);
+		return ret;
+	}
+
+	*input_consumed = input_size;
+	return MUX_OK;
+}
+
+static int side_only_decoder_read(struct mux_decoder *dec,
+				  void *output,
+				  size_t output_size,
+				  size_t *output_written,
+				  int *stream_type)
+{
+	int ret;
+
+	if (!output || !output_written || !stream_type)
+		return MUX_ERROR_INVAL;
+
+	ret = mux_buffer_read(&dec->side_output, output, output_size,
+			      output_written);
+	if (ret == MUX_OK && *output_written > 0)
+		*stream_type = MUX_STREAM_SIDE_CHANNEL;
+
+	return ret;
+}
+
+const struct mux_codec_ops mux_side_only_decoder_ops = {
+	.decoder_init = side_only_decoder_init,
+	.decoder_deinit = side_only_decoder_deinit,
+	.decoder_decode = side_only_decoder_decode,
+	.decoder_read = side_only_decoder_read,
+};
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "mux.h"
 #include "mux_internal.h"
+#include "mux_trace.h"
 #include <string.h>
 
 /*
@@ -16,7 +17,10 @@ static const char *error_strings[] = {
 	[-MUX_ERROR_ENCODE] = "Encoding error",
 	[-MUX_ERROR_DECODE] = "Decoding error",
 	[-MUX_ERROR_FORMAT] = "Format/container error",
-	[-MUX_ERROR_INIT] = "Initialization error"
+	[-MUX_ERROR_INIT] = "Initialization error",
+	[-MUX_ERROR_UNSUPPORTED] = "Operation not supported by codec",
+	[-MUX_ERROR_LIMIT] = "Resource limit exceeded",
+	[-MUX_ERROR_NOTFOUND] = "No such entry"
 };
 
 const char *mux_error_string(int error_code)
@@ -50,6 +54,8 @@ void mux_encoder_set_error(struct mux_encoder *enc, int code,
 	enc->error.library_name = library_name;
 	enc->error.library_code = library_code;
 	enc->error.library_msg = library_msg;
+
+	MUX_PROBE4(encoder_error, enc, code, enc->error.message, library_code);
 }
 
 void mux_decoder_set_error(struct mux_decoder *dec, int code,
@@ -66,6 +72,8 @@ void mux_decoder_set_error(struct mux_decoder *dec, int code,
 	dec->error.library_name = library_name;
 	dec->error.library_code = library_code;
 	dec->error.library_msg = library_msg;
+
+	MUX_PROBE4(decoder_error, dec, code, dec->error.message, library_code);
 }
 
 const struct mux_error_info *mux_encoder_get_error(struct mux_encoder *enc)
@@ -0,0 +1,611 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/*
+ * Load governor
+ *
+ * Each session counts its encode time, audio frames and loud frames in
+ * counters that only its encoding thread writes; updates read them and
+ * keep the previous values to take deltas over the update interval.
+ * Decisions go the other way as wanted complexity, DTX and shed flags
+ * that the session picks up on its next encode. The session list is
+ * under a lock taken by admit, remove and update, never by encode.
+ *
+ * Costs are in CPU ns per wall second: what a session used over the
+ * last interval, or its cost model estimate until it has encoded
+ * something. Every step a policy takes subtracts its estimated saving
+ * from the load, so one update takes as many steps as the overload
+ * needs; the next update measures what they really saved.
+ */
+#define GOVERN_EVENTS          256
+#define GOVERN_SAVE_COMPLEXITY 40     /* percent of a session's cost */
+#define GOVERN_SAVE_DTX        30
+#define NS_PER_SEC             1000000000.0
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOAD(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#else
+#define LOAD(x)     (x)
+#define STORE(x, v) ((x) = (v))
+#endif
+
+#ifdef HAVE_PTHREAD
+#define LOCK(g)     pthread_mutex_lock(&(g)->lock)
+#define UNLOCK(g)   pthread_mutex_unlock(&(g)->lock)
+#else
+#define LOCK(g)     ((void)0)
+#define UNLOCK(g)   ((void)0)
+#endif
+
+struct mux_govern_session {
+	struct mux_governor *g;
+	struct mux_encoder *enc;
+	uint32_t id;
+	int priority;
+	int index;                    /* in g->sessions */
+
+	/* Written by the encoding thread */
+	uint64_t busy_ns;
+	uint64_t frames;
+	uint64_t loud_frames;
+	int complexity;               /* applied, -1 without a control */
+	int dtx;
+	int seen_complexity;          /* last request acted on */
+	int seen_dtx;
+
+	/* Written by updates */
+	int want_complexity;
+	int want_dtx;
+	int shed;
+
+	/* Update state */
+	int ceiling;                  /* complexity at admission */
+	int measured;
+	uint64_t last_busy, last_frames, last_loud;
+	uint64_t cost;
+	uint64_t estimate;
+	int rtf_pct;
+	int silent;
+};
+
+struct mux_governor {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+	struct mux_governor_config cfg;
+	uint64_t capacity;            /* CPU ns per wall second */
+
+	struct mux_govern_session **sessions;
+	struct mux_govern_session **order;
+	int count;
+	int cap;
+
+	uint64_t last_update;
+	struct mux_governor_stats stats;
+
+	struct mux_governor_event events[GOVERN_EVENTS];
+	unsigned int event_head;
+	unsigned int event_tail;
+};
+
+static int load_pct(const struct mux_governor *g, uint64_t load)
+{
+	return (int)((double)load * 100 / (double)g->capacity);
+}
+
+static uint64_t share(const struct mux_governor *g, int pct)
+{
+	return (uint64_t)((double)g->capacity * pct / 100);
+}
+
+static void record(struct mux_governor *g, enum mux_govern_action action,
+		   const struct mux_govern_session *s, uint32_t id, int priority,
+		   uint64_t load)
+{
+	struct mux_governor_event *ev;
+
+	ev = &g->events[g->event_head++ % GOVERN_EVENTS];
+	ev->action = action;
+	ev->id = s ? s->id : id;
+	ev->priority = s ? s->priority : priority;
+	ev->load_pct = load_pct(g, load);
+	/* A full queue drops the oldest */
+	if (g->event_head - g->event_tail > GOVERN_EVENTS)
+		g->event_tail = g->event_head - GOVERN_EVENTS;
+	g->stats.actions[action]++;
+}
+
+static uint64_t session_cost(const struct mux_govern_session *s)
+{
+	if (s->shed)
+		return 0;
+	return s->measured ? s->cost : s->estimate;
+}
+
+static uint64_t projected_load(const struct mux_governor *g)
+{
+	uint64_t load = 0;
+	int i;
+
+	for (i = 0; i < g->count; i++)
+		load += session_cost(g->sessions[i]);
+	return load;
+}
+
+/*
+ * Encoder side
+ */
+
+int mux_govern_enter(struct mux_encoder *enc)
+{
+	struct mux_govern_session *s = enc->govern;
+	int want, applied;
+
+	if (LOAD(s->shed)) {
+		mux_encoder_set_error(enc, MUX_ERROR_LIMIT,
+				      "Session shed by the load governor",
+				      NULL, 0, NULL);
+		return MUX_ERROR_LIMIT;
+	}
+
+	want = LOAD(s->want_complexity);
+	if (want != s->seen_complexity) {
+		s->seen_complexity = want;
+		if (enc->ops->encoder_set_complexity(enc, want,
+						     &applied) == MUX_OK)
+			STORE(s->complexity, applied);
+	}
+
+	want = LOAD(s->want_dtx);
+	if (want != s->seen_dtx) {
+		s->seen_dtx = want;
+		if (enc->ops->encoder_set_dtx(enc, want) == MUX_OK)
+			STORE(s->dtx, want);
+	}
+	return MUX_OK;
+}
+
+void mux_govern_leave(struct mux_encoder *enc, uint64_t t0, const void *input,
+		      size_t consumed, int stream_type)
+{
+	struct mux_govern_session *s = enc->govern;
+	const int16_t *pcm = input;
+	int level = s->g->cfg.silence_level;
+	size_t i, n, frames;
+
+	STORE(s->busy_ns, s->busy_ns + (mux_clock_ns() - t0));
+	if (stream_type != MUX_STREAM_AUDIO || !pcm || !consumed)
+		return;
+
+	n = consumed / sizeof(*pcm);
+	frames = n / (size_t)enc->num_channels;
+	STORE(s->frames, s->frames + frames);
+
+	/* One loud sample makes the whole call loud */
+	for (i = 0; i < n; i++) {
+		if (pcm[i] >= level || pcm[i] <= -level) {
+			STORE(s->loud_frames, s->loud_frames + frames);
+			break;
+		}
+	}
+}
+
+void mux_govern_detach(struct mux_encoder *enc)
+{
+	if (enc->govern)
+		mux_governor_remove(enc->govern->g, enc);
+}
+
+/*
+ * Governor
+ */
+
+struct mux_governor *mux_governor_new(const struct mux_governor_config *cfg)
+{
+	static const enum mux_govern_policy defaults[MUX_GOVERN_POLICY_MAX] = {
+		MUX_GOVERN_COMPLEXITY, MUX_GOVERN_DTX, MUX_GOVERN_SHED
+	};
+	struct mux_governor *g;
+	struct mux_governor_config c;
+	int i;
+
+	if (cfg)
+		c = *cfg;
+	else
+		memset(&c, 0, sizeof(c));
+
+	if (c.cpus == 0)
+		c.cpus = mux_workers_default(INT_MAX);
+	if (c.max_load_pct == 0)
+		c.max_load_pct = 85;
+	if (c.target_load_pct == 0)
+		c.target_load_pct = c.max_load_pct < 70 ? c.max_load_pct : 70;
+	if (c.admit_load_pct == 0)
+		c.admit_load_pct = c.max_load_pct;
+	if (c.silence_level == 0)
+		c.silence_level = 64;
+	if (c.low_complexity == 0)
+		c.low_complexity = 2;
+	if (c.policies[0] == MUX_GOVERN_END)
+		memcpy(c.policies, defaults, sizeof(defaults));
+
+	if (c.cpus < 0 || c.max_load_pct < 0 || c.max_load_pct > 100 ||
+	    c.target_load_pct < 0 || c.target_load_pct > c.max_load_pct ||
+	    c.admit_load_pct < 0 || c.admit_load_pct > 100 ||
+	    c.protected_priority < 0 || c.silence_level < 0 ||
+	    c.silence_level > 32767 || c.low_complexity < 0 ||
+	    c.low_complexity > 10)
+		return NULL;
+	for (i = 0; i < MUX_GOVERN_POLICY_MAX; i++)
+		if (c.policies[i] < MUX_GOVERN_END ||
+		    c.policies[i] > MUX_GOVERN_SHED)
+			return NULL;
+
+	g = calloc(1, sizeof(*g));
+	if (!g)
+		return NULL;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&g->lock, NULL);
+#endif
+	g->cfg = c;
+	g->capacity = (uint64_t)c.cpus * 1000000000ULL;
+	return g;
+}
+
+void mux_governor_destroy(struct mux_governor *g)
+{
+	int i;
+
+	if (!g)
+		return;
+
+	/* Sessions still attached just stop being governed */
+	for (i = 0; i < g->count; i++) {
+		g->sessions[i]->enc->govern = NULL;
+		free(g->sessions[i]);
+	}
+	free(g->sessions);
+	free(g->order);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&g->lock);
+#endif
+	free(g);
+}
+
+static int grow(struct mux_governor *g)
+{
+	struct mux_govern_session **sessions, **order;
+	int cap = g->cap ? g->cap * 2 : 16;
+
+	sessions = realloc(g->sessions, (size_t)cap * sizeof(*sessions));
+	if (!sessions)
+		return MUX_ERROR_NOMEM;
+	g->sessions = sessions;
+	order = realloc(g->order, (size_t)cap * sizeof(*order));
+	if (!order)
+		return MUX_ERROR_NOMEM;
+	g->order = order;
+	g->cap = cap;
+	return MUX_OK;
+}
+
+int mux_governor_admit(struct mux_governor *g, struct mux_encoder *enc,
+		       uint32_t id, int priority)
+{
+	struct mux_govern_session *s;
+	struct mux_codec_cost cost;
+	uint64_t estimate = 0, load;
+	int applied, ret;
+
+	if (!g || !enc || !enc->ops || enc->govern)
+		return MUX_ERROR_INVAL;
+
+	if (mux_codec_cost(enc->codec_type, enc->sample_rate,
+			   enc->num_channels, &cost) == MUX_OK)
+		estimate = cost.encode_ns_per_sec;
+
+	/* Set up before locking, so the check and the insert are one step */
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return MUX_ERROR_NOMEM;
+	s->g = g;
+	s->enc = enc;
+	s->id = id;
+	s->priority = priority;
+	s->estimate = estimate;
+
+	/* The codec's own complexity is the ceiling for restoring */
+	s->ceiling = -1;
+	if (enc->ops->encoder_set_complexity) {
+		if (enc->hibernated) {
+			ret = mux_encoder_wake(enc);
+			if (ret != MUX_OK) {
+				free(s);
+				return ret;
+			}
+		}
+		if (enc->ops->encoder_set_complexity(enc, -1,
+						     &applied) == MUX_OK)
+			s->ceiling = applied;
+	}
+	s->complexity = s->seen_complexity = s->want_complexity = s->ceiling;
+
+	LOCK(g);
+	load = projected_load(g) + estimate;
+	if (load > share(g, g->cfg.admit_load_pct)) {
+		record(g, MUX_GOVERN_REFUSED, NULL, id, priority, load);
+		UNLOCK(g);
+		free(s);
+		return MUX_ERROR_LIMIT;
+	}
+	if (g->count == g->cap && grow(g) != MUX_OK) {
+		UNLOCK(g);
+		free(s);
+		return MUX_ERROR_NOMEM;
+	}
+	s->index = g->count;
+	g->sessions[g->count++] = s;
+	g->stats.admitted++;
+	enc->govern = s;
+	UNLOCK(g);
+	return MUX_OK;
+}
+
+int mux_governor_remove(struct mux_governor *g, struct mux_encoder *enc)
+{
+	struct mux_govern_session *s;
+
+	if (!g || !enc)
+		return MUX_ERROR_INVAL;
+
+	s = enc->govern;
+	if (!s || s->g != g)
+		return MUX_ERROR_NOTFOUND;
+
+	LOCK(g);
+	g->sessions[s->index] = g->sessions[--g->count];
+	g->sessions[s->index]->index = s->index;
+	UNLOCK(g);
+
+	enc->govern = NULL;
+	free(s);
+	return MUX_OK;
+}
+
+/* Lowest priority first, then the most expensive */
+static int shed_order(const void *a, const void *b)
+{
+	const struct mux_govern_session *x = *(const struct mux_govern_session *const *)a;
+	const struct mux_govern_session *y = *(const struct mux_govern_session *const *)b;
+	uint64_t cx = session_cost(x), cy = session_cost(y);
+
+	if (x->priority != y->priority)
+		return x->priority < y->priority ? -1 : 1;
+	return cx > cy ? -1 : cx < cy;
+}
+
+static int is_protected(const struct mux_governor *g,
+			const struct mux_govern_session *s)
+{
+	return g->cfg.protected_priority &&
+	       s->priority >= g->cfg.protected_priority;
+}
+
+static int sorted(struct mux_governor *g)
+{
+	int i, n = 0;
+
+	for (i = 0; i < g->count; i++)
+		if (!g->sessions[i]->shed && !is_protected(g, g->sessions[i]))
+			g->order[n++] = g->sessions[i];
+	qsort(g->order, (size_t)n, sizeof(*g->order), shed_order);
+	return n;
+}
+
+/* One policy step on s; returns the estimated saving, 0 if it did nothing */
+static uint64_t lower(struct mux_governor *g, struct mux_govern_session *s,
+		      enum mux_govern_policy policy, uint64_t load)
+{
+	uint64_t cost = session_cost(s), saved;
+
+	if (!cost)
+		return 0;
+
+	switch (policy) {
+	case MUX_GOVERN_COMPLEXITY:
+		if (s->ceiling < 0 || s->want_complexity <= g->cfg.low_complexity)
+			return 0;
+		saved = cost * GOVERN_SAVE_COMPLEXITY / 100;
+		STORE(s->want_complexity, g->cfg.low_complexity);
+		record(g, MUX_GOVERN_COMPLEXITY_LOWERED, s, 0, 0, load);
+		return saved;
+	case MUX_GOVERN_DTX:
+		if (!s->enc->ops->encoder_set_dtx || s->want_dtx || !s->silent)
+			return 0;
+		saved = cost * GOVERN_SAVE_DTX / 100;
+		STORE(s->want_dtx, 1);
+		record(g, MUX_GOVERN_DTX_ON, s, 0, 0, load);
+		return saved;
+	case MUX_GOVERN_SHED:
+		STORE(s->shed, 1);
+		record(g, MUX_GOVERN_SHED_SESSION, s, 0, 0, load);
+		return cost;
+	default:
+		return 0;
+	}
+}
+
+static int shed_load(struct mux_governor *g, uint64_t load)
+{
+	uint64_t target = share(g, g->cfg.target_load_pct), saved;
+	int decisions = 0, n, i, p;
+
+	n = sorted(g);
+	for (p = 0; p < MUX_GOVERN_POLICY_MAX; p++) {
+		if (g->cfg.policies[p] == MUX_GOVERN_END)
+			break;
+		for (i = 0; i < n && load > target; i++) {
+			saved = lower(g, g->order[i], g->cfg.policies[p], load);
+			if (!saved)
+				continue;
+			load -= saved < load ? saved : load;
+			decisions++;
+		}
+	}
+	return decisions;
+}
+
+/* What undoing a saving of pct costs, from the session's current cost */
+static uint64_t regain(const struct mux_govern_session *s, int pct)
+{
+	return session_cost(s) * (uint64_t)pct / (uint64_t)(100 - pct);
+}
+
+/* Undo one change, the last policy first and the highest priority first */
+static int restore(struct mux_governor *g, uint64_t load)
+{
+	uint64_t target = share(g, g->cfg.target_load_pct);
+	struct mux_govern_session *s;
+	int n, i, p;
+
+	n = sorted(g);
+	for (p = MUX_GOVERN_POLICY_MAX - 1; p >= 0; p--) {
+		for (i = n - 1; i >= 0; i--) {
+			s = g->order[i];
+			if (g->cfg.policies[p] == MUX_GOVERN_DTX && s->want_dtx &&
+			    load + regain(s, GOVERN_SAVE_DTX) <= target) {
+				STORE(s->want_dtx, 0);
+				record(g, MUX_GOVERN_DTX_OFF, s, 0, 0, load);
+				return 1;
+			}
+			if (g->cfg.policies[p] == MUX_GOVERN_COMPLEXITY &&
+			    s->want_complexity != s->ceiling &&
+			    load + regain(s, GOVERN_SAVE_COMPLEXITY) <= target) {
+				STORE(s->want_complexity, s->ceiling);
+				record(g, MUX_GOVERN_COMPLEXITY_RESTORED, s, 0, 0,
+				       load);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+int mux_governor_update(struct mux_governor *g)
+{
+	struct mux_govern_session *s;
+	uint64_t now, wall, busy, frames, loud, d_busy, d_frames, measured = 0;
+	uint64_t load;
+	int decisions = 0, i;
+
+	if (!g)
+		return MUX_ERROR_INVAL;
+
+	LOCK(g);
+	now = mux_clock_ns();
+	wall = g->last_update ? now - g->last_update : 0;
+	g->last_update = now;
+
+	for (i = 0; i < g->count; i++) {
+		s = g->sessions[i];
+		busy = LOAD(s->busy_ns);
+		frames = LOAD(s->frames);
+		loud = LOAD(s->loud_frames);
+		d_busy = busy - s->last_busy;
+		d_frames = frames - s->last_frames;
+
+		if (wall) {
+			s->cost = (uint64_t)((double)d_busy * NS_PER_SEC /
+					     (double)wall);
+			s->rtf_pct = d_frames ? (int)((double)d_busy * 100 *
+					s->enc->sample_rate /
+					((double)d_frames * NS_PER_SEC)) : 0;
+			s->silent = d_frames > 0 && loud == s->last_loud;
+			if (d_busy || d_frames)
+				s->measured = 1;
+			measured += s->cost;
+		}
+		s->last_busy = busy;
+		s->last_frames = frames;
+		s->last_loud = loud;
+	}
+
+	/* The first update only sets the baseline */
+	if (wall) {
+		g->stats.load_pct = load_pct(g, measured);
+		load = projected_load(g);
+		g->stats.overloaded = load > share(g, g->cfg.max_load_pct);
+		if (g->stats.overloaded)
+			decisions = shed_load(g, load);
+		else if (load < share(g, g->cfg.target_load_pct))
+			decisions = restore(g, load);
+	}
+	UNLOCK(g);
+	return decisions;
+}
+
+int mux_governor_get_stats(struct mux_governor *g,
+			   struct mux_governor_stats *stats)
+{
+	int i;
+
+	if (!g || !stats)
+		return MUX_ERROR_INVAL;
+
+	LOCK(g);
+	*stats = g->stats;
+	stats->sessions = 0;
+	for (i = 0; i < g->count; i++)
+		stats->sessions += !g->sessions[i]->shed;
+	UNLOCK(g);
+	return MUX_OK;
+}
+
+int mux_governor_get_session(struct mux_governor *g,
+			     const struct mux_encoder *enc,
+			     struct mux_governor_session *session)
+{
+	struct mux_govern_session *s;
+
+	if (!g || !enc || !session)
+		return MUX_ERROR_INVAL;
+
+	s = enc->govern;
+	if (!s || s->g != g)
+		return MUX_ERROR_NOTFOUND;
+
+	LOCK(g);
+	session->id = s->id;
+	session->priority = s->priority;
+	session->rtf_pct = s->rtf_pct;
+	session->complexity = LOAD(s->complexity);
+	session->dtx = LOAD(s->dtx);
+	session->silent = s->silent;
+	session->shed = s->shed;
+	UNLOCK(g);
+	return MUX_OK;
+}
+
+int mux_governor_next_event(struct mux_governor *g,
+			    struct mux_governor_event *event)
+{
+	if (!g || !event)
+		return MUX_ERROR_INVAL;
+
+	LOCK(g);
+	if (g->event_tail == g->event_head) {
+		UNLOCK(g);
+		return MUX_ERROR_NOTFOUND;
+	}
+	*event = g->events[g->event_tail++ % GOVERN_EVENTS];
+	UNLOCK(g);
+	return MUX_OK;
+}
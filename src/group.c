@@ -0,0 +1,737 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Channel-group encoding
+ *
+ * Wide inputs are split into mono or stereo groups, each handled by its
+ * own codec instance with one stream (raw or Ogg, as for any codec),
+ * and the groups' output is interleaved as LEB128 frames whatever
+ * num_streams is. An audio frame starts with a LEB128 tag: 0 for the
+ * group map, which comes first, otherwise the group index plus one,
+ * followed by the next bytes of that group's stream.
+ *
+ *   map: [0][version][channels: LEB128][groups: LEB128][channels per group]...
+ *
+ * Each encode, decode or finalize call runs the groups as a batch on a
+ * worker pool; frames are always written in group order, so the output
+ * doesn't depend on the thread count.
+ */
+#define GROUP_MAP_VERSION 1
+#define GROUP_TAG_MAX     10
+#define GROUP_READ_CHUNK  16384
+
+struct group {
+	int channels;                 /* 1 or 2 */
+	int first;                    /* first channel in the full layout */
+	struct mux_encoder *enc;
+	struct mux_decoder *dec;
+
+	/*
+	 * Encoder: pcm is this group's share of the input, out its tag
+	 * and stream bytes. Decoder: in is stream bytes, out decoded PCM.
+	 */
+	int16_t *pcm;
+	size_t pcm_frames;
+	struct mux_buffer in;
+	struct mux_buffer out;
+	size_t tag_len;
+	int ret;
+};
+
+struct group_state {
+	int num_channels;
+	int num_groups;
+	struct group *groups;
+	struct mux_workers *workers;
+	int threads;                  /* requested, 0 = one per CPU, 1 default */
+
+	/* Current batch */
+	const int16_t *pcm;           /* encoder input */
+	size_t frames;
+	int finalizing;
+
+	/* Decoder */
+	struct mux_demux demux;
+	struct mux_param params[8];   /* forwarded to every group */
+	int num_params;
+	int16_t *mix;                 /* interleaving scratch */
+	size_t mix_frames;
+};
+
+static int find_int(const struct mux_param *params, int num_params,
+		    const char *name, int def)
+{
+	int i;
+
+	for (i = 0; i < num_params; i++)
+		if (strcmp(params[i].name, name) == 0)
+			return params[i].value.i;
+
+	return def;
+}
+
+static int init_groups(struct group_state *st, int num_channels,
+		       const uint8_t *layout, int num_groups)
+{
+	int i, first = 0;
+
+	st->groups = calloc((size_t)num_groups, sizeof(*st->groups));
+	if (!st->groups)
+		return MUX_ERROR_NOMEM;
+
+	st->num_channels = num_channels;
+	st->num_groups = num_groups;
+	for (i = 0; i < num_groups; i++) {
+		st->groups[i].channels = layout[i];
+		st->groups[i].first = first;
+		first += layout[i];
+		if (mux_buffer_init(&st->groups[i].in, 0) != MUX_OK ||
+		    mux_buffer_init(&st->groups[i].out, 0) != MUX_OK)
+			return MUX_ERROR_NOMEM;
+	}
+
+	if (st->threads != 1)
+		st->workers = mux_workers_new(st->threads ? st->threads :
+					      mux_workers_default(num_groups));
+	return MUX_OK;
+}
+
+static void free_state(struct group_state *st)
+{
+	int i;
+
+	if (!st)
+		return;
+
+	mux_workers_free(st->workers);
+	for (i = 0; st->groups && i < st->num_groups; i++) {
+		mux_encoder_destroy(st->groups[i].enc);
+		mux_decoder_destroy(st->groups[i].dec);
+		mux_buffer_deinit(&st->groups[i].in);
+		mux_buffer_deinit(&st->groups[i].out);
+		free(st->groups[i].pcm);
+	}
+	free(st->groups);
+	mux_demux_deinit(&st->demux);
+	free(st->mix);
+	free(st);
+}
+
+/*
+ * Encoder
+ */
+static int write_map(struct mux_encoder *enc, const struct group_state *st)
+{
+	uint8_t map[3 + 2 * GROUP_TAG_MAX + 256];
+	size_t len = 0;
+	int i, n;
+
+	map[len++] = 0;
+	map[len++] = GROUP_MAP_VERSION;
+	n = mux_leb128_encode((uint64_t)st->num_channels, map + len,
+			      GROUP_TAG_MAX);
+	len += (size_t)n;
+	n = mux_leb128_encode((uint64_t)st->num_groups, map + len,
+			      GROUP_TAG_MAX);
+	len += (size_t)n;
+	for (i = 0; i < st->num_groups; i++)
+		map[len++] = (uint8_t)st->groups[i].channels;
+
+	return mux_leb128_write_frame(&enc->output, map, len,
+				      MUX_STREAM_AUDIO, 2);
+}
+
+static int setup_encoder(struct mux_encoder *enc, int sample_rate,
+			 int num_channels, const struct mux_param *params,
+			 int num_params)
+{
+	struct mux_param fwd[32];
+	uint8_t layout[255];
+	uint8_t tag[GROUP_TAG_MAX];
+	struct group_state *st;
+	struct group *g;
+	int size, num_groups, nfwd = 0, i, n, ret;
+
+	size = find_int(params, num_params, "channel_groups", 0);
+	if ((size != 1 && size != 2) || num_channels <= 0 ||
+	    num_channels > 255 || num_params > 32) {
+		mux_encoder_set_error(enc, MUX_ERROR_INVAL,
+				      "channel_groups must be 1 or 2, for up to 255 channels",
+				      NULL, 0, NULL);
+		return MUX_ERROR_INVAL;
+	}
+
+	st = calloc(1, sizeof(*st));
+	if (!st)
+		return MUX_ERROR_NOMEM;
+	enc->codec_data = st;
+
+	st->threads = find_int(params, num_params, "threads", 1);
+	if (st->threads < 0) {
+		mux_encoder_set_error(enc, MUX_ERROR_INVAL, "Invalid threads",
+				      NULL, 0, NULL);
+		return MUX_ERROR_INVAL;
+	}
+
+	num_groups = (num_channels + size - 1) / size;
+	for (i = 0; i < num_groups; i++)
+		layout[i] = (uint8_t)(num_channels - i * size < size ?
+				      num_channels - i * size : size);
+
+	ret = init_groups(st, num_channels, layout, num_groups);
+	if (ret != MUX_OK)
+		return ret;
+
+	/* The groups get everything but the grouping itself */
+	for (i = 0; i < num_params; i++)
+		if (strcmp(params[i].name, "channel_groups") != 0 &&
+		    strcmp(params[i].name, "threads") != 0)
+			fwd[nfwd++] = params[i];
+
+	for (i = 0; i < num_groups; i++) {
+		g = &st->groups[i];
+		g->enc = mux_encoder_new(enc->codec_type, sample_rate,
+					 g->channels, 1, fwd, nfwd);
+		if (!g->enc) {
+			mux_encoder_set_error(enc, MUX_ERROR_INIT,
+					      "Failed to create channel group encoder",
+					      NULL, 0, NULL);
+			return MUX_ERROR_INIT;
+		}
+
+		n = mux_leb128_encode((uint64_t)i + 1, tag, sizeof(tag));
+		g->tag_len = (size_t)n;
+		ret = mux_buffer_write(&g->out, tag, g->tag_len);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	return write_map(enc, st);
+}
+
+static void group_encoder_deinit(struct mux_encoder *enc)
+{
+	free_state(enc->codec_data);
+	enc->codec_data = NULL;
+}
+
+static int group_encoder_init(struct mux_encoder *enc,
+			      int sample_rate,
+			      int num_channels,
+			      const struct mux_param *params,
+			      int num_params)
+{
+	int ret;
+
+	ret = setup_encoder(enc, sample_rate, num_channels, params,
+			    num_params);
+	if (ret != MUX_OK)
+		group_encoder_deinit(enc);
+	return ret;
+}
+
+static int group_read_encoder(struct group *g)
+{
+	uint8_t buf[GROUP_READ_CHUNK];
+	size_t written;
+	int ret;
+
+	for (;;) {
+		ret = mux_encoder_read(g->enc, buf, sizeof(buf), &written);
+		if (ret != MUX_OK || written == 0)
+			return ret;
+		ret = mux_buffer_write(&g->out, buf, written);
+		if (ret != MUX_OK)
+			return ret;
+	}
+}
+
+static void encode_job(void *ctx, int job)
+{
+	struct group_state *st = ctx;
+	struct group *g = &st->groups[job];
+	const int16_t *src = st->pcm + g->first;
+	int16_t *dst;
+	size_t bytes, consumed, f;
+	int c;
+
+	if (st->finalizing) {
+		g->ret = mux_encoder_finalize(g->enc);
+		if (g->ret == MUX_OK)
+			g->ret = group_read_encoder(g);
+		return;
+	}
+
+	/* This group's channels out of the full interleaved frames */
+	bytes = st->frames * (size_t)g->channels * sizeof(int16_t);
+	if (st->frames > g->pcm_frames) {
+		dst = realloc(g->pcm, bytes);
+		if (!dst) {
+			g->ret = MUX_ERROR_NOMEM;
+			return;
+		}
+		g->pcm = dst;
+		g->pcm_frames = st->frames;
+	}
+	dst = g->pcm;
+	for (f = 0; f < st->frames; f++)
+		for (c = 0; c < g->channels; c++)
+			dst[f * g->channels + c] =
+				src[f * st->num_channels + c];
+
+	g->ret = mux_encoder_encode(g->enc, dst, bytes, &consumed,
+				    MUX_STREAM_AUDIO);
+	if (g->ret == MUX_OK && consumed != bytes)
+		g->ret = MUX_ERROR_ENCODE;
+	if (g->ret == MUX_OK)
+		g->ret = group_read_encoder(g);
+}
+
+/* Run a batch and write the groups' frames in order */
+static int encode_batch(struct mux_encoder *enc)
+{
+	struct group_state *st = enc->codec_data;
+	struct group *g;
+	int i, ret;
+
+	mux_workers_run(st->workers, st->num_groups, encode_job, st);
+
+	for (i = 0; i < st->num_groups; i++) {
+		g = &st->groups[i];
+		if (g->ret != MUX_OK) {
+			mux_encoder_set_error(enc, g->ret,
+					      "Channel group encoding failed",
+					      NULL, 0, NULL);
+			return g->ret;
+		}
+		if (g->out.size == g->tag_len)
+			continue;
+
+		ret = mux_leb128_write_frame(&enc->output, g->out.data,
+					     g->out.size, MUX_STREAM_AUDIO, 2);
+		if (ret != MUX_OK)
+			return ret;
+		g->out.size = g->tag_len;
+	}
+
+	return MUX_OK;
+}
+
+static int group_encoder_encode(struct mux_encoder *enc,
+				const void *input,
+				size_t input_size,
+				size_t *input_consumed,
+				int stream_type)
+{
+	struct group_state *st = enc->codec_data;
+	size_t frame_bytes = (size_t)st->num_channels * sizeof(int16_t);
+	int ret;
+
+	if (!input || !input_consumed)
+		return MUX_ERROR_INVAL;
+
+	if (stream_type == MUX_STREAM_SIDE_CHANNEL) {
+		if (enc->num_streams != 2)
+			return MUX_ERROR_INVAL;
+		ret = mux_leb128_write_frame(&enc->output, input, input_size,
+					     MUX_STREAM_SIDE_CHANNEL, 2);
+		if (ret == MUX_OK)
+			*input_consumed = input_size;
+		return ret;
+	}
+
+	/* Whole frames only; the caller passes a partial one again */
+	*input_consumed = 0;
+	st->pcm = input;
+	st->frames = input_size / frame_bytes;
+	if (st->frames == 0)
+		return MUX_OK;
+
+	ret = encode_batch(enc);
+	if (ret == MUX_OK)
+		*input_consumed = st->frames * frame_bytes;
+	return ret;
+}
+
+static int group_encoder_read(struct mux_encoder *enc,
+			      void *output,
+			      size_t output_size,
+			      size_t *output_written)
+{
+	if (!output || !output_written)
+		return MUX_ERROR_INVAL;
+
+	return mux_buffer_read(&enc->output, output, output_size,
+			       output_written);
+}
+
+static int group_encoder_finalize(struct mux_encoder *enc)
+{
+	struct group_state *st = enc->codec_data;
+	int ret;
+
+	st->finalizing = 1;
+	ret = encode_batch(enc);
+	st->finalizing = 0;
+	return ret;
+}
+
+const struct mux_codec_ops mux_group_encoder_ops = {
+	.encoder_init = group_encoder_init,
+	.encoder_deinit = group_encoder_deinit,
+	.encoder_encode = group_encoder_encode,
+	.encoder_read = group_encoder_read,
+	.encoder_finalize = group_encoder_finalize,
+};
+
+/*
+ * Decoder
+ */
+
+/* Decoder params that apply to each group as they do to the whole */
+static const char *const forwarded_params[] = {
+	"output_rate", "max_frame_size", "max_buffered_input",
+	"max_sample_rate",
+};
+
+static int setup_decoder(struct mux_decoder *dec,
+			 const struct mux_param *params, int num_params)
+{
+	struct group_state *st;
+	size_t j;
+	int i, ret;
+
+	st = calloc(1, sizeof(*st));
+	if (!st)
+		return MUX_ERROR_NOMEM;
+	dec->codec_data = st;
+
+	st->threads = find_int(params, num_params, "threads", 1);
+	if (st->threads < 0) {
+		mux_decoder_set_error(dec, MUX_ERROR_INVAL, "Invalid threads",
+				      NULL, 0, NULL);
+		return MUX_ERROR_INVAL;
+	}
+
+	/* Groups are created once the map is in; keep what they need */
+	for (i = 0; i < num_params; i++)
+		for (j = 0; j < sizeof(forwarded_params) /
+			    sizeof(forwarded_params[0]); j++)
+			if (strcmp(params[i].name, forwarded_params[j]) == 0 &&
+			    st->num_params < 8) {
+				st->params[st->num_params] = params[i];
+				st->params[st->num_params++].name =
+					forwarded_params[j];
+			}
+
+	/* Always LEB128 frames, even for Ogg codecs */
+	ret = mux_demux_init(&st->demux, MUX_CODEC_PCM, 2);
+	if (ret != MUX_OK)
+		return ret;
+	st->demux.max_packet = dec->limits.max_frame_size;
+
+	return MUX_OK;
+}
+
+static void group_decoder_deinit(struct mux_decoder *dec)
+{
+	free_state(dec->codec_data);
+	dec->codec_data = NULL;
+}
+
+static int group_decoder_init(struct mux_decoder *dec,
+			      const struct mux_param *params,
+			      int num_params)
+{
+	int ret;
+
+	ret = setup_decoder(dec, params, num_params);
+	if (ret != MUX_OK)
+		group_decoder_deinit(dec);
+	return ret;
+}
+
+static int format_error(struct mux_decoder *dec, const char *message)
+{
+	mux_decoder_set_error(dec, MUX_ERROR_FORMAT, message, NULL, 0, NULL);
+	return MUX_ERROR_FORMAT;
+}
+
+static int read_map(struct mux_decoder *dec, const uint8_t *p, size_t len)
+{
+	struct group_state *st = dec->codec_data;
+	uint64_t channels, groups;
+	size_t n, pos = 1;
+	int i, sum = 0, ret;
+
+	if (st->groups)
+		return format_error(dec, "Duplicate channel group map");
+	if (len < 1 || p[0] != GROUP_MAP_VERSION)
+		return format_error(dec, "Unsupported channel group map");
+
+	if (mux_leb128_decode(p + pos, len - pos, &channels, &n) != MUX_OK ||
+	    n == 0)
+		return format_error(dec, "Malformed channel group map");
+	pos += n;
+	if (mux_leb128_decode(p + pos, len - pos, &groups, &n) != MUX_OK ||
+	    n == 0)
+		return format_error(dec, "Malformed channel group map");
+	pos += n;
+
+	if (channels == 0 || groups == 0 || groups > channels ||
+	    len - pos != groups)
+		return format_error(dec, "Malformed channel group map");
+	if (channels > (uint64_t)dec->limits.max_channels) {
+		mux_decoder_set_error(dec, MUX_ERROR_LIMIT,
+				      "Channel count exceeds max_channels",
+				      NULL, 0, NULL);
+		return MUX_ERROR_LIMIT;
+	}
+
+	for (i = 0; i < (int)groups; i++) {
+		if (p[pos + i] < 1 || p[pos + i] > 2)
+			return format_error(dec, "Malformed channel group map");
+		sum += p[pos + i];
+	}
+	if ((uint64_t)sum != channels)
+		return format_error(dec, "Malformed channel group map");
+
+	ret = init_groups(st, (int)channels, p + pos, (int)groups);
+	if (ret != MUX_OK)
+		return ret;
+
+	for (i = 0; i < st->num_groups; i++) {
+		st->groups[i].dec = mux_decoder_new(dec->codec_type, 1,
+						    st->params,
+						    st->num_params);
+		if (!st->groups[i].dec) {
+			mux_decoder_set_error(dec, MUX_ERROR_INIT,
+					      "Failed to create channel group decoder",
+					      NULL, 0, NULL);
+			return MUX_ERROR_INIT;
+		}
+	}
+
+	return MUX_OK;
+}
+
+static int group_packet(void *ctx, const struct mux_demux_packet *pkt)
+{
+	struct mux_decoder *dec = ctx;
+	struct group_state *st = dec->codec_data;
+	uint64_t tag;
+	size_t n;
+
+	if (pkt->stream_type == MUX_STREAM_SIDE_CHANNEL)
+		return mux_buffer_write(&dec->side_output, pkt->data,
+					pkt->size);
+
+	if (mux_leb128_decode(pkt->data, pkt->size, &tag, &n) != MUX_OK ||
+	    n == 0)
+		return format_error(dec, "Malformed channel group frame");
+
+	if (tag == 0)
+		return read_map(dec, pkt->data + n, pkt->size - n);
+
+	if (!st->groups || tag > (uint64_t)st->num_groups)
+		return format_error(dec, "Frame for an unknown channel group");
+
+	return mux_buffer_write(&st->groups[tag - 1].in, pkt->data + n,
+				pkt->size - n);
+}
+
+static int group_read_decoder(struct group *g)
+{
+	uint8_t buf[GROUP_READ_CHUNK];
+	size_t written;
+	int stream_type, ret;
+
+	for (;;) {
+		ret = mux_decoder_read(g->dec, buf, sizeof(buf), &written,
+				       &stream_type);
+		if (ret == MUX_ERROR_EOF)
+			return MUX_OK;
+		if (ret != MUX_OK || written == 0)
+			return ret;
+		ret = mux_buffer_write(&g->out, buf, written);
+		if (ret != MUX_OK)
+			return ret;
+	}
+}
+
+static void decode_job(void *ctx, int job)
+{
+	struct group_state *st = ctx;
+	struct group *g = &st->groups[job];
+	size_t consumed;
+
+	g->ret = MUX_OK;
+	while (mux_buffer_available(&g->in) > 0) {
+		g->ret = mux_decoder_decode(g->dec, g->in.data + g->in.read_pos,
+					    (size_t)mux_buffer_available(&g->in),
+					    &consumed);
+		if (g->ret != MUX_OK)
+			return;
+		mux_buffer_read(&g->in, NULL, consumed, &consumed);
+		g->ret = group_read_decoder(g);
+		if (g->ret != MUX_OK || consumed == 0)
+			return;
+	}
+	mux_buffer_compact(&g->in);
+
+	if (st->finalizing) {
+		g->ret = mux_decoder_finalize(g->dec);
+		if (g->ret == MUX_OK)
+			g->ret = group_read_decoder(g);
+	}
+}
+
+/*
+ * Interleave the frames every group has decoded; at the end, pad groups
+ * that came up short with silence
+ */
+static int interleave(struct mux_decoder *dec)
+{
+	struct group_state *st = dec->codec_data;
+	struct group *g;
+	size_t frames = 0, avail, f, n;
+	int16_t *mix;
+	const int16_t *src;
+	int i, c;
+
+	for (i = 0; i < st->num_groups; i++) {
+		g = &st->groups[i];
+		avail = (size_t)mux_buffer_available(&g->out) /
+			((size_t)g->channels * sizeof(int16_t));
+		if (i == 0 || (st->finalizing ? avail > frames : avail < frames))
+			frames = avail;
+	}
+	if (frames == 0)
+		return MUX_OK;
+
+	if (frames > st->mix_frames) {
+		mix = realloc(st->mix, frames * (size_t)st->num_channels *
+			      sizeof(int16_t));
+		if (!mix)
+			return MUX_ERROR_NOMEM;
+		st->mix = mix;
+		st->mix_frames = frames;
+	}
+	memset(st->mix, 0, frames * (size_t)st->num_channels * sizeof(int16_t));
+
+	for (i = 0; i < st->num_groups; i++) {
+		g = &st->groups[i];
+		src = (const int16_t *)(g->out.data + g->out.read_pos);
+		avail = (size_t)mux_buffer_available(&g->out) /
+			((size_t)g->channels * sizeof(int16_t));
+		if (avail > frames)
+			avail = frames;
+		for (f = 0; f < avail; f++)
+			for (c = 0; c < g->channels; c++)
+				st->mix[f * st->num_channels + g->first + c] =
+					src[f * g->channels + c];
+		mux_buffer_read(&g->out, NULL,
+				avail * g->channels * sizeof(int16_t), &n);
+		mux_buffer_compact(&g->out);
+	}
+
+	return mux_buffer_write(&dec->audio_output, st->mix,
+				frames * (size_t)st->num_channels *
+				sizeof(int16_t));
+}
+
+static int decode_batch(struct mux_decoder *dec)
+{
+	struct group_state *st = dec->codec_data;
+	int i;
+
+	if (!st->groups)
+		return MUX_OK;
+
+	mux_workers_run(st->workers, st->num_groups, decode_job, st);
+
+	for (i = 0; i < st->num_groups; i++) {
+		if (st->groups[i].ret != MUX_OK) {
+			mux_decoder_set_error(dec, st->groups[i].ret,
+					      "Channel group decoding failed",
+					      NULL, 0, NULL);
+			return st->groups[i].ret;
+		}
+	}
+
+	return interleave(dec);
+}
+
+static int group_decoder_decode(struct mux_decoder *dec,
+				const void *input,
+				size_t input_size,
+				size_t *input_consumed)
+{
+	struct group_state *st = dec->codec_data;
+	unsigned int streams = 1u << MUX_STREAM_AUDIO;
+	int ret;
+
+	if (!input || !input_consumed)
+		return MUX_ERROR_INVAL;
+
+	if (dec->num_streams == 2)
+		streams |= 1u << MUX_STREAM_SIDE_CHANNEL;
+	ret = mux_demux_feed(&st->demux, input, input_size, streams,
+			     group_packet, dec);
+	if (ret == MUX_ERROR_LIMIT)
+		mux_decoder_set_error(dec, ret, "Frame exceeds max_frame_size",
+				      NULL, 0, NULL);
+	if (ret != MUX_OK)
+		return ret;
+
+	*input_consumed = input_size;
+	return decode_batch(dec);
+}
+
+static int group_decoder_read(struct mux_decoder *dec,
+			      void *output,
+			      size_t output_size,
+			      size_t *output_written,
+			      int *stream_type)
+{
+	int ret;
+
+	if (!output || !output_written || !stream_type)
+		return MUX_ERROR_INVAL;
+
+	ret = mux_buffer_read(&dec->audio_output, output, output_size,
+			      output_written);
+	if (ret != MUX_OK || *output_written > 0) {
+		*stream_type = MUX_STREAM_AUDIO;
+		return ret;
+	}
+
+	ret = mux_buffer_read(&dec->side_output, output, output_size,
+			      output_written);
+	if (ret == MUX_OK && *output_written > 0)
+		*stream_type = MUX_STREAM_SIDE_CHANNEL;
+	return ret;
+}
+
+static int group_decoder_finalize(struct mux_decoder *dec)
+{
+	struct group_state *st = dec->codec_data;
+	int ret;
+
+	st->finalizing = 1;
+	ret = decode_batch(dec);
+	st->finalizing = 0;
+	return ret;
+}
+
+const struct mux_codec_ops mux_group_decoder_ops = {
+	.decoder_init = group_decoder_init,
+	.decoder_deinit = group_decoder_deinit,
+	.decoder_decode = group_decoder_decode,
+	.decoder_read = group_decoder_read,
+	.decoder_finalize = group_decoder_finalize,
+};
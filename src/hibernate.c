@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+
+/*
+ * Idle session memory release
+ *
+ * The core only owns the output buffers; everything else is up to the
+ * codec's trim/wake/memory ops. Codecs without a wake op never park
+ * state, so hibernating them is the same as trimming.
+ */
+
+int mux_encoder_trim(struct mux_encoder *enc)
+{
+	if (!enc || !enc->ops)
+		return MUX_ERROR_INVAL;
+
+	mux_buffer_shrink(&enc->output);
+
+	if (!enc->ops->encoder_trim)
+		return MUX_OK;
+
+	return enc->ops->encoder_trim(enc, 0);
+}
+
+int mux_encoder_hibernate(struct mux_encoder *enc)
+{
+	int ret;
+
+	if (!enc || !enc->ops)
+		return MUX_ERROR_INVAL;
+
+	if (enc->hibernated)
+		return MUX_OK;
+
+	mux_buffer_shrink(&enc->output);
+
+	if (!enc->ops->encoder_trim)
+		return MUX_OK;
+
+	ret = enc->ops->encoder_trim(enc, enc->ops->encoder_wake != NULL);
+	if (ret == MUX_OK && enc->ops->encoder_wake)
+		enc->hibernated = 1;
+
+	return ret;
+}
+
+int mux_encoder_wake(struct mux_encoder *enc)
+{
+	int ret;
+
+	if (!enc || !enc->ops)
+		return MUX_ERROR_INVAL;
+
+	if (!enc->hibernated)
+		return MUX_OK;
+
+	ret = enc->ops->encoder_wake(enc);
+	if (ret != MUX_OK) {
+		mux_encoder_set_error(enc, ret, "Failed to wake encoder",
+				      NULL, 0, NULL);
+		return ret;
+	}
+
+	enc->hibernated = 0;
+	return MUX_OK;
+}
+
+size_t mux_encoder_memory_usage(const struct mux_encoder *enc)
+{
+	size_t bytes;
+
+	if (!enc || !enc->ops)
+		return 0;
+
+	bytes = sizeof(*enc) + enc->output.capacity;
+	if (enc->ops->encoder_memory && enc->codec_data)
+		bytes += enc->ops->encoder_memory(enc);
+
+	return bytes;
+}
+
+int mux_decoder_trim(struct mux_decoder *dec)
+{
+	if (!dec || !dec->ops)
+		return MUX_ERROR_INVAL;
+
+	mux_buffer_shrink(&dec->audio_output);
+	mux_buffer_shrink(&dec->side_output);
+	mux_buffer_shrink(&dec->lazy_input);
+
+	if (!dec->ops->decoder_trim)
+		return MUX_OK;
+
+	return dec->ops->decoder_trim(dec, 0);
+}
+
+int mux_decoder_hibernate(struct mux_decoder *dec)
+{
+	int ret;
+
+	if (!dec || !dec->ops)
+		return MUX_ERROR_INVAL;
+
+	if (dec->hibernated)
+		return MUX_OK;
+
+	mux_buffer_shrink(&dec->audio_output);
+	mux_buffer_shrink(&dec->side_output);
+	mux_buffer_shrink(&dec->lazy_input);
+
+	if (!dec->ops->decoder_trim)
+		return MUX_OK;
+
+	ret = dec->ops->decoder_trim(dec, dec->ops->decoder_wake != NULL);
+	if (ret == MUX_OK && dec->ops->decoder_wake)
+		dec->hibernated = 1;
+
+	return ret;
+}
+
+int mux_decoder_wake(struct mux_decoder *dec)
+{
+	int ret;
+
+	if (!dec || !dec->ops)
+		return MUX_ERROR_INVAL;
+
+	if (!dec->hibernated)
+		return MUX_OK;
+
+	ret = dec->ops->decoder_wake(dec);
+	if (ret != MUX_OK) {
+		mux_decoder_set_error(dec, ret, "Failed to wake decoder",
+				      NULL, 0, NULL);
+		return ret;
+	}
+
+	dec->hibernated = 0;
+	return MUX_OK;
+}
+
+size_t mux_decoder_memory_usage(const struct mux_decoder *dec)
+{
+	size_t bytes;
+
+	if (!dec || !dec->ops)
+		return 0;
+
+	bytes = sizeof(*dec) + dec->audio_output.capacity +
+		dec->side_output.capacity + dec->lazy_input.capacity;
+	if (dec->ops->decoder_memory && dec->codec_data)
+		bytes += dec->ops->decoder_memory(dec);
+
+	return bytes;
+}
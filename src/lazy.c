@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Lazy (pull-driven) decoding
+ *
+ * With the generic "lazy" decoder parameter, mux_decoder_decode() only
+ * queues the compressed bytes. Reads then hand the codec one container
+ * unit at a time - a LEB128 frame or an Ogg page - until the request
+ * can be filled, so buffered memory stays at compressed size and no
+ * work is spent on audio that is never read. Passthrough streams have
+ * no framing to split on and are fed in LAZY_RAW_UNIT pieces.
+ */
+#define LAZY_RAW_UNIT 2048
+#define OGG_HEADER_SIZE 27
+
+/* Bytes of the next whole unit at p, 0 if it isn't complete yet */
+static size_t next_unit(enum mux_container container, const uint8_t *p,
+			size_t len)
+{
+	uint64_t header;
+	size_t header_len, body = 0, i;
+	const uint8_t *next;
+
+	switch (container) {
+	case MUX_CONTAINER_LEB128:
+		/* Malformed headers are passed on for the codec to report */
+		if (mux_leb128_decode(p, len, &header, &header_len) != MUX_OK)
+			return len;
+		if (header_len == 0 ||
+		    (uint64_t)(len - header_len) < (header >> 1))
+			return 0;
+		return header_len + (size_t)(header >> 1);
+
+	case MUX_CONTAINER_OGG:
+		if (len < OGG_HEADER_SIZE)
+			return 0;
+		if (memcmp(p, "OggS", 4) != 0) {
+			/* Junk before the next page goes along in one piece */
+			next = memchr(p + 1, 'O', len - 1);
+			return next ? (size_t)(next - p) : len;
+		}
+		header_len = OGG_HEADER_SIZE + p[26];
+		if (len < header_len)
+			return 0;
+		for (i = 0; i < p[26]; i++)
+			body += p[OGG_HEADER_SIZE + i];
+		return len - header_len < body ? 0 : header_len + body;
+
+	case MUX_CONTAINER_RAW:
+	default:
+		return len < LAZY_RAW_UNIT ? len : LAZY_RAW_UNIT;
+	}
+}
+
+/* Pulls can come from the pumps and rings, not just mux_decoder_read() */
+static int lazy_wake(struct mux_decoder *dec)
+{
+	return dec->hibernated ? mux_decoder_wake(dec) : MUX_OK;
+}
+
+int mux_lazy_pull(struct mux_decoder *dec, size_t want)
+{
+	struct mux_buffer *q = &dec->lazy_input;
+	size_t avail, unit, consumed, n;
+	int ret;
+
+	if (!dec->lazy)
+		return MUX_OK;
+
+	while ((size_t)mux_buffer_available(&dec->audio_output) < want &&
+	       mux_buffer_available(&dec->side_output) == 0) {
+		avail = (size_t)mux_buffer_available(q);
+		if (avail == 0)
+			break;
+
+		unit = next_unit(dec->lazy_container, q->data + q->read_pos,
+				 avail);
+		if (unit == 0) {
+			if (!dec->lazy_eof)
+				break;
+			unit = avail;
+		}
+
+		ret = lazy_wake(dec);
+		if (ret != MUX_OK)
+			return ret;
+		ret = dec->ops->decoder_decode(dec, q->data + q->read_pos, unit,
+					       &consumed);
+		if (ret != MUX_OK)
+			return ret;
+
+		/* The codec's own input limits may hold the rest back */
+		if (consumed == 0)
+			break;
+		mux_buffer_read(q, NULL, consumed, &n);
+	}
+
+	/* Everything queued before mux_decoder_finalize() is in */
+	if (dec->lazy_eof && mux_buffer_available(q) == 0) {
+		dec->lazy_eof = 0;
+		ret = lazy_wake(dec);
+		if (ret != MUX_OK)
+			return ret;
+		if (dec->ops->decoder_finalize)
+			return dec->ops->decoder_finalize(dec);
+	}
+
+	return MUX_OK;
+}
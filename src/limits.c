@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <string.h>
+
+/*
+ * Decoder resource limits
+ *
+ * Every decoder accepts the max_* parameters below regardless of codec.
+ * Limits are checked as soon as the offending value is known (a frame
+ * header, a stream header), before anything is allocated for it, and
+ * fail with MUX_ERROR_LIMIT.
+ */
+#define DEFAULT_MAX_FRAME_SIZE     (16 << 20)
+#define DEFAULT_MAX_BUFFERED_INPUT (64 << 20)
+#define DEFAULT_MAX_CHANNELS       255  /* what any header can declare */
+#define DEFAULT_MAX_SAMPLE_RATE    384000
+
+/* Room for a LEB128 frame header in front of a maximal payload */
+#define FRAME_HEADER_MAX 10
+
+int mux_decoder_limits_setup(struct mux_decoder_limits *l,
+			     const struct mux_param *params,
+			     int num_params)
+{
+	int frame = DEFAULT_MAX_FRAME_SIZE;
+	int buffered = DEFAULT_MAX_BUFFERED_INPUT;
+	int per_call = 0;
+	int i;
+
+	l->max_channels = DEFAULT_MAX_CHANNELS;
+	l->max_sample_rate = DEFAULT_MAX_SAMPLE_RATE;
+
+	for (i = 0; i < num_params; i++) {
+		if (strcmp(params[i].name, "max_frame_size") == 0)
+			frame = params[i].value.i;
+		else if (strcmp(params[i].name, "max_buffered_input") == 0)
+			buffered = params[i].value.i;
+		else if (strcmp(params[i].name, "max_channels") == 0)
+			l->max_channels = params[i].value.i;
+		else if (strcmp(params[i].name, "max_sample_rate") == 0)
+			l->max_sample_rate = params[i].value.i;
+		else if (strcmp(params[i].name, "max_decode_input") == 0)
+			per_call = params[i].value.i;
+	}
+
+	if (frame <= 0 || buffered <= 0 || per_call < 0 ||
+	    l->max_channels <= 0 || l->max_channels > 255 ||
+	    l->max_sample_rate <= 0)
+		return MUX_ERROR_INVAL;
+
+	l->max_frame_size = (size_t)frame;
+	l->max_decode_input = (size_t)per_call;
+
+	/* A maximal frame must always fit, or the stream could never progress */
+	l->max_buffered_input = (size_t)buffered;
+	if (l->max_buffered_input < l->max_frame_size + FRAME_HEADER_MAX)
+		l->max_buffered_input = l->max_frame_size + FRAME_HEADER_MAX;
+
+	return MUX_OK;
+}
+
+static int limit_error(struct mux_decoder *dec, const char *message)
+{
+	mux_decoder_set_error(dec, MUX_ERROR_LIMIT, message, NULL, 0, NULL);
+	return MUX_ERROR_LIMIT;
+}
+
+size_t mux_decoder_input_room(const struct mux_decoder *dec, size_t buffered)
+{
+	if (buffered >= dec->limits.max_buffered_input)
+		return 0;
+	return dec->limits.max_buffered_input - buffered;
+}
+
+/*
+ * Append as much input as the buffered-input limit allows. The caller
+ * reports *accepted as consumed; the rest must be passed again later.
+ */
+int mux_decoder_buffer_input(struct mux_decoder *dec, struct mux_buffer *buf,
+			     const void *input, size_t input_size,
+			     size_t *accepted)
+{
+	size_t room;
+
+	room = mux_decoder_input_room(dec, mux_buffer_available(buf));
+	if (input_size > room)
+		input_size = room;
+
+	/* Drop already-parsed bytes so the buffer stays bounded too */
+	mux_buffer_compact(buf);
+
+	*accepted = input_size;
+	return mux_buffer_write(buf, input, input_size);
+}
+
+/*
+ * mux_leb128_read_frame() with the frame size checked against the
+ * limit as soon as the header is in, rather than once the whole
+ * claimed payload has been buffered
+ */
+int mux_decoder_read_frame(struct mux_decoder *dec, struct mux_buffer *input,
+			   void *payload, size_t payload_capacity,
+			   size_t *payload_size, int *stream_type)
+{
+	uint64_t header;
+	size_t header_len;
+	int ret;
+
+	if (dec->num_streams == 2 && mux_buffer_available(input) > 0) {
+		ret = mux_leb128_decode(input->data + input->read_pos,
+					input->size - input->read_pos,
+					&header, &header_len);
+		if (ret != MUX_OK) {
+			mux_decoder_set_error(dec, MUX_ERROR_FORMAT,
+					      "Malformed frame header",
+					      NULL, 0, NULL);
+			return MUX_ERROR_FORMAT;
+		}
+		if (header_len > 0 &&
+		    (header >> 1) > (uint64_t)dec->limits.max_frame_size)
+			return limit_error(dec, "Frame exceeds max_frame_size");
+	}
+
+	return mux_leb128_read_frame(input, payload, payload_capacity,
+				     payload_size, stream_type,
+				     dec->num_streams);
+}
+
+int mux_decoder_check_frame(struct mux_decoder *dec, size_t size)
+{
+	if (size > dec->limits.max_frame_size)
+		return limit_error(dec, "Packet exceeds max_frame_size");
+	return MUX_OK;
+}
+
+int mux_decoder_check_format(struct mux_decoder *dec, int sample_rate,
+			     int channels)
+{
+	if (channels <= 0 || channels > dec->limits.max_channels)
+		return limit_error(dec, "Channel count exceeds max_channels");
+	if (sample_rate <= 0 || sample_rate > dec->limits.max_sample_rate)
+		return limit_error(dec, "Sample rate exceeds max_sample_rate");
+	return MUX_OK;
+}
@@ -0,0 +1,551 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define _GNU_SOURCE
+#define MUX_HAVE_METRICS 1
+#endif
+
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Shared-memory metrics
+ *
+ * A header followed by one fixed-size slot per attached session. A
+ * slot is written only by the thread using its session, under a
+ * seqlock: the sequence word is odd while an update is in flight and
+ * readers retry until they copy a stable, even one. Sessions never
+ * share a cache line, so the audio path costs two clock reads and a
+ * few plain stores. Counters of detached sessions are folded into the
+ * header with atomic adds, and totals are that plus the live slots.
+ */
+#ifdef MUX_HAVE_METRICS
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define METRICS_MAGIC    0x4d58554du  /* "MUXM" */
+#define METRICS_VERSION  1
+#define METRICS_RETRIES  10000
+#define METRICS_SPINS    64           /* then yield to a preempted writer */
+
+#define SLOT_FREE     0
+#define SLOT_CLAIMED  1               /* being set up by its owner */
+#define SLOT_USED     2
+#define SLOT_RETIRING 3               /* being folded into the header */
+
+#define COUNTER_WORDS (sizeof(struct mux_metrics_counters) / sizeof(uint64_t))
+
+struct metrics_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_count;
+	uint32_t slot_size;
+	uint8_t pad0[48];
+
+	struct mux_metrics_counters retired;  /* detached sessions */
+	uint8_t pad1[16];
+};
+
+struct metrics_slot {
+	uint32_t seq;                 /* seqlock, odd during an update */
+	uint32_t state;
+	uint32_t codec_type;
+	uint32_t decoder;
+	char name[MUX_METRICS_NAME_MAX];
+	struct mux_metrics_counters c;
+	uint8_t pad[32];
+};
+
+struct mux_metrics {
+	struct metrics_header *shm;
+	size_t size;
+	int slot_count;
+	int writable;
+	int fd;
+};
+
+static struct metrics_slot *slot_at(const struct mux_metrics *m, int slot)
+{
+	return (struct metrics_slot *)((uint8_t *)m->shm + sizeof(*m->shm) +
+				       (size_t)slot * sizeof(struct metrics_slot));
+}
+
+static size_t metrics_size(int slots)
+{
+	return sizeof(struct metrics_header) +
+	       (size_t)slots * sizeof(struct metrics_slot);
+}
+
+static struct mux_metrics *map_metrics(int fd, size_t size, int writable)
+{
+	struct mux_metrics *m;
+	void *p;
+
+	p = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+		 MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	m = calloc(1, sizeof(*m));
+	if (!m) {
+		munmap(p, size);
+		return NULL;
+	}
+
+	m->shm = p;
+	m->size = size;
+	m->writable = writable;
+	m->fd = fd;
+	return m;
+}
+
+/* Nothing at path, or an old metrics page that is now unlinked */
+static int unlink_metrics_file(const char *path)
+{
+	struct metrics_header hdr;
+	struct stat st;
+	int fd, ok;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return errno == ENOENT;
+
+	ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	     (size_t)st.st_size >= sizeof(hdr) &&
+	     pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+	     hdr.magic == METRICS_MAGIC &&
+	     hdr.slot_size == sizeof(struct metrics_slot) &&
+	     hdr.slot_count > 0 && hdr.slot_count <= MUX_METRICS_MAX_SESSIONS &&
+	     (size_t)st.st_size == metrics_size((int)hdr.slot_count);
+	close(fd);
+
+	return ok && unlink(path) == 0;
+}
+
+struct mux_metrics *mux_metrics_create(const char *path, int max_sessions)
+{
+	struct mux_metrics *m;
+	size_t size;
+	int fd;
+
+	if (max_sessions <= 0 || max_sessions > MUX_METRICS_MAX_SESSIONS)
+		return NULL;
+
+	/*
+	 * A named page is replaced, so readers of the old one stay valid,
+	 * but only if it is one: anything else at path is left alone
+	 */
+	if (path) {
+		if (!unlink_metrics_file(path))
+			return NULL;
+		fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	} else {
+		fd = (int)syscall(SYS_memfd_create, "muxaudio-metrics", 0);
+	}
+	if (fd < 0)
+		return NULL;
+
+	size = metrics_size(max_sessions);
+	if (ftruncate(fd, (off_t)size) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	m = map_metrics(fd, size, 1);
+	if (!m) {
+		close(fd);
+		return NULL;
+	}
+	m->slot_count = max_sessions;
+
+	/* Fresh pages are zero; only the identity needs filling in */
+	m->shm->slot_count = (uint32_t)max_sessions;
+	m->shm->slot_size = sizeof(struct metrics_slot);
+	m->shm->version = METRICS_VERSION;
+	__atomic_store_n(&m->shm->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+
+	return m;
+}
+
+struct mux_metrics *mux_metrics_open(int fd)
+{
+	struct mux_metrics *m;
+	struct metrics_header hdr;
+	struct stat st;
+	int dup_fd;
+
+	if (fd < 0 || fstat(fd, &st) != 0 ||
+	    (size_t)st.st_size < sizeof(hdr) ||
+	    pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+		return NULL;
+
+	if (hdr.magic != METRICS_MAGIC || hdr.version != METRICS_VERSION ||
+	    hdr.slot_size != sizeof(struct metrics_slot) ||
+	    hdr.slot_count == 0 || hdr.slot_count > MUX_METRICS_MAX_SESSIONS ||
+	    (size_t)st.st_size != metrics_size((int)hdr.slot_count))
+		return NULL;
+
+	dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (dup_fd < 0)
+		return NULL;
+
+	m = map_metrics(dup_fd, (size_t)st.st_size, 0);
+	if (!m) {
+		close(dup_fd);
+		return NULL;
+	}
+	m->slot_count = (int)hdr.slot_count;
+
+	return m;
+}
+
+void mux_metrics_close(struct mux_metrics *m)
+{
+	if (!m)
+		return;
+
+	munmap(m->shm, m->size);
+	close(m->fd);
+	free(m);
+}
+
+int mux_metrics_fd(const struct mux_metrics *m)
+{
+	return m ? m->fd : -1;
+}
+
+int mux_metrics_slots(const struct mux_metrics *m)
+{
+	return m ? m->slot_count : 0;
+}
+
+/*
+ * Writer side: only the owning thread stores into a slot, so plain
+ * read-modify-write is enough; the stores are atomic so a concurrent
+ * reader never sees a torn word.
+ */
+static void slot_begin(struct metrics_slot *s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void slot_end(struct metrics_slot *s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+#define BUMP(field, v) \
+	__atomic_store_n(&(field), (field) + (uint64_t)(v), __ATOMIC_RELAXED)
+
+static void clear_counters(struct mux_metrics_counters *c)
+{
+	uint64_t *w = (uint64_t *)c;
+	size_t i;
+
+	for (i = 0; i < COUNTER_WORDS; i++)
+		__atomic_store_n(&w[i], 0, __ATOMIC_RELAXED);
+}
+
+static int metrics_attach(struct mux_metrics *m, const char *name,
+			  enum mux_codec_type codec_type, int decoder)
+{
+	struct metrics_slot *s;
+	uint32_t expected;
+	int i;
+
+	for (i = 0; i < m->slot_count; i++) {
+		s = slot_at(m, i);
+		expected = SLOT_FREE;
+		if (!__atomic_compare_exchange_n(&s->state, &expected,
+						 SLOT_CLAIMED, 0,
+						 __ATOMIC_ACQUIRE,
+						 __ATOMIC_RELAXED))
+			continue;
+
+		slot_begin(s);
+		memset(s->name, 0, sizeof(s->name));
+		if (name)
+			strncpy(s->name, name, sizeof(s->name) - 1);
+		s->codec_type = (uint32_t)codec_type;
+		s->decoder = (uint32_t)decoder;
+		clear_counters(&s->c);
+		slot_end(s);
+
+		__atomic_store_n(&s->state, SLOT_USED, __ATOMIC_RELEASE);
+		return i;
+	}
+
+	return MUX_ERROR_LIMIT;
+}
+
+static void metrics_detach(struct mux_metrics *m, int slot)
+{
+	struct metrics_slot *s = slot_at(m, slot);
+	uint64_t *from = (uint64_t *)&s->c;
+	uint64_t *to = (uint64_t *)&m->shm->retired;
+	size_t i;
+
+	/*
+	 * Readers skip the slot before its counters reach the header, so
+	 * a total never has them twice
+	 */
+	slot_begin(s);
+	__atomic_store_n(&s->state, SLOT_RETIRING, __ATOMIC_RELAXED);
+	slot_end(s);
+
+	/* Buffered bytes leave with the session */
+	__atomic_store_n(&s->c.buffered, 0, __ATOMIC_RELAXED);
+	for (i = 0; i < COUNTER_WORDS; i++)
+		__atomic_fetch_add(&to[i], from[i], __ATOMIC_RELAXED);
+
+	__atomic_store_n(&s->state, SLOT_FREE, __ATOMIC_RELEASE);
+}
+
+void mux_metrics_account(struct mux_metrics *m, int slot, int ret,
+			 size_t bytes_in, size_t bytes_out, size_t buffered,
+			 uint64_t ns)
+{
+	struct metrics_slot *s = slot_at(m, slot);
+	int bucket = 0;
+
+	/* Bucket 0 is under 1024 ns, each next one twice as wide */
+	if (ns >= 1024)
+		bucket = 63 - __builtin_clzll(ns) - 9;
+	if (bucket >= MUX_METRICS_BUCKETS)
+		bucket = MUX_METRICS_BUCKETS - 1;
+
+	slot_begin(s);
+	BUMP(s->c.calls, 1);
+	if (ret != MUX_OK && ret != MUX_ERROR_EOF)
+		BUMP(s->c.errors, 1);
+	BUMP(s->c.bytes_in, bytes_in);
+	BUMP(s->c.bytes_out, bytes_out);
+	__atomic_store_n(&s->c.buffered, (uint64_t)buffered, __ATOMIC_RELAXED);
+	BUMP(s->c.busy_ns, ns);
+	BUMP(s->c.latency[bucket], 1);
+	slot_end(s);
+}
+
+/* Copy a slot consistently; MUX_ERROR_NOTFOUND if it is not in use */
+static int read_slot(const struct metrics_slot *s,
+		     struct mux_metrics_session *out)
+{
+	const uint64_t *from = (const uint64_t *)&s->c;
+	uint64_t *to = (uint64_t *)&out->counters;
+	uint32_t seq;
+	size_t i;
+	int tries;
+
+	for (tries = 0; tries < METRICS_RETRIES; tries++) {
+		if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != SLOT_USED)
+			return MUX_ERROR_NOTFOUND;
+
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			if (tries >= METRICS_SPINS)
+				sched_yield();
+			continue;
+		}
+
+		for (i = 0; i < sizeof(out->name); i++)
+			out->name[i] = __atomic_load_n(&s->name[i],
+						       __ATOMIC_RELAXED);
+		out->name[sizeof(out->name) - 1] = '\0';
+		out->codec_type = (enum mux_codec_type)
+			__atomic_load_n(&s->codec_type, __ATOMIC_RELAXED);
+		out->decoder = (int)__atomic_load_n(&s->decoder,
+						    __ATOMIC_RELAXED);
+		for (i = 0; i < COUNTER_WORDS; i++)
+			to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		/* Retiring went through the seqlock, so this state is current */
+		if (__atomic_load_n(&s->state, __ATOMIC_RELAXED) != SLOT_USED)
+			return MUX_ERROR_NOTFOUND;
+		return MUX_OK;
+	}
+
+	/* The owner died mid-update */
+	return MUX_ERROR_FORMAT;
+}
+
+int mux_metrics_read(const struct mux_metrics *m, int slot,
+		     struct mux_metrics_session *out)
+{
+	if (!m || !out || slot < 0 || slot >= m->slot_count)
+		return MUX_ERROR_INVAL;
+
+	return read_slot(slot_at(m, slot), out);
+}
+
+int mux_metrics_read_total(const struct mux_metrics *m,
+			   struct mux_metrics_counters *out)
+{
+	struct mux_metrics_session s;
+	const uint64_t *retired;
+	uint64_t *to, *from;
+	size_t i;
+	int slot;
+
+	if (!m || !out)
+		return MUX_ERROR_INVAL;
+
+	retired = (const uint64_t *)&m->shm->retired;
+	to = (uint64_t *)out;
+	for (i = 0; i < COUNTER_WORDS; i++)
+		to[i] = __atomic_load_n(&retired[i], __ATOMIC_RELAXED);
+
+	from = (uint64_t *)&s.counters;
+	for (slot = 0; slot < m->slot_count; slot++) {
+		if (read_slot(slot_at(m, slot), &s) != MUX_OK)
+			continue;
+		for (i = 0; i < COUNTER_WORDS; i++)
+			to[i] += from[i];
+	}
+
+	return MUX_OK;
+}
+
+int mux_encoder_set_metrics(struct mux_encoder *enc, struct mux_metrics *m,
+			    const char *name)
+{
+	int slot;
+
+	if (!enc || (m && !m->writable))
+		return MUX_ERROR_INVAL;
+
+	if (enc->metrics)
+		metrics_detach(enc->metrics, enc->metrics_slot);
+	enc->metrics = NULL;
+	if (!m)
+		return MUX_OK;
+
+	slot = metrics_attach(m, name, enc->codec_type, 0);
+	if (slot < 0) {
+		mux_encoder_set_error(enc, slot, "No free metrics slot",
+				      NULL, 0, NULL);
+		return slot;
+	}
+
+	enc->metrics = m;
+	enc->metrics_slot = slot;
+	return MUX_OK;
+}
+
+int mux_decoder_set_metrics(struct mux_decoder *dec, struct mux_metrics *m,
+			    const char *name)
+{
+	int slot;
+
+	if (!dec || (m && !m->writable))
+		return MUX_ERROR_INVAL;
+
+	if (dec->metrics)
+		metrics_detach(dec->metrics, dec->metrics_slot);
+	dec->metrics = NULL;
+	if (!m)
+		return MUX_OK;
+
+	slot = metrics_attach(m, name, dec->codec_type, 1);
+	if (slot < 0) {
+		mux_decoder_set_error(dec, slot, "No free metrics slot",
+				      NULL, 0, NULL);
+		return slot;
+	}
+
+	dec->metrics = m;
+	dec->metrics_slot = slot;
+	return MUX_OK;
+}
+
+#else /* !MUX_HAVE_METRICS */
+
+struct mux_metrics *mux_metrics_create(const char *path, int max_sessions)
+{
+	(void)path;
+	(void)max_sessions;
+	return NULL;
+}
+
+struct mux_metrics *mux_metrics_open(int fd)
+{
+	(void)fd;
+	return NULL;
+}
+
+void mux_metrics_close(struct mux_metrics *m)
+{
+	(void)m;
+}
+
+int mux_metrics_fd(const struct mux_metrics *m)
+{
+	(void)m;
+	return -1;
+}
+
+int mux_metrics_slots(const struct mux_metrics *m)
+{
+	(void)m;
+	return 0;
+}
+
+void mux_metrics_account(struct mux_metrics *m, int slot, int ret,
+			 size_t bytes_in, size_t bytes_out, size_t buffered,
+			 uint64_t ns)
+{
+	(void)m;
+	(void)slot;
+	(void)ret;
+	(void)bytes_in;
+	(void)bytes_out;
+	(void)buffered;
+	(void)ns;
+}
+
+int mux_metrics_read(const struct mux_metrics *m, int slot,
+		     struct mux_metrics_session *out)
+{
+	(void)m;
+	(void)slot;
+	(void)out;
+	return MUX_ERROR_UNSUPPORTED;
+}
+
+int mux_metrics_read_total(const struct mux_metrics *m,
+			   struct mux_metrics_counters *out)
+{
+	(void)m;
+	(void)out;
+	return MUX_ERROR_UNSUPPORTED;
+}
+
+int mux_encoder_set_metrics(struct mux_encoder *enc, struct mux_metrics *m,
+			    const char *name)
+{
+	(void)name;
+	if (!enc)
+		return MUX_ERROR_INVAL;
+	return m ? MUX_ERROR_UNSUPPORTED : MUX_OK;
+}
+
+int mux_decoder_set_metrics(struct mux_decoder *dec, struct mux_metrics *m,
+			    const char *name)
+{
+	(void)name;
+	if (!dec)
+		return MUX_ERROR_INVAL;
+	return m ? MUX_ERROR_UNSUPPORTED : MUX_OK;
+}
+
+#endif /* MUX_HAVE_METRICS */
@@ -0,0 +1,1769 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#if defined(__SSE__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MP3_SSE
+#endif
+
+/*
+ * In-tree MPEG-1/2/2.5 Layer III decoder
+ *
+ * One frame per call, from the caller's bytes into the caller's PCM
+ * buffer; the only input kept between calls is the bit reservoir (the
+ * last 511 bytes of main data). Huffman decoding walks lookup tables
+ * built once per process from the ISO code tables. The IMDCT and the
+ * polyphase synthesis are matrix products with the windows folded in,
+ * done four lanes at a time with SSE where the target has it.
+ */
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define GRANULE         576
+#define MAX_RESERVOIR   511
+#define MAX_FRAME       1441
+#define MAIN_PAD        16
+#define MAIN_SIZE       (MAX_RESERVOIR + MAX_FRAME + MAIN_PAD)
+
+/* Layer III bitrates in kbps, MPEG-1 and MPEG-2/2.5 */
+static const int bitrates[2][15] = {
+	{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+	{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+};
+
+static const int sample_rates[9] = {
+	44100, 48000, 32000,    /* MPEG-1 */
+	22050, 24000, 16000,    /* MPEG-2 */
+	11025, 12000, 8000,     /* MPEG-2.5 */
+};
+
+/* Scalefactor band boundaries per sample rate */
+static const uint16_t long_bounds[9][23] = {
+	{ 0, 4, 8, 12, 16, 20, 24, 30, 36, 44, 52, 62, 74, 90, 110, 134,
+	  162, 196, 238, 288, 342, 418, 576 },
+	{ 0, 4, 8, 12, 16, 20, 24, 30, 36, 42, 50, 60, 72, 88, 106, 128,
+	  156, 190, 230, 276, 330, 384, 576 },
+	{ 0, 4, 8, 12, 16, 20, 24, 30, 36, 44, 54, 66, 82, 102, 126, 156,
+	  194, 240, 296, 364, 448, 550, 576 },
+	{ 0, 6, 12, 18, 24, 30, 36, 44, 54, 66, 80, 96, 116, 140, 168, 200,
+	  238, 284, 336, 396, 464, 522, 576 },
+	{ 0, 6, 12, 18, 24, 30, 36, 44, 54, 66, 80, 96, 114, 136, 162, 194,
+	  232, 278, 332, 394, 464, 540, 576 },
+	{ 0, 6, 12, 18, 24, 30, 36, 44, 54, 66, 80, 96, 116, 140, 168, 200,
+	  238, 284, 336, 396, 464, 522, 576 },
+	{ 0, 6, 12, 18, 24, 30, 36, 44, 54, 66, 80, 96, 116, 140, 168, 200,
+	  238, 284, 336, 396, 464, 522, 576 },
+	{ 0, 6, 12, 18, 24, 30, 36, 44, 54, 66, 80, 96, 116, 140, 168, 200,
+	  238, 284, 336, 396, 464, 522, 576 },
+	{ 0, 12, 24, 36, 48, 60, 72, 88, 108, 132, 160, 192, 232, 280, 336,
+	  400, 476, 566, 568, 570, 572, 574, 576 },
+};
+
+static const uint16_t short_bounds[9][14] = {
+	{ 0, 4, 8, 12, 16, 22, 30, 40, 52, 66, 84, 106, 136, 192 },
+	{ 0, 4, 8, 12, 16, 22, 28, 38, 50, 64, 80, 100, 126, 192 },
+	{ 0, 4, 8, 12, 16, 22, 30, 42, 58, 78, 104, 138, 180, 192 },
+	{ 0, 4, 8, 12, 18, 24, 32, 42, 56, 74, 100, 132, 174, 192 },
+	{ 0, 4, 8, 12, 18, 26, 36, 48, 62, 80, 104, 136, 180, 192 },
+	{ 0, 4, 8, 12, 18, 26, 36, 48, 62, 80, 104, 134, 174, 192 },
+	{ 0, 4, 8, 12, 18, 26, 36, 48, 62, 80, 104, 134, 174, 192 },
+	{ 0, 4, 8, 12, 18, 26, 36, 48, 62, 80, 104, 134, 174, 192 },
+	{ 0, 8, 16, 24, 36, 52, 72, 96, 124, 160, 162, 164, 166, 192 },
+};
+
+static const uint8_t pretab[22] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 3, 3, 3, 2, 0
+};
+
+/* MPEG-1 scalefactor bit lengths by scalefac_compress */
+static const uint8_t slen_tab[16][2] = {
+	{ 0, 0 }, { 0, 1 }, { 0, 2 }, { 0, 3 }, { 3, 0 }, { 1, 1 }, { 1, 2 },
+	{ 1, 3 }, { 2, 1 }, { 2, 2 }, { 2, 3 }, { 3, 1 }, { 3, 2 }, { 3, 3 },
+	{ 4, 2 }, { 4, 3 },
+};
+
+/* MPEG-2 scalefactors per partition: [table][long, short, mixed][part] */
+static const uint8_t lsf_sfb_count[6][3][4] = {
+	{ { 6, 5, 5, 5 }, { 9, 9, 9, 9 }, { 6, 9, 9, 9 } },
+	{ { 6, 5, 7, 3 }, { 9, 9, 12, 6 }, { 6, 9, 12, 6 } },
+	{ { 11, 10, 0, 0 }, { 18, 18, 0, 0 }, { 15, 18, 0, 0 } },
+	{ { 7, 7, 7, 0 }, { 12, 12, 12, 0 }, { 6, 15, 12, 0 } },
+	{ { 6, 6, 6, 3 }, { 12, 9, 9, 6 }, { 6, 12, 9, 6 } },
+	{ { 8, 8, 5, 0 }, { 15, 12, 9, 0 }, { 6, 18, 9, 0 } },
+};
+
+/* Alias reduction coefficients */
+static const float alias_c[8] = {
+	-0.6f, -0.535f, -0.33f, -0.185f, -0.095f, -0.041f, -0.0142f, -0.0037f
+};
+
+/*
+ * Huffman code tables (ISO 11172-3 table B.7): code and length of each
+ * (x, y) pair, row-major in x. Tables 4 and 14 don't exist; 17-23 and
+ * 25-31 are 16 and 24 with linbits.
+ */
+static const uint16_t hc1[4] = {
+	1, 1,
+	1, 0,
+};
+
+static const uint8_t hl1[4] = {
+	1, 3,
+	2, 3,
+};
+
+static const uint16_t hc2[9] = {
+	1, 2, 1,
+	3, 1, 1,
+	3, 2, 0,
+};
+
+static const uint8_t hl2[9] = {
+	1, 3, 6,
+	3, 3, 5,
+	5, 5, 6,
+};
+
+static const uint16_t hc3[9] = {
+	3, 2, 1,
+	1, 1, 1,
+	3, 2, 0,
+};
+
+static const uint8_t hl3[9] = {
+	2, 2, 6,
+	3, 2, 5,
+	5, 5, 6,
+};
+
+static const uint16_t hc5[16] = {
+	1, 2, 6, 5,
+	3, 1, 4, 4,
+	7, 5, 7, 1,
+	6, 1, 1, 0,
+};
+
+static const uint8_t hl5[16] = {
+	1, 3, 6, 7,
+	3, 3, 6, 7,
+	6, 6, 7, 8,
+	7, 6, 7, 8,
+};
+
+static const uint16_t hc6[16] = {
+	7, 3, 5, 1,
+	6, 2, 3, 2,
+	5, 4, 4, 1,
+	3, 3, 2, 0,
+};
+
+static const uint8_t hl6[16] = {
+	3, 3, 5, 7,
+	3, 2, 4, 5,
+	4, 4, 5, 6,
+	6, 5, 6, 7,
+};
+
+static const uint16_t hc7[36] = {
+	1, 2, 10, 19, 16, 10,
+	3, 3, 7, 10, 5, 3,
+	11, 4, 13, 17, 8, 4,
+	12, 11, 18, 15, 11, 2,
+	7, 6, 9, 14, 3, 1,
+	6, 4, 5, 3, 2, 0,
+};
+
+static const uint8_t hl7[36] = {
+	1, 3, 6, 8, 8, 9,
+	3, 4, 6, 7, 7, 8,
+	6, 5, 7, 8, 8, 9,
+	7, 7, 8, 9, 9, 9,
+	7, 7, 8, 9, 9, 10,
+	8, 8, 9, 10, 10, 10,
+};
+
+static const uint16_t hc8[36] = {
+	3, 4, 6, 18, 12, 5,
+	5, 1, 2, 16, 9, 3,
+	7, 3, 5, 14, 7, 3,
+	19, 17, 15, 13, 10, 4,
+	13, 5, 8, 11, 5, 1,
+	12, 4, 4, 1, 1, 0,
+};
+
+static const uint8_t hl8[36] = {
+	2, 3, 6, 8, 8, 9,
+	3, 2, 4, 8, 8, 8,
+	6, 4, 6, 8, 8, 9,
+	8, 8, 8, 9, 9, 10,
+	8, 7, 8, 9, 10, 10,
+	9, 8, 9, 9, 11, 11,
+};
+
+static const uint16_t hc9[36] = {
+	7, 5, 9, 14, 15, 7,
+	6, 4, 5, 5, 6, 7,
+	7, 6, 8, 8, 8, 5,
+	15, 6, 9, 10, 5, 1,
+	11, 7, 9, 6, 4, 1,
+	14, 4, 6, 2, 6, 0,
+};
+
+static const uint8_t hl9[36] = {
+	3, 3, 5, 6, 8, 9,
+	3, 3, 4, 5, 6, 8,
+	4, 4, 5, 6, 7, 8,
+	6, 5, 6, 7, 7, 8,
+	7, 6, 7, 7, 8, 9,
+	8, 7, 8, 8, 9, 9,
+};
+
+static const uint16_t hc10[64] = {
+	1, 2, 10, 23, 35, 30, 12, 17,
+	3, 3, 8, 12, 18, 21, 12, 7,
+	11, 9, 15, 21, 32, 40, 19, 6,
+	14, 13, 22, 34, 46, 23, 18, 7,
+	20, 19, 33, 47, 27, 22, 9, 3,
+	31, 22, 41, 26, 21, 20, 5, 3,
+	14, 13, 10, 11, 16, 6, 5, 1,
+	9, 8, 7, 8, 4, 4, 2, 0,
+};
+
+static const uint8_t hl10[64] = {
+	1, 3, 6, 8, 9, 9, 9, 10,
+	3, 4, 6, 7, 8, 9, 8, 8,
+	6, 6, 7, 8, 9, 10, 9, 9,
+	7, 7, 8, 9, 10, 10, 9, 10,
+	8, 8, 9, 10, 10, 10, 10, 10,
+	9, 9, 10, 10, 11, 11, 10, 11,
+	8, 8, 9, 10, 10, 10, 11, 11,
+	9, 8, 9, 10, 10, 11, 11, 11,
+};
+
+static const uint16_t hc11[64] = {
+	3, 4, 10, 24, 34, 33, 21, 15,
+	5, 3, 4, 10, 32, 17, 11, 10,
+	11, 7, 13, 18, 30, 31, 20, 5,
+	25, 11, 19, 59, 27, 18, 12, 5,
+	35, 33, 31, 58, 30, 16, 7, 5,
+	28, 26, 32, 19, 17, 15, 8, 14,
+	14, 12, 9, 13, 14, 9, 4, 1,
+	11, 4, 6, 6, 6, 3, 2, 0,
+};
+
+static const uint8_t hl11[64] = {
+	2, 3, 5, 7, 8, 9, 8, 9,
+	3, 3, 4, 6, 8, 8, 7, 8,
+	5, 5, 6, 7, 8, 9, 8, 8,
+	7, 6, 7, 9, 8, 10, 8, 9,
+	8, 8, 8, 9, 9, 10, 9, 10,
+	8, 8, 9, 10, 10, 11, 10, 11,
+	8, 7, 7, 8, 9, 10, 10, 10,
+	8, 7, 8, 9, 10, 10, 10, 10,
+};
+
+static const uint16_t hc12[64] = {
+	9, 6, 16, 33, 41, 39, 38, 26,
+	7, 5, 6, 9, 23, 16, 26, 11,
+	17, 7, 11, 14, 21, 30, 10, 7,
+	17, 10, 15, 12, 18, 28, 14, 5,
+	32, 13, 22, 19, 18, 16, 9, 5,
+	40, 17, 31, 29, 17, 13, 4, 2,
+	27, 12, 11, 15, 10, 7, 4, 1,
+	27, 12, 8, 12, 6, 3, 1, 0,
+};
+
+static const uint8_t hl12[64] = {
+	4, 3, 5, 7, 8, 9, 9, 9,
+	3, 3, 4, 5, 7, 7, 8, 8,
+	5, 4, 5, 6, 7, 8, 7, 8,
+	6, 5, 6, 6, 7, 8, 8, 8,
+	7, 6, 7, 7, 8, 8, 8, 9,
+	8, 7, 8, 8, 8, 9, 8, 9,
+	8, 7, 7, 8, 8, 9, 9, 10,
+	9, 8, 8, 9, 9, 9, 9, 10,
+};
+
+static const uint16_t hc13[256] = {
+	1, 5, 14, 21, 34, 51, 46, 71, 42, 52, 68, 52, 67, 44, 43, 19,
+	3, 4, 12, 19, 31, 26, 44, 33, 31, 24, 32, 24, 31, 35, 22, 14,
+	15, 13, 23, 36, 59, 49, 77, 65, 29, 40, 30, 40, 27, 33, 42, 16,
+	22, 20, 37, 61, 56, 79, 73, 64, 43, 76, 56, 37, 26, 31, 25, 14,
+	35, 16, 60, 57, 97, 75, 114, 91, 54, 73, 55, 41, 48, 53, 23, 24,
+	58, 27, 50, 96, 76, 70, 93, 84, 77, 58, 79, 29, 74, 49, 41, 17,
+	47, 45, 78, 74, 115, 94, 90, 79, 69, 83, 71, 50, 59, 38, 36, 15,
+	72, 34, 56, 95, 92, 85, 91, 90, 86, 73, 77, 65, 51, 44, 43, 42,
+	43, 20, 30, 44, 55, 78, 72, 87, 78, 61, 46, 54, 37, 30, 20, 16,
+	53, 25, 41, 37, 44, 59, 54, 81, 66, 76, 57, 54, 37, 18, 39, 11,
+	35, 33, 31, 57, 42, 82, 72, 80, 47, 58, 55, 21, 22, 26, 38, 22,
+	53, 25, 23, 38, 70, 60, 51, 36, 55, 26, 34, 23, 27, 14, 9, 7,
+	34, 32, 28, 39, 49, 75, 30, 52, 48, 40, 52, 28, 18, 17, 9, 5,
+	45, 21, 34, 64, 56, 50, 49, 45, 31, 19, 12, 15, 10, 7, 6, 3,
+	48, 23, 20, 39, 36, 35, 53, 21, 16, 23, 13, 10, 6, 1, 4, 2,
+	16, 15, 17, 27, 25, 20, 29, 11, 17, 12, 16, 8, 1, 1, 0, 1,
+};
+
+static const uint8_t hl13[256] = {
+	1, 4, 6, 7, 8, 9, 9, 10, 9, 10, 11, 11, 12, 12, 13, 13,
+	3, 4, 6, 7, 8, 8, 9, 9, 9, 9, 10, 10, 11, 12, 12, 12,
+	6, 6, 7, 8, 9, 9, 10, 10, 9, 10, 10, 11, 11, 12, 13, 13,
+	7, 7, 8, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11, 12, 13, 13,
+	8, 7, 9, 9, 10, 10, 11, 11, 10, 11, 11, 12, 12, 13, 13, 14,
+	9, 8, 9, 10, 10, 10, 11, 11, 11, 11, 12, 11, 13, 13, 14, 14,
+	9, 9, 10, 10, 11, 11, 11, 11, 11, 12, 12, 12, 13, 13, 14, 14,
+	10, 9, 10, 11, 11, 11, 12, 12, 12, 12, 13, 13, 13, 14, 16, 16,
+	9, 8, 9, 10, 10, 11, 11, 12, 12, 12, 12, 13, 13, 14, 15, 15,
+	10, 9, 10, 10, 11, 11, 11, 13, 12, 13, 13, 14, 14, 14, 16, 15,
+	10, 10, 10, 11, 11, 12, 12, 13, 12, 13, 14, 13, 14, 15, 16, 17,
+	11, 10, 10, 11, 12, 12, 12, 12, 13, 13, 13, 14, 15, 15, 15, 16,
+	11, 11, 11, 12, 12, 13, 12, 13, 14, 14, 15, 15, 15, 16, 16, 16,
+	12, 11, 12, 13, 13, 13, 14, 14, 14, 14, 14, 15, 16, 15, 16, 16,
+	13, 12, 12, 13, 13, 13, 15, 14, 14, 17, 15, 15, 15, 17, 16, 16,
+	12, 12, 13, 14, 14, 14, 15, 14, 15, 15, 16, 16, 19, 18, 19, 16,
+};
+
+static const uint16_t hc15[256] = {
+	7, 12, 18, 53, 47, 76, 124, 108, 89, 123, 108, 119, 107, 81, 122, 63,
+	13, 5, 16, 27, 46, 36, 61, 51, 42, 70, 52, 83, 65, 41, 59, 36,
+	19, 17, 15, 24, 41, 34, 59, 48, 40, 64, 50, 78, 62, 80, 56, 33,
+	29, 28, 25, 43, 39, 63, 55, 93, 76, 59, 93, 72, 54, 75, 50, 29,
+	52, 22, 42, 40, 67, 57, 95, 79, 72, 57, 89, 69, 49, 66, 46, 27,
+	77, 37, 35, 66, 58, 52, 91, 74, 62, 48, 79, 63, 90, 62, 40, 38,
+	125, 32, 60, 56, 50, 92, 78, 65, 55, 87, 71, 51, 73, 51, 70, 30,
+	109, 53, 49, 94, 88, 75, 66, 122, 91, 73, 56, 42, 64, 44, 21, 25,
+	90, 43, 41, 77, 73, 63, 56, 92, 77, 66, 47, 67, 48, 53, 36, 20,
+	71, 34, 67, 60, 58, 49, 88, 76, 67, 106, 71, 54, 38, 39, 23, 15,
+	109, 53, 51, 47, 90, 82, 58, 57, 48, 72, 57, 41, 23, 27, 62, 9,
+	86, 42, 40, 37, 70, 64, 52, 43, 70, 55, 42, 25, 29, 18, 11, 11,
+	118, 68, 30, 55, 50, 46, 74, 65, 49, 39, 24, 16, 22, 13, 14, 7,
+	91, 44, 39, 38, 34, 63, 52, 45, 31, 52, 28, 19, 14, 8, 9, 3,
+	123, 60, 58, 53, 47, 43, 32, 22, 37, 24, 17, 12, 15, 10, 2, 1,
+	71, 37, 34, 30, 28, 20, 17, 26, 21, 16, 10, 6, 8, 6, 2, 0,
+};
+
+static const uint8_t hl15[256] = {
+	3, 4, 5, 7, 7, 8, 9, 9, 9, 10, 10, 11, 11, 11, 12, 13,
+	4, 3, 5, 6, 7, 7, 8, 8, 8, 9, 9, 10, 10, 10, 11, 11,
+	5, 5, 5, 6, 7, 7, 8, 8, 8, 9, 9, 10, 10, 11, 11, 11,
+	6, 6, 6, 7, 7, 8, 8, 9, 9, 9, 10, 10, 10, 11, 11, 11,
+	7, 6, 7, 7, 8, 8, 9, 9, 9, 9, 10, 10, 10, 11, 11, 11,
+	8, 7, 7, 8, 8, 8, 9, 9, 9, 9, 10, 10, 11, 11, 11, 12,
+	9, 7, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 11, 11, 12, 12,
+	9, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 10, 11, 11, 11, 12,
+	9, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 12, 12, 12,
+	9, 8, 9, 9, 9, 9, 10, 10, 10, 11, 11, 11, 11, 12, 12, 12,
+	10, 9, 9, 9, 10, 10, 10, 10, 10, 11, 11, 11, 11, 12, 13, 12,
+	10, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11, 12, 12, 12, 13,
+	11, 10, 9, 10, 10, 10, 11, 11, 11, 11, 11, 11, 12, 12, 13, 13,
+	11, 10, 10, 10, 10, 11, 11, 11, 11, 12, 12, 12, 12, 12, 13, 13,
+	12, 11, 11, 11, 11, 11, 11, 11, 12, 12, 12, 12, 13, 13, 12, 13,
+	12, 11, 11, 11, 11, 11, 11, 12, 12, 12, 12, 12, 13, 13, 13, 13,
+};
+
+static const uint16_t hc16[256] = {
+	1, 5, 14, 44, 74, 63, 110, 93, 172, 149, 138, 242, 225, 195, 376, 17,
+	3, 4, 12, 20, 35, 62, 53, 47, 83, 75, 68, 119, 201, 107, 207, 9,
+	15, 13, 23, 38, 67, 58, 103, 90, 161, 72, 127, 117, 110, 209, 206, 16,
+	45, 21, 39, 69, 64, 114, 99, 87, 158, 140, 252, 212, 199, 387, 365, 26,
+	75, 36, 68, 65, 115, 101, 179, 164, 155, 264, 246, 226, 395, 382, 362, 9,
+	66, 30, 59, 56, 102, 185, 173, 265, 142, 253, 232, 400, 388, 378, 445, 16,
+	111, 54, 52, 100, 184, 178, 160, 133, 257, 244, 228, 217, 385, 366, 715, 10,
+	98, 48, 91, 88, 165, 157, 148, 261, 248, 407, 397, 372, 380, 889, 884, 8,
+	85, 84, 81, 159, 156, 143, 260, 249, 427, 401, 392, 383, 727, 713, 708, 7,
+	154, 76, 73, 141, 131, 256, 245, 426, 406, 394, 384, 735, 359, 710, 352, 11,
+	139, 129, 67, 125, 247, 233, 229, 219, 393, 743, 737, 720, 885, 882, 439, 4,
+	243, 120, 118, 115, 227, 223, 396, 746, 742, 736, 721, 712, 706, 223, 436, 6,
+	202, 224, 222, 218, 216, 389, 386, 381, 364, 888, 443, 707, 440, 437, 1728, 4,
+	747, 211, 210, 208, 370, 379, 734, 723, 714, 1735, 883, 877, 876, 3459, 865, 2,
+	377, 369, 102, 187, 726, 722, 358, 711, 709, 866, 1734, 871, 3458, 870, 434, 0,
+	12, 10, 7, 11, 10, 17, 11, 9, 13, 12, 10, 7, 5, 3, 1, 3,
+};
+
+static const uint8_t hl16[256] = {
+	1, 4, 6, 8, 9, 9, 10, 10, 11, 11, 11, 12, 12, 12, 13, 9,
+	3, 4, 6, 7, 8, 9, 9, 9, 10, 10, 10, 11, 12, 11, 12, 8,
+	6, 6, 7, 8, 9, 9, 10, 10, 11, 10, 11, 11, 11, 12, 12, 9,
+	8, 7, 8, 9, 9, 10, 10, 10, 11, 11, 12, 12, 12, 13, 13, 10,
+	9, 8, 9, 9, 10, 10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 9,
+	9, 8, 9, 9, 10, 11, 11, 12, 11, 12, 12, 13, 13, 13, 14, 10,
+	10, 9, 9, 10, 11, 11, 11, 11, 12, 12, 12, 12, 13, 13, 14, 10,
+	10, 9, 10, 10, 11, 11, 11, 12, 12, 13, 13, 13, 13, 15, 15, 10,
+	10, 10, 10, 11, 11, 11, 12, 12, 13, 13, 13, 13, 14, 14, 14, 10,
+	11, 10, 10, 11, 11, 12, 12, 13, 13, 13, 13, 14, 13, 14, 13, 11,
+	11, 11, 10, 11, 12, 12, 12, 12, 13, 14, 14, 14, 15, 15, 14, 10,
+	12, 11, 11, 11, 12, 12, 13, 14, 14, 14, 14, 14, 14, 13, 14, 11,
+	12, 12, 12, 12, 12, 13, 13, 13, 13, 15, 14, 14, 14, 14, 16, 11,
+	14, 12, 12, 12, 13, 13, 14, 14, 14, 16, 15, 15, 15, 17, 15, 11,
+	13, 13, 11, 12, 14, 14, 13, 14, 14, 15, 16, 15, 17, 15, 14, 11,
+	9, 8, 8, 9, 9, 10, 10, 10, 11, 11, 11, 11, 11, 11, 11, 8,
+};
+
+static const uint16_t hc24[256] = {
+	15, 13, 46, 80, 146, 262, 248, 434, 426, 669, 653, 649, 621, 517, 1032, 88,
+	14, 12, 21, 38, 71, 130, 122, 216, 209, 198, 327, 345, 319, 297, 279, 42,
+	47, 22, 41, 74, 68, 128, 120, 221, 207, 194, 182, 340, 315, 295, 541, 18,
+	81, 39, 75, 70, 134, 125, 116, 220, 204, 190, 178, 325, 311, 293, 271, 16,
+	147, 72, 69, 135, 127, 118, 112, 210, 200, 188, 352, 323, 306, 285, 540, 14,
+	263, 66, 129, 126, 119, 114, 214, 202, 192, 180, 341, 317, 301, 281, 262, 12,
+	249, 123, 121, 117, 113, 215, 206, 195, 185, 347, 330, 308, 291, 272, 520, 10,
+	435, 115, 111, 109, 211, 203, 196, 187, 353, 332, 313, 298, 283, 531, 381, 17,
+	427, 212, 208, 205, 201, 193, 186, 177, 169, 320, 303, 286, 268, 514, 377, 16,
+	335, 199, 197, 191, 189, 181, 174, 333, 321, 305, 289, 275, 521, 379, 371, 11,
+	668, 184, 183, 179, 175, 344, 331, 314, 304, 290, 277, 530, 383, 373, 366, 10,
+	652, 346, 171, 168, 164, 318, 309, 299, 287, 276, 263, 513, 375, 368, 362, 6,
+	648, 322, 316, 312, 307, 302, 292, 284, 269, 261, 512, 376, 370, 364, 359, 4,
+	620, 300, 296, 294, 288, 282, 273, 266, 515, 380, 374, 369, 365, 361, 357, 2,
+	1033, 280, 278, 274, 267, 264, 259, 382, 378, 372, 367, 363, 360, 358, 356, 0,
+	43, 20, 19, 17, 15, 13, 11, 9, 7, 6, 4, 7, 5, 3, 1, 3,
+};
+
+static const uint8_t hl24[256] = {
+	4, 4, 6, 7, 8, 9, 9, 10, 10, 11, 11, 11, 11, 11, 12, 9,
+	4, 4, 5, 6, 7, 8, 8, 9, 9, 9, 10, 10, 10, 10, 10, 8,
+	6, 5, 6, 7, 7, 8, 8, 9, 9, 9, 9, 10, 10, 10, 11, 7,
+	7, 6, 7, 7, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 7,
+	8, 7, 7, 8, 8, 8, 8, 9, 9, 9, 10, 10, 10, 10, 11, 7,
+	9, 7, 8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 10, 7,
+	9, 8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 10, 11, 7,
+	10, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 10, 11, 11, 8,
+	10, 9, 9, 9, 9, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 8,
+	10, 9, 9, 9, 9, 9, 9, 10, 10, 10, 10, 10, 11, 11, 11, 8,
+	11, 9, 9, 9, 9, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 8,
+	11, 10, 9, 9, 9, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 8,
+	11, 10, 10, 10, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 8,
+	11, 10, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 11, 11, 8,
+	12, 10, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 11, 11, 11, 8,
+	8, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 4,
+};
+
+static const uint16_t hcA[16] = {
+	1, 5, 4, 5, 6, 5, 4, 4,
+	7, 3, 6, 0, 7, 2, 3, 1,
+};
+
+static const uint8_t hlA[16] = {
+	1, 4, 4, 5, 4, 6, 5, 6,
+	4, 5, 5, 6, 5, 6, 6, 6,
+};
+static const float synth_win_half[257] = {
+	0.000000000f, -0.000015259f, -0.000015259f, -0.000015259f,
+	-0.000015259f, -0.000015259f, -0.000015259f, -0.000030518f,
+	-0.000030518f, -0.000030518f, -0.000030518f, -0.000045776f,
+	-0.000045776f, -0.000061035f, -0.000061035f, -0.000076294f,
+	-0.000076294f, -0.000091553f, -0.000106812f, -0.000106812f,
+	-0.000122070f, -0.000137329f, -0.000152588f, -0.000167847f,
+	-0.000198364f, -0.000213623f, -0.000244141f, -0.000259399f,
+	-0.000289917f, -0.000320435f, -0.000366211f, -0.000396729f,
+	-0.000442505f, -0.000473022f, -0.000534058f, -0.000579834f,
+	-0.000625610f, -0.000686646f, -0.000747681f, -0.000808716f,
+	-0.000885010f, -0.000961304f, -0.001037598f, -0.001113892f,
+	-0.001205444f, -0.001296997f, -0.001388550f, -0.001480103f,
+	-0.001586914f, -0.001693726f, -0.001785278f, -0.001907349f,
+	-0.002014160f, -0.002120972f, -0.002243042f, -0.002349854f,
+	-0.002456665f, -0.002578735f, -0.002685547f, -0.002792358f,
+	-0.002899170f, -0.002990723f, -0.003082275f, -0.003173828f,
+	0.003250122f, 0.003326416f, 0.003387451f, 0.003433228f,
+	0.003463745f, 0.003479004f, 0.003479004f, 0.003463745f,
+	0.003417969f, 0.003372192f, 0.003280640f, 0.003173828f,
+	0.003051758f, 0.002883911f, 0.002700806f, 0.002487183f,
+	0.002227783f, 0.001937866f, 0.001617432f, 0.001266479f,
+	0.000869751f, 0.000442505f, -0.000030518f, -0.000549316f,
+	-0.001098633f, -0.001693726f, -0.002334595f, -0.003005981f,
+	-0.003723145f, -0.004486084f, -0.005294800f, -0.006118774f,
+	-0.007003784f, -0.007919312f, -0.008865356f, -0.009841919f,
+	-0.010848999f, -0.011886597f, -0.012939453f, -0.014022827f,
+	-0.015121460f, -0.016235352f, -0.017349243f, -0.018463135f,
+	-0.019577026f, -0.020690918f, -0.021789551f, -0.022857666f,
+	-0.023910522f, -0.024932861f, -0.025909424f, -0.026840210f,
+	-0.027725220f, -0.028533936f, -0.029281616f, -0.029937744f,
+	-0.030532837f, -0.031005859f, -0.031387329f, -0.031661987f,
+	-0.031814575f, -0.031845093f, -0.031738281f, -0.031478882f,
+	0.031082153f, 0.030517578f, 0.029785156f, 0.028884888f,
+	0.027801514f, 0.026535034f, 0.025085449f, 0.023422241f,
+	0.021575928f, 0.019531250f, 0.017257690f, 0.014801025f,
+	0.012115479f, 0.009231567f, 0.006134033f, 0.002822876f,
+	-0.000686646f, -0.004394531f, -0.008316040f, -0.012420654f,
+	-0.016708374f, -0.021179199f, -0.025817871f, -0.030609131f,
+	-0.035552979f, -0.040634155f, -0.045837402f, -0.051132202f,
+	-0.056533813f, -0.061996460f, -0.067520142f, -0.073059082f,
+	-0.078628540f, -0.084182739f, -0.089706421f, -0.095169067f,
+	-0.100540161f, -0.105819702f, -0.110946655f, -0.115921021f,
+	-0.120697021f, -0.125259399f, -0.129562378f, -0.133590698f,
+	-0.137298584f, -0.140670776f, -0.143676758f, -0.146255493f,
+	-0.148422241f, -0.150115967f, -0.151306152f, -0.151962280f,
+	-0.152069092f, -0.151596069f, -0.150497437f, -0.148773193f,
+	-0.146362305f, -0.143264771f, -0.139450073f, -0.134887695f,
+	-0.129577637f, -0.123474121f, -0.116577148f, -0.108856201f,
+	0.100311279f, 0.090927124f, 0.080688477f, 0.069595337f,
+	0.057617187f, 0.044784546f, 0.031082153f, 0.016510010f,
+	0.001068115f, -0.015228271f, -0.032379150f, -0.050354004f,
+	-0.069168091f, -0.088775635f, -0.109161377f, -0.130310059f,
+	-0.152206421f, -0.174789429f, -0.198059082f, -0.221984863f,
+	-0.246505737f, -0.271591187f, -0.297210693f, -0.323318481f,
+	-0.349868774f, -0.376800537f, -0.404083252f, -0.431655884f,
+	-0.459472656f, -0.487472534f, -0.515609741f, -0.543823242f,
+	-0.572036743f, -0.600219727f, -0.628295898f, -0.656219482f,
+	-0.683914185f, -0.711318970f, -0.738372803f, -0.765029907f,
+	-0.791213989f, -0.816864014f, -0.841949463f, -0.866363525f,
+	-0.890090942f, -0.913055420f, -0.935195923f, -0.956481934f,
+	-0.976852417f, -0.996246338f, -1.014617920f, -1.031936646f,
+	-1.048156738f, -1.063217163f, -1.077117920f, -1.089782715f,
+	-1.101211548f, -1.111373901f, -1.120223999f, -1.127746582f,
+	-1.133926392f, -1.138763428f, -1.142211914f, -1.144287109f,
+	1.144989014f,
+};
+
+struct huff_src {
+	const uint16_t *codes;
+	const uint8_t *lens;
+	int dim;
+};
+
+/* Indexed by table number; count1 table A is slot 17 */
+#define HUFF_COUNT1 17
+
+static const struct huff_src huff_src[25] = {
+	[1] = { hc1, hl1, 2 },    [2] = { hc2, hl2, 3 },
+	[3] = { hc3, hl3, 3 },    [5] = { hc5, hl5, 4 },
+	[6] = { hc6, hl6, 4 },    [7] = { hc7, hl7, 6 },
+	[8] = { hc8, hl8, 6 },    [9] = { hc9, hl9, 6 },
+	[10] = { hc10, hl10, 8 }, [11] = { hc11, hl11, 8 },
+	[12] = { hc12, hl12, 8 }, [13] = { hc13, hl13, 16 },
+	[15] = { hc15, hl15, 16 }, [16] = { hc16, hl16, 16 },
+	[HUFF_COUNT1] = { hcA, hlA, 0 },
+	[24] = { hc24, hl24, 16 },
+};
+
+/* table_select -> code table and linbits */
+static const uint8_t huff_select[32][2] = {
+	{ 0, 0 }, { 1, 0 }, { 2, 0 }, { 3, 0 }, { 0, 0 }, { 5, 0 }, { 6, 0 },
+	{ 7, 0 }, { 8, 0 }, { 9, 0 }, { 10, 0 }, { 11, 0 }, { 12, 0 },
+	{ 13, 0 }, { 0, 0 }, { 15, 0 }, { 16, 1 }, { 16, 2 }, { 16, 3 },
+	{ 16, 4 }, { 16, 6 }, { 16, 8 }, { 16, 10 }, { 16, 13 }, { 24, 4 },
+	{ 24, 5 }, { 24, 6 }, { 24, 7 }, { 24, 8 }, { 24, 9 }, { 24, 11 },
+	{ 24, 13 },
+};
+
+/*
+ * Lookup tables, built once. Each code table gets a root table indexed
+ * by its next (up to) 8 bits, with subtables for longer codes. An
+ * entry is either a leaf, 0x8000 | bits used at this level << 8 | value
+ * (x << 4 | y, or vwxy for count1), or a link, (subtable bits - 1) <<
+ * 12 | subtable offset from the table's base.
+ */
+#define HUFF_LUT_SIZE   5120
+#define HUFF_LEAF       0x8000
+
+static uint16_t huff_lut[HUFF_LUT_SIZE];
+static uint16_t huff_base[25];
+static uint8_t huff_root[25];
+
+static float pow43_tab[1024];
+static float imdct_long[4][18][36];     /* by block type; 2 unused */
+static float imdct_short[6][12];
+static float dct_tab[32][32];
+static float synth_win[512];            /* scaled to 16-bit output */
+static float alias_cs[8], alias_ca[8];
+static float is_ratio[7][2];            /* MPEG-1 intensity positions */
+
+static int huff_build(const struct huff_src *t, uint16_t *lut, int at,
+		      int bits, uint32_t prefix, int plen, int *used, int cap)
+{
+	int i, j, n = t->dim ? t->dim * t->dim : 16;
+	int len, rest, first, w, sub;
+	unsigned int value;
+	uint32_t code;
+
+	for (i = 0; i < n; i++) {
+		len = t->lens[i];
+		code = t->codes[i];
+		if (len <= plen || (code >> (len - plen)) != prefix)
+			continue;
+
+		rest = len - plen;
+		if (rest > bits) {
+			/* Remember the longest code under this entry */
+			j = (code >> (rest - bits)) & ((1u << bits) - 1);
+			if (rest - bits > lut[at + j])
+				lut[at + j] = (uint16_t)(rest - bits);
+			continue;
+		}
+
+		value = t->dim ? (unsigned int)(i / t->dim) << 4 | i % t->dim :
+			(unsigned int)i;
+		first = (int)(code & ((1u << rest) - 1)) << (bits - rest);
+		for (j = 0; j < 1 << (bits - rest); j++)
+			lut[at + first + j] = (uint16_t)(HUFF_LEAF | rest << 8 |
+							 value);
+	}
+
+	for (j = 0; j < 1 << bits; j++) {
+		if (lut[at + j] == 0 || (lut[at + j] & HUFF_LEAF))
+			continue;
+		w = lut[at + j] > 8 ? 8 : lut[at + j];
+		sub = *used;
+		*used += 1 << w;
+		if (*used > cap)
+			return -1;
+		lut[at + j] = (uint16_t)((w - 1) << 12 | sub);
+		if (huff_build(t, lut, sub, w, prefix << bits | (uint32_t)j,
+			       plen + bits, used, cap) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void build_tables(void)
+{
+	int t, i, k, bt, used, cap, maxlen, base = 0;
+	double w;
+
+	for (t = 0; t < 25; t++) {
+		const struct huff_src *src = &huff_src[t];
+		int n;
+
+		if (!src->codes)
+			continue;
+		n = src->dim ? src->dim * src->dim : 16;
+		for (i = 0, maxlen = 0; i < n; i++)
+			if (src->lens[i] > maxlen)
+				maxlen = src->lens[i];
+
+		huff_base[t] = (uint16_t)base;
+		huff_root[t] = (uint8_t)(maxlen > 8 ? 8 : maxlen);
+		used = 1 << huff_root[t];
+		/* Offsets are 12 bits */
+		cap = HUFF_LUT_SIZE - base < 4096 ? HUFF_LUT_SIZE - base : 4096;
+		if (used > cap || huff_build(src, huff_lut + base, 0,
+					     huff_root[t], 0, 0, &used, cap) < 0)
+			abort();
+		base += used;
+	}
+
+	for (i = 0; i < 1024; i++)
+		pow43_tab[i] = (float)pow(i, 4.0 / 3.0);
+
+	/* 36-point IMDCT with each block type's window folded in */
+	for (bt = 0; bt < 4; bt++) {
+		for (i = 0; i < 36; i++) {
+			if (bt == 0 || (bt == 1 && i < 18) || (bt == 3 && i >= 18))
+				w = sin(M_PI / 36 * (i + 0.5));
+			else if ((bt == 1 && i < 24) || (bt == 3 && i >= 12))
+				w = 1;
+			else if (bt == 1 && i < 30)
+				w = sin(M_PI / 12 * (i - 18 + 0.5));
+			else if (bt == 3 && i >= 6)
+				w = sin(M_PI / 12 * (i - 6 + 0.5));
+			else
+				w = 0;
+			for (k = 0; k < 18; k++)
+				imdct_long[bt][k][i] = (float)(w *
+					cos(M_PI / 72 * (2 * i + 19) * (2 * k + 1)));
+		}
+	}
+
+	for (i = 0; i < 12; i++)
+		for (k = 0; k < 6; k++)
+			imdct_short[k][i] = (float)(sin(M_PI / 12 * (i + 0.5)) *
+				cos(M_PI / 24 * (2 * i + 7) * (2 * k + 1)));
+
+	/* Synthesis matrixing: the 64 V values are A[16..32] and sign
+	 * flipped mirrors of A[0..31] */
+	for (k = 0; k < 32; k++)
+		for (i = 0; i < 32; i++)
+			dct_tab[k][i] = (float)cos(M_PI / 64 * i * (2 * k + 1));
+
+	for (i = 0; i <= 256; i++)
+		synth_win[i] = synth_win_half[i] * 32768.0f;
+	for (i = 1; i < 256; i++)
+		synth_win[512 - i] = i % 64 ? -synth_win[i] : synth_win[i];
+
+	for (i = 0; i < 8; i++) {
+		w = sqrt(1.0 + alias_c[i] * alias_c[i]);
+		alias_cs[i] = (float)(1.0 / w);
+		alias_ca[i] = (float)(alias_c[i] / w);
+	}
+
+	/* tan(p * pi / 12) / (1 + tan) and 1 / (1 + tan) */
+	for (i = 0; i < 7; i++) {
+		double s = sin(M_PI / 12 * i), c = cos(M_PI / 12 * i);
+
+		is_ratio[i][0] = (float)(s / (s + c));
+		is_ratio[i][1] = (float)(c / (s + c));
+	}
+}
+
+#ifdef HAVE_PTHREAD
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+#else
+static int tables_ready;
+#endif
+
+static void init_tables(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_once(&tables_once, build_tables);
+#else
+	if (!tables_ready) {
+		build_tables();
+		tables_ready = 1;
+	}
+#endif
+}
+
+/*
+ * DSP kernels, scalar and SSE
+ */
+static void imdct36_c(const float *x, const float *t, float *out)
+{
+	int k, i;
+
+	for (i = 0; i < 36; i++)
+		out[i] = 0;
+	for (k = 0; k < 18; k++, t += 36)
+		for (i = 0; i < 36; i++)
+			out[i] += x[k] * t[i];
+}
+
+static void imdct12_c(const float *x, const float *t, float *out)
+{
+	int k, i;
+
+	for (i = 0; i < 12; i++)
+		out[i] = 0;
+	for (k = 0; k < 6; k++, t += 12)
+		for (i = 0; i < 12; i++)
+			out[i] += x[k] * t[i];
+}
+
+static void dct32_c(const float *s, float *a)
+{
+	const float *t = dct_tab[0];
+	int k, i;
+
+	for (i = 0; i < 32; i++)
+		a[i] = 0;
+	for (k = 0; k < 32; k++, t += 32)
+		for (i = 0; i < 32; i++)
+			a[i] += s[k] * t[i];
+}
+
+/* out[j] = sum over the last 16 V vectors, alternating halves */
+static void window_c(float (*v)[64], int pos, float *out)
+{
+	const float *a, *b, *d;
+	int i, j;
+
+	for (j = 0; j < 32; j++)
+		out[j] = 0;
+	for (i = 0; i < 8; i++) {
+		a = v[(pos + 2 * i) & 15];
+		b = v[(pos + 2 * i + 1) & 15] + 32;
+		d = synth_win + 64 * i;
+		for (j = 0; j < 32; j++)
+			out[j] += a[j] * d[j] + b[j] * d[32 + j];
+	}
+}
+
+#ifdef MP3_SSE
+static void imdct36_sse(const float *x, const float *t, float *out)
+{
+	__m128 acc[9], xk;
+	int k, i;
+
+	for (i = 0; i < 9; i++)
+		acc[i] = _mm_setzero_ps();
+	for (k = 0; k < 18; k++, t += 36) {
+		xk = _mm_set1_ps(x[k]);
+		for (i = 0; i < 9; i++)
+			acc[i] = _mm_add_ps(acc[i],
+					    _mm_mul_ps(xk, _mm_loadu_ps(t + 4 * i)));
+	}
+	for (i = 0; i < 9; i++)
+		_mm_storeu_ps(out + 4 * i, acc[i]);
+}
+
+static void imdct12_sse(const float *x, const float *t, float *out)
+{
+	__m128 a0 = _mm_setzero_ps(), a1 = a0, a2 = a0, xk;
+	int k;
+
+	for (k = 0; k < 6; k++, t += 12) {
+		xk = _mm_set1_ps(x[k]);
+		a0 = _mm_add_ps(a0, _mm_mul_ps(xk, _mm_loadu_ps(t)));
+		a1 = _mm_add_ps(a1, _mm_mul_ps(xk, _mm_loadu_ps(t + 4)));
+		a2 = _mm_add_ps(a2, _mm_mul_ps(xk, _mm_loadu_ps(t + 8)));
+	}
+	_mm_storeu_ps(out, a0);
+	_mm_storeu_ps(out + 4, a1);
+	_mm_storeu_ps(out + 8, a2);
+}
+
+static void dct32_sse(const float *s, float *a)
+{
+	const float *t = dct_tab[0];
+	__m128 acc[8], sk;
+	int k, i;
+
+	for (i = 0; i < 8; i++)
+		acc[i] = _mm_setzero_ps();
+	for (k = 0; k < 32; k++, t += 32) {
+		sk = _mm_set1_ps(s[k]);
+		for (i = 0; i < 8; i++)
+			acc[i] = _mm_add_ps(acc[i],
+					    _mm_mul_ps(sk, _mm_loadu_ps(t + 4 * i)));
+	}
+	for (i = 0; i < 8; i++)
+		_mm_storeu_ps(a + 4 * i, acc[i]);
+}
+
+static void window_sse(float (*v)[64], int pos, float *out)
+{
+	const float *a, *b, *d;
+	__m128 acc[8];
+	int i, j;
+
+	for (j = 0; j < 8; j++)
+		acc[j] = _mm_setzero_ps();
+	for (i = 0; i < 8; i++) {
+		a = v[(pos + 2 * i) & 15];
+		b = v[(pos + 2 * i + 1) & 15] + 32;
+		d = synth_win + 64 * i;
+		for (j = 0; j < 8; j++) {
+			acc[j] = _mm_add_ps(acc[j],
+				_mm_mul_ps(_mm_loadu_ps(a + 4 * j),
+					   _mm_loadu_ps(d + 4 * j)));
+			acc[j] = _mm_add_ps(acc[j],
+				_mm_mul_ps(_mm_loadu_ps(b + 4 * j),
+					   _mm_loadu_ps(d + 32 + 4 * j)));
+		}
+	}
+	for (j = 0; j < 8; j++)
+		_mm_storeu_ps(out + 4 * j, acc[j]);
+}
+#endif /* MP3_SSE */
+
+/*
+ * Decoder state
+ */
+struct mp3_header {
+	int lsf;                /* MPEG-2/2.5: one granule per frame */
+	int crc;
+	int bitrate;
+	int sr_index;           /* into sample_rates and the band tables */
+	int mode;               /* 0 stereo, 1 joint, 2 dual, 3 mono */
+	int mode_ext;
+	int channels;
+	int frame_bytes;
+};
+
+struct granule {
+	int part2_3_length;
+	int big_values;
+	int global_gain;
+	int scalefac_compress;
+	int block_type;         /* 0 normal, 1 start, 2 short, 3 stop */
+	int mixed;
+	int table_select[3];
+	int subblock_gain[3];
+	int region1_start;      /* in lines */
+	int region2_start;
+	int preflag;
+	int scalefac_scale;
+	int count1table;
+};
+
+struct side_info {
+	int main_data_begin;
+	int scfsi[2];
+	struct granule gr[2][2];
+};
+
+/* Scalefactor bands of a granule in bitstream order */
+struct band_list {
+	int n;
+	uint8_t width[39];
+	uint8_t win[39];        /* short window, or 3 for a long band */
+	uint8_t sfb[39];
+};
+
+struct bits {
+	const uint8_t *p;
+	size_t pos;             /* in bits */
+	size_t limit;
+};
+
+struct mux_mp3dec {
+	int flags;
+	void (*imdct36)(const float *x, const float *t, float *out);
+	void (*imdct12)(const float *x, const float *t, float *out);
+	void (*dct32)(const float *s, float *a);
+	void (*window)(float (*v)[64], int pos, float *out);
+
+	/* First decoded frame's version and rate; later headers must match */
+	int locked;
+	int lock_lsf;
+	int lock_sr;
+	size_t skip;            /* rest of an ID3v2 tag */
+
+	/* Bit reservoir, followed by the current frame's main data */
+	uint8_t main[MAIN_SIZE];
+	size_t main_len;
+
+	uint8_t scf_prev[2][22];        /* granule 0, for scfsi */
+	float overlap[2][32][18];
+	float v[2][16][64];
+	int vpos[2];
+
+	/* Per-granule scratch */
+	int ix[GRANULE];
+	float xr[2][GRANULE];
+	float sb[2][18][32];
+};
+
+static unsigned int peek_bits(const struct bits *b, int n)
+{
+	const uint8_t *q = b->p + (b->pos >> 3);
+	uint32_t v = (uint32_t)q[0] << 24 | (uint32_t)q[1] << 16 |
+		     (uint32_t)q[2] << 8 | q[3];
+
+	return (v << (b->pos & 7)) >> (32 - n);
+}
+
+static unsigned int get_bits(struct bits *b, int n)
+{
+	unsigned int v;
+
+	if (n == 0)
+		return 0;
+	v = peek_bits(b, n);
+	b->pos += (size_t)n;
+	return v;
+}
+
+static unsigned int huff_decode(struct bits *b, int table)
+{
+	const uint16_t *lut = huff_lut + huff_base[table];
+	int w = huff_root[table];
+	unsigned int e = lut[peek_bits(b, w)];
+
+	while (!(e & HUFF_LEAF)) {
+		b->pos += (size_t)w;
+		w = (int)(e >> 12) + 1;
+		e = lut[(e & 0xfff) + peek_bits(b, w)];
+	}
+	b->pos += (e >> 8) & 0xf;
+	return e & 0xff;
+}
+
+static int parse_header(const uint8_t *p, struct mp3_header *h)
+{
+	int ver, br, sr;
+
+	/* Sync, not the reserved version, Layer III */
+	if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0 ||
+	    ((p[1] >> 3) & 3) == 1 || ((p[1] >> 1) & 3) != 1)
+		return 0;
+
+	/* Free format and the reserved rate aren't supported */
+	br = p[2] >> 4;
+	sr = (p[2] >> 2) & 3;
+	if (br == 0 || br == 15 || sr == 3)
+		return 0;
+
+	ver = (p[1] >> 3) & 3;
+	h->lsf = ver != 3;
+	h->crc = !(p[1] & 1);
+	h->bitrate = bitrates[h->lsf][br];
+	h->sr_index = (ver == 3 ? 0 : ver == 2 ? 3 : 6) + sr;
+	h->mode = p[3] >> 6;
+	h->mode_ext = (p[3] >> 4) & 3;
+	h->channels = h->mode == 3 ? 1 : 2;
+	h->frame_bytes = (h->lsf ? 72 : 144) * h->bitrate * 1000 /
+			 sample_rates[h->sr_index] + ((p[2] >> 1) & 1);
+	return 1;
+}
+
+static int side_info_size(const struct mp3_header *h)
+{
+	if (h->lsf)
+		return h->channels == 1 ? 9 : 17;
+	return h->channels == 1 ? 17 : 32;
+}
+
+static int read_side_info(struct bits *b, const struct mp3_header *h,
+			  struct side_info *si)
+{
+	const uint16_t *lb = long_bounds[h->sr_index];
+	const uint16_t *sb = short_bounds[h->sr_index];
+	int ngr = h->lsf ? 1 : 2, nch = h->channels;
+	int gr, ch, i, r0, r1;
+
+	si->main_data_begin = (int)get_bits(b, h->lsf ? 8 : 9);
+	if (h->lsf)
+		b->pos += nch == 1 ? 1 : 2;
+	else
+		b->pos += nch == 1 ? 5 : 3;
+	for (ch = 0; ch < nch; ch++)
+		si->scfsi[ch] = h->lsf ? 0 : (int)get_bits(b, 4);
+
+	for (gr = 0; gr < ngr; gr++) {
+		for (ch = 0; ch < nch; ch++) {
+			struct granule *g = &si->gr[gr][ch];
+
+			g->part2_3_length = (int)get_bits(b, 12);
+			g->big_values = (int)get_bits(b, 9);
+			g->global_gain = (int)get_bits(b, 8);
+			g->scalefac_compress = (int)get_bits(b, h->lsf ? 9 : 4);
+			if (g->big_values > GRANULE / 2)
+				return -1;
+
+			if (get_bits(b, 1)) {
+				g->block_type = (int)get_bits(b, 2);
+				g->mixed = (int)get_bits(b, 1);
+				if (g->block_type == 0)
+					return -1;
+				for (i = 0; i < 2; i++)
+					g->table_select[i] = (int)get_bits(b, 5);
+				g->table_select[2] = 0;
+				for (i = 0; i < 3; i++)
+					g->subblock_gain[i] = (int)get_bits(b, 3);
+
+				/* Implicit region split: three short bands,
+				 * or eight long ones */
+				if (g->block_type == 2 && !g->mixed)
+					g->region1_start = 3 * sb[3];
+				else
+					g->region1_start = lb[8];
+				g->region2_start = GRANULE;
+			} else {
+				g->block_type = 0;
+				g->mixed = 0;
+				for (i = 0; i < 3; i++)
+					g->table_select[i] = (int)get_bits(b, 5);
+				g->subblock_gain[0] = g->subblock_gain[1] =
+					g->subblock_gain[2] = 0;
+				r0 = (int)get_bits(b, 4);
+				r1 = (int)get_bits(b, 3);
+				g->region1_start = lb[r0 + 1];
+				g->region2_start = lb[r0 + r1 + 2 > 22 ? 22 :
+						      r0 + r1 + 2];
+			}
+
+			g->preflag = h->lsf ? 0 : (int)get_bits(b, 1);
+			g->scalefac_scale = (int)get_bits(b, 1);
+			g->count1table = (int)get_bits(b, 1);
+		}
+	}
+
+	return 0;
+}
+
+static void build_bands(struct band_list *bl, const struct mp3_header *h,
+			const struct granule *g)
+{
+	const uint16_t *lb = long_bounds[h->sr_index];
+	const uint16_t *sb = short_bounds[h->sr_index];
+	int s, w, n = 0, first_short = 0;
+
+	if (g->block_type != 2) {
+		for (s = 0; s < 22; s++, n++) {
+			bl->width[n] = (uint8_t)(lb[s + 1] - lb[s]);
+			bl->win[n] = 3;
+			bl->sfb[n] = (uint8_t)s;
+		}
+		bl->n = n;
+		return;
+	}
+
+	/* Mixed blocks: long bands up to line 36 (72 at 8 kHz), then
+	 * short bands from 3 */
+	if (g->mixed) {
+		for (s = 0; s < (h->lsf ? 6 : 8); s++, n++) {
+			bl->width[n] = (uint8_t)(lb[s + 1] - lb[s]);
+			bl->win[n] = 3;
+			bl->sfb[n] = (uint8_t)s;
+		}
+		first_short = 3;
+	}
+	for (s = first_short; s < 13; s++) {
+		for (w = 0; w < 3; w++, n++) {
+			bl->width[n] = (uint8_t)(sb[s + 1] - sb[s]);
+			bl->win[n] = (uint8_t)w;
+			bl->sfb[n] = (uint8_t)s;
+		}
+	}
+	bl->n = n;
+}
+
+static void read_scf_mpeg1(struct bits *b, const struct granule *g, int gr,
+			   int scfsi, uint8_t *scf, uint8_t *prev)
+{
+	static const uint8_t groups[5] = { 0, 6, 11, 16, 21 };
+	int s1 = slen_tab[g->scalefac_compress][0];
+	int s2 = slen_tab[g->scalefac_compress][1];
+	int i, k, n1;
+
+	memset(scf, 0, 39);
+	if (g->block_type == 2) {
+		n1 = g->mixed ? 17 : 18;
+		for (i = 0; i < n1; i++)
+			scf[i] = (uint8_t)get_bits(b, s1);
+		for (i = 0; i < 18; i++)
+			scf[n1 + i] = (uint8_t)get_bits(b, s2);
+		return;
+	}
+
+	for (k = 0; k < 4; k++) {
+		for (i = groups[k]; i < groups[k + 1]; i++) {
+			if (gr && (scfsi >> (3 - k)) & 1)
+				scf[i] = prev[i];
+			else
+				scf[i] = (uint8_t)get_bits(b, k < 2 ? s1 : s2);
+		}
+	}
+	if (!gr)
+		memcpy(prev, scf, 22);
+}
+
+static void read_scf_lsf(struct bits *b, struct granule *g, int is_right,
+			 uint8_t *scf, uint8_t *is_max, int *is_scale)
+{
+	int kind = g->block_type == 2 ? (g->mixed ? 2 : 1) : 0;
+	int sfc = g->scalefac_compress, slen[4] = { 0 }, tab, k, i, n = 0;
+
+	if (is_right) {
+		*is_scale = sfc & 1;
+		sfc >>= 1;
+		if (sfc < 180) {
+			slen[0] = sfc / 36;
+			slen[1] = sfc % 36 / 6;
+			slen[2] = sfc % 6;
+			tab = 3;
+		} else if (sfc < 244) {
+			sfc -= 180;
+			slen[0] = sfc >> 4;
+			slen[1] = (sfc >> 2) & 3;
+			slen[2] = sfc & 3;
+			tab = 4;
+		} else {
+			sfc -= 244;
+			slen[0] = sfc / 3;
+			slen[1] = sfc % 3;
+			tab = 5;
+		}
+		g->preflag = 0;
+	} else if (sfc < 400) {
+		slen[0] = (sfc >> 4) / 5;
+		slen[1] = (sfc >> 4) % 5;
+		slen[2] = (sfc & 15) >> 2;
+		slen[3] = sfc & 3;
+		tab = 0;
+		g->preflag = 0;
+	} else if (sfc < 500) {
+		sfc -= 400;
+		slen[0] = (sfc >> 2) / 5;
+		slen[1] = (sfc >> 2) % 5;
+		slen[2] = sfc & 3;
+		tab = 1;
+		g->preflag = 0;
+	} else {
+		sfc -= 500;
+		slen[0] = sfc / 3;
+		slen[1] = sfc % 3;
+		tab = 2;
+		g->preflag = 1;
+	}
+
+	memset(scf, 0, 39);
+	memset(is_max, 0, 39);
+	for (k = 0; k < 4; k++) {
+		for (i = 0; i < lsf_sfb_count[tab][kind][k]; i++, n++) {
+			scf[n] = (uint8_t)get_bits(b, slen[k]);
+			is_max[n] = (uint8_t)((1 << slen[k]) - 1);
+		}
+	}
+}
+
+/*
+ * Big values and count1 regions into ix; returns the number of lines
+ * that may be nonzero
+ */
+static int read_huffman(struct bits *b, const struct granule *g, size_t end,
+			int *ix)
+{
+	int bounds[3], r, i = 0, t, linbits, x, y;
+	unsigned int v;
+
+	bounds[2] = g->big_values * 2;
+	bounds[0] = g->region1_start < bounds[2] ? g->region1_start : bounds[2];
+	bounds[1] = g->region2_start < bounds[2] ? g->region2_start : bounds[2];
+
+	for (r = 0; r < 3; r++) {
+		t = huff_select[g->table_select[r]][0];
+		linbits = huff_select[g->table_select[r]][1];
+		if (!t) {
+			for (; i < bounds[r]; i++)
+				ix[i] = 0;
+			continue;
+		}
+		for (; i < bounds[r]; i += 2) {
+			/* Runaway big_values in a damaged frame */
+			if (b->pos > b->limit)
+				goto out;
+			v = huff_decode(b, t);
+			x = (int)(v >> 4);
+			y = (int)(v & 15);
+			if (x == 15 && linbits)
+				x += (int)get_bits(b, linbits);
+			if (x && get_bits(b, 1))
+				x = -x;
+			if (y == 15 && linbits)
+				y += (int)get_bits(b, linbits);
+			if (y && get_bits(b, 1))
+				y = -y;
+			ix[i] = x;
+			ix[i + 1] = y;
+		}
+	}
+
+	while (i <= GRANULE - 4 && b->pos < end) {
+		int q[4], k;
+
+		if (g->count1table)
+			v = 15 - get_bits(b, 4);
+		else
+			v = huff_decode(b, HUFF_COUNT1);
+		for (k = 0; k < 4; k++) {
+			q[k] = (v >> (3 - k)) & 1;
+			if (q[k] && get_bits(b, 1))
+				q[k] = -1;
+		}
+		/* A quadruple running past part2_3_length is stuffing */
+		if (b->pos > end)
+			break;
+		for (k = 0; k < 4; k++)
+			ix[i++] = q[k];
+	}
+
+out:
+	r = i;
+	for (; i < GRANULE; i++)
+		ix[i] = 0;
+	return r;
+}
+
+static float pow43(int v)
+{
+	float f;
+
+	if (v < 1024)
+		return pow43_tab[v];
+	f = (float)v;
+	return f * cbrtf(f);
+}
+
+static void requantize(const struct granule *g, const struct band_list *bl,
+		       const uint8_t *scf, const int *ix, float *xr, int nz)
+{
+	static const float quarter[4] = {
+		1.0f, 1.18920712f, 1.41421356f, 1.68179283f
+	};
+	int shift = 1 + g->scalefac_scale, b, i = 0, end, e;
+	float scale;
+
+	for (b = 0; b < bl->n && i < nz; b++) {
+		if (bl->win[b] == 3)
+			e = g->global_gain - 210 -
+			    ((scf[b] + (g->preflag ? pretab[bl->sfb[b]] : 0))
+			     << shift);
+		else
+			e = g->global_gain - 210 -
+			    8 * g->subblock_gain[bl->win[b]] - (scf[b] << shift);
+		scale = ldexpf(quarter[e & 3], (e - (e & 3)) / 4);
+
+		end = i + bl->width[b];
+		if (end > nz)
+			end = nz;
+		for (; i < end; i++) {
+			if (ix[i] > 0)
+				xr[i] = pow43(ix[i]) * scale;
+			else if (ix[i] < 0)
+				xr[i] = -pow43(-ix[i]) * scale;
+			else
+				xr[i] = 0;
+		}
+	}
+	for (; i < GRANULE; i++)
+		xr[i] = 0;
+}
+
+static void ms_lines(float *l, float *r, int from, int to)
+{
+	float m, s;
+	int i;
+
+	for (i = from; i < to; i++) {
+		m = l[i];
+		s = r[i];
+		l[i] = (m + s) * 0.70710678f;
+		r[i] = (m - s) * 0.70710678f;
+	}
+}
+
+/*
+ * Joint stereo. Intensity coding covers the bands above the last
+ * nonzero right channel line (per window for short blocks); the bands
+ * below it, and those with an illegal position, are mid/side if that
+ * is on too.
+ */
+static void joint_stereo(const struct mp3_header *h,
+			 const struct band_list *bl, const uint8_t *scf,
+			 const uint8_t *is_max, int is_scale, float *l,
+			 float *r, int *nz)
+{
+	int ms = h->mode_ext & 2, limit = nz[0] > nz[1] ? nz[0] : nz[1];
+	uint8_t is_band[39], pos[39], bad[39];
+	int start[39], zero[3] = { 1, 1, 1 };
+	int b, i, n, allzero, last;
+	float kl, kr, io;
+
+	nz[0] = nz[1] = limit;
+	if (!(h->mode_ext & 1)) {
+		if (ms)
+			ms_lines(l, r, 0, limit);
+		return;
+	}
+
+	for (b = 0, n = 0; b < bl->n; n += bl->width[b], b++)
+		start[b] = n;
+
+	for (b = bl->n - 1; b >= 0; b--) {
+		for (i = start[b], allzero = 1; i < start[b] + bl->width[b]; i++)
+			if (r[i] != 0) {
+				allzero = 0;
+				break;
+			}
+		if (bl->win[b] < 3) {
+			is_band[b] = (uint8_t)(zero[bl->win[b]] && allzero);
+			if (!allzero)
+				zero[bl->win[b]] = 0;
+		} else {
+			is_band[b] = (uint8_t)(zero[0] && zero[1] && zero[2] &&
+					       allzero);
+			if (!allzero)
+				zero[0] = zero[1] = zero[2] = 0;
+		}
+	}
+
+	for (b = 0; b < bl->n; b++) {
+		/* The last band of each window has no scalefactor of its
+		 * own and uses the one below */
+		last = bl->win[b] == 3 ? bl->sfb[b] == 21 : bl->sfb[b] == 12;
+		if (last && b >= (bl->win[b] == 3 ? 1 : 3)) {
+			pos[b] = pos[b - (bl->win[b] == 3 ? 1 : 3)];
+			bad[b] = bad[b - (bl->win[b] == 3 ? 1 : 3)];
+		} else {
+			pos[b] = scf[b];
+			bad[b] = (uint8_t)(h->lsf ? scf[b] == is_max[b] :
+					   scf[b] == 7);
+		}
+	}
+
+	io = is_scale ? 0.70710678f : 0.84089642f;
+	for (b = 0; b < bl->n; b++) {
+		float *lb = l + start[b], *rb = r + start[b];
+		int w = bl->width[b];
+
+		if (!is_band[b] || bad[b]) {
+			if (ms)
+				ms_lines(lb, rb, 0, w);
+			continue;
+		}
+
+		if (!h->lsf) {
+			kl = is_ratio[pos[b]][0];
+			kr = is_ratio[pos[b]][1];
+		} else if (pos[b] == 0) {
+			kl = kr = 1;
+		} else if (pos[b] & 1) {
+			kl = powf(io, (float)((pos[b] + 1) / 2));
+			kr = 1;
+		} else {
+			kl = 1;
+			kr = powf(io, (float)(pos[b] / 2));
+		}
+		for (i = 0; i < w; i++) {
+			rb[i] = lb[i] * kr;
+			lb[i] *= kl;
+		}
+	}
+
+	/* Intensity bands can reach up to the left channel's last line */
+	nz[0] = nz[1] = GRANULE;
+}
+
+/* Short bands from window-major to the interleaved order the IMDCT uses */
+static void reorder(const struct mp3_header *h, const struct band_list *bl,
+		    float *xr)
+{
+	const uint16_t *sb = short_bounds[h->sr_index];
+	float tmp[GRANULE];
+	int b, i, n = 0, first = -1, w;
+
+	for (b = 0; b < bl->n; n += bl->width[b], b++) {
+		if (bl->win[b] == 3)
+			continue;
+		if (first < 0)
+			first = n;
+		w = bl->win[b];
+		for (i = 0; i < bl->width[b]; i++)
+			tmp[3 * (sb[bl->sfb[b]] + i) + w] = xr[n + i];
+	}
+	if (first >= 0)
+		memcpy(xr + first, tmp + first,
+		       (GRANULE - (size_t)first) * sizeof(float));
+}
+
+static void antialias(float *xr, int nsb)
+{
+	float *a, u, v;
+	int sb, i;
+
+	for (sb = 1; sb < nsb; sb++) {
+		a = xr + 18 * sb;
+		for (i = 0; i < 8; i++) {
+			u = a[-1 - i];
+			v = a[i];
+			a[-1 - i] = u * alias_cs[i] - v * alias_ca[i];
+			a[i] = v * alias_cs[i] + u * alias_ca[i];
+		}
+	}
+}
+
+/*
+ * IMDCT, overlap-add and frequency inversion of one channel's granule
+ * into 18 time slots of 32 subband samples
+ */
+static void hybrid(struct mux_mp3dec *d, const struct granule *g, int ch,
+		   int nsb)
+{
+	float *xr = d->xr[ch], (*out)[32] = d->sb[ch];
+	float tmp[36], y[12], x[6];
+	int sb, i, w, k, bt;
+
+	for (sb = 0; sb < 32; sb++) {
+		float *ov = d->overlap[ch][sb];
+
+		if (sb >= nsb) {
+			for (i = 0; i < 36; i++)
+				tmp[i] = 0;
+		} else if (g->block_type != 2 || (g->mixed && sb < 2)) {
+			bt = g->block_type == 2 ? 0 : g->block_type;
+			d->imdct36(xr + 18 * sb, imdct_long[bt][0], tmp);
+		} else {
+			for (i = 0; i < 36; i++)
+				tmp[i] = 0;
+			for (w = 0; w < 3; w++) {
+				for (k = 0; k < 6; k++)
+					x[k] = xr[18 * sb + 3 * k + w];
+				d->imdct12(x, imdct_short[0], y);
+				for (i = 0; i < 12; i++)
+					tmp[6 + 6 * w + i] += y[i];
+			}
+		}
+
+		for (i = 0; i < 18; i++) {
+			float s = tmp[i] + ov[i];
+
+			out[i][sb] = (sb & i & 1) ? -s : s;
+			ov[i] = tmp[18 + i];
+		}
+	}
+}
+
+/* One time slot of 32 subband samples to 32 PCM samples */
+static void synth(struct mux_mp3dec *d, int ch, const float *s, int16_t *pcm,
+		  int stride)
+{
+	float a[32], out[32], *v;
+	int i, pos;
+	long q;
+
+	d->dct32(s, a);
+
+	pos = d->vpos[ch] = (d->vpos[ch] - 1) & 15;
+	v = d->v[ch][pos];
+	for (i = 0; i < 16; i++) {
+		v[i] = a[16 + i];
+		v[48 + i] = -a[i];
+	}
+	v[16] = 0;
+	for (i = 17; i < 48; i++)
+		v[i] = -a[48 - i];
+
+	d->window(d->v[ch], pos, out);
+	for (i = 0; i < 32; i++) {
+		q = lrintf(out[i]);
+		pcm[i * stride] = (int16_t)(q > 32767 ? 32767 :
+					    q < -32768 ? -32768 : q);
+	}
+}
+
+static int decode_granule(struct mux_mp3dec *d, const struct mp3_header *h,
+			  struct side_info *si, struct bits *b, int gr,
+			  int16_t *pcm)
+{
+	struct band_list bl[2];
+	uint8_t scf[2][39], is_max[39];
+	int nch = h->channels, out_ch, ch, nz[2], nsb, i, is_scale = 0;
+	size_t end;
+
+	for (ch = 0; ch < nch; ch++) {
+		struct granule *g = &si->gr[gr][ch];
+
+		end = b->pos + (size_t)g->part2_3_length;
+		if (end > b->limit)
+			return -1;
+		build_bands(&bl[ch], h, g);
+		if (h->lsf)
+			read_scf_lsf(b, g, ch == 1 && (h->mode_ext & 1) &&
+				     h->mode == 1, scf[ch], is_max, &is_scale);
+		else
+			read_scf_mpeg1(b, g, gr, si->scfsi[ch], scf[ch],
+				       d->scf_prev[ch]);
+		if (b->pos > end)
+			return -1;
+
+		nz[ch] = read_huffman(b, g, end, d->ix);
+		requantize(g, &bl[ch], scf[ch], d->ix, d->xr[ch], nz[ch]);
+		b->pos = end;
+	}
+
+	if (h->mode == 1 && nch == 2 && h->mode_ext)
+		joint_stereo(h, &bl[1], scf[1], is_max,
+			     is_scale, d->xr[0], d->xr[1], nz);
+
+	for (ch = 0; ch < nch; ch++) {
+		struct granule *g = &si->gr[gr][ch];
+
+		if (g->block_type == 2) {
+			reorder(h, &bl[ch], d->xr[ch]);
+			nsb = 32;
+			if (g->mixed)
+				antialias(d->xr[ch], 2);
+		} else {
+			/* Butterflies spill one subband past the last line */
+			nsb = (nz[ch] + 17) / 18 + 1;
+			if (nsb > 32)
+				nsb = 32;
+			antialias(d->xr[ch], nsb);
+		}
+		hybrid(d, g, ch, nsb);
+	}
+
+	out_ch = nch;
+	if (nch == 2 && (d->flags & MUX_MP3DEC_MONO)) {
+		float *l = d->sb[0][0], *r = d->sb[1][0];
+
+		for (i = 0; i < 18 * 32; i++)
+			l[i] = (l[i] + r[i]) * 0.5f;
+		out_ch = 1;
+	}
+
+	for (ch = 0; ch < out_ch; ch++)
+		for (i = 0; i < 18; i++)
+			synth(d, ch, d->sb[ch][i], pcm + i * 32 * out_ch + ch,
+			      out_ch);
+
+	return 0;
+}
+
+/*
+ * Public API
+ */
+struct mux_mp3dec *mux_mp3dec_new(int flags)
+{
+	struct mux_mp3dec *d;
+
+	init_tables();
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
+
+	d->flags = flags;
+	d->imdct36 = imdct36_c;
+	d->imdct12 = imdct12_c;
+	d->dct32 = dct32_c;
+	d->window = window_c;
+#ifdef MP3_SSE
+	if (!(flags & MUX_MP3DEC_SCALAR)) {
+		d->imdct36 = imdct36_sse;
+		d->imdct12 = imdct12_sse;
+		d->dct32 = dct32_sse;
+		d->window = window_sse;
+	}
+#endif
+
+	return d;
+}
+
+void mux_mp3dec_destroy(struct mux_mp3dec *d)
+{
+	free(d);
+}
+
+void mux_mp3dec_reset(struct mux_mp3dec *d)
+{
+	if (!d)
+		return;
+
+	d->locked = 0;
+	d->skip = 0;
+	d->main_len = 0;
+	memset(d->overlap, 0, sizeof(d->overlap));
+	memset(d->v, 0, sizeof(d->v));
+}
+
+int mux_mp3dec_simd(void)
+{
+#ifdef MP3_SSE
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Find the next frame header; returns its offset or -1 */
+static long find_frame(struct mux_mp3dec *d, const uint8_t *p, size_t size,
+		       struct mp3_header *h)
+{
+	struct mp3_header next;
+	size_t i;
+
+	for (i = 0; i + 4 <= size; i++) {
+		if (!parse_header(p + i, h))
+			continue;
+		if (d->locked && (h->lsf != d->lock_lsf ||
+				  h->sr_index != d->lock_sr))
+			continue;
+
+		/* Before the first frame, check the next header too if it
+		 * is there, so a stray sync in junk doesn't lock the stream */
+		if (!d->locked && i + (size_t)h->frame_bytes + 4 <= size &&
+		    (!parse_header(p + i + h->frame_bytes, &next) ||
+		     next.lsf != h->lsf || next.sr_index != h->sr_index))
+			continue;
+
+		return (long)i;
+	}
+
+	return -1;
+}
+
+int mux_mp3dec_decode_frame(struct mux_mp3dec *d, const void *data,
+			    size_t size, int16_t *pcm, size_t *consumed,
+			    struct mux_mp3_frame_info *info)
+{
+	const uint8_t *p = data;
+	struct mp3_header h;
+	struct side_info si;
+	struct bits b;
+	uint8_t side[32 + 4];
+	size_t skip = 0, main_bytes, start;
+	long off;
+	int side_len, gr, ok = 1;
+
+	if (!d || (!data && size) || !pcm || !consumed || !info)
+		return MUX_ERROR_INVAL;
+
+	memset(info, 0, sizeof(*info));
+	*consumed = 0;
+
+	/* ID3v2 tags in front of a file */
+	if (!d->locked && !d->skip && size >= 10 && memcmp(p, "ID3", 3) == 0 &&
+	    !((p[6] | p[7] | p[8] | p[9]) & 0x80))
+		d->skip = 10 + ((size_t)p[6] << 21 | (size_t)p[7] << 14 |
+				(size_t)p[8] << 7 | p[9]) + (p[5] & 0x10 ? 10 : 0);
+	if (d->skip) {
+		skip = d->skip < size ? d->skip : size;
+		d->skip -= skip;
+		*consumed = skip;
+		return MUX_OK;
+	}
+
+	off = find_frame(d, p, size, &h);
+	if (off < 0) {
+		/* Keep a possible partial header */
+		*consumed = size > 3 ? size - 3 : 0;
+		return MUX_OK;
+	}
+	if ((size_t)off + (size_t)h.frame_bytes > size) {
+		*consumed = (size_t)off;
+		return MUX_OK;
+	}
+
+	p += off;
+	*consumed = (size_t)off + (size_t)h.frame_bytes;
+	info->frame_bytes = h.frame_bytes;
+	info->sample_rate = sample_rates[h.sr_index];
+	info->channels = h.channels == 2 && (d->flags & MUX_MP3DEC_MONO) ?
+			 1 : h.channels;
+	info->bitrate = h.bitrate;
+
+	d->locked = 1;
+	d->lock_lsf = h.lsf;
+	d->lock_sr = h.sr_index;
+
+	/* Side info, padded for the bit reader */
+	side_len = side_info_size(&h);
+	start = 4 + (h.crc ? 2 : 0);
+	if (start + (size_t)side_len > (size_t)h.frame_bytes)
+		return MUX_OK;
+	memset(side, 0, sizeof(side));
+	memcpy(side, p + start, (size_t)side_len);
+	b.p = side;
+	b.pos = 0;
+	b.limit = (size_t)side_len * 8;
+	if (read_side_info(&b, &h, &si) < 0)
+		ok = 0;
+
+	/* Main data: the reservoir's tail, then this frame's */
+	main_bytes = (size_t)h.frame_bytes - start - (size_t)side_len;
+	if (ok && (size_t)si.main_data_begin > d->main_len)
+		ok = 0;
+	memcpy(d->main + d->main_len, p + start + side_len, main_bytes);
+	memset(d->main + d->main_len + main_bytes, 0, MAIN_PAD);
+
+	if (ok) {
+		b.p = d->main;
+		b.pos = (d->main_len - (size_t)si.main_data_begin) * 8;
+		b.limit = (d->main_len + main_bytes) * 8;
+		for (gr = 0; gr < (h.lsf ? 1 : 2) && ok; gr++)
+			ok = decode_granule(d, &h, &si, &b, gr,
+					    pcm + gr * GRANULE * info->channels) == 0 &&
+			     b.pos <= b.limit;
+	}
+
+	d->main_len += main_bytes;
+	if (d->main_len > MAX_RESERVOIR) {
+		memmove(d->main, d->main + d->main_len - MAX_RESERVOIR,
+			MAX_RESERVOIR);
+		d->main_len = MAX_RESERVOIR;
+	}
+
+	if (ok)
+		info->samples = h.lsf ? GRANULE : 2 * GRANULE;
+	return MUX_OK;
+}
@@ -12,6 +12,7 @@
 struct mux_encoder;
 struct mux_decoder;
 struct mux_codec_ops;
+struct mux_snap_reader;
 
 /*
  * Internal buffer for holding encoded/decoded data
@@ -69,6 +70,64 @@ struct mux_codec_ops {
 
 	int (*decoder_finalize)(struct mux_decoder *dec);
 
+	/*
+	 * Snapshot/restore (optional). snapshot appends codec state to
+	 * blob; restore reads it back into an encoder/decoder initialized
+	 * with the same configuration. Codec state ends the blob, so
+	 * restore checks mux_snap_end() before it changes anything.
+	 */
+	int (*encoder_snapshot)(struct mux_encoder *enc,
+				struct mux_buffer *blob);
+	int (*encoder_restore)(struct mux_encoder *enc,
+			       struct mux_snap_reader *r);
+	int (*decoder_snapshot)(struct mux_decoder *dec,
+				struct mux_buffer *blob);
+	int (*decoder_restore)(struct mux_decoder *dec,
+			       struct mux_snap_reader *r);
+
+	/*
+	 * Idle memory release (optional). trim gives back memory the codec
+	 * regrows on demand; with hibernate set it may also park state in
+	 * a compact form, which wake rebuilds before the next call. memory
+	 * reports the heap held through codec_data.
+	 */
+	int (*encoder_trim)(struct mux_encoder *enc, int hibernate);
+	int (*encoder_wake)(struct mux_encoder *enc);
+	size_t (*encoder_memory)(const struct mux_encoder *enc);
+	int (*decoder_trim)(struct mux_decoder *dec, int hibernate);
+	int (*decoder_wake)(struct mux_decoder *dec);
+	size_t (*decoder_memory)(const struct mux_decoder *dec);
+
+	/*
+	 * Live bitrate change (optional), for rate control. bps 0 only
+	 * reports the current bitrate; codecs with fixed modes take the
+	 * highest one at or below bps, or their lowest.
+	 */
+	int (*encoder_set_bitrate)(struct mux_encoder *enc, int bps,
+				   int *applied);
+
+	/*
+	 * Splicing (optional). Appends one packet of a pre-encoded clip
+	 * in the encoder's own framing, first completing a partially
+	 * buffered frame with silence. Stream header packets of the clip
+	 * are passed in too, to be checked or skipped. splice_check
+	 * (optional) validates a packet without writing anything; every
+	 * packet of a clip is checked before the first one is spliced.
+	 */
+	int (*encoder_splice)(struct mux_encoder *enc, const uint8_t *packet,
+			      size_t size);
+	int (*encoder_splice_check)(struct mux_encoder *enc,
+				    const uint8_t *packet, size_t size);
+
+	/*
+	 * Load shedding (optional). set_complexity takes a level from 0
+	 * (cheapest) to 10 and reports the one applied; -1 only reports.
+	 * set_dtx switches discontinuous transmission on or off.
+	 */
+	int (*encoder_set_complexity)(struct mux_encoder *enc, int level,
+				      int *applied);
+	int (*encoder_set_dtx)(struct mux_encoder *enc, int on);
+
 	/* Parameter info */
 	const struct mux_param_desc *encoder_params;
 	int encoder_param_count;
@@ -94,6 +153,25 @@ struct mux_encoder {
 	/* Output buffer for multiplexed data */
 	struct mux_buffer output;
 
+	/* Codec state is parked until mux_encoder_wake() */
+	int hibernated;
+
+	/* mux_encoder_pump() state, allocated on first use */
+	struct mux_pump *pump;
+
+	/* Shared-memory metrics slot, if attached */
+	struct mux_metrics *metrics;
+	int metrics_slot;
+
+	/* Rate control, set by mux_encoder_set_rate_limit() */
+	struct mux_rate *rate;
+
+	/* Load governor session, set by mux_governor_admit() */
+	struct mux_govern_session *govern;
+
+	/* Keyed side channel state, set by mux_encoder_set_state() */
+	struct mux_state_writer *state;
+
 	/* Error information */
 	struct mux_error_info error;
 
@@ -101,6 +179,26 @@ struct mux_encoder {
 	void *codec_data;
 };
 
+/*
+ * Stream framing, selected by codec type and num_streams
+ */
+enum mux_container {
+	MUX_CONTAINER_RAW,     /* num_streams == 1: everything is audio */
+	MUX_CONTAINER_LEB128,
+	MUX_CONTAINER_OGG      /* audio on serial 1, side channel on serial 2 */
+};
+
+/*
+ * Decoder resource limits (generic max_* decoder params)
+ */
+struct mux_decoder_limits {
+	size_t max_frame_size;      /* largest frame/packet payload */
+	size_t max_buffered_input;  /* undecoded input held between calls */
+	int max_channels;
+	int max_sample_rate;
+	size_t max_decode_input;    /* input taken per decode call, 0 = all */
+};
+
 /*
  * Decoder base structure
  */
@@ -113,6 +211,40 @@ struct mux_decoder {
 	struct mux_buffer audio_output;
 	struct mux_buffer side_output;
 
+	struct mux_decoder_limits limits;
+
+	/* Params it was created with, names copied */
+	struct mux_param *params;
+	int num_params;
+
+	/* Codec state is parked until mux_decoder_wake() */
+	int hibernated;
+
+	/* mux_decoder_pump() state, allocated on first use */
+	struct mux_pump *pump;
+
+	/* Shared-memory metrics slot, if attached */
+	struct mux_metrics *metrics;
+	int metrics_slot;
+
+	/* Lazy mode: compressed input queued until it is read */
+	int lazy;
+	int lazy_eof;               /* finalize waits for the queue to drain */
+	enum mux_container lazy_container;
+	struct mux_buffer lazy_input;
+
+	/*
+	 * Optional consumer of decoded int16 PCM instead of audio_output,
+	 * fed by codecs that output through mux_pcm_reducer. rate is the
+	 * (possibly reduced) output rate, native_rate the stream's own.
+	 */
+	int (*pcm_sink)(void *ctx, const int16_t *pcm, size_t frames,
+			int channels, int rate, int native_rate);
+	void *pcm_sink_ctx;
+
+	/* Keyed side channel state, set by mux_decoder_set_state() */
+	struct mux_state_reader *state;
+
 	/* Error information */
 	struct mux_error_info error;
 
@@ -126,10 +258,168 @@ struct mux_decoder {
 int mux_buffer_init(struct mux_buffer *buf, size_t initial_capacity);
 void mux_buffer_deinit(struct mux_buffer *buf);
 int mux_buffer_write(struct mux_buffer *buf, const void *data, size_t size);
+void *mux_buffer_reserve(struct mux_buffer *buf, size_t size);
 int mux_buffer_read(struct mux_buffer *buf, void *data, size_t size,
 		    size_t *bytes_read);
 int mux_buffer_available(const struct mux_buffer *buf);
 void mux_buffer_clear(struct mux_buffer *buf);
+void mux_buffer_compact(struct mux_buffer *buf);
+void mux_buffer_shrink(struct mux_buffer *buf);
+
+/*
+ * Lazy decoding: decode queued input until want bytes of audio (or
+ * any side channel data) are ready
+ */
+int mux_lazy_pull(struct mux_decoder *dec, size_t want);
+
+/*
+ * fd pump state
+ */
+struct mux_pump;
+
+void mux_pump_free(struct mux_pump *pump);
+
+/*
+ * Encoder rate control: encode and finalize in place of the codec ops
+ * while a limit is set
+ */
+struct mux_rate;
+
+int mux_rate_encode(struct mux_encoder *enc, const void *input,
+		    size_t input_size, size_t *input_consumed, int stream_type);
+int mux_rate_finalize(struct mux_encoder *enc);
+/* Charge bytes of spliced output that stand for frames of audio */
+int mux_rate_splice(struct mux_encoder *enc, size_t bytes, uint64_t frames);
+void mux_rate_free(struct mux_rate *rate);
+
+/*
+ * Load governor hooks around mux_encoder_encode(), on the session's own
+ * thread: enter applies pending decisions and refuses a shed session,
+ * leave counts the call's time and audio
+ */
+int mux_govern_enter(struct mux_encoder *enc);
+void mux_govern_leave(struct mux_encoder *enc, uint64_t t0, const void *input,
+		      size_t consumed, int stream_type);
+void mux_govern_detach(struct mux_encoder *enc);
+
+/*
+ * Codec encode, through rate control if set; the part of
+ * mux_encoder_encode() that layers on the side channel call again
+ */
+int mux_encoder_put(struct mux_encoder *enc, const void *input,
+		    size_t input_size, size_t *input_consumed, int stream_type);
+
+/*
+ * Keyed side channel state: tick sends what is due after each audio
+ * encode and at finalize, feed takes the side channel bytes a
+ * decoder read would have returned
+ */
+int mux_state_tick(struct mux_encoder *enc, size_t frames);
+int mux_state_feed(struct mux_decoder *dec, const void *data, size_t size);
+void mux_state_writer_free(struct mux_state_writer *w);
+void mux_state_reader_free(struct mux_state_reader *r);
+
+/*
+ * Record one call of the session in slot; called by its owning thread
+ */
+void mux_metrics_account(struct mux_metrics *m, int slot, int ret,
+			 size_t bytes_in, size_t bytes_out, size_t buffered,
+			 uint64_t ns);
+
+/*
+ * Decoder limit enforcement
+ */
+int mux_decoder_limits_setup(struct mux_decoder_limits *l,
+			     const struct mux_param *params,
+			     int num_params);
+size_t mux_decoder_input_room(const struct mux_decoder *dec, size_t buffered);
+int mux_decoder_buffer_input(struct mux_decoder *dec, struct mux_buffer *buf,
+			     const void *input, size_t input_size,
+			     size_t *accepted);
+int mux_decoder_read_frame(struct mux_decoder *dec, struct mux_buffer *input,
+			   void *payload, size_t payload_capacity,
+			   size_t *payload_size, int *stream_type);
+int mux_decoder_check_frame(struct mux_decoder *dec, size_t size);
+int mux_decoder_check_format(struct mux_decoder *dec, int sample_rate,
+			     int channels);
+
+/*
+ * Clocks (nanoseconds)
+ */
+uint64_t mux_clock_ns(void);
+uint64_t mux_cpu_clock_ns(void);
+
+/*
+ * Decoder output reduction (output_rate / output_channels params)
+ */
+#define MUX_REDUCE_MAX_CHANNELS 8
+#define MUX_REDUCE_PARAM_COUNT  2
+
+extern const struct mux_param_desc mux_reduce_decoder_params[MUX_REDUCE_PARAM_COUNT];
+
+struct mux_pcm_reducer {
+	int req_rate;       /* requested maximum rate, 0 = native */
+	int req_channels;   /* requested channels, 0 = native */
+	int in_rate;
+	int in_channels;
+	int out_rate;
+	int out_channels;
+	int active;         /* output differs from decoder output */
+	uint32_t phase;
+	uint32_t count;
+	int32_t acc[MUX_REDUCE_MAX_CHANNELS];
+};
+
+int mux_pcm_reducer_setup(struct mux_pcm_reducer *r,
+			  const struct mux_param *params,
+			  int num_params);
+void mux_pcm_reducer_start(struct mux_pcm_reducer *r,
+			   int in_rate,
+			   int in_channels);
+int mux_pcm_reducer_write_s16(struct mux_pcm_reducer *r,
+			      struct mux_decoder *dec,
+			      const int16_t *pcm,
+			      size_t frames);
+int mux_pcm_reducer_write_f32(struct mux_pcm_reducer *r,
+			      struct mux_decoder *dec,
+			      float *const *pcm,
+			      size_t frames);
+int mux_pcm_reducer_write_s32(struct mux_pcm_reducer *r,
+			      struct mux_decoder *dec,
+			      const int32_t *const *pcm,
+			      size_t frames);
+
+/* Deep copies of param arrays (names duplicated) */
+int mux_params_copy(struct mux_param **out, int *num_out,
+		    const struct mux_param *params, int num_params);
+void mux_params_free(struct mux_param *params, int num_params);
+
+/*
+ * Snapshot serialization helpers
+ */
+struct mux_snap_reader {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+};
+
+int mux_snap_put(struct mux_buffer *blob, const void *data, size_t size);
+int mux_snap_put_u32(struct mux_buffer *blob, uint32_t value);
+int mux_snap_put_u64(struct mux_buffer *blob, uint64_t value);
+int mux_snap_put_bytes(struct mux_buffer *blob, const void *data, size_t size);
+int mux_snap_put_buffer(struct mux_buffer *blob, const struct mux_buffer *buf);
+int mux_snap_get(struct mux_snap_reader *r, void *data, size_t size);
+int mux_snap_get_u32(struct mux_snap_reader *r, uint32_t *value);
+int mux_snap_get_u64(struct mux_snap_reader *r, uint64_t *value);
+int mux_snap_get_bytes(struct mux_snap_reader *r, const uint8_t **data,
+		       size_t *size);
+/* Take a saved buffer out now, apply it once nothing else can fail */
+int mux_snap_stage_buffer(struct mux_snap_reader *r, struct mux_buffer *buf,
+			  const uint8_t **data, size_t *size);
+void mux_snap_commit_buffer(struct mux_buffer *buf, const uint8_t *data,
+			    size_t size);
+/* MUX_ERROR_FORMAT if anything is left unread */
+int mux_snap_end(const struct mux_snap_reader *r);
 
 /*
  * Codec registry
@@ -168,6 +458,76 @@ int mux_leb128_read_frame(struct mux_buffer *input,
 			  void *payload, size_t payload_capacity,
 			  size_t *payload_size, int *stream_type, int num_streams);
 
+/*
+ * Container demultiplexer (no codec state)
+ */
+struct mux_demux_packet {
+	int stream_type;
+	const uint8_t *data;   /* valid only during the callback */
+	size_t size;
+	int64_t granulepos;    /* Ogg only, -1 otherwise */
+	int bos;
+	int eos;
+};
+
+struct mux_demux {
+	enum mux_container container;
+	struct mux_buffer input;       /* unparsed tail of previous feeds */
+	uint64_t skip;                 /* bytes of an unwanted packet still to come */
+	size_t max_packet;             /* wanted packets above this fail, 0 = any */
+
+	/* Ogg packets spanning pages, per stream type */
+	struct mux_buffer partial[2];
+	int partial_valid[2];
+	int drop_cont[2];
+
+	/* Current feed */
+	unsigned int streams;
+	int (*fn)(void *ctx, const struct mux_demux_packet *pkt);
+	void *ctx;
+};
+
+enum mux_container mux_demux_container(enum mux_codec_type codec_type,
+				       int num_streams);
+int mux_demux_init(struct mux_demux *d, enum mux_codec_type codec_type,
+		   int num_streams);
+void mux_demux_deinit(struct mux_demux *d);
+
+/*
+ * Parse input and call fn for each complete packet whose stream type
+ * bit is set in streams. Other packets are skipped unparsed.
+ */
+int mux_demux_feed(struct mux_demux *d, const void *data, size_t size,
+		   unsigned int streams,
+		   int (*fn)(void *ctx, const struct mux_demux_packet *pkt),
+		   void *ctx);
+
+extern const struct mux_codec_ops mux_side_only_decoder_ops;
+
+/* channel_groups: one codec instance per mono or stereo group */
+extern const struct mux_codec_ops mux_group_encoder_ops;
+extern const struct mux_codec_ops mux_group_decoder_ops;
+
+/*
+ * Worker pool: mux_workers_run() calls fn for jobs 0..jobs-1 across
+ * the pool and the calling thread, returning once all are done. A NULL
+ * pool (threads <= 1, or no pthreads) runs them in the calling thread.
+ */
+struct mux_workers;
+
+struct mux_workers *mux_workers_new(int threads);
+void mux_workers_free(struct mux_workers *w);
+void mux_workers_run(struct mux_workers *w, int jobs,
+		     void (*fn)(void *ctx, int job), void *ctx);
+int mux_workers_count(const struct mux_workers *w);
+int mux_workers_default(int jobs);
+
+/*
+ * G.711 sample expansion, shared with the waveform overview
+ */
+int16_t mux_alaw_decode_sample(uint8_t alaw);
+int16_t mux_mulaw_decode_sample(uint8_t mulaw);
+
 /*
  * Codec-specific operations (implemented by each codec)
  */
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "mux.h"
 #include "mux_internal.h"
+#include "mux_trace.h"
 #include <string.h>
 
 /*
@@ -116,6 +117,7 @@ int mux_leb128_write_frame(struct mux_buffer *output,
 			return ret;
 	}
 
+	MUX_PROBE2(frame_emit, stream_type & 1, payload_size);
 	return MUX_OK;
 }
 
@@ -220,6 +222,7 @@ int mux_leb128_read_frame(struct mux_buffer *input,
 
 	*payload_size = actual_payload_size;
 	*stream_type = stream;
+	MUX_PROBE2(frame_parse, stream, actual_payload_size);
 
 	/* Reset buffer if fully read */
 	if (input->read_pos == input->size) {
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef MUX_TRACE_H
+#define MUX_TRACE_H
+
+/*
+ * USDT static probes, provider "muxaudio"
+ *
+ * With <sys/sdt.h> each probe is a single nop plus an ELF note; nothing
+ * runs until a tracer (bpftrace, perf, SystemTap) attaches. Without it
+ * the probes compile away and their arguments are never evaluated, so
+ * arguments must not have side effects.
+ *
+ * See tools/bpftrace/ and the README for the probe list.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define MUX_PROBE1(name, a) \
+	DTRACE_PROBE1(muxaudio, name, a)
+#define MUX_PROBE2(name, a, b) \
+	DTRACE_PROBE2(muxaudio, name, a, b)
+#define MUX_PROBE3(name, a, b, c) \
+	DTRACE_PROBE3(muxaudio, name, a, b, c)
+#define MUX_PROBE4(name, a, b, c, d) \
+	DTRACE_PROBE4(muxaudio, name, a, b, c, d)
+
+#else
+
+#define MUX_PROBE1(name, a)          do { } while (0)
+#define MUX_PROBE2(name, a, b)       do { } while (0)
+#define MUX_PROBE3(name, a, b, c)    do { } while (0)
+#define MUX_PROBE4(name, a, b, c, d) do { } while (0)
+
+#endif
+
+/* Codec library call boundaries: lib_entry(codec, fn), lib_return(codec, fn, ret) */
+#define MUX_PROBE_LIB_ENTRY(codec, fn) \
+	MUX_PROBE2(lib_entry, codec, fn)
+#define MUX_PROBE_LIB_RETURN(codec, fn, ret) \
+	MUX_PROBE3(lib_return, codec, fn, ret)
+
+#endif /* MUX_TRACE_H */
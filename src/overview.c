@@ -0,0 +1,508 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Waveform overview
+ *
+ * Reduces decoded audio to per-bucket min/max/RMS as it is produced,
+ * so no PCM is ever queued in audio_output. PCM and G.711 skip the
+ * codec entirely: audio payloads come from the container demuxer and
+ * are scanned (G.711 through a 256-entry expansion table) in stack
+ * sized chunks. Codecs that output through mux_pcm_reducer hand their
+ * int16 PCM to the overview through the decoder's PCM sink; anything
+ * else is scanned in place from audio_output after each call.
+ *
+ * Buckets are counted in native frames even when the decoder runs at
+ * a reduced output_rate: every output frame stands for native_rate /
+ * rate native frames, tracked in integer units so there is no drift.
+ */
+#define OVERVIEW_CHUNK 2048  /* samples scanned per stack chunk */
+
+struct mux_overview {
+	enum mux_codec_type codec_type;
+	int direct;  /* PCM/G.711 scanned straight from payloads */
+	struct mux_demux demux;
+	struct mux_decoder dec;
+	int16_t g711[256];
+
+	int num_channels;  /* caller's layout for headerless streams */
+	int frames_per_bucket;
+
+	/* Format of the audio being scanned */
+	int channels;
+	int rate;
+	int native_rate;
+
+	/* Bucket in progress */
+	uint64_t units;  /* native frames seen, times rate */
+	uint32_t count;
+	int16_t min[MUX_OVERVIEW_MAX_CHANNELS];
+	int16_t max[MUX_OVERVIEW_MAX_CHANNELS];
+	uint64_t sumsq[MUX_OVERVIEW_MAX_CHANNELS];
+
+	/* Payload bytes not yet making up a whole frame */
+	int16_t stage[OVERVIEW_CHUNK];
+	size_t stage_len;
+
+	struct mux_buffer peaks;  /* completed buckets */
+};
+
+static void bucket_reset(struct mux_overview *ov)
+{
+	int c;
+
+	for (c = 0; c < MUX_OVERVIEW_MAX_CHANNELS; c++) {
+		ov->min[c] = INT16_MAX;
+		ov->max[c] = INT16_MIN;
+		ov->sumsq[c] = 0;
+	}
+	ov->count = 0;
+}
+
+static uint16_t isqrt(uint64_t v)
+{
+	uint64_t r = 0, bit = (uint64_t)1 << 30;
+
+	/* Mean squares of int16 stay below 2^30 + 1 */
+	while (bit > v)
+		bit >>= 2;
+	while (bit) {
+		if (v >= r + bit) {
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return r > UINT16_MAX ? UINT16_MAX : (uint16_t)r;
+}
+
+static int bucket_emit(struct mux_overview *ov)
+{
+	struct mux_peak peak[MUX_OVERVIEW_MAX_CHANNELS];
+	int c;
+
+	for (c = 0; c < ov->channels; c++) {
+		peak[c].min = ov->min[c];
+		peak[c].max = ov->max[c];
+		peak[c].rms = isqrt(ov->sumsq[c] / ov->count);
+	}
+
+	return mux_buffer_write(&ov->peaks, peak,
+				ov->channels * sizeof(peak[0]));
+}
+
+#ifdef __SSE2__
+/*
+ * Mono and stereo, eight samples at a time. Even and odd samples are
+ * squared separately (the other half masked off before the multiply-
+ * add) so stereo lanes stay apart. Returns the frames handled.
+ */
+static size_t scan_sse2(struct mux_overview *ov, const int16_t *pcm,
+			size_t frames)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i even = _mm_set1_epi32(0xffff);
+	__m128i vmin = _mm_set1_epi16(INT16_MAX);
+	__m128i vmax = _mm_set1_epi16(INT16_MIN);
+	__m128i sq_even = zero, sq_odd = zero;
+	int16_t lo[8], hi[8];
+	uint64_t se[2], so[2];
+	size_t i, vecs = frames * ov->channels / 8;
+	int c;
+
+	for (i = 0; i < vecs; i++) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(pcm + i * 8));
+		__m128i e = _mm_madd_epi16(_mm_and_si128(x, even), x);
+		__m128i o = _mm_madd_epi16(_mm_andnot_si128(even, x), x);
+
+		vmin = _mm_min_epi16(vmin, x);
+		vmax = _mm_max_epi16(vmax, x);
+
+		/* Squares are below 2^31, so widening with zeros is exact */
+		sq_even = _mm_add_epi64(sq_even, _mm_unpacklo_epi32(e, zero));
+		sq_even = _mm_add_epi64(sq_even, _mm_unpackhi_epi32(e, zero));
+		sq_odd = _mm_add_epi64(sq_odd, _mm_unpacklo_epi32(o, zero));
+		sq_odd = _mm_add_epi64(sq_odd, _mm_unpackhi_epi32(o, zero));
+	}
+
+	_mm_storeu_si128((__m128i *)lo, vmin);
+	_mm_storeu_si128((__m128i *)hi, vmax);
+	_mm_storeu_si128((__m128i *)se, sq_even);
+	_mm_storeu_si128((__m128i *)so, sq_odd);
+
+	for (i = 0; i < 8; i++) {
+		c = ov->channels == 2 ? (int)(i & 1) : 0;
+		if (lo[i] < ov->min[c])
+			ov->min[c] = lo[i];
+		if (hi[i] > ov->max[c])
+			ov->max[c] = hi[i];
+	}
+
+	if (ov->channels == 2) {
+		ov->sumsq[0] += se[0] + se[1];
+		ov->sumsq[1] += so[0] + so[1];
+	} else {
+		ov->sumsq[0] += se[0] + se[1] + so[0] + so[1];
+	}
+
+	return vecs * 8 / ov->channels;
+}
+#endif
+
+/*
+ * Fused min/max/sum-of-squares over interleaved frames, all within
+ * the current bucket
+ */
+static void scan(struct mux_overview *ov, const int16_t *pcm, size_t frames)
+{
+	int ch = ov->channels;
+	size_t i = 0;
+	int c;
+
+#ifdef __SSE2__
+	if (ch <= 2)
+		i = scan_sse2(ov, pcm, frames);
+#endif
+
+	for (; i < frames; i++) {
+		for (c = 0; c < ch; c++) {
+			int32_t v = pcm[i * ch + c];
+
+			if (v < ov->min[c])
+				ov->min[c] = (int16_t)v;
+			if (v > ov->max[c])
+				ov->max[c] = (int16_t)v;
+			ov->sumsq[c] += (uint64_t)(v * v);
+		}
+	}
+
+	ov->count += (uint32_t)frames;
+}
+
+static int overview_pcm(void *ctx, const int16_t *pcm, size_t frames,
+			int channels, int rate, int native_rate)
+{
+	struct mux_overview *ov = ctx;
+	uint64_t target;
+	size_t n;
+	int ret;
+
+	if (channels != ov->channels || rate != ov->rate ||
+	    native_rate != ov->native_rate) {
+		if (channels <= 0 || channels > MUX_OVERVIEW_MAX_CHANNELS ||
+		    rate <= 0 || native_rate <= 0)
+			return MUX_ERROR_UNSUPPORTED;
+
+		/* A format change closes the bucket in progress */
+		if (ov->count) {
+			ret = bucket_emit(ov);
+			if (ret != MUX_OK)
+				return ret;
+		}
+		bucket_reset(ov);
+		ov->units = 0;
+		ov->channels = channels;
+		ov->rate = rate;
+		ov->native_rate = native_rate;
+	}
+
+	target = (uint64_t)ov->frames_per_bucket * rate;
+
+	while (frames > 0) {
+		n = (size_t)((target - ov->units + native_rate - 1) / native_rate);
+		if (n > frames)
+			n = frames;
+
+		scan(ov, pcm, n);
+		ov->units += (uint64_t)n * native_rate;
+		pcm += n * channels;
+		frames -= n;
+
+		if (ov->units < target)
+			continue;
+
+		/* One output frame can outlast a bucket when decimating */
+		while (ov->units >= target) {
+			ret = bucket_emit(ov);
+			if (ret != MUX_OK)
+				return ret;
+			ov->units -= target;
+		}
+		bucket_reset(ov);
+	}
+
+	return MUX_OK;
+}
+
+/*
+ * PCM and G.711 audio payloads; frames may straddle payloads
+ */
+static int overview_packet(void *ctx, const struct mux_demux_packet *pkt)
+{
+	struct mux_overview *ov = ctx;
+	uint8_t *stage = (uint8_t *)ov->stage;
+	int16_t pcm[OVERVIEW_CHUNK];
+	const uint8_t *p = pkt->data;
+	size_t size = pkt->size;
+	size_t bpf, cap, n, frames, used, i;
+	int pcm16 = ov->codec_type == MUX_CODEC_PCM;
+	int ret;
+
+	bpf = (size_t)ov->num_channels * (pcm16 ? sizeof(int16_t) : 1);
+	cap = pcm16 ? sizeof(ov->stage) : OVERVIEW_CHUNK;
+	cap -= cap % bpf;
+
+	while (size > 0) {
+		n = cap - ov->stage_len < size ? cap - ov->stage_len : size;
+		memcpy(stage + ov->stage_len, p, n);
+		ov->stage_len += n;
+		p += n;
+		size -= n;
+
+		frames = ov->stage_len / bpf;
+		if (frames == 0)
+			continue;
+
+		if (pcm16) {
+			ret = overview_pcm(ov, ov->stage, frames,
+					   ov->num_channels, 1, 1);
+		} else {
+			for (i = 0; i < frames * ov->num_channels; i++)
+				pcm[i] = ov->g711[stage[i]];
+			ret = overview_pcm(ov, pcm, frames, ov->num_channels,
+					   1, 1);
+		}
+		if (ret != MUX_OK)
+			return ret;
+
+		used = frames * bpf;
+		memmove(stage, stage + used, ov->stage_len - used);
+		ov->stage_len -= used;
+	}
+
+	return MUX_OK;
+}
+
+/*
+ * Codecs not going through the reducer leave PCM in audio_output;
+ * scan it where it is and drop it
+ */
+static int drain_decoder(struct mux_overview *ov)
+{
+	struct mux_buffer *out = &ov->dec.audio_output;
+	size_t bpf = (size_t)ov->num_channels * sizeof(int16_t);
+	size_t frames, skipped;
+	int ret = MUX_OK;
+
+	frames = (size_t)mux_buffer_available(out) / bpf;
+	if (frames > 0)
+		ret = overview_pcm(ov, (const int16_t *)(out->data +
+							 out->read_pos),
+				   frames, ov->num_channels, 1, 1);
+
+	if (ret == MUX_OK)
+		mux_buffer_read(out, NULL, frames * bpf, &skipped);
+	mux_buffer_compact(out);
+
+	/* Side data isn't wanted here */
+	mux_buffer_clear(&ov->dec.side_output);
+	return ret;
+}
+
+static int init_direct(struct mux_overview *ov, int num_streams,
+		       const struct mux_param *params, int num_params)
+{
+	struct mux_decoder_limits limits;
+	int i, ret;
+
+	if (mux_decoder_limits_setup(&limits, params, num_params) != MUX_OK)
+		return MUX_ERROR_INVAL;
+
+	ret = mux_demux_init(&ov->demux, ov->codec_type, num_streams);
+	if (ret != MUX_OK)
+		return ret;
+	ov->demux.max_packet = limits.max_frame_size;
+
+	for (i = 0; i < 256; i++)
+		ov->g711[i] = ov->codec_type == MUX_CODEC_ALAW ?
+			      mux_alaw_decode_sample((uint8_t)i) :
+			      mux_mulaw_decode_sample((uint8_t)i);
+
+	/* Headerless: the layout is known up front */
+	ov->channels = ov->num_channels;
+	ov->rate = 1;
+	ov->native_rate = 1;
+	ov->direct = 1;
+	return MUX_OK;
+}
+
+struct mux_overview *mux_overview_new(enum mux_codec_type codec_type,
+				      int num_streams,
+				      int num_channels,
+				      int frames_per_bucket,
+				      const struct mux_param *params,
+				      int num_params)
+{
+	struct mux_overview *ov;
+	int direct, ret;
+
+	direct = codec_type == MUX_CODEC_PCM || codec_type == MUX_CODEC_ALAW ||
+		 codec_type == MUX_CODEC_MULAW;
+
+	if (frames_per_bucket <= 0 || num_channels < 0 ||
+	    num_channels > MUX_OVERVIEW_MAX_CHANNELS ||
+	    (direct && num_channels == 0))
+		return NULL;
+	if (num_streams != 1 && num_streams != 2)
+		return NULL;
+
+	ov = calloc(1, sizeof(*ov));
+	if (!ov)
+		return NULL;
+
+	ov->codec_type = codec_type;
+	ov->num_channels = num_channels ? num_channels : 1;
+	ov->frames_per_bucket = frames_per_bucket;
+	bucket_reset(ov);
+
+	if (mux_buffer_init(&ov->peaks, 4096) != MUX_OK) {
+		free(ov);
+		return NULL;
+	}
+
+	if (direct) {
+		ret = init_direct(ov, num_streams, params, num_params);
+	} else {
+		ret = mux_decoder_init(&ov->dec, codec_type, num_streams,
+				       params, num_params);
+		if (ret == MUX_OK && (ov->dec.ops == &mux_side_only_decoder_ops ||
+				      ov->dec.lazy)) {
+			mux_decoder_deinit(&ov->dec);
+			ret = MUX_ERROR_INVAL;
+		}
+		ov->dec.pcm_sink = overview_pcm;
+		ov->dec.pcm_sink_ctx = ov;
+	}
+
+	if (ret != MUX_OK) {
+		mux_buffer_deinit(&ov->peaks);
+		free(ov);
+		return NULL;
+	}
+
+	return ov;
+}
+
+void mux_overview_destroy(struct mux_overview *ov)
+{
+	if (!ov)
+		return;
+
+	if (ov->direct)
+		mux_demux_deinit(&ov->demux);
+	else
+		mux_decoder_deinit(&ov->dec);
+
+	mux_buffer_deinit(&ov->peaks);
+	free(ov);
+}
+
+int mux_overview_feed(struct mux_overview *ov,
+		      const void *input,
+		      size_t input_size,
+		      size_t *input_consumed)
+{
+	int ret;
+
+	if (!ov || !input || !input_consumed)
+		return MUX_ERROR_INVAL;
+
+	if (ov->direct) {
+		ret = mux_demux_feed(&ov->demux, input, input_size,
+				     1u << MUX_STREAM_AUDIO,
+				     overview_packet, ov);
+		*input_consumed = ret == MUX_OK ? input_size : 0;
+		return ret;
+	}
+
+	ret = mux_decoder_decode(&ov->dec, input, input_size, input_consumed);
+	if (ret != MUX_OK)
+		return ret;
+
+	return drain_decoder(ov);
+}
+
+int mux_overview_finalize(struct mux_overview *ov)
+{
+	int ret;
+
+	if (!ov)
+		return MUX_ERROR_INVAL;
+
+	if (!ov->direct) {
+		ret = mux_decoder_finalize(&ov->dec);
+		if (ret == MUX_OK)
+			ret = drain_decoder(ov);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	/* A trailing partial frame is dropped */
+	ov->stage_len = 0;
+
+	if (ov->count) {
+		ret = bucket_emit(ov);
+		if (ret != MUX_OK)
+			return ret;
+	}
+	bucket_reset(ov);
+	ov->units = 0;
+
+	return MUX_OK;
+}
+
+int mux_overview_read(struct mux_overview *ov,
+		      struct mux_peak *peaks,
+		      size_t max_buckets,
+		      size_t *buckets)
+{
+	size_t bucket_size, n, bytes_read;
+	int ret;
+
+	if (!ov || !peaks || !buckets)
+		return MUX_ERROR_INVAL;
+
+	*buckets = 0;
+	if (ov->channels == 0)
+		return MUX_OK;
+
+	bucket_size = ov->channels * sizeof(struct mux_peak);
+	n = (size_t)mux_buffer_available(&ov->peaks) / bucket_size;
+	if (n > max_buckets)
+		n = max_buckets;
+
+	ret = mux_buffer_read(&ov->peaks, peaks, n * bucket_size, &bytes_read);
+	if (ret != MUX_OK)
+		return ret;
+
+	*buckets = bytes_read / bucket_size;
+	return MUX_OK;
+}
+
+int mux_overview_channels(const struct mux_overview *ov)
+{
+	if (!ov)
+		return 0;
+
+	return ov->channels;
+}
@@ -0,0 +1,844 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define MUX_HAVE_MMAP 1
+#endif
+
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef MUX_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Clip pack layout (all integers little-endian):
+ *
+ *   file header (64 bytes)
+ *   shared stream headers and clip payloads, each 64-byte aligned
+ *   header table: { offset u64, size u64 } per shared header
+ *   index: one 48-byte entry per clip, sorted by id
+ *
+ * The writer streams payloads out as clips are added and appends the
+ * tables on finish, so only the index is held in memory.
+ */
+#define PACK_MAGIC        "MUXPACK"
+#define PACK_VERSION      1
+#define PACK_ALIGN        64
+#define PACK_HEADER_SIZE  64
+#define PACK_TABLE_SIZE   16
+#define PACK_ENTRY_SIZE   48
+#define PACK_NO_HEADER    0xffffffffu
+
+struct pack_entry {
+	uint64_t id;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t duration;
+	uint32_t sample_rate;
+	uint32_t header;       /* shared header index or PACK_NO_HEADER */
+	uint16_t codec_type;
+	uint8_t num_streams;
+	uint8_t num_channels;
+};
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+	put_le32(p, (uint32_t)v);
+	put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+	       (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+/*
+ * Stream header detection
+ *
+ * Returns how many leading bytes of a clip are stream headers that
+ * identically configured clips share byte for byte. Splitting there is
+ * always lossless; a poor guess only costs deduplication.
+ */
+
+/* Ogg: the leading pages with granule position 0 (Opus/Vorbis headers) */
+static size_t ogg_header_size(const uint8_t *data, size_t size)
+{
+	size_t pos = 0, page, i;
+	int segments;
+
+	while (size - pos >= 27 && memcmp(data + pos, "OggS", 4) == 0) {
+		if (get_le64(data + pos + 6) != 0)
+			break;
+
+		segments = data[pos + 26];
+		if (size - pos < 27 + (size_t)segments)
+			break;
+
+		page = 27 + (size_t)segments;
+		for (i = 0; i < (size_t)segments; i++)
+			page += data[pos + 27 + i];
+		if (size - pos < page)
+			break;
+
+		pos += page;
+	}
+
+	return pos;
+}
+
+/* FLAC: "fLaC" and the metadata blocks of a passthrough stream */
+static size_t flac_header_size(const uint8_t *data, size_t size)
+{
+	size_t pos = 4, len;
+	int last;
+
+	if (size < 4 || memcmp(data, "fLaC", 4) != 0)
+		return 0;
+
+	do {
+		if (size - pos < 4)
+			return 0;
+		last = data[pos] & 0x80;
+		len = (size_t)data[pos + 1] << 16 | (size_t)data[pos + 2] << 8 |
+		      data[pos + 3];
+		if (size - pos - 4 < len)
+			return 0;
+		pos += 4 + len;
+	} while (!last);
+
+	return pos;
+}
+
+static size_t stream_header_size(const struct mux_clip *clip)
+{
+	switch (clip->codec_type) {
+	case MUX_CODEC_OPUS:
+	case MUX_CODEC_VORBIS:
+		return ogg_header_size(clip->data, clip->size);
+	case MUX_CODEC_FLAC:
+		if (clip->num_streams == 1)
+			return flac_header_size(clip->data, clip->size);
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Writer
+ */
+struct pack_shared {
+	uint64_t offset;
+	size_t size;
+	uint8_t *data;         /* kept to recognize later copies */
+};
+
+struct mux_pack_writer {
+	FILE *f;
+	uint64_t pos;
+	int failed;
+
+	struct pack_entry *entries;
+	size_t count;
+	size_t capacity;
+
+	struct pack_shared *shared;
+	size_t shared_count;
+	size_t shared_capacity;
+};
+
+static int write_bytes(struct mux_pack_writer *w, const void *data,
+		       size_t size)
+{
+	if (size > 0 && fwrite(data, 1, size, w->f) != size) {
+		w->failed = 1;
+		return MUX_ERROR;
+	}
+
+	w->pos += size;
+	return MUX_OK;
+}
+
+static int write_padding(struct mux_pack_writer *w)
+{
+	static const uint8_t zero[PACK_ALIGN];
+
+	return write_bytes(w, zero, (size_t)(-w->pos & (PACK_ALIGN - 1)));
+}
+
+struct mux_pack_writer *mux_pack_writer_new(const char *path)
+{
+	struct mux_pack_writer *w;
+	uint8_t header[PACK_HEADER_SIZE];
+
+	if (!path)
+		return NULL;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	w->f = fopen(path, "wb");
+	if (!w->f) {
+		free(w);
+		return NULL;
+	}
+
+	/* Placeholder, rewritten by finish */
+	memset(header, 0, sizeof(header));
+	if (write_bytes(w, header, sizeof(header)) != MUX_OK) {
+		mux_pack_writer_destroy(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+static int add_shared(struct mux_pack_writer *w, const uint8_t *data,
+		      size_t size, uint32_t *index)
+{
+	struct pack_shared *s;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < w->shared_count; i++) {
+		s = &w->shared[i];
+		if (s->size == size && memcmp(s->data, data, size) == 0) {
+			*index = (uint32_t)i;
+			return MUX_OK;
+		}
+	}
+
+	if (w->shared_count == PACK_NO_HEADER)
+		return MUX_ERROR_LIMIT;
+
+	if (w->shared_count == w->shared_capacity) {
+		size_t cap = w->shared_capacity ? w->shared_capacity * 2 : 8;
+
+		s = realloc(w->shared, cap * sizeof(*s));
+		if (!s)
+			return MUX_ERROR_NOMEM;
+		w->shared = s;
+		w->shared_capacity = cap;
+	}
+
+	s = &w->shared[w->shared_count];
+	s->data = malloc(size);
+	if (!s->data)
+		return MUX_ERROR_NOMEM;
+	memcpy(s->data, data, size);
+	s->size = size;
+
+	ret = write_padding(w);
+	if (ret != MUX_OK) {
+		free(s->data);
+		return ret;
+	}
+	s->offset = w->pos;
+	ret = write_bytes(w, data, size);
+	if (ret != MUX_OK) {
+		free(s->data);
+		return ret;
+	}
+
+	*index = (uint32_t)w->shared_count++;
+	return MUX_OK;
+}
+
+int mux_pack_writer_add(struct mux_pack_writer *w, const struct mux_clip *clip)
+{
+	struct pack_entry *e;
+	size_t header_size;
+	uint32_t header = PACK_NO_HEADER;
+	int ret;
+
+	if (!w || !w->f || w->failed || !clip || (!clip->data && clip->size) ||
+	    (int)clip->codec_type < 0 || clip->codec_type >= MUX_CODEC_MAX ||
+	    (clip->num_streams != 1 && clip->num_streams != 2) ||
+	    clip->sample_rate < 0 || clip->num_channels < 0 ||
+	    clip->num_channels > 255)
+		return MUX_ERROR_INVAL;
+
+	if (w->count == w->capacity) {
+		size_t cap = w->capacity ? w->capacity * 2 : 256;
+
+		e = realloc(w->entries, cap * sizeof(*e));
+		if (!e)
+			return MUX_ERROR_NOMEM;
+		w->entries = e;
+		w->capacity = cap;
+	}
+
+	header_size = clip->size ? stream_header_size(clip) : 0;
+	if (header_size > 0) {
+		ret = add_shared(w, clip->data, header_size, &header);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	ret = write_padding(w);
+	if (ret != MUX_OK)
+		return ret;
+
+	e = &w->entries[w->count];
+	e->id = clip->id;
+	e->offset = w->pos;
+	e->size = clip->size - header_size;
+	e->duration = clip->duration;
+	e->sample_rate = (uint32_t)clip->sample_rate;
+	e->header = header;
+	e->codec_type = (uint16_t)clip->codec_type;
+	e->num_streams = (uint8_t)clip->num_streams;
+	e->num_channels = (uint8_t)clip->num_channels;
+
+	ret = write_bytes(w, clip->data + header_size, clip->size - header_size);
+	if (ret != MUX_OK)
+		return ret;
+
+	w->count++;
+	return MUX_OK;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	const struct pack_entry *x = a, *y = b;
+
+	return x->id < y->id ? -1 : x->id > y->id;
+}
+
+int mux_pack_writer_finish(struct mux_pack_writer *w)
+{
+	uint8_t buf[PACK_HEADER_SIZE];
+	uint64_t table_offset, index_offset;
+	size_t i;
+	int ret;
+
+	if (!w || !w->f || w->failed)
+		return MUX_ERROR_INVAL;
+
+	qsort(w->entries, w->count, sizeof(*w->entries), compare_entries);
+	for (i = 1; i < w->count; i++) {
+		if (w->entries[i].id == w->entries[i - 1].id)
+			return MUX_ERROR_INVAL;
+	}
+
+	ret = write_padding(w);
+	if (ret != MUX_OK)
+		return ret;
+
+	table_offset = w->pos;
+	for (i = 0; i < w->shared_count && ret == MUX_OK; i++) {
+		put_le64(buf, w->shared[i].offset);
+		put_le64(buf + 8, w->shared[i].size);
+		ret = write_bytes(w, buf, PACK_TABLE_SIZE);
+	}
+	if (ret == MUX_OK)
+		ret = write_padding(w);
+	if (ret != MUX_OK)
+		return ret;
+
+	index_offset = w->pos;
+	for (i = 0; i < w->count && ret == MUX_OK; i++) {
+		const struct pack_entry *e = &w->entries[i];
+
+		put_le64(buf, e->id);
+		put_le64(buf + 8, e->offset);
+		put_le64(buf + 16, e->size);
+		put_le64(buf + 24, e->duration);
+		put_le32(buf + 32, e->sample_rate);
+		put_le32(buf + 36, e->header);
+		buf[40] = (uint8_t)e->codec_type;
+		buf[41] = (uint8_t)(e->codec_type >> 8);
+		buf[42] = e->num_streams;
+		buf[43] = e->num_channels;
+		put_le32(buf + 44, 0);
+		ret = write_bytes(w, buf, PACK_ENTRY_SIZE);
+	}
+	if (ret != MUX_OK)
+		return ret;
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, PACK_MAGIC, sizeof(PACK_MAGIC));
+	put_le32(buf + 8, PACK_VERSION);
+	put_le32(buf + 12, PACK_ENTRY_SIZE);
+	put_le64(buf + 16, w->count);
+	put_le64(buf + 24, index_offset);
+	put_le64(buf + 32, w->shared_count);
+	put_le64(buf + 40, table_offset);
+
+	if (fseek(w->f, 0, SEEK_SET) != 0 ||
+	    fwrite(buf, 1, sizeof(buf), w->f) != sizeof(buf)) {
+		w->failed = 1;
+		return MUX_ERROR;
+	}
+
+	ret = fclose(w->f) == 0 ? MUX_OK : MUX_ERROR;
+	w->f = NULL;
+	return ret;
+}
+
+void mux_pack_writer_destroy(struct mux_pack_writer *w)
+{
+	size_t i;
+
+	if (!w)
+		return;
+
+	if (w->f)
+		fclose(w->f);
+	for (i = 0; i < w->shared_count; i++)
+		free(w->shared[i].data);
+	free(w->shared);
+	free(w->entries);
+	free(w);
+}
+
+/*
+ * Reader
+ */
+
+/*
+ * Decoders that have consumed a shared header, kept as snapshots so that
+ * opening a clip restores one instead of parsing the header again. Only
+ * decoders opened without params are primed, and only for codecs with
+ * snapshots; the rest parse the header each time.
+ */
+#define PRIMED_EMPTY  0
+#define PRIMED_READY  1
+#define PRIMED_NONE   2   /* can't be snapshotted, always parse */
+
+struct pack_primed_slot {
+	int state;
+	enum mux_codec_type codec_type;
+	int num_streams;
+	uint8_t *blob;
+	size_t size;
+};
+
+struct pack_primed {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+	size_t count;
+	struct pack_primed_slot slot[];
+};
+
+#ifdef HAVE_PTHREAD
+#define LOCK(p)     pthread_mutex_lock(&(p)->lock)
+#define UNLOCK(p)   pthread_mutex_unlock(&(p)->lock)
+#else
+#define LOCK(p)     ((void)0)
+#define UNLOCK(p)   ((void)0)
+#endif
+
+struct mux_pack {
+	const uint8_t *data;
+	size_t size;
+	void *owned;           /* mapping or heap copy, NULL if borrowed */
+	int mapped;
+
+	size_t count;
+	const uint8_t *index;
+	size_t header_count;
+	const uint8_t *table;
+
+	struct pack_primed *primed;   /* one slot per shared header */
+};
+
+/* Is [offset, offset + len) inside the pack? */
+static int in_pack(const struct mux_pack *pack, uint64_t offset, uint64_t len)
+{
+	return offset <= pack->size && len <= pack->size - offset;
+}
+
+static int pack_parse(struct mux_pack *pack)
+{
+	const uint8_t *h = pack->data;
+	uint64_t count, index_offset, header_count, table_offset;
+
+	if (pack->size < PACK_HEADER_SIZE ||
+	    memcmp(h, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0 ||
+	    get_le32(h + 8) != PACK_VERSION ||
+	    get_le32(h + 12) != PACK_ENTRY_SIZE)
+		return MUX_ERROR_FORMAT;
+
+	count = get_le64(h + 16);
+	index_offset = get_le64(h + 24);
+	header_count = get_le64(h + 32);
+	table_offset = get_le64(h + 40);
+
+	if (count > pack->size / PACK_ENTRY_SIZE ||
+	    header_count > pack->size / PACK_TABLE_SIZE ||
+	    !in_pack(pack, index_offset, count * PACK_ENTRY_SIZE) ||
+	    !in_pack(pack, table_offset, header_count * PACK_TABLE_SIZE))
+		return MUX_ERROR_FORMAT;
+
+	pack->count = (size_t)count;
+	pack->index = pack->data + index_offset;
+	pack->header_count = (size_t)header_count;
+	pack->table = pack->data + table_offset;
+	return MUX_OK;
+}
+
+struct mux_pack *mux_pack_open_memory(const void *data, size_t size)
+{
+	struct mux_pack *pack;
+
+	if (!data)
+		return NULL;
+
+	pack = calloc(1, sizeof(*pack));
+	if (!pack)
+		return NULL;
+
+	pack->data = data;
+	pack->size = size;
+	if (pack_parse(pack) != MUX_OK) {
+		free(pack);
+		return NULL;
+	}
+
+	pack->primed = calloc(1, sizeof(*pack->primed) + pack->header_count *
+			      sizeof(pack->primed->slot[0]));
+	if (!pack->primed) {
+		free(pack);
+		return NULL;
+	}
+	pack->primed->count = pack->header_count;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&pack->primed->lock, NULL);
+#endif
+
+	return pack;
+}
+
+#ifdef MUX_HAVE_MMAP
+static void *load_file(const char *path, size_t *size, int *mapped)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	*size = (size_t)st.st_size;
+	*mapped = 1;
+	return p;
+}
+#else
+static void *load_file(const char *path, size_t *size, int *mapped)
+{
+	FILE *f;
+	long len;
+	void *p = NULL;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 &&
+	    fseek(f, 0, SEEK_SET) == 0) {
+		p = malloc((size_t)len);
+		if (p && fread(p, 1, (size_t)len, f) != (size_t)len) {
+			free(p);
+			p = NULL;
+		}
+		*size = (size_t)len;
+	}
+
+	fclose(f);
+	*mapped = 0;
+	return p;
+}
+#endif
+
+static void unload_file(void *p, size_t size, int mapped)
+{
+#ifdef MUX_HAVE_MMAP
+	if (mapped) {
+		munmap(p, size);
+		return;
+	}
+#else
+	(void)size;
+	(void)mapped;
+#endif
+	free(p);
+}
+
+struct mux_pack *mux_pack_open(const char *path)
+{
+	struct mux_pack *pack;
+	size_t size = 0;
+	int mapped = 0;
+	void *p;
+
+	if (!path)
+		return NULL;
+
+	p = load_file(path, &size, &mapped);
+	if (!p)
+		return NULL;
+
+	pack = mux_pack_open_memory(p, size);
+	if (!pack) {
+		unload_file(p, size, mapped);
+		return NULL;
+	}
+
+	pack->owned = p;
+	pack->mapped = mapped;
+	return pack;
+}
+
+void mux_pack_close(struct mux_pack *pack)
+{
+	size_t i;
+
+	if (!pack)
+		return;
+
+	for (i = 0; i < pack->primed->count; i++)
+		free(pack->primed->slot[i].blob);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&pack->primed->lock);
+#endif
+	free(pack->primed);
+
+	if (pack->owned)
+		unload_file(pack->owned, pack->size, pack->mapped);
+	free(pack);
+}
+
+size_t mux_pack_count(const struct mux_pack *pack)
+{
+	return pack ? pack->count : 0;
+}
+
+static int read_entry(const struct mux_pack *pack, size_t index,
+		      struct mux_clip *clip)
+{
+	const uint8_t *e = pack->index + index * PACK_ENTRY_SIZE;
+	uint64_t offset = get_le64(e + 8), size = get_le64(e + 16);
+	uint32_t header = get_le32(e + 36);
+	unsigned codec = (unsigned)e[40] | (unsigned)e[41] << 8;
+
+	if (!in_pack(pack, offset, size) || codec >= MUX_CODEC_MAX)
+		return MUX_ERROR_FORMAT;
+
+	memset(clip, 0, sizeof(*clip));
+	clip->id = get_le64(e);
+	clip->codec_type = (enum mux_codec_type)codec;
+	clip->num_streams = e[42];
+	clip->sample_rate = (int)get_le32(e + 32);
+	clip->num_channels = e[43];
+	clip->duration = get_le64(e + 24);
+	clip->data = pack->data + offset;
+	clip->size = (size_t)size;
+	clip->pack = pack;
+
+	if (header != PACK_NO_HEADER) {
+		const uint8_t *t = pack->table + (size_t)header * PACK_TABLE_SIZE;
+
+		if (header >= pack->header_count)
+			return MUX_ERROR_FORMAT;
+		offset = get_le64(t);
+		size = get_le64(t + 8);
+		if (!in_pack(pack, offset, size))
+			return MUX_ERROR_FORMAT;
+		clip->header = pack->data + offset;
+		clip->header_size = (size_t)size;
+	}
+
+	return MUX_OK;
+}
+
+int mux_pack_get(const struct mux_pack *pack, size_t index,
+		 struct mux_clip *clip)
+{
+	if (!pack || !clip)
+		return MUX_ERROR_INVAL;
+
+	if (index >= pack->count)
+		return MUX_ERROR_NOTFOUND;
+
+	return read_entry(pack, index, clip);
+}
+
+int mux_pack_find(const struct mux_pack *pack, uint64_t id,
+		  struct mux_clip *clip)
+{
+	size_t lo = 0, hi, mid;
+	uint64_t key;
+
+	if (!pack || !clip)
+		return MUX_ERROR_INVAL;
+
+	hi = pack->count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		key = get_le64(pack->index + mid * PACK_ENTRY_SIZE);
+		if (key == id)
+			return read_entry(pack, mid, clip);
+		if (key < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return MUX_ERROR_NOTFOUND;
+}
+
+static struct mux_decoder *parse_header(const struct mux_clip *clip,
+					const struct mux_param *params,
+					int num_params)
+{
+	struct mux_decoder *dec;
+	size_t pos = 0, consumed;
+
+	dec = mux_decoder_new(clip->codec_type, clip->num_streams, params,
+			      num_params);
+	if (!dec)
+		return NULL;
+
+	while (pos < clip->header_size) {
+		if (mux_decoder_decode(dec, clip->header + pos,
+				       clip->header_size - pos,
+				       &consumed) != MUX_OK || consumed == 0) {
+			mux_decoder_destroy(dec);
+			return NULL;
+		}
+		pos += consumed;
+	}
+
+	return dec;
+}
+
+/*
+ * Slot of the shared header a clip points at. The writer lays shared
+ * headers out in table order, so the table is sorted by offset.
+ */
+static struct pack_primed_slot *primed_slot(const struct mux_clip *clip)
+{
+	const struct mux_pack *pack = clip->pack;
+	uint64_t offset, key;
+	size_t lo = 0, hi, mid;
+
+	if (clip->header < pack->data ||
+	    clip->header >= pack->data + pack->size)
+		return NULL;
+
+	offset = (uint64_t)(clip->header - pack->data);
+	hi = pack->header_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		key = get_le64(pack->table + mid * PACK_TABLE_SIZE);
+		if (key == offset)
+			return &pack->primed->slot[mid];
+		if (key < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+/* Parse the header once into a snapshot; called with the lock held */
+static void prime_slot(struct pack_primed_slot *slot,
+		       const struct mux_clip *clip)
+{
+	struct mux_decoder *dec;
+	size_t size;
+
+	slot->state = PRIMED_NONE;
+	slot->codec_type = clip->codec_type;
+	slot->num_streams = clip->num_streams;
+
+	dec = parse_header(clip, NULL, 0);
+	if (!dec)
+		return;
+
+	if (mux_decoder_snapshot(dec, NULL, 0, &size) == MUX_OK) {
+		slot->blob = malloc(size);
+		if (slot->blob &&
+		    mux_decoder_snapshot(dec, slot->blob, size, &size) == MUX_OK) {
+			slot->size = size;
+			slot->state = PRIMED_READY;
+		} else {
+			free(slot->blob);
+			slot->blob = NULL;
+		}
+	}
+
+	mux_decoder_destroy(dec);
+}
+
+struct mux_decoder *mux_pack_decoder_new(const struct mux_clip *clip,
+					 const struct mux_param *params,
+					 int num_params)
+{
+	struct pack_primed_slot *slot = NULL;
+	struct mux_decoder *dec;
+	int ready;
+
+	if (!clip)
+		return NULL;
+
+	if (clip->pack && clip->header_size > 0 && num_params == 0)
+		slot = primed_slot(clip);
+	if (!slot)
+		return parse_header(clip, params, num_params);
+
+	LOCK(clip->pack->primed);
+	if (slot->state == PRIMED_EMPTY)
+		prime_slot(slot, clip);
+	ready = slot->state == PRIMED_READY &&
+		slot->codec_type == clip->codec_type &&
+		slot->num_streams == clip->num_streams;
+	UNLOCK(clip->pack->primed);
+
+	/* A ready slot's blob stays put until mux_pack_close() */
+	if (ready) {
+		dec = mux_decoder_new_from_snapshot(slot->blob, slot->size);
+		if (dec)
+			return dec;
+	}
+
+	return parse_header(clip, params, num_params);
+}
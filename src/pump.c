@@ -0,0 +1,392 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define MUX_HAVE_PUMP 1
+#endif
+
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Non-blocking fd pumps
+ *
+ * Each call loops until no fd can make progress: flush queued output,
+ * then read and encode/decode whatever input is ready. The encoder's
+ * stream is written straight from its output buffer. Decoded output
+ * is staged through mux_decoder_read(), so state records, metrics and
+ * probes see it as they would any read. Reading pauses while a blocked
+ * output has PUMP_HIGH_WATER bytes queued, which bounds memory when
+ * the consumer is slower than the producer.
+ */
+#ifdef MUX_HAVE_PUMP
+
+#include <errno.h>
+#include <unistd.h>
+
+#define PUMP_BUFFER      65536
+#define PUMP_SIDE_BUFFER 4096
+#define PUMP_HIGH_WATER  (1 << 20)
+
+enum pump_result {
+	PUMP_READY,
+	PUMP_AGAIN,
+	PUMP_EOF,
+	PUMP_FAIL,
+};
+
+struct mux_pump {
+	uint8_t in[PUMP_BUFFER];
+	size_t in_len;               /* carried over: partial frame or unconsumed */
+	uint8_t side[PUMP_SIDE_BUFFER];
+	struct mux_buffer audio_out;  /* decoder: read, not yet written */
+	struct mux_buffer side_out;
+	int in_eof;
+	int side_eof;
+	int finalized;
+};
+
+void mux_pump_free(struct mux_pump *pump)
+{
+	if (!pump)
+		return;
+	mux_buffer_deinit(&pump->audio_out);
+	mux_buffer_deinit(&pump->side_out);
+	free(pump);
+}
+
+static int pump_read(int fd, void *data, size_t size, size_t *n)
+{
+	ssize_t r;
+
+	do {
+		r = read(fd, data, size);
+	} while (r < 0 && errno == EINTR);
+
+	if (r > 0) {
+		*n = (size_t)r;
+		return PUMP_READY;
+	}
+	if (r == 0)
+		return PUMP_EOF;
+	if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return PUMP_AGAIN;
+	return PUMP_FAIL;
+}
+
+/* Write out everything queued in buf; PUMP_READY once it is empty */
+static int pump_flush(int fd, struct mux_buffer *buf)
+{
+	size_t avail, n;
+	ssize_t w;
+
+	while ((avail = (size_t)mux_buffer_available(buf)) > 0) {
+		do {
+			w = write(fd, buf->data + buf->read_pos, avail);
+		} while (w < 0 && errno == EINTR);
+
+		if (w < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return PUMP_AGAIN;
+			return PUMP_FAIL;
+		}
+
+		mux_buffer_read(buf, NULL, (size_t)w, &n);
+	}
+
+	return PUMP_READY;
+}
+
+static struct mux_pump *pump_get(struct mux_pump **pump)
+{
+	if (!*pump)
+		*pump = calloc(1, sizeof(**pump));
+	return *pump;
+}
+
+static int encoder_io_error(struct mux_encoder *enc, const char *message)
+{
+	int err = errno;
+
+	mux_encoder_set_error(enc, MUX_ERROR, message, "libc", err,
+			      strerror(err));
+	return MUX_ERROR;
+}
+
+static int decoder_io_error(struct mux_decoder *dec, const char *message)
+{
+	int err = errno;
+
+	mux_decoder_set_error(dec, MUX_ERROR, message, "libc", err,
+			      strerror(err));
+	return MUX_ERROR;
+}
+
+int mux_encoder_pump(struct mux_encoder *enc, int in_fd, int side_fd,
+		     int out_fd, int *wait)
+{
+	struct mux_pump *p;
+	size_t frame, whole, n, consumed;
+	int ret, r, progress;
+
+	if (!enc || !enc->ops || in_fd < 0 || out_fd < 0 || !wait)
+		return MUX_ERROR_INVAL;
+
+	*wait = 0;
+
+	p = pump_get(&enc->pump);
+	if (!p)
+		return MUX_ERROR_NOMEM;
+
+	if (side_fd < 0 || enc->num_streams == 1)
+		p->side_eof = 1;
+
+	frame = (size_t)enc->num_channels * sizeof(int16_t);
+
+	do {
+		progress = 0;
+
+		r = pump_flush(out_fd, &enc->output);
+		if (r == PUMP_FAIL)
+			return encoder_io_error(enc, "Failed to write output");
+		if (r == PUMP_AGAIN) {
+			*wait |= MUX_PUMP_OUT;
+			if (mux_buffer_available(&enc->output) >= PUMP_HIGH_WATER)
+				break;
+		} else if (p->finalized) {
+			return MUX_ERROR_EOF;
+		}
+
+		/*
+		 * Side data goes first so it sits next to the audio it
+		 * annotates. side_fd is a byte stream; a read is split or
+		 * merged however the fd delivers it.
+		 */
+		if (!p->side_eof && !(*wait & MUX_PUMP_SIDE)) {
+			r = pump_read(side_fd, p->side, sizeof(p->side), &n);
+			if (r == PUMP_READY) {
+				ret = mux_encoder_encode(enc, p->side, n, &consumed,
+							 MUX_STREAM_SIDE_CHANNEL);
+				if (ret != MUX_OK)
+					return ret;
+				progress = 1;
+			} else if (r == PUMP_EOF) {
+				p->side_eof = 1;
+				progress = 1;
+			} else if (r == PUMP_AGAIN) {
+				*wait |= MUX_PUMP_SIDE;
+			} else {
+				return encoder_io_error(enc, "Failed to read side channel");
+			}
+		}
+
+		if (!p->in_eof && !(*wait & MUX_PUMP_IN) &&
+		    p->in_len < sizeof(p->in)) {
+			r = pump_read(in_fd, p->in + p->in_len,
+				      sizeof(p->in) - p->in_len, &n);
+			if (r == PUMP_READY) {
+				p->in_len += n;
+				whole = p->in_len - p->in_len % frame;
+				consumed = 0;
+				if (whole > 0) {
+					ret = mux_encoder_encode(enc, p->in, whole,
+								 &consumed,
+								 MUX_STREAM_AUDIO);
+					if (ret != MUX_OK)
+						return ret;
+				}
+				/* Keep a split frame for the next read */
+				memmove(p->in, p->in + consumed, p->in_len - consumed);
+				p->in_len -= consumed;
+				progress = 1;
+			} else if (r == PUMP_EOF) {
+				p->in_eof = 1;
+				progress = 1;
+			} else if (r == PUMP_AGAIN) {
+				*wait |= MUX_PUMP_IN;
+			} else {
+				return encoder_io_error(enc, "Failed to read audio");
+			}
+		}
+
+		/* A trailing partial frame at EOF is dropped, like mux(1) */
+		if (p->in_eof && p->side_eof && !p->finalized) {
+			ret = mux_encoder_finalize(enc);
+			if (ret != MUX_OK)
+				return ret;
+			p->finalized = 1;
+			progress = 1;
+		}
+	} while (progress);
+
+	return MUX_OK;
+}
+
+/*
+ * Read decoded output into the pump's staging buffers until one holds
+ * PUMP_BUFFER bytes; *empty is set once the decoder has nothing left
+ */
+static int pump_stage(struct mux_decoder *dec, struct mux_pump *p,
+		      int side_fd, int *progress, int *empty)
+{
+	uint8_t *dst;
+	size_t n;
+	int ret, stream_type;
+
+	/* Partial writes leave a read position to reclaim */
+	if (p->audio_out.read_pos > (size_t)mux_buffer_available(&p->audio_out))
+		mux_buffer_compact(&p->audio_out);
+	if (p->side_out.read_pos > (size_t)mux_buffer_available(&p->side_out))
+		mux_buffer_compact(&p->side_out);
+
+	*empty = 0;
+	while ((size_t)mux_buffer_available(&p->audio_out) < PUMP_BUFFER &&
+	       (size_t)mux_buffer_available(&p->side_out) < PUMP_BUFFER) {
+		dst = mux_buffer_reserve(&p->audio_out, PUMP_BUFFER);
+		if (!dst)
+			return MUX_ERROR_NOMEM;
+
+		stream_type = MUX_STREAM_AUDIO;
+		ret = mux_decoder_read(dec, dst, PUMP_BUFFER, &n, &stream_type);
+		if (ret != MUX_OK)
+			return ret;
+		if (n == 0) {
+			*empty = 1;
+			break;
+		}
+		*progress = 1;
+
+		/* Without a side_fd side data is dropped */
+		if (stream_type != MUX_STREAM_SIDE_CHANNEL)
+			p->audio_out.size += n;
+		else if (side_fd >= 0 &&
+			 (ret = mux_buffer_write(&p->side_out, dst, n)) != MUX_OK)
+			return ret;
+	}
+
+	return MUX_OK;
+}
+
+int mux_decoder_pump(struct mux_decoder *dec, int in_fd, int out_fd,
+		     int side_fd, int *wait)
+{
+	struct mux_pump *p;
+	size_t n, consumed;
+	int ret, r, progress, empty;
+
+	if (!dec || !dec->ops || in_fd < 0 || out_fd < 0 || !wait)
+		return MUX_ERROR_INVAL;
+
+	*wait = 0;
+
+	p = pump_get(&dec->pump);
+	if (!p)
+		return MUX_ERROR_NOMEM;
+
+	do {
+		progress = 0;
+
+		/* A lazy decoder decodes only what the staging buffers take */
+		ret = pump_stage(dec, p, side_fd, &progress, &empty);
+		if (ret != MUX_OK)
+			return ret;
+
+		if (side_fd >= 0) {
+			r = pump_flush(side_fd, &p->side_out);
+			if (r == PUMP_FAIL)
+				return decoder_io_error(dec,
+							"Failed to write side channel");
+			if (r == PUMP_AGAIN)
+				*wait |= MUX_PUMP_SIDE;
+		}
+
+		r = pump_flush(out_fd, &p->audio_out);
+		if (r == PUMP_FAIL)
+			return decoder_io_error(dec, "Failed to write audio");
+		if (r == PUMP_AGAIN)
+			*wait |= MUX_PUMP_OUT;
+
+		if (!(*wait & (MUX_PUMP_OUT | MUX_PUMP_SIDE)) && p->finalized &&
+		    empty)
+			return MUX_ERROR_EOF;
+
+		/* Don't take more input than a blocked output lets go */
+		if ((*wait & (MUX_PUMP_OUT | MUX_PUMP_SIDE)) &&
+		    (size_t)mux_buffer_available(&dec->audio_output) +
+		    (size_t)mux_buffer_available(&dec->side_output) +
+		    (size_t)mux_buffer_available(&dec->lazy_input) >=
+		    PUMP_HIGH_WATER)
+			break;
+
+		if (!p->in_eof && !(*wait & MUX_PUMP_IN) &&
+		    p->in_len < sizeof(p->in)) {
+			r = pump_read(in_fd, p->in + p->in_len,
+				      sizeof(p->in) - p->in_len, &n);
+			if (r == PUMP_READY) {
+				p->in_len += n;
+				progress = 1;
+			} else if (r == PUMP_EOF) {
+				p->in_eof = 1;
+				progress = 1;
+			} else if (r == PUMP_AGAIN) {
+				*wait |= MUX_PUMP_IN;
+			} else {
+				return decoder_io_error(dec, "Failed to read input");
+			}
+		}
+
+		/* A max_decode_input limit may leave input for the next round */
+		if (p->in_len > 0) {
+			ret = mux_decoder_decode(dec, p->in, p->in_len, &consumed);
+			if (ret != MUX_OK)
+				return ret;
+			memmove(p->in, p->in + consumed, p->in_len - consumed);
+			p->in_len -= consumed;
+			if (consumed > 0)
+				progress = 1;
+		}
+
+		if (p->in_eof && p->in_len == 0 && !p->finalized) {
+			ret = mux_decoder_finalize(dec);
+			if (ret != MUX_OK)
+				return ret;
+			p->finalized = 1;
+			progress = 1;
+		}
+	} while (progress);
+
+	return MUX_OK;
+}
+
+#else /* !MUX_HAVE_PUMP */
+
+void mux_pump_free(struct mux_pump *pump)
+{
+	(void)pump;
+}
+
+int mux_encoder_pump(struct mux_encoder *enc, int in_fd, int side_fd,
+		     int out_fd, int *wait)
+{
+	(void)enc;
+	(void)in_fd;
+	(void)side_fd;
+	(void)out_fd;
+	if (wait)
+		*wait = 0;
+	return MUX_ERROR_UNSUPPORTED;
+}
+
+int mux_decoder_pump(struct mux_decoder *dec, int in_fd, int out_fd,
+		     int side_fd, int *wait)
+{
+	(void)dec;
+	(void)in_fd;
+	(void)out_fd;
+	(void)side_fd;
+	if (wait)
+		*wait = 0;
+	return MUX_ERROR_UNSUPPORTED;
+}
+
+#endif /* MUX_HAVE_PUMP */
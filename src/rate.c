@@ -0,0 +1,298 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Encoder rate control
+ *
+ * A token bucket over the bytes each encode call appends to
+ * enc->output, whatever they are: codec payload, framing, container
+ * pages or side channel data. Credit accrues with the audio consumed,
+ * so the bucket runs on stream time and a faster-than-real-time
+ * encode is paced the same as a live one. Tokens are counted in units
+ * of 1 / (8 * sample_rate) byte, which makes one sample frame of
+ * credit exactly rate_bps units.
+ *
+ * Codecs with an encoder_set_bitrate op are steered from the fill
+ * level: full bitrate (the codec's own, capped at the link rate) down
+ * to half full, then proportionally less, down to an eighth. Side
+ * channel data only spends credit above half full and is otherwise
+ * queued, then released in slices as credit comes in. The queue is
+ * bounded: side data past it is left unconsumed for the caller.
+ */
+#define RATE_SIDE_SLICE_MIN 64        /* bytes, unless less is queued */
+#define RATE_SIDE_QUEUE_MAX (2 << 20) /* bytes; a state snapshot fits */
+#define RATE_SIDE_OVERHEAD  8         /* framing allowance per slice */
+
+struct mux_rate {
+	int rate_bps;
+	int64_t unit;                 /* units per byte */
+	int64_t capacity;
+	int64_t tokens;
+
+	int ceiling;                  /* codec bitrate, 0 = fixed rate */
+	int bitrate;                  /* last applied */
+
+	struct mux_buffer side;       /* deferred side channel data */
+	uint64_t bytes;
+};
+
+void mux_rate_free(struct mux_rate *rate)
+{
+	if (!rate)
+		return;
+
+	mux_buffer_deinit(&rate->side);
+	free(rate);
+}
+
+static size_t output_level(const struct mux_encoder *enc)
+{
+	return (size_t)mux_buffer_available(&enc->output);
+}
+
+/* Run a codec call and charge what it appended */
+static int charged_encode(struct mux_encoder *enc, const void *input,
+			  size_t input_size, size_t *input_consumed,
+			  int stream_type)
+{
+	struct mux_rate *r = enc->rate;
+	size_t before = output_level(enc), added;
+	int ret;
+
+	ret = enc->ops->encoder_encode(enc, input, input_size, input_consumed,
+				       stream_type);
+
+	added = output_level(enc) - before;
+	r->tokens -= (int64_t)added * r->unit;
+	r->bytes += added;
+	return ret;
+}
+
+/* Credit above the audio reserve, in bytes */
+static int64_t side_credit(const struct mux_rate *r)
+{
+	int64_t spare = r->tokens - r->capacity / 2;
+
+	return spare > 0 ? spare / r->unit : 0;
+}
+
+static int release_side(struct mux_encoder *enc, int all)
+{
+	struct mux_rate *r = enc->rate;
+	size_t queued, n, consumed;
+	int64_t credit;
+	int ret;
+
+	while ((queued = (size_t)mux_buffer_available(&r->side)) > 0) {
+		n = queued;
+		if (!all) {
+			credit = side_credit(r) - RATE_SIDE_OVERHEAD;
+			if (credit < (int64_t)(queued < RATE_SIDE_SLICE_MIN ?
+					       queued : RATE_SIDE_SLICE_MIN))
+				break;
+			if ((int64_t)n > credit)
+				n = (size_t)credit;
+		}
+
+		ret = charged_encode(enc, r->side.data + r->side.read_pos, n,
+				     &consumed, MUX_STREAM_SIDE_CHANNEL);
+		if (ret != MUX_OK)
+			return ret;
+		if (consumed == 0)
+			break;
+		r->side.read_pos += consumed;
+	}
+
+	if (mux_buffer_available(&r->side) == 0)
+		mux_buffer_clear(&r->side);
+	return MUX_OK;
+}
+
+static void steer(struct mux_encoder *enc)
+{
+	struct mux_rate *r = enc->rate;
+	int64_t target, cap, floor;
+	int applied;
+
+	if (!r->ceiling)
+		return;
+
+	cap = r->ceiling < r->rate_bps ? r->ceiling : r->rate_bps;
+	floor = cap / 8;
+	if (r->tokens >= r->capacity / 2)
+		target = cap;
+	else
+		target = r->tokens > 0 ? cap * r->tokens / (r->capacity / 2) : 0;
+	if (target < floor)
+		target = floor;
+
+	/* Leave the codec alone for small moves */
+	if (target == r->bitrate ||
+	    (target != cap && llabs(target - r->bitrate) < r->bitrate / 16))
+		return;
+
+	if (enc->ops->encoder_set_bitrate(enc, (int)target, &applied) == MUX_OK)
+		r->bitrate = applied;
+}
+
+int mux_rate_encode(struct mux_encoder *enc, const void *input,
+		    size_t input_size, size_t *input_consumed, int stream_type)
+{
+	struct mux_rate *r = enc->rate;
+	size_t frame_bytes, queued, room;
+	int ret;
+
+	if (stream_type == MUX_STREAM_SIDE_CHANNEL) {
+		if (!input || !input_consumed)
+			return MUX_ERROR_INVAL;
+
+		/* Straight through if nothing is waiting and there is room */
+		if (enc->num_streams == 1 ||
+		    (mux_buffer_available(&r->side) == 0 &&
+		     (int64_t)input_size + RATE_SIDE_OVERHEAD <= side_credit(r)))
+			return charged_encode(enc, input, input_size,
+					      input_consumed, stream_type);
+
+		/* Take what the queue has room for; the caller retries the rest */
+		queued = (size_t)mux_buffer_available(&r->side);
+		room = queued < RATE_SIDE_QUEUE_MAX ?
+		       RATE_SIDE_QUEUE_MAX - queued : 0;
+		if (room == 0 && input_size > 0) {
+			*input_consumed = 0;
+			mux_encoder_set_error(enc, MUX_ERROR_LIMIT,
+					      "Side channel queue full", NULL, 0,
+					      NULL);
+			return MUX_ERROR_LIMIT;
+		}
+		if (input_size > room)
+			input_size = room;
+
+		if (r->side.read_pos > (size_t)mux_buffer_available(&r->side))
+			mux_buffer_compact(&r->side);
+		ret = mux_buffer_write(&r->side, input, input_size);
+		if (ret != MUX_OK)
+			return ret;
+		*input_consumed = input_size;
+		return release_side(enc, 0);
+	}
+
+	ret = charged_encode(enc, input, input_size, input_consumed,
+			     stream_type);
+	if (ret != MUX_OK)
+		return ret;
+
+	frame_bytes = (size_t)enc->num_channels * sizeof(int16_t);
+	r->tokens += (int64_t)(*input_consumed / frame_bytes) * r->rate_bps;
+	if (r->tokens > r->capacity)
+		r->tokens = r->capacity;
+
+	steer(enc);
+	return release_side(enc, 0);
+}
+
+int mux_rate_splice(struct mux_encoder *enc, size_t bytes, uint64_t frames)
+{
+	struct mux_rate *r = enc->rate;
+
+	r->tokens -= (int64_t)bytes * r->unit;
+	r->bytes += bytes;
+	r->tokens += (int64_t)frames * r->rate_bps;
+	if (r->tokens > r->capacity)
+		r->tokens = r->capacity;
+
+	steer(enc);
+	return release_side(enc, 0);
+}
+
+int mux_rate_finalize(struct mux_encoder *enc)
+{
+	struct mux_rate *r = enc->rate;
+	size_t before;
+	int ret;
+
+	/* Nothing stays behind at the end of the stream */
+	ret = release_side(enc, 1);
+	if (ret != MUX_OK || !enc->ops->encoder_finalize)
+		return ret;
+
+	before = output_level(enc);
+	ret = enc->ops->encoder_finalize(enc);
+	r->tokens -= (int64_t)(output_level(enc) - before) * r->unit;
+	r->bytes += output_level(enc) - before;
+	return ret;
+}
+
+int mux_encoder_set_rate_limit(struct mux_encoder *enc, int rate_bps,
+			       int window_ms)
+{
+	struct mux_rate *r;
+	int bitrate = 0, ret;
+
+	if (!enc || !enc->ops || rate_bps < 0 ||
+	    (rate_bps > 0 && (window_ms <= 0 || window_ms > 60000)))
+		return MUX_ERROR_INVAL;
+
+	if (enc->hibernated) {
+		ret = mux_encoder_wake(enc);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	r = enc->rate;
+	if (rate_bps == 0) {
+		if (!r)
+			return MUX_OK;
+		/* Queued side data goes out and the codec gets its bitrate back */
+		ret = release_side(enc, 1);
+		if (r->ceiling && r->bitrate != r->ceiling)
+			enc->ops->encoder_set_bitrate(enc, r->ceiling, &bitrate);
+		mux_rate_free(r);
+		enc->rate = NULL;
+		return ret;
+	}
+
+	if (!r) {
+		r = calloc(1, sizeof(*r));
+		if (!r)
+			return MUX_ERROR_NOMEM;
+		if (mux_buffer_init(&r->side, 0) != MUX_OK) {
+			free(r);
+			return MUX_ERROR_NOMEM;
+		}
+		if (enc->ops->encoder_set_bitrate &&
+		    enc->ops->encoder_set_bitrate(enc, 0, &bitrate) == MUX_OK)
+			r->ceiling = bitrate;
+		r->bitrate = r->ceiling;
+		enc->rate = r;
+	}
+
+	/* A new limit starts with a full bucket */
+	r->rate_bps = rate_bps;
+	r->unit = 8 * (int64_t)enc->sample_rate;
+	r->capacity = (int64_t)rate_bps * enc->sample_rate * window_ms / 1000;
+	r->tokens = r->capacity;
+	steer(enc);
+	return MUX_OK;
+}
+
+int mux_encoder_get_rate_stats(const struct mux_encoder *enc,
+			       struct mux_rate_stats *stats)
+{
+	const struct mux_rate *r;
+
+	if (!enc || !stats)
+		return MUX_ERROR_INVAL;
+
+	r = enc->rate;
+	if (!r)
+		return MUX_ERROR_NOTFOUND;
+
+	stats->bytes = r->bytes;
+	stats->level = r->tokens / r->unit;
+	stats->bitrate = r->bitrate;
+	stats->side_queued = (size_t)mux_buffer_available(&r->side);
+	return MUX_OK;
+}
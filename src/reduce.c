@@ -0,0 +1,300 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <string.h>
+
+/*
+ * Monitoring-quality output reduction
+ *
+ * Downmix to mono and decimate in a single pass over the decoder's
+ * native output. Decimation is a box filter: every output sample is
+ * the mean of the input frames it covers, tracked with an integer
+ * phase so any ratio works without drift. That is cheap and good
+ * enough for confidence monitoring, not for production resampling.
+ * Output is never upsampled.
+ */
+#define REDUCE_CHUNK 2048
+
+const struct mux_param_desc mux_reduce_decoder_params[MUX_REDUCE_PARAM_COUNT] = {
+	{
+		.name = "output_rate",
+		.description = "Maximum output sample rate (0 = native)",
+		.type = MUX_PARAM_TYPE_INT,
+		.range.i = { .min = 0, .max = 384000, .def = 0 }
+	},
+	{
+		.name = "output_channels",
+		.description = "Output channels (0 = native, 1 = mono downmix)",
+		.type = MUX_PARAM_TYPE_INT,
+		.range.i = { .min = 0, .max = 1, .def = 0 }
+	}
+};
+
+struct reduce_out {
+	struct mux_pcm_reducer *r;
+	struct mux_decoder *dec;
+	size_t fill;
+	int16_t chunk[REDUCE_CHUNK];
+};
+
+int mux_pcm_reducer_setup(struct mux_pcm_reducer *r,
+			  const struct mux_param *params,
+			  int num_params)
+{
+	int i;
+
+	memset(r, 0, sizeof(*r));
+
+	for (i = 0; i < num_params; i++) {
+		if (strcmp(params[i].name, "output_rate") == 0)
+			r->req_rate = params[i].value.i;
+		else if (strcmp(params[i].name, "output_channels") == 0)
+			r->req_channels = params[i].value.i;
+	}
+
+	if (r->req_rate < 0 || (r->req_rate > 0 && r->req_rate < 1000) ||
+	    r->req_rate > 384000 ||
+	    r->req_channels < 0 || r->req_channels > 1)
+		return MUX_ERROR_INVAL;
+
+	return MUX_OK;
+}
+
+void mux_pcm_reducer_start(struct mux_pcm_reducer *r,
+			   int in_rate,
+			   int in_channels)
+{
+	r->in_rate = in_rate;
+	r->in_channels = in_channels;
+	r->out_rate = in_rate;
+	r->out_channels = in_channels;
+
+	if (r->req_rate > 0 && r->req_rate < in_rate)
+		r->out_rate = r->req_rate;
+	if (r->req_channels > 0 && r->req_channels < in_channels)
+		r->out_channels = r->req_channels;
+
+	/* Decimating many channels without a downmix isn't worth the state */
+	if (r->out_channels > MUX_REDUCE_MAX_CHANNELS)
+		r->out_rate = in_rate;
+
+	r->active = r->out_rate != in_rate || r->out_channels != in_channels;
+	r->phase = 0;
+	r->count = 0;
+	memset(r->acc, 0, sizeof(r->acc));
+}
+
+/*
+ * Hand reduced PCM to the decoder: its PCM sink when one is attached,
+ * audio_output otherwise
+ */
+static int reduce_emit(struct mux_pcm_reducer *r, struct mux_decoder *dec,
+		       const int16_t *pcm, size_t samples)
+{
+	if (dec->pcm_sink)
+		return dec->pcm_sink(dec->pcm_sink_ctx, pcm,
+				     samples / r->out_channels,
+				     r->out_channels, r->out_rate, r->in_rate);
+
+	return mux_buffer_write(&dec->audio_output, pcm,
+				samples * sizeof(int16_t));
+}
+
+static int reduce_flush(struct reduce_out *o)
+{
+	int ret;
+
+	if (o->fill == 0)
+		return MUX_OK;
+
+	ret = reduce_emit(o->r, o->dec, o->chunk, o->fill);
+	o->fill = 0;
+	return ret;
+}
+
+static void reduce_out_init(struct reduce_out *o, struct mux_pcm_reducer *r,
+			    struct mux_decoder *dec)
+{
+	o->r = r;
+	o->dec = dec;
+	o->fill = 0;
+}
+
+static int32_t clip16(int32_t v)
+{
+	if (v > 32767)
+		return 32767;
+	if (v < -32768)
+		return -32768;
+	return v;
+}
+
+/*
+ * Feed one (already downmixed) frame into the decimator
+ */
+static int reduce_push(struct mux_pcm_reducer *r, struct reduce_out *o,
+		       const int32_t *v)
+{
+	int c, ret;
+
+	for (c = 0; c < r->out_channels; c++)
+		r->acc[c] += v[c];
+	r->count++;
+
+	r->phase += (uint32_t)r->out_rate;
+	if (r->phase < (uint32_t)r->in_rate)
+		return MUX_OK;
+	r->phase -= (uint32_t)r->in_rate;
+
+	if (o->fill + r->out_channels > REDUCE_CHUNK) {
+		ret = reduce_flush(o);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	for (c = 0; c < r->out_channels; c++) {
+		o->chunk[o->fill++] = (int16_t)clip16(r->acc[c] /
+						      (int32_t)r->count);
+		r->acc[c] = 0;
+	}
+	r->count = 0;
+
+	return MUX_OK;
+}
+
+int mux_pcm_reducer_write_s16(struct mux_pcm_reducer *r,
+			      struct mux_decoder *dec,
+			      const int16_t *pcm,
+			      size_t frames)
+{
+	struct reduce_out o;
+	int32_t v[MUX_REDUCE_MAX_CHANNELS];
+	int ic = r->in_channels;
+	size_t i;
+	int c, ret;
+
+	if (!r->active)
+		return reduce_emit(r, dec, pcm, frames * ic);
+
+	reduce_out_init(&o, r, dec);
+
+	for (i = 0; i < frames; i++) {
+		const int16_t *f = pcm + i * ic;
+
+		if (r->out_channels < ic) {
+			int32_t sum = 0;
+
+			for (c = 0; c < ic; c++)
+				sum += f[c];
+			v[0] = sum / ic;
+		} else {
+			for (c = 0; c < ic; c++)
+				v[c] = f[c];
+		}
+
+		ret = reduce_push(r, &o, v);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	return reduce_flush(&o);
+}
+
+int mux_pcm_reducer_write_f32(struct mux_pcm_reducer *r,
+			      struct mux_decoder *dec,
+			      float *const *pcm,
+			      size_t frames)
+{
+	struct reduce_out o;
+	int32_t v[MUX_REDUCE_MAX_CHANNELS];
+	int ic = r->in_channels;
+	float scale = 32768.0f;
+	size_t i;
+	int c, ret;
+
+	reduce_out_init(&o, r, dec);
+
+	/* Plain planar float to interleaved int16 */
+	if (!r->active) {
+		for (i = 0; i < frames; i++) {
+			if (o.fill + ic > REDUCE_CHUNK) {
+				ret = reduce_flush(&o);
+				if (ret != MUX_OK)
+					return ret;
+			}
+			for (c = 0; c < ic; c++)
+				o.chunk[o.fill++] =
+					(int16_t)clip16((int32_t)(pcm[c][i] * scale));
+		}
+		return reduce_flush(&o);
+	}
+
+	if (r->out_channels < ic)
+		scale /= (float)ic;
+
+	for (i = 0; i < frames; i++) {
+		if (r->out_channels < ic) {
+			float sum = 0.0f;
+
+			for (c = 0; c < ic; c++)
+				sum += pcm[c][i];
+			v[0] = clip16((int32_t)(sum * scale));
+		} else {
+			for (c = 0; c < ic; c++)
+				v[c] = clip16((int32_t)(pcm[c][i] * scale));
+		}
+
+		ret = reduce_push(r, &o, v);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	return reduce_flush(&o);
+}
+
+int mux_pcm_reducer_write_s32(struct mux_pcm_reducer *r,
+			      struct mux_decoder *dec,
+			      const int32_t *const *pcm,
+			      size_t frames)
+{
+	struct reduce_out o;
+	int32_t v[MUX_REDUCE_MAX_CHANNELS];
+	int ic = r->in_channels;
+	size_t i;
+	int c, ret;
+
+	reduce_out_init(&o, r, dec);
+
+	/* Plain planar int32 to interleaved int16 */
+	if (!r->active) {
+		for (i = 0; i < frames; i++) {
+			if (o.fill + ic > REDUCE_CHUNK) {
+				ret = reduce_flush(&o);
+				if (ret != MUX_OK)
+					return ret;
+			}
+			for (c = 0; c < ic; c++)
+				o.chunk[o.fill++] = (int16_t)pcm[c][i];
+		}
+		return reduce_flush(&o);
+	}
+
+	for (i = 0; i < frames; i++) {
+		if (r->out_channels < ic) {
+			int64_t sum = 0;
+
+			for (c = 0; c < ic; c++)
+				sum += pcm[c][i];
+			v[0] = clip16((int32_t)(sum / ic));
+		} else {
+			for (c = 0; c < ic; c++)
+				v[c] = (int16_t)pcm[c][i];
+		}
+
+		ret = reduce_push(r, &o, v);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	return reduce_flush(&o);
+}
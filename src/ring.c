@@ -0,0 +1,627 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define _GNU_SOURCE
+#define MUX_HAVE_RING 1
+#endif
+
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Shared-memory single-producer/single-consumer byte ring
+ *
+ * The ring lives in a memfd: one header page followed by the data
+ * area, which is mapped twice back to back so any readable or
+ * writable region is contiguous in memory. Head and tail are
+ * free-running 64-bit byte counters, each written by one side only.
+ * A side that has to block advertises it with a waiting flag and
+ * sleeps on a futex sequence word, so the other side only makes a
+ * syscall when someone is actually asleep.
+ */
+#ifdef MUX_HAVE_RING
+
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_MAGIC   0x5258554du  /* "MUXR" */
+#define RING_VERSION 1
+#define RING_SPIN    2000
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() do { } while (0)
+#endif
+
+/* Each side's fields get their own cache line */
+struct ring_shared {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;
+	uint32_t closed;              /* producer has finished */
+	uint8_t pad0[44];
+
+	uint64_t head;                /* written by producer */
+	uint32_t data_seq;            /* futex: bumped on commit */
+	uint32_t consumer_waiting;
+	uint8_t pad1[48];
+
+	uint64_t tail;                /* written by consumer */
+	uint32_t space_seq;           /* futex: bumped on release */
+	uint32_t producer_waiting;
+	uint8_t pad2[48];
+};
+
+struct mux_ring {
+	struct ring_shared *shm;
+	uint8_t *data;
+	size_t capacity;
+	size_t header_size;
+	int spin;                     /* spins before sleeping, 0 on one CPU */
+	int fd;
+};
+
+static long futex(uint32_t *word, int op, uint32_t val,
+		  const struct timespec *timeout)
+{
+	return syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+static int map_ring(struct mux_ring *ring)
+{
+	size_t total = ring->header_size + 2 * ring->capacity;
+	uint8_t *base, *p;
+
+	/* Reserve the whole range, then map the file into it twice */
+	base = mmap(NULL, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return MUX_ERROR_NOMEM;
+
+	p = mmap(base, ring->header_size + ring->capacity,
+		 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, ring->fd, 0);
+	if (p == MAP_FAILED)
+		goto fail;
+
+	p = mmap(base + ring->header_size + ring->capacity, ring->capacity,
+		 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, ring->fd,
+		 (off_t)ring->header_size);
+	if (p == MAP_FAILED)
+		goto fail;
+
+	ring->shm = (struct ring_shared *)base;
+	ring->data = base + ring->header_size;
+	ring->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPIN : 0;
+	return MUX_OK;
+
+fail:
+	munmap(base, total);
+	return MUX_ERROR_NOMEM;
+}
+
+struct mux_ring *mux_ring_create(size_t capacity)
+{
+	struct mux_ring *ring;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	if (capacity == 0 || capacity > ((size_t)1 << 40))
+		return NULL;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->header_size = page;
+	ring->capacity = (capacity + page - 1) / page * page;
+
+	ring->fd = (int)syscall(SYS_memfd_create, "muxaudio-ring", 0);
+	if (ring->fd < 0) {
+		free(ring);
+		return NULL;
+	}
+
+	if (ftruncate(ring->fd, (off_t)(ring->header_size + ring->capacity)) != 0 ||
+	    map_ring(ring) != MUX_OK) {
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	/* Fresh memfd pages are zero; only the identity needs filling in */
+	ring->shm->capacity = ring->capacity;
+	ring->shm->version = RING_VERSION;
+	__atomic_store_n(&ring->shm->magic, RING_MAGIC, __ATOMIC_RELEASE);
+
+	return ring;
+}
+
+struct mux_ring *mux_ring_open(int fd)
+{
+	struct mux_ring *ring;
+	struct ring_shared *hdr;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	struct stat st;
+	uint64_t capacity;
+
+	if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size <= page)
+		return NULL;
+
+	hdr = mmap(NULL, page, PROT_READ, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		return NULL;
+
+	capacity = hdr->capacity;
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+	    hdr->version != RING_VERSION || capacity == 0 ||
+	    capacity % page != 0 || (uint64_t)st.st_size != page + capacity) {
+		munmap(hdr, page);
+		return NULL;
+	}
+	munmap(hdr, page);
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->header_size = page;
+	ring->capacity = (size_t)capacity;
+	ring->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (ring->fd < 0) {
+		free(ring);
+		return NULL;
+	}
+
+	if (map_ring(ring) != MUX_OK) {
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	return ring;
+}
+
+void mux_ring_close(struct mux_ring *ring)
+{
+	if (!ring)
+		return;
+
+	munmap(ring->shm, ring->header_size + 2 * ring->capacity);
+	close(ring->fd);
+	free(ring);
+}
+
+int mux_ring_fd(const struct mux_ring *ring)
+{
+	return ring ? ring->fd : -1;
+}
+
+size_t mux_ring_capacity(const struct mux_ring *ring)
+{
+	return ring ? ring->capacity : 0;
+}
+
+/*
+ * Sleep on *seq until the other side bumps it or the deadline passes.
+ * The caller has already published its waiting flag and re-checked.
+ */
+static void ring_sleep(const struct mux_ring *ring, uint32_t *seq,
+		       uint32_t seen, uint64_t deadline)
+{
+	struct timespec ts, *tsp = NULL;
+	int spin;
+
+	/* The other side is usually mid-chunk; a short spin saves two syscalls */
+	for (spin = 0; spin < ring->spin; spin++) {
+		if (__atomic_load_n(seq, __ATOMIC_ACQUIRE) != seen)
+			return;
+		cpu_relax();
+	}
+
+	if (deadline != UINT64_MAX) {
+		uint64_t now = mux_clock_ns();
+		uint64_t left = deadline > now ? deadline - now : 0;
+
+		if (left == 0)
+			return;
+		ts.tv_sec = (time_t)(left / 1000000000ULL);
+		ts.tv_nsec = (long)(left % 1000000000ULL);
+		tsp = &ts;
+	}
+
+	futex(seq, FUTEX_WAIT, seen, tsp);
+}
+
+static void ring_wake(uint32_t *seq, uint32_t *waiting)
+{
+	__atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+		futex(seq, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+static uint64_t deadline_for(int timeout_ms)
+{
+	if (timeout_ms < 0)
+		return UINT64_MAX;
+	return mux_clock_ns() + (uint64_t)timeout_ms * 1000000ULL;
+}
+
+int mux_ring_write_acquire(struct mux_ring *ring, void **ptr,
+			   size_t *avail, int timeout_ms)
+{
+	struct ring_shared *s;
+	uint64_t deadline = 0, head;
+	uint32_t seq;
+	size_t space;
+
+	if (!ring || !ptr || !avail)
+		return MUX_ERROR_INVAL;
+
+	s = ring->shm;
+	head = s->head;
+
+	for (;;) {
+		space = ring->capacity -
+			(size_t)(head - __atomic_load_n(&s->tail, __ATOMIC_SEQ_CST));
+		if (space > 0 || timeout_ms == 0)
+			break;
+
+		if (!deadline)
+			deadline = deadline_for(timeout_ms);
+		else if (mux_clock_ns() >= deadline)
+			break;
+
+		seq = __atomic_load_n(&s->space_seq, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&s->producer_waiting, 1, __ATOMIC_SEQ_CST);
+		if (ring->capacity -
+		    (size_t)(head - __atomic_load_n(&s->tail, __ATOMIC_SEQ_CST)) == 0)
+			ring_sleep(ring, &s->space_seq, seq, deadline);
+		__atomic_store_n(&s->producer_waiting, 0, __ATOMIC_SEQ_CST);
+	}
+
+	*ptr = ring->data + (size_t)(head % ring->capacity);
+	*avail = space;
+	return MUX_OK;
+}
+
+int mux_ring_write_commit(struct mux_ring *ring, size_t size)
+{
+	struct ring_shared *s;
+
+	if (!ring)
+		return MUX_ERROR_INVAL;
+
+	s = ring->shm;
+	if (size > ring->capacity -
+		   (size_t)(s->head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE)))
+		return MUX_ERROR_INVAL;
+	if (size == 0)
+		return MUX_OK;
+
+	__atomic_store_n(&s->head, s->head + size, __ATOMIC_SEQ_CST);
+	ring_wake(&s->data_seq, &s->consumer_waiting);
+	return MUX_OK;
+}
+
+int mux_ring_write(struct mux_ring *ring, const void *data, size_t size,
+		   size_t *written, int timeout_ms)
+{
+	void *ptr;
+	size_t avail;
+	int ret;
+
+	if (!ring || !data || !written)
+		return MUX_ERROR_INVAL;
+
+	*written = 0;
+	if (size == 0)
+		return MUX_OK;
+
+	ret = mux_ring_write_acquire(ring, &ptr, &avail, timeout_ms);
+	if (ret != MUX_OK)
+		return ret;
+
+	if (avail > size)
+		avail = size;
+	memcpy(ptr, data, avail);
+	*written = avail;
+
+	return mux_ring_write_commit(ring, avail);
+}
+
+void mux_ring_shutdown(struct mux_ring *ring)
+{
+	if (!ring)
+		return;
+
+	__atomic_store_n(&ring->shm->closed, 1, __ATOMIC_SEQ_CST);
+	ring_wake(&ring->shm->data_seq, &ring->shm->consumer_waiting);
+}
+
+/*
+ * Wait until at least @min bytes are readable. Once the producer has
+ * closed the ring with fewer left, return MUX_ERROR_EOF with whatever
+ * remains in *avail.
+ */
+static int ring_acquire(struct mux_ring *ring, size_t min, const void **ptr,
+			size_t *avail, int timeout_ms)
+{
+	struct ring_shared *s = ring->shm;
+	uint64_t deadline = 0, tail = s->tail;
+	uint32_t seq;
+	size_t used;
+	int closed;
+
+	for (;;) {
+		closed = __atomic_load_n(&s->closed, __ATOMIC_SEQ_CST);
+		used = (size_t)(__atomic_load_n(&s->head, __ATOMIC_SEQ_CST) - tail);
+		if (used >= min || closed || timeout_ms == 0)
+			break;
+
+		if (!deadline)
+			deadline = deadline_for(timeout_ms);
+		else if (mux_clock_ns() >= deadline)
+			break;
+
+		seq = __atomic_load_n(&s->data_seq, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&s->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&s->head, __ATOMIC_SEQ_CST) - tail < min &&
+		    !__atomic_load_n(&s->closed, __ATOMIC_SEQ_CST))
+			ring_sleep(ring, &s->data_seq, seq, deadline);
+		__atomic_store_n(&s->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+	}
+
+	*ptr = ring->data + (size_t)(tail % ring->capacity);
+	*avail = used;
+
+	/* Producer finished and nothing more will arrive */
+	if (used < min && closed)
+		return MUX_ERROR_EOF;
+	return MUX_OK;
+}
+
+int mux_ring_read_acquire(struct mux_ring *ring, const void **ptr,
+			  size_t *avail, int timeout_ms)
+{
+	if (!ring || !ptr || !avail)
+		return MUX_ERROR_INVAL;
+
+	return ring_acquire(ring, 1, ptr, avail, timeout_ms);
+}
+
+int mux_ring_read_release(struct mux_ring *ring, size_t size)
+{
+	struct ring_shared *s;
+
+	if (!ring)
+		return MUX_ERROR_INVAL;
+
+	s = ring->shm;
+	if (size > (size_t)(__atomic_load_n(&s->head, __ATOMIC_ACQUIRE) - s->tail))
+		return MUX_ERROR_INVAL;
+	if (size == 0)
+		return MUX_OK;
+
+	__atomic_store_n(&s->tail, s->tail + size, __ATOMIC_SEQ_CST);
+	ring_wake(&s->space_seq, &s->producer_waiting);
+	return MUX_OK;
+}
+
+int mux_ring_read(struct mux_ring *ring, void *data, size_t size,
+		  size_t *bytes_read, int timeout_ms)
+{
+	const void *ptr;
+	size_t avail;
+	int ret;
+
+	if (!ring || !data || !bytes_read)
+		return MUX_ERROR_INVAL;
+
+	*bytes_read = 0;
+	if (size == 0)
+		return MUX_OK;
+
+	ret = mux_ring_read_acquire(ring, &ptr, &avail, timeout_ms);
+	if (ret != MUX_OK)
+		return ret;
+
+	if (avail > size)
+		avail = size;
+	memcpy(data, ptr, avail);
+	*bytes_read = avail;
+
+	return mux_ring_read_release(ring, avail);
+}
+
+#else /* !MUX_HAVE_RING */
+
+static int ring_acquire(struct mux_ring *ring, size_t min, const void **ptr,
+			size_t *avail, int timeout_ms)
+{
+	(void)ring;
+	(void)min;
+	(void)ptr;
+	(void)avail;
+	(void)timeout_ms;
+	return MUX_ERROR_UNSUPPORTED;
+}
+
+struct mux_ring *mux_ring_create(size_t capacity)
+{
+	(void)capacity;
+	return NULL;
+}
+
+struct mux_ring *mux_ring_open(int fd)
+{
+	(void)fd;
+	return NULL;
+}
+
+void mux_ring_close(struct mux_ring *ring)
+{
+	(void)ring;
+}
+
+int mux_ring_fd(const struct mux_ring *ring)
+{
+	(void)ring;
+	return -1;
+}
+
+size_t mux_ring_capacity(const struct mux_ring *ring)
+{
+	(void)ring;
+	return 0;
+}
+
+int mux_ring_write_acquire(struct mux_ring *ring, void **ptr,
+			   size_t *avail, int timeout_ms)
+{
+	(void)ring;
+	(void)ptr;
+	(void)avail;
+	(void)timeout_ms;
+	return MUX_ERROR_UNSUPPORTED;
+}
+
+int mux_ring_write_commit(struct mux_ring *ring, size_t size)
+{
+	(void)ring;
+	(void)size;
+	return MUX_ERROR_UNSUPPORTED;
+}
+
+int mux_ring_write(struct mux_ring *ring, const void *data, size_t size,
+		   size_t *written, int timeout_ms)
+{
+	(void)ring;
+	(void)data;
+	(void)size;
+	(void)written;
+	(void)timeout_ms;
+	return MUX_ERROR_UNSUPPORTED;
+}
+
+void mux_ring_shutdown(struct mux_ring *ring)
+{
+	(void)ring;
+}
+
+int mux_ring_read_acquire(struct mux_ring *ring, const void **ptr,
+			  size_t *avail, int timeout_ms)
+{
+	(void)ring;
+	(void)ptr;
+	(void)avail;
+	(void)timeout_ms;
+	return MUX_ERROR_UNSUPPORTED;
+}
+
+int mux_ring_read_release(struct mux_ring *ring, size_t size)
+{
+	(void)ring;
+	(void)size;
+	return MUX_ERROR_UNSUPPORTED;
+}
+
+int mux_ring_read(struct mux_ring *ring, void *data, size_t size,
+		  size_t *bytes_read, int timeout_ms)
+{
+	(void)ring;
+	(void)data;
+	(void)size;
+	(void)bytes_read;
+	(void)timeout_ms;
+	return MUX_ERROR_UNSUPPORTED;
+}
+
+#endif /* MUX_HAVE_RING */
+
+/*
+ * Encode whatever whole PCM frames the ring holds, directly from the
+ * shared mapping, waiting for the tail of a split frame
+ */
+int mux_encoder_encode_ring(struct mux_encoder *enc, struct mux_ring *ring,
+			    int timeout_ms, size_t *input_consumed)
+{
+	const void *ptr;
+	size_t avail, frame, consumed;
+	int ret;
+
+	if (!enc || !ring || !input_consumed)
+		return MUX_ERROR_INVAL;
+
+	*input_consumed = 0;
+
+	/* A frame split by the producer stays in the ring until complete */
+	frame = (size_t)enc->num_channels * sizeof(int16_t);
+	ret = ring_acquire(ring, frame, &ptr, &avail, timeout_ms);
+	if (ret == MUX_ERROR_EOF && avail > 0) {
+		/* The producer left a partial frame behind: drop it */
+		mux_ring_read_release(ring, avail);
+		return MUX_ERROR_EOF;
+	}
+	if (ret != MUX_OK)
+		return ret;
+
+	avail -= avail % frame;
+	if (avail == 0)
+		return MUX_OK;
+
+	ret = mux_encoder_encode(enc, ptr, avail, &consumed, MUX_STREAM_AUDIO);
+	if (ret != MUX_OK)
+		return ret;
+
+	*input_consumed = consumed;
+	return mux_ring_read_release(ring, consumed);
+}
+
+/*
+ * Move decoded audio straight from the decoder's output into the ring.
+ * Side channel data stays queued for mux_decoder_read().
+ */
+int mux_decoder_read_ring(struct mux_decoder *dec, struct mux_ring *ring,
+			  int timeout_ms, size_t *output_written)
+{
+	void *ptr;
+	size_t avail, n;
+	int ret;
+
+	if (!dec || !ring || !output_written)
+		return MUX_ERROR_INVAL;
+
+	*output_written = 0;
+
+	ret = mux_lazy_pull(dec, mux_ring_capacity(ring));
+	if (ret != MUX_OK)
+		return ret;
+
+	while (mux_buffer_available(&dec->audio_output) > 0) {
+		ret = mux_ring_write_acquire(ring, &ptr, &avail,
+					     *output_written ? 0 : timeout_ms);
+		if (ret != MUX_OK)
+			return ret;
+		if (avail == 0)
+			break;
+
+		ret = mux_buffer_read(&dec->audio_output, ptr, avail, &n);
+		if (ret != MUX_OK)
+			return ret;
+
+		ret = mux_ring_write_commit(ring, n);
+		if (ret != MUX_OK)
+			return ret;
+		*output_written += n;
+	}
+
+	return MUX_OK;
+}
@@ -0,0 +1,590 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Snapshot blob layout:
+ *
+ *   "MUXS" | version | abi | kind | codec | sample_rate | num_channels |
+ *   num_streams | decoder params | pending output buffer(s) |
+ *   lazy decoder input | codec-specific state
+ *
+ * Codec state comes last so everything else is checked before a codec
+ * restore starts changing anything.
+ *
+ * Integers are stored in host byte order. Blobs are only meant to move
+ * between processes running the same build on the same architecture,
+ * which the abi word checks.
+ */
+#define SNAPSHOT_MAGIC    "MUXS"
+#define SNAPSHOT_VERSION  5
+#define SNAPSHOT_ENCODER  0
+#define SNAPSHOT_DECODER  1
+#define SNAPSHOT_PARAMS_MAX 64
+#define SNAPSHOT_NAME_MAX   255
+
+struct snapshot_header {
+	uint32_t kind;
+	uint32_t codec_type;
+	int32_t sample_rate;
+	int32_t num_channels;
+	int32_t num_streams;
+};
+
+static uint32_t snapshot_abi(void)
+{
+	const uint16_t probe = 1;
+
+	return (uint32_t)sizeof(void *) |
+	       ((uint32_t)*(const uint8_t *)&probe << 8);
+}
+
+/*
+ * Serialization helpers
+ */
+int mux_snap_put(struct mux_buffer *blob, const void *data, size_t size)
+{
+	if (size == 0)
+		return MUX_OK;
+
+	return mux_buffer_write(blob, data, size);
+}
+
+int mux_snap_put_u32(struct mux_buffer *blob, uint32_t value)
+{
+	return mux_buffer_write(blob, &value, sizeof(value));
+}
+
+int mux_snap_put_u64(struct mux_buffer *blob, uint64_t value)
+{
+	return mux_buffer_write(blob, &value, sizeof(value));
+}
+
+int mux_snap_put_bytes(struct mux_buffer *blob, const void *data, size_t size)
+{
+	int ret;
+
+	ret = mux_snap_put_u64(blob, size);
+	if (ret != MUX_OK)
+		return ret;
+
+	return mux_snap_put(blob, data, size);
+}
+
+int mux_snap_put_buffer(struct mux_buffer *blob, const struct mux_buffer *buf)
+{
+	return mux_snap_put_bytes(blob, buf->data + buf->read_pos,
+				  buf->size - buf->read_pos);
+}
+
+int mux_snap_get(struct mux_snap_reader *r, void *data, size_t size)
+{
+	if (r->size - r->pos < size)
+		return MUX_ERROR_FORMAT;
+
+	if (size > 0)
+		memcpy(data, r->data + r->pos, size);
+	r->pos += size;
+
+	return MUX_OK;
+}
+
+int mux_snap_get_u32(struct mux_snap_reader *r, uint32_t *value)
+{
+	return mux_snap_get(r, value, sizeof(*value));
+}
+
+int mux_snap_get_u64(struct mux_snap_reader *r, uint64_t *value)
+{
+	return mux_snap_get(r, value, sizeof(*value));
+}
+
+int mux_snap_get_bytes(struct mux_snap_reader *r, const uint8_t **data,
+		       size_t *size)
+{
+	uint64_t len;
+	int ret;
+
+	ret = mux_snap_get_u64(r, &len);
+	if (ret != MUX_OK)
+		return ret;
+
+	if (r->size - r->pos < len)
+		return MUX_ERROR_FORMAT;
+
+	*data = r->data + r->pos;
+	*size = (size_t)len;
+	r->pos += (size_t)len;
+
+	return MUX_OK;
+}
+
+/*
+ * Take a saved buffer out of the blob without applying it yet. Room is
+ * made up front so that mux_snap_commit_buffer() cannot fail.
+ */
+int mux_snap_stage_buffer(struct mux_snap_reader *r, struct mux_buffer *buf,
+			  const uint8_t **data, size_t *size)
+{
+	int ret;
+
+	ret = mux_snap_get_bytes(r, data, size);
+	if (ret != MUX_OK)
+		return ret;
+
+	if (*size > buf->capacity && !mux_buffer_reserve(buf, *size))
+		return MUX_ERROR_NOMEM;
+
+	return MUX_OK;
+}
+
+void mux_snap_commit_buffer(struct mux_buffer *buf, const uint8_t *data,
+			    size_t size)
+{
+	mux_buffer_clear(buf);
+	mux_snap_put(buf, data, size);
+}
+
+int mux_snap_end(const struct mux_snap_reader *r)
+{
+	return r->pos == r->size ? MUX_OK : MUX_ERROR_FORMAT;
+}
+
+static int put_header(struct mux_buffer *blob,
+		      const struct snapshot_header *hdr)
+{
+	int ret;
+
+	ret = mux_snap_put(blob, SNAPSHOT_MAGIC, 4);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u32(blob, SNAPSHOT_VERSION);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_u32(blob, snapshot_abi());
+	if (ret == MUX_OK)
+		ret = mux_snap_put(blob, hdr, sizeof(*hdr));
+
+	return ret;
+}
+
+static int get_header(struct mux_snap_reader *r, struct snapshot_header *hdr)
+{
+	char magic[4];
+	uint32_t version, abi;
+
+	if (mux_snap_get(r, magic, sizeof(magic)) != MUX_OK ||
+	    memcmp(magic, SNAPSHOT_MAGIC, 4) != 0)
+		return MUX_ERROR_FORMAT;
+
+	if (mux_snap_get_u32(r, &version) != MUX_OK ||
+	    version != SNAPSHOT_VERSION)
+		return MUX_ERROR_FORMAT;
+
+	if (mux_snap_get_u32(r, &abi) != MUX_OK || abi != snapshot_abi())
+		return MUX_ERROR_FORMAT;
+
+	return mux_snap_get(r, hdr, sizeof(*hdr));
+}
+
+/*
+ * Copy a serialized blob out to the caller, or just report its size
+ */
+static int emit_blob(const struct mux_buffer *blob, void *out,
+		     size_t out_size, size_t *out_written)
+{
+	*out_written = blob->size;
+
+	if (!out)
+		return MUX_OK;
+
+	if (out_size < blob->size)
+		return MUX_ERROR_INVAL;
+
+	memcpy(out, blob->data, blob->size);
+	return MUX_OK;
+}
+
+/*
+ * Encoder snapshot/restore
+ */
+int mux_encoder_snapshot(struct mux_encoder *enc,
+			 void *blob,
+			 size_t blob_size,
+			 size_t *blob_written)
+{
+	struct snapshot_header hdr;
+	struct mux_buffer b;
+	int ret;
+
+	if (!enc || !enc->ops || !blob_written)
+		return MUX_ERROR_INVAL;
+
+	if (!enc->ops->encoder_snapshot || !enc->ops->encoder_restore) {
+		mux_encoder_set_error(enc, MUX_ERROR_UNSUPPORTED,
+				      "Codec does not support snapshots",
+				      NULL, 0, NULL);
+		return MUX_ERROR_UNSUPPORTED;
+	}
+
+	if (enc->hibernated) {
+		ret = mux_encoder_wake(enc);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	ret = mux_buffer_init(&b, 4096);
+	if (ret != MUX_OK)
+		return ret;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.kind = SNAPSHOT_ENCODER;
+	hdr.codec_type = enc->codec_type;
+	hdr.sample_rate = enc->sample_rate;
+	hdr.num_channels = enc->num_channels;
+	hdr.num_streams = enc->num_streams;
+
+	ret = put_header(&b, &hdr);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_buffer(&b, &enc->output);
+	if (ret == MUX_OK)
+		ret = enc->ops->encoder_snapshot(enc, &b);
+	if (ret == MUX_OK)
+		ret = emit_blob(&b, blob, blob_size, blob_written);
+
+	mux_buffer_deinit(&b);
+	return ret;
+}
+
+int mux_encoder_restore(struct mux_encoder *enc,
+			const void *blob,
+			size_t blob_size)
+{
+	struct snapshot_header hdr;
+	struct mux_snap_reader r = { blob, blob_size, 0 };
+	const uint8_t *output;
+	size_t output_size;
+	int ret;
+
+	if (!enc || !enc->ops || !blob)
+		return MUX_ERROR_INVAL;
+
+	if (!enc->ops->encoder_snapshot || !enc->ops->encoder_restore) {
+		mux_encoder_set_error(enc, MUX_ERROR_UNSUPPORTED,
+				      "Codec does not support snapshots",
+				      NULL, 0, NULL);
+		return MUX_ERROR_UNSUPPORTED;
+	}
+
+	if (enc->hibernated) {
+		ret = mux_encoder_wake(enc);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	ret = get_header(&r, &hdr);
+	if (ret != MUX_OK || hdr.kind != SNAPSHOT_ENCODER) {
+		mux_encoder_set_error(enc, MUX_ERROR_FORMAT,
+				      "Not an encoder snapshot for this build",
+				      NULL, 0, NULL);
+		return MUX_ERROR_FORMAT;
+	}
+
+	if (hdr.codec_type != (uint32_t)enc->codec_type ||
+	    hdr.sample_rate != enc->sample_rate ||
+	    hdr.num_channels != enc->num_channels ||
+	    hdr.num_streams != enc->num_streams) {
+		mux_encoder_set_error(enc, MUX_ERROR_INVAL,
+				      "Snapshot configuration does not match encoder",
+				      NULL, 0, NULL);
+		return MUX_ERROR_INVAL;
+	}
+
+	ret = mux_snap_stage_buffer(&r, &enc->output, &output, &output_size);
+	if (ret == MUX_OK)
+		ret = enc->ops->encoder_restore(enc, &r);
+	if (ret == MUX_OK)
+		ret = mux_snap_end(&r);
+	if (ret == MUX_OK)
+		mux_snap_commit_buffer(&enc->output, output, output_size);
+
+	if (ret == MUX_ERROR_FORMAT)
+		mux_encoder_set_error(enc, ret, "Corrupt encoder snapshot",
+				      NULL, 0, NULL);
+
+	return ret;
+}
+
+struct mux_encoder *mux_encoder_new_from_snapshot(const void *blob,
+						  size_t blob_size)
+{
+	struct snapshot_header hdr;
+	struct mux_snap_reader r = { blob, blob_size, 0 };
+	struct mux_encoder *enc;
+
+	if (!blob || get_header(&r, &hdr) != MUX_OK ||
+	    hdr.kind != SNAPSHOT_ENCODER)
+		return NULL;
+
+	enc = mux_encoder_new(hdr.codec_type, hdr.sample_rate,
+			      hdr.num_channels, hdr.num_streams, NULL, 0);
+	if (!enc)
+		return NULL;
+
+	if (mux_encoder_restore(enc, blob, blob_size) != MUX_OK) {
+		mux_encoder_destroy(enc);
+		return NULL;
+	}
+
+	return enc;
+}
+
+/*
+ * Decoder params go along so that a session made from the blob is set
+ * up like the original (lazy, limits, output reduction, groups). Values
+ * are saved as their first 32 bits, which holds any int, bool or float.
+ */
+static int put_params(struct mux_buffer *blob, const struct mux_param *params,
+		      int num_params)
+{
+	uint32_t value;
+	int i, ret;
+
+	ret = mux_snap_put_u32(blob, (uint32_t)num_params);
+	for (i = 0; i < num_params && ret == MUX_OK; i++) {
+		memcpy(&value, &params[i].value, sizeof(value));
+		ret = mux_snap_put_bytes(blob, params[i].name,
+					 strlen(params[i].name));
+		if (ret == MUX_OK)
+			ret = mux_snap_put_u32(blob, value);
+	}
+
+	return ret;
+}
+
+/* With params NULL they are only checked and skipped */
+static int get_params(struct mux_snap_reader *r, struct mux_param **params,
+		      int *num_params)
+{
+	struct mux_param *p = NULL;
+	const uint8_t *name;
+	uint32_t count, value, i;
+	size_t len;
+	char *copy;
+	int ret;
+
+	ret = mux_snap_get_u32(r, &count);
+	if (ret != MUX_OK)
+		return ret;
+	if (count > SNAPSHOT_PARAMS_MAX)
+		return MUX_ERROR_FORMAT;
+
+	if (params && count > 0) {
+		p = calloc(count, sizeof(*p));
+		if (!p)
+			return MUX_ERROR_NOMEM;
+	}
+
+	for (i = 0; i < count; i++) {
+		ret = mux_snap_get_bytes(r, &name, &len);
+		if (ret == MUX_OK)
+			ret = mux_snap_get_u32(r, &value);
+		if (ret == MUX_OK && (len == 0 || len > SNAPSHOT_NAME_MAX ||
+				      memchr(name, 0, len)))
+			ret = MUX_ERROR_FORMAT;
+		if (ret == MUX_OK && p) {
+			copy = malloc(len + 1);
+			if (copy) {
+				memcpy(copy, name, len);
+				copy[len] = '\0';
+				p[i].name = copy;
+				memcpy(&p[i].value, &value, sizeof(value));
+			} else {
+				ret = MUX_ERROR_NOMEM;
+			}
+		}
+		if (ret != MUX_OK) {
+			mux_params_free(p, (int)i);
+			return ret;
+		}
+	}
+
+	if (params) {
+		*params = p;
+		*num_params = (int)count;
+	}
+	return MUX_OK;
+}
+
+/*
+ * Decoder snapshot/restore
+ */
+int mux_decoder_snapshot(struct mux_decoder *dec,
+			 void *blob,
+			 size_t blob_size,
+			 size_t *blob_written)
+{
+	struct snapshot_header hdr;
+	struct mux_buffer b;
+	int ret;
+
+	if (!dec || !dec->ops || !blob_written)
+		return MUX_ERROR_INVAL;
+
+	if (!dec->ops->decoder_snapshot || !dec->ops->decoder_restore) {
+		mux_decoder_set_error(dec, MUX_ERROR_UNSUPPORTED,
+				      "Codec does not support snapshots",
+				      NULL, 0, NULL);
+		return MUX_ERROR_UNSUPPORTED;
+	}
+
+	if (dec->hibernated) {
+		ret = mux_decoder_wake(dec);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	ret = mux_buffer_init(&b, 4096);
+	if (ret != MUX_OK)
+		return ret;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.kind = SNAPSHOT_DECODER;
+	hdr.codec_type = dec->codec_type;
+	hdr.num_streams = dec->num_streams;
+
+	ret = put_header(&b, &hdr);
+	if (ret == MUX_OK)
+		ret = put_params(&b, dec->params, dec->num_params);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_buffer(&b, &dec->audio_output);
+	if (ret == MUX_OK)
+		ret = mux_snap_put_buffer(&b, &dec->side_output);
+	/* Input queued by a lazy decoder stays compressed */
+	if (ret == MUX_OK)
+		ret = mux_snap_put_buffer(&b, &dec->lazy_input);
+	if (ret == MUX_OK)
+		ret = dec->ops->decoder_snapshot(dec, &b);
+	if (ret == MUX_OK)
+		ret = emit_blob(&b, blob, blob_size, blob_written);
+
+	mux_buffer_deinit(&b);
+	return ret;
+}
+
+/* An eager decoder decodes what a lazy one had queued */
+static int restore_queue(struct mux_decoder *dec)
+{
+	struct mux_buffer *q = &dec->lazy_input;
+	size_t consumed;
+	int ret = MUX_OK;
+
+	if (mux_buffer_available(q) > 0)
+		ret = dec->ops->decoder_decode(dec, q->data + q->read_pos,
+					       (size_t)mux_buffer_available(q),
+					       &consumed);
+	mux_buffer_clear(q);
+	return ret;
+}
+
+int mux_decoder_restore(struct mux_decoder *dec,
+			const void *blob,
+			size_t blob_size)
+{
+	struct snapshot_header hdr;
+	struct mux_snap_reader r = { blob, blob_size, 0 };
+	const uint8_t *audio, *side, *lazy;
+	size_t audio_size, side_size, lazy_size;
+	int ret;
+
+	if (!dec || !dec->ops || !blob)
+		return MUX_ERROR_INVAL;
+
+	if (!dec->ops->decoder_snapshot || !dec->ops->decoder_restore) {
+		mux_decoder_set_error(dec, MUX_ERROR_UNSUPPORTED,
+				      "Codec does not support snapshots",
+				      NULL, 0, NULL);
+		return MUX_ERROR_UNSUPPORTED;
+	}
+
+	if (dec->hibernated) {
+		ret = mux_decoder_wake(dec);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	ret = get_header(&r, &hdr);
+	if (ret != MUX_OK || hdr.kind != SNAPSHOT_DECODER) {
+		mux_decoder_set_error(dec, MUX_ERROR_FORMAT,
+				      "Not a decoder snapshot for this build",
+				      NULL, 0, NULL);
+		return MUX_ERROR_FORMAT;
+	}
+
+	if (hdr.codec_type != (uint32_t)dec->codec_type ||
+	    hdr.num_streams != dec->num_streams) {
+		mux_decoder_set_error(dec, MUX_ERROR_INVAL,
+				      "Snapshot configuration does not match decoder",
+				      NULL, 0, NULL);
+		return MUX_ERROR_INVAL;
+	}
+
+	/* The decoder was set up by its caller; its own params stand */
+	ret = get_params(&r, NULL, NULL);
+	if (ret == MUX_OK)
+		ret = mux_snap_stage_buffer(&r, &dec->audio_output, &audio,
+					    &audio_size);
+	if (ret == MUX_OK)
+		ret = mux_snap_stage_buffer(&r, &dec->side_output, &side,
+					    &side_size);
+	if (ret == MUX_OK)
+		ret = mux_snap_stage_buffer(&r, &dec->lazy_input, &lazy,
+					    &lazy_size);
+	if (ret == MUX_OK)
+		ret = dec->ops->decoder_restore(dec, &r);
+	if (ret == MUX_OK)
+		ret = mux_snap_end(&r);
+	if (ret == MUX_OK) {
+		mux_snap_commit_buffer(&dec->audio_output, audio,
+				       audio_size);
+		mux_snap_commit_buffer(&dec->side_output, side, side_size);
+		mux_snap_commit_buffer(&dec->lazy_input, lazy, lazy_size);
+		dec->lazy_eof = 0;
+		if (!dec->lazy)
+			ret = restore_queue(dec);
+	}
+
+	if (ret == MUX_ERROR_FORMAT)
+		mux_decoder_set_error(dec, ret, "Corrupt decoder snapshot",
+				      NULL, 0, NULL);
+
+	return ret;
+}
+
+struct mux_decoder *mux_decoder_new_from_snapshot(const void *blob,
+						  size_t blob_size)
+{
+	struct snapshot_header hdr;
+	struct mux_snap_reader r = { blob, blob_size, 0 };
+	struct mux_decoder *dec;
+	struct mux_param *params;
+	int num_params;
+
+	if (!blob || get_header(&r, &hdr) != MUX_OK ||
+	    hdr.kind != SNAPSHOT_DECODER ||
+	    get_params(&r, &params, &num_params) != MUX_OK)
+		return NULL;
+
+	dec = mux_decoder_new(hdr.codec_type, hdr.num_streams, params,
+			      num_params);
+	mux_params_free(params, num_params);
+	if (!dec)
+		return NULL;
+
+	if (mux_decoder_restore(dec, blob, blob_size) != MUX_OK) {
+		mux_decoder_destroy(dec);
+		return NULL;
+	}
+
+	return dec;
+}
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <string.h>
+
+/*
+ * Splicing pre-encoded clips into a live encoder
+ *
+ * The clip's header and data are split into packets by the container
+ * demuxer and every audio packet goes to the codec's encoder_splice
+ * op, which writes it out in the encoder's own framing: a LEB128
+ * frame, raw bytes or an Ogg packet renumbered to follow the live
+ * ones. Nothing is decoded or encoded, so a prompt played into many
+ * calls costs each of them a copy. The encoder keeps its state and
+ * live encoding carries on after the clip.
+ *
+ * The clip is demuxed twice: first every packet is checked, then it is
+ * spliced, so a bad or cut clip leaves the live stream untouched.
+ */
+
+struct splice_pass {
+	struct mux_encoder *enc;
+	int check;
+};
+
+static int splice_packet(void *ctx, const struct mux_demux_packet *pkt)
+{
+	struct splice_pass *pass = ctx;
+	struct mux_encoder *enc = pass->enc;
+
+	if (pkt->size == 0)
+		return MUX_OK;
+	if (pass->check)
+		return enc->ops->encoder_splice_check ?
+		       enc->ops->encoder_splice_check(enc, pkt->data,
+						      pkt->size) : MUX_OK;
+	return enc->ops->encoder_splice(enc, pkt->data, pkt->size);
+}
+
+static int splice_clip(struct mux_encoder *enc, const struct mux_clip *clip,
+		       int check)
+{
+	struct splice_pass pass = { .enc = enc, .check = check };
+	struct mux_demux d;
+	unsigned int streams = 1u << MUX_STREAM_AUDIO;
+	int ret;
+
+	ret = mux_demux_init(&d, clip->codec_type, clip->num_streams);
+	if (ret != MUX_OK)
+		return ret;
+
+	if (clip->header_size)
+		ret = mux_demux_feed(&d, clip->header, clip->header_size,
+				     streams, splice_packet, &pass);
+	if (ret == MUX_OK && clip->size)
+		ret = mux_demux_feed(&d, clip->data, clip->size, streams,
+				     splice_packet, &pass);
+
+	/* A cut clip leaves part of a packet behind */
+	if (ret == MUX_OK && (mux_buffer_available(&d.input) > 0 || d.skip))
+		ret = MUX_ERROR_FORMAT;
+	mux_demux_deinit(&d);
+	return ret;
+}
+
+int mux_encoder_splice(struct mux_encoder *enc, const struct mux_clip *clip)
+{
+	size_t before, added;
+	int ret;
+
+	if (!enc || !enc->ops || !clip || (clip->size && !clip->data) ||
+	    (clip->header_size && !clip->header) ||
+	    clip->num_streams < 1 || clip->num_streams > 2)
+		return MUX_ERROR_INVAL;
+
+	if (clip->codec_type != enc->codec_type ||
+	    clip->sample_rate != enc->sample_rate ||
+	    clip->num_channels != enc->num_channels) {
+		mux_encoder_set_error(enc, MUX_ERROR_INVAL,
+				      "Clip format differs from the encoder's",
+				      NULL, 0, NULL);
+		return MUX_ERROR_INVAL;
+	}
+
+	if (!enc->ops->encoder_splice)
+		return MUX_ERROR_UNSUPPORTED;
+
+	if (enc->hibernated) {
+		ret = mux_encoder_wake(enc);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	ret = splice_clip(enc, clip, 1);
+	if (ret != MUX_OK)
+		return ret;
+
+	before = (size_t)mux_buffer_available(&enc->output);
+	ret = splice_clip(enc, clip, 0);
+
+	added = (size_t)mux_buffer_available(&enc->output) - before;
+	if (enc->rate) {
+		int charged = mux_rate_splice(enc, added, clip->duration);
+
+		if (ret == MUX_OK)
+			ret = charged;
+	}
+	return ret;
+}
@@ -0,0 +1,845 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Keyed side channel state
+ *
+ * Records are self-delimiting so they survive being cut into several
+ * side channel packets and can be found by a reader that starts in the
+ * middle of one:
+ *
+ *   [0xa5 0x53][kind][seq][len][head check][body][check]
+ *
+ * kind is 0 for a snapshot and 1 for a delta, seq and len are LEB128,
+ * head check is FNV-1a of kind up to len folded to 16 bits and check
+ * FNV-1a of kind up to the end of the body, both little endian. The
+ * head check lets a reader drop a marker that turns up inside a value
+ * without waiting for len bytes of body first.
+ * The body is a list of entries:
+ *
+ *   set:    [0][key len][key][value len][value]
+ *   delete: [1][key len][key]
+ *
+ * with a one-byte key length and a LEB128 value length. A snapshot
+ * holds every key, sorted; a delta the keys changed since the previous
+ * record. Sequence numbers count records, so a reader that misses one
+ * notices and waits for the next snapshot.
+ */
+#define STATE_MARK0       0xa5
+#define STATE_MARK1       0x53
+#define STATE_SNAPSHOT    0
+#define STATE_DELTA       1
+#define STATE_SET         0
+#define STATE_DELETE      1
+#define STATE_HEADER_MAX  (3 + 5 + 10 + 2)
+#define STATE_RECORD_MAX  (1 << 20)    /* body bytes */
+#define STATE_EVENTS_MAX  (1 << 20)    /* undelivered event bytes */
+
+struct state_entry {
+	char *key;
+	uint8_t *value;
+	size_t key_len;
+	size_t size;
+	size_t cap;                   /* of value, kept as it shrinks */
+	int dirty;                    /* writer: changed since the last record */
+	int deleted;                  /* writer: delete not sent yet */
+	int seen;                     /* reader: in the snapshot being applied */
+};
+
+struct state_map {
+	struct state_entry *entries;
+	int count;
+	int cap;
+};
+
+struct mux_state_writer {
+	struct state_map map;
+	size_t live_bytes;            /* snapshot body size */
+	int dirty;
+	int snapshot_due;
+	uint32_t seq;
+	uint64_t interval;            /* frames between snapshots, 0 = none */
+	uint64_t frames;              /* since the last snapshot */
+	struct mux_buffer rec;
+	struct mux_state_stats stats;
+};
+
+struct mux_state_reader {
+	struct state_map map;
+	struct mux_buffer input;      /* side channel bytes not parsed yet */
+	struct mux_buffer events;
+	uint32_t seq;
+	struct mux_state_stats stats;
+};
+
+static uint32_t state_check(const uint8_t *data, size_t size)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		h ^= data[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static uint16_t head_check(const uint8_t *data, size_t size)
+{
+	uint32_t h = state_check(data, size);
+
+	return (uint16_t)(h ^ (h >> 16));
+}
+
+static size_t leb128_size(uint64_t value)
+{
+	size_t n = 1;
+
+	while (value >= 0x80) {
+		value >>= 7;
+		n++;
+	}
+	return n;
+}
+
+static size_t entry_bytes(const struct state_entry *e)
+{
+	return 2 + e->key_len + leb128_size(e->size) + e->size;
+}
+
+/* Body size of a delta: the changed keys and the deletes not sent yet */
+static size_t delta_bytes(const struct state_map *m)
+{
+	const struct state_entry *e;
+	size_t n = 0;
+	int i;
+
+	for (i = 0; i < m->count; i++) {
+		e = &m->entries[i];
+		if (e->dirty)
+			n += e->deleted ? 2 + e->key_len : entry_bytes(e);
+	}
+	return n;
+}
+
+/*
+ * Sorted map
+ */
+
+/* Index of key, or of where it would go as -1 - index */
+static int map_find(const struct state_map *m, const char *key)
+{
+	int lo = 0, hi = m->count - 1, mid, c;
+
+	while (lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		c = strcmp(m->entries[mid].key, key);
+		if (c == 0)
+			return mid;
+		if (c < 0)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1 - lo;
+}
+
+static struct state_entry *map_insert(struct state_map *m, int at,
+				      const char *key, size_t key_len)
+{
+	struct state_entry *entries, *e;
+	char *copy;
+	int cap;
+
+	if (m->count == m->cap) {
+		cap = m->cap ? m->cap * 2 : 16;
+		entries = realloc(m->entries, (size_t)cap * sizeof(*entries));
+		if (!entries)
+			return NULL;
+		m->entries = entries;
+		m->cap = cap;
+	}
+
+	copy = malloc(key_len + 1);
+	if (!copy)
+		return NULL;
+	memcpy(copy, key, key_len);
+	copy[key_len] = '\0';
+
+	memmove(&m->entries[at + 1], &m->entries[at],
+		(size_t)(m->count - at) * sizeof(*m->entries));
+	m->count++;
+	e = &m->entries[at];
+	memset(e, 0, sizeof(*e));
+	e->key = copy;
+	e->key_len = key_len;
+	return e;
+}
+
+static void map_remove(struct state_map *m, int at)
+{
+	free(m->entries[at].key);
+	free(m->entries[at].value);
+	memmove(&m->entries[at], &m->entries[at + 1],
+		(size_t)(m->count - at - 1) * sizeof(*m->entries));
+	m->count--;
+}
+
+static void map_free(struct state_map *m)
+{
+	int i;
+
+	for (i = 0; i < m->count; i++) {
+		free(m->entries[i].key);
+		free(m->entries[i].value);
+	}
+	free(m->entries);
+	memset(m, 0, sizeof(*m));
+}
+
+static int entry_assign(struct state_entry *e, const void *value, size_t size)
+{
+	uint8_t *copy;
+
+	/* Levels and the like keep changing in place */
+	if (size > e->cap) {
+		copy = malloc(size);
+		if (!copy)
+			return MUX_ERROR_NOMEM;
+		free(e->value);
+		e->value = copy;
+		e->cap = size;
+	}
+	if (size)
+		memcpy(e->value, value, size);
+	e->size = size;
+	return MUX_OK;
+}
+
+static int same_value(const struct state_entry *e, const void *value,
+		      size_t size)
+{
+	return e->size == size && (size == 0 || !memcmp(e->value, value, size));
+}
+
+/*
+ * Encoder side
+ */
+
+void mux_state_writer_free(struct mux_state_writer *w)
+{
+	if (!w)
+		return;
+
+	map_free(&w->map);
+	mux_buffer_deinit(&w->rec);
+	free(w);
+}
+
+int mux_encoder_set_state(struct mux_encoder *enc, int snapshot_ms)
+{
+	struct mux_state_writer *w;
+
+	if (!enc || !enc->ops || snapshot_ms > 3600000)
+		return MUX_ERROR_INVAL;
+
+	if (snapshot_ms < 0) {
+		mux_state_writer_free(enc->state);
+		enc->state = NULL;
+		return MUX_OK;
+	}
+
+	if (enc->num_streams != 2) {
+		mux_encoder_set_error(enc, MUX_ERROR_INVAL,
+				      "State needs a side channel", NULL, 0,
+				      NULL);
+		return MUX_ERROR_INVAL;
+	}
+
+	w = enc->state;
+	if (!w) {
+		w = calloc(1, sizeof(*w));
+		if (!w)
+			return MUX_ERROR_NOMEM;
+		if (mux_buffer_init(&w->rec, 0) != MUX_OK) {
+			free(w);
+			return MUX_ERROR_NOMEM;
+		}
+		/* Listeners start from a snapshot */
+		w->snapshot_due = 1;
+		enc->state = w;
+	}
+	w->interval = (uint64_t)enc->sample_rate * (uint64_t)snapshot_ms / 1000;
+	return MUX_OK;
+}
+
+int mux_encoder_state_set(struct mux_encoder *enc, const char *key,
+			  const void *value, size_t size)
+{
+	struct mux_state_writer *w;
+	struct state_entry *e = NULL;
+	size_t key_len, before = 0;
+	int at, ret;
+
+	if (!enc || !key || (size && !value))
+		return MUX_ERROR_INVAL;
+
+	w = enc->state;
+	if (!w)
+		return MUX_ERROR_INVAL;
+
+	key_len = strlen(key);
+	if (key_len == 0 || key_len > MUX_STATE_KEY_MAX ||
+	    size > MUX_STATE_VALUE_MAX)
+		return MUX_ERROR_INVAL;
+
+	at = map_find(&w->map, key);
+	if (at >= 0) {
+		e = &w->map.entries[at];
+		if (!e->deleted && same_value(e, value, size))
+			return MUX_OK;
+		if (!e->deleted)
+			before = entry_bytes(e);
+	}
+
+	/* Every snapshot has to fit one record */
+	if (w->live_bytes - before + 2 + key_len + leb128_size(size) + size >
+	    STATE_RECORD_MAX)
+		return MUX_ERROR_LIMIT;
+
+	if (at < 0) {
+		e = map_insert(&w->map, -1 - at, key, key_len);
+		if (!e)
+			return MUX_ERROR_NOMEM;
+	}
+
+	ret = entry_assign(e, value, size);
+	if (ret != MUX_OK) {
+		if (at < 0)
+			map_remove(&w->map, -1 - at);
+		return ret;
+	}
+
+	w->live_bytes += entry_bytes(e) - before;
+	e->deleted = 0;
+	e->dirty = 1;
+	w->dirty = 1;
+	return MUX_OK;
+}
+
+int mux_encoder_state_delete(struct mux_encoder *enc, const char *key)
+{
+	struct mux_state_writer *w;
+	struct state_entry *e;
+	int at;
+
+	if (!enc || !key)
+		return MUX_ERROR_INVAL;
+
+	w = enc->state;
+	if (!w)
+		return MUX_ERROR_INVAL;
+
+	at = map_find(&w->map, key);
+	if (at < 0 || w->map.entries[at].deleted)
+		return MUX_ERROR_NOTFOUND;
+
+	/* Kept until the delete has gone out */
+	e = &w->map.entries[at];
+	w->live_bytes -= entry_bytes(e);
+	e->deleted = 1;
+	e->dirty = 1;
+	w->dirty = 1;
+	return MUX_OK;
+}
+
+static int put_entry(struct mux_buffer *rec, const struct state_entry *e)
+{
+	uint8_t *p;
+	size_t n = 0;
+
+	p = mux_buffer_reserve(rec, entry_bytes(e));
+	if (!p)
+		return MUX_ERROR_NOMEM;
+
+	p[n++] = e->deleted ? STATE_DELETE : STATE_SET;
+	p[n++] = (uint8_t)e->key_len;
+	memcpy(p + n, e->key, e->key_len);
+	n += e->key_len;
+	if (!e->deleted) {
+		n += (size_t)mux_leb128_encode(e->size, p + n, 10);
+		if (e->size)
+			memcpy(p + n, e->value, e->size);
+		n += e->size;
+	}
+	rec->size += n;
+	return MUX_OK;
+}
+
+/* Build a record in w->rec and send it on the side channel */
+static int emit(struct mux_encoder *enc, int kind)
+{
+	struct mux_state_writer *w = enc->state;
+	struct mux_buffer *rec = &w->rec;
+	struct state_entry *e;
+	uint8_t header[STATE_HEADER_MAX], *p;
+	size_t n = 0, body, pos, consumed;
+	uint32_t check;
+	uint16_t head;
+	int i, ret;
+
+	/* The header goes in front once the body size is known */
+	mux_buffer_clear(rec);
+	if (!mux_buffer_reserve(rec, STATE_HEADER_MAX))
+		return MUX_ERROR_NOMEM;
+	rec->size = STATE_HEADER_MAX;
+
+	for (i = 0; i < w->map.count; i++) {
+		e = &w->map.entries[i];
+		if (kind == STATE_SNAPSHOT ? e->deleted : !e->dirty)
+			continue;
+		ret = put_entry(rec, e);
+		if (ret != MUX_OK)
+			return ret;
+	}
+	body = rec->size - STATE_HEADER_MAX;
+
+	header[n++] = STATE_MARK0;
+	header[n++] = STATE_MARK1;
+	header[n++] = (uint8_t)kind;
+	n += (size_t)mux_leb128_encode(w->seq, header + n, 5);
+	n += (size_t)mux_leb128_encode(body, header + n, 10);
+	head = head_check(header + 2, n - 2);
+	header[n++] = (uint8_t)head;
+	header[n++] = (uint8_t)(head >> 8);
+	rec->read_pos = STATE_HEADER_MAX - n;
+	memcpy(rec->data + rec->read_pos, header, n);
+
+	p = mux_buffer_reserve(rec, 4);
+	if (!p)
+		return MUX_ERROR_NOMEM;
+	check = state_check(rec->data + rec->read_pos + 2, n - 2 + body);
+	p[0] = (uint8_t)check;
+	p[1] = (uint8_t)(check >> 8);
+	p[2] = (uint8_t)(check >> 16);
+	p[3] = (uint8_t)(check >> 24);
+	rec->size += 4;
+
+	for (pos = rec->read_pos; pos < rec->size; pos += consumed) {
+		ret = mux_encoder_put(enc, rec->data + pos, rec->size - pos,
+				      &consumed, MUX_STREAM_SIDE_CHANNEL);
+		if (ret != MUX_OK)
+			return ret;
+		if (consumed == 0)
+			return MUX_ERROR_ENCODE;
+	}
+
+	/* Sent deletes are gone for good */
+	for (i = w->map.count - 1; i >= 0; i--) {
+		if (w->map.entries[i].deleted)
+			map_remove(&w->map, i);
+		else
+			w->map.entries[i].dirty = 0;
+	}
+
+	w->seq++;
+	w->dirty = 0;
+	w->stats.records++;
+	w->stats.bytes += rec->size - rec->read_pos;
+	if (kind == STATE_SNAPSHOT) {
+		w->stats.snapshots++;
+		w->snapshot_due = 0;
+		w->frames = 0;
+	}
+	return MUX_OK;
+}
+
+int mux_encoder_state_sync(struct mux_encoder *enc)
+{
+	if (!enc || !enc->state)
+		return MUX_ERROR_INVAL;
+
+	if (enc->hibernated) {
+		int ret = mux_encoder_wake(enc);
+
+		if (ret != MUX_OK)
+			return ret;
+	}
+	return emit(enc, STATE_SNAPSHOT);
+}
+
+int mux_state_tick(struct mux_encoder *enc, size_t frames)
+{
+	struct mux_state_writer *w = enc->state;
+
+	w->frames += frames;
+	if (w->snapshot_due || (w->interval && w->frames >= w->interval))
+		return emit(enc, STATE_SNAPSHOT);
+	if (!w->dirty)
+		return MUX_OK;
+
+	/* Deletes can push a delta past what a snapshot is held to */
+	if (delta_bytes(&w->map) > STATE_RECORD_MAX)
+		return emit(enc, STATE_SNAPSHOT);
+	return emit(enc, STATE_DELTA);
+}
+
+int mux_encoder_get_state_stats(const struct mux_encoder *enc,
+				struct mux_state_stats *stats)
+{
+	const struct mux_state_writer *w;
+	int i;
+
+	if (!enc || !stats)
+		return MUX_ERROR_INVAL;
+
+	w = enc->state;
+	if (!w)
+		return MUX_ERROR_NOTFOUND;
+
+	*stats = w->stats;
+	stats->keys = 0;
+	for (i = 0; i < w->map.count; i++)
+		stats->keys += !w->map.entries[i].deleted;
+	stats->synced = 1;
+	return MUX_OK;
+}
+
+/*
+ * Decoder side
+ */
+
+void mux_state_reader_free(struct mux_state_reader *r)
+{
+	if (!r)
+		return;
+
+	map_free(&r->map);
+	mux_buffer_deinit(&r->input);
+	mux_buffer_deinit(&r->events);
+	free(r);
+}
+
+int mux_decoder_set_state(struct mux_decoder *dec, int on)
+{
+	struct mux_state_reader *r;
+
+	if (!dec || !dec->ops)
+		return MUX_ERROR_INVAL;
+
+	if (!on) {
+		mux_state_reader_free(dec->state);
+		dec->state = NULL;
+		return MUX_OK;
+	}
+	if (dec->state)
+		return MUX_OK;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return MUX_ERROR_NOMEM;
+	if (mux_buffer_init(&r->input, 0) != MUX_OK ||
+	    mux_buffer_init(&r->events, 0) != MUX_OK) {
+		mux_state_reader_free(r);
+		return MUX_ERROR_NOMEM;
+	}
+	dec->state = r;
+	return MUX_OK;
+}
+
+/* Queued as [change][key len][key NUL][value len, size_t][value] */
+static void queue_event(struct mux_state_reader *r, int change,
+			const struct state_entry *e)
+{
+	size_t size = change == MUX_STATE_SET ? e->size : 0;
+	size_t len = 3 + e->key_len + sizeof(size) + size;
+	uint8_t *p;
+
+	if (r->events.read_pos > (size_t)mux_buffer_available(&r->events))
+		mux_buffer_compact(&r->events);
+	if (mux_buffer_available(&r->events) + len > STATE_EVENTS_MAX ||
+	    !(p = mux_buffer_reserve(&r->events, len))) {
+		r->stats.events_lost++;
+		return;
+	}
+
+	*p++ = (uint8_t)change;
+	*p++ = (uint8_t)e->key_len;
+	memcpy(p, e->key, e->key_len + 1);
+	p += e->key_len + 1;
+	memcpy(p, &size, sizeof(size));
+	if (size)
+		memcpy(p + sizeof(size), e->value, size);
+	r->events.size += len;
+}
+
+/* Walks a record body; checks it when apply is 0, applies it when 1 */
+static int walk_body(struct mux_state_reader *r, const uint8_t *p, size_t len,
+		     int apply)
+{
+	struct state_entry *e;
+	char key[MUX_STATE_KEY_MAX + 1];
+	size_t pos = 0, key_len, n;
+	uint64_t size;
+	int op, at;
+
+	while (pos < len) {
+		if (len - pos < 2)
+			return MUX_ERROR_FORMAT;
+		op = p[pos++];
+		key_len = p[pos++];
+		if ((op != STATE_SET && op != STATE_DELETE) || key_len == 0 ||
+		    len - pos < key_len || memchr(p + pos, 0, key_len))
+			return MUX_ERROR_FORMAT;
+		memcpy(key, p + pos, key_len);
+		key[key_len] = '\0';
+		pos += key_len;
+
+		size = 0;
+		if (op == STATE_SET) {
+			if (mux_leb128_decode(p + pos, len - pos, &size,
+					      &n) != MUX_OK || n == 0 ||
+			    size > MUX_STATE_VALUE_MAX || len - pos - n < size)
+				return MUX_ERROR_FORMAT;
+			pos += n;
+		}
+		if (!apply) {
+			pos += (size_t)size;
+			continue;
+		}
+
+		at = map_find(&r->map, key);
+		if (op == STATE_DELETE) {
+			if (at >= 0) {
+				queue_event(r, MUX_STATE_DELETED,
+					    &r->map.entries[at]);
+				map_remove(&r->map, at);
+			}
+			continue;
+		}
+
+		if (at >= 0) {
+			e = &r->map.entries[at];
+		} else {
+			e = map_insert(&r->map, -1 - at, key, key_len);
+			if (!e)
+				return MUX_ERROR_NOMEM;
+		}
+		e->seen = 1;
+		if (at < 0 || !same_value(e, p + pos, (size_t)size)) {
+			if (entry_assign(e, p + pos, (size_t)size) != MUX_OK)
+				return MUX_ERROR_NOMEM;
+			queue_event(r, MUX_STATE_SET, e);
+		}
+		pos += (size_t)size;
+	}
+	return MUX_OK;
+}
+
+static int apply_record(struct mux_state_reader *r, int kind, uint32_t seq,
+			const uint8_t *body, size_t len)
+{
+	int i, ret;
+
+	if (kind != STATE_SNAPSHOT && kind != STATE_DELTA)
+		return MUX_ERROR_FORMAT;
+
+	/* A missed record leaves the map stale until the next snapshot */
+	if (kind == STATE_DELTA &&
+	    (!r->stats.synced || seq != (uint32_t)(r->seq + 1))) {
+		r->stats.synced = 0;
+		r->stats.dropped++;
+		return MUX_OK;
+	}
+
+	ret = walk_body(r, body, len, 0);
+	if (ret != MUX_OK)
+		return ret;
+
+	for (i = 0; i < r->map.count; i++)
+		r->map.entries[i].seen = kind == STATE_DELTA;
+	ret = walk_body(r, body, len, 1);
+	if (ret != MUX_OK)
+		return ret;
+
+	/* Keys missing from a snapshot were deleted while we weren't looking */
+	for (i = r->map.count - 1; i >= 0; i--) {
+		if (!r->map.entries[i].seen) {
+			queue_event(r, MUX_STATE_DELETED, &r->map.entries[i]);
+			map_remove(&r->map, i);
+		}
+	}
+
+	r->seq = seq;
+	r->stats.synced = 1;
+	r->stats.records++;
+	r->stats.bytes += len;
+	if (kind == STATE_SNAPSHOT)
+		r->stats.snapshots++;
+	return MUX_OK;
+}
+
+int mux_state_feed(struct mux_decoder *dec, const void *data, size_t size)
+{
+	struct mux_state_reader *r = dec->state;
+	struct mux_buffer *in = &r->input;
+	const uint8_t *p, *mark;
+	size_t avail, pos, n, m;
+	uint64_t seq, len;
+	int ret;
+
+	if (in->read_pos > (size_t)mux_buffer_available(in))
+		mux_buffer_compact(in);
+	ret = mux_buffer_write(in, data, size);
+	if (ret != MUX_OK)
+		return ret;
+
+	for (;;) {
+		p = in->data + in->read_pos;
+		avail = (size_t)mux_buffer_available(in);
+
+		/* Skip to the next marker, keeping a first half at the end */
+		mark = avail ? memchr(p, STATE_MARK0, avail) : NULL;
+		while (mark && (size_t)(mark - p) + 1 < avail &&
+		       mark[1] != STATE_MARK1)
+			mark = memchr(mark + 1, STATE_MARK0,
+				      avail - (size_t)(mark + 1 - p));
+		if (!mark) {
+			in->read_pos += avail;
+			break;
+		}
+		in->read_pos += (size_t)(mark - p);
+		p = mark;
+		avail = (size_t)mux_buffer_available(in);
+		if (avail < 3)
+			break;
+		if (p[2] != STATE_SNAPSHOT && p[2] != STATE_DELTA) {
+			in->read_pos++;
+			continue;
+		}
+
+		pos = 3;
+		m = 0;
+		ret = mux_leb128_decode(p + pos, avail - pos, &seq, &n);
+		if (ret == MUX_OK && n)
+			ret = mux_leb128_decode(p + pos + n, avail - pos - n,
+						&len, &m);
+		if (ret != MUX_OK || (n && seq > UINT32_MAX) ||
+		    (m && len > STATE_RECORD_MAX) ||
+		    ((!n || !m) && avail - pos >= 5 + 10)) {
+			/* Not a record after all */
+			in->read_pos++;
+			continue;
+		}
+		if (!m || avail < pos + n + m + 2)
+			break;
+
+		/* Only a checked header is worth waiting len bytes for */
+		pos += n + m;
+		if (head_check(p + 2, pos - 2) !=
+		    ((uint16_t)p[pos] | (uint16_t)p[pos + 1] << 8)) {
+			in->read_pos++;
+			continue;
+		}
+		pos += 2;
+		if (avail < pos + (size_t)len + 4)
+			break;
+
+		if (state_check(p + 2, pos - 2 + (size_t)len) !=
+		    ((uint32_t)p[pos + len] | (uint32_t)p[pos + len + 1] << 8 |
+		     (uint32_t)p[pos + len + 2] << 16 |
+		     (uint32_t)p[pos + len + 3] << 24)) {
+			in->read_pos++;
+			continue;
+		}
+
+		ret = apply_record(r, p[2], (uint32_t)seq, p + pos,
+				   (size_t)len);
+		if (ret == MUX_ERROR_NOMEM)
+			return ret;
+		if (ret != MUX_OK) {
+			/* Checked out but unreadable: wait for a snapshot */
+			r->stats.synced = 0;
+			r->stats.dropped++;
+		}
+		in->read_pos += pos + (size_t)len + 4;
+	}
+
+	if (mux_buffer_available(in) == 0)
+		mux_buffer_clear(in);
+	return MUX_OK;
+}
+
+int mux_decoder_state_get(struct mux_decoder *dec, const char *key,
+			  const void **value, size_t *size)
+{
+	struct mux_state_reader *r;
+	int at;
+
+	if (!dec || !key || !value || !size)
+		return MUX_ERROR_INVAL;
+
+	r = dec->state;
+	if (!r)
+		return MUX_ERROR_INVAL;
+
+	at = map_find(&r->map, key);
+	if (at < 0)
+		return MUX_ERROR_NOTFOUND;
+	*value = r->map.entries[at].value;
+	*size = r->map.entries[at].size;
+	return MUX_OK;
+}
+
+int mux_decoder_state_next_event(struct mux_decoder *dec,
+				 struct mux_state_event *event)
+{
+	struct mux_state_reader *r;
+	struct mux_buffer *ev;
+	const uint8_t *p;
+	size_t key_len;
+
+	if (!dec || !event)
+		return MUX_ERROR_INVAL;
+
+	r = dec->state;
+	if (!r)
+		return MUX_ERROR_INVAL;
+
+	ev = &r->events;
+	if (mux_buffer_available(ev) == 0) {
+		mux_buffer_clear(ev);
+		return MUX_ERROR_NOTFOUND;
+	}
+
+	p = ev->data + ev->read_pos;
+	event->change = (enum mux_state_change)p[0];
+	key_len = p[1];
+	event->key = (const char *)p + 2;
+	p += 3 + key_len;
+	memcpy(&event->size, p, sizeof(event->size));
+	p += sizeof(event->size);
+	event->value = event->change == MUX_STATE_SET ? p : NULL;
+	ev->read_pos = (size_t)(p - ev->data) + event->size;
+	return MUX_OK;
+}
+
+int mux_decoder_get_state_stats(const struct mux_decoder *dec,
+				struct mux_state_stats *stats)
+{
+	const struct mux_state_reader *r;
+
+	if (!dec || !stats)
+		return MUX_ERROR_INVAL;
+
+	r = dec->state;
+	if (!r)
+		return MUX_ERROR_NOTFOUND;
+
+	*stats = r->stats;
+	stats->keys = r->map.count;
+	return MUX_OK;
+}
@@ -0,0 +1,733 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Transcoding with packet passthrough
+ *
+ * A transcoder starts out probing: input is held back while the
+ * container demultiplexer looks at the first audio packets. Once the
+ * source's own header (FLAC STREAMINFO, OpusHead, Vorbis
+ * identification, MP3 frame header) and, where the target params ask
+ * for a bitrate the header doesn't declare, the measured bitrate have
+ * been compared against the target, the held input is replayed either
+ * through the remuxer - whole Ogg pages copied, LEB128 frames
+ * rewrapped - or through a decoder feeding an encoder.
+ */
+#define TC_PROBE_HEAD    4096          /* audio payload kept for headers */
+#define TC_PROBE_MAX     (1 << 20)     /* input held before giving up */
+#define TC_MEASURE_US    1000000       /* audio measured for bitrates */
+#define TC_READ_CHUNK    16384
+#define OGG_HEADER_SIZE  27
+#define OGG_SERIAL_AUDIO 1
+#define OGG_SERIAL_SIDE  2
+
+enum tc_mode {
+	TC_PROBING,
+	TC_PASSTHROUGH,
+	TC_TRANSCODE
+};
+
+/* Encoder params that change the encoded stream, if given */
+struct tc_target {
+	int bitrate;                  /* kbps, 0 = not given */
+	int quality;                  /* quality/vbr/profile/dtx given */
+	int allow;                    /* "passthrough" param */
+};
+
+struct mux_transcoder {
+	enum mux_codec_type codec[2];  /* source, target */
+	int streams[2];
+	int sample_rate;
+	int num_channels;
+	struct tc_target target;
+	enum tc_mode mode;
+	int finalized;
+
+	struct mux_demux demux;
+	struct mux_buffer output;     /* remuxed stream */
+	struct mux_buffer pending;    /* incomplete Ogg page */
+
+	/* Probing */
+	struct mux_buffer held;       /* raw input, replayed once decided */
+	uint8_t head[TC_PROBE_HEAD];  /* start of the audio payload */
+	size_t head_len;
+	uint64_t packets;
+	uint64_t measured_bytes;
+	uint64_t measured_us;
+
+	/* Transcoding, set up only once it is decided on */
+	struct mux_param *params;     /* encoder params, names copied */
+	int num_params;
+	struct mux_decoder *dec;
+	struct mux_encoder *enc;
+	struct mux_buffer pcm;        /* decoded audio not yet encoded */
+	struct mux_buffer side;       /* side data the encoder didn't take */
+};
+
+static uint32_t read_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static const struct mux_param *find_param(const struct mux_param *params,
+					  int num_params, const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_params; i++)
+		if (strcmp(params[i].name, name) == 0)
+			return &params[i];
+
+	return NULL;
+}
+
+/*
+ * Source headers
+ */
+
+/* Duration of an Opus packet from its TOC byte (RFC 6716, 3.1) */
+static unsigned int opus_packet_us(const uint8_t *p, size_t len)
+{
+	static const unsigned int silk_us[] = { 10000, 20000, 40000, 60000 };
+	unsigned int config, frame_us, frames;
+
+	if (len < 1)
+		return 0;
+
+	config = p[0] >> 3;
+	if (config < 12)
+		frame_us = silk_us[config & 3];
+	else if (config < 16)
+		frame_us = (config & 1) ? 20000 : 10000;
+	else
+		frame_us = 2500u << (config & 3);
+
+	switch (p[0] & 3) {
+	case 0:
+		frames = 1;
+		break;
+	case 3:
+		if (len < 2)
+			return 0;
+		frames = p[1] & 0x3f;
+		break;
+	default:
+		frames = 2;
+		break;
+	}
+
+	return frame_us * frames;
+}
+
+static int flac_matches(const struct mux_transcoder *tc)
+{
+	const uint8_t *h = tc->head;
+	unsigned int rate, channels, bits;
+
+	/* "fLaC", then STREAMINFO, always the first metadata block */
+	if (memcmp(h, "fLaC", 4) != 0 || (h[4] & 0x7f) != 0)
+		return 0;
+
+	rate = ((unsigned int)h[18] << 12) | ((unsigned int)h[19] << 4) |
+	       (h[20] >> 4);
+	channels = ((h[20] >> 1) & 7) + 1;
+	bits = (((unsigned int)(h[20] & 1) << 4) | (h[21] >> 4)) + 1;
+
+	/* Lossless, so compression level doesn't matter */
+	return rate == (unsigned int)tc->sample_rate &&
+	       channels == (unsigned int)tc->num_channels && bits == 16;
+}
+
+static int opus_matches(const struct mux_transcoder *tc)
+{
+	const uint8_t *h = tc->head;
+
+	return memcmp(h, "OpusHead", 8) == 0 &&
+	       h[9] == tc->num_channels &&
+	       read_le32(h + 12) == (uint32_t)tc->sample_rate &&
+	       h[18] == 0 && !tc->target.quality;
+}
+
+static int vorbis_matches(const struct mux_transcoder *tc)
+{
+	const uint8_t *h = tc->head;
+	int32_t nominal;
+
+	if (h[0] != 1 || memcmp(h + 1, "vorbis", 6) != 0 ||
+	    h[11] != tc->num_channels ||
+	    read_le32(h + 12) != (uint32_t)tc->sample_rate)
+		return 0;
+
+	/* Quality is not recorded in the stream */
+	if (tc->target.quality)
+		return 0;
+
+	nominal = (int32_t)read_le32(h + 20);
+	return !tc->target.bitrate ||
+	       (nominal > 0 && (nominal + 500) / 1000 == tc->target.bitrate);
+}
+
+static int mp3_matches(const struct mux_transcoder *tc)
+{
+	static const int kbps[2][15] = {
+		{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+	};
+	static const int rates[3] = { 44100, 48000, 32000 };
+	const uint8_t *h;
+	int version, bitrate_index, rate_index, rate, i;
+
+	/* First layer III frame header */
+	for (i = 0; i + 4 <= (int)tc->head_len; i++) {
+		h = tc->head + i;
+		if (h[0] != 0xff || (h[1] & 0xe6) != 0xe2)
+			continue;
+		version = (h[1] >> 3) & 3;
+		bitrate_index = h[2] >> 4;
+		rate_index = (h[2] >> 2) & 3;
+		if (version == 1 || bitrate_index == 15 || rate_index == 3)
+			continue;
+
+		rate = rates[rate_index] >> (version == 3 ? 0 :
+					     version == 2 ? 1 : 2);
+		return rate == tc->sample_rate &&
+		       ((h[3] >> 6) == 3) == (tc->num_channels == 1) &&
+		       !tc->target.quality &&
+		       (!tc->target.bitrate ||
+			kbps[version != 3][bitrate_index] ==
+			tc->target.bitrate);
+	}
+
+	return 0;
+}
+
+/* Measured bitrate within 15% of the target */
+static int bitrate_close(const struct mux_transcoder *tc)
+{
+	uint64_t kbps;
+
+	if (tc->measured_us == 0)
+		return 0;
+
+	kbps = tc->measured_bytes * 8000 / tc->measured_us;
+	return kbps * 100 >= (uint64_t)tc->target.bitrate * 85 &&
+	       kbps * 100 <= (uint64_t)tc->target.bitrate * 115;
+}
+
+/*
+ * Decide once enough has been seen. The source's framing has to carry
+ * over to the target's: Ogg codecs only change which pages are kept,
+ * and LEB128 frames can only be dropped for codecs that delimit their
+ * own frames.
+ */
+static enum tc_mode decide(const struct mux_transcoder *tc, int eof)
+{
+	const struct tc_target *t = &tc->target;
+	enum mux_container from, to;
+	int measure;
+
+	if (!t->allow || tc->codec[0] != tc->codec[1])
+		return TC_TRANSCODE;
+
+	from = mux_demux_container(tc->codec[0], tc->streams[0]);
+	to = mux_demux_container(tc->codec[1], tc->streams[1]);
+
+	switch (tc->codec[0]) {
+	case MUX_CODEC_PCM:
+	case MUX_CODEC_ALAW:
+	case MUX_CODEC_MULAW:
+		/* Nothing but the PCM the caller described */
+		return TC_PASSTHROUGH;
+
+	case MUX_CODEC_FLAC:
+		if (tc->head_len >= 22)
+			return flac_matches(tc) ? TC_PASSTHROUGH : TC_TRANSCODE;
+		break;
+
+	case MUX_CODEC_MP3:
+		if (tc->head_len >= TC_PROBE_HEAD || (eof && tc->head_len))
+			return mp3_matches(tc) ? TC_PASSTHROUGH : TC_TRANSCODE;
+		break;
+
+	case MUX_CODEC_VORBIS:
+		if (tc->packets >= 1)
+			return tc->head_len >= 28 && vorbis_matches(tc) ?
+			       TC_PASSTHROUGH : TC_TRANSCODE;
+		break;
+
+	case MUX_CODEC_OPUS:
+		if (tc->packets < 1)
+			break;
+		if (tc->head_len < 19 || !opus_matches(tc))
+			return TC_TRANSCODE;
+		/* OpusHead has no bitrate; measure it if one was asked for */
+		if (!t->bitrate)
+			return TC_PASSTHROUGH;
+		if (tc->measured_us >= TC_MEASURE_US || eof)
+			return bitrate_close(tc) ? TC_PASSTHROUGH :
+			       TC_TRANSCODE;
+		break;
+
+	case MUX_CODEC_AAC:
+		/*
+		 * Raw access units without an AudioSpecificConfig: the
+		 * profile can't be checked and a bitrate only measured
+		 * when frames are delimited.
+		 */
+		if (t->quality || from != to)
+			return TC_TRANSCODE;
+		if (!t->bitrate)
+			return TC_PASSTHROUGH;
+		measure = from == MUX_CONTAINER_LEB128;
+		if (!measure)
+			return TC_TRANSCODE;
+		if (tc->measured_us >= TC_MEASURE_US || eof)
+			return bitrate_close(tc) ? TC_PASSTHROUGH :
+			       TC_TRANSCODE;
+		break;
+
+	default:
+		/* Nothing to compare against; only defaults carry over */
+		if (t->quality || t->bitrate || from != to)
+			return TC_TRANSCODE;
+		return TC_PASSTHROUGH;
+	}
+
+	if (eof || tc->held.size >= TC_PROBE_MAX)
+		return TC_TRANSCODE;
+	return TC_PROBING;
+}
+
+static int probe_packet(void *ctx, const struct mux_demux_packet *pkt)
+{
+	struct mux_transcoder *tc = ctx;
+	size_t n;
+
+	tc->packets++;
+
+	if (tc->head_len < TC_PROBE_HEAD) {
+		n = TC_PROBE_HEAD - tc->head_len;
+		if (n > pkt->size)
+			n = pkt->size;
+		/* Ogg codecs: the header is the first packet on its own */
+		if (tc->codec[0] == MUX_CODEC_OPUS ||
+		    tc->codec[0] == MUX_CODEC_VORBIS) {
+			if (tc->packets == 1)
+				memcpy(tc->head, pkt->data, n);
+			tc->head_len = tc->packets == 1 ? n : tc->head_len;
+		} else {
+			memcpy(tc->head + tc->head_len, pkt->data, n);
+			tc->head_len += n;
+		}
+	}
+
+	/* Bitrates: Opus past OpusHead/OpusTags, one AAC frame per packet */
+	if (tc->codec[0] == MUX_CODEC_OPUS && tc->packets > 2) {
+		tc->measured_bytes += pkt->size;
+		tc->measured_us += opus_packet_us(pkt->data, pkt->size);
+	} else if (tc->codec[0] == MUX_CODEC_AAC && tc->sample_rate > 0) {
+		tc->measured_bytes += pkt->size;
+		tc->measured_us += 1024ULL * 1000000 / (uint64_t)tc->sample_rate;
+	}
+
+	return MUX_OK;
+}
+
+/*
+ * Passthrough
+ */
+static int remux_packet(void *ctx, const struct mux_demux_packet *pkt)
+{
+	struct mux_transcoder *tc = ctx;
+
+	return mux_leb128_write_frame(&tc->output, pkt->data, pkt->size,
+				      pkt->stream_type, tc->streams[1]);
+}
+
+/* Whole pages are copied, granule positions and all */
+static int remux_ogg(struct mux_transcoder *tc, const uint8_t *data,
+		     size_t size)
+{
+	struct mux_buffer *q = &tc->pending;
+	const uint8_t *p, *next;
+	size_t avail, header_len, body_len, n;
+	uint32_t serial;
+	int i, ret;
+
+	ret = mux_buffer_write(q, data, size);
+	if (ret != MUX_OK)
+		return ret;
+
+	for (;;) {
+		p = q->data + q->read_pos;
+		avail = (size_t)mux_buffer_available(q);
+		if (avail < OGG_HEADER_SIZE)
+			break;
+
+		if (memcmp(p, "OggS", 4) != 0) {
+			next = memchr(p + 1, 'O', avail - 1);
+			mux_buffer_read(q, NULL, next ? (size_t)(next - p) :
+					avail, &n);
+			continue;
+		}
+
+		header_len = OGG_HEADER_SIZE + p[26];
+		if (avail < header_len)
+			break;
+		body_len = 0;
+		for (i = 0; i < p[26]; i++)
+			body_len += p[OGG_HEADER_SIZE + i];
+		if (avail < header_len + body_len)
+			break;
+
+		serial = read_le32(p + 14);
+		if (serial == OGG_SERIAL_AUDIO ||
+		    (serial == OGG_SERIAL_SIDE && tc->streams[1] == 2)) {
+			ret = mux_buffer_write(&tc->output, p,
+					       header_len + body_len);
+			if (ret != MUX_OK)
+				return ret;
+		}
+		mux_buffer_read(q, NULL, header_len + body_len, &n);
+	}
+
+	mux_buffer_compact(q);
+	return MUX_OK;
+}
+
+static int passthrough(struct mux_transcoder *tc, const void *data,
+		       size_t size)
+{
+	unsigned int streams = 1u << MUX_STREAM_AUDIO;
+
+	if (tc->demux.container == MUX_CONTAINER_OGG)
+		return remux_ogg(tc, data, size);
+
+	if (tc->streams[1] == 2)
+		streams |= 1u << MUX_STREAM_SIDE_CHANNEL;
+	return mux_demux_feed(&tc->demux, data, size, streams,
+			      remux_packet, tc);
+}
+
+/*
+ * Pass on queued side data as far as the encoder takes it; rate control
+ * may only take part, or none once its queue is full
+ */
+static int flush_side(struct mux_transcoder *tc)
+{
+	size_t n, consumed;
+	int ret;
+
+	while ((n = (size_t)mux_buffer_available(&tc->side)) > 0) {
+		consumed = 0;
+		ret = mux_encoder_encode(tc->enc,
+					 tc->side.data + tc->side.read_pos, n,
+					 &consumed, MUX_STREAM_SIDE_CHANNEL);
+		if (ret != MUX_OK && !(ret == MUX_ERROR_LIMIT && consumed == 0))
+			return ret;
+		if (consumed == 0)
+			break;
+		mux_buffer_read(&tc->side, NULL, consumed, &n);
+	}
+
+	mux_buffer_compact(&tc->side);
+	return MUX_OK;
+}
+
+/*
+ * Transcode: decoded audio in whole frames, side channel as is
+ */
+static int drain_decoder(struct mux_transcoder *tc)
+{
+	uint8_t buf[TC_READ_CHUNK];
+	size_t frame = (size_t)tc->num_channels * sizeof(int16_t);
+	size_t n, whole, consumed;
+	int stream_type, ret;
+
+	for (;;) {
+		stream_type = MUX_STREAM_AUDIO;
+		ret = mux_decoder_read(tc->dec, buf, sizeof(buf), &n,
+				       &stream_type);
+		if (ret == MUX_ERROR_EOF)
+			return MUX_OK;
+		if (ret != MUX_OK)
+			return ret;
+		if (n == 0)
+			return MUX_OK;
+
+		if (stream_type == MUX_STREAM_SIDE_CHANNEL) {
+			if (tc->streams[1] != 2)
+				continue;
+			ret = mux_buffer_write(&tc->side, buf, n);
+			if (ret == MUX_OK)
+				ret = flush_side(tc);
+			if (ret != MUX_OK)
+				return ret;
+			continue;
+		}
+
+		ret = mux_buffer_write(&tc->pcm, buf, n);
+		if (ret != MUX_OK)
+			return ret;
+
+		n = (size_t)mux_buffer_available(&tc->pcm);
+		whole = n - n % frame;
+		if (whole == 0)
+			continue;
+		ret = mux_encoder_encode(tc->enc,
+					 tc->pcm.data + tc->pcm.read_pos,
+					 whole, &consumed, MUX_STREAM_AUDIO);
+		if (ret != MUX_OK)
+			return ret;
+		mux_buffer_read(&tc->pcm, NULL, consumed, &n);
+		mux_buffer_compact(&tc->pcm);
+
+		/* Encoded audio may have made room for held side data */
+		ret = flush_side(tc);
+		if (ret != MUX_OK)
+			return ret;
+	}
+}
+
+static int transcode(struct mux_transcoder *tc, const uint8_t *data,
+		     size_t size)
+{
+	size_t consumed;
+	int ret;
+
+	while (size > 0) {
+		ret = mux_decoder_decode(tc->dec, data, size, &consumed);
+		if (ret != MUX_OK)
+			return ret;
+		ret = drain_decoder(tc);
+		if (ret != MUX_OK)
+			return ret;
+		if (consumed == 0)
+			return MUX_ERROR_LIMIT;
+		data += consumed;
+		size -= consumed;
+	}
+
+	return MUX_OK;
+}
+
+static int process(struct mux_transcoder *tc, const void *data, size_t size)
+{
+	if (tc->mode == TC_PASSTHROUGH)
+		return passthrough(tc, data, size);
+	if (!tc->dec || !tc->enc)
+		return MUX_ERROR_NOCODEC;
+	return transcode(tc, data, size);
+}
+
+/* Switch out of probing and replay what was held */
+static int start(struct mux_transcoder *tc, enum tc_mode mode)
+{
+	int ret;
+
+	mux_demux_deinit(&tc->demux);
+	ret = mux_demux_init(&tc->demux, tc->codec[0], tc->streams[0]);
+	if (ret != MUX_OK)
+		return ret;
+
+	/* Without a decoder and encoder, process() reports NOCODEC */
+	if (mode == TC_TRANSCODE) {
+		tc->dec = mux_decoder_new(tc->codec[0], tc->streams[0],
+					  NULL, 0);
+		tc->enc = mux_encoder_new(tc->codec[1], tc->sample_rate,
+					  tc->num_channels, tc->streams[1],
+					  tc->params, tc->num_params);
+	}
+	mux_params_free(tc->params, tc->num_params);
+	tc->params = NULL;
+	tc->num_params = 0;
+
+	tc->mode = mode;
+	ret = tc->held.size ? process(tc, tc->held.data, tc->held.size) :
+	      MUX_OK;
+	mux_buffer_deinit(&tc->held);
+	return ret;
+}
+
+/*
+ * Public API
+ */
+struct mux_transcoder *mux_transcoder_new(enum mux_codec_type src_codec,
+					  int src_streams,
+					  enum mux_codec_type dst_codec,
+					  int dst_streams,
+					  int sample_rate,
+					  int num_channels,
+					  const struct mux_param *params,
+					  int num_params)
+{
+	struct mux_transcoder *tc;
+	const struct mux_param *p;
+	enum tc_mode mode;
+
+	if ((src_streams != 1 && src_streams != 2) ||
+	    (dst_streams != 1 && dst_streams != 2) ||
+	    sample_rate <= 0 || num_channels <= 0 ||
+	    (num_params > 0 && !params))
+		return NULL;
+
+	tc = calloc(1, sizeof(*tc));
+	if (!tc)
+		return NULL;
+
+	tc->codec[0] = src_codec;
+	tc->codec[1] = dst_codec;
+	tc->streams[0] = src_streams;
+	tc->streams[1] = dst_streams;
+	tc->sample_rate = sample_rate;
+	tc->num_channels = num_channels;
+
+	p = find_param(params, num_params, "passthrough");
+	tc->target.allow = p ? p->value.b : 1;
+	p = find_param(params, num_params, "bitrate");
+	tc->target.bitrate = p ? p->value.i : 0;
+	tc->target.quality = find_param(params, num_params, "quality") ||
+			     find_param(params, num_params, "vbr") ||
+			     find_param(params, num_params, "profile") ||
+			     find_param(params, num_params, "dtx");
+
+	if (mux_demux_init(&tc->demux, src_codec, src_streams) != MUX_OK)
+		goto fail;
+	if (mux_buffer_init(&tc->output, 4096) != MUX_OK ||
+	    mux_buffer_init(&tc->pending, 0) != MUX_OK ||
+	    mux_buffer_init(&tc->held, 0) != MUX_OK ||
+	    mux_buffer_init(&tc->pcm, 0) != MUX_OK ||
+	    mux_buffer_init(&tc->side, 0) != MUX_OK ||
+	    mux_params_copy(&tc->params, &tc->num_params, params,
+			    num_params) != MUX_OK)
+		goto fail;
+
+	mode = decide(tc, 0);
+	if (mode != TC_PROBING && start(tc, mode) != MUX_OK)
+		goto fail;
+	if (mode == TC_TRANSCODE && (!tc->dec || !tc->enc))
+		goto fail;
+
+	return tc;
+
+fail:
+	mux_transcoder_destroy(tc);
+	return NULL;
+}
+
+void mux_transcoder_destroy(struct mux_transcoder *tc)
+{
+	if (!tc)
+		return;
+
+	mux_decoder_destroy(tc->dec);
+	mux_encoder_destroy(tc->enc);
+	mux_demux_deinit(&tc->demux);
+	mux_buffer_deinit(&tc->output);
+	mux_buffer_deinit(&tc->pending);
+	mux_buffer_deinit(&tc->held);
+	mux_buffer_deinit(&tc->pcm);
+	mux_buffer_deinit(&tc->side);
+	mux_params_free(tc->params, tc->num_params);
+	free(tc);
+}
+
+int mux_transcoder_feed(struct mux_transcoder *tc, const void *input,
+			size_t input_size, size_t *input_consumed)
+{
+	enum tc_mode mode;
+	int ret;
+
+	if (!tc || !input_consumed || (!input && input_size > 0))
+		return MUX_ERROR_INVAL;
+	if (tc->finalized)
+		return MUX_ERROR_EOF;
+
+	*input_consumed = 0;
+	if (input_size == 0)
+		return MUX_OK;
+
+	if (tc->mode != TC_PROBING) {
+		ret = process(tc, input, input_size);
+		if (ret == MUX_OK)
+			*input_consumed = input_size;
+		return ret;
+	}
+
+	ret = mux_buffer_write(&tc->held, input, input_size);
+	if (ret != MUX_OK)
+		return ret;
+	*input_consumed = input_size;
+
+	ret = mux_demux_feed(&tc->demux, input, input_size,
+			     1u << MUX_STREAM_AUDIO, probe_packet, tc);
+	mode = ret == MUX_OK ? decide(tc, 0) : TC_TRANSCODE;
+
+	return mode == TC_PROBING ? MUX_OK : start(tc, mode);
+}
+
+int mux_transcoder_finalize(struct mux_transcoder *tc)
+{
+	size_t consumed;
+	int ret;
+
+	if (!tc)
+		return MUX_ERROR_INVAL;
+	if (tc->finalized)
+		return MUX_OK;
+
+	if (tc->mode == TC_PROBING) {
+		ret = start(tc, decide(tc, 1));
+		if (ret != MUX_OK)
+			return ret;
+	}
+	tc->finalized = 1;
+
+	/* Passthrough: an incomplete trailing frame or page is dropped */
+	if (tc->mode == TC_PASSTHROUGH)
+		return MUX_OK;
+	if (!tc->dec || !tc->enc)
+		return MUX_ERROR_NOCODEC;
+
+	ret = mux_decoder_finalize(tc->dec);
+	if (ret == MUX_OK)
+		ret = drain_decoder(tc);
+	if (ret == MUX_OK && mux_buffer_available(&tc->pcm) > 0)
+		ret = mux_encoder_encode(tc->enc,
+					 tc->pcm.data + tc->pcm.read_pos,
+					 (size_t)mux_buffer_available(&tc->pcm),
+					 &consumed, MUX_STREAM_AUDIO);
+	if (ret == MUX_OK)
+		ret = flush_side(tc);
+	if (ret == MUX_OK && mux_buffer_available(&tc->side) > 0)
+		ret = MUX_ERROR_LIMIT;
+	if (ret == MUX_OK)
+		ret = mux_encoder_finalize(tc->enc);
+
+	return ret;
+}
+
+int mux_transcoder_read(struct mux_transcoder *tc, void *output,
+			size_t output_size, size_t *output_written)
+{
+	if (!tc || !output || !output_written)
+		return MUX_ERROR_INVAL;
+
+	if (tc->mode == TC_TRANSCODE)
+		return mux_encoder_read(tc->enc, output, output_size,
+					output_written);
+
+	return mux_buffer_read(&tc->output, output, output_size,
+			       output_written);
+}
+
+int mux_transcoder_passthrough(const struct mux_transcoder *tc)
+{
+	if (!tc || tc->mode == TC_PROBING)
+		return -1;
+	return tc->mode == TC_PASSTHROUGH;
+}
@@ -0,0 +1,686 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Trunks: many sessions over one byte stream
+ *
+ * Every frame is a LEB128 tag and body length followed by the body.
+ * Tag 0 is a control frame whose first body field is its type, any
+ * other tag is a session slot plus one and carries the next bytes of that
+ * session's stream after a one-byte sequence number:
+ *
+ *   hello: [0][len][0][version]
+ *   open:  [0][len][1][slot][id][codec][streams][rate][channels]
+ *   close: [0][len][2][slot]
+ *   data:  [slot + 1][len][seq][stream bytes]
+ *
+ * All control fields are LEB128. Slots are the lowest free ones, so
+ * tags stay one byte for the first 127 sessions; a slot is free again
+ * once its close frame has been written. Unknown control types are
+ * skipped.
+ */
+#define TRUNK_VERSION     1
+#define TRUNK_HELLO       0
+#define TRUNK_OPEN        1
+#define TRUNK_CLOSE       2
+#define TRUNK_HEADER_MAX  20            /* tag and length */
+#define TRUNK_CHUNK       16384         /* stream bytes per data frame */
+#define TRUNK_FRAME_MAX   (1 << 20)     /* largest body a reader takes */
+#define TRUNK_SLOTS_MAX   (1 << 20)
+
+static int put_header(uint8_t *p, uint64_t tag, size_t len)
+{
+	int n, m;
+
+	n = mux_leb128_encode(tag, p, 10);
+	m = mux_leb128_encode((uint64_t)len, p + n, 10);
+	return n + m;
+}
+
+static int put_frame(struct mux_buffer *out, uint64_t tag,
+		     const uint8_t *body, size_t len)
+{
+	uint8_t *p;
+	int n;
+
+	p = mux_buffer_reserve(out, TRUNK_HEADER_MAX + len);
+	if (!p)
+		return MUX_ERROR_NOMEM;
+
+	n = put_header(p, tag, len);
+	memcpy(p + n, body, len);
+	out->size += (size_t)n + len;
+	return MUX_OK;
+}
+
+/*
+ * Writer
+ */
+struct trunk_source {
+	struct mux_encoder *enc;      /* NULL for a free slot */
+	uint8_t seq;
+};
+
+struct mux_trunk_writer {
+	struct trunk_source *slots;
+	int num_slots;                /* up to the highest slot in use */
+	int capacity;
+	int first_free;
+	struct mux_buffer out;
+};
+
+static int write_control(struct mux_trunk_writer *w, const uint64_t *fields,
+			 int count)
+{
+	uint8_t body[8 * 10];
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+		len += (size_t)mux_leb128_encode(fields[i], body + len, 10);
+
+	return put_frame(&w->out, 0, body, len);
+}
+
+struct mux_trunk_writer *mux_trunk_writer_new(void)
+{
+	struct mux_trunk_writer *w;
+	uint64_t hello[] = { TRUNK_HELLO, TRUNK_VERSION };
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	if (mux_buffer_init(&w->out, 0) != MUX_OK ||
+	    write_control(w, hello, 2) != MUX_OK) {
+		mux_trunk_writer_destroy(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+void mux_trunk_writer_destroy(struct mux_trunk_writer *w)
+{
+	if (!w)
+		return;
+
+	mux_buffer_deinit(&w->out);
+	free(w->slots);
+	free(w);
+}
+
+int mux_trunk_writer_add(struct mux_trunk_writer *w, uint32_t id,
+			 struct mux_encoder *enc, int *slot)
+{
+	struct trunk_source *slots;
+	uint64_t open[7];
+	int s, cap, ret;
+
+	if (!w || !enc || !slot)
+		return MUX_ERROR_INVAL;
+
+	s = w->first_free;
+	while (s < w->num_slots && w->slots[s].enc)
+		s++;
+
+	if (s >= w->capacity) {
+		if (s >= TRUNK_SLOTS_MAX)
+			return MUX_ERROR_LIMIT;
+		cap = w->capacity ? w->capacity * 2 : 64;
+		slots = realloc(w->slots, (size_t)cap * sizeof(*slots));
+		if (!slots)
+			return MUX_ERROR_NOMEM;
+		memset(slots + w->capacity, 0,
+		       (size_t)(cap - w->capacity) * sizeof(*slots));
+		w->slots = slots;
+		w->capacity = cap;
+	}
+
+	open[0] = TRUNK_OPEN;
+	open[1] = (uint64_t)s;
+	open[2] = id;
+	open[3] = (uint64_t)enc->codec_type;
+	open[4] = (uint64_t)enc->num_streams;
+	open[5] = (uint64_t)enc->sample_rate;
+	open[6] = (uint64_t)enc->num_channels;
+	ret = write_control(w, open, 7);
+	if (ret != MUX_OK)
+		return ret;
+
+	w->slots[s].enc = enc;
+	w->slots[s].seq = 0;
+	if (s >= w->num_slots)
+		w->num_slots = s + 1;
+	w->first_free = s + 1;
+	*slot = s;
+	return MUX_OK;
+}
+
+/* Everything the session's encoder has, in frames of up to TRUNK_CHUNK */
+static int collect_one(struct mux_trunk_writer *w, int s)
+{
+	struct trunk_source *src = &w->slots[s];
+	uint8_t hdr[TRUNK_HEADER_MAX];
+	size_t avail, n, got;
+	uint8_t *p;
+	int hlen, len, ret;
+
+	while ((avail = (size_t)mux_buffer_available(&src->enc->output)) > 0) {
+		n = avail < TRUNK_CHUNK ? avail : TRUNK_CHUNK;
+		p = mux_buffer_reserve(&w->out, TRUNK_HEADER_MAX + 1 + n);
+		if (!p)
+			return MUX_ERROR_NOMEM;
+
+		/* Straight into the trunk, behind the header it will get */
+		hlen = put_header(p, (uint64_t)s + 1, n + 1);
+		ret = mux_encoder_read(src->enc, p + hlen + 1, n, &got);
+		if (ret != MUX_OK)
+			return ret;
+		if (got == 0)
+			break;
+		if (got < n) {
+			len = put_header(hdr, (uint64_t)s + 1, got + 1);
+			memmove(p + len + 1, p + hlen + 1, got);
+			memcpy(p, hdr, (size_t)len);
+			hlen = len;
+		}
+
+		p[hlen] = src->seq++;
+		w->out.size += (size_t)hlen + 1 + got;
+	}
+
+	return MUX_OK;
+}
+
+int mux_trunk_writer_remove(struct mux_trunk_writer *w, int slot)
+{
+	uint64_t close[] = { TRUNK_CLOSE, (uint64_t)slot };
+	int ret;
+
+	if (!w || slot < 0 || slot >= w->num_slots || !w->slots[slot].enc)
+		return MUX_ERROR_INVAL;
+
+	ret = collect_one(w, slot);
+	if (ret != MUX_OK)
+		return ret;
+	ret = write_control(w, close, 2);
+	if (ret != MUX_OK)
+		return ret;
+
+	w->slots[slot].enc = NULL;
+	if (slot < w->first_free)
+		w->first_free = slot;
+	while (w->num_slots > 0 && !w->slots[w->num_slots - 1].enc)
+		w->num_slots--;
+	return MUX_OK;
+}
+
+int mux_trunk_writer_collect(struct mux_trunk_writer *w)
+{
+	int s, ret;
+
+	if (!w)
+		return MUX_ERROR_INVAL;
+
+	for (s = 0; s < w->num_slots; s++) {
+		if (!w->slots[s].enc)
+			continue;
+		ret = collect_one(w, s);
+		if (ret != MUX_OK)
+			return ret;
+	}
+
+	return MUX_OK;
+}
+
+int mux_trunk_writer_read(struct mux_trunk_writer *w, void *output,
+			  size_t output_size, size_t *output_written)
+{
+	int ret;
+
+	if (!w || !output || !output_written)
+		return MUX_ERROR_INVAL;
+
+	ret = mux_buffer_read(&w->out, output, output_size, output_written);
+	if (ret != MUX_OK)
+		return ret;
+
+	/* Keep appends from growing the buffer behind a slow reader */
+	if (mux_buffer_available(&w->out) == 0)
+		mux_buffer_clear(&w->out);
+	else if (w->out.read_pos > (size_t)mux_buffer_available(&w->out))
+		mux_buffer_compact(&w->out);
+	return MUX_OK;
+}
+
+/*
+ * Reader
+ */
+struct trunk_session {
+	struct mux_trunk_session info;
+	struct mux_decoder *dec;
+	uint8_t seq;
+	int closed;
+	int failed;                   /* data is dropped after an error */
+	int error;                    /* not yet reported */
+	int queued;
+	struct trunk_session *next;   /* ready list */
+};
+
+struct mux_trunk_reader {
+	struct trunk_session **slots;
+	size_t num_slots;
+	int hello;
+
+	/* Sessions that may have output, in the order they got data */
+	struct trunk_session *head;
+	struct trunk_session *tail;
+
+	struct mux_buffer in;         /* incomplete or stalled frame */
+	size_t partial;               /* body bytes of it already decoded */
+	int stalled;
+
+	struct mux_param params[16];  /* forwarded to every session */
+	int num_params;
+};
+
+struct mux_trunk_reader *mux_trunk_reader_new(const struct mux_param *params,
+					      int num_params)
+{
+	struct mux_trunk_reader *r;
+
+	if (num_params < 0 || num_params > 16 || (num_params && !params))
+		return NULL;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	if (mux_buffer_init(&r->in, 0) != MUX_OK) {
+		free(r);
+		return NULL;
+	}
+
+	if (num_params)
+		memcpy(r->params, params, (size_t)num_params * sizeof(*params));
+	r->num_params = num_params;
+	return r;
+}
+
+static void free_session(struct trunk_session *s)
+{
+	mux_decoder_destroy(s->dec);
+	free(s);
+}
+
+void mux_trunk_reader_destroy(struct mux_trunk_reader *r)
+{
+	struct trunk_session *s, *next;
+	size_t i;
+
+	if (!r)
+		return;
+
+	/* Closed sessions are only on the ready list */
+	for (s = r->head; s; s = next) {
+		next = s->next;
+		if (s->closed)
+			free_session(s);
+	}
+	for (i = 0; i < r->num_slots; i++)
+		if (r->slots[i])
+			free_session(r->slots[i]);
+
+	free(r->slots);
+	mux_buffer_deinit(&r->in);
+	free(r);
+}
+
+static void queue(struct mux_trunk_reader *r, struct trunk_session *s)
+{
+	if (s->queued)
+		return;
+
+	s->queued = 1;
+	s->next = NULL;
+	if (r->tail)
+		r->tail->next = s;
+	else
+		r->head = s;
+	r->tail = s;
+}
+
+/* *hlen stays 0 while the header is incomplete */
+static int read_header(const uint8_t *p, size_t size, uint64_t *tag,
+		       size_t *len, size_t *hlen)
+{
+	uint64_t v;
+	size_t n, m;
+
+	*hlen = 0;
+	if (mux_leb128_decode(p, size, tag, &n) != MUX_OK)
+		return MUX_ERROR_FORMAT;
+	if (n == 0)
+		return MUX_OK;
+	if (mux_leb128_decode(p + n, size - n, &v, &m) != MUX_OK)
+		return MUX_ERROR_FORMAT;
+	if (m == 0)
+		return MUX_OK;
+	if (v > TRUNK_FRAME_MAX)
+		return MUX_ERROR_FORMAT;
+
+	*len = (size_t)v;
+	*hlen = n + m;
+	return MUX_OK;
+}
+
+static int get_field(const uint8_t *body, size_t len, size_t *pos,
+		     uint64_t max, uint64_t *value)
+{
+	size_t n;
+
+	if (mux_leb128_decode(body + *pos, len - *pos, value, &n) != MUX_OK ||
+	    n == 0 || *value > max)
+		return MUX_ERROR_FORMAT;
+
+	*pos += n;
+	return MUX_OK;
+}
+
+static struct trunk_session *find_slot(struct mux_trunk_reader *r,
+				       uint64_t slot)
+{
+	return slot < r->num_slots ? r->slots[slot] : NULL;
+}
+
+static int open_session(struct mux_trunk_reader *r, const uint8_t *body,
+			size_t len, size_t pos)
+{
+	struct trunk_session *s, **slots;
+	uint64_t slot, id, codec, streams, rate, channels;
+	size_t cap;
+
+	if (get_field(body, len, &pos, TRUNK_SLOTS_MAX - 1, &slot) != MUX_OK ||
+	    get_field(body, len, &pos, UINT32_MAX, &id) != MUX_OK ||
+	    get_field(body, len, &pos, MUX_CODEC_MAX - 1, &codec) != MUX_OK ||
+	    get_field(body, len, &pos, 2, &streams) != MUX_OK ||
+	    get_field(body, len, &pos, 1 << 20, &rate) != MUX_OK ||
+	    get_field(body, len, &pos, 255, &channels) != MUX_OK ||
+	    streams == 0 || find_slot(r, slot))
+		return MUX_ERROR_FORMAT;
+
+	if (slot >= r->num_slots) {
+		cap = r->num_slots ? r->num_slots : 64;
+		while (cap <= slot)
+			cap *= 2;
+		slots = realloc(r->slots, cap * sizeof(*slots));
+		if (!slots)
+			return MUX_ERROR_NOMEM;
+		memset(slots + r->num_slots, 0,
+		       (cap - r->num_slots) * sizeof(*slots));
+		r->slots = slots;
+		r->num_slots = cap;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return MUX_ERROR_NOMEM;
+
+	s->info.id = (uint32_t)id;
+	s->info.codec_type = (enum mux_codec_type)codec;
+	s->info.num_streams = (int)streams;
+	s->info.sample_rate = (int)rate;
+	s->info.num_channels = (int)channels;
+
+	/* A codec that isn't compiled in only fails its own session */
+	s->dec = mux_decoder_new(s->info.codec_type, s->info.num_streams,
+				 r->params, r->num_params);
+	if (!s->dec) {
+		s->failed = 1;
+		s->error = MUX_ERROR_NOCODEC;
+		queue(r, s);
+	}
+
+	r->slots[slot] = s;
+	return MUX_OK;
+}
+
+static void close_session(struct mux_trunk_reader *r, uint64_t slot)
+{
+	struct trunk_session *s = r->slots[slot];
+	int ret;
+
+	if (!s->failed) {
+		ret = mux_decoder_finalize(s->dec);
+		if (ret != MUX_OK) {
+			s->failed = 1;
+			s->error = ret;
+		}
+	}
+
+	s->closed = 1;
+	r->slots[slot] = NULL;
+	queue(r, s);
+}
+
+static int control(struct mux_trunk_reader *r, const uint8_t *body,
+		   size_t len)
+{
+	uint64_t type, v;
+	size_t pos = 0;
+
+	if (get_field(body, len, &pos, UINT64_MAX, &type) != MUX_OK)
+		return MUX_ERROR_FORMAT;
+
+	if (type == TRUNK_HELLO) {
+		if (get_field(body, len, &pos, UINT64_MAX, &v) != MUX_OK ||
+		    v != TRUNK_VERSION)
+			return MUX_ERROR_FORMAT;
+		r->hello = 1;
+		return MUX_OK;
+	}
+
+	if (!r->hello)
+		return MUX_ERROR_FORMAT;
+
+	switch (type) {
+	case TRUNK_OPEN:
+		return open_session(r, body, len, pos);
+	case TRUNK_CLOSE:
+		if (get_field(body, len, &pos, UINT64_MAX, &v) != MUX_OK ||
+		    !find_slot(r, v))
+			return MUX_ERROR_FORMAT;
+		close_session(r, v);
+		return MUX_OK;
+	default:
+		return MUX_OK;
+	}
+}
+
+/* Hand a data frame's stream bytes to its session's decoder */
+static int deliver(struct mux_trunk_reader *r, uint64_t slot,
+		   const uint8_t *body, size_t len)
+{
+	struct trunk_session *s = find_slot(r, slot);
+	size_t off, consumed;
+	int ret;
+
+	if (!r->hello || !s || len == 0 ||
+	    (r->partial == 0 && body[0] != s->seq))
+		return MUX_ERROR_FORMAT;
+
+	off = 1 + r->partial;
+	if (!s->failed && off < len) {
+		ret = mux_decoder_decode(s->dec, body + off, len - off,
+					 &consumed);
+		if (ret != MUX_OK) {
+			s->failed = 1;
+			s->error = ret;
+		} else if (consumed < len - off) {
+			/* The decoder bounds its work; the caller feeds again */
+			r->partial += consumed;
+			r->stalled = 1;
+			queue(r, s);
+			return MUX_OK;
+		}
+		queue(r, s);
+	}
+
+	r->partial = 0;
+	s->seq++;
+	return MUX_OK;
+}
+
+/* Whole frames at data; *used is how far they go */
+static int parse(struct mux_trunk_reader *r, const uint8_t *data,
+		 size_t size, size_t *used)
+{
+	uint64_t tag;
+	size_t pos = 0, len, hlen;
+	int ret = MUX_OK;
+
+	while (pos < size) {
+		ret = read_header(data + pos, size - pos, &tag, &len, &hlen);
+		if (ret != MUX_OK || hlen == 0 || size - pos - hlen < len)
+			break;
+
+		if (tag == 0)
+			ret = control(r, data + pos + hlen, len);
+		else
+			ret = deliver(r, tag - 1, data + pos + hlen, len);
+		if (ret != MUX_OK || r->stalled)
+			break;
+		pos += hlen + len;
+	}
+
+	*used = pos;
+	return ret;
+}
+
+int mux_trunk_reader_feed(struct mux_trunk_reader *r, const void *input,
+			  size_t input_size, size_t *input_consumed)
+{
+	const uint8_t *in = input;
+	size_t have, used, take, len, hlen;
+	uint64_t tag;
+	int ret;
+
+	if (!r || (!input && input_size) || !input_consumed)
+		return MUX_ERROR_INVAL;
+
+	*input_consumed = 0;
+	r->stalled = 0;
+
+	/* Finish the buffered frame first, topping it up from the input */
+	while ((have = (size_t)mux_buffer_available(&r->in)) > 0) {
+		ret = parse(r, r->in.data + r->in.read_pos, have, &used);
+		r->in.read_pos += used;
+		if (ret != MUX_OK || r->stalled)
+			return ret;
+		if (used == have) {
+			mux_buffer_clear(&r->in);
+			break;
+		}
+		if (*input_consumed == input_size)
+			return MUX_OK;
+
+		have -= used;
+		ret = read_header(r->in.data + r->in.read_pos, have, &tag, &len,
+				  &hlen);
+		if (ret != MUX_OK)
+			return ret;
+		take = (hlen ? hlen + len : TRUNK_HEADER_MAX) - have;
+		if (take > input_size - *input_consumed)
+			take = input_size - *input_consumed;
+
+		mux_buffer_compact(&r->in);
+		ret = mux_buffer_write(&r->in, in + *input_consumed, take);
+		if (ret != MUX_OK)
+			return ret;
+		*input_consumed += take;
+	}
+
+	/* Whole frames straight from the input, then keep the rest */
+	ret = parse(r, in + *input_consumed, input_size - *input_consumed,
+		    &used);
+	*input_consumed += used;
+	if (ret != MUX_OK || r->stalled)
+		return ret;
+
+	ret = mux_buffer_write(&r->in, in + *input_consumed,
+			       input_size - *input_consumed);
+	if (ret == MUX_OK)
+		*input_consumed = input_size;
+	return ret;
+}
+
+int mux_trunk_reader_finalize(struct mux_trunk_reader *r)
+{
+	size_t i;
+
+	if (!r)
+		return MUX_ERROR_INVAL;
+
+	for (i = 0; i < r->num_slots; i++)
+		if (r->slots[i])
+			close_session(r, i);
+
+	return mux_buffer_available(&r->in) ? MUX_ERROR_FORMAT : MUX_OK;
+}
+
+int mux_trunk_reader_read(struct mux_trunk_reader *r,
+			  struct mux_trunk_session *session,
+			  void *output, size_t output_size,
+			  size_t *output_written, int *stream_type)
+{
+	struct trunk_session *s;
+	int ret;
+
+	if (!r || !output || !output_written || !stream_type)
+		return MUX_ERROR_INVAL;
+
+	*output_written = 0;
+	*stream_type = -1;
+
+	while ((s = r->head)) {
+		if (session)
+			*session = s->info;
+
+		if (s->error) {
+			ret = s->error;
+			s->error = 0;
+			return ret;
+		}
+
+		if (s->dec) {
+			ret = mux_decoder_read(s->dec, output, output_size,
+					       output_written, stream_type);
+			if (ret != MUX_OK) {
+				mux_decoder_destroy(s->dec);
+				s->dec = NULL;
+				s->failed = 1;
+				return ret;
+			}
+			if (*output_written > 0)
+				return MUX_OK;
+		}
+
+		/* Drained */
+		r->head = s->next;
+		if (!r->head)
+			r->tail = NULL;
+		s->queued = 0;
+
+		if (s->closed) {
+			*stream_type = MUX_TRUNK_END;
+			free_session(s);
+			return MUX_OK;
+		}
+	}
+
+	return MUX_OK;
+}
@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mux.h"
+#include "mux_internal.h"
+#include <stdlib.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+/*
+ * Worker pool
+ *
+ * A fixed set of threads that run one batch of jobs at a time: the
+ * caller hands out job indices, joins in, and returns once every job
+ * is done. Batches are short (one encode or decode call), so workers
+ * sleep on a condition variable between them rather than spinning.
+ * Without pthreads every batch runs in the calling thread.
+ */
+#ifdef HAVE_PTHREAD
+
+#include <pthread.h>
+
+struct mux_workers {
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	pthread_t *threads;
+	int count;
+
+	/* Current batch */
+	void (*fn)(void *ctx, int job);
+	void *ctx;
+	int jobs;
+	int next;
+	int running;                  /* workers still in the batch */
+	unsigned int generation;
+	int stop;
+};
+
+/* Take jobs until there are none left; lock held on entry and exit */
+static void run_jobs(struct mux_workers *w)
+{
+	int job;
+
+	while (w->next < w->jobs) {
+		job = w->next++;
+		pthread_mutex_unlock(&w->lock);
+		w->fn(w->ctx, job);
+		pthread_mutex_lock(&w->lock);
+	}
+}
+
+static void *worker_main(void *arg)
+{
+	struct mux_workers *w = arg;
+	unsigned int seen = 0;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->stop && w->generation == seen)
+			pthread_cond_wait(&w->start, &w->lock);
+		if (w->stop)
+			break;
+		seen = w->generation;
+
+		run_jobs(w);
+		if (--w->running == 0)
+			pthread_cond_signal(&w->done);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+struct mux_workers *mux_workers_new(int threads)
+{
+	struct mux_workers *w;
+
+	/* The calling thread is one of them */
+	if (threads <= 1)
+		return NULL;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	w->threads = calloc((size_t)threads - 1, sizeof(*w->threads));
+	if (!w->threads) {
+		free(w);
+		return NULL;
+	}
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->start, NULL);
+	pthread_cond_init(&w->done, NULL);
+
+	for (w->count = 0; w->count < threads - 1; w->count++)
+		if (pthread_create(&w->threads[w->count], NULL, worker_main,
+				   w) != 0)
+			break;
+
+	if (w->count == 0) {
+		mux_workers_free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+void mux_workers_free(struct mux_workers *w)
+{
+	int i;
+
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_broadcast(&w->start);
+	pthread_mutex_unlock(&w->lock);
+
+	for (i = 0; i < w->count; i++)
+		pthread_join(w->threads[i], NULL);
+
+	pthread_cond_destroy(&w->done);
+	pthread_cond_destroy(&w->start);
+	pthread_mutex_destroy(&w->lock);
+	free(w->threads);
+	free(w);
+}
+
+void mux_workers_run(struct mux_workers *w, int jobs,
+		     void (*fn)(void *ctx, int job), void *ctx)
+{
+	int i;
+
+	if (!w || jobs <= 1) {
+		for (i = 0; i < jobs; i++)
+			fn(ctx, i);
+		return;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	w->fn = fn;
+	w->ctx = ctx;
+	w->jobs = jobs;
+	w->next = 0;
+	w->running = w->count;
+	w->generation++;
+	pthread_cond_broadcast(&w->start);
+
+	run_jobs(w);
+	while (w->running > 0)
+		pthread_cond_wait(&w->done, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+}
+
+int mux_workers_count(const struct mux_workers *w)
+{
+	return w ? w->count + 1 : 1;
+}
+
+#else /* !HAVE_PTHREAD */
+
+struct mux_workers *mux_workers_new(int threads)
+{
+	(void)threads;
+	return NULL;
+}
+
+void mux_workers_free(struct mux_workers *w)
+{
+	(void)w;
+}
+
+void mux_workers_run(struct mux_workers *w, int jobs,
+		     void (*fn)(void *ctx, int job), void *ctx)
+{
+	int i;
+
+	(void)w;
+	for (i = 0; i < jobs; i++)
+		fn(ctx, i);
+}
+
+int mux_workers_count(const struct mux_workers *w)
+{
+	(void)w;
+	return 1;
+}
+
+#endif /* HAVE_PTHREAD */
+
+int mux_workers_default(int jobs)
+{
+	long cpus = 1;
+
+#if defined(_SC_NPROCESSORS_ONLN)
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (cpus < 1)
+		cpus = 1;
+#ifdef MUX_WORKERS_MAX
+	/* WASM threads come from a fixed pool of web workers */
+	if (cpus > MUX_WORKERS_MAX)
+		cpus = MUX_WORKERS_MAX;
+#endif
+	return jobs < cpus ? jobs : (int)cpus;
+}
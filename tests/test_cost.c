@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test codec calibration and cost model
+ */
+#include <stdio.h>
+#include "mux.h"
+
+static int test_nominal(void)
+{
+	struct mux_codec_cost cost;
+	int ret;
+
+	printf("Testing nominal cost...\n");
+
+	ret = mux_codec_cost(MUX_CODEC_PCM, 48000, 2, &cost);
+	if (ret != MUX_OK) {
+		fprintf(stderr, "  FAIL: mux_codec_cost returned %d\n", ret);
+		return -1;
+	}
+
+	if (cost.calibrated || cost.bytes_per_sec != 48000 * 2 * 2 ||
+	    cost.latency_samples != 1) {
+		fprintf(stderr, "  FAIL: unexpected nominal PCM cost\n");
+		return -1;
+	}
+
+	if (mux_codec_cost(MUX_CODEC_PCM, 48000, 0, &cost) != MUX_ERROR_INVAL ||
+	    mux_codec_cost(MUX_CODEC_PCM, 48000, 2, NULL) != MUX_ERROR_INVAL ||
+	    mux_codec_cost(MUX_CODEC_ALAW, 1000, 1, &cost) != MUX_ERROR_INVAL) {
+		fprintf(stderr, "  FAIL: invalid configs accepted\n");
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_calibrate(enum mux_codec_type codec, int bytes_per_sample)
+{
+	struct mux_codec_cost cost;
+	int expected = 8000 * bytes_per_sample;
+	int ret;
+
+	printf("Testing %s calibration...\n", mux_codec_to_name(codec));
+
+	ret = mux_calibrate(codec, 8000, 1);
+	if (ret != MUX_OK) {
+		fprintf(stderr, "  FAIL: mux_calibrate returned %d\n", ret);
+		return -1;
+	}
+
+	ret = mux_codec_cost(codec, 8000, 1, &cost);
+	if (ret != MUX_OK || !cost.calibrated) {
+		fprintf(stderr, "  FAIL: configuration not calibrated\n");
+		return -1;
+	}
+
+	/* Measured output includes framing overhead */
+	if (cost.bytes_per_sec < expected ||
+	    cost.bytes_per_sec > expected + expected / 10) {
+		fprintf(stderr, "  FAIL: bytes_per_sec %d, expected ~%d\n",
+			cost.bytes_per_sec, expected);
+		return -1;
+	}
+
+	if (cost.encode_ns_per_sec == 0 || cost.decode_ns_per_sec == 0) {
+		fprintf(stderr, "  FAIL: no CPU time measured\n");
+		return -1;
+	}
+
+	printf("  PASS (encode %llu ns/s, decode %llu ns/s)\n",
+	       (unsigned long long)cost.encode_ns_per_sec,
+	       (unsigned long long)cost.decode_ns_per_sec);
+	return 0;
+}
+
+static int test_select(void)
+{
+	struct mux_codec_cost cost;
+	enum mux_codec_type codec;
+	int ret;
+
+	printf("Testing codec selection...\n");
+
+	/* PCM at 16 KB/s doesn't fit, G.711 does */
+	ret = mux_codec_select(8000, 1, 0, 9000, &codec);
+	if (ret != MUX_OK) {
+		fprintf(stderr, "  FAIL: no codec selected\n");
+		return -1;
+	}
+
+	mux_codec_cost(codec, 8000, 1, &cost);
+	if (cost.bytes_per_sec > 9000) {
+		fprintf(stderr, "  FAIL: %s exceeds bitrate limit\n",
+			mux_codec_to_name(codec));
+		return -1;
+	}
+
+	ret = mux_codec_select(8000, 1, 0, 10, &codec);
+	if (ret != MUX_ERROR_NOCODEC) {
+		fprintf(stderr, "  FAIL: impossible constraint satisfied\n");
+		return -1;
+	}
+
+	printf("  PASS (selected %s)\n", mux_codec_to_name(codec));
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Cost Model Tests\n");
+	printf("================\n\n");
+
+	if (test_nominal() != 0)
+		failures++;
+	if (test_calibrate(MUX_CODEC_PCM, 2) != 0)
+		failures++;
+	if (test_calibrate(MUX_CODEC_ALAW, 1) != 0)
+		failures++;
+	if (test_select() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
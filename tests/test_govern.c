@@ -0,0 +1,354 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test the load governor: admission stops at the configured load,
+ * overload sheds the lowest priorities first and leaves protected
+ * sessions alone, silent sessions are spotted, and Opus sessions get
+ * their complexity lowered, DTX turned on and both undone again
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mux.h"
+
+#define RATE     8000
+#define TICK     (RATE / 50)
+#define SESSIONS 4
+#define MAX_ADMIT 100000
+
+static int16_t loud[48000 / 50 * 2], quiet[48000 / 50 * 2];
+static uint8_t out[1 << 16];
+
+static void fill(int16_t *pcm, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; i++)
+		pcm[i] = (int16_t)((((int)i * 2731) % 24000) - 12000);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int encode(struct mux_encoder *enc, const int16_t *pcm, size_t frames,
+		  int channels)
+{
+	size_t consumed, written;
+	int ret;
+
+	ret = mux_encoder_encode(enc, pcm, frames * (size_t)channels *
+				 sizeof(*pcm), &consumed, MUX_STREAM_AUDIO);
+	while (mux_encoder_read(enc, out, sizeof(out), &written) == MUX_OK &&
+	       written > 0)
+		;
+	return ret;
+}
+
+static void nap(int ms)
+{
+	struct timespec ts = { 0, (long)ms * 1000000 };
+
+	nanosleep(&ts, NULL);
+}
+
+/* Keep every session encoding for ms of wall time */
+static void busy(struct mux_encoder **encs, int n, const int16_t *pcm,
+		 size_t frames, int channels, int ms)
+{
+	uint64_t end = now_ns() + (uint64_t)ms * 1000000;
+	int i;
+
+	while (now_ns() < end)
+		for (i = 0; i < n; i++)
+			encode(encs[i], pcm, frames, channels);
+}
+
+static int test_admission(void)
+{
+	struct mux_governor_config cfg;
+	struct mux_governor_event ev;
+	struct mux_governor_stats stats;
+	struct mux_governor *g;
+	struct mux_encoder **encs;
+	int n = 0, ret = MUX_OK, ok;
+
+	printf("Test: Admission stops at the load limit\n");
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.cpus = 1;
+	cfg.admit_load_pct = 1;
+	g = mux_governor_new(&cfg);
+	encs = calloc(MAX_ADMIT, sizeof(*encs));
+	if (!g || !encs) {
+		printf("  FAIL: Could not create the governor\n");
+		mux_governor_destroy(g);
+		free(encs);
+		return -1;
+	}
+
+	while (n < MAX_ADMIT) {
+		encs[n] = mux_encoder_new(MUX_CODEC_ALAW, RATE, 1, 1, NULL, 0);
+		if (!encs[n])
+			break;
+		ret = mux_governor_admit(g, encs[n], (uint32_t)n, 1);
+		if (ret != MUX_OK) {
+			mux_encoder_destroy(encs[n]);
+			break;
+		}
+		n++;
+	}
+
+	ok = ret == MUX_ERROR_LIMIT && n > 0 &&
+	     mux_governor_next_event(g, &ev) == MUX_OK &&
+	     ev.action == MUX_GOVERN_REFUSED && ev.id == (uint32_t)n &&
+	     mux_governor_next_event(g, &ev) == MUX_ERROR_NOTFOUND &&
+	     mux_governor_admit(g, encs[0], 0, 1) == MUX_ERROR_INVAL;
+
+	/* A session leaving makes room for one more */
+	mux_encoder_destroy(encs[n - 1]);
+	encs[n - 1] = mux_encoder_new(MUX_CODEC_ALAW, RATE, 1, 1, NULL, 0);
+	ok = ok && encs[n - 1] &&
+	     mux_governor_admit(g, encs[n - 1], 0, 1) == MUX_OK &&
+	     mux_governor_get_stats(g, &stats) == MUX_OK &&
+	     stats.sessions == n && stats.admitted == (uint64_t)n + 1 &&
+	     stats.actions[MUX_GOVERN_REFUSED] == 1;
+
+	mux_governor_destroy(g);
+	while (n-- > 0)
+		mux_encoder_destroy(encs[n]);
+	free(encs);
+
+	if (!ok) {
+		printf("  FAIL: Admission not limited as configured\n");
+		return -1;
+	}
+	printf("  PASS: Refused after %d sessions\n", (int)stats.admitted - 1);
+	return 0;
+}
+
+static int test_shed(void)
+{
+	static const int priorities[SESSIONS] = { 2, 1, 3, 1 };
+	struct mux_governor_config cfg;
+	struct mux_governor_session info;
+	struct mux_governor_event ev;
+	struct mux_governor_stats stats;
+	struct mux_governor *g;
+	struct mux_encoder *encs[SESSIONS];
+	int i, last = 0, ok = 1, shed = 0;
+
+	printf("Test: Overload sheds low priorities first\n");
+
+	/* Any encoding at all is an overload */
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.cpus = 1;
+	cfg.max_load_pct = 1;
+	cfg.admit_load_pct = 100;
+	cfg.protected_priority = 3;
+	g = mux_governor_new(&cfg);
+	if (!g) {
+		printf("  FAIL: Could not create the governor\n");
+		return -1;
+	}
+
+	for (i = 0; i < SESSIONS; i++) {
+		encs[i] = mux_encoder_new(MUX_CODEC_ALAW, RATE, 1, 2, NULL, 0);
+		if (!encs[i] || mux_governor_admit(g, encs[i], (uint32_t)i,
+						   priorities[i]) != MUX_OK)
+			ok = 0;
+	}
+	if (!ok) {
+		printf("  FAIL: Could not admit the sessions\n");
+		goto out;
+	}
+
+	mux_governor_update(g);
+	busy(encs, SESSIONS, loud, TICK, 1, 50);
+	if (mux_governor_update(g) != SESSIONS - 1) {
+		printf("  FAIL: Expected %d decisions\n", SESSIONS - 1);
+		ok = 0;
+		goto out;
+	}
+
+	while (mux_governor_next_event(g, &ev) == MUX_OK) {
+		if (ev.action != MUX_GOVERN_SHED_SESSION ||
+		    ev.priority < last || ev.priority >= 3 || ev.load_pct < 1)
+			ok = 0;
+		last = ev.priority;
+		shed++;
+	}
+
+	for (i = 0; i < SESSIONS; i++) {
+		int want = priorities[i] < 3 ? MUX_ERROR_LIMIT : MUX_OK;
+
+		if (mux_governor_get_session(g, encs[i], &info) != MUX_OK ||
+		    info.shed != (priorities[i] < 3) || info.complexity != -1 ||
+		    encode(encs[i], loud, TICK, 1) != want)
+			ok = 0;
+		/* Shed sessions still flush what they have */
+		if (priorities[i] < 3 && mux_encoder_finalize(encs[i]) != MUX_OK)
+			ok = 0;
+	}
+
+	ok = ok && shed == SESSIONS - 1 &&
+	     mux_governor_get_stats(g, &stats) == MUX_OK &&
+	     stats.sessions == 1 && stats.overloaded &&
+	     stats.actions[MUX_GOVERN_SHED_SESSION] == SESSIONS - 1;
+	if (!ok)
+		printf("  FAIL: Wrong sessions shed\n");
+	else
+		printf("  PASS: %d shed in priority order, load %d%%\n", shed,
+		       stats.load_pct);
+
+out:
+	/* Encoders may go first; their sessions detach */
+	for (i = 0; i < SESSIONS; i++)
+		mux_encoder_destroy(encs[i]);
+	mux_governor_destroy(g);
+	return ok ? 0 : -1;
+}
+
+static int test_silence(void)
+{
+	struct mux_governor_session a, b;
+	struct mux_governor *g;
+	struct mux_encoder *talk, *hold;
+	int ok;
+
+	printf("Test: Silent sessions are spotted\n");
+
+	g = mux_governor_new(NULL);
+	talk = mux_encoder_new(MUX_CODEC_MULAW, RATE, 1, 1, NULL, 0);
+	hold = mux_encoder_new(MUX_CODEC_MULAW, RATE, 1, 1, NULL, 0);
+	ok = g && talk && hold &&
+	     mux_governor_admit(g, talk, 1, 1) == MUX_OK &&
+	     mux_governor_admit(g, hold, 2, 1) == MUX_OK;
+
+	if (ok) {
+		mux_governor_update(g);
+		encode(talk, quiet, TICK, 1);
+		encode(talk, loud, TICK, 1);
+		encode(hold, quiet, TICK, 1);
+		mux_governor_update(g);
+		ok = mux_governor_get_session(g, talk, &a) == MUX_OK &&
+		     mux_governor_get_session(g, hold, &b) == MUX_OK &&
+		     !a.silent && b.silent && a.id == 1 && b.id == 2 &&
+		     mux_governor_remove(g, hold) == MUX_OK &&
+		     mux_governor_get_session(g, hold, &b) ==
+		     MUX_ERROR_NOTFOUND &&
+		     mux_governor_remove(g, hold) == MUX_ERROR_NOTFOUND;
+	}
+
+	mux_governor_destroy(g);
+	mux_encoder_destroy(talk);
+	mux_encoder_destroy(hold);
+
+	if (!ok) {
+		printf("  FAIL: Silence not detected\n");
+		return -1;
+	}
+	printf("  PASS: Quiet session marked silent, talking one not\n");
+	return 0;
+}
+
+static int test_opus(void)
+{
+	struct mux_governor_config cfg;
+	struct mux_governor_session info;
+	struct mux_governor_event ev;
+	struct mux_governor *g;
+	struct mux_encoder *enc;
+	size_t frames = 48000 / 50;
+	int ok, ceiling, lowered = 0, dtx = 0, dtx_off = 0, restored = 0, i;
+
+	printf("Test: Opus complexity and DTX follow the load\n");
+
+	enc = mux_encoder_new(MUX_CODEC_OPUS, 48000, 1, 1, NULL, 0);
+	if (!enc) {
+		printf("  SKIP (Opus not available)\n");
+		return 0;
+	}
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.cpus = 1;
+	cfg.max_load_pct = 1;
+	cfg.admit_load_pct = 100;
+	cfg.policies[0] = MUX_GOVERN_COMPLEXITY;
+	cfg.policies[1] = MUX_GOVERN_DTX;
+	g = mux_governor_new(&cfg);
+	ok = g && mux_governor_admit(g, enc, 7, 1) == MUX_OK &&
+	     mux_governor_get_session(g, enc, &info) == MUX_OK &&
+	     info.complexity > 2;
+	ceiling = info.complexity;
+
+	/* Overloaded while silent: both policies, never shed */
+	if (ok) {
+		mux_governor_update(g);
+		busy(&enc, 1, quiet, frames, 1, 50);
+		ok = mux_governor_update(g) == 2;
+		encode(enc, quiet, frames, 1);
+		ok = ok && mux_governor_get_session(g, enc, &info) == MUX_OK &&
+		     info.complexity == 2 && info.dtx && !info.shed;
+	}
+
+	/* Idle: undone one per update, DTX first */
+	for (i = 0; ok && i < 2; i++) {
+		nap(200);
+		mux_governor_update(g);
+		encode(enc, quiet, frames, 1);
+	}
+	ok = ok && mux_governor_get_session(g, enc, &info) == MUX_OK &&
+	     info.complexity == ceiling && !info.dtx;
+
+	while (ok && mux_governor_next_event(g, &ev) == MUX_OK) {
+		lowered += ev.action == MUX_GOVERN_COMPLEXITY_LOWERED;
+		dtx += ev.action == MUX_GOVERN_DTX_ON;
+		dtx_off += ev.action == MUX_GOVERN_DTX_OFF;
+		restored += ev.action == MUX_GOVERN_COMPLEXITY_RESTORED &&
+			    dtx_off == 1;
+	}
+	ok = ok && lowered == 1 && dtx == 1 && dtx_off == 1 && restored == 1;
+
+	mux_governor_destroy(g);
+	mux_encoder_destroy(enc);
+
+	if (!ok) {
+		printf("  FAIL: Complexity or DTX not governed\n");
+		return -1;
+	}
+	printf("  PASS: Complexity %d -> 2 -> %d, DTX on and off\n", ceiling,
+	       ceiling);
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Load Governor Tests\n");
+	printf("===================\n\n");
+
+	fill(loud, sizeof(loud) / sizeof(loud[0]));
+
+	if (test_admission() != 0)
+		failures++;
+	if (test_shed() != 0)
+		failures++;
+	if (test_silence() != 0)
+		failures++;
+	if (test_opus() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
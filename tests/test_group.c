@@ -0,0 +1,272 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test channel-group encoding: wide streams round-trip through
+ * per-group codec instances, the output doesn't depend on the thread
+ * count, and the decoder's channel limit still applies
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE     8000
+#define FRAMES   1600
+#define OUT_MAX  (4 << 20)
+
+static uint8_t stream[OUT_MAX];
+static uint8_t stream2[OUT_MAX];
+static uint8_t decoded[OUT_MAX];
+
+static void fill(int16_t *pcm, int channels, size_t frames)
+{
+	size_t i;
+
+	for (i = 0; i < frames * (size_t)channels; i++)
+		pcm[i] = (int16_t)((i * 7919) % 20000 - 10000);
+}
+
+/* Two chunks with a side message between them */
+static size_t encode(enum mux_codec_type codec, int channels, int groups,
+		     int threads, const int16_t *pcm, uint8_t *out)
+{
+	struct mux_param params[] = {
+		{ .name = "channel_groups", .value.i = groups },
+		{ .name = "threads", .value.i = threads },
+	};
+	struct mux_encoder *enc;
+	size_t half = FRAMES / 2 * (size_t)channels * sizeof(int16_t);
+	size_t consumed, written, len = 0;
+	int ok;
+
+	enc = mux_encoder_new(codec, RATE, channels, 2, params, 2);
+	if (!enc)
+		return 0;
+
+	ok = mux_encoder_encode(enc, pcm, half, &consumed,
+				MUX_STREAM_AUDIO) == MUX_OK &&
+	     consumed == half &&
+	     mux_encoder_encode(enc, "marker", 6, &consumed,
+				MUX_STREAM_SIDE_CHANNEL) == MUX_OK &&
+	     mux_encoder_encode(enc, (const uint8_t *)pcm + half, half,
+				&consumed, MUX_STREAM_AUDIO) == MUX_OK &&
+	     mux_encoder_finalize(enc) == MUX_OK;
+
+	while (ok && mux_encoder_read(enc, out + len, OUT_MAX - len,
+				      &written) == MUX_OK && written > 0)
+		len += written;
+
+	mux_encoder_destroy(enc);
+	return ok ? len : 0;
+}
+
+/* max_channels 0 leaves the default */
+static int decode(enum mux_codec_type codec, int max_channels,
+		  const uint8_t *in, size_t len, size_t *audio, int *side)
+{
+	struct mux_param params[] = {
+		{ .name = "channel_groups", .value.b = 1 },
+		{ .name = "max_channels", .value.i = max_channels },
+	};
+	struct mux_decoder *dec;
+	size_t pos, n, consumed, written;
+	int ret = MUX_OK, stream_type;
+
+	*audio = 0;
+	*side = 0;
+	dec = mux_decoder_new(codec, 2, params, max_channels ? 2 : 1);
+	if (!dec)
+		return MUX_ERROR;
+
+	/* Odd-sized pieces to split frames and tags */
+	for (pos = 0; pos < len && ret == MUX_OK; pos += n) {
+		n = len - pos < 1001 ? len - pos : 1001;
+		ret = mux_decoder_decode(dec, in + pos, n, &consumed);
+	}
+	if (ret == MUX_OK)
+		ret = mux_decoder_finalize(dec);
+
+	while (ret == MUX_OK &&
+	       (ret = mux_decoder_read(dec, decoded + *audio,
+				       OUT_MAX - *audio, &written,
+				       &stream_type)) == MUX_OK &&
+	       written > 0) {
+		if (stream_type == MUX_STREAM_SIDE_CHANNEL)
+			*side = written == 6 && memcmp(decoded + *audio,
+						      "marker", 6) == 0;
+		else
+			*audio += written;
+	}
+
+	mux_decoder_destroy(dec);
+	return ret;
+}
+
+static int test_pcm_pairs(void)
+{
+	static int16_t pcm[FRAMES * 16];
+	size_t len, len2, audio;
+	int side;
+
+	printf("Testing 16 channels in stereo pairs...\n");
+
+	fill(pcm, 16, FRAMES);
+	len = encode(MUX_CODEC_PCM, 16, 2, 4, pcm, stream);
+	if (len == 0 ||
+	    decode(MUX_CODEC_PCM, 0, stream, len, &audio, &side) != MUX_OK ||
+	    audio != sizeof(pcm) || memcmp(decoded, pcm, audio) != 0 ||
+	    !side) {
+		fprintf(stderr, "  FAIL: round trip (%zu bytes)\n", audio);
+		return -1;
+	}
+
+	/* Same bytes in the calling thread alone */
+	len2 = encode(MUX_CODEC_PCM, 16, 2, 1, pcm, stream2);
+	if (len2 != len || memcmp(stream, stream2, len) != 0) {
+		fprintf(stderr, "  FAIL: output depends on thread count\n");
+		return -1;
+	}
+
+	printf("  PASS (%zu bytes)\n", len);
+	return 0;
+}
+
+static int test_alaw_mono(void)
+{
+	static int16_t pcm[FRAMES * 5], ref[FRAMES * 5];
+	struct mux_encoder *enc;
+	struct mux_decoder *dec;
+	static uint8_t plain[OUT_MAX];
+	size_t len, consumed, written, plain_len = 0, n = 0, audio;
+	int stream_type, side;
+
+	printf("Testing 5 mono G.711 groups...\n");
+
+	/* Reference: the same samples through one 5-channel encoder */
+	fill(pcm, 5, FRAMES);
+	enc = mux_encoder_new(MUX_CODEC_ALAW, RATE, 5, 1, NULL, 0);
+	dec = mux_decoder_new(MUX_CODEC_ALAW, 1, NULL, 0);
+	if (!enc || !dec) {
+		mux_encoder_destroy(enc);
+		mux_decoder_destroy(dec);
+		return -1;
+	}
+	mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed, MUX_STREAM_AUDIO);
+	mux_encoder_finalize(enc);
+	while (mux_encoder_read(enc, plain + plain_len, OUT_MAX - plain_len,
+				&written) == MUX_OK && written > 0)
+		plain_len += written;
+	mux_decoder_decode(dec, plain, plain_len, &consumed);
+	mux_decoder_finalize(dec);
+	while (mux_decoder_read(dec, (uint8_t *)ref + n, sizeof(ref) - n,
+				&written, &stream_type) == MUX_OK && written > 0)
+		n += written;
+	mux_encoder_destroy(enc);
+	mux_decoder_destroy(dec);
+
+	len = encode(MUX_CODEC_ALAW, 5, 1, 0, pcm, stream);
+	if (len == 0 || n != sizeof(ref) ||
+	    decode(MUX_CODEC_ALAW, 8, stream, len, &audio, &side) != MUX_OK ||
+	    audio != sizeof(ref) || memcmp(decoded, ref, audio) != 0) {
+		fprintf(stderr, "  FAIL: grouped decode differs\n");
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_limits(void)
+{
+	static int16_t pcm[FRAMES * 16];
+	struct mux_param bad = { .name = "channel_groups", .value.i = 3 };
+	struct mux_param pairs = { .name = "channel_groups", .value.i = 2 };
+	struct mux_encoder *enc;
+	size_t len, audio, consumed;
+	int side;
+
+	printf("Testing limits and partial frames...\n");
+
+	/* Only mono and stereo groups */
+	enc = mux_encoder_new(MUX_CODEC_PCM, RATE, 6, 1, &bad, 1);
+	if (enc) {
+		mux_encoder_destroy(enc);
+		fprintf(stderr, "  FAIL: groups of 3 accepted\n");
+		return -1;
+	}
+
+	/* 16 channels over a max_channels of 8 */
+	fill(pcm, 16, FRAMES);
+	len = encode(MUX_CODEC_PCM, 16, 2, 0, pcm, stream);
+	if (decode(MUX_CODEC_PCM, 8, stream, len, &audio, &side) !=
+	    MUX_ERROR_LIMIT) {
+		fprintf(stderr, "  FAIL: channel limit not enforced\n");
+		return -1;
+	}
+
+	/* Whole frames only: 3 channels, 7 samples takes 2 frames */
+	enc = mux_encoder_new(MUX_CODEC_PCM, RATE, 3, 1, &pairs, 1);
+	if (!enc ||
+	    mux_encoder_encode(enc, pcm, 7 * sizeof(int16_t), &consumed,
+			       MUX_STREAM_AUDIO) != MUX_OK ||
+	    consumed != 6 * sizeof(int16_t)) {
+		mux_encoder_destroy(enc);
+		fprintf(stderr, "  FAIL: partial frame\n");
+		return -1;
+	}
+	mux_encoder_destroy(enc);
+
+	printf("  PASS\n");
+	return 0;
+}
+
+/* A codec that can't take this many channels on its own */
+static int test_flac_wide(void)
+{
+	static int16_t pcm[FRAMES * 24];
+	size_t len, audio;
+	int side;
+
+	printf("Testing 24-channel FLAC...\n");
+
+	fill(pcm, 24, FRAMES);
+	len = encode(MUX_CODEC_FLAC, 24, 2, 0, pcm, stream);
+	if (len == 0) {
+		printf("  SKIP (FLAC not available)\n");
+		return 0;
+	}
+
+	if (decode(MUX_CODEC_FLAC, 0, stream, len, &audio, &side) != MUX_OK ||
+	    audio != sizeof(pcm) || memcmp(decoded, pcm, audio) != 0 ||
+	    !side) {
+		fprintf(stderr, "  FAIL: lossless round trip\n");
+		return -1;
+	}
+
+	printf("  PASS (%zu bytes)\n", len);
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Channel Group Tests\n");
+	printf("===================\n\n");
+
+	if (test_pcm_pairs() != 0)
+		failures++;
+	if (test_alaw_mono() != 0)
+		failures++;
+	if (test_limits() != 0)
+		failures++;
+	if (test_flac_wide() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
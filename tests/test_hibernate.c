@@ -0,0 +1,270 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test idle session trimming and hibernation: memory goes down and the
+ * session continues exactly as if it had never been parked
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "test_utils.h"
+
+#define RATE     16000
+#define CHANNELS 1
+#define OUT_SIZE (1 << 20)
+
+static int test_encoder(enum mux_codec_type codec, int optional)
+{
+	struct mux_encoder *a, *b;
+	uint8_t *out_a, *out_b;
+	size_t len_a, len_b, before, after;
+	int ret = -1;
+
+	printf("Testing %s encoder hibernation...\n", mux_codec_to_name(codec));
+
+	a = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	b = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	if (!a || !b) {
+		mux_encoder_destroy(a);
+		mux_encoder_destroy(b);
+		if (optional) {
+			printf("  SKIP (codec not available)\n");
+			return 0;
+		}
+		fprintf(stderr, "  FAIL: mux_encoder_new\n");
+		return -1;
+	}
+
+	out_a = malloc(OUT_SIZE);
+	out_b = malloc(OUT_SIZE);
+	if (!out_a || !out_b)
+		goto out;
+
+	/* Grow the buffers, then leave some output unread */
+	if (feed_session(a, 0, 50) != 0 || feed_session(b, 0, 50) != 0)
+		goto out;
+	len_a = drain_session(a, out_a, OUT_SIZE);
+	len_b = drain_session(b, out_b, OUT_SIZE);
+	if (feed_session(a, 50, 3) != 0 || feed_session(b, 50, 3) != 0)
+		goto out;
+
+	before = mux_encoder_memory_usage(b);
+	if (mux_encoder_hibernate(b) != MUX_OK ||
+	    mux_encoder_hibernate(b) != MUX_OK) {
+		fprintf(stderr, "  FAIL: hibernate\n");
+		goto out;
+	}
+	after = mux_encoder_memory_usage(b);
+	if (after >= before) {
+		fprintf(stderr, "  FAIL: %zu bytes before, %zu after\n",
+			before, after);
+		goto out;
+	}
+
+	/* The next call wakes it implicitly */
+	if (feed_session(a, 53, 20) != 0 || feed_session(b, 53, 20) != 0 ||
+	    mux_encoder_finalize(a) != MUX_OK ||
+	    mux_encoder_finalize(b) != MUX_OK) {
+		fprintf(stderr, "  FAIL: encode after hibernation\n");
+		goto out;
+	}
+
+	len_a += drain_session(a, out_a + len_a, OUT_SIZE - len_a);
+	len_b += drain_session(b, out_b + len_b, OUT_SIZE - len_b);
+	if (len_a == 0 || len_a != len_b || memcmp(out_a, out_b, len_a) != 0) {
+		fprintf(stderr, "  FAIL: output differs (%zu vs %zu bytes)\n",
+			len_a, len_b);
+		goto out;
+	}
+
+	printf("  PASS (%zu -> %zu bytes)\n", before, after);
+	ret = 0;
+
+out:
+	mux_encoder_destroy(b);
+	mux_encoder_destroy(a);
+	free(out_b);
+	free(out_a);
+	return ret;
+}
+
+static size_t read_all(struct mux_decoder *dec, uint8_t *out, size_t size)
+{
+	size_t total = 0, written;
+	int stream_type;
+
+	do {
+		stream_type = -1;
+		if (mux_decoder_read(dec, out + total, size - total, &written,
+				     &stream_type) != MUX_OK)
+			return 0;
+		total += written;
+	} while (written > 0 && total < size);
+
+	return total;
+}
+
+static int test_decoder(enum mux_codec_type codec, int optional)
+{
+	struct mux_encoder *enc;
+	struct mux_decoder *a, *b;
+	uint8_t *stream, *out_a, *out_b;
+	size_t len, split, consumed, len_a, len_b, before, after;
+	int ret = -1;
+
+	printf("Testing %s decoder hibernation...\n", mux_codec_to_name(codec));
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	a = mux_decoder_new(codec, 2, NULL, 0);
+	b = mux_decoder_new(codec, 2, NULL, 0);
+	stream = malloc(OUT_SIZE);
+	out_a = malloc(OUT_SIZE);
+	out_b = malloc(OUT_SIZE);
+	if (!enc || !a || !b) {
+		if (optional) {
+			printf("  SKIP (codec not available)\n");
+			ret = 0;
+		} else {
+			fprintf(stderr, "  FAIL: setup\n");
+		}
+		goto out;
+	}
+	if (!stream || !out_a || !out_b)
+		goto out;
+
+	if (feed_session(enc, 0, 60) != 0 || mux_encoder_finalize(enc) != MUX_OK)
+		goto out;
+	len = drain_session(enc, stream, OUT_SIZE);
+
+	/* Park it with a partial frame of input outstanding */
+	split = len * 2 / 3 + 5;
+	if (mux_decoder_decode(a, stream, split, &consumed) != MUX_OK ||
+	    consumed != split ||
+	    mux_decoder_decode(b, stream, split, &consumed) != MUX_OK ||
+	    consumed != split)
+		goto out;
+	len_a = read_all(a, out_a, OUT_SIZE);
+	len_b = read_all(b, out_b, OUT_SIZE);
+
+	before = mux_decoder_memory_usage(b);
+	if (mux_decoder_hibernate(b) != MUX_OK) {
+		fprintf(stderr, "  FAIL: hibernate\n");
+		goto out;
+	}
+	after = mux_decoder_memory_usage(b);
+	if (after >= before) {
+		fprintf(stderr, "  FAIL: %zu bytes before, %zu after\n",
+			before, after);
+		goto out;
+	}
+
+	/* Explicit wake this time */
+	if (mux_decoder_wake(b) != MUX_OK ||
+	    mux_decoder_decode(a, stream + split, len - split,
+			       &consumed) != MUX_OK ||
+	    mux_decoder_decode(b, stream + split, len - split,
+			       &consumed) != MUX_OK ||
+	    mux_decoder_finalize(a) != MUX_OK ||
+	    mux_decoder_finalize(b) != MUX_OK) {
+		fprintf(stderr, "  FAIL: decode after hibernation\n");
+		goto out;
+	}
+
+	len_a += read_all(a, out_a + len_a, OUT_SIZE - len_a);
+	len_b += read_all(b, out_b + len_b, OUT_SIZE - len_b);
+	if (len_a == 0 || len_a != len_b || memcmp(out_a, out_b, len_a) != 0) {
+		fprintf(stderr, "  FAIL: output differs (%zu vs %zu bytes)\n",
+			len_a, len_b);
+		goto out;
+	}
+
+	printf("  PASS (%zu -> %zu bytes)\n", before, after);
+	ret = 0;
+
+out:
+	mux_decoder_destroy(b);
+	mux_decoder_destroy(a);
+	mux_encoder_destroy(enc);
+	free(out_b);
+	free(out_a);
+	free(stream);
+	return ret;
+}
+
+static int test_trim(void)
+{
+	struct mux_encoder *enc;
+	uint8_t out[4096];
+	size_t before, after, written;
+	int ret = -1;
+
+	printf("Testing trim keeps pending output...\n");
+
+	enc = mux_encoder_new(MUX_CODEC_PCM, RATE, CHANNELS, 2, NULL, 0);
+	if (!enc)
+		return -1;
+
+	if (feed_session(enc, 0, 40) != 0)
+		goto out;
+	while (mux_encoder_read(enc, out, sizeof(out), &written) == MUX_OK &&
+	       written > 0)
+		;
+	if (feed_session(enc, 40, 1) != 0)
+		goto out;
+
+	before = mux_encoder_memory_usage(enc);
+	if (mux_encoder_trim(enc) != MUX_OK)
+		goto out;
+	after = mux_encoder_memory_usage(enc);
+
+	/* One chunk, its frame header and a side packet remain */
+	if (mux_encoder_read(enc, out, sizeof(out), &written) != MUX_OK ||
+	    written != SESSION_CHUNK * sizeof(int16_t) + 2 + 5 || after >= before) {
+		fprintf(stderr, "  FAIL: %zu pending bytes, %zu -> %zu\n",
+			written, before, after);
+		goto out;
+	}
+
+	if (mux_encoder_trim(NULL) != MUX_ERROR_INVAL ||
+	    mux_decoder_wake(NULL) != MUX_ERROR_INVAL ||
+	    mux_encoder_wake(enc) != MUX_OK) {
+		fprintf(stderr, "  FAIL: argument handling\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_encoder_destroy(enc);
+	return ret;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Session Hibernation Tests\n");
+	printf("=========================\n\n");
+
+	if (test_encoder(MUX_CODEC_PCM, 0) != 0)
+		failures++;
+	if (test_encoder(MUX_CODEC_OPUS, 1) != 0)
+		failures++;
+	if (test_decoder(MUX_CODEC_PCM, 0) != 0)
+		failures++;
+	if (test_decoder(MUX_CODEC_ALAW, 0) != 0)
+		failures++;
+	if (test_decoder(MUX_CODEC_OPUS, 1) != 0)
+		failures++;
+	if (test_trim() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
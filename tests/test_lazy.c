@@ -0,0 +1,341 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test lazy decoding: output matches eager decoding whatever the read
+ * pattern, input stays compressed until it is read, and snapshots of a
+ * lazy decoder carry the queued input along
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE      16000
+#define CHANNELS  1
+#define CHUNK     320          /* 20 ms */
+#define CHUNKS    150
+#define OUT_SIZE  (1 << 21)
+
+static const struct mux_param lazy_param[] = {
+	{ .name = "lazy", .value.b = 1 },
+};
+
+struct output {
+	uint8_t *audio;
+	size_t audio_len;
+	uint8_t side[4096];
+	size_t side_len;
+};
+
+static size_t encode_stream(enum mux_codec_type codec, uint8_t *out)
+{
+	struct mux_encoder *enc;
+	int16_t pcm[CHUNK * CHANNELS];
+	char tag[16];
+	size_t total = 0, consumed, written;
+	int i, j;
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	if (!enc)
+		return 0;
+
+	for (i = 0; i < CHUNKS; i++) {
+		for (j = 0; j < CHUNK * CHANNELS; j++)
+			pcm[j] = (int16_t)(((i * CHUNK + j) * 97) % 30000 - 15000);
+		if (mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				       MUX_STREAM_AUDIO) != MUX_OK)
+			goto fail;
+		if (i % 25 == 0) {
+			snprintf(tag, sizeof(tag), "mark %d;", i);
+			if (mux_encoder_encode(enc, tag, strlen(tag), &consumed,
+					       MUX_STREAM_SIDE_CHANNEL) != MUX_OK)
+				goto fail;
+		}
+	}
+	if (mux_encoder_finalize(enc) != MUX_OK)
+		goto fail;
+
+	while (mux_encoder_read(enc, out + total, OUT_SIZE - total,
+				&written) == MUX_OK && written > 0)
+		total += written;
+
+	mux_encoder_destroy(enc);
+	return total;
+
+fail:
+	mux_encoder_destroy(enc);
+	return 0;
+}
+
+/* Read whatever is available in requests of at most step bytes */
+static int read_some(struct mux_decoder *dec, struct output *o, size_t step,
+		     int max_reads)
+{
+	size_t n;
+	int stream_type, reads = 0;
+	uint8_t *dst;
+
+	do {
+		dst = o->audio + o->audio_len;
+		stream_type = -1;
+		if (mux_decoder_read(dec, dst, step, &n, &stream_type) != MUX_OK)
+			return -1;
+		if (n == 0)
+			break;
+		if (stream_type == MUX_STREAM_SIDE_CHANNEL) {
+			if (o->side_len + n > sizeof(o->side))
+				return -1;
+			memcpy(o->side + o->side_len, dst, n);
+			o->side_len += n;
+		} else {
+			o->audio_len += n;
+		}
+	} while (++reads != max_reads);
+
+	return 0;
+}
+
+static int same_output(const struct output *a, const struct output *b)
+{
+	return a->audio_len > 0 && a->audio_len == b->audio_len &&
+	       memcmp(a->audio, b->audio, a->audio_len) == 0 &&
+	       a->side_len == b->side_len &&
+	       memcmp(a->side, b->side, a->side_len) == 0;
+}
+
+static int test_codec(enum mux_codec_type codec, int optional)
+{
+	struct mux_decoder *eager = NULL, *lazy = NULL;
+	struct output ref, out;
+	uint8_t *stream;
+	size_t len, consumed, pos, eager_mem, lazy_mem;
+	int ret = -1;
+
+	printf("Testing %s lazy decoding...\n", mux_codec_to_name(codec));
+
+	memset(&ref, 0, sizeof(ref));
+	memset(&out, 0, sizeof(out));
+	stream = malloc(OUT_SIZE);
+	ref.audio = malloc(OUT_SIZE);
+	out.audio = malloc(OUT_SIZE);
+	if (!stream || !ref.audio || !out.audio)
+		goto out;
+
+	len = encode_stream(codec, stream);
+	eager = mux_decoder_new(codec, 2, NULL, 0);
+	lazy = mux_decoder_new(codec, 2, lazy_param, 1);
+	if (len == 0 || !eager || !lazy) {
+		if (optional) {
+			printf("  SKIP (codec not available)\n");
+			ret = 0;
+		} else {
+			fprintf(stderr, "  FAIL: setup\n");
+		}
+		goto out;
+	}
+
+	/* Whole stream in, nothing read yet */
+	if (mux_decoder_decode(eager, stream, len, &consumed) != MUX_OK ||
+	    mux_decoder_decode(lazy, stream, len, &consumed) != MUX_OK ||
+	    consumed != len) {
+		fprintf(stderr, "  FAIL: decode\n");
+		goto out;
+	}
+	eager_mem = mux_decoder_memory_usage(eager);
+	lazy_mem = mux_decoder_memory_usage(lazy);
+	if (lazy_mem > len + 64 * 1024) {
+		fprintf(stderr, "  FAIL: %zu bytes held for %zu of input\n",
+			lazy_mem, len);
+		goto out;
+	}
+
+	if (mux_decoder_finalize(eager) != MUX_OK ||
+	    mux_decoder_finalize(lazy) != MUX_OK ||
+	    read_some(eager, &ref, OUT_SIZE, -1) != 0 ||
+	    read_some(lazy, &out, 1000, -1) != 0) {
+		fprintf(stderr, "  FAIL: read\n");
+		goto out;
+	}
+	if (!same_output(&ref, &out)) {
+		fprintf(stderr, "  FAIL: output differs (%zu/%zu audio, "
+			"%zu/%zu side)\n", out.audio_len, ref.audio_len,
+			out.side_len, ref.side_len);
+		goto out;
+	}
+
+	/* Input trickled in, reads interleaved */
+	mux_decoder_destroy(lazy);
+	lazy = mux_decoder_new(codec, 2, lazy_param, 1);
+	if (!lazy)
+		goto out;
+	memset(out.side, 0, sizeof(out.side));
+	out.audio_len = out.side_len = 0;
+	for (pos = 0; pos < len; pos += consumed) {
+		size_t n = len - pos < 333 ? len - pos : 333;
+
+		if (mux_decoder_decode(lazy, stream + pos, n,
+				       &consumed) != MUX_OK ||
+		    read_some(lazy, &out, 700, 2) != 0)
+			goto out;
+	}
+	if (mux_decoder_finalize(lazy) != MUX_OK ||
+	    read_some(lazy, &out, 4096, -1) != 0 || !same_output(&ref, &out)) {
+		fprintf(stderr, "  FAIL: interleaved output differs\n");
+		goto out;
+	}
+
+	printf("  PASS (%zu -> %zu bytes buffered)\n", eager_mem, lazy_mem);
+	ret = 0;
+
+out:
+	mux_decoder_destroy(lazy);
+	mux_decoder_destroy(eager);
+	free(out.audio);
+	free(ref.audio);
+	free(stream);
+	return ret;
+}
+
+/* Only what is read gets decoded */
+static int test_pull(void)
+{
+	struct mux_decoder *dec = NULL;
+	struct output out;
+	uint8_t *stream;
+	size_t len, consumed, before, after;
+	int ret = -1;
+
+	printf("Testing decode follows consumption...\n");
+
+	memset(&out, 0, sizeof(out));
+	stream = malloc(OUT_SIZE);
+	out.audio = malloc(OUT_SIZE);
+	if (!stream || !out.audio)
+		goto out;
+
+	len = encode_stream(MUX_CODEC_ALAW, stream);
+	dec = mux_decoder_new(MUX_CODEC_ALAW, 2, lazy_param, 1);
+	if (!len || !dec ||
+	    mux_decoder_decode(dec, stream, len, &consumed) != MUX_OK)
+		goto out;
+
+	before = mux_decoder_memory_usage(dec);
+	/* Audio up to the first side message, then the message */
+	if (read_some(dec, &out, 1000, 2) != 0 || out.side_len == 0 ||
+	    out.audio_len == 0) {
+		fprintf(stderr, "  FAIL: first read (%zu audio, %zu side)\n",
+			out.audio_len, out.side_len);
+		goto out;
+	}
+	after = mux_decoder_memory_usage(dec);
+
+	if (after > before + 4096) {
+		fprintf(stderr, "  FAIL: %zu -> %zu bytes after one read\n",
+			before, after);
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_decoder_destroy(dec);
+	free(out.audio);
+	free(stream);
+	return ret;
+}
+
+static int test_snapshot(void)
+{
+	struct mux_decoder *lazy = NULL, *copy = NULL;
+	struct output a, b;
+	uint8_t *stream, *blob = NULL;
+	size_t len, half, consumed, blob_len;
+	int ret = -1;
+
+	printf("Testing snapshot of a lazy decoder...\n");
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	stream = malloc(OUT_SIZE);
+	a.audio = malloc(OUT_SIZE);
+	b.audio = malloc(OUT_SIZE);
+	if (!stream || !a.audio || !b.audio)
+		goto out;
+
+	len = encode_stream(MUX_CODEC_MULAW, stream);
+	half = len / 2 + 7;
+	lazy = mux_decoder_new(MUX_CODEC_MULAW, 2, lazy_param, 1);
+	if (!len || !lazy ||
+	    mux_decoder_decode(lazy, stream, half, &consumed) != MUX_OK ||
+	    read_some(lazy, &a, 500, 3) != 0)
+		goto out;
+
+	if (mux_decoder_snapshot(lazy, NULL, 0, &blob_len) != MUX_OK ||
+	    !(blob = malloc(blob_len)) ||
+	    mux_decoder_snapshot(lazy, blob, blob_len, &blob_len) != MUX_OK) {
+		fprintf(stderr, "  FAIL: snapshot\n");
+		goto out;
+	}
+	copy = mux_decoder_new_from_snapshot(blob, blob_len);
+	if (!copy) {
+		fprintf(stderr, "  FAIL: restore\n");
+		goto out;
+	}
+
+	/* Both continue with the second half */
+	b.audio_len = 0;
+	a.audio_len = 0;
+	a.side_len = 0;
+	if (mux_decoder_decode(lazy, stream + half, len - half,
+			       &consumed) != MUX_OK ||
+	    mux_decoder_decode(copy, stream + half, len - half,
+			       &consumed) != MUX_OK ||
+	    mux_decoder_finalize(lazy) != MUX_OK ||
+	    mux_decoder_finalize(copy) != MUX_OK ||
+	    read_some(lazy, &a, 900, -1) != 0 ||
+	    read_some(copy, &b, 900, -1) != 0 || !same_output(&a, &b)) {
+		fprintf(stderr, "  FAIL: output differs after restore\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_decoder_destroy(copy);
+	mux_decoder_destroy(lazy);
+	free(blob);
+	free(b.audio);
+	free(a.audio);
+	free(stream);
+	return ret;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Lazy Decoding Tests\n");
+	printf("===================\n\n");
+
+	if (test_codec(MUX_CODEC_PCM, 0) != 0)
+		failures++;
+	if (test_codec(MUX_CODEC_ALAW, 0) != 0)
+		failures++;
+	if (test_codec(MUX_CODEC_OPUS, 1) != 0)
+		failures++;
+	if (test_codec(MUX_CODEC_VORBIS, 1) != 0)
+		failures++;
+	if (test_pull() != 0)
+		failures++;
+	if (test_snapshot() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
@@ -0,0 +1,302 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test decoder resource limits (max_* decoder parameters)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE     16000
+#define CHANNELS 1
+
+/* Muxed PCM stream with small audio frames and one side packet */
+static size_t build_stream(uint8_t *stream, size_t cap, size_t frame_bytes,
+			   size_t total_bytes, size_t side_bytes)
+{
+	struct mux_encoder *enc;
+	static int16_t pcm[65536];
+	uint8_t side[4096];
+	size_t len = 0, pos, consumed, written;
+	size_t i;
+
+	enc = mux_encoder_new(MUX_CODEC_PCM, RATE, CHANNELS, 2, NULL, 0);
+	if (!enc)
+		return 0;
+
+	for (i = 0; i < total_bytes / 2; i++)
+		pcm[i] = (int16_t)(i * 37);
+	memset(side, 's', sizeof(side));
+
+	for (pos = 0; pos < total_bytes; pos += frame_bytes)
+		mux_encoder_encode(enc, (uint8_t *)pcm + pos, frame_bytes,
+				   &consumed, MUX_STREAM_AUDIO);
+	if (side_bytes)
+		mux_encoder_encode(enc, side, side_bytes, &consumed,
+				   MUX_STREAM_SIDE_CHANNEL);
+	mux_encoder_finalize(enc);
+
+	while (mux_encoder_read(enc, stream + len, cap - len, &written) ==
+	       MUX_OK && written > 0)
+		len += written;
+
+	mux_encoder_destroy(enc);
+	return len;
+}
+
+/*
+ * Feed everything, passing back whatever the decoder didn't take.
+ * Returns the number of audio bytes decoded or -1.
+ */
+static long decode_all(struct mux_decoder *dec, const uint8_t *data,
+		       size_t size, size_t *max_taken)
+{
+	uint8_t out[4096];
+	size_t pos = 0, consumed, written;
+	long audio = 0;
+	int stream_type;
+
+	*max_taken = 0;
+	while (pos < size) {
+		if (mux_decoder_decode(dec, data + pos, size - pos,
+				       &consumed) != MUX_OK)
+			return -1;
+		if (consumed > *max_taken)
+			*max_taken = consumed;
+		pos += consumed;
+
+		do {
+			stream_type = -1;
+			if (mux_decoder_read(dec, out, sizeof(out), &written,
+					     &stream_type) != MUX_OK)
+				return -1;
+			if (stream_type == MUX_STREAM_AUDIO)
+				audio += (long)written;
+		} while (written > 0);
+	}
+
+	return audio;
+}
+
+static int test_huge_header(void)
+{
+	struct mux_decoder *dec;
+	/* Claims a 2^40 byte audio frame */
+	static const uint8_t header[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x40 };
+	const struct mux_error_info *err;
+	size_t consumed;
+	int ret;
+
+	printf("Testing oversized frame header...\n");
+
+	dec = mux_decoder_new(MUX_CODEC_PCM, 2, NULL, 0);
+	if (!dec) {
+		fprintf(stderr, "  FAIL: decoder creation\n");
+		return -1;
+	}
+
+	/* Rejected from the header alone, without waiting for the payload */
+	ret = mux_decoder_decode(dec, header, sizeof(header), &consumed);
+	err = mux_decoder_get_error(dec);
+
+	if (ret != MUX_ERROR_LIMIT || !err || err->code != MUX_ERROR_LIMIT) {
+		fprintf(stderr, "  FAIL: expected MUX_ERROR_LIMIT, got %d\n", ret);
+		mux_decoder_destroy(dec);
+		return -1;
+	}
+	mux_decoder_destroy(dec);
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_frame_size(void)
+{
+	static const struct mux_param small[] = {
+		{ .name = "max_frame_size", .value.i = 1000 },
+	};
+	static uint8_t stream[16384];
+	struct mux_decoder *dec;
+	size_t len, consumed;
+	int ret;
+
+	printf("Testing max_frame_size...\n");
+
+	len = build_stream(stream, sizeof(stream), 4000, 8000, 0);
+	dec = mux_decoder_new(MUX_CODEC_PCM, 2, small, 1);
+	if (!len || !dec) {
+		fprintf(stderr, "  FAIL: setup\n");
+		mux_decoder_destroy(dec);
+		return -1;
+	}
+
+	ret = mux_decoder_decode(dec, stream, len, &consumed);
+	mux_decoder_destroy(dec);
+
+	if (ret != MUX_ERROR_LIMIT) {
+		fprintf(stderr, "  FAIL: 4000 byte frame accepted (%d)\n", ret);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_buffered_input(void)
+{
+	static const struct mux_param params[] = {
+		{ .name = "max_frame_size", .value.i = 64 },
+		{ .name = "max_buffered_input", .value.i = 100 },
+	};
+	static uint8_t stream[16384];
+	struct mux_decoder *dec;
+	size_t len, max_taken;
+	long audio;
+
+	printf("Testing max_buffered_input...\n");
+
+	len = build_stream(stream, sizeof(stream), 32, 6400, 0);
+	dec = mux_decoder_new(MUX_CODEC_PCM, 2, params, 2);
+	if (!len || !dec) {
+		fprintf(stderr, "  FAIL: setup\n");
+		mux_decoder_destroy(dec);
+		return -1;
+	}
+
+	audio = decode_all(dec, stream, len, &max_taken);
+	mux_decoder_destroy(dec);
+
+	if (audio != 6400 || max_taken > 100) {
+		fprintf(stderr, "  FAIL: %ld audio bytes, up to %zu taken per call\n",
+			audio, max_taken);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_decode_input(void)
+{
+	static const struct mux_param params[] = {
+		{ .name = "max_decode_input", .value.i = 10 },
+	};
+	static uint8_t stream[16384];
+	struct mux_decoder *dec;
+	size_t len, max_taken;
+	long audio;
+
+	printf("Testing max_decode_input...\n");
+
+	len = build_stream(stream, sizeof(stream), 640, 6400, 0);
+	dec = mux_decoder_new(MUX_CODEC_PCM, 2, params, 1);
+	if (!len || !dec) {
+		fprintf(stderr, "  FAIL: setup\n");
+		mux_decoder_destroy(dec);
+		return -1;
+	}
+
+	audio = decode_all(dec, stream, len, &max_taken);
+	mux_decoder_destroy(dec);
+
+	if (audio != 6400 || max_taken > 10) {
+		fprintf(stderr, "  FAIL: %ld audio bytes, up to %zu taken per call\n",
+			audio, max_taken);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_invalid_params(void)
+{
+	static const struct mux_param bad[][1] = {
+		{ { .name = "max_frame_size", .value.i = 0 } },
+		{ { .name = "max_buffered_input", .value.i = -1 } },
+		{ { .name = "max_channels", .value.i = 0 } },
+		{ { .name = "max_sample_rate", .value.i = -48000 } },
+		{ { .name = "max_decode_input", .value.i = -5 } },
+	};
+	struct mux_decoder *dec;
+	size_t i;
+
+	printf("Testing invalid limit values...\n");
+
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		dec = mux_decoder_new(MUX_CODEC_PCM, 2, bad[i], 1);
+		if (dec) {
+			fprintf(stderr, "  FAIL: %s = %d accepted\n",
+				bad[i][0].name, bad[i][0].value.i);
+			mux_decoder_destroy(dec);
+			return -1;
+		}
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_side_only(void)
+{
+	static const struct mux_param params[] = {
+		{ .name = "side_only", .value.b = 1 },
+		{ .name = "max_frame_size", .value.i = 256 },
+	};
+	static uint8_t stream[16384];
+	struct mux_decoder *dec;
+	size_t len, consumed;
+	int ret;
+
+	printf("Testing side-only max_frame_size...\n");
+
+	/* Oversized audio frames are skipped unread; the side packet isn't */
+	len = build_stream(stream, sizeof(stream), 4000, 8000, 1000);
+	dec = mux_decoder_new(MUX_CODEC_PCM, 2, params, 2);
+	if (!len || !dec) {
+		fprintf(stderr, "  FAIL: setup\n");
+		mux_decoder_destroy(dec);
+		return -1;
+	}
+
+	ret = mux_decoder_decode(dec, stream, len, &consumed);
+	mux_decoder_destroy(dec);
+
+	if (ret != MUX_ERROR_LIMIT) {
+		fprintf(stderr, "  FAIL: 1000 byte side packet accepted (%d)\n",
+			ret);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Decoder Resource Limit Tests\n");
+	printf("============================\n\n");
+
+	if (test_huge_header() != 0)
+		failures++;
+	if (test_frame_size() != 0)
+		failures++;
+	if (test_buffered_input() != 0)
+		failures++;
+	if (test_decode_input() != 0)
+		failures++;
+	if (test_invalid_params() != 0)
+		failures++;
+	if (test_side_only() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
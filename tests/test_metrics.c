@@ -0,0 +1,314 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test the shared-memory metrics page: counters match what the
+ * sessions did, slots come and go with sessions, and a reader in
+ * another process never sees a half-written update
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHUNK         1920
+#define CHUNKS        200
+#define STRESS_CALLS  200000
+
+static uint64_t latency_sum(const struct mux_metrics_counters *c)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < MUX_METRICS_BUCKETS; i++)
+		sum += c->latency[i];
+	return sum;
+}
+
+static int test_counters(void)
+{
+	struct mux_metrics *m, *r = NULL;
+	struct mux_encoder *enc = NULL;
+	struct mux_decoder *dec = NULL;
+	struct mux_metrics_session s;
+	struct mux_metrics_counters total;
+	static int16_t pcm[CHUNK / 2];
+	static uint8_t out[65536];
+	/* LEB128 header of a 1 GiB audio frame, over max_frame_size */
+	static const uint8_t huge_frame[] = { 0x80, 0x80, 0x80, 0x80, 0x08 };
+	size_t consumed, written, encoded = 0, decoded = 0;
+	uint64_t calls = 0;
+	int i, stream_type, ret = -1;
+
+	printf("Testing session counters...\n");
+
+	m = mux_metrics_create(NULL, 4);
+	if (!m) {
+		printf("  SKIP (memfd not available)\n");
+		return 0;
+	}
+
+	/* Second mapping of the same memfd, as a monitor would see it */
+	r = mux_metrics_open(mux_metrics_fd(m));
+	enc = mux_encoder_new(MUX_CODEC_ALAW, 48000, 1, 2, NULL, 0);
+	dec = mux_decoder_new(MUX_CODEC_ALAW, 2, NULL, 0);
+	if (!r || !enc || !dec ||
+	    mux_encoder_set_metrics(enc, m, "enc-1") != MUX_OK ||
+	    mux_decoder_set_metrics(dec, m, "dec-1") != MUX_OK) {
+		fprintf(stderr, "  FAIL: setup\n");
+		goto out;
+	}
+
+	/* The read-only mapping can't host sessions */
+	if (mux_encoder_set_metrics(enc, r, "x") != MUX_ERROR_INVAL) {
+		fprintf(stderr, "  FAIL: attached to a read-only page\n");
+		goto out;
+	}
+
+	for (i = 0; i < CHUNKS; i++) {
+		memset(pcm, i, sizeof(pcm));
+		if (mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				       MUX_STREAM_AUDIO) != MUX_OK)
+			goto out;
+		calls++;
+		while (mux_encoder_read(enc, out, sizeof(out), &written) ==
+		       MUX_OK) {
+			calls++;
+			if (written == 0)
+				break;
+			encoded += written;
+			if (mux_decoder_decode(dec, out, written,
+					       &consumed) != MUX_OK)
+				goto out;
+		}
+	}
+	while (mux_decoder_read(dec, out, sizeof(out), &written,
+				&stream_type) == MUX_OK && written > 0)
+		decoded += written;
+
+	if (mux_metrics_read(r, 0, &s) != MUX_OK ||
+	    strcmp(s.name, "enc-1") != 0 || s.decoder ||
+	    s.codec_type != MUX_CODEC_ALAW ||
+	    s.counters.calls != calls || s.counters.errors != 0 ||
+	    s.counters.bytes_in != (uint64_t)CHUNKS * sizeof(pcm) ||
+	    s.counters.bytes_out != encoded ||
+	    latency_sum(&s.counters) != calls || s.counters.busy_ns == 0) {
+		fprintf(stderr, "  FAIL: encoder counters\n");
+		goto out;
+	}
+
+	if (mux_metrics_read(r, 1, &s) != MUX_OK ||
+	    strcmp(s.name, "dec-1") != 0 || !s.decoder ||
+	    s.counters.bytes_in != encoded ||
+	    s.counters.bytes_out != decoded || s.counters.buffered != 0) {
+		fprintf(stderr, "  FAIL: decoder counters\n");
+		goto out;
+	}
+
+	/* Errors count; totals survive the session going away */
+	if (mux_decoder_decode(dec, huge_frame, sizeof(huge_frame),
+			       &consumed) == MUX_OK)
+		goto out;
+	mux_decoder_destroy(dec);
+	dec = NULL;
+	if (mux_metrics_read(r, 1, &s) != MUX_ERROR_NOTFOUND ||
+	    mux_metrics_read_total(r, &total) != MUX_OK ||
+	    total.bytes_in != (uint64_t)CHUNKS * sizeof(pcm) + encoded ||
+	    total.bytes_out != encoded + decoded || total.errors != 1) {
+		fprintf(stderr, "  FAIL: totals after detach\n");
+		goto out;
+	}
+
+	printf("  PASS (%llu encoder calls)\n", (unsigned long long)calls);
+	ret = 0;
+
+out:
+	mux_decoder_destroy(dec);
+	mux_encoder_destroy(enc);
+	mux_metrics_close(r);
+	mux_metrics_close(m);
+	return ret;
+}
+
+static int test_slots(void)
+{
+	struct mux_metrics *m, *r;
+	struct mux_decoder *dec[3] = { NULL, NULL, NULL };
+	struct mux_metrics_session s;
+	char path[64];
+	int fd, i, ret = -1;
+
+	printf("Testing slot allocation and named pages...\n");
+
+	snprintf(path, sizeof(path), "/tmp/muxaudio-metrics-%d", (int)getpid());
+	m = mux_metrics_create(path, 2);
+	if (!m) {
+		fprintf(stderr, "  FAIL: create %s\n", path);
+		return -1;
+	}
+
+	for (i = 0; i < 3; i++)
+		dec[i] = mux_decoder_new(MUX_CODEC_PCM, 2, NULL, 0);
+	if (!dec[0] || !dec[1] || !dec[2] ||
+	    mux_decoder_set_metrics(dec[0], m, "a") != MUX_OK ||
+	    mux_decoder_set_metrics(dec[1], m, "b") != MUX_OK ||
+	    mux_decoder_set_metrics(dec[2], m, "c") != MUX_ERROR_LIMIT) {
+		fprintf(stderr, "  FAIL: two slots\n");
+		goto out;
+	}
+
+	/* A detached slot is reused */
+	if (mux_decoder_set_metrics(dec[0], NULL, NULL) != MUX_OK ||
+	    mux_decoder_set_metrics(dec[2], m, "c") != MUX_OK) {
+		fprintf(stderr, "  FAIL: slot reuse\n");
+		goto out;
+	}
+
+	/* An outside reader finds the page by name */
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		r = mux_metrics_open(fd);
+		close(fd);
+		if (r && mux_metrics_read(r, 0, &s) == MUX_OK &&
+		    strcmp(s.name, "c") == 0)
+			ret = 0;
+		mux_metrics_close(r);
+	}
+	if (ret != 0) {
+		fprintf(stderr, "  FAIL: reading %s\n", path);
+		goto out;
+	}
+
+	/* An old page is replaced, any other file is left alone */
+	r = mux_metrics_create(path, 1);
+	ret = r ? 0 : -1;
+	mux_metrics_close(r);
+	unlink(path);
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd >= 0) {
+		if (write(fd, "keep", 4) != 4)
+			ret = -1;
+		close(fd);
+	}
+	r = mux_metrics_create(path, 1);
+	if (ret != 0 || fd < 0 || r || access(path, F_OK) != 0) {
+		fprintf(stderr, "  FAIL: replacing %s\n", path);
+		mux_metrics_close(r);
+		ret = -1;
+		goto out;
+	}
+
+	printf("  PASS\n");
+
+out:
+	for (i = 0; i < 3; i++)
+		mux_decoder_destroy(dec[i]);
+	mux_metrics_close(m);
+	unlink(path);
+	return ret;
+}
+
+/*
+ * A child scrapes the page while the parent updates it: every copy
+ * must have as many latency samples as calls
+ */
+static int test_concurrent_reader(void)
+{
+	struct mux_metrics *m;
+	struct mux_encoder *enc;
+	int16_t pcm[64];
+	size_t consumed;
+	int i, status, pipefd[2];
+	pid_t pid;
+
+	printf("Testing concurrent reader...\n");
+
+	m = mux_metrics_create(NULL, 1);
+	enc = mux_encoder_new(MUX_CODEC_PCM, 8000, 1, 1, NULL, 0);
+	if (!m || !enc || mux_encoder_set_metrics(enc, m, "hot") != MUX_OK ||
+	    pipe(pipefd) != 0) {
+		fprintf(stderr, "  FAIL: setup\n");
+		mux_encoder_destroy(enc);
+		mux_metrics_close(m);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		struct mux_metrics *r = mux_metrics_open(mux_metrics_fd(m));
+		struct mux_metrics_session s;
+		long reads = 0;
+		char c;
+
+		close(pipefd[1]);
+		if (!r)
+			_exit(2);
+		fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+		while (read(pipefd[0], &c, 1) < 0) {
+			if (mux_metrics_read(r, 0, &s) != MUX_OK ||
+			    latency_sum(&s.counters) != s.counters.calls ||
+			    s.counters.bytes_in != s.counters.calls * sizeof(pcm))
+				_exit(1);
+			reads++;
+		}
+		_exit(reads > 0 ? 0 : 3);
+	}
+	close(pipefd[0]);
+
+	memset(pcm, 0, sizeof(pcm));
+	for (i = 0; i < STRESS_CALLS; i++)
+		mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				   MUX_STREAM_AUDIO);
+	/* EOF on the pipe stops the reader */
+	close(pipefd[1]);
+	waitpid(pid, &status, 0);
+
+	mux_encoder_destroy(enc);
+	mux_metrics_close(m);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "  FAIL: reader saw a torn update (%d)\n",
+			WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Shared Memory Metrics Tests\n");
+	printf("===========================\n\n");
+
+	if (test_counters() != 0)
+		failures++;
+	if (test_slots() != 0)
+		failures++;
+	if (test_concurrent_reader() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
+
+#else
+
+int main(void)
+{
+	printf("Shared Memory Metrics Tests\n");
+	printf("  SKIP (Linux only)\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,214 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test reduced-rate / mono monitoring decode
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE    48000
+#define FRAMES  (RATE / 2)  /* 500 ms */
+
+static const struct mux_param monitor_8k_mono[] = {
+	{ .name = "output_rate", .value.i = 8000 },
+	{ .name = "output_channels", .value.i = 1 },
+};
+
+/* Constant over each group of six frames, so an exact 8 kHz mono
+ * reduction of a lossless stream is known */
+static int16_t step_value(int frame)
+{
+	return (int16_t)(((frame / 6) * 97) % 2000 - 1000);
+}
+
+static void drain_decoder(struct mux_decoder *dec, uint8_t *audio,
+			  size_t *total)
+{
+	uint8_t buf[16384];
+	size_t written;
+	int stream_type;
+
+	do {
+		stream_type = -1;
+		mux_decoder_read(dec, buf, sizeof(buf), &written, &stream_type);
+		if (stream_type == MUX_STREAM_AUDIO &&
+		    *total + written <= FRAMES * 4) {
+			memcpy(audio + *total, buf, written);
+			*total += written;
+		}
+	} while (written > 0);
+}
+
+static void pump(struct mux_encoder *enc, struct mux_decoder *dec,
+		 uint8_t *audio, size_t *total)
+{
+	uint8_t buf[16384];
+	size_t written, consumed;
+
+	while (mux_encoder_read(enc, buf, sizeof(buf), &written) == MUX_OK &&
+	       written > 0) {
+		mux_decoder_decode(dec, buf, written, &consumed);
+		drain_decoder(dec, audio, total);
+	}
+}
+
+static uint8_t *roundtrip(enum mux_codec_type codec,
+			  const struct mux_param *params, int num_params,
+			  size_t *audio_size)
+{
+	struct mux_encoder *enc;
+	struct mux_decoder *dec;
+	int16_t pcm[960 * 2];
+	uint8_t *audio;
+	size_t consumed, total = 0;
+	int i, j;
+
+	enc = mux_encoder_new(codec, RATE, 2, 2, NULL, 0);
+	dec = mux_decoder_new(codec, 2, params, num_params);
+	audio = malloc(FRAMES * 4);
+	if (!enc || !dec || !audio) {
+		mux_encoder_destroy(enc);
+		mux_decoder_destroy(dec);
+		free(audio);
+		return NULL;
+	}
+
+	for (i = 0; i < FRAMES; i += 960) {
+		for (j = 0; j < 960; j++) {
+			pcm[j * 2] = step_value(i + j);
+			pcm[j * 2 + 1] = step_value(i + j);
+		}
+		mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				   MUX_STREAM_AUDIO);
+		pump(enc, dec, audio, &total);
+	}
+
+	mux_encoder_finalize(enc);
+	pump(enc, dec, audio, &total);
+	mux_decoder_finalize(dec);
+	drain_decoder(dec, audio, &total);
+
+	mux_decoder_destroy(dec);
+	mux_encoder_destroy(enc);
+	*audio_size = total;
+	return audio;
+}
+
+static int test_flac_exact(void)
+{
+	const int16_t *out;
+	uint8_t *audio;
+	size_t size, i;
+
+	printf("Testing FLAC 8 kHz mono reduction...\n");
+
+	audio = roundtrip(MUX_CODEC_FLAC, monitor_8k_mono, 2, &size);
+	if (!audio) {
+		printf("  SKIP (codec not available)\n");
+		return 0;
+	}
+
+	out = (const int16_t *)audio;
+	if (size != FRAMES / 6 * sizeof(int16_t)) {
+		fprintf(stderr, "  FAIL: %zu bytes, expected %zu\n",
+			size, FRAMES / 6 * sizeof(int16_t));
+		free(audio);
+		return -1;
+	}
+
+	for (i = 0; i < size / 2; i++) {
+		if (out[i] != step_value((int)i * 6)) {
+			fprintf(stderr, "  FAIL: sample %zu is %d, expected %d\n",
+				i, out[i], step_value((int)i * 6));
+			free(audio);
+			return -1;
+		}
+	}
+
+	free(audio);
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_opus_native(void)
+{
+	const struct mux_param params[] = {
+		{ .name = "output_rate", .value.i = 16000 },
+		{ .name = "output_channels", .value.i = 1 },
+	};
+	size_t size, expected = FRAMES / 3 * sizeof(int16_t);
+	uint8_t *audio;
+
+	printf("Testing Opus 16 kHz mono decode...\n");
+
+	audio = roundtrip(MUX_CODEC_OPUS, params, 2, &size);
+	if (!audio) {
+		printf("  SKIP (codec not available)\n");
+		return 0;
+	}
+	free(audio);
+
+	if (size < expected - expected / 10 || size > expected + expected / 10) {
+		fprintf(stderr, "  FAIL: %zu bytes, expected ~%zu\n",
+			size, expected);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_invalid(void)
+{
+	const struct mux_param params[] = {
+		{ .name = "output_channels", .value.i = 2 },
+	};
+	struct mux_decoder *dec;
+	int i;
+
+	printf("Testing invalid monitoring parameters...\n");
+
+	for (i = 0; i < MUX_CODEC_MAX; i++) {
+		const struct mux_param_desc *desc;
+		int count;
+
+		if (mux_get_decoder_params(i, &desc, &count) != MUX_OK ||
+		    count == 0 || strcmp(desc[0].name, "output_rate") != 0)
+			continue;
+
+		dec = mux_decoder_new(i, 2, params, 1);
+		if (dec) {
+			fprintf(stderr, "  FAIL: %s accepted output_channels=2\n",
+				mux_codec_to_name(i));
+			mux_decoder_destroy(dec);
+			return -1;
+		}
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Monitoring Decode Tests\n");
+	printf("=======================\n\n");
+
+	if (test_flac_exact() != 0)
+		failures++;
+	if (test_opus_native() != 0)
+		failures++;
+	if (test_invalid() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
@@ -0,0 +1,544 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test the in-tree MP3 decoder on frames written here: one MDCT line
+ * per granule comes out as a tone at its frequency, joint stereo puts
+ * it in the right channels, the bit reservoir doesn't change the
+ * output, and junk, ID3 tags and partial frames are stepped over
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE        48000
+#define FRAME_BYTES 384         /* 128 kbps */
+#define FRAMES      12
+#define LINE        40
+#define MAX_STREAM  (FRAMES * FRAME_BYTES + 256)
+#define MAX_PCM     (FRAMES * MUX_MP3DEC_MAX_SAMPLES * 2)
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+struct frame_spec {
+	int mode;               /* 0 stereo, 1 joint, 3 mono */
+	int mode_ext;
+	int line[2];            /* the one nonzero line per channel, or -1 */
+	int gain;
+};
+
+struct bit_writer {
+	uint8_t *p;
+	size_t pos;
+};
+
+static uint8_t stream[MAX_STREAM];
+static int16_t pcm_a[MAX_PCM], pcm_b[MAX_PCM];
+
+static void put(struct bit_writer *w, unsigned int v, int n)
+{
+	while (n--) {
+		if ((v >> n) & 1)
+			w->p[w->pos >> 3] |= (uint8_t)(0x80 >> (w->pos & 7));
+		w->pos++;
+	}
+}
+
+/* Count1 quadruples (table B) up to the one holding line, all +1 */
+static int put_granule(struct bit_writer *w, int line)
+{
+	size_t start = w->pos;
+	int q;
+
+	for (q = 0; line >= 0 && q <= line / 4; q++) {
+		if (q == line / 4) {
+			put(w, 15 - (8u >> (line % 4)), 4);
+			put(w, 0, 1);
+		} else {
+			put(w, 15, 4);
+		}
+	}
+	return (int)(w->pos - start);
+}
+
+static int channels_of(const struct frame_spec *s)
+{
+	return s->mode == 3 ? 1 : 2;
+}
+
+/* Main data of one frame; returns its length in bytes */
+static size_t put_main(const struct frame_spec *s, uint8_t *out,
+		       int len[2][2])
+{
+	struct bit_writer w = { out, 0 };
+	int gr, ch;
+
+	for (gr = 0; gr < 2; gr++)
+		for (ch = 0; ch < channels_of(s); ch++)
+			len[gr][ch] = put_granule(&w, s->line[ch]);
+	return (w.pos + 7) / 8;
+}
+
+static void put_header_side(const struct frame_spec *s, uint8_t *out,
+			    int main_data_begin, int len[2][2])
+{
+	struct bit_writer w = { out, 0 };
+	int nch = channels_of(s), gr, ch;
+
+	/* MPEG-1 Layer III, no CRC, 128 kbps, 48 kHz */
+	put(&w, 0xfffb, 16);
+	put(&w, 0x94, 8);
+	put(&w, (unsigned int)(s->mode << 6 | s->mode_ext << 4), 8);
+
+	put(&w, (unsigned int)main_data_begin, 9);
+	put(&w, 0, nch == 1 ? 5 : 3);
+	put(&w, 0, 4 * nch);                    /* scfsi */
+	for (gr = 0; gr < 2; gr++) {
+		for (ch = 0; ch < nch; ch++) {
+			put(&w, (unsigned int)len[gr][ch], 12);
+			put(&w, 0, 9);                  /* big_values */
+			put(&w, (unsigned int)s->gain, 8);
+			put(&w, 0, 4);                  /* no scalefactor bits */
+			put(&w, 0, 1);                  /* long blocks */
+			put(&w, 0, 15 + 4 + 3);         /* tables, regions */
+			put(&w, 0, 2);                  /* preflag, scale */
+			put(&w, 1, 1);                  /* count1 table B */
+		}
+	}
+}
+
+/*
+ * A stream of identical frames. With reservoir set, each frame's main
+ * data goes at the end of the frame before it.
+ */
+static size_t build_stream(const struct frame_spec *s, int frames,
+			   int reservoir, uint8_t *out)
+{
+	int len[2][2], f, side = channels_of(s) == 1 ? 17 : 32;
+	uint8_t main_data[FRAME_BYTES];
+	size_t n, room = FRAME_BYTES - 4 - (size_t)side;
+	uint8_t *frame;
+
+	memset(main_data, 0, sizeof(main_data));
+	n = put_main(s, main_data, len);
+	memset(out, 0, (size_t)frames * FRAME_BYTES);
+
+	for (f = 0; f < frames; f++) {
+		frame = out + (size_t)f * FRAME_BYTES;
+		put_header_side(s, frame, reservoir && f > 0 ? (int)n : 0, len);
+		if (!reservoir || f == 0)
+			memcpy(frame + 4 + side, main_data, n);
+		if (reservoir && f + 1 < frames)
+			memcpy(frame + 4 + side + room - n, main_data, n);
+	}
+	return (size_t)frames * FRAME_BYTES;
+}
+
+/* Decode everything in pieces of chunk bytes; returns sample frames */
+static long decode(int flags, const uint8_t *in, size_t len, size_t chunk,
+		   int16_t *pcm, int *channels)
+{
+	static uint8_t buf[MAX_STREAM];
+	static int16_t frame[MUX_MP3DEC_MAX_SAMPLES * 2];
+	struct mux_mp3_frame_info info;
+	struct mux_mp3dec *d = mux_mp3dec_new(flags);
+	size_t have = 0, fed = 0, consumed, n;
+	long total = 0;
+
+	if (!d)
+		return -1;
+
+	for (;;) {
+		if (fed < len) {
+			n = len - fed < chunk ? len - fed : chunk;
+			memcpy(buf + have, in + fed, n);
+			have += n;
+			fed += n;
+		}
+		if (mux_mp3dec_decode_frame(d, buf, have, frame, &consumed,
+					    &info) != MUX_OK) {
+			total = -1;
+			break;
+		}
+		memmove(buf, buf + consumed, have - consumed);
+		have -= consumed;
+		if (info.frame_bytes) {
+			n = (size_t)info.samples * (size_t)info.channels;
+			memcpy(pcm + total * info.channels, frame,
+			       n * sizeof(int16_t));
+			total += info.samples;
+			*channels = info.channels;
+		} else if (fed == len && consumed == 0) {
+			break;
+		}
+	}
+
+	mux_mp3dec_destroy(d);
+	return total;
+}
+
+/* Goertzel power of one channel at freq */
+static double power_at(const int16_t *pcm, int stride, long n, double freq)
+{
+	double c = 2 * cos(2 * M_PI * freq / RATE), s1 = 0, s2 = 0, s;
+	long i;
+
+	for (i = 0; i < n; i++) {
+		s = pcm[i * stride] + c * s1 - s2;
+		s2 = s1;
+		s1 = s;
+	}
+	return (s1 * s1 + s2 * s2 - c * s1 * s2) / ((double)n * n);
+}
+
+/* Tone at the line's frequency well above two other frequencies */
+static int is_tone(const int16_t *pcm, int stride, long n, int line)
+{
+	double f = (line + 0.5) * RATE / 1152.0;
+	double p = power_at(pcm, stride, n, f);
+
+	return p > 1000 && p > 100 * power_at(pcm, stride, n, f * 0.5) &&
+	       p > 100 * power_at(pcm, stride, n, f + 3000);
+}
+
+/* RMS of one channel */
+static double rms(const int16_t *pcm, int stride, long n)
+{
+	double sum = 0;
+	long i;
+
+	for (i = 0; i < n; i++)
+		sum += (double)pcm[i * stride] * pcm[i * stride];
+	return sqrt(sum / (double)n);
+}
+
+static int is_silent(const int16_t *pcm, int stride, long n)
+{
+	long i;
+
+	for (i = 0; i < n; i++)
+		if (pcm[i * stride] != 0)
+			return 0;
+	return 1;
+}
+
+static int test_silence(void)
+{
+	struct frame_spec s = { 3, 0, { -1, -1 }, 150 };
+	size_t len;
+	long n;
+	int ch;
+
+	printf("Testing silent frames...\n");
+
+	len = build_stream(&s, FRAMES, 0, stream);
+	n = decode(0, stream, len, len, pcm_a, &ch);
+	if (n != FRAMES * 1152 || ch != 1 || !is_silent(pcm_a, 1, n)) {
+		fprintf(stderr, "  FAIL: %ld samples\n", n);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_tone(void)
+{
+	/* Global gain 206 scales each line to 0.5 */
+	struct frame_spec s = { 3, 0, { LINE, -1 }, 206 };
+	size_t len;
+	long n, i, diff = 0;
+	double level;
+	int ch;
+
+	printf("Testing a single-line tone...\n");
+
+	len = build_stream(&s, FRAMES, 0, stream);
+	n = decode(MUX_MP3DEC_SCALAR, stream, len, len, pcm_a, &ch);
+	if (n != FRAMES * 1152 || !is_tone(pcm_a + 1152, 1, n - 1152, LINE)) {
+		fprintf(stderr, "  FAIL: no tone at line %d\n", LINE);
+		return -1;
+	}
+
+	/* Past the first frame's overlap, a half scale sine */
+	level = rms(pcm_a + 2304, 1, n - 2304);
+	if (fabs(level - 16384 / sqrt(2)) > 100) {
+		fprintf(stderr, "  FAIL: RMS %.0f\n", level);
+		return -1;
+	}
+
+	/* The SIMD kernels only reorder float sums */
+	if (decode(0, stream, len, len, pcm_b, &ch) != n) {
+		fprintf(stderr, "  FAIL: SIMD decode\n");
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		if (abs(pcm_a[i] - pcm_b[i]) > diff)
+			diff = abs(pcm_a[i] - pcm_b[i]);
+	if (diff > 1) {
+		fprintf(stderr, "  FAIL: SIMD differs by %ld\n", diff);
+		return -1;
+	}
+
+	printf("  PASS (%s)\n", mux_mp3dec_simd() ? "SIMD" : "scalar only");
+	return 0;
+}
+
+static int test_joint_stereo(void)
+{
+	struct frame_spec ms = { 1, 2, { LINE, -1 }, 206 };
+	struct frame_spec is = { 1, 1, { LINE, -1 }, 206 };
+	size_t len;
+	long n, i;
+	int ch;
+
+	printf("Testing joint stereo...\n");
+
+	/* Side silent: both channels the same */
+	len = build_stream(&ms, FRAMES, 0, stream);
+	n = decode(0, stream, len, len, pcm_a, &ch);
+	if (n != FRAMES * 1152 || ch != 2 || is_silent(pcm_a, 2, n)) {
+		fprintf(stderr, "  FAIL: M/S decode\n");
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		if (pcm_a[2 * i] != pcm_a[2 * i + 1])
+			break;
+	if (i < n) {
+		fprintf(stderr, "  FAIL: M/S channels differ at %ld\n", i);
+		return -1;
+	}
+
+	/* Mixed down to mono, that is the same signal again */
+	if (decode(MUX_MP3DEC_MONO, stream, len, len, pcm_b, &ch) != n ||
+	    ch != 1) {
+		fprintf(stderr, "  FAIL: mono mixdown\n");
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		if (abs(pcm_b[i] - pcm_a[2 * i]) > 1)
+			break;
+	if (i < n) {
+		fprintf(stderr, "  FAIL: mixdown differs at %ld\n", i);
+		return -1;
+	}
+
+	/* Intensity position 0 puts everything on the right; skip the
+	 * first frame for the tone check */
+	len = build_stream(&is, FRAMES, 0, stream);
+	n = decode(0, stream, len, len, pcm_a, &ch);
+	if (n != FRAMES * 1152 || !is_silent(pcm_a, 2, n) ||
+	    !is_tone(pcm_a + 1152 * 2 + 1, 2, n - 1152, LINE)) {
+		fprintf(stderr, "  FAIL: intensity stereo\n");
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_reservoir(void)
+{
+	static uint8_t plain[MAX_STREAM];
+	struct frame_spec s = { 0, 0, { LINE, LINE + 100 }, 206 };
+	size_t len;
+	long n;
+	int ch;
+
+	printf("Testing the bit reservoir...\n");
+
+	len = build_stream(&s, FRAMES, 0, plain);
+	n = decode(0, plain, len, len, pcm_a, &ch);
+	build_stream(&s, FRAMES, 1, stream);
+	if (n != FRAMES * 1152 ||
+	    decode(0, stream, len, len, pcm_b, &ch) != n ||
+	    memcmp(pcm_a, pcm_b, (size_t)n * 2 * sizeof(int16_t)) != 0) {
+		fprintf(stderr, "  FAIL: output differs\n");
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_resync(void)
+{
+	static uint8_t dirty[MAX_STREAM];
+	static const uint8_t id3[10] = { 'I', 'D', '3', 4, 0, 0, 0, 0, 0, 40 };
+	struct frame_spec s = { 3, 0, { LINE, -1 }, 206 };
+	struct mux_mp3_frame_info info;
+	struct mux_mp3dec *d;
+	size_t len, n = 0, consumed;
+	long samples;
+	int i, ch;
+
+	printf("Testing junk, tags and partial frames...\n");
+
+	len = build_stream(&s, FRAMES, 0, stream);
+	if (decode(0, stream, len, len, pcm_a, &ch) != FRAMES * 1152)
+		return -1;
+
+	/* A tag full of false syncs, then junk */
+	memcpy(dirty, id3, sizeof(id3));
+	memset(dirty + 10, 0xff, 40);
+	n = 50;
+	for (i = 0; i < 77; i++)
+		dirty[n++] = (uint8_t)(i * 37 % 128);
+	memcpy(dirty + n, stream, len);
+	n += len;
+
+	samples = decode(0, dirty, n, 100, pcm_b, &ch);
+	if (samples != FRAMES * 1152 ||
+	    memcmp(pcm_a, pcm_b, (size_t)samples * sizeof(int16_t)) != 0) {
+		fprintf(stderr, "  FAIL: %ld samples after junk\n", samples);
+		return -1;
+	}
+
+	/* Half a frame: nothing decoded, the header isn't dropped */
+	d = mux_mp3dec_new(0);
+	if (!d ||
+	    mux_mp3dec_decode_frame(d, stream, FRAME_BYTES / 2, pcm_b,
+				    &consumed, &info) != MUX_OK ||
+	    info.frame_bytes != 0 || consumed != 0) {
+		mux_mp3dec_destroy(d);
+		fprintf(stderr, "  FAIL: partial frame\n");
+		return -1;
+	}
+	mux_mp3dec_destroy(d);
+
+	printf("  PASS\n");
+	return 0;
+}
+
+/* LEB128 frame: length << 1 | stream type, then the payload */
+static size_t put_leb128(uint8_t *out, const void *data, size_t size,
+			 int type)
+{
+	uint64_t v = (uint64_t)size << 1 | (uint64_t)type;
+	size_t n = 0;
+
+	do {
+		out[n++] = (uint8_t)((v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+		v >>= 7;
+	} while (v);
+	memcpy(out + n, data, size);
+	return n + size;
+}
+
+/* Everything a decoder gives back; side data must be "marker" */
+static long codec_decode(int num_streams, const struct mux_param *params,
+			 int num_params, const uint8_t *in, size_t len,
+			 uint8_t *out, size_t cap, int *side)
+{
+	struct mux_decoder *dec;
+	size_t pos, n, consumed, written, total = 0;
+	int type, ret = MUX_OK;
+
+	*side = 0;
+	dec = mux_decoder_new(MUX_CODEC_MP3, num_streams, params, num_params);
+	if (!dec)
+		return -1;
+
+	/* Odd pieces to split frames and LEB128 headers */
+	for (pos = 0; pos < len && ret == MUX_OK; pos += n) {
+		n = len - pos < 999 ? len - pos : 999;
+		ret = mux_decoder_decode(dec, in + pos, n, &consumed);
+	}
+	if (ret == MUX_OK)
+		ret = mux_decoder_finalize(dec);
+	while (ret == MUX_OK &&
+	       mux_decoder_read(dec, out + total, cap - total, &written,
+				&type) == MUX_OK && written > 0) {
+		if (type == MUX_STREAM_SIDE_CHANNEL)
+			*side = written == 6 &&
+				memcmp(out + total, "marker", 6) == 0;
+		else
+			total += written;
+	}
+
+	mux_decoder_destroy(dec);
+	return ret == MUX_OK ? (long)total : -2;
+}
+
+/* The codec decodes raw and LEB128 framed streams the same way */
+static int test_codec(void)
+{
+	static uint8_t out[MAX_PCM * 2], framed[MAX_STREAM + 64];
+	struct mux_param mono = { .name = "output_channels", .value.i = 1 };
+	struct frame_spec s = { 1, 2, { LINE, LINE + 8 }, 206 };
+	size_t len, flen = 0, f;
+	long n, total;
+	int ch, side;
+
+	printf("Testing MP3 codec decode...\n");
+
+	len = build_stream(&s, FRAMES, 0, stream);
+	n = decode(0, stream, len, 1000, pcm_a, &ch);
+
+	total = codec_decode(1, NULL, 0, stream, len, out, sizeof(out), &side);
+	if (total == -1) {
+		printf("  SKIP (MP3 decoding not available)\n");
+		return 0;
+	}
+
+	/* libmpg123 may be the backend; then only check the length */
+	if (total != n * 2 * (long)sizeof(int16_t)) {
+		fprintf(stderr, "  FAIL: %ld bytes\n", total);
+		return -1;
+	}
+	if (memcmp(out, pcm_a, (size_t)total) != 0) {
+		printf("  PASS (other backend)\n");
+		return 0;
+	}
+
+	/* Two frames per payload and a side message; mono output */
+	for (f = 0; f < FRAMES; f += 2) {
+		flen += put_leb128(framed + flen, stream + f * FRAME_BYTES,
+				   2 * FRAME_BYTES, MUX_STREAM_AUDIO);
+		if (f == 4)
+			flen += put_leb128(framed + flen, "marker", 6,
+					   MUX_STREAM_SIDE_CHANNEL);
+	}
+	n = decode(MUX_MP3DEC_MONO, stream, len, len, pcm_b, &ch);
+	total = codec_decode(2, &mono, 1, framed, flen, out, sizeof(out),
+			     &side);
+	if (total != n * (long)sizeof(int16_t) ||
+	    memcmp(out, pcm_b, (size_t)total) != 0 || !side) {
+		fprintf(stderr, "  FAIL: LEB128 mono decode\n");
+		return -1;
+	}
+
+	printf("  PASS (in-tree decoder)\n");
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("MP3 Decoder Tests\n");
+	printf("=================\n\n");
+
+	if (test_silence() != 0)
+		failures++;
+	if (test_tone() != 0)
+		failures++;
+	if (test_joint_stereo() != 0)
+		failures++;
+	if (test_reservoir() != 0)
+		failures++;
+	if (test_resync() != 0)
+		failures++;
+	if (test_codec() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
@@ -0,0 +1,240 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test waveform overview generation against a brute-force reduction
+ * of the fully decoded audio
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE    8000
+#define FRAMES  10037  /* not a whole number of buckets */
+#define BUCKET  160
+
+static int16_t pcm[FRAMES * 3];
+static uint8_t stream[FRAMES * 8];
+static int16_t decoded[FRAMES * 3];
+static struct mux_peak expect[(FRAMES / BUCKET + 1) * 3];
+static struct mux_peak got[(FRAMES / BUCKET + 1) * 3];
+
+static void fill(int channels)
+{
+	uint32_t seed = 12345;
+	int i, c;
+
+	for (i = 0; i < FRAMES; i++) {
+		for (c = 0; c < channels; c++) {
+			seed = seed * 1103515245u + 12345u;
+			/* Loud bursts so buckets differ, full scale included */
+			pcm[i * channels + c] = (int16_t)((int32_t)(seed >> 16) -
+							  32768) /
+						((i / 700) % 3 + 1 + c);
+		}
+	}
+	pcm[0] = -32768;
+	pcm[1] = 32767;
+}
+
+static size_t encode(enum mux_codec_type codec, int channels)
+{
+	struct mux_encoder *enc;
+	size_t len = 0, pos, n, consumed, written;
+
+	enc = mux_encoder_new(codec, RATE, channels, 2, NULL, 0);
+	if (!enc)
+		return 0;
+
+	/* Odd chunk sizes so frames and buckets straddle payloads */
+	for (pos = 0; pos < (size_t)FRAMES * channels; pos += n) {
+		n = (size_t)FRAMES * channels - pos < 333 ?
+		    (size_t)FRAMES * channels - pos : 333;
+		n -= n % channels;
+		mux_encoder_encode(enc, pcm + pos, n * sizeof(int16_t),
+				   &consumed, MUX_STREAM_AUDIO);
+		if (pos == 0)
+			mux_encoder_encode(enc, "meta", 4, &consumed,
+					   MUX_STREAM_SIDE_CHANNEL);
+	}
+	mux_encoder_finalize(enc);
+
+	while (mux_encoder_read(enc, stream + len, sizeof(stream) - len,
+				&written) == MUX_OK && written > 0)
+		len += written;
+
+	mux_encoder_destroy(enc);
+	return len;
+}
+
+/* Reference: full decode, then min/max/RMS per bucket */
+static size_t reference(enum mux_codec_type codec, int channels, size_t len)
+{
+	struct mux_decoder *dec;
+	size_t consumed, written, got_bytes = 0, nb = 0, start, i;
+	int stream_type, c;
+
+	dec = mux_decoder_new(codec, 2, NULL, 0);
+	if (!dec)
+		return 0;
+	mux_decoder_decode(dec, stream, len, &consumed);
+	mux_decoder_finalize(dec);
+	do {
+		stream_type = -1;
+		mux_decoder_read(dec, (uint8_t *)decoded + got_bytes,
+				 sizeof(decoded) - got_bytes, &written,
+				 &stream_type);
+		if (stream_type == MUX_STREAM_AUDIO)
+			got_bytes += written;
+	} while (written > 0);
+	mux_decoder_destroy(dec);
+
+	for (start = 0; start < FRAMES; start += BUCKET, nb++) {
+		size_t end = start + BUCKET < FRAMES ? start + BUCKET : FRAMES;
+
+		for (c = 0; c < channels; c++) {
+			struct mux_peak *p = &expect[nb * channels + c];
+			uint64_t sumsq = 0;
+
+			p->min = INT16_MAX;
+			p->max = INT16_MIN;
+			for (i = start; i < end; i++) {
+				int32_t v = decoded[i * channels + c];
+
+				if (v < p->min)
+					p->min = (int16_t)v;
+				if (v > p->max)
+					p->max = (int16_t)v;
+				sumsq += (uint64_t)(v * v);
+			}
+			p->rms = (uint16_t)sqrt((double)(sumsq / (end - start)));
+		}
+	}
+
+	return nb;
+}
+
+static size_t overview(enum mux_codec_type codec, int channels, size_t len,
+		       size_t step)
+{
+	struct mux_overview *ov;
+	size_t pos, n, consumed, nb = 0, r;
+
+	ov = mux_overview_new(codec, 2, channels, BUCKET, NULL, 0);
+	if (!ov)
+		return 0;
+
+	for (pos = 0; pos < len; pos += consumed) {
+		n = len - pos < step ? len - pos : step;
+		if (mux_overview_feed(ov, stream + pos, n, &consumed) != MUX_OK)
+			goto fail;
+		while (mux_overview_read(ov, got + nb * channels, 7, &r) ==
+		       MUX_OK && r > 0)
+			nb += r;
+	}
+	if (mux_overview_finalize(ov) != MUX_OK ||
+	    mux_overview_channels(ov) != channels)
+		goto fail;
+	while (mux_overview_read(ov, got + nb * channels, 7, &r) == MUX_OK &&
+	       r > 0)
+		nb += r;
+
+	mux_overview_destroy(ov);
+	return nb;
+
+fail:
+	mux_overview_destroy(ov);
+	return 0;
+}
+
+static int test_codec(enum mux_codec_type codec, int channels)
+{
+	static const size_t steps[] = { 1, 97, sizeof(stream) };
+	size_t len, nb, i, j;
+
+	printf("Testing %s overview, %d channel(s)...\n",
+	       mux_codec_to_name(codec), channels);
+
+	fill(channels);
+	len = encode(codec, channels);
+	nb = len ? reference(codec, channels, len) : 0;
+	if (nb != FRAMES / BUCKET + 1) {
+		fprintf(stderr, "  FAIL: reference decode\n");
+		return -1;
+	}
+
+	for (i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+		memset(got, 0, sizeof(got));
+		if (overview(codec, channels, len, steps[i]) != nb) {
+			fprintf(stderr, "  FAIL: bucket count (step %zu)\n",
+				steps[i]);
+			return -1;
+		}
+		for (j = 0; j < nb * channels; j++) {
+			if (got[j].min != expect[j].min ||
+			    got[j].max != expect[j].max ||
+			    got[j].rms != expect[j].rms) {
+				fprintf(stderr, "  FAIL: bucket %zu ch %zu: "
+					"%d/%d/%u, expected %d/%d/%u\n",
+					j / channels, j % channels,
+					got[j].min, got[j].max, got[j].rms,
+					expect[j].min, expect[j].max,
+					expect[j].rms);
+				return -1;
+			}
+		}
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_invalid(void)
+{
+	struct mux_overview *ov;
+
+	printf("Testing invalid overview arguments...\n");
+
+	ov = mux_overview_new(MUX_CODEC_PCM, 2, 1, 0, NULL, 0);
+	if (!ov)
+		ov = mux_overview_new(MUX_CODEC_PCM, 2, 0, BUCKET, NULL, 0);
+	if (!ov)
+		ov = mux_overview_new(MUX_CODEC_ALAW, 3, 1, BUCKET, NULL, 0);
+	if (ov) {
+		fprintf(stderr, "  FAIL: invalid arguments accepted\n");
+		mux_overview_destroy(ov);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Waveform Overview Tests\n");
+	printf("=======================\n\n");
+
+	if (test_codec(MUX_CODEC_PCM, 1) != 0)
+		failures++;
+	if (test_codec(MUX_CODEC_PCM, 2) != 0)
+		failures++;
+	if (test_codec(MUX_CODEC_PCM, 3) != 0)
+		failures++;
+	if (test_codec(MUX_CODEC_ALAW, 2) != 0)
+		failures++;
+	if (test_codec(MUX_CODEC_MULAW, 1) != 0)
+		failures++;
+	if (test_invalid() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
@@ -0,0 +1,536 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test clip packs: index lookups, metadata round trip, payload alignment,
+ * shared header deduplication, decoding straight from the pack and
+ * decoders restored from a primed header
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE      8000
+#define CHANNELS  1
+#define NUM_CLIPS 24
+#define MAX_CLIP  (1 << 16)
+#define PACK_PATH "test_pack.muxpack"
+
+struct source {
+	struct mux_clip clip;
+	uint8_t *stream;
+};
+
+static size_t encode_clip(enum mux_codec_type codec, int num_streams,
+			  int seed, int frames, uint8_t *out, size_t size)
+{
+	struct mux_encoder *enc;
+	int16_t pcm[160];
+	size_t total = 0, consumed, written;
+	int i, n;
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, num_streams, NULL, 0);
+	if (!enc)
+		return 0;
+
+	for (n = 0; n < frames; n += 160) {
+		for (i = 0; i < 160; i++)
+			pcm[i] = (int16_t)(((seed * 131 + n + i) * 53) % 30000 -
+					   15000);
+		if (mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				       MUX_STREAM_AUDIO) != MUX_OK)
+			goto fail;
+	}
+	if (num_streams == 2 &&
+	    mux_encoder_encode(enc, "tag", 3, &consumed,
+			       MUX_STREAM_SIDE_CHANNEL) != MUX_OK)
+		goto fail;
+	if (mux_encoder_finalize(enc) != MUX_OK)
+		goto fail;
+
+	while (total < size &&
+	       mux_encoder_read(enc, out + total, size - total,
+				&written) == MUX_OK && written > 0)
+		total += written;
+
+	mux_encoder_destroy(enc);
+	return total;
+
+fail:
+	mux_encoder_destroy(enc);
+	return 0;
+}
+
+static size_t decode_all(struct mux_decoder *dec, const uint8_t *data,
+			 size_t len, uint8_t *out, size_t size)
+{
+	size_t total = 0, consumed, written;
+	int stream_type;
+
+	if (len > 0 && mux_decoder_decode(dec, data, len, &consumed) != MUX_OK)
+		return 0;
+	if (mux_decoder_finalize(dec) != MUX_OK)
+		return 0;
+
+	do {
+		stream_type = -1;
+		if (mux_decoder_read(dec, out + total, size - total, &written,
+				     &stream_type) != MUX_OK)
+			return 0;
+		total += written;
+	} while (written > 0 && total < size);
+
+	return total;
+}
+
+/* Does the pack hand back header + data == the original stream? */
+static int same_stream(const struct mux_clip *c, const struct source *s)
+{
+	return c->header_size + c->size == s->clip.size &&
+	       (c->header_size == 0 ||
+		memcmp(c->header, s->stream, c->header_size) == 0) &&
+	       memcmp(c->data, s->stream + c->header_size, c->size) == 0;
+}
+
+static int test_roundtrip(void)
+{
+	static const enum mux_codec_type codecs[] = {
+		MUX_CODEC_PCM, MUX_CODEC_ALAW, MUX_CODEC_MULAW
+	};
+	struct source src[NUM_CLIPS];
+	struct mux_pack_writer *w;
+	struct mux_pack *pack = NULL;
+	struct mux_decoder *dec;
+	struct mux_clip c;
+	uint8_t *out_a = NULL, *out_b = NULL;
+	size_t len_a, len_b, i;
+	uint64_t prev = 0;
+	int ret = -1;
+
+	printf("Testing pack round trip...\n");
+
+	memset(src, 0, sizeof(src));
+	for (i = 0; i < NUM_CLIPS; i++) {
+		struct mux_clip *clip = &src[i].clip;
+
+		src[i].stream = malloc(MAX_CLIP);
+		if (!src[i].stream)
+			goto out;
+
+		/* Ids added out of order and spread out */
+		clip->id = (uint64_t)((i * 7919) % NUM_CLIPS) * 1000003u + 17;
+		clip->codec_type = codecs[i % 3];
+		clip->num_streams = 1 + (int)(i & 1);
+		clip->sample_rate = RATE;
+		clip->num_channels = CHANNELS;
+		clip->duration = 160 * (i + 1);
+		clip->data = src[i].stream;
+		clip->size = encode_clip(clip->codec_type, clip->num_streams,
+					 (int)i, 160 * ((int)i + 1),
+					 src[i].stream, MAX_CLIP);
+		if (clip->size == 0) {
+			fprintf(stderr, "  FAIL: encoding clip %zu\n", i);
+			goto out;
+		}
+	}
+
+	w = mux_pack_writer_new(PACK_PATH);
+	if (!w) {
+		fprintf(stderr, "  FAIL: mux_pack_writer_new\n");
+		goto out;
+	}
+	for (i = 0; i < NUM_CLIPS; i++) {
+		if (mux_pack_writer_add(w, &src[i].clip) != MUX_OK) {
+			fprintf(stderr, "  FAIL: mux_pack_writer_add\n");
+			mux_pack_writer_destroy(w);
+			goto out;
+		}
+	}
+	if (mux_pack_writer_finish(w) != MUX_OK) {
+		fprintf(stderr, "  FAIL: mux_pack_writer_finish\n");
+		mux_pack_writer_destroy(w);
+		goto out;
+	}
+	mux_pack_writer_destroy(w);
+
+	pack = mux_pack_open(PACK_PATH);
+	if (!pack || mux_pack_count(pack) != NUM_CLIPS) {
+		fprintf(stderr, "  FAIL: mux_pack_open\n");
+		goto out;
+	}
+
+	/* Iteration is in id order */
+	for (i = 0; i < NUM_CLIPS; i++) {
+		if (mux_pack_get(pack, i, &c) != MUX_OK ||
+		    (i > 0 && c.id <= prev)) {
+			fprintf(stderr, "  FAIL: index order at %zu\n", i);
+			goto out;
+		}
+		prev = c.id;
+	}
+	if (mux_pack_get(pack, NUM_CLIPS, &c) != MUX_ERROR_NOTFOUND) {
+		fprintf(stderr, "  FAIL: get past the end\n");
+		goto out;
+	}
+
+	out_a = malloc(MAX_CLIP * 2);
+	out_b = malloc(MAX_CLIP * 2);
+	if (!out_a || !out_b)
+		goto out;
+
+	for (i = 0; i < NUM_CLIPS; i++) {
+		const struct mux_clip *s = &src[i].clip;
+
+		if (mux_pack_find(pack, s->id, &c) != MUX_OK ||
+		    c.id != s->id || c.codec_type != s->codec_type ||
+		    c.num_streams != s->num_streams ||
+		    c.sample_rate != s->sample_rate ||
+		    c.num_channels != s->num_channels ||
+		    c.duration != s->duration || !same_stream(&c, &src[i])) {
+			fprintf(stderr, "  FAIL: clip %zu does not match\n", i);
+			goto out;
+		}
+		if ((uintptr_t)c.data % 64 != 0) {
+			fprintf(stderr, "  FAIL: clip %zu payload unaligned\n",
+				i);
+			goto out;
+		}
+
+		/* Decoding from the pack matches decoding the original */
+		dec = mux_pack_decoder_new(&c, NULL, 0);
+		if (!dec)
+			goto out;
+		len_a = decode_all(dec, c.data, c.size, out_a, MAX_CLIP * 2);
+		mux_decoder_destroy(dec);
+
+		dec = mux_decoder_new(s->codec_type, s->num_streams, NULL, 0);
+		if (!dec)
+			goto out;
+		len_b = decode_all(dec, s->data, s->size, out_b, MAX_CLIP * 2);
+		mux_decoder_destroy(dec);
+
+		if (len_a == 0 || len_a != len_b ||
+		    memcmp(out_a, out_b, len_a) != 0) {
+			fprintf(stderr, "  FAIL: clip %zu decodes differently\n",
+				i);
+			goto out;
+		}
+	}
+
+	if (mux_pack_find(pack, 16, &c) != MUX_ERROR_NOTFOUND ||
+	    mux_pack_find(pack, UINT64_MAX, &c) != MUX_ERROR_NOTFOUND) {
+		fprintf(stderr, "  FAIL: unknown id found\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_pack_close(pack);
+	remove(PACK_PATH);
+	free(out_b);
+	free(out_a);
+	for (i = 0; i < NUM_CLIPS; i++)
+		free(src[i].stream);
+	return ret;
+}
+
+/* Append an Ogg page with a single segment (CRC is not checked here) */
+static size_t put_page(uint8_t *p, uint64_t granule, uint8_t fill,
+		       size_t len)
+{
+	int i;
+
+	memcpy(p, "OggS", 4);
+	p[4] = 0;
+	p[5] = granule ? 0 : 2;
+	for (i = 0; i < 8; i++)
+		p[6 + i] = (uint8_t)(granule >> (8 * i));
+	memset(p + 14, 0, 12);
+	p[14] = 1;
+	p[26] = 1;
+	p[27] = (uint8_t)len;
+	memset(p + 28, fill, len);
+	return 28 + len;
+}
+
+static int test_shared_headers(void)
+{
+	uint8_t streams[3][512];
+	struct mux_clip clip, a, b, c;
+	struct mux_pack_writer *w;
+	struct mux_pack *pack = NULL;
+	size_t header_len = 0;
+	int i, ret = -1;
+
+	printf("Testing shared header deduplication...\n");
+
+	w = mux_pack_writer_new(PACK_PATH);
+	if (!w)
+		return -1;
+
+	memset(&clip, 0, sizeof(clip));
+	clip.codec_type = MUX_CODEC_OPUS;
+	clip.num_streams = 2;
+	clip.sample_rate = 48000;
+	clip.num_channels = 2;
+
+	/* Same header pages, different audio; the last one has other headers */
+	for (i = 0; i < 3; i++) {
+		size_t len;
+
+		len = put_page(streams[i], 0, i < 2 ? 0x11 : 0x22, 19);
+		len += put_page(streams[i] + len, 0, 0x33, 40);
+		header_len = len;
+		len += put_page(streams[i] + len, 960, (uint8_t)(0x40 + i), 100);
+
+		clip.id = (uint64_t)i;
+		clip.data = streams[i];
+		clip.size = len;
+		if (mux_pack_writer_add(w, &clip) != MUX_OK)
+			goto out;
+	}
+
+	if (mux_pack_writer_finish(w) != MUX_OK)
+		goto out;
+
+	pack = mux_pack_open(PACK_PATH);
+	if (!pack || mux_pack_find(pack, 0, &a) != MUX_OK ||
+	    mux_pack_find(pack, 1, &b) != MUX_OK ||
+	    mux_pack_find(pack, 2, &c) != MUX_OK) {
+		fprintf(stderr, "  FAIL: lookup\n");
+		goto out;
+	}
+
+	if (a.header_size != header_len || a.size != 128 ||
+	    a.header != b.header || a.header == c.header ||
+	    memcmp(a.header, streams[0], header_len) != 0 ||
+	    memcmp(c.header, streams[2], header_len) != 0 ||
+	    memcmp(b.data, streams[1] + header_len, b.size) != 0) {
+		fprintf(stderr, "  FAIL: headers not shared as expected\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_pack_close(pack);
+	mux_pack_writer_destroy(w);
+	remove(PACK_PATH);
+	return ret;
+}
+
+/*
+ * Decoders opened after the first for the same header are restored from
+ * the pack's primed snapshot; they must decode like a parsed one
+ */
+static int test_primed(void)
+{
+	struct mux_clip clip, c, parsed;
+	struct mux_pack_writer *w = NULL;
+	struct mux_pack *pack = NULL;
+	struct mux_decoder *dec;
+	uint8_t *stream, *out_a, *out_b;
+	size_t len_a, len_b;
+	int i, ret = -1;
+
+	printf("Testing primed decoders...\n");
+
+	stream = malloc(MAX_CLIP);
+	out_a = malloc(MAX_CLIP * 2);
+	out_b = malloc(MAX_CLIP * 2);
+	if (!stream || !out_a || !out_b)
+		goto out;
+
+	memset(&clip, 0, sizeof(clip));
+	clip.id = 1;
+	clip.codec_type = MUX_CODEC_OPUS;
+	clip.num_streams = 2;
+	clip.sample_rate = RATE;
+	clip.num_channels = CHANNELS;
+	clip.data = stream;
+	clip.size = encode_clip(MUX_CODEC_OPUS, 2, 5, 1600, stream, MAX_CLIP);
+	if (clip.size == 0) {
+		printf("  SKIP (Opus not available)\n");
+		ret = 0;
+		goto out;
+	}
+
+	w = mux_pack_writer_new(PACK_PATH);
+	if (!w || mux_pack_writer_add(w, &clip) != MUX_OK ||
+	    mux_pack_writer_finish(w) != MUX_OK)
+		goto out;
+
+	pack = mux_pack_open(PACK_PATH);
+	if (!pack || mux_pack_find(pack, 1, &c) != MUX_OK || !c.header_size) {
+		fprintf(stderr, "  FAIL: lookup\n");
+		goto out;
+	}
+
+	/* Without the pack the header is parsed every time */
+	parsed = c;
+	parsed.pack = NULL;
+	dec = mux_pack_decoder_new(&parsed, NULL, 0);
+	if (!dec)
+		goto out;
+	len_a = decode_all(dec, c.data, c.size, out_a, MAX_CLIP * 2);
+	mux_decoder_destroy(dec);
+
+	for (i = 0; i < 3; i++) {
+		dec = mux_pack_decoder_new(&c, NULL, 0);
+		if (!dec)
+			goto out;
+		len_b = decode_all(dec, c.data, c.size, out_b, MAX_CLIP * 2);
+		mux_decoder_destroy(dec);
+
+		if (len_a == 0 || len_a != len_b ||
+		    memcmp(out_a, out_b, len_a) != 0) {
+			fprintf(stderr, "  FAIL: open %d decodes differently\n",
+				i);
+			goto out;
+		}
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_pack_close(pack);
+	mux_pack_writer_destroy(w);
+	remove(PACK_PATH);
+	free(out_b);
+	free(out_a);
+	free(stream);
+	return ret;
+}
+
+static int test_errors(void)
+{
+	uint8_t data[16] = { 1, 2, 3 };
+	uint8_t *file = NULL;
+	struct mux_pack_writer *w;
+	struct mux_pack *pack;
+	struct mux_clip clip, c;
+	FILE *f;
+	long len;
+	int ret = -1;
+
+	printf("Testing error handling...\n");
+
+	memset(&clip, 0, sizeof(clip));
+	clip.codec_type = MUX_CODEC_PCM;
+	clip.num_streams = 1;
+	clip.data = data;
+	clip.size = sizeof(data);
+
+	/* Duplicate ids */
+	w = mux_pack_writer_new(PACK_PATH);
+	if (!w || mux_pack_writer_add(w, &clip) != MUX_OK ||
+	    mux_pack_writer_add(w, &clip) != MUX_OK ||
+	    mux_pack_writer_finish(w) != MUX_ERROR_INVAL) {
+		fprintf(stderr, "  FAIL: duplicate ids accepted\n");
+		mux_pack_writer_destroy(w);
+		goto out;
+	}
+	mux_pack_writer_destroy(w);
+
+	/* Bad clips */
+	w = mux_pack_writer_new(PACK_PATH);
+	if (!w)
+		goto out;
+	clip.num_streams = 3;
+	if (mux_pack_writer_add(w, &clip) != MUX_ERROR_INVAL ||
+	    mux_pack_writer_add(w, NULL) != MUX_ERROR_INVAL) {
+		fprintf(stderr, "  FAIL: bad clip accepted\n");
+		mux_pack_writer_destroy(w);
+		goto out;
+	}
+	clip.num_streams = 1;
+	if (mux_pack_writer_add(w, &clip) != MUX_OK ||
+	    mux_pack_writer_finish(w) != MUX_OK) {
+		mux_pack_writer_destroy(w);
+		goto out;
+	}
+	mux_pack_writer_destroy(w);
+
+	/* Load it back and use the in-memory variant */
+	f = fopen(PACK_PATH, "rb");
+	if (!f)
+		goto out;
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	file = malloc((size_t)len);
+	if (!file || fread(file, 1, (size_t)len, f) != (size_t)len) {
+		fclose(f);
+		goto out;
+	}
+	fclose(f);
+
+	pack = mux_pack_open_memory(file, (size_t)len);
+	if (!pack || mux_pack_find(pack, 0, &c) != MUX_OK ||
+	    c.size != sizeof(data) || memcmp(c.data, data, sizeof(data)) != 0) {
+		fprintf(stderr, "  FAIL: mux_pack_open_memory\n");
+		mux_pack_close(pack);
+		goto out;
+	}
+	mux_pack_close(pack);
+
+	/* Truncated and corrupted packs are refused */
+	if (mux_pack_open_memory(file, 63) != NULL) {
+		fprintf(stderr, "  FAIL: truncated pack accepted\n");
+		goto out;
+	}
+	file[24] = 0xff;        /* index offset */
+	if (mux_pack_open_memory(file, (size_t)len) != NULL) {
+		fprintf(stderr, "  FAIL: corrupt pack accepted\n");
+		goto out;
+	}
+	file[0] = 'X';
+	if (mux_pack_open_memory(file, (size_t)len) != NULL ||
+	    mux_pack_open("does-not-exist.muxpack") != NULL) {
+		fprintf(stderr, "  FAIL: bad magic accepted\n");
+		goto out;
+	}
+
+	if (mux_pack_find(NULL, 0, &c) != MUX_ERROR_INVAL ||
+	    mux_pack_count(NULL) != 0 ||
+	    strcmp(mux_error_string(MUX_ERROR_NOTFOUND), "No such entry") != 0) {
+		fprintf(stderr, "  FAIL: argument handling\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	free(file);
+	remove(PACK_PATH);
+	return ret;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Clip Pack Tests\n");
+	printf("===============\n\n");
+
+	if (test_roundtrip() != 0)
+		failures++;
+	if (test_shared_headers() != 0)
+		failures++;
+	if (test_primed() != 0)
+		failures++;
+	if (test_errors() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
@@ -0,0 +1,577 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test the non-blocking fd pumps over pipes: the stream survives split
+ * frames and partial writes, waits are reported on the right side and
+ * a stalled reader bounds the memory queued
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mux.h"
+
+#define RATE      16000
+#define CHANNELS  2
+#define FRAMES    (RATE * 3)
+#define PCM_BYTES (FRAMES * CHANNELS * sizeof(int16_t))
+#define OUT_SIZE  (1 << 22)
+#define SIDE_SIZE 4096
+
+struct feed {
+	int fd;
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+	size_t chunk;           /* bytes per write, to split frames */
+};
+
+static int make_pipe(int fds[2])
+{
+	if (pipe(fds) != 0)
+		return -1;
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	return 0;
+}
+
+/* Write one chunk, close the write end once everything is in */
+static void feed_some(struct feed *f)
+{
+	ssize_t w;
+	size_t n;
+
+	if (f->fd >= 0 && f->pos < f->len) {
+		n = f->len - f->pos;
+		if (n > f->chunk)
+			n = f->chunk;
+		w = write(f->fd, f->data + f->pos, n);
+		if (w > 0)
+			f->pos += (size_t)w;
+	}
+
+	if (f->fd >= 0 && f->pos == f->len) {
+		close(f->fd);
+		f->fd = -1;
+	}
+}
+
+/* Read what is there; returns 1 at end of file */
+static int drain_some(int fd, uint8_t *out, size_t size, size_t *len)
+{
+	ssize_t r;
+
+	for (;;) {
+		r = read(fd, out + *len, size - *len);
+		if (r > 0)
+			*len += (size_t)r;
+		else
+			return r == 0;
+	}
+}
+
+static void fill_pcm(uint8_t *pcm)
+{
+	int16_t *s = (int16_t *)pcm;
+	size_t i;
+
+	for (i = 0; i < FRAMES * CHANNELS; i++)
+		s[i] = (int16_t)((i * 7919) % 40000 - 20000);
+}
+
+static const char side_text[] = "chapter one|chapter two|chapter three";
+
+static int test_encoder(enum mux_codec_type codec)
+{
+	struct mux_encoder *enc;
+	struct mux_decoder *dec = NULL;
+	struct feed in, side;
+	int in_p[2], side_p[2], out_p[2];
+	uint8_t *pcm, *out, *audio, sidebuf[SIDE_SIZE];
+	size_t out_len = 0, audio_len = 0, side_len = 0, consumed, n;
+	int ret, wait, saw_in_wait = 0, stream_type, rounds = 0, result = -1;
+
+	printf("Testing %s encoder pump...\n", mux_codec_to_name(codec));
+
+	pcm = malloc(PCM_BYTES);
+	out = malloc(OUT_SIZE);
+	audio = malloc(OUT_SIZE);
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	if (!pcm || !out || !audio || !enc ||
+	    make_pipe(in_p) || make_pipe(side_p) || make_pipe(out_p)) {
+		fprintf(stderr, "  FAIL: setup\n");
+		free(pcm);
+		free(out);
+		free(audio);
+		mux_encoder_destroy(enc);
+		return -1;
+	}
+	fill_pcm(pcm);
+
+	in = (struct feed){ in_p[1], pcm, PCM_BYTES, 0, 1001 };
+	side = (struct feed){ side_p[1], (const uint8_t *)side_text,
+			      sizeof(side_text) - 1, 0, 12 };
+
+	do {
+		/* Trickle input so the pump sees split frames and EAGAIN */
+		if (rounds % 3 == 0)
+			feed_some(&in);
+		if (rounds % 50 == 0)
+			feed_some(&side);
+		ret = mux_encoder_pump(enc, in_p[0], side_p[0], out_p[1], &wait);
+		if (wait & MUX_PUMP_IN)
+			saw_in_wait = 1;
+		drain_some(out_p[0], out, OUT_SIZE, &out_len);
+		rounds++;
+	} while (ret == MUX_OK && rounds < 1000000);
+
+	if (ret != MUX_ERROR_EOF) {
+		fprintf(stderr, "  FAIL: pump returned %d\n", ret);
+		goto out;
+	}
+	close(out_p[1]);
+	out_p[1] = -1;
+	while (!drain_some(out_p[0], out, OUT_SIZE, &out_len))
+		;
+
+	if (!saw_in_wait) {
+		fprintf(stderr, "  FAIL: never waited for input\n");
+		goto out;
+	}
+
+	/* The stream must decode back to the input */
+	dec = mux_decoder_new(codec, 2, NULL, 0);
+	if (!dec || mux_decoder_decode(dec, out, out_len, &consumed) != MUX_OK ||
+	    mux_decoder_finalize(dec) != MUX_OK)
+		goto out;
+	do {
+		stream_type = -1;
+		if (mux_decoder_read(dec, audio + audio_len, OUT_SIZE - audio_len,
+				     &n, &stream_type) != MUX_OK)
+			goto out;
+		if (stream_type == MUX_STREAM_SIDE_CHANNEL) {
+			memmove(sidebuf + side_len, audio + audio_len, n);
+			side_len += n;
+		} else {
+			audio_len += n;
+		}
+	} while (n > 0);
+
+	if (side_len != sizeof(side_text) - 1 ||
+	    memcmp(sidebuf, side_text, side_len) != 0) {
+		fprintf(stderr, "  FAIL: side channel mismatch\n");
+		goto out;
+	}
+	if (codec == MUX_CODEC_PCM &&
+	    (audio_len != PCM_BYTES || memcmp(audio, pcm, PCM_BYTES) != 0)) {
+		fprintf(stderr, "  FAIL: audio mismatch (%zu bytes)\n",
+			audio_len);
+		goto out;
+	}
+	if (audio_len != PCM_BYTES) {
+		fprintf(stderr, "  FAIL: %zu audio bytes\n", audio_len);
+		goto out;
+	}
+
+	printf("  PASS (%d rounds)\n", rounds);
+	result = 0;
+
+out:
+	if (in.fd >= 0)
+		close(in.fd);
+	if (side.fd >= 0)
+		close(side.fd);
+	if (out_p[1] >= 0)
+		close(out_p[1]);
+	close(in_p[0]);
+	close(side_p[0]);
+	close(out_p[0]);
+	mux_decoder_destroy(dec);
+	mux_encoder_destroy(enc);
+	free(audio);
+	free(out);
+	free(pcm);
+	return result;
+}
+
+static int test_decoder(enum mux_codec_type codec)
+{
+	struct mux_encoder *enc;
+	struct mux_decoder *dec = NULL;
+	struct feed in = { -1, NULL, 0, 0, 0 };
+	int in_p[2] = { -1, -1 }, out_p[2] = { -1, -1 }, side_p[2] = { -1, -1 };
+	uint8_t *pcm, *stream, *audio, *ref, sidebuf[SIDE_SIZE];
+	size_t stream_len = 0, audio_len = 0, ref_len = 0, side_len = 0;
+	size_t consumed, n;
+	int ret, wait, rounds = 0, stream_type, out_eof = 0, result = -1;
+
+	printf("Testing %s decoder pump...\n", mux_codec_to_name(codec));
+
+	pcm = malloc(PCM_BYTES);
+	stream = malloc(OUT_SIZE);
+	audio = malloc(OUT_SIZE);
+	ref = malloc(OUT_SIZE);
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	if (!pcm || !stream || !audio || !ref || !enc)
+		goto out;
+	fill_pcm(pcm);
+
+	if (mux_encoder_encode(enc, pcm, PCM_BYTES / 2, &consumed,
+			       MUX_STREAM_AUDIO) != MUX_OK ||
+	    mux_encoder_encode(enc, side_text, sizeof(side_text) - 1, &consumed,
+			       MUX_STREAM_SIDE_CHANNEL) != MUX_OK ||
+	    mux_encoder_encode(enc, pcm + PCM_BYTES / 2, PCM_BYTES / 2,
+			       &consumed, MUX_STREAM_AUDIO) != MUX_OK ||
+	    mux_encoder_finalize(enc) != MUX_OK)
+		goto out;
+	while (mux_encoder_read(enc, stream + stream_len, OUT_SIZE - stream_len,
+				&n) == MUX_OK && n > 0)
+		stream_len += n;
+
+	/* Reference: decode it directly */
+	dec = mux_decoder_new(codec, 2, NULL, 0);
+	if (!dec || mux_decoder_decode(dec, stream, stream_len,
+				       &consumed) != MUX_OK ||
+	    mux_decoder_finalize(dec) != MUX_OK)
+		goto out;
+	do {
+		stream_type = -1;
+		mux_decoder_read(dec, ref + ref_len, OUT_SIZE - ref_len, &n,
+				 &stream_type);
+		if (stream_type == MUX_STREAM_AUDIO)
+			ref_len += n;
+	} while (n > 0);
+	mux_decoder_destroy(dec);
+
+	dec = mux_decoder_new(codec, 2, NULL, 0);
+	if (!dec || make_pipe(in_p) || make_pipe(out_p) || make_pipe(side_p))
+		goto out;
+
+	in = (struct feed){ in_p[1], stream, stream_len, 0, 777 };
+	do {
+		if (rounds % 2 == 0)
+			feed_some(&in);
+		ret = mux_decoder_pump(dec, in_p[0], out_p[1], side_p[1], &wait);
+		drain_some(out_p[0], audio, OUT_SIZE, &audio_len);
+		drain_some(side_p[0], sidebuf, sizeof(sidebuf), &side_len);
+		rounds++;
+	} while (ret == MUX_OK && rounds < 1000000);
+
+	if (ret != MUX_ERROR_EOF) {
+		fprintf(stderr, "  FAIL: pump returned %d\n", ret);
+		goto out;
+	}
+	close(out_p[1]);
+	close(side_p[1]);
+	out_p[1] = side_p[1] = -1;
+	while (!out_eof)
+		out_eof = drain_some(out_p[0], audio, OUT_SIZE, &audio_len);
+	while (!drain_some(side_p[0], sidebuf, sizeof(sidebuf), &side_len))
+		;
+
+	if (audio_len != ref_len || memcmp(audio, ref, ref_len) != 0 ||
+	    side_len != sizeof(side_text) - 1 ||
+	    memcmp(sidebuf, side_text, side_len) != 0) {
+		fprintf(stderr, "  FAIL: output mismatch (%zu/%zu audio, %zu side)\n",
+			audio_len, ref_len, side_len);
+		goto out;
+	}
+
+	printf("  PASS (%d rounds)\n", rounds);
+	result = 0;
+
+out:
+	if (in.fd >= 0)
+		close(in.fd);
+	if (in_p[0] >= 0)
+		close(in_p[0]);
+	if (out_p[0] >= 0)
+		close(out_p[0]);
+	if (out_p[1] >= 0)
+		close(out_p[1]);
+	if (side_p[0] >= 0)
+		close(side_p[0]);
+	if (side_p[1] >= 0)
+		close(side_p[1]);
+	mux_decoder_destroy(dec);
+	mux_encoder_destroy(enc);
+	free(ref);
+	free(audio);
+	free(stream);
+	free(pcm);
+	return result;
+}
+
+/* Keyed state records are taken out on the way, not written to side_fd */
+static int test_state(void)
+{
+	struct mux_encoder *enc;
+	struct mux_decoder *dec = NULL;
+	struct feed in = { -1, NULL, 0, 0, 0 };
+	int in_p[2] = { -1, -1 }, out_p[2] = { -1, -1 }, side_p[2] = { -1, -1 };
+	uint8_t *pcm, *stream, *audio, sidebuf[SIDE_SIZE];
+	size_t stream_len = 0, audio_len = 0, side_len = 0, consumed, n;
+	const void *value;
+	int ret, wait, rounds = 0, result = -1;
+
+	printf("Testing decoder pump with keyed state...\n");
+
+	pcm = malloc(PCM_BYTES);
+	stream = malloc(OUT_SIZE);
+	audio = malloc(OUT_SIZE);
+	enc = mux_encoder_new(MUX_CODEC_PCM, RATE, CHANNELS, 2, NULL, 0);
+	if (!pcm || !stream || !audio || !enc)
+		goto out;
+	fill_pcm(pcm);
+
+	if (mux_encoder_set_state(enc, 0) != MUX_OK ||
+	    mux_encoder_state_set(enc, "title", "pump", 4) != MUX_OK ||
+	    mux_encoder_encode(enc, pcm, PCM_BYTES, &consumed,
+			       MUX_STREAM_AUDIO) != MUX_OK ||
+	    mux_encoder_finalize(enc) != MUX_OK)
+		goto out;
+	while (mux_encoder_read(enc, stream + stream_len, OUT_SIZE - stream_len,
+				&n) == MUX_OK && n > 0)
+		stream_len += n;
+
+	dec = mux_decoder_new(MUX_CODEC_PCM, 2, NULL, 0);
+	if (!dec || mux_decoder_set_state(dec, 1) != MUX_OK ||
+	    make_pipe(in_p) || make_pipe(out_p) || make_pipe(side_p))
+		goto out;
+
+	in = (struct feed){ in_p[1], stream, stream_len, 0, 4096 };
+	in_p[1] = -1;
+	do {
+		feed_some(&in);
+		ret = mux_decoder_pump(dec, in_p[0], out_p[1], side_p[1], &wait);
+		drain_some(out_p[0], audio, OUT_SIZE, &audio_len);
+		drain_some(side_p[0], sidebuf, sizeof(sidebuf), &side_len);
+		rounds++;
+	} while (ret == MUX_OK && rounds < 1000000);
+
+	if (ret != MUX_ERROR_EOF || audio_len != PCM_BYTES ||
+	    memcmp(audio, pcm, PCM_BYTES) != 0 || side_len != 0 ||
+	    mux_decoder_state_get(dec, "title", &value, &n) != MUX_OK ||
+	    n != 4 || memcmp(value, "pump", 4) != 0) {
+		fprintf(stderr, "  FAIL: ret %d, %zu audio, %zu side bytes\n",
+			ret, audio_len, side_len);
+		goto out;
+	}
+
+	printf("  PASS\n");
+	result = 0;
+
+out:
+	if (in.fd >= 0)
+		close(in.fd);
+	if (in_p[0] >= 0)
+		close(in_p[0]);
+	if (in_p[1] >= 0)
+		close(in_p[1]);
+	if (out_p[0] >= 0)
+		close(out_p[0]);
+	if (out_p[1] >= 0)
+		close(out_p[1]);
+	if (side_p[0] >= 0)
+		close(side_p[0]);
+	if (side_p[1] >= 0)
+		close(side_p[1]);
+	mux_decoder_destroy(dec);
+	mux_encoder_destroy(enc);
+	free(audio);
+	free(stream);
+	free(pcm);
+	return result;
+}
+
+/* A lazy decoder parked with input queued must wake before pulling */
+static int test_hibernated(enum mux_codec_type codec, int optional)
+{
+	struct mux_param lazy = { .name = "lazy", .value.b = 1 };
+	struct mux_encoder *enc;
+	struct mux_decoder *dec = NULL;
+	struct feed in = { -1, NULL, 0, 0, 0 };
+	int in_p[2] = { -1, -1 }, out_p[2] = { -1, -1 };
+	uint8_t *pcm, *stream, *audio, *ref;
+	size_t stream_len = 0, audio_len = 0, ref_len = 0, consumed, n;
+	int ret, wait, rounds = 0, stream_type, result = -1;
+
+	printf("Testing hibernated lazy %s decoder pump...\n",
+	       mux_codec_to_name(codec));
+
+	pcm = malloc(PCM_BYTES);
+	stream = malloc(OUT_SIZE);
+	audio = malloc(OUT_SIZE);
+	ref = malloc(OUT_SIZE);
+	if (!pcm || !stream || !audio || !ref)
+		goto out;
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 1, NULL, 0);
+	if (!enc) {
+		if (optional) {
+			printf("  SKIP (codec not available)\n");
+			result = 0;
+		}
+		goto out;
+	}
+	fill_pcm(pcm);
+
+	if (mux_encoder_encode(enc, pcm, PCM_BYTES, &consumed,
+			       MUX_STREAM_AUDIO) != MUX_OK ||
+	    mux_encoder_finalize(enc) != MUX_OK)
+		goto out_enc;
+	while (mux_encoder_read(enc, stream + stream_len, OUT_SIZE - stream_len,
+				&n) == MUX_OK && n > 0)
+		stream_len += n;
+
+	dec = mux_decoder_new(codec, 1, NULL, 0);
+	if (!dec || mux_decoder_decode(dec, stream, stream_len,
+				       &consumed) != MUX_OK ||
+	    mux_decoder_finalize(dec) != MUX_OK)
+		goto out_enc;
+	do {
+		stream_type = -1;
+		mux_decoder_read(dec, ref + ref_len, OUT_SIZE - ref_len, &n,
+				 &stream_type);
+		ref_len += n;
+	} while (n > 0);
+	mux_decoder_destroy(dec);
+
+	/* Half the stream queued, the decoder parked, the rest on the pipe */
+	dec = mux_decoder_new(codec, 1, &lazy, 1);
+	if (!dec || make_pipe(in_p) || make_pipe(out_p) ||
+	    mux_decoder_decode(dec, stream, stream_len / 2,
+			       &consumed) != MUX_OK ||
+	    consumed != stream_len / 2 ||
+	    mux_decoder_hibernate(dec) != MUX_OK)
+		goto out_enc;
+
+	in = (struct feed){ in_p[1], stream + consumed, stream_len - consumed,
+			    0, 4096 };
+	in_p[1] = -1;
+
+	do {
+		feed_some(&in);
+		ret = mux_decoder_pump(dec, in_p[0], out_p[1], -1, &wait);
+		drain_some(out_p[0], audio, OUT_SIZE, &audio_len);
+		rounds++;
+	} while (ret == MUX_OK && rounds < 1000000);
+
+	if (ret != MUX_ERROR_EOF || audio_len != ref_len ||
+	    memcmp(audio, ref, ref_len) != 0) {
+		fprintf(stderr, "  FAIL: pump returned %d, %zu/%zu bytes\n",
+			ret, audio_len, ref_len);
+		goto out_enc;
+	}
+
+	printf("  PASS (%zu bytes)\n", audio_len);
+	result = 0;
+
+out_enc:
+	mux_encoder_destroy(enc);
+out:
+	if (in.fd >= 0)
+		close(in.fd);
+	if (in_p[0] >= 0)
+		close(in_p[0]);
+	if (in_p[1] >= 0)
+		close(in_p[1]);
+	if (out_p[0] >= 0)
+		close(out_p[0]);
+	if (out_p[1] >= 0)
+		close(out_p[1]);
+	mux_decoder_destroy(dec);
+	free(ref);
+	free(audio);
+	free(stream);
+	free(pcm);
+	return result;
+}
+
+/* Nobody reads the output: the pump must stop pulling input */
+static int test_backpressure(void)
+{
+	struct mux_encoder *enc;
+	int in_p[2], out_p[2];
+	uint8_t chunk[16384];
+	size_t mem;
+	int i, ret, wait = 0, result = -1;
+
+	printf("Testing backpressure...\n");
+
+	enc = mux_encoder_new(MUX_CODEC_PCM, RATE, CHANNELS, 1, NULL, 0);
+	if (!enc || make_pipe(in_p) || make_pipe(out_p)) {
+		mux_encoder_destroy(enc);
+		return -1;
+	}
+
+	memset(chunk, 0x55, sizeof(chunk));
+	for (i = 0; i < 1000; i++) {
+		while (write(in_p[1], chunk, sizeof(chunk)) > 0)
+			;
+		ret = mux_encoder_pump(enc, in_p[0], -1, out_p[1], &wait);
+		if (ret != MUX_OK)
+			break;
+	}
+
+	mem = mux_encoder_memory_usage(enc);
+	if (ret != MUX_OK || wait != MUX_PUMP_OUT || mem > (3u << 20)) {
+		fprintf(stderr, "  FAIL: ret %d, wait %#x, %zu bytes queued\n",
+			ret, wait, mem);
+		goto out;
+	}
+
+	/* Argument checks */
+	if (mux_encoder_pump(NULL, in_p[0], -1, out_p[1], &wait) !=
+	    MUX_ERROR_INVAL ||
+	    mux_decoder_pump(NULL, in_p[0], out_p[1], -1, &wait) !=
+	    MUX_ERROR_INVAL ||
+	    mux_encoder_pump(enc, -1, -1, out_p[1], &wait) != MUX_ERROR_INVAL) {
+		fprintf(stderr, "  FAIL: argument handling\n");
+		goto out;
+	}
+
+	printf("  PASS (%zu bytes held)\n", mem);
+	result = 0;
+
+out:
+	close(in_p[0]);
+	close(in_p[1]);
+	close(out_p[0]);
+	close(out_p[1]);
+	mux_encoder_destroy(enc);
+	return result;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("FD Pump Tests\n");
+	printf("=============\n\n");
+
+	if (test_encoder(MUX_CODEC_PCM) != 0)
+		failures++;
+	if (test_encoder(MUX_CODEC_ALAW) != 0)
+		failures++;
+	if (test_decoder(MUX_CODEC_PCM) != 0)
+		failures++;
+	if (test_decoder(MUX_CODEC_MULAW) != 0)
+		failures++;
+	if (test_state() != 0)
+		failures++;
+	if (test_hibernated(MUX_CODEC_PCM, 0) != 0)
+		failures++;
+	if (test_hibernated(MUX_CODEC_OPUS, 1) != 0)
+		failures++;
+	if (test_backpressure() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
@@ -0,0 +1,349 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test encoder rate control: side channel bursts are paced so that no
+ * stretch of output exceeds the token bucket, all side data still
+ * arrives in order, turning the limit off flushes it, a writer faster
+ * than the link is pushed back instead of queued forever, and codecs with
+ * a live bitrate are steered below the link rate
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE      8000
+#define TICK      160            /* 20 ms */
+#define TICKS     300
+#define LINK_BPS  80000
+#define WINDOW_MS 200
+#define SIDE_MAX  8192
+
+static size_t tick_bytes[TICKS];
+static uint8_t stream[1 << 20];
+static size_t stream_len;
+static uint8_t side_in[SIDE_MAX];
+static size_t side_in_len;
+
+static void fill(int16_t *pcm, int tick)
+{
+	int i;
+
+	for (i = 0; i < TICK; i++)
+		pcm[i] = (int16_t)(((tick * TICK + i) * 2731) % 24000 - 12000);
+}
+
+static size_t drain(struct mux_encoder *enc)
+{
+	size_t written, total = 0;
+
+	while (mux_encoder_read(enc, stream + stream_len,
+				sizeof(stream) - stream_len, &written) ==
+	       MUX_OK && written > 0) {
+		stream_len += written;
+		total += written;
+	}
+	return total;
+}
+
+/* 20 ms of A-law per tick with two side channel bursts */
+static int run(int limit)
+{
+	struct mux_encoder *enc;
+	int16_t pcm[TICK];
+	size_t consumed, n;
+	int tick, ret = 0;
+
+	stream_len = 0;
+	side_in_len = 0;
+	enc = mux_encoder_new(MUX_CODEC_ALAW, RATE, 1, 2, NULL, 0);
+	if (!enc)
+		return -1;
+	if (limit && mux_encoder_set_rate_limit(enc, LINK_BPS,
+						WINDOW_MS) != MUX_OK)
+		ret = -1;
+
+	for (tick = 0; tick < TICKS && ret == 0; tick++) {
+		fill(pcm, tick);
+		if (mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				       MUX_STREAM_AUDIO) != MUX_OK)
+			ret = -1;
+		if (tick == 10 || tick == 60) {
+			n = tick == 10 ? 5000 : 3000;
+			for (consumed = 0; consumed < n; consumed++)
+				side_in[side_in_len + consumed] =
+					(uint8_t)(side_in_len + consumed);
+			if (mux_encoder_encode(enc, side_in + side_in_len, n,
+					       &consumed,
+					       MUX_STREAM_SIDE_CHANNEL) != MUX_OK ||
+			    consumed != n)
+				ret = -1;
+			side_in_len += n;
+		}
+		tick_bytes[tick] = drain(enc);
+	}
+
+	if (mux_encoder_finalize(enc) != MUX_OK)
+		ret = -1;
+	drain(enc);
+	mux_encoder_destroy(enc);
+	return ret;
+}
+
+/* Bytes of the worst stretch of ticks beyond what the bucket allows */
+static long long worst_excess(void)
+{
+	long long sum, allowed, worst = -1000000;
+	int a, b;
+
+	for (a = 0; a < TICKS; a++) {
+		sum = 0;
+		for (b = a; b < TICKS; b++) {
+			sum += (long long)tick_bytes[b];
+			allowed = (long long)LINK_BPS / 8 * WINDOW_MS / 1000 +
+				  (long long)LINK_BPS / 8 * (b - a + 1) *
+				  TICK / RATE;
+			if (sum - allowed > worst)
+				worst = sum - allowed;
+		}
+	}
+	return worst;
+}
+
+static int side_round_trip(void)
+{
+	static uint8_t side_out[SIDE_MAX], buf[4096];
+	struct mux_decoder *dec = mux_decoder_new(MUX_CODEC_ALAW, 2, NULL, 0);
+	size_t consumed, written, got = 0;
+	int type, ok;
+
+	if (!dec)
+		return -1;
+	ok = mux_decoder_decode(dec, stream, stream_len, &consumed) == MUX_OK &&
+	     consumed == stream_len && mux_decoder_finalize(dec) == MUX_OK;
+	while (ok && mux_decoder_read(dec, buf, sizeof(buf), &written,
+				      &type) == MUX_OK && written > 0) {
+		if (type == MUX_STREAM_SIDE_CHANNEL && got + written <= SIDE_MAX) {
+			memcpy(side_out + got, buf, written);
+			got += written;
+		}
+	}
+	mux_decoder_destroy(dec);
+
+	return ok && got == side_in_len &&
+	       memcmp(side_out, side_in, got) == 0 ? 0 : -1;
+}
+
+static int test_side_pacing(void)
+{
+	long long unlimited, limited;
+
+	printf("Test: Side channel bursts on an A-law call\n");
+
+	if (run(0) != 0) {
+		printf("  FAIL: Encoding failed\n");
+		return -1;
+	}
+	unlimited = worst_excess();
+
+	if (run(1) != 0) {
+		printf("  FAIL: Encoding with a limit failed\n");
+		return -1;
+	}
+	limited = worst_excess();
+
+	if (unlimited <= 0 || limited > 0) {
+		printf("  FAIL: Worst excess %lld bytes unlimited, %lld limited\n",
+		       unlimited, limited);
+		return -1;
+	}
+	if (side_round_trip() != 0) {
+		printf("  FAIL: Side channel data differs after decoding\n");
+		return -1;
+	}
+
+	printf("  PASS: %lld bytes over the bucket without a limit, none with\n",
+	       unlimited);
+	return 0;
+}
+
+static int test_off(void)
+{
+	struct mux_encoder *enc;
+	struct mux_rate_stats st;
+	int16_t pcm[TICK] = { 0 };
+	uint8_t side[3000] = { 0 };
+	size_t consumed, before, queued;
+	int ok;
+
+	printf("Test: Turning the limit off\n");
+
+	enc = mux_encoder_new(MUX_CODEC_MULAW, RATE, 1, 2, NULL, 0);
+	if (!enc)
+		return -1;
+
+	stream_len = 0;
+	ok = mux_encoder_set_rate_limit(enc, 72000, 100) == MUX_OK &&
+	     mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				MUX_STREAM_AUDIO) == MUX_OK &&
+	     mux_encoder_encode(enc, side, sizeof(side), &consumed,
+				MUX_STREAM_SIDE_CHANNEL) == MUX_OK &&
+	     mux_encoder_get_rate_stats(enc, &st) == MUX_OK;
+	queued = st.side_queued;
+	before = drain(enc);
+	ok = ok && mux_encoder_set_rate_limit(enc, 0, 0) == MUX_OK &&
+	     mux_encoder_get_rate_stats(enc, &st) == MUX_ERROR_NOTFOUND &&
+	     drain(enc) >= queued;
+	mux_encoder_destroy(enc);
+
+	if (!ok || queued == 0 || st.bitrate != 0) {
+		printf("  FAIL: %zu bytes queued, %zu emitted before\n", queued,
+		       before);
+		return -1;
+	}
+
+	printf("  PASS: %zu queued side bytes flushed\n", queued);
+	return 0;
+}
+
+static int test_backpressure(void)
+{
+	static uint8_t side[1 << 16];
+	struct mux_encoder *enc;
+	struct mux_rate_stats st;
+	int16_t pcm[TICK] = { 0 };
+	size_t consumed, total = 0;
+	int i, ret = MUX_OK, ok;
+
+	printf("Test: A side channel writer faster than the link\n");
+
+	enc = mux_encoder_new(MUX_CODEC_MULAW, RATE, 1, 2, NULL, 0);
+	if (!enc)
+		return -1;
+
+	/* 64 KiB of side data per 20 ms tick on an 80 kbps link */
+	ok = mux_encoder_set_rate_limit(enc, LINK_BPS, WINDOW_MS) == MUX_OK;
+	for (i = 0; i < 100 && ok && ret == MUX_OK; i++) {
+		ok = mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+					MUX_STREAM_AUDIO) == MUX_OK;
+		ret = mux_encoder_encode(enc, side, sizeof(side), &consumed,
+					 MUX_STREAM_SIDE_CHANNEL);
+		total += consumed;
+		stream_len = 0;
+		drain(enc);
+	}
+	ok = ok && ret == MUX_ERROR_LIMIT && consumed == 0 &&
+	     mux_encoder_get_rate_stats(enc, &st) == MUX_OK &&
+	     st.side_queued <= (size_t)2 << 20 && total > st.side_queued;
+	mux_encoder_destroy(enc);
+
+	if (!ok) {
+		printf("  FAIL: Side queue not bounded\n");
+		return -1;
+	}
+	printf("  PASS: Refused after %zu bytes, %zu queued\n", total,
+	       st.side_queued);
+	return 0;
+}
+
+/* Opus at 64 kbps VBR on a 24 kbps link */
+static int test_opus(void)
+{
+	struct mux_param p = { .name = "bitrate", .value.i = 64 };
+	struct mux_encoder *enc;
+	struct mux_rate_stats st;
+	int16_t pcm[960 * 2];
+	size_t consumed, late = 0;
+	int i, k, ok = 1;
+
+	printf("Test: Opus steered below the link rate\n");
+
+	enc = mux_encoder_new(MUX_CODEC_OPUS, 48000, 2, 2, &p, 1);
+	if (!enc) {
+		printf("  SKIP (Opus not available)\n");
+		return 0;
+	}
+	if (mux_encoder_set_rate_limit(enc, 24000, 500) != MUX_OK)
+		ok = 0;
+
+	/* 10 s of noise-like audio; the last 5 s are measured */
+	for (i = 0; i < 500 && ok; i++) {
+		for (k = 0; k < 960 * 2; k++)
+			pcm[k] = (int16_t)((rand() % 20000) - 10000);
+		if (mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				       MUX_STREAM_AUDIO) != MUX_OK)
+			ok = 0;
+		stream_len = 0;
+		if (i >= 250)
+			late += drain(enc);
+		else
+			drain(enc);
+	}
+	ok = ok && mux_encoder_get_rate_stats(enc, &st) == MUX_OK;
+	mux_encoder_destroy(enc);
+
+	/* 5 s at 24 kbps, plus the bucket */
+	if (!ok || st.bitrate <= 0 || st.bitrate > 24000 ||
+	    late > 5 * 24000 / 8 + 24000 / 8 / 2) {
+		printf("  FAIL: %zu bytes in 5 s, codec at %d bps\n", late,
+		       st.bitrate);
+		return -1;
+	}
+
+	printf("  PASS: %zu bytes in 5 s, codec at %d bps\n", late, st.bitrate);
+	return 0;
+}
+
+/* AMR-NB picks the highest mode that fits */
+static int test_amr(void)
+{
+	struct mux_encoder *enc;
+	struct mux_rate_stats st;
+	int ok;
+
+	printf("Test: AMR mode follows the link\n");
+
+	enc = mux_encoder_new(MUX_CODEC_AMR, RATE, 1, 2, NULL, 0);
+	if (!enc) {
+		printf("  SKIP (AMR-NB not available)\n");
+		return 0;
+	}
+	ok = mux_encoder_set_rate_limit(enc, 8000, 200) == MUX_OK &&
+	     mux_encoder_get_rate_stats(enc, &st) == MUX_OK &&
+	     st.bitrate == 7950;
+	mux_encoder_destroy(enc);
+
+	if (!ok) {
+		printf("  FAIL: Mode at %d bps on an 8 kbps link\n", st.bitrate);
+		return -1;
+	}
+
+	printf("  PASS: 7.95 kbps mode on an 8 kbps link\n");
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Rate Control Tests\n");
+	printf("==================\n\n");
+
+	if (test_side_pacing() != 0)
+		failures++;
+	if (test_off() != 0)
+		failures++;
+	if (test_backpressure() != 0)
+		failures++;
+	if (test_opus() != 0)
+		failures++;
+	if (test_amr() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
@@ -0,0 +1,366 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test the shared-memory PCM ring and its encoder/decoder adapters
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#ifdef __linux__
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHANNELS 2
+#define TOTAL    (200 * 1024)
+#define CROSS_CHUNKS 1500
+
+static uint8_t pattern(size_t i)
+{
+	return (uint8_t)((i * 7 + (i >> 9)) & 0xff);
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int test_encode_from_ring(void)
+{
+	struct mux_ring *cons, *prod = NULL;
+	struct mux_encoder *enc = NULL;
+	static uint8_t chunk[1000], out[TOTAL];
+	size_t sent = 0, got = 0, n, written, consumed;
+	int ret = -1;
+
+	printf("Testing encode from ring...\n");
+
+	cons = mux_ring_create(4096);
+	if (!cons) {
+		printf("  SKIP (memfd not available)\n");
+		return 0;
+	}
+
+	/* Second mapping of the same memfd, as another process would see it */
+	prod = mux_ring_open(mux_ring_fd(cons));
+	enc = mux_encoder_new(MUX_CODEC_PCM, 48000, CHANNELS, 1, NULL, 0);
+	if (!prod || !enc) {
+		fprintf(stderr, "  FAIL: setup\n");
+		goto out;
+	}
+
+	while (got < TOTAL) {
+		/* Odd sizes so frames straddle commits and the wrap point */
+		n = sent < TOTAL ? (sent * 13 % 997) + 1 : 0;
+		if (n > TOTAL - sent)
+			n = TOTAL - sent;
+		for (written = 0; written < n; written++)
+			chunk[written] = pattern(sent + written);
+		if (n && mux_ring_write(prod, chunk, n, &written, 0) != MUX_OK)
+			goto out;
+		sent += n ? written : 0;
+
+		if (mux_encoder_encode_ring(enc, cons, 0, &consumed) != MUX_OK)
+			goto out;
+		if (consumed % (CHANNELS * 2) != 0) {
+			fprintf(stderr, "  FAIL: partial frame encoded\n");
+			goto out;
+		}
+
+		while (mux_encoder_read(enc, out + got, sizeof(out) - got,
+					&written) == MUX_OK && written > 0)
+			got += written;
+
+		if (sent == TOTAL && consumed == 0 && got < TOTAL) {
+			fprintf(stderr, "  FAIL: stalled at %zu bytes\n", got);
+			goto out;
+		}
+	}
+
+	for (n = 0; n < TOTAL; n++) {
+		if (out[n] != pattern(n)) {
+			fprintf(stderr, "  FAIL: byte %zu differs\n", n);
+			goto out;
+		}
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_encoder_destroy(enc);
+	mux_ring_close(prod);
+	mux_ring_close(cons);
+	return ret;
+}
+
+static int test_timeout(void)
+{
+	struct mux_ring *ring;
+	const void *ptr;
+	size_t avail = 1;
+	double t0, elapsed;
+	int ret;
+
+	printf("Testing read timeout...\n");
+
+	ring = mux_ring_create(4096);
+	if (!ring) {
+		printf("  SKIP (memfd not available)\n");
+		return 0;
+	}
+
+	t0 = now_ms();
+	ret = mux_ring_read_acquire(ring, &ptr, &avail, 20);
+	elapsed = now_ms() - t0;
+
+	if (ret != MUX_OK || avail != 0 || elapsed < 15) {
+		fprintf(stderr, "  FAIL: ret %d avail %zu after %.1f ms\n",
+			ret, avail, elapsed);
+		mux_ring_close(ring);
+		return -1;
+	}
+
+	mux_ring_shutdown(ring);
+	ret = mux_ring_read_acquire(ring, &ptr, &avail, -1);
+	mux_ring_close(ring);
+
+	if (ret != MUX_ERROR_EOF) {
+		fprintf(stderr, "  FAIL: expected EOF after shutdown, got %d\n", ret);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+/*
+ * A split frame waits for its tail; at shutdown the partial frame is
+ * dropped and the encoder sees EOF instead of spinning
+ */
+static int test_partial_frame(void)
+{
+	struct mux_ring *ring;
+	struct mux_encoder *enc = NULL;
+	static const uint8_t half[3] = { 1, 2, 3 };
+	size_t written, consumed = 1;
+	double t0, elapsed;
+	int ret = -1, r;
+
+	printf("Testing partial frame at shutdown...\n");
+
+	ring = mux_ring_create(4096);
+	if (!ring) {
+		printf("  SKIP (memfd not available)\n");
+		return 0;
+	}
+
+	enc = mux_encoder_new(MUX_CODEC_PCM, 48000, CHANNELS, 1, NULL, 0);
+	if (!enc || mux_ring_write(ring, half, sizeof(half), &written, 0) != MUX_OK) {
+		fprintf(stderr, "  FAIL: setup\n");
+		goto out;
+	}
+
+	t0 = now_ms();
+	r = mux_encoder_encode_ring(enc, ring, 20, &consumed);
+	elapsed = now_ms() - t0;
+	if (r != MUX_OK || consumed != 0 || elapsed < 15) {
+		fprintf(stderr, "  FAIL: ret %d consumed %zu after %.1f ms\n",
+			r, consumed, elapsed);
+		goto out;
+	}
+
+	mux_ring_shutdown(ring);
+	r = mux_encoder_encode_ring(enc, ring, -1, &consumed);
+	if (r != MUX_ERROR_EOF || consumed != 0) {
+		fprintf(stderr, "  FAIL: expected EOF after shutdown, got %d\n", r);
+		goto out;
+	}
+	if (mux_encoder_encode_ring(enc, ring, -1, &consumed) != MUX_ERROR_EOF) {
+		fprintf(stderr, "  FAIL: EOF not sticky\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_encoder_destroy(enc);
+	mux_ring_close(ring);
+	return ret;
+}
+
+/*
+ * Child process produces through an inherited fd; both sides block
+ */
+static int test_cross_process(void)
+{
+	struct mux_ring *ring;
+	static uint8_t buf[3000];
+	size_t total = 0, n, i;
+	int status, ret = 0;
+	pid_t pid;
+
+	printf("Testing cross-process transfer...\n");
+
+	ring = mux_ring_create(8192);
+	if (!ring) {
+		printf("  SKIP (memfd not available)\n");
+		return 0;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		mux_ring_close(ring);
+		return -1;
+	}
+
+	if (pid == 0) {
+		struct mux_ring *prod = mux_ring_open(mux_ring_fd(ring));
+		size_t sent = 0, off;
+
+		if (!prod)
+			_exit(1);
+		while (sent < CROSS_CHUNKS * sizeof(buf)) {
+			for (i = 0; i < sizeof(buf); i++)
+				buf[i] = pattern(sent + i);
+			for (off = 0; off < sizeof(buf); off += n)
+				if (mux_ring_write(prod, buf + off, sizeof(buf) - off,
+						   &n, -1) != MUX_OK)
+					_exit(1);
+			sent += sizeof(buf);
+		}
+		mux_ring_shutdown(prod);
+		mux_ring_close(prod);
+		_exit(0);
+	}
+
+	while (mux_ring_read(ring, buf, sizeof(buf), &n, -1) == MUX_OK) {
+		for (i = 0; i < n; i++) {
+			if (buf[i] != pattern(total + i)) {
+				ret = -1;
+				break;
+			}
+		}
+		total += n;
+	}
+
+	waitpid(pid, &status, 0);
+	mux_ring_close(ring);
+
+	if (ret != 0 || total != CROSS_CHUNKS * sizeof(buf) ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "  FAIL: received %zu bytes\n", total);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+static int test_decode_to_ring(void)
+{
+	struct mux_encoder *enc = NULL;
+	struct mux_decoder *dec = NULL;
+	struct mux_ring *ring;
+	int16_t pcm[960 * CHANNELS], back[960 * CHANNELS];
+	uint8_t stream[16384], side[64];
+	size_t len = 0, consumed, written, n;
+	int stream_type, i, ret = -1;
+
+	printf("Testing decode into ring...\n");
+
+	ring = mux_ring_create(65536);
+	if (!ring) {
+		printf("  SKIP (memfd not available)\n");
+		return 0;
+	}
+
+	for (i = 0; i < 960 * CHANNELS; i++)
+		pcm[i] = (int16_t)(i * 31);
+
+	enc = mux_encoder_new(MUX_CODEC_PCM, 48000, CHANNELS, 2, NULL, 0);
+	dec = mux_decoder_new(MUX_CODEC_PCM, 2, NULL, 0);
+	if (!enc || !dec)
+		goto out;
+
+	mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed, MUX_STREAM_AUDIO);
+	mux_encoder_encode(enc, "cue", 3, &consumed, MUX_STREAM_SIDE_CHANNEL);
+	mux_encoder_finalize(enc);
+	while (mux_encoder_read(enc, stream + len, sizeof(stream) - len,
+				&written) == MUX_OK && written > 0)
+		len += written;
+
+	if (mux_decoder_decode(dec, stream, len, &consumed) != MUX_OK ||
+	    mux_decoder_finalize(dec) != MUX_OK ||
+	    mux_decoder_read_ring(dec, ring, 0, &written) != MUX_OK ||
+	    written != sizeof(pcm)) {
+		fprintf(stderr, "  FAIL: read into ring\n");
+		goto out;
+	}
+
+	if (mux_ring_read(ring, back, sizeof(back), &n, 0) != MUX_OK ||
+	    n != sizeof(back) || memcmp(back, pcm, sizeof(pcm)) != 0) {
+		fprintf(stderr, "  FAIL: ring audio differs\n");
+		goto out;
+	}
+
+	/* Side data is still there for the normal read path */
+	if (mux_decoder_read(dec, side, sizeof(side), &n, &stream_type) != MUX_OK ||
+	    stream_type != MUX_STREAM_SIDE_CHANNEL || n != 3 ||
+	    memcmp(side, "cue", 3) != 0) {
+		fprintf(stderr, "  FAIL: side data lost\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_decoder_destroy(dec);
+	mux_encoder_destroy(enc);
+	mux_ring_close(ring);
+	return ret;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Shared Memory Ring Tests\n");
+	printf("========================\n\n");
+
+	if (test_encode_from_ring() != 0)
+		failures++;
+	if (test_timeout() != 0)
+		failures++;
+	if (test_partial_frame() != 0)
+		failures++;
+	if (test_cross_process() != 0)
+		failures++;
+	if (test_decode_to_ring() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
+
+#else
+
+int main(void)
+{
+	printf("Shared Memory Ring Tests\n");
+	printf("  SKIP (Linux only)\n");
+	return 0;
+}
+
+#endif
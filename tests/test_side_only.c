@@ -0,0 +1,307 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test side-channel-only decoding (side_only decoder parameter)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE     16000
+#define CHANNELS 1
+#define CHUNK    320
+
+static const struct mux_param side_only[] = {
+	{ .name = "side_only", .value.b = 1 },
+};
+
+struct collected {
+	uint8_t side[8192];
+	size_t side_size;
+	size_t audio_size;
+};
+
+static int decode_all(struct mux_decoder *dec, const uint8_t *data,
+		      size_t size, size_t step, struct collected *c)
+{
+	uint8_t out[8192];
+	size_t pos, n, consumed, written;
+	int stream_type;
+
+	memset(c, 0, sizeof(*c));
+
+	for (pos = 0; pos <= size; pos += step) {
+		n = size - pos < step ? size - pos : step;
+		if (n > 0 &&
+		    mux_decoder_decode(dec, data + pos, n, &consumed) != MUX_OK)
+			return -1;
+		if (pos + n == size && mux_decoder_finalize(dec) != MUX_OK)
+			return -1;
+
+		do {
+			stream_type = -1;
+			if (mux_decoder_read(dec, out, sizeof(out), &written,
+					     &stream_type) != MUX_OK)
+				return -1;
+			if (stream_type == MUX_STREAM_AUDIO) {
+				c->audio_size += written;
+			} else if (stream_type == MUX_STREAM_SIDE_CHANNEL) {
+				if (c->side_size + written > sizeof(c->side))
+					return -1;
+				memcpy(c->side + c->side_size, out, written);
+				c->side_size += written;
+			}
+		} while (written > 0);
+
+		if (n == 0)
+			break;
+	}
+
+	return 0;
+}
+
+static int test_leb128(enum mux_codec_type codec)
+{
+	struct mux_encoder *enc;
+	struct mux_decoder *full = NULL, *side = NULL;
+	struct collected a, b;
+	static uint8_t stream[1 << 18];
+	int16_t pcm[CHUNK];
+	char meta[32];
+	size_t len = 0, consumed, written;
+	int i, j, ret = -1;
+
+	printf("Testing %s side-only decode...\n", mux_codec_to_name(codec));
+
+	enc = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	if (!enc)
+		goto out;
+
+	for (i = 0; i < 50; i++) {
+		for (j = 0; j < CHUNK; j++)
+			pcm[j] = (int16_t)((i * CHUNK + j) * 101);
+		mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				   MUX_STREAM_AUDIO);
+		if (i % 3 == 0) {
+			snprintf(meta, sizeof(meta), "event %d", i);
+			mux_encoder_encode(enc, meta, strlen(meta), &consumed,
+					   MUX_STREAM_SIDE_CHANNEL);
+		}
+	}
+	mux_encoder_finalize(enc);
+	while (mux_encoder_read(enc, stream + len, sizeof(stream) - len,
+				&written) == MUX_OK && written > 0)
+		len += written;
+
+	full = mux_decoder_new(codec, 2, NULL, 0);
+	side = mux_decoder_new(codec, 2, side_only, 1);
+	if (!full || !side) {
+		fprintf(stderr, "  FAIL: decoder creation\n");
+		goto out;
+	}
+
+	/* Odd step so frame headers and payloads straddle calls */
+	if (decode_all(full, stream, len, 4096, &a) != 0 ||
+	    decode_all(side, stream, len, 7, &b) != 0) {
+		fprintf(stderr, "  FAIL: decode\n");
+		goto out;
+	}
+
+	if (b.audio_size != 0) {
+		fprintf(stderr, "  FAIL: side-only returned %zu audio bytes\n",
+			b.audio_size);
+		goto out;
+	}
+
+	if (a.side_size == 0 || a.side_size != b.side_size ||
+	    memcmp(a.side, b.side, a.side_size) != 0) {
+		fprintf(stderr, "  FAIL: side data differs (%zu vs %zu bytes)\n",
+			a.side_size, b.side_size);
+		goto out;
+	}
+
+	printf("  PASS (%zu side bytes)\n", b.side_size);
+	ret = 0;
+
+out:
+	mux_decoder_destroy(side);
+	mux_decoder_destroy(full);
+	mux_encoder_destroy(enc);
+	return ret;
+}
+
+/*
+ * Hand-built Ogg pages, so the Ogg path is covered without libogg
+ */
+static uint32_t ogg_crc(const uint8_t *data, size_t size)
+{
+	uint32_t crc = 0;
+	size_t i;
+	int bit;
+
+	for (i = 0; i < size; i++) {
+		crc ^= (uint32_t)data[i] << 24;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000u) ? (crc << 1) ^ 0x04c11db7u :
+						    crc << 1;
+	}
+
+	return crc;
+}
+
+static size_t ogg_page(uint8_t *out, int flags, uint32_t serial,
+		       const uint8_t *lacing, int nsegs,
+		       const uint8_t *body, size_t body_size)
+{
+	static uint32_t pageno;
+	size_t len = 27 + nsegs + body_size;
+	uint32_t crc;
+	int i;
+
+	memcpy(out, "OggS", 4);
+	out[4] = 0;
+	out[5] = (uint8_t)flags;
+	memset(out + 6, 0, 8);
+	for (i = 0; i < 4; i++) {
+		out[14 + i] = (uint8_t)(serial >> (8 * i));
+		out[18 + i] = (uint8_t)(pageno >> (8 * i));
+		out[22 + i] = 0;
+	}
+	out[26] = (uint8_t)nsegs;
+	memcpy(out + 27, lacing, nsegs);
+	memcpy(out + 27 + nsegs, body, body_size);
+
+	crc = ogg_crc(out, len);
+	for (i = 0; i < 4; i++)
+		out[22 + i] = (uint8_t)(crc >> (8 * i));
+
+	pageno++;
+	return len;
+}
+
+static int test_ogg(void)
+{
+	static uint8_t stream[8192], body[1024], expect[1024];
+	struct mux_decoder *dec;
+	struct collected c;
+	uint8_t lacing[8];
+	size_t len = 0, expect_len = 0, bad;
+	size_t steps[] = { 1, 13, sizeof(stream) };
+	int i, ret = 0;
+
+	printf("Testing Ogg side-only decode...\n");
+
+	/* Audio and side stream headers */
+	memset(body, 'A', sizeof(body));
+	lacing[0] = 19;
+	len += ogg_page(stream + len, 0x02, 1, lacing, 1, body, 19);
+	lacing[0] = 4;
+	len += ogg_page(stream + len, 0x02, 2, lacing, 1,
+			(const uint8_t *)"SIDE", 4);
+
+	/* Two side packets on one page */
+	lacing[0] = 5;
+	lacing[1] = 5;
+	len += ogg_page(stream + len, 0, 2, lacing, 2,
+			(const uint8_t *)"helloworld", 10);
+	memcpy(expect + expect_len, "helloworld", 10);
+	expect_len += 10;
+
+	/* A 300 byte side packet split around an audio page */
+	for (i = 0; i < 300; i++)
+		expect[expect_len + i] = (uint8_t)i;
+	lacing[0] = 255;
+	len += ogg_page(stream + len, 0, 2, lacing, 1, expect + expect_len, 255);
+	lacing[0] = 200;
+	len += ogg_page(stream + len, 0, 1, lacing, 1, body, 200);
+	lacing[0] = 45;
+	lacing[1] = 4;
+	memcpy(body + 512, expect + expect_len + 255, 45);
+	memcpy(body + 512 + 45, "tail", 4);
+	len += ogg_page(stream + len, 0x01, 2, lacing, 2, body + 512, 49);
+	memcpy(expect + expect_len + 300, "tail", 4);
+	expect_len += 304;
+
+	/* Garbage, then a side page with a broken checksum */
+	memcpy(stream + len, "xxOggSjunk", 10);
+	len += 10;
+	lacing[0] = 3;
+	bad = len;
+	len += ogg_page(stream + len, 0, 2, lacing, 1,
+			(const uint8_t *)"bad", 3);
+	stream[bad + 22] ^= 0x55;
+
+	/* End of stream */
+	lacing[0] = 4;
+	len += ogg_page(stream + len, 0, 2, lacing, 1,
+			(const uint8_t *)"last", 4);
+	memcpy(expect + expect_len, "last", 4);
+	expect_len += 4;
+	lacing[0] = 0;
+	len += ogg_page(stream + len, 0x04, 2, lacing, 1, body, 0);
+
+	for (i = 0; i < (int)(sizeof(steps) / sizeof(steps[0])); i++) {
+		/* Works without the Opus library being compiled in */
+		dec = mux_decoder_new(MUX_CODEC_OPUS, 2, side_only, 1);
+		if (!dec) {
+			fprintf(stderr, "  FAIL: decoder creation\n");
+			return -1;
+		}
+
+		if (decode_all(dec, stream, len, steps[i], &c) != 0 ||
+		    c.audio_size != 0 || c.side_size != expect_len ||
+		    memcmp(c.side, expect, expect_len) != 0) {
+			fprintf(stderr, "  FAIL: step %zu: %zu side bytes, expected %zu\n",
+				steps[i], c.side_size, expect_len);
+			ret = -1;
+		}
+
+		mux_decoder_destroy(dec);
+	}
+
+	if (ret == 0)
+		printf("  PASS\n");
+	return ret;
+}
+
+static int test_invalid(void)
+{
+	struct mux_decoder *dec;
+
+	printf("Testing side-only validation...\n");
+
+	dec = mux_decoder_new(MUX_CODEC_PCM, 1, side_only, 1);
+	if (dec) {
+		fprintf(stderr, "  FAIL: passthrough stream accepted\n");
+		mux_decoder_destroy(dec);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Side-Only Decode Tests\n");
+	printf("======================\n\n");
+
+	if (test_leb128(MUX_CODEC_PCM) != 0)
+		failures++;
+	if (test_leb128(MUX_CODEC_ALAW) != 0)
+		failures++;
+	if (test_ogg() != 0)
+		failures++;
+	if (test_invalid() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
@@ -0,0 +1,373 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test encoder/decoder snapshot and restore
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+#include "test_utils.h"
+
+#define RATE     16000
+#define CHANNELS 1
+
+static int test_encoder(enum mux_codec_type codec, int optional)
+{
+	struct mux_encoder *a, *b;
+	uint8_t *blob, *out_a, *out_b;
+	size_t blob_size, written, len_a, len_b;
+	const size_t out_size = 1 << 20;
+	int ret = -1;
+
+	printf("Testing %s encoder snapshot...\n", mux_codec_to_name(codec));
+
+	a = mux_encoder_new(codec, RATE, CHANNELS, 2, NULL, 0);
+	if (!a) {
+		if (optional) {
+			printf("  SKIP (codec not available)\n");
+			return 0;
+		}
+		fprintf(stderr, "  FAIL: mux_encoder_new\n");
+		return -1;
+	}
+
+	out_a = malloc(out_size);
+	out_b = malloc(out_size);
+	blob = NULL;
+	b = NULL;
+	if (!out_a || !out_b)
+		goto out;
+
+	/* Leave output unread so it must travel with the snapshot */
+	if (feed_session(a, 0, 7) != 0)
+		goto out;
+
+	if (mux_encoder_snapshot(a, NULL, 0, &blob_size) != MUX_OK) {
+		fprintf(stderr, "  FAIL: size query\n");
+		goto out;
+	}
+
+	blob = malloc(blob_size);
+	if (!blob)
+		goto out;
+
+	if (mux_encoder_snapshot(a, blob, blob_size - 1, &written) !=
+	    MUX_ERROR_INVAL || written != blob_size) {
+		fprintf(stderr, "  FAIL: short buffer not reported\n");
+		goto out;
+	}
+
+	if (mux_encoder_snapshot(a, blob, blob_size, &written) != MUX_OK ||
+	    written != blob_size) {
+		fprintf(stderr, "  FAIL: snapshot\n");
+		goto out;
+	}
+
+	b = mux_encoder_new_from_snapshot(blob, blob_size);
+	if (!b) {
+		fprintf(stderr, "  FAIL: restore\n");
+		goto out;
+	}
+
+	/* Both sessions must continue byte for byte */
+	if (feed_session(a, 7, 13) != 0 || feed_session(b, 7, 13) != 0 ||
+	    mux_encoder_finalize(a) != MUX_OK ||
+	    mux_encoder_finalize(b) != MUX_OK) {
+		fprintf(stderr, "  FAIL: encode after restore\n");
+		goto out;
+	}
+
+	len_a = drain_session(a, out_a, out_size);
+	len_b = drain_session(b, out_b, out_size);
+	if (len_a == 0 || len_a != len_b || memcmp(out_a, out_b, len_a) != 0) {
+		fprintf(stderr, "  FAIL: output differs (%zu vs %zu bytes)\n",
+			len_a, len_b);
+		goto out;
+	}
+
+	printf("  PASS (%zu byte snapshot)\n", blob_size);
+	ret = 0;
+
+out:
+	mux_encoder_destroy(b);
+	mux_encoder_destroy(a);
+	free(blob);
+	free(out_b);
+	free(out_a);
+	return ret;
+}
+
+static int test_decoder(void)
+{
+	struct mux_encoder *enc;
+	struct mux_decoder *a, *b = NULL;
+	uint8_t stream[8192], blob[8192], out[8192];
+	size_t len, half, consumed, blob_size, written, total_a = 0, total_b = 0;
+	int stream_type;
+	int ret = -1;
+
+	printf("Testing decoder snapshot with a partial frame...\n");
+
+	enc = mux_encoder_new(MUX_CODEC_ALAW, RATE, CHANNELS, 2, NULL, 0);
+	a = mux_decoder_new(MUX_CODEC_ALAW, 2, NULL, 0);
+	if (!enc || !a)
+		goto out;
+
+	if (feed_session(enc, 0, 4) != 0)
+		goto out;
+	len = drain_session(enc, stream, sizeof(stream));
+
+	/* Split in the middle of a frame */
+	half = len / 2 + 3;
+	if (mux_decoder_decode(a, stream, half, &consumed) != MUX_OK)
+		goto out;
+
+	if (mux_decoder_snapshot(a, blob, sizeof(blob), &blob_size) != MUX_OK) {
+		fprintf(stderr, "  FAIL: snapshot\n");
+		goto out;
+	}
+
+	b = mux_decoder_new_from_snapshot(blob, blob_size);
+	if (!b) {
+		fprintf(stderr, "  FAIL: restore\n");
+		goto out;
+	}
+
+	if (mux_decoder_decode(a, stream + half, len - half, &consumed) != MUX_OK ||
+	    mux_decoder_decode(b, stream + half, len - half, &consumed) != MUX_OK)
+		goto out;
+
+	do {
+		stream_type = -1;
+		mux_decoder_read(a, out, sizeof(out), &written, &stream_type);
+		total_a += written;
+	} while (written > 0);
+
+	do {
+		stream_type = -1;
+		mux_decoder_read(b, out, sizeof(out), &written, &stream_type);
+		total_b += written;
+	} while (written > 0);
+
+	/* b never saw the first half directly; it must still yield everything */
+	if (total_b != total_a ||
+	    total_a != 4 * SESSION_CHUNK * sizeof(int16_t) + 4) {
+		fprintf(stderr, "  FAIL: decoded %zu vs %zu bytes\n",
+			total_a, total_b);
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_decoder_destroy(b);
+	mux_decoder_destroy(a);
+	mux_encoder_destroy(enc);
+	return ret;
+}
+
+/* A decoder made from a blob gets the params of the original */
+static int test_params(void)
+{
+	struct mux_param limit = { .name = "max_decode_input", .value.i = 16 };
+	struct mux_decoder *a, *b = NULL;
+	uint8_t blob[4096], input[100];
+	size_t blob_size, consumed = 0;
+	int ret = -1;
+
+	printf("Testing decoder params travel with the snapshot...\n");
+
+	a = mux_decoder_new(MUX_CODEC_PCM, 2, &limit, 1);
+	if (!a || mux_decoder_snapshot(a, blob, sizeof(blob),
+				       &blob_size) != MUX_OK)
+		goto out;
+
+	b = mux_decoder_new_from_snapshot(blob, blob_size);
+	memset(input, 0, sizeof(input));
+	if (!b || mux_decoder_decode(b, input, sizeof(input),
+				     &consumed) != MUX_OK || consumed != 16) {
+		fprintf(stderr, "  FAIL: %zu bytes taken, limit was 16\n",
+			consumed);
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_decoder_destroy(b);
+	mux_decoder_destroy(a);
+	return ret;
+}
+
+/* A blob with trailing bytes must not touch the codec's own input */
+static int test_trailing(void)
+{
+	struct mux_encoder *enc;
+	struct mux_decoder *a, *b = NULL;
+	uint8_t stream[8192], blob[8192], out[8192];
+	size_t len, half, consumed, blob_size, written, total = 0;
+	int stream_type;
+	int ret = -1;
+
+	printf("Testing decoder restore with trailing bytes...\n");
+
+	enc = mux_encoder_new(MUX_CODEC_ALAW, RATE, CHANNELS, 2, NULL, 0);
+	a = mux_decoder_new(MUX_CODEC_ALAW, 2, NULL, 0);
+	b = mux_decoder_new(MUX_CODEC_ALAW, 2, NULL, 0);
+	if (!enc || !a || !b)
+		goto out;
+
+	if (feed_session(enc, 0, 4) != 0)
+		goto out;
+	len = drain_session(enc, stream, sizeof(stream));
+
+	/* a and b each hold a different partial frame */
+	half = len / 2 + 3;
+	if (mux_decoder_decode(a, stream, half, &consumed) != MUX_OK ||
+	    mux_decoder_decode(b, stream, 3, &consumed) != MUX_OK ||
+	    mux_decoder_snapshot(b, blob, sizeof(blob) - 1,
+				 &blob_size) != MUX_OK)
+		goto out;
+
+	blob[blob_size] = 0;
+	if (mux_decoder_restore(a, blob, blob_size + 1) != MUX_ERROR_FORMAT) {
+		fprintf(stderr, "  FAIL: trailing bytes accepted\n");
+		goto out;
+	}
+
+	if (mux_decoder_decode(a, stream + half, len - half,
+			       &consumed) != MUX_OK)
+		goto out;
+	do {
+		stream_type = -1;
+		mux_decoder_read(a, out, sizeof(out), &written, &stream_type);
+		total += written;
+	} while (written > 0);
+
+	if (total != 4 * SESSION_CHUNK * sizeof(int16_t) + 4) {
+		fprintf(stderr, "  FAIL: decoded %zu bytes after failed restore\n",
+			total);
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_decoder_destroy(b);
+	mux_decoder_destroy(a);
+	mux_encoder_destroy(enc);
+	return ret;
+}
+
+static int test_mismatch(void)
+{
+	struct mux_encoder *pcm, *alaw;
+	uint8_t blob[4096], out[4096];
+	size_t blob_size;
+	int ret = -1;
+
+	printf("Testing restore validation...\n");
+
+	pcm = mux_encoder_new(MUX_CODEC_PCM, RATE, CHANNELS, 2, NULL, 0);
+	alaw = mux_encoder_new(MUX_CODEC_ALAW, RATE, CHANNELS, 2, NULL, 0);
+	if (!pcm || !alaw)
+		goto out;
+
+	if (mux_encoder_snapshot(pcm, blob, sizeof(blob), &blob_size) != MUX_OK)
+		goto out;
+
+	if (mux_encoder_restore(alaw, blob, blob_size) != MUX_ERROR_INVAL) {
+		fprintf(stderr, "  FAIL: codec mismatch accepted\n");
+		goto out;
+	}
+
+	/* A failed restore leaves the encoder's own output alone */
+	if (feed_session(pcm, 0, 3) != 0)
+		goto out;
+	if (mux_encoder_restore(pcm, blob, blob_size - 1) != MUX_ERROR_FORMAT) {
+		fprintf(stderr, "  FAIL: truncated snapshot accepted\n");
+		goto out;
+	}
+	if (drain_session(pcm, out, sizeof(out)) < 3 * sizeof(int16_t) * SESSION_CHUNK) {
+		fprintf(stderr, "  FAIL: failed restore dropped pending output\n");
+		goto out;
+	}
+
+	blob[0] ^= 0xff;
+	if (mux_encoder_restore(pcm, blob, blob_size) != MUX_ERROR_FORMAT ||
+	    mux_encoder_new_from_snapshot(blob, blob_size) != NULL) {
+		fprintf(stderr, "  FAIL: bad magic accepted\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_encoder_destroy(alaw);
+	mux_encoder_destroy(pcm);
+	return ret;
+}
+
+static int test_unsupported(void)
+{
+	struct mux_encoder *enc;
+	size_t blob_size;
+	int ret;
+
+	printf("Testing unsupported codec...\n");
+
+	enc = mux_encoder_new(MUX_CODEC_AMR, 8000, 1, 2, NULL, 0);
+	if (!enc) {
+		printf("  SKIP (codec not available)\n");
+		return 0;
+	}
+
+	ret = mux_encoder_snapshot(enc, NULL, 0, &blob_size);
+	mux_encoder_destroy(enc);
+
+	if (ret != MUX_ERROR_UNSUPPORTED) {
+		fprintf(stderr, "  FAIL: expected MUX_ERROR_UNSUPPORTED, got %d\n",
+			ret);
+		return -1;
+	}
+
+	printf("  PASS\n");
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Snapshot Tests\n");
+	printf("==============\n\n");
+
+	if (test_encoder(MUX_CODEC_PCM, 0) != 0)
+		failures++;
+	if (test_encoder(MUX_CODEC_ALAW, 0) != 0)
+		failures++;
+	if (test_encoder(MUX_CODEC_OPUS, 1) != 0)
+		failures++;
+	if (test_decoder() != 0)
+		failures++;
+	if (test_params() != 0)
+		failures++;
+	if (test_trailing() != 0)
+		failures++;
+	if (test_mismatch() != 0)
+		failures++;
+	if (test_unsupported() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
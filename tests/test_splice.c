@@ -0,0 +1,398 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test splicing pre-encoded clips into live encoders: G.711 calls play
+ * the same audio as if the clip had been encoded live, clips come from
+ * memory or a pack and may be framed differently from the call, Ogg
+ * codecs keep a decodable stream, and mismatched clips are refused
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE       8000
+#define CLIP_LEN   (RATE * 2)
+#define LIVE_LEN   1000           /* not a multiple of any frame size */
+#define PACK_PATH  "test_splice.muxpack"
+#define STREAM_MAX (1 << 20)
+
+static int16_t live1[LIVE_LEN * 2], live2[LIVE_LEN * 2];
+static int16_t prompt[48000 * 2];
+static uint8_t clip_buf[STREAM_MAX], stream[STREAM_MAX];
+static int16_t pcm_a[STREAM_MAX / 2], pcm_b[STREAM_MAX / 2];
+
+static void fill(int16_t *pcm, size_t samples, int seed)
+{
+	size_t i;
+
+	for (i = 0; i < samples; i++)
+		pcm[i] = (int16_t)(((seed * 977 + (int)i) * 2731) % 24000 -
+				   12000);
+}
+
+static size_t drain(struct mux_encoder *enc, uint8_t *out, size_t len)
+{
+	size_t written;
+
+	while (len < STREAM_MAX &&
+	       mux_encoder_read(enc, out + len, STREAM_MAX - len, &written) ==
+	       MUX_OK && written > 0)
+		len += written;
+	return len;
+}
+
+static int encode(struct mux_encoder *enc, const int16_t *pcm, size_t samples)
+{
+	size_t consumed;
+
+	return mux_encoder_encode(enc, pcm, samples * sizeof(*pcm), &consumed,
+				  MUX_STREAM_AUDIO);
+}
+
+/* A whole stream with a side channel packet the splice must drop */
+static int make_clip(enum mux_codec_type codec, int rate, int channels,
+		     int num_streams, const struct mux_param *params,
+		     int num_params, size_t frames, struct mux_clip *clip)
+{
+	struct mux_encoder *enc;
+	size_t consumed;
+	int ok;
+
+	enc = mux_encoder_new(codec, rate, channels, num_streams, params,
+			      num_params);
+	if (!enc)
+		return -1;
+
+	fill(prompt, frames * (size_t)channels, 7);
+	ok = encode(enc, prompt, frames * (size_t)channels) == MUX_OK &&
+	     (num_streams == 1 ||
+	      mux_encoder_encode(enc, "prompt", 6, &consumed,
+				 MUX_STREAM_SIDE_CHANNEL) == MUX_OK) &&
+	     mux_encoder_finalize(enc) == MUX_OK;
+
+	memset(clip, 0, sizeof(*clip));
+	clip->codec_type = codec;
+	clip->num_streams = num_streams;
+	clip->sample_rate = rate;
+	clip->num_channels = channels;
+	clip->duration = frames;
+	clip->data = clip_buf;
+	clip->size = drain(enc, clip_buf, 0);
+	mux_encoder_destroy(enc);
+	return ok && clip->size > 0 ? 0 : -1;
+}
+
+/* Audio samples of a whole stream, -1 on error */
+static long decode(enum mux_codec_type codec, int num_streams,
+		   const uint8_t *data, size_t len, int16_t *pcm,
+		   int *side_bytes)
+{
+	struct mux_decoder *dec;
+	size_t consumed, written, total = 0;
+	static uint8_t buf[4096];
+	int type, ret;
+
+	dec = mux_decoder_new(codec, num_streams, NULL, 0);
+	if (!dec)
+		return -1;
+
+	*side_bytes = 0;
+	ret = mux_decoder_decode(dec, data, len, &consumed);
+	if (ret == MUX_OK && consumed != len)
+		ret = MUX_ERROR_FORMAT;
+	if (ret == MUX_OK)
+		ret = mux_decoder_finalize(dec);
+
+	while (ret == MUX_OK) {
+		ret = mux_decoder_read(dec, buf, sizeof(buf), &written, &type);
+		if (ret != MUX_OK || written == 0)
+			break;
+		if (type != MUX_STREAM_AUDIO) {
+			*side_bytes += (int)written;
+		} else if ((total + written / sizeof(*pcm)) * sizeof(*pcm) <=
+			   STREAM_MAX) {
+			memcpy(pcm + total, buf, written);
+			total += written / sizeof(*pcm);
+		}
+	}
+	mux_decoder_destroy(dec);
+	return ret == MUX_OK ? (long)total : -1;
+}
+
+/*
+ * live1, clip, live2 through enc; the reference encodes the same PCM
+ * live with ref
+ */
+static int play(struct mux_encoder *enc, struct mux_encoder *ref,
+		const struct mux_clip *clip, size_t *len, size_t *ref_len)
+{
+	fill(live1, LIVE_LEN, 1);
+	fill(live2, LIVE_LEN, 2);
+
+	if (encode(enc, live1, LIVE_LEN) != MUX_OK ||
+	    mux_encoder_splice(enc, clip) != MUX_OK ||
+	    encode(enc, live2, LIVE_LEN) != MUX_OK ||
+	    mux_encoder_finalize(enc) != MUX_OK)
+		return -1;
+	*len = drain(enc, stream, 0);
+
+	if (!ref)
+		return 0;
+	if (encode(ref, live1, LIVE_LEN) != MUX_OK ||
+	    encode(ref, prompt, (size_t)clip->duration *
+		   (size_t)clip->num_channels) != MUX_OK ||
+	    encode(ref, live2, LIVE_LEN) != MUX_OK ||
+	    mux_encoder_finalize(ref) != MUX_OK)
+		return -1;
+	*ref_len = drain(ref, clip_buf, 0);
+	return 0;
+}
+
+static int same_audio(enum mux_codec_type codec, int num_streams,
+		      size_t len, size_t ref_len)
+{
+	long a, b;
+	int side_a, side_b;
+
+	a = decode(codec, num_streams, stream, len, pcm_a, &side_a);
+	b = decode(codec, num_streams, clip_buf, ref_len, pcm_b, &side_b);
+	return a > 0 && a == b && side_a == 0 &&
+	       memcmp(pcm_a, pcm_b, (size_t)a * sizeof(*pcm_a)) == 0 ? 0 : -1;
+}
+
+static int test_g711(void)
+{
+	struct mux_encoder *enc, *ref;
+	struct mux_clip clip;
+	size_t len = 0, ref_len = 0;
+	int ret;
+
+	printf("Test: A-law prompt spliced into a call\n");
+
+	if (make_clip(MUX_CODEC_ALAW, RATE, 1, 2, NULL, 0, CLIP_LEN,
+		      &clip) != 0) {
+		printf("  FAIL: Could not encode the clip\n");
+		return -1;
+	}
+
+	enc = mux_encoder_new(MUX_CODEC_ALAW, RATE, 1, 2, NULL, 0);
+	ref = mux_encoder_new(MUX_CODEC_ALAW, RATE, 1, 2, NULL, 0);
+	ret = enc && ref ? play(enc, ref, &clip, &len, &ref_len) : -1;
+	mux_encoder_destroy(enc);
+	mux_encoder_destroy(ref);
+
+	if (ret != 0 || same_audio(MUX_CODEC_ALAW, 2, len, ref_len) != 0) {
+		printf("  FAIL: Spliced call differs from live encoding\n");
+		return -1;
+	}
+
+	printf("  PASS: %zu bytes, same audio as encoding the prompt live\n",
+	       len);
+	return 0;
+}
+
+/* A raw mu-law clip from a pack into LEB128 and raw calls */
+static int test_pack(void)
+{
+	struct mux_pack_writer *w;
+	struct mux_pack *pack;
+	struct mux_encoder *enc, *ref;
+	struct mux_clip clip;
+	size_t len = 0, ref_len = 0;
+	int streams, ret = 0;
+
+	printf("Test: Mu-law prompt from a pack\n");
+
+	if (make_clip(MUX_CODEC_MULAW, RATE, 2, 1, NULL, 0, CLIP_LEN,
+		      &clip) != 0)
+		return -1;
+	clip.id = 42;
+
+	w = mux_pack_writer_new(PACK_PATH);
+	if (!w || mux_pack_writer_add(w, &clip) != MUX_OK ||
+	    mux_pack_writer_finish(w) != MUX_OK) {
+		printf("  FAIL: Could not write the pack\n");
+		mux_pack_writer_destroy(w);
+		return -1;
+	}
+	mux_pack_writer_destroy(w);
+
+	pack = mux_pack_open(PACK_PATH);
+	if (!pack || mux_pack_find(pack, 42, &clip) != MUX_OK) {
+		printf("  FAIL: Could not find the clip\n");
+		mux_pack_close(pack);
+		return -1;
+	}
+
+	for (streams = 1; streams <= 2 && ret == 0; streams++) {
+		enc = mux_encoder_new(MUX_CODEC_MULAW, RATE, 2, streams,
+				      NULL, 0);
+		ref = mux_encoder_new(MUX_CODEC_MULAW, RATE, 2, streams,
+				      NULL, 0);
+		ret = enc && ref ? play(enc, ref, &clip, &len, &ref_len) : -1;
+		if (ret == 0)
+			ret = same_audio(MUX_CODEC_MULAW, streams, len,
+					 ref_len);
+		mux_encoder_destroy(enc);
+		mux_encoder_destroy(ref);
+	}
+	mux_pack_close(pack);
+	remove(PACK_PATH);
+
+	if (ret != 0) {
+		printf("  FAIL: Spliced call with %d stream(s) differs\n",
+		       streams - 1);
+		return -1;
+	}
+
+	printf("  PASS: Raw and framed calls match live encoding\n");
+	return 0;
+}
+
+static int test_refused(void)
+{
+	struct mux_encoder *enc;
+	struct mux_clip clip;
+	struct mux_rate_stats st;
+	int16_t odd[3] = { 0 };
+	/* A whole frame, then one of a sample and a half */
+	static const uint8_t bad[] = { 0x04, 1, 2, 0x06, 3, 4, 5 };
+	int ok;
+
+	printf("Test: Mismatched and cut clips\n");
+
+	if (make_clip(MUX_CODEC_PCM, RATE, 1, 2, NULL, 0, 800, &clip) != 0)
+		return -1;
+
+	enc = mux_encoder_new(MUX_CODEC_PCM, RATE, 2, 2, NULL, 0);
+	ok = enc && mux_encoder_splice(enc, &clip) == MUX_ERROR_INVAL;
+	mux_encoder_destroy(enc);
+
+	enc = mux_encoder_new(MUX_CODEC_PCM, 16000, 1, 2, NULL, 0);
+	ok = ok && enc && mux_encoder_splice(enc, &clip) == MUX_ERROR_INVAL;
+	mux_encoder_destroy(enc);
+
+	enc = mux_encoder_new(MUX_CODEC_ALAW, RATE, 1, 2, NULL, 0);
+	ok = ok && enc && mux_encoder_splice(enc, &clip) == MUX_ERROR_INVAL;
+	mux_encoder_destroy(enc);
+
+	/*
+	 * Cut inside the last frame; a PCM frame of half a sample; a bad
+	 * frame after a good one. None of them may leave anything behind.
+	 */
+	enc = mux_encoder_new(MUX_CODEC_PCM, RATE, 1, 2, NULL, 0);
+	clip.size--;
+	ok = ok && enc && mux_encoder_splice(enc, &clip) == MUX_ERROR_FORMAT;
+	clip.data = (const uint8_t *)odd;
+	clip.size = 0;
+	clip.header = (const uint8_t *)"\x06\x00\x00";
+	clip.header_size = 4;
+	ok = ok && mux_encoder_splice(enc, &clip) == MUX_ERROR_FORMAT;
+	clip.data = bad;
+	clip.size = sizeof(bad);
+	clip.header_size = 0;
+	ok = ok && mux_encoder_splice(enc, &clip) == MUX_ERROR_FORMAT &&
+	     drain(enc, stream, 0) == 0;
+	mux_encoder_destroy(enc);
+
+	/* Spliced bytes count against a rate limit */
+	if (ok && make_clip(MUX_CODEC_ALAW, RATE, 1, 2, NULL, 0, CLIP_LEN,
+			    &clip) == 0) {
+		enc = mux_encoder_new(MUX_CODEC_ALAW, RATE, 1, 2, NULL, 0);
+		ok = enc && mux_encoder_set_rate_limit(enc, 80000, 200) ==
+		     MUX_OK && mux_encoder_splice(enc, &clip) == MUX_OK &&
+		     mux_encoder_get_rate_stats(enc, &st) == MUX_OK &&
+		     st.bytes >= CLIP_LEN;
+		mux_encoder_destroy(enc);
+	} else {
+		ok = 0;
+	}
+
+	if (!ok) {
+		printf("  FAIL: Bad clip not refused\n");
+		return -1;
+	}
+
+	printf("  PASS: Wrong format refused, bad and cut clips add nothing\n");
+	return 0;
+}
+
+/*
+ * Ogg codecs: a clip spliced mid-frame into a call decodes to about
+ * the sum of the parts
+ */
+static int test_ogg(enum mux_codec_type codec, const char *name, int rate)
+{
+	struct mux_param q = { .name = "quality", .value.f = 0.2f };
+	struct mux_encoder *enc;
+	struct mux_clip clip;
+	size_t len = 0, clip_frames = (size_t)rate;
+	long got, want;
+	int side;
+
+	printf("Test: %s prompt spliced mid-frame\n", name);
+
+	enc = mux_encoder_new(codec, rate, 2, 2, NULL, 0);
+	if (!enc) {
+		printf("  SKIP (%s not available)\n", name);
+		return 0;
+	}
+	if (make_clip(codec, rate, 2, 2, NULL, 0, clip_frames, &clip) != 0 ||
+	    play(enc, NULL, &clip, &len, NULL) != 0) {
+		printf("  FAIL: Splicing failed\n");
+		mux_encoder_destroy(enc);
+		return -1;
+	}
+	mux_encoder_destroy(enc);
+
+	/* Live audio is padded at the splice; codec delay trims a little */
+	got = decode(codec, 2, stream, len, pcm_a, &side) / 2;
+	want = LIVE_LEN + (long)clip_frames;
+	if (got < want - rate / 50 || got > want + rate / 10 || side != 0) {
+		printf("  FAIL: %ld frames decoded, %ld expected\n", got, want);
+		return -1;
+	}
+
+	/* A clip made with other settings */
+	if (codec == MUX_CODEC_VORBIS) {
+		enc = mux_encoder_new(codec, rate, 2, 2, NULL, 0);
+		if (!enc || make_clip(codec, rate, 2, 2, &q, 1, clip_frames,
+				      &clip) != 0 ||
+		    mux_encoder_splice(enc, &clip) != MUX_ERROR_FORMAT) {
+			printf("  FAIL: Clip with another setup accepted\n");
+			mux_encoder_destroy(enc);
+			return -1;
+		}
+		mux_encoder_destroy(enc);
+	}
+
+	printf("  PASS: %ld frames decoded, %ld expected\n", got, want);
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Splice Tests\n");
+	printf("============\n\n");
+
+	if (test_g711() != 0)
+		failures++;
+	if (test_pack() != 0)
+		failures++;
+	if (test_refused() != 0)
+		failures++;
+	if (test_ogg(MUX_CODEC_OPUS, "Opus", 48000) != 0)
+		failures++;
+	if (test_ogg(MUX_CODEC_VORBIS, "Vorbis", 44100) != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
@@ -0,0 +1,507 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test keyed side channel state: deltas and snapshots rebuild the
+ * writer's map on the decoder with one event per change, a listener
+ * joining mid-stream catches up at the next snapshot, records cut up
+ * by rate control still parse, a lost record is noticed, a marker
+ * inside a value does not hold up a late joiner, a delta too big for
+ * one record goes out as a snapshot, and Ogg side streams carry state
+ * like LEB128 ones
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE       8000
+#define TICK       (RATE / 50)
+#define TICKS      150            /* 3 s */
+#define STREAM_MAX (1 << 22)
+
+static int16_t pcm[48000 / 50];
+static uint8_t stream[STREAM_MAX];
+static size_t tick_end[TICKS + 1];  /* stream bytes after each tick */
+static uint8_t out[1 << 16];
+
+/* What the writer holds after tick t */
+static void expected(int t, char *level, size_t level_size, int *has_title)
+{
+	snprintf(level, level_size, "%d", -(t % 40));
+	*has_title = t < 100;
+}
+
+/* Levels change every tick, the title goes at tick 100 */
+static int make_stream(enum mux_codec_type codec, int rate, int snapshot_ms,
+		       int rate_bps, size_t *len)
+{
+	static char title[1000];
+	struct mux_encoder *enc;
+	char level[16];
+	size_t consumed, written, frames = (size_t)rate / 50;
+	int t, ret, has_title;
+
+	enc = mux_encoder_new(codec, rate, 1, 2, NULL, 0);
+	if (!enc)
+		return 1;
+
+	ret = mux_encoder_set_state(enc, snapshot_ms);
+	if (ret == MUX_OK && rate_bps)
+		ret = mux_encoder_set_rate_limit(enc, rate_bps, 20);
+	/* Under rate control, snapshots too big to go out in one piece */
+	memset(title, 'x', sizeof(title));
+	if (ret == MUX_OK)
+		ret = mux_encoder_state_set(enc, "title", title,
+					    rate_bps ? sizeof(title) : 10);
+
+	*len = 0;
+	for (t = 0; t < TICKS && ret == MUX_OK; t++) {
+		expected(t, level, sizeof(level), &has_title);
+		ret = mux_encoder_state_set(enc, "level", level, strlen(level));
+		if (ret == MUX_OK && t == 100)
+			ret = mux_encoder_state_delete(enc, "title");
+		if (ret == MUX_OK)
+			ret = mux_encoder_encode(enc, pcm, frames * sizeof(*pcm),
+						 &consumed, MUX_STREAM_AUDIO);
+		while (ret == MUX_OK &&
+		       mux_encoder_read(enc, stream + *len, STREAM_MAX - *len,
+					&written) == MUX_OK && written > 0)
+			*len += written;
+		tick_end[t] = *len;
+	}
+	if (ret == MUX_OK)
+		ret = mux_encoder_finalize(enc);
+	while (ret == MUX_OK &&
+	       mux_encoder_read(enc, stream + *len, STREAM_MAX - *len,
+				&written) == MUX_OK && written > 0)
+		*len += written;
+
+	mux_encoder_destroy(enc);
+	return ret == MUX_OK ? 0 : -1;
+}
+
+struct listen {
+	int events;
+	int deletes;
+	size_t audio;
+	size_t side;
+	struct mux_state_stats stats;
+};
+
+/* Decode data, counting events and what reaches the caller */
+static int listen(enum mux_codec_type codec, const uint8_t *data, size_t len,
+		  struct mux_decoder **decp, struct listen *l)
+{
+	struct mux_decoder *dec;
+	struct mux_state_event ev;
+	size_t pos = 0, consumed, written;
+	int type, ret;
+
+	memset(l, 0, sizeof(*l));
+	dec = mux_decoder_new(codec, 2, NULL, 0);
+	if (!dec)
+		return -1;
+	ret = mux_decoder_set_state(dec, 1);
+
+	while (ret == MUX_OK && pos < len) {
+		size_t n = len - pos < 1000 ? len - pos : 1000;
+
+		ret = mux_decoder_decode(dec, data + pos, n, &consumed);
+		pos += consumed;
+		while (ret == MUX_OK &&
+		       (ret = mux_decoder_read(dec, out, sizeof(out), &written,
+					       &type)) == MUX_OK && written > 0) {
+			if (type == MUX_STREAM_AUDIO)
+				l->audio += written;
+			else
+				l->side += written;
+		}
+		while (ret == MUX_OK &&
+		       mux_decoder_state_next_event(dec, &ev) == MUX_OK) {
+			l->events++;
+			l->deletes += ev.change == MUX_STATE_DELETED;
+		}
+		if (ret == MUX_OK && consumed == 0 && n > 0)
+			break;
+	}
+	if (ret == MUX_OK)
+		ret = mux_decoder_get_state_stats(dec, &l->stats);
+
+	*decp = dec;
+	return ret == MUX_OK ? 0 : -1;
+}
+
+/* The decoder's map matches the writer's after the last tick */
+static int same_map(struct mux_decoder *dec)
+{
+	const void *value;
+	size_t size;
+	char level[16];
+	int title;
+
+	expected(TICKS - 1, level, sizeof(level), &title);
+	return mux_decoder_state_get(dec, "level", &value, &size) == MUX_OK &&
+	       size == strlen(level) && !memcmp(value, level, size) &&
+	       mux_decoder_state_get(dec, "title", &value, &size) ==
+	       (title ? MUX_OK : MUX_ERROR_NOTFOUND);
+}
+
+static int test_deltas(void)
+{
+	struct mux_decoder *dec = NULL;
+	struct listen l;
+	size_t len;
+	int ok;
+
+	printf("Test: Deltas rebuild the map\n");
+
+	ok = make_stream(MUX_CODEC_PCM, RATE, 0, 0, &len) == 0 &&
+	     listen(MUX_CODEC_PCM, stream, len, &dec, &l) == 0 &&
+	     same_map(dec);
+
+	/* title, every level change, the delete */
+	ok = ok && l.events == 1 + TICKS + 1 && l.deletes == 1 &&
+	     l.side == 0 && l.audio == (size_t)TICKS * TICK * 2 &&
+	     l.stats.synced && l.stats.snapshots == 1 &&
+	     l.stats.records == TICKS && l.stats.keys == 1;
+	mux_decoder_destroy(dec);
+
+	if (!ok) {
+		printf("  FAIL: Map or events differ\n");
+		return -1;
+	}
+	printf("  PASS: %d events from %llu records\n", l.events,
+	       (unsigned long long)l.stats.records);
+	return 0;
+}
+
+static int test_late_join(void)
+{
+	struct mux_decoder *dec = NULL;
+	struct listen l;
+	size_t len;
+	int ok, join = 60;
+
+	printf("Test: Late joiner catches up at a snapshot\n");
+
+	/* Snapshots every 500 ms, joining at 1.2 s */
+	ok = make_stream(MUX_CODEC_PCM, RATE, 500, 0, &len) == 0 &&
+	     listen(MUX_CODEC_PCM, stream + tick_end[join - 1],
+		    len - tick_end[join - 1], &dec, &l) == 0 &&
+	     same_map(dec);
+
+	/* Skipped deltas until the 1.5 s snapshot, then two later ones */
+	ok = ok && l.stats.synced && l.stats.snapshots == 3 &&
+	     l.stats.dropped == (uint64_t)(75 - join) && l.side == 0;
+	mux_decoder_destroy(dec);
+
+	if (!ok) {
+		printf("  FAIL: Late joiner did not catch up\n");
+		return -1;
+	}
+	printf("  PASS: %llu deltas skipped before the first snapshot\n",
+	       (unsigned long long)l.stats.dropped);
+	return 0;
+}
+
+static int test_rate_sliced(void)
+{
+	struct mux_decoder *dec = NULL;
+	struct listen l;
+	size_t len;
+	int ok;
+
+	printf("Test: Records sliced by rate control\n");
+
+	/* Just above the audio rate: side data trickles out in slices */
+	ok = make_stream(MUX_CODEC_PCM, RATE, 500, 8000 * 16 + 48000,
+			 &len) == 0 &&
+	     listen(MUX_CODEC_PCM, stream, len, &dec, &l) == 0 &&
+	     same_map(dec) && l.stats.synced && l.stats.dropped == 0 &&
+	     l.side == 0;
+	mux_decoder_destroy(dec);
+
+	if (!ok) {
+		printf("  FAIL: Sliced records lost\n");
+		return -1;
+	}
+	printf("  PASS: %llu records applied\n",
+	       (unsigned long long)l.stats.records);
+	return 0;
+}
+
+static int test_gap(void)
+{
+	static uint8_t cut[STREAM_MAX];
+	struct mux_decoder *dec = NULL;
+	struct listen l;
+	size_t len, a, b;
+	int ok;
+
+	printf("Test: A lost record is noticed\n");
+
+	/* Tick 30 goes missing, audio and delta together */
+	ok = make_stream(MUX_CODEC_PCM, RATE, 1000, 0, &len) == 0;
+	a = tick_end[29];
+	b = tick_end[30];
+	memcpy(cut, stream, a);
+	memcpy(cut + a, stream + b, len - b);
+
+	ok = ok && listen(MUX_CODEC_PCM, cut, len - (b - a), &dec, &l) == 0 &&
+	     same_map(dec) && l.stats.synced &&
+	     l.stats.dropped == 50 - 31 && l.stats.snapshots == 3;
+	mux_decoder_destroy(dec);
+
+	if (!ok) {
+		printf("  FAIL: Gap not handled\n");
+		return -1;
+	}
+	printf("  PASS: %llu deltas skipped until the next snapshot\n",
+	       (unsigned long long)l.stats.dropped);
+	return 0;
+}
+
+static int test_false_marker(void)
+{
+	/* A marker and a header asking for 1 MiB of body, inside a value */
+	static const uint8_t fake[] = { 0xa5, 0x53, 0x00, 0x05, 0xff, 0xff, 0x3f };
+	static uint8_t blob[1000 + sizeof(fake)];
+	struct mux_encoder *enc;
+	struct mux_decoder *dec = NULL;
+	struct listen l;
+	char level[16];
+	size_t len = 0, consumed, written, at, from;
+	int t, has_title, ret, ok;
+
+	printf("Test: A marker inside a value does not stall a late joiner\n");
+
+	memset(blob, 'x', sizeof(blob));
+	memcpy(blob + 1000, fake, sizeof(fake));
+
+	/* Rate control cuts the snapshots into packets, as in test_rate_sliced */
+	enc = mux_encoder_new(MUX_CODEC_PCM, RATE, 1, 2, NULL, 0);
+	if (!enc) {
+		printf("  FAIL: Could not create the encoder\n");
+		return -1;
+	}
+	ret = mux_encoder_set_state(enc, 500);
+	if (ret == MUX_OK)
+		ret = mux_encoder_set_rate_limit(enc, 8000 * 16 + 48000, 20);
+	if (ret == MUX_OK)
+		ret = mux_encoder_state_set(enc, "blob", blob, sizeof(blob));
+	if (ret == MUX_OK)
+		ret = mux_encoder_state_set(enc, "title", "x", 1);
+	for (t = 0; t < TICKS && ret == MUX_OK; t++) {
+		expected(t, level, sizeof(level), &has_title);
+		ret = mux_encoder_state_set(enc, "level", level, strlen(level));
+		if (ret == MUX_OK && t == 100)
+			ret = mux_encoder_state_delete(enc, "title");
+		if (ret == MUX_OK)
+			ret = mux_encoder_encode(enc, pcm, TICK * sizeof(*pcm),
+						 &consumed, MUX_STREAM_AUDIO);
+		while (ret == MUX_OK &&
+		       mux_encoder_read(enc, stream + len, STREAM_MAX - len,
+					&written) == MUX_OK && written > 0)
+			len += written;
+		tick_end[t] = len;
+	}
+	mux_encoder_destroy(enc);
+
+	/* Join at the last tick before the fake marker of the first snapshot */
+	for (at = 0; at + sizeof(fake) <= len; at++)
+		if (!memcmp(stream + at, fake, sizeof(fake)))
+			break;
+	for (t = 0, from = 0; t < TICKS && tick_end[t] <= at; t++)
+		from = tick_end[t];
+
+	ok = ret == MUX_OK && at + sizeof(fake) <= len && from > 0 &&
+	     listen(MUX_CODEC_PCM, stream + from, len - from, &dec, &l) == 0 &&
+	     same_map(dec) && l.stats.synced && l.stats.snapshots > 0 &&
+	     l.side == 0;
+	mux_decoder_destroy(dec);
+
+	if (!ok) {
+		printf("  FAIL: Reader waited on a false marker\n");
+		return -1;
+	}
+	printf("  PASS: Synced at snapshot %llu of the stream\n",
+	       (unsigned long long)(TICKS * 20 / 500 - l.stats.snapshots + 1));
+	return 0;
+}
+
+/*
+ * Replacing a map of many long keys with one of big values: the live
+ * map fits a record, but not the deletes and sets together
+ */
+static void long_key(char *key, int i)
+{
+	char num[8];
+
+	memset(key, 'k', MUX_STATE_KEY_MAX);
+	key[MUX_STATE_KEY_MAX] = '\0';
+	snprintf(num, sizeof(num), "%03d", i);
+	memcpy(key, num, 3);
+}
+
+static int test_big_delta(void)
+{
+	static uint8_t value[MUX_STATE_VALUE_MAX];
+	struct mux_encoder *enc;
+	struct mux_decoder *dec = NULL;
+	struct listen l;
+	char key[MUX_STATE_KEY_MAX + 1];
+	const void *got;
+	size_t len = 0, size, consumed, written;
+	int i, t, ret, ok;
+
+	printf("Test: A delta too big for a record goes out as a snapshot\n");
+
+	enc = mux_encoder_new(MUX_CODEC_PCM, RATE, 1, 2, NULL, 0);
+	if (!enc) {
+		printf("  FAIL: Could not create the encoder\n");
+		return -1;
+	}
+	memset(value, 'v', sizeof(value));
+
+	ret = mux_encoder_set_state(enc, 0);
+	for (i = 0; i < 300 && ret == MUX_OK; i++) {
+		long_key(key, i);
+		ret = mux_encoder_state_set(enc, key, NULL, 0);
+	}
+	for (t = 0; t < 2 && ret == MUX_OK; t++) {
+		if (t == 1) {
+			for (i = 0; i < 300 && ret == MUX_OK; i++) {
+				long_key(key, i);
+				ret = mux_encoder_state_delete(enc, key);
+			}
+			for (i = 0; i < 15 && ret == MUX_OK; i++) {
+				snprintf(key, sizeof(key), "big%d", i);
+				ret = mux_encoder_state_set(enc, key, value,
+							    sizeof(value));
+			}
+		}
+		if (ret == MUX_OK)
+			ret = mux_encoder_encode(enc, pcm, TICK * sizeof(*pcm),
+						 &consumed, MUX_STREAM_AUDIO);
+		while (ret == MUX_OK &&
+		       mux_encoder_read(enc, stream + len, STREAM_MAX - len,
+					&written) == MUX_OK && written > 0)
+			len += written;
+	}
+	mux_encoder_destroy(enc);
+
+	ok = ret == MUX_OK &&
+	     listen(MUX_CODEC_PCM, stream, len, &dec, &l) == 0 &&
+	     l.stats.synced && l.stats.dropped == 0 &&
+	     l.stats.snapshots == 2 && l.stats.keys == 15 &&
+	     mux_decoder_state_get(dec, "big14", &got, &size) == MUX_OK &&
+	     size == sizeof(value) && l.side == 0;
+	mux_decoder_destroy(dec);
+
+	if (!ok) {
+		printf("  FAIL: Oversized delta lost\n");
+		return -1;
+	}
+	printf("  PASS: %d events, %llu snapshots\n", l.events,
+	       (unsigned long long)l.stats.snapshots);
+	return 0;
+}
+
+static int test_ogg(void)
+{
+	struct mux_decoder *dec = NULL;
+	struct listen l;
+	size_t len;
+	int ret, ok;
+
+	printf("Test: State over an Ogg side stream\n");
+
+	ret = make_stream(MUX_CODEC_OPUS, 48000, 1000, 0, &len);
+	if (ret > 0) {
+		printf("  SKIP (Opus not available)\n");
+		return 0;
+	}
+
+	ok = ret == 0 && listen(MUX_CODEC_OPUS, stream, len, &dec, &l) == 0 &&
+	     same_map(dec) && l.stats.synced && l.stats.dropped == 0 &&
+	     l.side == 0 && l.audio > 0;
+	mux_decoder_destroy(dec);
+
+	if (!ok) {
+		printf("  FAIL: Map differs over Ogg\n");
+		return -1;
+	}
+	printf("  PASS: %llu records, %d events\n",
+	       (unsigned long long)l.stats.records, l.events);
+	return 0;
+}
+
+static int test_refused(void)
+{
+	struct mux_encoder *one, *two;
+	char key[MUX_STATE_KEY_MAX + 2];
+	int ok;
+
+	printf("Test: Bad state calls refused\n");
+
+	memset(key, 'k', sizeof(key) - 1);
+	key[sizeof(key) - 1] = '\0';
+
+	one = mux_encoder_new(MUX_CODEC_PCM, RATE, 1, 1, NULL, 0);
+	two = mux_encoder_new(MUX_CODEC_PCM, RATE, 1, 2, NULL, 0);
+	ok = one && two &&
+	     mux_encoder_set_state(one, 0) == MUX_ERROR_INVAL &&
+	     mux_encoder_state_set(two, "a", "1", 1) == MUX_ERROR_INVAL &&
+	     mux_encoder_set_state(two, 0) == MUX_OK &&
+	     mux_encoder_state_set(two, key, "1", 1) == MUX_ERROR_INVAL &&
+	     mux_encoder_state_set(two, "", "1", 1) == MUX_ERROR_INVAL &&
+	     mux_encoder_state_delete(two, "a") == MUX_ERROR_NOTFOUND &&
+	     mux_encoder_state_set(two, "a", NULL, 0) == MUX_OK &&
+	     mux_encoder_state_delete(two, "a") == MUX_OK &&
+	     mux_encoder_state_delete(two, "a") == MUX_ERROR_NOTFOUND;
+	mux_encoder_destroy(one);
+	mux_encoder_destroy(two);
+
+	if (!ok) {
+		printf("  FAIL: Bad call accepted\n");
+		return -1;
+	}
+	printf("  PASS: No side channel, bad keys and unknown keys refused\n");
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+	size_t i;
+
+	printf("Side Channel State Tests\n");
+	printf("========================\n\n");
+
+	for (i = 0; i < sizeof(pcm) / sizeof(pcm[0]); i++)
+		pcm[i] = (int16_t)(((int)i * 2731) % 24000 - 12000);
+
+	if (test_deltas() != 0)
+		failures++;
+	if (test_late_join() != 0)
+		failures++;
+	if (test_rate_sliced() != 0)
+		failures++;
+	if (test_gap() != 0)
+		failures++;
+	if (test_false_marker() != 0)
+		failures++;
+	if (test_big_delta() != 0)
+		failures++;
+	if (test_ogg() != 0)
+		failures++;
+	if (test_refused() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
@@ -0,0 +1,450 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test transcoding: matching configs are remuxed packet for packet,
+ * anything else is decoded and encoded again
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE      8000
+#define FRAMES    4000
+#define OUT_MAX   (1 << 20)
+#define CHUNK     777
+
+static uint8_t out[OUT_MAX];
+static uint8_t ref[OUT_MAX];
+
+/* Feed in odd-sized chunks, reading as we go */
+static int run(struct mux_transcoder *tc, const uint8_t *in, size_t len,
+	       size_t *out_len)
+{
+	size_t pos = 0, n, consumed, written;
+	int ret;
+
+	*out_len = 0;
+	for (;;) {
+		n = len - pos < CHUNK ? len - pos : CHUNK;
+		ret = n ? mux_transcoder_feed(tc, in + pos, n, &consumed) :
+		      mux_transcoder_finalize(tc);
+		if (ret != MUX_OK)
+			return ret;
+		pos += n ? consumed : 0;
+
+		do {
+			ret = mux_transcoder_read(tc, out + *out_len,
+						  OUT_MAX - *out_len, &written);
+			if (ret != MUX_OK)
+				return ret;
+			*out_len += written;
+		} while (written > 0);
+
+		if (n == 0)
+			return MUX_OK;
+	}
+}
+
+static size_t encode(enum mux_codec_type codec, int num_streams,
+		     const int16_t *pcm, const char *side, uint8_t *dst)
+{
+	struct mux_encoder *enc;
+	size_t consumed, written, len = 0;
+	size_t half = FRAMES / 2 * sizeof(int16_t);
+
+	enc = mux_encoder_new(codec, RATE, 1, num_streams, NULL, 0);
+	if (!enc)
+		return 0;
+	mux_encoder_encode(enc, pcm, half, &consumed, MUX_STREAM_AUDIO);
+	if (side)
+		mux_encoder_encode(enc, side, strlen(side), &consumed,
+				   MUX_STREAM_SIDE_CHANNEL);
+	mux_encoder_encode(enc, (const uint8_t *)pcm + half, half, &consumed,
+			   MUX_STREAM_AUDIO);
+	mux_encoder_finalize(enc);
+	while (mux_encoder_read(enc, dst + len, OUT_MAX - len, &written) ==
+	       MUX_OK && written > 0)
+		len += written;
+	mux_encoder_destroy(enc);
+	return len;
+}
+
+static void fill(int16_t *pcm)
+{
+	int i;
+
+	for (i = 0; i < FRAMES; i++)
+		pcm[i] = (int16_t)((i * 37) % 2000 - 1000);
+}
+
+static int test_pcm_remux(void)
+{
+	static int16_t pcm[FRAMES];
+	static uint8_t in[OUT_MAX];
+	struct mux_transcoder *tc;
+	size_t in_len, out_len;
+	int ret = -1;
+
+	printf("Testing PCM remux...\n");
+
+	fill(pcm);
+	in_len = encode(MUX_CODEC_PCM, 2, pcm, "marker", in);
+
+	/* Same framing: byte for byte */
+	tc = mux_transcoder_new(MUX_CODEC_PCM, 2, MUX_CODEC_PCM, 2, RATE, 1,
+				NULL, 0);
+	if (!tc || mux_transcoder_passthrough(tc) != 1 ||
+	    run(tc, in, in_len, &out_len) != MUX_OK ||
+	    out_len != in_len || memcmp(out, in, in_len) != 0) {
+		fprintf(stderr, "  FAIL: LEB128 to LEB128\n");
+		goto out;
+	}
+	mux_transcoder_destroy(tc);
+
+	/* One stream: side channel dropped, raw samples left */
+	tc = mux_transcoder_new(MUX_CODEC_PCM, 2, MUX_CODEC_PCM, 1, RATE, 1,
+				NULL, 0);
+	if (!tc || run(tc, in, in_len, &out_len) != MUX_OK ||
+	    out_len != sizeof(pcm) || memcmp(out, pcm, sizeof(pcm)) != 0) {
+		fprintf(stderr, "  FAIL: LEB128 to raw\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_transcoder_destroy(tc);
+	return ret;
+}
+
+static int test_alaw_reframe(void)
+{
+	static int16_t pcm[FRAMES], a[FRAMES], b[FRAMES];
+	static uint8_t in[OUT_MAX];
+	struct mux_transcoder *tc;
+	struct mux_decoder *dec[2];
+	size_t in_len, out_len, consumed, na = 0, nb = 0, written;
+	int stream_type, ret = -1;
+
+	printf("Testing G.711 raw to LEB128...\n");
+
+	fill(pcm);
+	in_len = encode(MUX_CODEC_ALAW, 1, pcm, NULL, in);
+	tc = mux_transcoder_new(MUX_CODEC_ALAW, 1, MUX_CODEC_ALAW, 2, RATE, 1,
+				NULL, 0);
+	dec[0] = mux_decoder_new(MUX_CODEC_ALAW, 1, NULL, 0);
+	dec[1] = mux_decoder_new(MUX_CODEC_ALAW, 2, NULL, 0);
+	if (!tc || !dec[0] || !dec[1] ||
+	    run(tc, in, in_len, &out_len) != MUX_OK ||
+	    mux_transcoder_passthrough(tc) != 1) {
+		fprintf(stderr, "  FAIL: remux\n");
+		goto out;
+	}
+
+	/* Same samples out of both, without requantizing */
+	mux_decoder_decode(dec[0], in, in_len, &consumed);
+	mux_decoder_decode(dec[1], out, out_len, &consumed);
+	mux_decoder_finalize(dec[0]);
+	mux_decoder_finalize(dec[1]);
+	while (mux_decoder_read(dec[0], (uint8_t *)a + na, sizeof(a) - na,
+				&written, &stream_type) == MUX_OK && written)
+		na += written;
+	while (mux_decoder_read(dec[1], (uint8_t *)b + nb, sizeof(b) - nb,
+				&written, &stream_type) == MUX_OK && written)
+		nb += written;
+	if (na != sizeof(a) || nb != na || memcmp(a, b, na) != 0) {
+		fprintf(stderr, "  FAIL: decoded %zu vs %zu bytes\n", na, nb);
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_decoder_destroy(dec[0]);
+	mux_decoder_destroy(dec[1]);
+	mux_transcoder_destroy(tc);
+	return ret;
+}
+
+static int test_transcode(void)
+{
+	static int16_t pcm[FRAMES];
+	static uint8_t in[OUT_MAX];
+	struct mux_param off = { .name = "passthrough", .value.b = 0 };
+	struct mux_transcoder *tc;
+	size_t in_len, ref_len, out_len;
+	int ret = -1;
+
+	printf("Testing transcode...\n");
+
+	fill(pcm);
+	in_len = encode(MUX_CODEC_PCM, 2, pcm, "marker", in);
+	ref_len = encode(MUX_CODEC_ALAW, 2, pcm, "marker", ref);
+
+	/* Different codec: same as encoding the PCM directly */
+	tc = mux_transcoder_new(MUX_CODEC_PCM, 2, MUX_CODEC_ALAW, 2, RATE, 1,
+				NULL, 0);
+	if (!tc || mux_transcoder_passthrough(tc) != 0 ||
+	    run(tc, in, in_len, &out_len) != MUX_OK) {
+		fprintf(stderr, "  FAIL: PCM to A-law\n");
+		goto out;
+	}
+	/* Frames may be split differently; compare the decoded streams */
+	{
+		struct mux_decoder *d1 = mux_decoder_new(MUX_CODEC_ALAW, 2, NULL, 0);
+		struct mux_decoder *d2 = mux_decoder_new(MUX_CODEC_ALAW, 2, NULL, 0);
+		static uint8_t a[OUT_MAX], b[OUT_MAX];
+		size_t consumed, written, na = 0, nb = 0;
+		int type, side = 0;
+
+		mux_decoder_decode(d1, ref, ref_len, &consumed);
+		mux_decoder_decode(d2, out, out_len, &consumed);
+		mux_decoder_finalize(d1);
+		mux_decoder_finalize(d2);
+		while (mux_decoder_read(d1, a + na, OUT_MAX - na, &written,
+					&type) == MUX_OK && written)
+			na += type == MUX_STREAM_AUDIO ? written : 0;
+		while (mux_decoder_read(d2, b + nb, OUT_MAX - nb, &written,
+					&type) == MUX_OK && written) {
+			if (type == MUX_STREAM_SIDE_CHANNEL)
+				side = written == 6 && memcmp(b + nb, "marker", 6) == 0;
+			else
+				nb += written;
+		}
+		mux_decoder_destroy(d1);
+		mux_decoder_destroy(d2);
+		if (na != sizeof(pcm) || nb != na || memcmp(a, b, na) != 0 ||
+		    !side) {
+			fprintf(stderr, "  FAIL: transcoded output differs\n");
+			goto out;
+		}
+	}
+	mux_transcoder_destroy(tc);
+
+	/* Forced: PCM through decoder and encoder comes out the same */
+	tc = mux_transcoder_new(MUX_CODEC_PCM, 2, MUX_CODEC_PCM, 1, RATE, 1,
+				&off, 1);
+	if (!tc || mux_transcoder_passthrough(tc) != 0 ||
+	    run(tc, in, in_len, &out_len) != MUX_OK ||
+	    out_len != sizeof(pcm) || memcmp(out, pcm, sizeof(pcm)) != 0) {
+		fprintf(stderr, "  FAIL: forced transcode\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_transcoder_destroy(tc);
+	return ret;
+}
+
+/* fLaC + STREAMINFO + bytes standing in for frames */
+static size_t make_flac(uint8_t *p, unsigned int rate, unsigned int channels)
+{
+	size_t i;
+
+	memset(p, 0, 42);
+	memcpy(p, "fLaC", 4);
+	p[4] = 0x80;    /* last metadata block, STREAMINFO */
+	p[7] = 34;
+	p[18] = (uint8_t)(rate >> 12);
+	p[19] = (uint8_t)(rate >> 4);
+	p[20] = (uint8_t)(((rate & 0xf) << 4) | ((channels - 1) << 1));
+	p[21] = 15 << 4;    /* 16 bits */
+	for (i = 42; i < 6000; i++)
+		p[i] = (uint8_t)(i * 13);
+	return 6000;
+}
+
+static int test_flac(void)
+{
+	static uint8_t in[8192];
+	struct mux_param level = { .name = "compression", .value.i = 8 };
+	struct mux_transcoder *tc;
+	size_t in_len, out_len, consumed;
+	int ret = -1;
+
+	printf("Testing FLAC STREAMINFO match...\n");
+
+	/* Compression level doesn't count for a lossless codec */
+	in_len = make_flac(in, 48000, 2);
+	tc = mux_transcoder_new(MUX_CODEC_FLAC, 1, MUX_CODEC_FLAC, 1, 48000, 2,
+				&level, 1);
+	if (!tc || mux_transcoder_passthrough(tc) != -1 ||
+	    run(tc, in, in_len, &out_len) != MUX_OK ||
+	    mux_transcoder_passthrough(tc) != 1 ||
+	    out_len != in_len || memcmp(out, in, in_len) != 0) {
+		fprintf(stderr, "  FAIL: matching stream not copied\n");
+		goto out;
+	}
+	mux_transcoder_destroy(tc);
+
+	/* 44.1 kHz stream, 48 kHz wanted */
+	in_len = make_flac(in, 44100, 2);
+	tc = mux_transcoder_new(MUX_CODEC_FLAC, 1, MUX_CODEC_FLAC, 1, 48000, 2,
+				NULL, 0);
+	if (!tc) {
+		fprintf(stderr, "  FAIL: new\n");
+		goto out;
+	}
+	mux_transcoder_feed(tc, in, in_len, &consumed);
+	if (mux_transcoder_passthrough(tc) != 0) {
+		fprintf(stderr, "  FAIL: mismatch not transcoded\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_transcoder_destroy(tc);
+	return ret;
+}
+
+/*
+ * Ogg Opus, built by hand: OpusHead, OpusTags, then 20 ms CELT packets
+ * of a fixed size, one per page
+ */
+static uint32_t ogg_crc(const uint8_t *p, size_t len)
+{
+	uint32_t crc = 0;
+	size_t i;
+	int bit;
+
+	for (i = 0; i < len; i++) {
+		crc ^= (uint32_t)p[i] << 24;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000u) ? (crc << 1) ^ 0x04c11db7u :
+						    crc << 1;
+	}
+	return crc;
+}
+
+static size_t ogg_page(uint8_t *p, uint32_t serial, uint32_t seq,
+		       uint64_t granule, int flags, const uint8_t *data,
+		       size_t len)
+{
+	size_t segs = len / 255 + 1, i;
+	uint32_t crc;
+
+	memset(p, 0, 27);
+	memcpy(p, "OggS", 4);
+	p[5] = (uint8_t)flags;
+	for (i = 0; i < 8; i++)
+		p[6 + i] = (uint8_t)(granule >> (8 * i));
+	for (i = 0; i < 4; i++) {
+		p[14 + i] = (uint8_t)(serial >> (8 * i));
+		p[18 + i] = (uint8_t)(seq >> (8 * i));
+	}
+	p[26] = (uint8_t)segs;
+	for (i = 0; i < segs; i++)
+		p[27 + i] = i + 1 < segs ? 255 : (uint8_t)(len % 255);
+	memcpy(p + 27 + segs, data, len);
+
+	crc = ogg_crc(p, 27 + segs + len);
+	for (i = 0; i < 4; i++)
+		p[22 + i] = (uint8_t)(crc >> (8 * i));
+	return 27 + segs + len;
+}
+
+static size_t make_opus(uint8_t *p, int packet_size, int with_side)
+{
+	static const uint8_t head[19] = {
+		'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 2,
+		0x38, 0x01, 0x80, 0xbb, 0, 0, 0, 0, 0
+	};
+	static const uint8_t tags[16] = {
+		'O', 'p', 'u', 's', 'T', 'a', 'g', 's'
+	};
+	uint8_t packet[512];
+	size_t len = 0;
+	int i;
+
+	len += ogg_page(p + len, 1, 0, 0, 0x02, head, sizeof(head));
+	len += ogg_page(p + len, 1, 1, 0, 0, tags, sizeof(tags));
+	memset(packet, 0x55, sizeof(packet));
+	packet[0] = 31 << 3;    /* CELT fullband 20 ms, one frame */
+	for (i = 0; i < 60; i++) {
+		len += ogg_page(p + len, 1, (uint32_t)i + 2, 960ULL * (i + 1),
+				0, packet, (size_t)packet_size);
+		if (with_side && i == 10)
+			len += ogg_page(p + len, 2, 0, 0, 0x02,
+					(const uint8_t *)"marker", 6);
+	}
+	return len;
+}
+
+static int test_opus(void)
+{
+	static uint8_t in[65536], plain[65536];
+	struct mux_param rate = { .name = "bitrate", .value.i = 64 };
+	struct mux_transcoder *tc;
+	size_t in_len, plain_len, out_len, consumed;
+	int ret = -1;
+
+	printf("Testing Ogg Opus passthrough...\n");
+
+	/* 160 bytes every 20 ms is 64 kbps; the side page is dropped */
+	in_len = make_opus(in, 160, 1);
+	plain_len = make_opus(plain, 160, 0);
+	tc = mux_transcoder_new(MUX_CODEC_OPUS, 2, MUX_CODEC_OPUS, 1, 48000, 2,
+				&rate, 1);
+	if (!tc || run(tc, in, in_len, &out_len) != MUX_OK ||
+	    mux_transcoder_passthrough(tc) != 1 ||
+	    out_len != plain_len || memcmp(out, plain, plain_len) != 0) {
+		fprintf(stderr, "  FAIL: pages not copied\n");
+		goto out;
+	}
+	mux_transcoder_destroy(tc);
+
+	/* 320 bytes is 128 kbps, too far off */
+	in_len = make_opus(in, 320, 0);
+	tc = mux_transcoder_new(MUX_CODEC_OPUS, 1, MUX_CODEC_OPUS, 1, 48000, 2,
+				&rate, 1);
+	if (!tc) {
+		fprintf(stderr, "  FAIL: new\n");
+		goto out;
+	}
+	mux_transcoder_feed(tc, in, in_len, &consumed);
+	if (mux_transcoder_passthrough(tc) != 0) {
+		fprintf(stderr, "  FAIL: bitrate mismatch not transcoded\n");
+		goto out;
+	}
+
+	printf("  PASS\n");
+	ret = 0;
+
+out:
+	mux_transcoder_destroy(tc);
+	return ret;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Transcoder Tests\n");
+	printf("================\n\n");
+
+	if (test_pcm_remux() != 0)
+		failures++;
+	if (test_alaw_reframe() != 0)
+		failures++;
+	if (test_transcode() != 0)
+		failures++;
+	if (test_flac() != 0)
+		failures++;
+	if (test_opus() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
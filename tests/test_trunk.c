@@ -0,0 +1,400 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * Test trunks: many G.711 and PCM sessions round-trip through one
+ * stream fed in odd-sized pieces and decode exactly like their own
+ * streams would, also behind decoders that bound their work per call,
+ * slots are reused after close, and damage to the trunk is detected
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mux.h"
+
+#define RATE      8000
+#define TICK      160            /* 20 ms */
+#define TICKS     25
+#define SESSIONS  60
+#define TRUNK_MAX (4 << 20)
+#define OUT_MAX   (TICKS * TICK * 2 + 4096)
+
+struct call {
+	uint32_t id;
+	enum mux_codec_type codec;
+	struct mux_encoder *enc;
+	int slot;
+	int start, stop;             /* ticks */
+	int ended;
+
+	/* The same audio through a stream of its own */
+	struct mux_encoder *ref_enc;
+	struct mux_decoder *ref_dec;
+
+	uint8_t want[2][OUT_MAX];
+	size_t want_len[2];
+	uint8_t got[2][OUT_MAX];
+	size_t got_len[2];
+};
+
+static struct call calls[SESSIONS];
+static uint8_t trunk[TRUNK_MAX];
+static size_t trunk_len;
+
+static void append(uint8_t *dst, size_t *len, const uint8_t *src, size_t n)
+{
+	if (*len + n <= OUT_MAX) {
+		memcpy(dst + *len, src, n);
+		*len += n;
+	}
+}
+
+static void fill(int16_t *pcm, uint32_t id, int tick)
+{
+	int i;
+
+	for (i = 0; i < TICK; i++)
+		pcm[i] = (int16_t)(((tick * TICK + i) * (int)(id % 97 + 3) *
+				    131) % 30000 - 15000);
+}
+
+/* Encode one tick of a call into both its trunk and reference encoders */
+static int encode_tick(struct call *c, int tick)
+{
+	static uint8_t buf[65536];
+	int16_t pcm[TICK];
+	char side[32];
+	size_t consumed, written, n;
+	int type;
+
+	fill(pcm, c->id, tick);
+	n = (size_t)snprintf(side, sizeof(side), "call %u tick %d",
+			     (unsigned int)c->id, tick);
+
+	if (mux_encoder_encode(c->enc, pcm, sizeof(pcm), &consumed,
+			       MUX_STREAM_AUDIO) != MUX_OK ||
+	    mux_encoder_encode(c->ref_enc, pcm, sizeof(pcm), &consumed,
+			       MUX_STREAM_AUDIO) != MUX_OK)
+		return -1;
+	if (tick % 7 == 3 &&
+	    (mux_encoder_encode(c->enc, side, n, &consumed,
+				MUX_STREAM_SIDE_CHANNEL) != MUX_OK ||
+	     mux_encoder_encode(c->ref_enc, side, n, &consumed,
+				MUX_STREAM_SIDE_CHANNEL) != MUX_OK))
+		return -1;
+	if (tick == c->stop - 1 &&
+	    (mux_encoder_finalize(c->enc) != MUX_OK ||
+	     mux_encoder_finalize(c->ref_enc) != MUX_OK))
+		return -1;
+
+	while (mux_encoder_read(c->ref_enc, buf, sizeof(buf), &written) ==
+	       MUX_OK && written > 0)
+		if (mux_decoder_decode(c->ref_dec, buf, written,
+				       &consumed) != MUX_OK)
+			return -1;
+	if (tick == c->stop - 1 && mux_decoder_finalize(c->ref_dec) != MUX_OK)
+		return -1;
+	while (mux_decoder_read(c->ref_dec, buf, sizeof(buf), &written,
+				&type) == MUX_OK && written > 0)
+		append(c->want[type], &c->want_len[type], buf, written);
+	return 0;
+}
+
+static struct call *find_call(uint32_t id)
+{
+	int i;
+
+	for (i = 0; i < SESSIONS; i++)
+		if (calls[i].id == id)
+			return &calls[i];
+	return NULL;
+}
+
+/*
+ * Calls start and stop at different ticks; the second half starts once
+ * the first half has left, so it gets the freed slots
+ */
+static int build_trunk(struct mux_trunk_writer *w)
+{
+	static const enum mux_codec_type codecs[] = {
+		MUX_CODEC_ALAW, MUX_CODEC_MULAW, MUX_CODEC_PCM
+	};
+	struct call *c;
+	size_t written;
+	int tick, i, lowest;
+
+	for (i = 0; i < SESSIONS; i++) {
+		c = &calls[i];
+		c->id = 1000003u * (uint32_t)(i + 1);
+		c->codec = codecs[i % 3];
+		c->start = i < SESSIONS / 2 ? i % 4 : TICKS / 2 + i % 3;
+		c->stop = i < SESSIONS / 2 ? TICKS / 2 - i % 3 : TICKS - i % 2;
+		c->enc = mux_encoder_new(c->codec, RATE, 1, 2, NULL, 0);
+		c->ref_enc = mux_encoder_new(c->codec, RATE, 1, 2, NULL, 0);
+		c->ref_dec = mux_decoder_new(c->codec, 2, NULL, 0);
+		if (!c->enc || !c->ref_enc || !c->ref_dec)
+			return -1;
+	}
+
+	for (tick = 0; tick < TICKS; tick++) {
+		lowest = -1;
+		for (i = 0; i < SESSIONS; i++) {
+			c = &calls[i];
+			if (tick == c->start) {
+				if (mux_trunk_writer_add(w, c->id, c->enc,
+							 &c->slot) != MUX_OK)
+					return -1;
+				if (lowest < 0 || c->slot < lowest)
+					lowest = c->slot;
+			}
+			if (tick >= c->start && tick < c->stop &&
+			    encode_tick(c, tick) != 0)
+				return -1;
+		}
+		/* Everything left at TICKS / 2, so slot 0 is free again */
+		if (tick == TICKS / 2 && lowest != 0) {
+			printf("  slot %d reused first, expected 0\n", lowest);
+			return -1;
+		}
+
+		if (mux_trunk_writer_collect(w) != MUX_OK)
+			return -1;
+		for (i = 0; i < SESSIONS; i++)
+			if (tick == calls[i].stop - 1 &&
+			    mux_trunk_writer_remove(w, calls[i].slot) != MUX_OK)
+				return -1;
+
+		while (mux_trunk_writer_read(w, trunk + trunk_len,
+					     TRUNK_MAX - trunk_len,
+					     &written) == MUX_OK && written > 0)
+			trunk_len += written;
+	}
+
+	return 0;
+}
+
+static int drain(struct mux_trunk_reader *r)
+{
+	static uint8_t buf[512];
+	struct mux_trunk_session s;
+	struct call *c;
+	size_t written;
+	int type, ret;
+
+	while ((ret = mux_trunk_reader_read(r, &s, buf, sizeof(buf), &written,
+					    &type)) == MUX_OK) {
+		if (type < 0)
+			return 0;
+		c = find_call(s.id);
+		if (!c || s.codec_type != c->codec || s.sample_rate != RATE ||
+		    s.num_channels != 1 || c->ended)
+			return -1;
+		if (type == MUX_TRUNK_END)
+			c->ended = 1;
+		else
+			append(c->got[type], &c->got_len[type], buf, written);
+	}
+	return ret;
+}
+
+static int test_round_trip(void)
+{
+	static const size_t pieces[] = { 1, 7, 300, 13, 4096, 2, 65536, 19 };
+	struct mux_trunk_writer *w;
+	struct mux_trunk_reader *r;
+	struct call *c;
+	size_t pos, n, consumed, payload = 0;
+	int i, k, ok = 1;
+
+	printf("Test: %d calls over one trunk\n", SESSIONS);
+
+	w = mux_trunk_writer_new();
+	r = mux_trunk_reader_new(NULL, 0);
+	if (!w || !r || build_trunk(w) != 0) {
+		printf("  FAIL: Couldn't build the trunk\n");
+		ok = 0;
+		goto out;
+	}
+
+	for (pos = 0, k = 0; pos < trunk_len && ok; pos += consumed, k++) {
+		n = pieces[k % 8];
+		if (n > trunk_len - pos)
+			n = trunk_len - pos;
+		if (mux_trunk_reader_feed(r, trunk + pos, n, &consumed) !=
+		    MUX_OK || consumed != n || drain(r) != 0)
+			ok = 0;
+	}
+	if (!ok || mux_trunk_reader_finalize(r) != MUX_OK || drain(r) != 0) {
+		printf("  FAIL: Reading the trunk failed at %zu\n", pos);
+		ok = 0;
+		goto out;
+	}
+
+	for (i = 0; i < SESSIONS; i++) {
+		c = &calls[i];
+		payload += c->want_len[0] + c->want_len[1];
+		if (!c->ended || c->want_len[0] == 0 || c->want_len[1] == 0 ||
+		    c->got_len[0] != c->want_len[0] ||
+		    c->got_len[1] != c->want_len[1] ||
+		    memcmp(c->got[0], c->want[0], c->want_len[0]) != 0 ||
+		    memcmp(c->got[1], c->want[1], c->want_len[1]) != 0) {
+			printf("  FAIL: Call %d differs (%zu/%zu audio bytes, ended %d)\n",
+			       i, c->got_len[0], c->want_len[0], c->ended);
+			ok = 0;
+			break;
+		}
+	}
+	if (ok)
+		printf("  PASS: %zu trunk bytes, %zu decoded bytes match\n",
+		       trunk_len, payload);
+
+out:
+	for (i = 0; i < SESSIONS; i++) {
+		mux_encoder_destroy(calls[i].enc);
+		mux_encoder_destroy(calls[i].ref_enc);
+		mux_decoder_destroy(calls[i].ref_dec);
+	}
+	mux_trunk_writer_destroy(w);
+	mux_trunk_reader_destroy(r);
+	return ok ? 0 : -1;
+}
+
+/* Decoders that take 50 bytes per call make feed stop short */
+static int test_bounded(void)
+{
+	struct mux_param p = { .name = "max_decode_input", .value.i = 50 };
+	struct mux_trunk_reader *r;
+	size_t pos, n, consumed, calls_fed = 0;
+	int i, ok = 1;
+
+	printf("Test: Decoders with bounded work per call\n");
+
+	for (i = 0; i < SESSIONS; i++) {
+		calls[i].got_len[0] = calls[i].got_len[1] = 0;
+		calls[i].ended = 0;
+	}
+
+	r = mux_trunk_reader_new(&p, 1);
+	for (pos = 0; r && pos < trunk_len && ok; pos += consumed) {
+		n = trunk_len - pos < 4096 ? trunk_len - pos : 4096;
+		if (mux_trunk_reader_feed(r, trunk + pos, n, &consumed) !=
+		    MUX_OK || drain(r) != 0)
+			ok = 0;
+		calls_fed++;
+	}
+	if (!r || !ok || mux_trunk_reader_finalize(r) != MUX_OK ||
+	    drain(r) != 0) {
+		printf("  FAIL: Reading the trunk failed at %zu\n", pos);
+		mux_trunk_reader_destroy(r);
+		return -1;
+	}
+	mux_trunk_reader_destroy(r);
+
+	for (i = 0; i < SESSIONS; i++) {
+		if (!calls[i].ended ||
+		    calls[i].got_len[0] != calls[i].want_len[0] ||
+		    memcmp(calls[i].got[0], calls[i].want[0],
+			   calls[i].want_len[0]) != 0) {
+			printf("  FAIL: Call %d differs\n", i);
+			return -1;
+		}
+	}
+
+	printf("  PASS: Same output in %zu feed calls\n", calls_fed);
+	return 0;
+}
+
+/* Offset of the n-th data frame's sequence byte, or 0 */
+static size_t find_seq(const uint8_t *p, size_t len, int n)
+{
+	size_t pos = 0, hlen;
+
+	while (pos + 2 < len) {
+		/* Tags and lengths here are one byte each */
+		hlen = 2;
+		if (p[pos] != 0 && n-- == 0)
+			return pos + hlen;
+		pos += hlen + p[pos + 1];
+	}
+	return 0;
+}
+
+static int test_damage(void)
+{
+	static uint8_t buf[4096];
+	int16_t pcm[40] = { 0 };
+	struct mux_trunk_writer *w;
+	struct mux_trunk_reader *r;
+	struct mux_encoder *enc;
+	size_t len = 0, written, consumed, at;
+	int slot, i, ret1, ret2, ret3;
+
+	printf("Test: Damaged trunks\n");
+
+	w = mux_trunk_writer_new();
+	enc = mux_encoder_new(MUX_CODEC_ALAW, RATE, 1, 1, NULL, 0);
+	if (!w || !enc || mux_trunk_writer_add(w, 7, enc, &slot) != MUX_OK) {
+		printf("  FAIL: Couldn't set up\n");
+		return -1;
+	}
+	for (i = 0; i < 3; i++) {
+		mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				   MUX_STREAM_AUDIO);
+		mux_trunk_writer_collect(w);
+	}
+	while (mux_trunk_writer_read(w, buf + len, sizeof(buf) - len,
+				     &written) == MUX_OK && written > 0)
+		len += written;
+	mux_encoder_destroy(enc);
+	mux_trunk_writer_destroy(w);
+
+	/* A lost frame shows up as a sequence gap */
+	at = find_seq(buf, len, 1);
+	buf[at]++;
+	r = mux_trunk_reader_new(NULL, 0);
+	ret1 = mux_trunk_reader_feed(r, buf, len, &consumed);
+	mux_trunk_reader_destroy(r);
+	buf[at]--;
+
+	/* Data without the hello frame */
+	r = mux_trunk_reader_new(NULL, 0);
+	ret2 = mux_trunk_reader_feed(r, buf + 4, len - 4, &consumed);
+	mux_trunk_reader_destroy(r);
+
+	/* Cut in the middle of a frame */
+	r = mux_trunk_reader_new(NULL, 0);
+	ret3 = mux_trunk_reader_feed(r, buf, len - 5, &consumed);
+	if (ret3 == MUX_OK)
+		ret3 = mux_trunk_reader_finalize(r);
+	mux_trunk_reader_destroy(r);
+
+	if (at == 0 || ret1 != MUX_ERROR_FORMAT || ret2 != MUX_ERROR_FORMAT ||
+	    ret3 != MUX_ERROR_FORMAT) {
+		printf("  FAIL: Got %d, %d, %d\n", ret1, ret2, ret3);
+		return -1;
+	}
+
+	printf("  PASS: Sequence gap, missing hello and cut trunk rejected\n");
+	return 0;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	printf("Trunk Tests\n");
+	printf("===========\n\n");
+
+	if (test_round_trip() != 0)
+		failures++;
+	if (test_bounded() != 0)
+		failures++;
+	if (test_damage() != 0)
+		failures++;
+
+	if (failures == 0) {
+		printf("\nAll tests passed!\n");
+		return 0;
+	} else {
+		printf("\n%d test(s) failed.\n", failures);
+		return 1;
+	}
+}
@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "test_utils.h"
+#include "mux.h"
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -338,3 +339,48 @@ void print_audio_stats(const int16_t *original, size_t original_samples,
 	}
 	printf("\n");
 }
+
+/*
+ * Session fixtures
+ */
+
+static void fill_session_chunk(int16_t *pcm, int index)
+{
+	int i;
+
+	for (i = 0; i < SESSION_CHUNK; i++)
+		pcm[i] = (int16_t)(((index * SESSION_CHUNK + i) * 37) % 20000 -
+				   10000);
+}
+
+int feed_session(struct mux_encoder *enc, int first, int count)
+{
+	int16_t pcm[SESSION_CHUNK];
+	size_t consumed;
+	int i;
+
+	for (i = first; i < first + count; i++) {
+		fill_session_chunk(pcm, i);
+		if (mux_encoder_encode(enc, pcm, sizeof(pcm), &consumed,
+				       MUX_STREAM_AUDIO) != MUX_OK)
+			return -1;
+		if (i % 5 == 0 &&
+		    mux_encoder_encode(enc, "meta", 4, &consumed,
+				       MUX_STREAM_SIDE_CHANNEL) != MUX_OK)
+			return -1;
+	}
+
+	return 0;
+}
+
+size_t drain_session(struct mux_encoder *enc, uint8_t *out, size_t size)
+{
+	size_t total = 0, written;
+
+	while (total < size &&
+	       mux_encoder_read(enc, out + total, size - total,
+				&written) == MUX_OK && written > 0)
+		total += written;
+
+	return total;
+}
@@ -72,4 +72,20 @@ void print_audio_stats(const int16_t *original, size_t original_samples,
 		       const int16_t *decoded, size_t decoded_samples,
 		       int channels);
 
+/*
+ * Session fixtures
+ */
+
+struct mux_encoder;
+
+/* Samples per chunk fed by feed_session(), 20ms mono at 16 kHz */
+#define SESSION_CHUNK 320
+
+/* Encode chunks [first, first + count) of a fixed mono signal, with a
+ * 4 byte side packet before every fifth; 0 on success */
+int feed_session(struct mux_encoder *enc, int first, int count);
+
+/* Read pending encoder output into out; returns the bytes read */
+size_t drain_session(struct mux_encoder *enc, uint8_t *out, size_t size);
+
 #endif /* TEST_UTILS_H */
@@ -26,6 +26,7 @@ struct encoder_config {
 	int num_streams;
 	int bitrate;
 	int compression;
+	int ring_fd;
 };
 
 static void usage(const char *prog)
@@ -42,6 +43,8 @@ static void usage(const char *prog)
 	fprintf(stderr, "  -s, --streams NUM      Number of streams: 1=passthrough, 2=mux (default: 2)\n");
 	fprintf(stderr, "  -b, --bitrate KBPS     Bitrate in kbps for lossy codecs (default: 128)\n");
 	fprintf(stderr, "  -l, --level LEVEL      Compression level 0-8 for FLAC (default: 5)\n");
+	fprintf(stderr, "  -m, --ring-fd FD       Read audio from a shared-memory ring on FD\n");
+	fprintf(stderr, "                         instead of stdin (Linux)\n");
 	fprintf(stderr, "  -h, --help             Show this help\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Input:\n");
@@ -56,6 +59,7 @@ static void usage(const char *prog)
 static int encode_stream(const struct encoder_config *config)
 {
 	struct mux_encoder *enc;
+	struct mux_ring *ring = NULL;
 	struct mux_param params[2];
 	int num_params = 0;
 	uint8_t audio_buffer[AUDIO_BUFFER_SIZE];
@@ -87,14 +91,39 @@ static int encode_stream(const struct encoder_config *config)
 		return 1;
 	}
 
+	if (config->ring_fd >= 0) {
+		ring = mux_ring_open(config->ring_fd);
+		if (!ring) {
+			fprintf(stderr, "Error: fd %d is not a muxaudio ring\n",
+				config->ring_fd);
+			mux_encoder_destroy(enc);
+			return 1;
+		}
+	}
+
 	/* Main encoding loop */
 	while (!audio_eof || !side_eof) {
+		/* Encode audio in place from the shared ring */
+		if (!audio_eof && ring) {
+			ret = mux_encoder_encode_ring(enc, ring, -1, &consumed);
+			if (ret == MUX_ERROR_EOF) {
+				audio_eof = 1;
+			} else if (ret != MUX_OK) {
+				const struct mux_error_info *err = mux_encoder_get_error(enc);
+				fprintf(stderr, "Error: Encode failed: %s\n", err->message);
+				mux_encoder_destroy(enc);
+				mux_ring_close(ring);
+				return 1;
+			}
+		}
+
 		/* Read audio from stdin */
-		if (!audio_eof) {
+		if (!audio_eof && !ring) {
 			audio_read = read(STDIN_FILENO, audio_buffer, sizeof(audio_buffer));
 			if (audio_read < 0) {
 				perror("read(stdin)");
 				mux_encoder_destroy(enc);
+				mux_ring_close(ring);
 				return 1;
 			}
 			if (audio_read == 0) {
@@ -106,6 +135,7 @@ static int encode_stream(const struct encoder_config *config)
 					const struct mux_error_info *err = mux_encoder_get_error(enc);
 					fprintf(stderr, "Error: Encode failed: %s\n", err->message);
 					mux_encoder_destroy(enc);
+					mux_ring_close(ring);
 					return 1;
 				}
 			}
@@ -126,6 +156,7 @@ static int encode_stream(const struct encoder_config *config)
 					const struct mux_error_info *err = mux_encoder_get_error(enc);
 					fprintf(stderr, "Error: Encode failed: %s\n", err->message);
 					mux_encoder_destroy(enc);
+					mux_ring_close(ring);
 					return 1;
 				}
 			}
@@ -140,12 +171,14 @@ static int encode_stream(const struct encoder_config *config)
 			if (ret != MUX_OK) {
 				fprintf(stderr, "Error: Failed to read encoder output\n");
 				mux_encoder_destroy(enc);
+				mux_ring_close(ring);
 				return 1;
 			}
 
 			if (write(STDOUT_FILENO, output_buffer, written) != (ssize_t)written) {
 				perror("write(stdout)");
 				mux_encoder_destroy(enc);
+				mux_ring_close(ring);
 				return 1;
 			}
 		}
@@ -157,6 +190,7 @@ static int encode_stream(const struct encoder_config *config)
 		const struct mux_error_info *err = mux_encoder_get_error(enc);
 		fprintf(stderr, "Error: Finalize failed: %s\n", err->message);
 		mux_encoder_destroy(enc);
+		mux_ring_close(ring);
 		return 1;
 	}
 
@@ -169,17 +203,20 @@ static int encode_stream(const struct encoder_config *config)
 		if (ret != MUX_OK) {
 			fprintf(stderr, "Error: Failed to read encoder output\n");
 			mux_encoder_destroy(enc);
+			mux_ring_close(ring);
 			return 1;
 		}
 
 		if (write(STDOUT_FILENO, output_buffer, written) != (ssize_t)written) {
 			perror("write(stdout)");
 			mux_encoder_destroy(enc);
+			mux_ring_close(ring);
 			return 1;
 		}
 	}
 
 	mux_encoder_destroy(enc);
+	mux_ring_close(ring);
 	return 0;
 }
 
@@ -191,7 +228,8 @@ int main(int argc, char **argv)
 		.num_channels = 2,
 		.num_streams = 2,
 		.bitrate = 128,
-		.compression = 5
+		.compression = 5,
+		.ring_fd = -1
 	};
 
 	static struct option long_options[] = {
@@ -201,12 +239,13 @@ int main(int argc, char **argv)
 		{"streams",   required_argument, 0, 's'},
 		{"bitrate",   required_argument, 0, 'b'},
 		{"level",     required_argument, 0, 'l'},
+		{"ring-fd",   required_argument, 0, 'm'},
 		{"help",      no_argument,       0, 'h'},
 		{0, 0, 0, 0}
 	};
 
 	int opt;
-	while ((opt = getopt_long(argc, argv, "c:r:n:s:b:l:h", long_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "c:r:n:s:b:l:m:h", long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'c':
 			if (mux_codec_from_name(optarg, &config.codec) != MUX_OK) {
@@ -250,6 +289,13 @@ int main(int argc, char **argv)
 				return 1;
 			}
 			break;
+		case 'm':
+			config.ring_fd = atoi(optarg);
+			if (config.ring_fd < 0) {
+				fprintf(stderr, "Error: Invalid ring fd\n");
+				return 1;
+			}
+			break;
 		case 'h':
 			usage(argv[0]);
 			return 0;
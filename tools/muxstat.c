@@ -0,0 +1,147 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/*
+ * muxstat - Print the counters of a shared-memory metrics page
+ *
+ * Usage: muxstat [options] FILE
+ *
+ * FILE is the path given to mux_metrics_create(), or /proc/PID/fd/N
+ * for a memfd. The page is mapped read-only; reading it takes no lock
+ * and never stalls the process being watched.
+ */
+
+#include "mux.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] FILE\n", prog);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Print the counters of a muxaudio metrics page\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -i, --interval SEC     Print again every SEC seconds\n");
+	fprintf(stderr, "  -h, --help             Show this help\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "FILE is the metrics file, or /proc/PID/fd/N for a memfd\n");
+}
+
+/* Upper bound of the bucket holding the given fraction of calls */
+static double latency_us(const struct mux_metrics_counters *c, double q)
+{
+	uint64_t seen = 0, want;
+	int i;
+
+	if (c->calls == 0)
+		return 0;
+
+	want = (uint64_t)((double)c->calls * q);
+	for (i = 0; i < MUX_METRICS_BUCKETS - 1; i++) {
+		seen += c->latency[i];
+		if (seen > want)
+			break;
+	}
+	return (double)(1024ULL << i) / 1000.0;
+}
+
+static void print_row(const char *name, const char *kind,
+		      const struct mux_metrics_counters *c)
+{
+	printf("%-20s %-12s %10llu %7llu %10.2f %10.2f %9llu %9.1f %8.1f %8.1f\n",
+	       name, kind, (unsigned long long)c->calls,
+	       (unsigned long long)c->errors,
+	       (double)c->bytes_in / (1 << 20),
+	       (double)c->bytes_out / (1 << 20),
+	       (unsigned long long)(c->buffered / 1024),
+	       (double)c->busy_ns / 1e6,
+	       latency_us(c, 0.5), latency_us(c, 0.99));
+}
+
+static void print_metrics(const struct mux_metrics *m)
+{
+	struct mux_metrics_session s;
+	struct mux_metrics_counters total;
+	char kind[32];
+	int slot;
+
+	printf("%-20s %-12s %10s %7s %10s %10s %9s %9s %8s %8s\n",
+	       "session", "codec", "calls", "errors", "in MiB", "out MiB",
+	       "buf KiB", "busy ms", "p50 us", "p99 us");
+
+	for (slot = 0; slot < mux_metrics_slots(m); slot++) {
+		if (mux_metrics_read(m, slot, &s) != MUX_OK)
+			continue;
+		snprintf(kind, sizeof(kind), "%s %s",
+			 mux_codec_to_name(s.codec_type),
+			 s.decoder ? "dec" : "enc");
+		print_row(s.name[0] ? s.name : "-", kind, &s.counters);
+	}
+
+	if (mux_metrics_read_total(m, &total) == MUX_OK)
+		print_row("total", "", &total);
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"interval",  required_argument, 0, 'i'},
+		{"help",      no_argument,       0, 'h'},
+		{0, 0, 0, 0}
+	};
+	struct mux_metrics *m;
+	int interval = 0;
+	int opt, fd;
+
+	while ((opt = getopt_long(argc, argv, "i:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			interval = atoi(optarg);
+			if (interval <= 0) {
+				fprintf(stderr, "Error: Invalid interval\n");
+				return 1;
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	m = mux_metrics_open(fd);
+	close(fd);
+	if (!m) {
+		fprintf(stderr, "Error: %s is not a metrics page\n",
+			argv[optind]);
+		return 1;
+	}
+
+	for (;;) {
+		print_metrics(m);
+		if (!interval)
+			break;
+		fflush(stdout);
+		sleep((unsigned int)interval);
+		printf("\n");
+	}
+
+	mux_metrics_close(m);
+	return 0;
+}
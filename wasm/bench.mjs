@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+// Encode and decode of a 32-channel stream in multiples of real time:
+// a plain session on the single-threaded module is the baseline, against
+// stereo-pair channel groups on each module (web workers via
+// worker_threads on the threaded one). Only channel-group sessions use
+// the workers; a plain session is no faster on the threaded module.
+// Codecs whose plain encoder can't take 32 channels are measured
+// against single-threaded groups instead, marked with *.
+//
+//   node wasm/bench.mjs [build-dir...]    (default: build build-mt)
+
+import { existsSync } from 'node:fs';
+import { join, resolve } from 'node:path';
+import { performance } from 'node:perf_hooks';
+import { createMuxAudio } from './muxaudio.wrapper.js';
+
+const RATE = 48000;
+const CHANNELS = 32;
+const SECONDS = 5;
+const TICK = RATE / 50;
+const CODECS = ['opus', 'vorbis', 'flac', 'pcm'];
+
+function findBuild(dirs, file) {
+  for (const dir of dirs) {
+    if (existsSync(join(dir, file))) {
+      return resolve(dir);
+    }
+  }
+  return null;
+}
+
+const pcm = new Int16Array(TICK * CHANNELS);
+for (let i = 0; i < TICK; i++) {
+  for (let ch = 0; ch < CHANNELS; ch++) {
+    const f = 220 * (ch + 1);
+    pcm[i * CHANNELS + ch] = Math.round(Math.sin(2 * Math.PI * f * i / RATE) * 8000 +
+      (Math.random() - 0.5) * 2000);
+  }
+}
+
+// threads null: a plain session; undefined: the wrapper's default
+function run(mux, codec, threads) {
+  const grouped = threads !== null;
+  const enc = mux.Encoder(codec, RATE, CHANNELS,
+    grouped ? { channel_groups: 2, threads } : {}, 1);
+  const chunks = [];
+  let t0 = performance.now();
+  for (let t = 0; t < SECONDS * 50; t++) {
+    enc.encode(pcm);
+    chunks.push(enc.read());
+  }
+  chunks.push(enc.finalize());
+  const encMs = performance.now() - t0;
+  enc.destroy();
+
+  const dec = mux.Decoder(codec, grouped ? { channel_groups: 1, threads } : {}, 1);
+  t0 = performance.now();
+  for (const c of chunks) {
+    dec.decode(c);
+    while (dec.read().data.length > 0)
+      ;
+  }
+  dec.finalize();
+  const decMs = performance.now() - t0;
+  dec.destroy();
+
+  return { enc: SECONDS * 1000 / encMs, dec: SECONDS * 1000 / decMs };
+}
+
+async function main() {
+  const dirs = process.argv.length > 2 ? process.argv.slice(2) : ['build', 'build-mt'];
+  const stDir = findBuild(dirs, 'muxaudio.js');
+  const mtDir = findBuild(dirs, 'muxaudio-mt.js');
+
+  if (!stDir || !mtDir) {
+    console.log(`Needs muxaudio.js and muxaudio-mt.js in ${dirs.join(', ')}`);
+    process.exit(1);
+  }
+
+  const st = await createMuxAudio({ path: stDir, threads: false });
+  const mt = await createMuxAudio({ path: mtDir, threads: true });
+
+  console.log(`${CHANNELS} channels, groups in stereo pairs, ${SECONDS} s at ${RATE} Hz\n`);
+  console.log(`${'codec'.padEnd(7)} ${'module'.padEnd(10)} ${'threads'.padStart(7)} | ` +
+    `${'enc x RT'.padStart(9)} ${'dec x RT'.padStart(9)} | ${'speedup'.padStart(7)}`);
+
+  for (const codec of CODECS) {
+    const rows = [];
+    let base;
+    try {
+      base = run(st, codec, null);
+      rows.push(['plain', '1', base]);
+    } catch (e) {
+      base = null;
+    }
+    try {
+      rows.push(['groups', '1', run(st, codec, 1)]);
+    } catch (e) {
+      console.log(`${codec.padEnd(7)} (not available)`);
+      continue;
+    }
+    const mark = base ? ' ' : '*';
+    base = base || rows[0][2];
+    for (const threads of [2, 4, undefined]) {
+      rows.push(['threaded', threads ? String(threads) : 'pool', run(mt, codec, threads)]);
+    }
+    for (const [name, threads, r] of rows) {
+      console.log(`${codec.padEnd(7)} ${name.padEnd(10)} ${threads.padStart(7)} | ` +
+        `${r.enc.toFixed(1).padStart(9)} ${r.dec.toFixed(1).padStart(9)} | ` +
+        `${(r.enc / base.enc).toFixed(2).padStart(6)}${mark}`);
+    }
+  }
+  process.exit(0);
+}
+
+main();
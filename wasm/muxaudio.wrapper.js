@@ -10,15 +10,25 @@ const CODEC_TYPES = {
   vorbis: 2,
   flac: 3,
   mp3: 4,
-  aac: 5
+  aac: 5,
+  alaw: 6,
+  mulaw: 7
 };
 
 // Stream types
 const STREAM_AUDIO = 0;
 const STREAM_SIDE_CHANNEL = 1;
 
+// Module builds: single-threaded, and pthreads on web workers (WASM_THREADS)
+const BUILDS = {
+  st: { file: 'muxaudio.js', factory: 'createMuxAudioWasm' },
+  mt: { file: 'muxaudio-mt.js', factory: 'createMuxAudioWasmMT' }
+};
+
+const isNode = typeof process !== 'undefined' && !!(process.versions && process.versions.node);
+
 export class MuxEncoder {
-  constructor(module, codec, sampleRate, channels, params = {}) {
+  constructor(module, codec, sampleRate, channels, params = {}, numStreams = 2) {
     this.module = module;
     this.sampleRate = sampleRate;
     this.channels = channels;
@@ -35,7 +45,7 @@ export class MuxEncoder {
 
     // Bind C functions
     this._new = module.cwrap('mux_encoder_new', 'number',
-      ['number', 'number', 'number', 'number', 'number']);
+      ['number', 'number', 'number', 'number', 'number', 'number']);
     this._destroy = module.cwrap('mux_encoder_destroy', null, ['number']);
     this._encode = module.cwrap('mux_encoder_encode', 'number',
       ['number', 'number', 'number', 'number', 'number']);
@@ -50,6 +60,7 @@ export class MuxEncoder {
       this.codecType,
       sampleRate,
       channels,
+      numStreams,
       paramsPtr,
       numParams
     );
@@ -116,7 +127,8 @@ export class MuxEncoder {
     const { _malloc, _free } = this.module;
 
     // Determine if input is audio (Int16Array) or side channel (Uint8Array)
-    let inputPtr, numBytes, heap;
+    // Heap views are fetched after _malloc, which may grow memory
+    let inputPtr, numBytes;
 
     if (data instanceof Int16Array || (data.buffer && data.BYTES_PER_ELEMENT === 2)) {
       // Audio data
@@ -132,7 +144,7 @@ export class MuxEncoder {
       throw new Error('Data must be Int16Array (audio) or Uint8Array (side channel)');
     }
 
-    const consumedPtr = _malloc(8);
+    const consumedPtr = _malloc(4);
 
     const result = this._encode(
       this.encoder,
@@ -151,16 +163,16 @@ export class MuxEncoder {
   }
 
   read() {
-    const { _malloc, _free, HEAPU8, getValue } = this.module;
+    const { _malloc, _free, getValue } = this.module;
     const maxSize = 4 * 1024 * 1024; // 4MB buffer
     const outputPtr = _malloc(maxSize);
-    const writtenPtr = _malloc(8);
+    const writtenPtr = _malloc(4);
 
     const result = this._read(this.encoder, outputPtr, maxSize, writtenPtr);
 
     if (result === 0) {
-      const written = getValue(writtenPtr, 'i64');
-      const output = HEAPU8.slice(outputPtr, outputPtr + Number(written));
+      const written = getValue(writtenPtr, 'i32') >>> 0; // size_t
+      const output = this.module.HEAPU8.slice(outputPtr, outputPtr + written);
       _free(outputPtr);
       _free(writtenPtr);
       return output;
@@ -210,7 +222,7 @@ export class MuxEncoder {
 }
 
 export class MuxDecoder {
-  constructor(module, codec, params = {}) {
+  constructor(module, codec, params = {}, numStreams = 2) {
     this.module = module;
 
     // Resolve codec name to type
@@ -225,7 +237,7 @@ export class MuxDecoder {
 
     // Bind C functions
     this._new = module.cwrap('mux_decoder_new', 'number',
-      ['number', 'number', 'number']);
+      ['number', 'number', 'number', 'number']);
     this._destroy = module.cwrap('mux_decoder_destroy', null, ['number']);
     this._decode = module.cwrap('mux_decoder_decode', 'number',
       ['number', 'number', 'number', 'number']);
@@ -234,7 +246,11 @@ export class MuxDecoder {
     this._finalize = module.cwrap('mux_decoder_finalize', 'number', ['number']);
 
     // Create decoder (params usually not needed for decoders)
-    this.decoder = this._new(this.codecType, 0, 0);
+    const { paramsPtr, numParams } = MuxEncoder.prototype._createParams.call(this, params);
+
+    this.decoder = this._new(this.codecType, numStreams, paramsPtr, numParams);
+
+    MuxEncoder.prototype._freeParams.call(this, paramsPtr, numParams);
 
     if (!this.decoder) {
       throw new Error(`Failed to create ${codec} decoder`);
@@ -242,12 +258,12 @@ export class MuxDecoder {
   }
 
   decode(data) {
-    const { _malloc, _free, HEAPU8 } = this.module;
+    const { _malloc, _free } = this.module;
 
     const inputPtr = _malloc(data.length);
-    HEAPU8.set(data, inputPtr);
+    this.module.HEAPU8.set(data, inputPtr);
 
-    const consumedPtr = _malloc(8);
+    const consumedPtr = _malloc(4);
 
     const result = this._decode(
       this.decoder,
@@ -265,10 +281,10 @@ export class MuxDecoder {
   }
 
   read() {
-    const { _malloc, _free, HEAP16, HEAPU8, getValue } = this.module;
+    const { _malloc, _free, getValue } = this.module;
     const maxSize = 4 * 1024 * 1024; // 4MB buffer
     const outputPtr = _malloc(maxSize);
-    const writtenPtr = _malloc(8);
+    const writtenPtr = _malloc(4);
     const streamTypePtr = _malloc(4);
 
     const result = this._read(
@@ -280,17 +296,17 @@ export class MuxDecoder {
     );
 
     if (result === 0) {
-      const written = getValue(writtenPtr, 'i64');
+      const written = getValue(writtenPtr, 'i32') >>> 0; // size_t
       const streamType = getValue(streamTypePtr, 'i32');
 
       let data;
       if (streamType === STREAM_AUDIO) {
         // Audio data - return as Int16Array
-        const samples = Number(written) / 2;
+        const samples = written / 2;
         data = new Int16Array(this.module.HEAP16.buffer, outputPtr, samples).slice();
       } else {
         // Side channel data - return as Uint8Array
-        data = HEAPU8.slice(outputPtr, outputPtr + Number(written));
+        data = this.module.HEAPU8.slice(outputPtr, outputPtr + written);
       }
 
       _free(outputPtr);
@@ -331,29 +347,133 @@ export class MuxDecoder {
   }
 }
 
+// SharedArrayBuffer is what the threaded module needs; browsers only
+// hand it to cross-origin isolated pages (COOP/COEP headers)
+export function threadsSupported() {
+  if (typeof SharedArrayBuffer === 'undefined') return false;
+  if (typeof crossOriginIsolated !== 'undefined') return crossOriginIsolated;
+  return isNode;
+}
+
+// Instantiate the module script at url (a file path in Node), whichever
+// build it is: required in Node, importScripts() in a worker, or a
+// script tag
+async function loadScript(url) {
+  if (isNode) {
+    const { createRequire } = await import('node:module');
+    const { fileURLToPath } = await import('node:url');
+    const require = createRequire(import.meta.url);
+    return require(url.startsWith('file:') ? fileURLToPath(url) : url)();
+  }
+
+  const before = Object.values(BUILDS).filter((b) => globalThis[b.factory]);
+  if (typeof importScripts === 'function') {
+    importScripts(url);
+  } else {
+    await new Promise((resolve, reject) => {
+      const script = document.createElement('script');
+      script.src = url;
+      script.onload = resolve;
+      script.onerror = () => reject(new Error(`Failed to load ${url}`));
+      document.head.appendChild(script);
+    });
+  }
+  const build = Object.values(BUILDS).find((b) =>
+    typeof globalThis[b.factory] === 'function' && !before.includes(b)) ||
+    Object.values(BUILDS).find((b) => typeof globalThis[b.factory] === 'function');
+  if (!build) {
+    throw new Error(`${url} does not define a muxaudio module`);
+  }
+
+  // The .wasm, and the script pthread workers start from, sit next to
+  // the module, not next to whoever loaded it
+  return globalThis[build.factory]({
+    mainScriptUrlOrBlob: url,
+    locateFile: (file) => new URL(file, url).href
+  });
+}
+
+// One of the two builds from a directory, or the factory already on the
+// page
+async function loadModule(build, path) {
+  if (typeof globalThis[build.factory] === 'function' && !path) {
+    return globalThis[build.factory]();
+  }
+
+  if (isNode) {
+    const { resolve } = await import('node:path');
+    const { fileURLToPath } = await import('node:url');
+    return loadScript(path ? resolve(path, build.file) :
+      fileURLToPath(new URL(build.file, import.meta.url)));
+  }
+
+  const base = path ? (path.endsWith('/') ? path : path + '/') : './';
+  return loadScript(new URL(base + build.file,
+    path ? globalThis.location.href : import.meta.url).href);
+}
+
 // Main factory function
-export async function createMuxAudio(wasmPath) {
-  // Load the WASM module
-  let createModule;
+//
+// createMuxAudio(url)  loads the module script at url (muxaudio.js or
+//                      muxaudio-mt.js) as it is
+// createMuxAudio({ path, threads })
+//   options.path    directory (or URL) holding muxaudio.js / muxaudio-mt.js
+//   options.threads 'auto' (default): the threaded module when the page
+//                   can run it and it loads, else the single-threaded one;
+//                   true/false to insist on one of them
+//   options.url     same as passing a string
+//
+// On the threaded module, channel_groups sessions that don't set threads
+// get threads: 0 and so the whole worker pool. Threads only help those
+// sessions: grouping is a different wire format, which the decoder has
+// to be told about too, and a plain encoder or decoder runs on one
+// thread in either module (see "Threaded WASM" in the README).
+export async function createMuxAudio(options = {}) {
+  if (typeof options === 'string') {
+    options = { url: options };
+  }
+  const { path, url, threads = 'auto' } = options;
 
-  if (wasmPath) {
-    // Custom WASM path
-    createModule = await import(wasmPath);
+  let Module = null;
+  let threaded = false;
+
+  if (url) {
+    Module = await loadScript(url);
+    threaded = typeof SharedArrayBuffer !== 'undefined' &&
+      Module.HEAPU8.buffer instanceof SharedArrayBuffer;
   } else {
-    // Try to load from same directory
-    const Module = await createMuxAudioWasm();
-
-    return {
-      Module,
-      Encoder: (codec, sr, ch, params) => new MuxEncoder(Module, codec, sr, ch, params),
-      Decoder: (codec, params) => new MuxDecoder(Module, codec, params),
-
-      // Codec constants
-      CODEC: CODEC_TYPES,
-      STREAM_AUDIO,
-      STREAM_SIDE_CHANNEL
-    };
+    if (threads === true || (threads === 'auto' && threadsSupported())) {
+      try {
+        Module = await loadModule(BUILDS.mt, path);
+        threaded = true;
+      } catch (e) {
+        if (threads === true) {
+          throw e;
+        }
+      }
+    }
+    if (!Module) {
+      Module = await loadModule(BUILDS.st, path);
+    }
   }
+
+  const withThreads = (params = {}) =>
+    threaded && params.channel_groups && params.threads === undefined ?
+      { ...params, threads: 0 } : params;
+
+  return {
+    Module,
+    threaded,
+    Encoder: (codec, sr, ch, params, streams) =>
+      new MuxEncoder(Module, codec, sr, ch, withThreads(params), streams),
+    Decoder: (codec, params, streams) =>
+      new MuxDecoder(Module, codec, withThreads(params), streams),
+
+    // Codec constants
+    CODEC: CODEC_TYPES,
+    STREAM_AUDIO,
+    STREAM_SIDE_CHANNEL
+  };
 }
 
 // Browser global export
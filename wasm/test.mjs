@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+// Headless WASM tests under Node: round trips through each module
+// build found, loaded by directory and by module path, channel groups
+// on the threaded module give the same stream as the single-threaded
+// one, and the wrapper runs inside a worker_threads worker the way it
+// would in a web worker.
+//
+//   node wasm/test.mjs [build-dir...]     (default: build build-mt)
+//
+// Needs Node 20.19 or later; the threaded module is muxaudio-mt.js from
+// a -DWASM_THREADS=ON build.
+
+import { existsSync } from 'node:fs';
+import { join, resolve } from 'node:path';
+import { Worker, isMainThread, parentPort, workerData } from 'node:worker_threads';
+import { createMuxAudio } from './muxaudio.wrapper.js';
+
+const RATE = 48000;
+const CHANNELS = 16;
+const FRAMES = RATE; // 1 s
+
+function findBuild(dirs, file) {
+  for (const dir of dirs) {
+    if (existsSync(join(dir, file))) {
+      return resolve(dir);
+    }
+  }
+  return null;
+}
+
+function makePcm(frames, channels) {
+  const pcm = new Int16Array(frames * channels);
+  for (let i = 0; i < pcm.length; i++) {
+    pcm[i] = ((i * 2731) % 24000) - 12000;
+  }
+  return pcm;
+}
+
+function concat(chunks) {
+  const out = new Uint8Array(chunks.reduce((n, c) => n + c.length, 0));
+  let pos = 0;
+  for (const c of chunks) {
+    out.set(c, pos);
+    pos += c.length;
+  }
+  return out;
+}
+
+function encode(mux, codec, pcm, channels, params) {
+  const enc = mux.Encoder(codec, RATE, channels, params);
+  const chunks = [];
+  const tick = (RATE / 50) * channels;
+  try {
+    for (let pos = 0; pos < pcm.length; pos += tick) {
+      enc.encode(pcm.subarray(pos, pos + tick));
+      chunks.push(enc.read());
+    }
+    chunks.push(enc.finalize());
+  } finally {
+    enc.destroy();
+  }
+  return concat(chunks);
+}
+
+function decodeAudio(mux, codec, stream, params) {
+  const dec = mux.Decoder(codec, params);
+  const parts = [];
+  try {
+    dec.decode(stream);
+    for (const out of dec.finalize()) {
+      if (out.streamType === mux.STREAM_AUDIO) {
+        parts.push(out.data);
+      }
+    }
+  } finally {
+    dec.destroy();
+  }
+  const pcm = new Int16Array(parts.reduce((n, p) => n + p.length, 0));
+  let pos = 0;
+  for (const p of parts) {
+    pcm.set(p, pos);
+    pos += p.length;
+  }
+  return pcm;
+}
+
+function equal(a, b) {
+  if (a.length !== b.length) return false;
+  for (let i = 0; i < a.length; i++) {
+    if (a[i] !== b[i]) return false;
+  }
+  return true;
+}
+
+// No threads: the wrapper puts the groups on all the workers there are
+// in the threaded module
+const groupParams = { channel_groups: 2 };
+const groupDecodeParams = { channel_groups: 1 };
+
+async function testRoundTrip(name, dir, threads) {
+  console.log(`Test: PCM round trip, ${name} module`);
+  if (!dir) {
+    console.log('  SKIP (not built)');
+    return 0;
+  }
+
+  const mux = await createMuxAudio({ path: dir, threads });
+  const pcm = makePcm(FRAMES, 2);
+  const out = decodeAudio(mux, 'pcm', encode(mux, 'pcm', pcm, 2, {}), {});
+  if (mux.threaded !== threads || !equal(pcm, out)) {
+    console.log('  FAIL: Decoded audio differs');
+    return -1;
+  }
+  console.log(`  PASS: ${out.length} samples`);
+  return 0;
+}
+
+async function testModuleUrl(dir, file, threads) {
+  console.log(`Test: Loading ${file} by its own path`);
+  if (!dir) {
+    console.log('  SKIP (not built)');
+    return 0;
+  }
+
+  const mux = await createMuxAudio(join(dir, file));
+  const pcm = makePcm(FRAMES / 10, 2);
+  const out = decodeAudio(mux, 'pcm', encode(mux, 'pcm', pcm, 2, {}), {});
+  if (mux.threaded !== threads || !equal(pcm, out)) {
+    console.log(`  FAIL: threaded ${mux.threaded}, or decoded audio differs`);
+    return -1;
+  }
+  console.log(`  PASS: threaded: ${mux.threaded}`);
+  return 0;
+}
+
+async function testGroups(stDir, mtDir) {
+  console.log('Test: Channel groups on workers match the single-threaded stream');
+  if (!stDir || !mtDir) {
+    console.log('  SKIP (needs both builds)');
+    return 0;
+  }
+
+  const st = await createMuxAudio({ path: stDir, threads: false });
+  const mt = await createMuxAudio({ path: mtDir, threads: true });
+  const pcm = makePcm(FRAMES, CHANNELS);
+  const a = encode(st, 'pcm', pcm, CHANNELS, groupParams);
+  const b = encode(mt, 'pcm', pcm, CHANNELS, groupParams);
+  const out = decodeAudio(mt, 'pcm', b, groupDecodeParams);
+
+  if (!equal(a, b) || !equal(pcm, out)) {
+    console.log('  FAIL: Threaded stream or audio differs');
+    return -1;
+  }
+  console.log(`  PASS: ${b.length} bytes, ${CHANNELS} channels in pairs`);
+  return 0;
+}
+
+async function testInWorker(dir) {
+  console.log('Test: Wrapper inside a worker thread');
+  if (!dir) {
+    console.log('  SKIP (not built)');
+    return 0;
+  }
+
+  const result = await new Promise((resolveResult, reject) => {
+    const worker = new Worker(new URL(import.meta.url), { workerData: { dir } });
+    worker.once('message', resolveResult);
+    worker.once('error', reject);
+  });
+  if (!result.ok) {
+    console.log(`  FAIL: ${result.error}`);
+    return -1;
+  }
+  console.log(`  PASS: ${result.samples} samples, threaded: ${result.threaded}`);
+  return 0;
+}
+
+// Worker side of testInWorker: 'auto' picks the best build there is
+async function workerMain() {
+  try {
+    const mux = await createMuxAudio({ path: workerData.dir });
+    const channels = mux.threaded ? CHANNELS : 2;
+    const pcm = makePcm(FRAMES / 10, channels);
+    const out = mux.threaded ?
+      decodeAudio(mux, 'pcm', encode(mux, 'pcm', pcm, channels, groupParams),
+        groupDecodeParams) :
+      decodeAudio(mux, 'pcm', encode(mux, 'pcm', pcm, channels, {}), {});
+    parentPort.postMessage({ ok: equal(pcm, out), samples: out.length,
+      threaded: mux.threaded, error: 'Decoded audio differs' });
+  } catch (e) {
+    parentPort.postMessage({ ok: false, error: e.message });
+  }
+}
+
+async function main() {
+  const dirs = process.argv.length > 2 ? process.argv.slice(2) : ['build', 'build-mt'];
+  const stDir = findBuild(dirs, 'muxaudio.js');
+  const mtDir = findBuild(dirs, 'muxaudio-mt.js');
+  let failures = 0;
+
+  console.log('WASM Tests');
+  console.log('==========\n');
+
+  if (!stDir && !mtDir) {
+    console.log(`No muxaudio.js or muxaudio-mt.js in ${dirs.join(', ')}`);
+    process.exit(1);
+  }
+
+  if (await testRoundTrip('single-threaded', stDir, false) !== 0) failures++;
+  if (await testRoundTrip('threaded', mtDir, true) !== 0) failures++;
+  if (await testModuleUrl(stDir, 'muxaudio.js', false) !== 0) failures++;
+  if (await testModuleUrl(mtDir, 'muxaudio-mt.js', true) !== 0) failures++;
+  if (await testGroups(stDir, mtDir) !== 0) failures++;
+  if (await testInWorker(mtDir || stDir) !== 0) failures++;
+
+  if (failures === 0) {
+    console.log('\nAll tests passed!');
+    process.exit(0);
+  }
+  console.log(`\n${failures} test(s) failed.`);
+  process.exit(1);
+}
+
+if (isMainThread) {
+  main();
+} else {
+  workerMain();
+}